@@ -0,0 +1,234 @@
+#include "accesslog.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define ACCESS_LOG_RING_SIZE 2048 /* Entries per thread, a power of two. */
+#define ACCESS_LOG_BUFFER_SIZE 65536
+#define ACCESS_LOG_LINE_MAX 512
+#define ACCESS_LOG_IDLE_NS 10000000 /* Writer's nap when every ring is empty. */
+
+/* Filled by the thread that owns it, drained by the writer. */
+struct access_log_ring {
+  struct access_log_entry entries[ACCESS_LOG_RING_SIZE];
+  uint64_t head;    /* Next entry to fill; written by the owner only. */
+  uint64_t tail;    /* Next entry to drain; written by the writer only. */
+  uint64_t dropped; /* Entries that found the ring full. */
+  struct access_log_ring* next;      /* In all_rings. */
+  struct access_log_ring* next_free; /* In free_rings, once its thread exits. */
+};
+
+static int log_fd = -1;
+
+/* Every ring ever handed out, and those of exited threads, as in stats.c. */
+static struct access_log_ring* all_rings;
+static struct access_log_ring* free_rings;
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ring_key;
+static __thread struct access_log_ring* local;
+
+/* The writer of this process, started by the first entry logged. */
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t writer;
+static bool writer_running, writer_stopping;
+static uint64_t dropped_reported;
+
+static void access_log_ring_exit(void* block) {
+  struct access_log_ring* ring = block;
+  pthread_mutex_lock(&rings_lock);
+  ring->next_free = free_rings;
+  free_rings = ring;
+  pthread_mutex_unlock(&rings_lock);
+}
+
+/* Hands out this thread's ring. A reused ring keeps its unwritten entries,
+ * which the writer still drains. */
+static struct access_log_ring* access_log_local(void) {
+  if (local) return local;
+
+  pthread_mutex_lock(&rings_lock);
+  if (free_rings) {
+    local = free_rings;
+    free_rings = local->next_free;
+  } else {
+    local = calloc(1, sizeof(*local));
+    if (!local) {
+      fprintf(stderr, "Malloc failed\n");
+      exit(1);
+    }
+    /* Published with a release store; the writer walks the list without the
+     * lock. */
+    local->next = all_rings;
+    __atomic_store_n(&all_rings, local, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&rings_lock);
+  pthread_setspecific(ring_key, local);
+  return local;
+}
+
+/* Appends the line for ENTRY to BUFFER, which has room for at least
+ * ACCESS_LOG_LINE_MAX bytes. Returns its length. The format is the Common
+ * Log Format with the latency in microseconds added. */
+static int access_log_format(char* buffer, struct access_log_entry* entry) {
+  char peer[INET_ADDRSTRLEN] = "-";
+  if (entry->peer.sin_family == AF_INET)
+    inet_ntop(AF_INET, &entry->peer.sin_addr, peer, sizeof(peer));
+
+  char date[32];
+  struct tm tm;
+  gmtime_r(&entry->time.tv_sec, &tm);
+  strftime(date, sizeof(date), "%d/%b/%Y:%H:%M:%S +0000", &tm);
+
+  /* Keep the line a line: clients choose the path. */
+  char path[ACCESS_LOG_PATH_SIZE];
+  size_t i;
+  for (i = 0; i + 1 < sizeof(path) && entry->path[i]; i++) {
+    char c = entry->path[i];
+    path[i] = c < 0x20 || c == 0x7f || c == '"' ? '?' : c;
+  }
+  path[i] = '\0';
+
+  return snprintf(buffer, ACCESS_LOG_LINE_MAX,
+                  "%s - - [%s] \"%s %s\" %d %llu %lluus\n", peer, date,
+                  entry->method, path, entry->status_code,
+                  (unsigned long long)entry->bytes,
+                  (unsigned long long)(entry->latency_ns / 1000));
+}
+
+static void access_log_write(char* buffer, size_t length) {
+  while (length > 0) {
+    ssize_t written = write(log_fd, buffer, length);
+    if (written < 0 && errno == EINTR) continue;
+    if (written <= 0) return;
+    buffer += written;
+    length -= written;
+  }
+}
+
+/* Writes out everything queued in every ring. Returns the number of entries
+ * written. Only one thread at a time may drain. */
+static int access_log_drain(char* buffer) {
+  size_t length = 0;
+  int drained = 0;
+  uint64_t dropped = 0;
+  for (struct access_log_ring* ring =
+           __atomic_load_n(&all_rings, __ATOMIC_ACQUIRE);
+       ring; ring = ring->next) {
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = ring->tail;
+    for (; tail != head; tail++, drained++) {
+      if (length + ACCESS_LOG_LINE_MAX > ACCESS_LOG_BUFFER_SIZE) {
+        access_log_write(buffer, length);
+        length = 0;
+      }
+      length += access_log_format(
+          buffer + length, &ring->entries[tail % ACCESS_LOG_RING_SIZE]);
+    }
+    /* Frees the slots for the owner. */
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    dropped += __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+  }
+
+  if (dropped > dropped_reported) {
+    length += snprintf(buffer + length, ACCESS_LOG_LINE_MAX,
+                       "# access log full, dropped %llu entries\n",
+                       (unsigned long long)(dropped - dropped_reported));
+    dropped_reported = dropped;
+  }
+  if (length > 0) access_log_write(buffer, length);
+  return drained;
+}
+
+static void* access_log_writer(void* arg) {
+  char* buffer = arg;
+  while (!__atomic_load_n(&writer_stopping, __ATOMIC_ACQUIRE)) {
+    if (access_log_drain(buffer) == 0) {
+      struct timespec idle = {0, ACCESS_LOG_IDLE_NS};
+      nanosleep(&idle, NULL);
+    }
+  }
+  return NULL;
+}
+
+static void access_log_start_writer(void) {
+  pthread_mutex_lock(&writer_lock);
+  if (!writer_running) {
+    char* buffer = malloc(ACCESS_LOG_BUFFER_SIZE);
+    if (!buffer || pthread_create(&writer, NULL, access_log_writer, buffer)) {
+      fprintf(stderr, "Failed to start the access log writer\n");
+      exit(1);
+    }
+    __atomic_store_n(&writer_running, true, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&writer_lock);
+}
+
+/* Stops the writer, if this process has one, and writes what is left. */
+static void access_log_exit(void) {
+  static char buffer[ACCESS_LOG_BUFFER_SIZE];
+  pthread_mutex_lock(&writer_lock);
+  if (writer_running) {
+    __atomic_store_n(&writer_stopping, true, __ATOMIC_RELEASE);
+    pthread_join(writer, NULL);
+    writer_running = false;
+  }
+  access_log_drain(buffer);
+  pthread_mutex_unlock(&writer_lock);
+}
+
+/* A forked child has no writer, and leaves what is queued to its parent. It
+ * may have been forked while another thread held either lock. */
+static void access_log_forked(void) {
+  pthread_mutex_init(&rings_lock, NULL);
+  pthread_mutex_init(&writer_lock, NULL);
+  writer_running = writer_stopping = false;
+  for (struct access_log_ring* ring = all_rings; ring; ring = ring->next)
+    ring->tail = ring->head;
+}
+
+void access_log_init(int fd) {
+  log_fd = fd;
+  if (fd == -1) return;
+  pthread_key_create(&ring_key, access_log_ring_exit);
+  pthread_atfork(NULL, NULL, access_log_forked);
+  atexit(access_log_exit);
+}
+
+bool access_log_enabled(void) { return log_fd != -1; }
+
+void access_log_begin(struct access_log_entry* entry, struct sockaddr_in* peer,
+                      struct http_request* request) {
+  if (log_fd == -1) return;
+  clock_gettime(CLOCK_REALTIME_COARSE, &entry->time);
+  if (peer)
+    entry->peer = *peer;
+  else
+    memset(&entry->peer, 0, sizeof(entry->peer));
+  snprintf(entry->method, sizeof(entry->method), "%s",
+           request ? request->method : "-");
+  snprintf(entry->path, sizeof(entry->path), "%s",
+           request ? request->path : "-");
+  entry->status_code = 0;
+  entry->bytes = entry->latency_ns = 0;
+}
+
+void access_log_end(struct access_log_entry* entry) {
+  if (log_fd == -1) return;
+  if (!__atomic_load_n(&writer_running, __ATOMIC_ACQUIRE))
+    access_log_start_writer();
+
+  struct access_log_ring* ring = access_log_local();
+  uint64_t head = ring->head;
+  if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) ==
+      ACCESS_LOG_RING_SIZE) {
+    __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+    return;
+  }
+  ring->entries[head % ACCESS_LOG_RING_SIZE] = *entry;
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,51 @@
+/*
+ * Access log for --files mode: one line per response, with the client, the
+ * request line, status, bytes sent and latency (--access-log FILE, stdout by
+ * default, "off" for none).
+ *
+ * A thread that answers a request copies its entry into a ring of its own,
+ * which takes no lock and makes no system call. A background writer thread
+ * drains every ring into one buffer and write()s it out in large batches. If
+ * a ring fills up before the writer gets to it, the entry is dropped and
+ * counted rather than making the server wait on the log; the writer notes
+ * how many were lost.
+ *
+ * The writer is started in each process that logs, so forkserver children
+ * log too. Whatever is still queued is written when the process exits.
+ */
+
+#ifndef ACCESSLOG_H
+#define ACCESSLOG_H
+
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "libhttp.h"
+
+#define ACCESS_LOG_PATH_SIZE 128
+
+struct access_log_entry {
+  struct timespec time;    /* When the request was read. */
+  struct sockaddr_in peer; /* All zero if the client is not known. */
+  char method[8];
+  char path[ACCESS_LOG_PATH_SIZE]; /* Truncated if need be. */
+  int status_code;
+  uint64_t bytes;      /* Of the response, headers included. */
+  uint64_t latency_ns; /* From the parsed request to the response sent. */
+};
+
+/* Logs to FD, or nowhere if FD is -1. */
+void access_log_init(int fd);
+bool access_log_enabled(void);
+
+/* Fills in the time, client and request line of ENTRY, for REQUEST from PEER
+ * (which may be NULL). REQUEST need not outlive the call. */
+void access_log_begin(struct access_log_entry* entry, struct sockaddr_in* peer,
+                      struct http_request* request);
+
+/* Queues ENTRY, once its status, bytes and latency are filled in. */
+void access_log_end(struct access_log_entry* entry);
+
+#endif
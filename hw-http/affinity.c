@@ -0,0 +1,110 @@
+#define _GNU_SOURCE /* sched_getaffinity(), pthread_setaffinity_np() */
+#include "affinity.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define AFFINITY_MAX_NODES 64
+
+static int* cpus; /* The slot list. */
+static int num_cpus;
+
+/* Marks the CPUs of the kernel cpulist LIST ("0-3,8,10-11") in NODE_CPUS. */
+static void affinity_parse_cpulist(char* list, cpu_set_t* node_cpus) {
+  char* rest = list;
+  while (*rest) {
+    char* end;
+    long first = strtol(rest, &end, 10), last = first;
+    if (end == rest) break;
+    if (*end == '-') last = strtol(end + 1, &end, 10);
+    for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+      CPU_SET(cpu, node_cpus);
+    rest = *end == ',' ? end + 1 : end;
+    if (*rest == '\n') break;
+  }
+}
+
+/* Reads which CPUs belong to which node into NODES; returns the number of
+ * nodes found, 0 if the system does not say. */
+static int affinity_read_nodes(cpu_set_t* nodes) {
+  int num_nodes = 0;
+  for (int node = 0; node < AFFINITY_MAX_NODES; node++) {
+    char path[64], list[1024];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+             node);
+    FILE* file = fopen(path, "r");
+    if (!file) continue;
+    CPU_ZERO(&nodes[num_nodes]);
+    if (fgets(list, sizeof(list), file))
+      affinity_parse_cpulist(list, &nodes[num_nodes]);
+    fclose(file);
+    if (CPU_COUNT(&nodes[num_nodes]) > 0) num_nodes++;
+  }
+  return num_nodes;
+}
+
+void affinity_init(enum affinity_policy policy) {
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) {
+    perror("Failed to read the CPU affinity, not pinning");
+    return;
+  }
+
+  static cpu_set_t nodes[AFFINITY_MAX_NODES];
+  int num_nodes = affinity_read_nodes(nodes);
+  if (num_nodes == 0) {
+    /* One node holding every CPU. */
+    CPU_ZERO(&nodes[0]);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) CPU_SET(cpu, &nodes[0]);
+    num_nodes = 1;
+  }
+  for (int node = 0; node < num_nodes; node++)
+    CPU_AND(&nodes[node], &nodes[node], &allowed);
+
+  cpus = malloc(CPU_COUNT(&allowed) * sizeof(int));
+  if (!cpus) {
+    fprintf(stderr, "Malloc failed\n");
+    exit(1);
+  }
+
+  /* Compact takes each node's CPUs in turn; spread takes the next CPU of
+   * every node in turn. A CPU the system lists in no node comes last. */
+  int next[AFFINITY_MAX_NODES] = {0};
+  bool added = true;
+  while (added) {
+    added = false;
+    for (int node = 0; node < num_nodes; node++) {
+      for (int cpu = next[node]; cpu < CPU_SETSIZE; cpu++) {
+        next[node] = cpu + 1;
+        if (!CPU_ISSET(cpu, &nodes[node]) || !CPU_ISSET(cpu, &allowed))
+          continue;
+        CPU_CLR(cpu, &allowed);
+        cpus[num_cpus++] = cpu;
+        added = true;
+        if (policy == AFFINITY_SPREAD) break;
+      }
+    }
+  }
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    if (CPU_ISSET(cpu, &allowed)) cpus[num_cpus++] = cpu;
+}
+
+bool affinity_enabled(void) { return num_cpus > 0; }
+
+int affinity_cpu(int slot) {
+  return num_cpus > 0 ? cpus[slot % num_cpus] : -1;
+}
+
+void affinity_pin(int slot) {
+  if (num_cpus == 0) return;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(affinity_cpu(slot), &set);
+  int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (error != 0)
+    fprintf(stderr, "Failed to pin to CPU %d: %s\n", affinity_cpu(slot),
+            strerror(error));
+}
@@ -0,0 +1,39 @@
+/*
+ * CPU placement for --pin-workers.
+ *
+ * The CPUs the server may run on are put in a list, and each thread that
+ * serves connections is pinned to one slot of it: acceptor I (its event loop,
+ * for epollserver and uringserver) to slot I, worker J of acceptor I's pool
+ * to slot I + J * acceptors, and --prefork child I to slot I. Slots wrap
+ * around the list. A pinned thread allocates its stack and buffers after it
+ * is pinned, so the kernel's first-touch policy puts them on its own NUMA
+ * node.
+ *
+ * The list is ordered by NUMA node (from /sys/devices/system/node): with
+ * --numa compact, node by node, so consecutive slots share a node and its
+ * caches; with --numa spread, one CPU of each node in turn, so the load and
+ * memory traffic are shared by every node.
+ */
+
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <stdbool.h>
+
+enum affinity_policy {
+  AFFINITY_COMPACT,
+  AFFINITY_SPREAD,
+};
+
+/* Builds the list of CPUs this process may run on, in POLICY's order. */
+void affinity_init(enum affinity_policy policy);
+bool affinity_enabled(void);
+
+/* Returns the CPU of SLOT, or -1 if pinning is not enabled. */
+int affinity_cpu(int slot);
+
+/* Pins the calling thread to the CPU of SLOT, if pinning is enabled. Prints
+ * a warning and leaves the thread floating if it cannot. */
+void affinity_pin(int slot);
+
+#endif
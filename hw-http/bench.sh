@@ -0,0 +1,41 @@
+#!/bin/bash
+#
+# Benchmarks each server variant with loadgen and prints one JSON object per
+# run, e.g.
+#
+#     make bench
+#     VARIANTS="poolserver threadserver" LOADGEN_ARGS="--pipeline 8" make bench
+#
+# Environment:
+#   VARIANTS      servers to run (default: every variant built by the Makefile)
+#   SERVER_ARGS   extra server options (default: --num-threads 8)
+#   LOADGEN_ARGS  extra loadgen options, see ./loadgen --help
+#   BENCH_PORT    port to benchmark on (default: 8100)
+#   BENCH_PATHS   paths to request (default: / and a small text file)
+
+cd "$(dirname "$0")"
+
+VARIANTS=${VARIANTS:-"httpserver forkserver threadserver poolserver epollserver uringserver"}
+SERVER_ARGS=${SERVER_ARGS:-"--num-threads 8"}
+BENCH_PORT=${BENCH_PORT:-8100}
+BENCH_PATHS=${BENCH_PATHS:-"/ /my_documents/credit.txt"}
+
+for variant in $VARIANTS; do
+  ./"$variant" --files www --port "$BENCH_PORT" $SERVER_ARGS >/dev/null 2>&1 &
+  server=$!
+
+  # Wait until the server accepts connections.
+  for _ in $(seq 50); do
+    (exec 3<>"/dev/tcp/127.0.0.1/$BENCH_PORT") 2>/dev/null && break
+    sleep 0.1
+  done
+
+  for path in $BENCH_PATHS; do
+    ./loadgen --port "$BENCH_PORT" --path "$path" --json --label "$variant" \
+      $LOADGEN_ARGS
+  done
+
+  kill "$server"
+  wait "$server" 2>/dev/null
+done
+exit 0
@@ -0,0 +1,156 @@
+#!/bin/bash
+#
+# Runs every server variant under the same load profiles and prints one table
+# of throughput, latency percentiles, CPU and memory, e.g.
+#
+#     make compare
+#     VARIANTS="poolserver epollserver" PROFILES="small proxy" make compare
+#
+# Each (variant, profile) pair gets a freshly started server, driven by one
+# loadgen run with the same options. CPU is the server's user + system time,
+# its reaped children's included (forkserver), as a percentage of one core
+# over the run. RSS is the peak of the server's resident set plus its live
+# children's, sampled every 0.2 s.
+#
+# Profiles:
+#   small    a short text file
+#   large    a 4 MB file of random bytes
+#   listing  a directory without index.html
+#   proxy    the small file, through the variant in --proxy mode in front of
+#            a poolserver serving the files
+#
+# Environment:
+#   VARIANTS      servers to run (default: every variant built by the Makefile)
+#   PROFILES      profiles to run (default: all of the above)
+#   SERVER_ARGS   extra server options (default: --num-threads 8)
+#   LOADGEN_ARGS  extra loadgen options, see ./loadgen --help
+#   BENCH_PORT    port of the server under test (default: 8100); the proxy
+#                 profile's upstream listens on the next one
+
+cd "$(dirname "$0")"
+
+VARIANTS=${VARIANTS:-"httpserver forkserver threadserver poolserver epollserver uringserver"}
+PROFILES=${PROFILES:-"small large listing proxy"}
+SERVER_ARGS=${SERVER_ARGS:-"--num-threads 8"}
+BENCH_PORT=${BENCH_PORT:-8100}
+UPSTREAM_PORT=$((BENCH_PORT + 1))
+TICKS=$(getconf CLK_TCK)
+
+# The files served, so that the large file need not live in www.
+ROOT=$(mktemp -d)
+trap 'rm -rf "$ROOT"' EXIT
+cp -r www/. "$ROOT"
+head -c $((4 * 1024 * 1024)) /dev/urandom >"$ROOT/large.bin"
+
+# Waits until something accepts connections on port $1. Fails if nothing
+# does within 5 s.
+wait_for_port() {
+  for _ in $(seq 50); do
+    (exec 3<>"/dev/tcp/127.0.0.1/$1") 2>/dev/null && return 0
+    sleep 0.1
+  done
+  return 1
+}
+
+# Prints the CPU time, in clock ticks, that process $1 and its reaped children
+# have used.
+cpu_ticks() {
+  # The fields after the command name, which may hold spaces.
+  local stat
+  stat=$(cat "/proc/$1/stat" 2>/dev/null) || { echo 0; return; }
+  set -- ${stat##*) }
+  echo $((${12} + ${13} + ${14} + ${15}))
+}
+
+# Prints the resident set, in kB, of process $1 and its children.
+rss_kb() {
+  local total=0 pid kb
+  for pid in "$1" $(pgrep -P "$1"); do
+    kb=$(sed -n 's/^VmRSS:[[:space:]]*\([0-9]*\).*/\1/p' "/proc/$pid/status" \
+      2>/dev/null)
+    total=$((total + ${kb:-0}))
+  done
+  echo "$total"
+}
+
+# Prints the number after "$1": in the JSON object on standard input.
+json_field() {
+  sed -n "s/.*\"$1\":\([0-9.]*\).*/\1/p"
+}
+
+# Stops process $1 and waits for it.
+stop() {
+  kill "$1" 2>/dev/null
+  wait "$1" 2>/dev/null
+}
+
+printf "%-13s %-8s %10s %9s %9s %9s %9s %7s %9s %7s\n" variant profile \
+  "req/s" "p50(us)" "p90(us)" "p99(us)" "p99.9(us)" "cpu%" "rss(MB)" errors
+
+upstream=
+if [[ " $PROFILES " == *" proxy "* ]]; then
+  ./poolserver --files "$ROOT" --port "$UPSTREAM_PORT" --num-threads 8 \
+    >/dev/null 2>&1 &
+  upstream=$!
+  wait_for_port "$UPSTREAM_PORT" || echo "upstream poolserver did not start" >&2
+fi
+
+for variant in $VARIANTS; do
+  for profile in $PROFILES; do
+    source=(--files "$ROOT")
+    case $profile in
+      small) path=/my_documents/credit.txt ;;
+      large) path=/large.bin ;;
+      listing) path=/my_documents/ ;;
+      proxy)
+        path=/my_documents/credit.txt
+        source=(--proxy "127.0.0.1:$UPSTREAM_PORT")
+        ;;
+      *)
+        echo "unknown profile: $profile" >&2
+        continue
+        ;;
+    esac
+
+    ./"$variant" "${source[@]}" --port "$BENCH_PORT" $SERVER_ARGS \
+      >/dev/null 2>&1 &
+    server=$!
+    if ! wait_for_port "$BENCH_PORT" || ! kill -0 "$server" 2>/dev/null; then
+      printf "%-13s %-8s %10s\n" "$variant" "$profile" "(did not start)"
+      stop "$server"
+      continue
+    fi
+
+    result=$ROOT/result.json
+    start_ticks=$(cpu_ticks "$server")
+    ./loadgen --port "$BENCH_PORT" --path "$path" --json --label "$variant" \
+      $LOADGEN_ARGS >"$result" &
+    loadgen=$!
+    peak=0
+    while kill -0 "$loadgen" 2>/dev/null; do
+      rss=$(rss_kb "$server")
+      ((rss > peak)) && peak=$rss
+      sleep 0.2
+    done
+    wait "$loadgen"
+    end_ticks=$(cpu_ticks "$server")
+    stop "$server"
+
+    duration=$(json_field duration_s <"$result")
+    if [ -z "$duration" ]; then
+      printf "%-13s %-8s %10s\n" "$variant" "$profile" "(loadgen failed)"
+      continue
+    fi
+    cpu=$(awk -v t=$((end_ticks - start_ticks)) -v hz="$TICKS" \
+      -v s="$duration" 'BEGIN { printf "%.0f", 100 * t / hz / s }')
+    printf "%-13s %-8s %10s %9s %9s %9s %9s %7s %9s %7s\n" "$variant" \
+      "$profile" "$(json_field rps <"$result")" \
+      "$(json_field p50 <"$result")" "$(json_field p90 <"$result")" \
+      "$(json_field p99 <"$result")" "$(json_field p99.9 <"$result")" \
+      "$cpu" "$(awk -v kb="$peak" 'BEGIN { printf "%.1f", kb / 1024 }')" \
+      "$(json_field errors <"$result")"
+  done
+done
+
+[ -n "$upstream" ] && stop "$upstream"
+exit 0
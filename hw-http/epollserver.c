@@ -0,0 +1,627 @@
+/*
+ * Event-loop server variant (EPOLLSERVER).
+ *
+ * A single thread owns every connection. Sockets are non-blocking and
+ * registered edge-triggered with epoll; each connection carries a small state
+ * machine so that a request which cannot make progress (the client has not
+ * sent its headers yet, the socket buffer is full, the proxy target has not
+ * answered) simply waits for the next readiness event instead of pinning a
+ * thread.
+ *
+ * In files mode connections are persistent: once a response is sent the
+ * connection goes back to reading, and requests already buffered (pipelined)
+ * are answered right away.
+ *
+ * Every connection has one timer in the loop's timer wheel: a files-mode
+ * connection is closed once it has been idle for server_idle_timeout seconds,
+ * or has taken server_request_timeout seconds to send the headers of a
+ * request, however it trickles them in. A proxied one gets
+ * server_request_timeout to reach the target and is closed after
+ * server_proxy_timeout seconds without traffic.
+ *
+ * With --io-threads N, the opening, stat()ing and caching of the file a
+ * request names is done on the I/O pool (iopool.h) rather than by the loop,
+ * and the connection waits in CONN_PREPARE, without a timer, until a pool
+ * thread is done with it. The first megabyte of the body is read ahead on the
+ * pool as well, so that sendfile() seldom has to wait for the disk.
+ *
+ * When a reload drains the server, the loop stops accepting, closes each
+ * connection after the response in progress, and returns once none is left.
+ */
+
+#ifdef EPOLLSERVER
+
+#define _GNU_SOURCE /* accept4() */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "accesslog.h"
+#include "httpserver.h"
+#include "iopool.h"
+#include "libhttp.h"
+#include "proxypool.h"
+#include "reload.h"
+#include "response.h"
+#include "stats.h"
+#include "timerwheel.h"
+
+#define EPOLL_MAX_EVENTS 256
+#define FILE_CHUNK_SIZE 16384
+#define RELAY_BUFFER_SIZE 16384
+#define IO_READAHEAD_SIZE (1 << 20)
+
+enum conn_state {
+  CONN_READ_REQUEST,  /* Accumulating the request line and headers. */
+  CONN_PREPARE,       /* The I/O pool is building the response. */
+  CONN_SEND_RESPONSE, /* Draining the output buffer, then the file body. */
+  CONN_PROXY_CONNECT, /* Waiting for the non-blocking connect() to finish. */
+  CONN_PROXY_RELAY,   /* Relaying bytes between client and proxy target. */
+  CONN_DONE,          /* Closed; freed once the current batch is handled. */
+};
+
+struct conn;
+
+/* What epoll hands back to us: one socket of one connection. */
+struct conn_endpoint {
+  struct conn* conn;
+  int fd;
+};
+
+/* Bytes read from one side of a proxied connection, not yet written out. */
+struct relay {
+  char buf[RELAY_BUFFER_SIZE];
+  size_t start, end;
+  bool eof; /* The source side has no more data. */
+};
+
+struct conn {
+  enum conn_state state;
+  struct conn_endpoint client;
+  struct conn_endpoint target; /* Proxy target, fd is -1 in files mode. */
+
+  /* Buffered request bytes; may hold several pipelined requests. */
+  struct http_reader reader;
+  struct response response;
+
+  /* The request handed to the I/O pool; it points into reader. */
+  struct http_request request;
+  struct io_job io;
+
+  /* Stage timings of the current request, recorded once it is sent. */
+  uint64_t request_started, parse_ns, send_ns;
+  struct sockaddr_in peer;
+  struct access_log_entry log_entry;
+
+  struct relay* to_target; /* client -> proxy target */
+  struct relay* to_client; /* proxy target -> client */
+  struct proxy_upstream* upstream; /* The proxy target, once picked. */
+  int proxy_tries;                 /* Upstreams picked so far. */
+
+  /* The connection's deadline. A deadline for the request is armed once;
+   * an idle timeout is pushed back by every event. */
+  struct timer timer;
+  bool deadline;
+
+  struct conn* next_closed;
+};
+
+/* With --acceptors N there are N loops, each on its own thread and with its
+ * own copy of this state. */
+static __thread int epoll_fd;
+static __thread bool proxy_mode;
+
+/* Connections closed during the current batch of events. */
+static __thread struct conn* closed_conns;
+static __thread int open_conns;
+
+static __thread struct timer_wheel timers;
+
+/* With --io-threads, the loop's completions. Their eventfd is marked in epoll
+ * by an endpoint without a connection. */
+static __thread struct io_completions completions;
+static __thread struct conn_endpoint completions_endpoint;
+
+static void set_nonblocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static void watch_endpoint(struct conn_endpoint* endpoint) {
+  struct epoll_event event;
+  event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+  event.data.ptr = endpoint;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, endpoint->fd, &event) == -1)
+    perror("Failed to add socket to epoll");
+}
+
+/*
+ * Closes every descriptor owned by C. The structure itself stays alive until
+ * the end of the current batch, since later events in the same batch may
+ * still point at it.
+ */
+static void conn_close(struct conn* c) {
+  if (c->state == CONN_DONE) return;
+  c->state = CONN_DONE;
+
+  close(c->client.fd);
+  if (c->target.fd != -1) close(c->target.fd);
+  response_free(&c->response);
+  timer_cancel(&timers, &c->timer);
+  if (c->upstream) proxy_pool_release(c->upstream);
+  open_conns--;
+
+  c->next_closed = closed_conns;
+  closed_conns = c;
+}
+
+static void free_closed_conns(void) {
+  while (closed_conns) {
+    struct conn* c = closed_conns;
+    closed_conns = c->next_closed;
+    free(c->to_target);
+    free(c->to_client);
+    free(c);
+  }
+}
+
+/* Records the stage timings of the response just sent. */
+static void conn_record_request(struct conn* c) {
+  stats_record(STATS_PARSE, c->parse_ns);
+  stats_record(STATS_SEND, c->send_ns);
+  stats_record(STATS_REQUEST, stats_now() - c->request_started);
+  stats_count_response(c->response.status_code);
+  c->parse_ns = c->send_ns = 0;
+
+  c->log_entry.status_code = c->response.status_code;
+  c->log_entry.latency_ns = stats_now() - c->request_started;
+  access_log_end(&c->log_entry);
+}
+
+/* Forgets the response just sent so the next pipelined request can be read. */
+static void conn_finish_response(struct conn* c) {
+  response_finish(&c->response);
+  c->state = CONN_READ_REQUEST;
+}
+
+/*
+ * Writes pending output, refilling it from the file as needed. Returns 1 once
+ * the whole response is sent, 0 if the socket is full, -1 on error.
+ */
+static int conn_send_response(struct conn* c) {
+  struct response* r = &c->response;
+  while (1) {
+    bool more = response_body_pending(r);
+    while (r->out_sent < r->out_len) {
+      /* MSG_MORE lets the headers share a packet with the file body. */
+      ssize_t n = send(c->client.fd, r->out + r->out_sent,
+                       r->out_len - r->out_sent, more ? MSG_MORE : 0);
+      if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+        if (errno == EINTR) continue;
+        return -1;
+      }
+      r->out_sent += n;
+    }
+
+    if (!more) return 1;
+
+    if (r->cached) {
+      ssize_t n = send(c->client.fd, r->cached->body + r->file_offset,
+                       r->file_size - r->file_offset, 0);
+      if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+        if (errno == EINTR) continue;
+        return -1;
+      }
+      r->file_offset += n;
+      continue;
+    }
+
+    if (r->use_sendfile) {
+      ssize_t n = sendfile(c->client.fd, r->file_fd, &r->file_offset,
+                           r->file_size - r->file_offset);
+      if (n > 0) continue;
+      if (n == 0) return 1;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+      if (errno == EINTR) continue;
+      if (errno != EINVAL && errno != ENOSYS) return -1;
+      r->use_sendfile = false;
+    }
+
+    /* Refill the output buffer with the next chunk of the file. */
+    r->out_len = r->out_sent = 0;
+    response_reserve(r, FILE_CHUNK_SIZE);
+    off_t chunk = r->file_size - r->file_offset;
+    if (chunk > FILE_CHUNK_SIZE) chunk = FILE_CHUNK_SIZE;
+    ssize_t n = pread(r->file_fd, r->out, chunk, r->file_offset);
+    if (n <= 0) return n == 0 ? 1 : -1;
+    r->out_len = n;
+    r->file_offset += n;
+  }
+}
+
+/*
+ * Moves bytes from SRC to DST through RELAY until either side would block.
+ * Returns -1 on error, 0 otherwise.
+ */
+static int relay_pump(struct relay* relay, int src, int dst) {
+  while (1) {
+    if (relay->start < relay->end) {
+      ssize_t n = write(dst, relay->buf + relay->start,
+                        relay->end - relay->start);
+      if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+        if (errno == EINTR) continue;
+        return -1;
+      }
+      relay->start += n;
+    } else if (!relay->eof) {
+      ssize_t n = read(src, relay->buf, RELAY_BUFFER_SIZE);
+      if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+        if (errno == EINTR) continue;
+        return -1;
+      }
+      if (n == 0) {
+        relay->eof = true;
+        shutdown(dst, SHUT_WR);
+        return 0;
+      }
+      relay->start = 0;
+      relay->end = n;
+    } else {
+      return 0;
+    }
+  }
+}
+
+static void conn_relay(struct conn* c) {
+  if (relay_pump(c->to_target, c->client.fd, c->target.fd) == -1 ||
+      relay_pump(c->to_client, c->target.fd, c->client.fd) == -1) {
+    conn_close(c);
+    return;
+  }
+
+  if (c->to_target->eof && c->to_client->eof &&
+      c->to_target->start == c->to_target->end &&
+      c->to_client->start == c->to_client->end)
+    conn_close(c);
+}
+
+static void conn_start_proxy(struct conn* c);
+
+/* Tries the next upstream when the one picked cannot be reached, and answers
+ * the client with 502 once every one has been tried. */
+static void conn_proxy_failed(struct conn* c) {
+  close(c->target.fd);
+  c->target.fd = -1;
+  proxy_pool_failed(c->upstream);
+  if (c->proxy_tries < proxy_pool_upstreams()) {
+    c->deadline = false; /* A new connect gets its own. */
+    conn_start_proxy(c);
+    return;
+  }
+  response_empty(&c->response, 502);
+  c->state = CONN_SEND_RESPONSE;
+}
+
+static void conn_start_relay(struct conn* c) {
+  c->to_target = calloc(1, sizeof(struct relay));
+  c->to_client = calloc(1, sizeof(struct relay));
+  if (!c->to_target || !c->to_client) {
+    fprintf(stderr, "Malloc failed\n");
+    exit(ENOBUFS);
+  }
+  c->state = CONN_PROXY_RELAY;
+}
+
+static void conn_start_proxy(struct conn* c) {
+  if (c->upstream) proxy_pool_release(c->upstream);
+  c->upstream = proxy_pool_pick(&c->peer);
+  c->proxy_tries++;
+
+  c->target.fd = proxy_pool_take(c->upstream);
+  if (c->target.fd != -1) {
+    set_nonblocking(c->target.fd);
+    conn_start_relay(c);
+    watch_endpoint(&c->target);
+    return;
+  }
+
+  c->target.fd =
+      socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (c->target.fd == -1) {
+    perror("Failed to create a new socket");
+    conn_close(c);
+    return;
+  }
+
+  c->state = CONN_PROXY_CONNECT;
+  struct sockaddr_in* address = proxy_upstream_address(c->upstream);
+  if (connect(c->target.fd, (struct sockaddr*)address, sizeof(*address)) ==
+      0) {
+    conn_start_relay(c);
+  } else if (errno != EINPROGRESS) {
+    conn_proxy_failed(c);
+    return;
+  }
+  watch_endpoint(&c->target);
+}
+
+static void conn_offload(struct conn* c, struct http_request* request);
+
+/* Drives the state machine of C after EVENTS were reported on ENDPOINT. */
+static void conn_step(struct conn* c, struct conn_endpoint* endpoint,
+                      uint32_t events) {
+  struct http_request request;
+  uint64_t started;
+  int status;
+
+  while (1) {
+    switch (c->state) {
+      case CONN_READ_REQUEST:
+        /* Same as http_read_request(), with only the parsing timed. */
+        started = stats_now();
+        status = http_parse_request(&c->reader, &request);
+        c->parse_ns += stats_now() - started;
+        if (status == 0) {
+          status = http_reader_fill(&c->reader);
+          if (status == 1) break;
+          if (status == 0) conn_close(c);
+          return;
+        }
+
+        c->request_started = stats_now();
+        c->deadline = false;
+        access_log_begin(&c->log_entry, &c->peer,
+                         status == -1 ? NULL : &request);
+        if (status == -1) {
+          c->response.keep_alive = false;
+          response_empty(&c->response, 400);
+        } else {
+          if (reload_draining()) request.keep_alive = 0;
+          if (io_pool_enabled()) {
+            conn_offload(c, &request);
+            return;
+          }
+          response_prepare_files(&c->response, &request);
+          stats_record(STATS_OPEN, stats_now() - c->request_started);
+        }
+        c->log_entry.bytes = response_length(&c->response);
+        c->state = CONN_SEND_RESPONSE;
+        break;
+
+      case CONN_SEND_RESPONSE:
+        started = stats_now();
+        status = conn_send_response(c);
+        c->send_ns += stats_now() - started;
+        if (status == 0) return;
+        if (!proxy_mode) conn_record_request(c);
+        if (status == -1 || !c->response.keep_alive) {
+          conn_close(c);
+          return;
+        }
+        conn_finish_response(c);
+        break;
+
+      case CONN_PREPARE:
+        return;
+
+      case CONN_PROXY_CONNECT:
+        if (endpoint != &c->target || !(events & (EPOLLOUT | EPOLLERR)))
+          return;
+
+        int error = 0;
+        socklen_t length = sizeof(error);
+        getsockopt(c->target.fd, SOL_SOCKET, SO_ERROR, &error, &length);
+        if (error != 0) {
+          conn_proxy_failed(c);
+          events = 0; /* They were for the upstream given up on. */
+          break;
+        }
+        conn_start_relay(c);
+        break;
+
+      case CONN_PROXY_RELAY:
+        conn_relay(c);
+        return;
+
+      case CONN_DONE:
+        return;
+    }
+  }
+}
+
+/* Arms C's timer for the state it is waiting in. */
+static void conn_schedule(struct conn* c) {
+  /* The pool holds on to a connection being prepared, so it must not be
+   * closed under it. */
+  if (c->state == CONN_PREPARE) {
+    timer_cancel(&timers, &c->timer);
+    return;
+  }
+  bool deadline = c->state == CONN_PROXY_CONNECT ||
+                  (c->state == CONN_READ_REQUEST &&
+                   c->reader.end > c->reader.start);
+  if (deadline && c->deadline) return;
+  c->deadline = deadline;
+  if (deadline)
+    timer_arm(&timers, &c->timer, server_request_timeout);
+  else
+    timer_arm(&timers, &c->timer,
+              proxy_mode ? server_proxy_timeout : server_idle_timeout);
+}
+
+static void conn_advance(struct conn* c, struct conn_endpoint* endpoint,
+                         uint32_t events) {
+  conn_step(c, endpoint, events);
+  if (c->state != CONN_DONE) conn_schedule(c);
+}
+
+/* Builds C's response on a pool thread. */
+static void conn_prepare_run(struct io_job* job) {
+  struct conn* c = (struct conn*)((char*)job - offsetof(struct conn, io));
+  struct response* r = &c->response;
+  response_prepare_files(r, &c->request);
+  if (r->file_fd != -1 && r->file_size > r->file_offset) {
+    off_t length = r->file_size - r->file_offset;
+    readahead(r->file_fd, r->file_offset,
+              length < IO_READAHEAD_SIZE ? length : IO_READAHEAD_SIZE);
+  }
+}
+
+/* Back on the loop, sends the response conn_prepare_run() built. */
+static void conn_prepare_complete(struct io_job* job) {
+  struct conn* c = (struct conn*)((char*)job - offsetof(struct conn, io));
+  stats_record(STATS_OPEN, stats_now() - c->request_started);
+  c->log_entry.bytes = response_length(&c->response);
+  c->state = CONN_SEND_RESPONSE;
+  conn_advance(c, &c->client, 0);
+}
+
+/* Hands REQUEST, just read on C, to the I/O pool. */
+static void conn_offload(struct conn* c, struct http_request* request) {
+  c->request = *request;
+  c->io.run = conn_prepare_run;
+  c->io.complete = conn_prepare_complete;
+  c->state = CONN_PREPARE;
+  io_submit(&completions, &c->io);
+}
+
+static void conn_expired(struct timer* timer) {
+  struct conn* c =
+      (struct conn*)((char*)timer - offsetof(struct conn, timer));
+  if (c->state == CONN_PROXY_CONNECT) {
+    conn_proxy_failed(c);
+    conn_advance(c, &c->client, 0);
+  } else {
+    conn_close(c);
+  }
+}
+
+static void accept_connections(int server_socket) {
+  struct sockaddr_in client_address;
+  socklen_t client_address_length;
+
+  while (1) {
+    client_address_length = sizeof(client_address);
+    int client_socket_number =
+        accept4(server_socket, (struct sockaddr*)&client_address,
+                &client_address_length, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (client_socket_number < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        perror("Error accepting socket");
+      return;
+    }
+    uint64_t accepted = stats_now();
+    stats_count_connection();
+
+    struct conn* c = calloc(1, sizeof(struct conn));
+    if (!c) {
+      fprintf(stderr, "Malloc failed\n");
+      exit(ENOBUFS);
+    }
+    c->peer = client_address;
+    c->client.conn = c;
+    c->client.fd = client_socket_number;
+    c->target.conn = c;
+    c->target.fd = -1;
+    c->state = CONN_READ_REQUEST;
+    response_init(&c->response);
+    http_reader_init(&c->reader, client_socket_number);
+    watch_endpoint(&c->client);
+    open_conns++;
+
+    if (proxy_mode) conn_start_proxy(c);
+    if (c->state != CONN_DONE) conn_schedule(c);
+    stats_record(STATS_ACCEPT, stats_now() - accepted);
+  }
+}
+
+void epoll_serve_forever(int server_socket, void (*request_handler)(int)) {
+  proxy_mode = request_handler == handle_proxy_request;
+
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd == -1) {
+    perror("Failed to create epoll instance");
+    exit(errno);
+  }
+
+  /* The listening socket is level-triggered and marked by a NULL pointer. */
+  set_nonblocking(server_socket);
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.ptr = NULL;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_socket, &event) == -1) {
+    perror("Failed to add listening socket to epoll");
+    exit(errno);
+  }
+
+  if (io_pool_enabled()) {
+    if (io_completions_init(&completions) == -1) {
+      perror("Failed to create the I/O completion eventfd");
+      exit(errno);
+    }
+    completions_endpoint.conn = NULL;
+    completions_endpoint.fd = completions.eventfd;
+    event.events = EPOLLIN;
+    event.data.ptr = &completions_endpoint;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, completions.eventfd, &event) ==
+        -1) {
+      perror("Failed to add the I/O completions to epoll");
+      exit(errno);
+    }
+  }
+
+  timer_wheel_init(&timers);
+
+  struct epoll_event events[EPOLL_MAX_EVENTS];
+  bool listening = true;
+  while (1) {
+    if (reload_draining()) {
+      /* The socket stays open for the next generation to accept on. */
+      if (listening) epoll_ctl(epoll_fd, EPOLL_CTL_DEL, server_socket, NULL);
+      listening = false;
+      if (open_conns == 0) break;
+    }
+
+    /* Wake up every tick while any connection has a timer running. */
+    int wait_timeout = timers.armed > 0 ? TIMER_TICK_MS : -1;
+    int num_events =
+        epoll_wait(epoll_fd, events, EPOLL_MAX_EVENTS, wait_timeout);
+    if (num_events < 0) {
+      if (errno == EINTR) continue;
+      perror("Failed to wait for events");
+      exit(errno);
+    }
+
+    for (int i = 0; i < num_events; i++) {
+      struct conn_endpoint* endpoint = events[i].data.ptr;
+      if (endpoint == NULL)
+        accept_connections(server_socket);
+      else if (endpoint == &completions_endpoint)
+        io_completions_run(&completions);
+      else
+        conn_advance(endpoint->conn, endpoint, events[i].events);
+    }
+    timer_wheel_advance(&timers, conn_expired);
+    free_closed_conns();
+  }
+  if (io_pool_enabled()) close(completions.eventfd);
+  close(epoll_fd);
+}
+
+#endif
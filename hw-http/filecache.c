@@ -0,0 +1,426 @@
+#include "filecache.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifdef FILE_CACHE_GZIP
+#include <zlib.h>
+#endif
+
+#include "libhttp.h"
+#include "utlist.h"
+
+#define FILE_CACHE_SHARDS 16
+#define FILE_CACHE_BUCKETS 256
+
+struct file_cache_shard {
+  pthread_mutex_t lock;
+  struct file_cache_entry* buckets[FILE_CACHE_BUCKETS];
+  struct file_cache_entry* lru; /* Least recently used first. */
+  size_t used, capacity;        /* In bytes, see file_cache_charge(). */
+};
+
+/* What an entry is built from: the file (or, for a listing, the directory)
+ * FILE, sent as PATH with Content-Encoding ENCODING. COMPRESS means FILE is
+ * gzipped here rather than stored compressed. */
+struct file_cache_source {
+  char* path;
+  char* file;
+  char* encoding;
+  bool listing, compress;
+  bool map; /* Map FILE rather than read it, see file_cache_load(). */
+};
+
+static struct file_cache_shard shards[FILE_CACHE_SHARDS];
+static bool cache_enabled;
+static bool cache_map_files;
+
+/* FNV-1a; the low bits pick the shard, the next ones the bucket. */
+static uint32_t file_cache_hash(char* path) {
+  uint32_t hash = 2166136261u;
+  for (unsigned char* p = (unsigned char*)path; *p; p++) {
+    hash ^= *p;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static struct file_cache_shard* file_cache_shard(uint32_t hash) {
+  return &shards[hash % FILE_CACHE_SHARDS];
+}
+
+static struct file_cache_entry** file_cache_bucket(
+    struct file_cache_shard* shard, uint32_t hash) {
+  return &shard->buckets[(hash / FILE_CACHE_SHARDS) % FILE_CACHE_BUCKETS];
+}
+
+/* Memory accounted to ENTRY against its shard's capacity. */
+static size_t file_cache_charge(struct file_cache_entry* entry) {
+  return sizeof(*entry) + strlen(entry->path) + 1 + entry->headers_length +
+         entry->size;
+}
+
+void file_cache_init(size_t capacity, bool map_files) {
+  for (int i = 0; i < FILE_CACHE_SHARDS; i++) {
+    pthread_mutex_init(&shards[i].lock, NULL);
+    shards[i].capacity = capacity / FILE_CACHE_SHARDS;
+  }
+  cache_enabled = capacity > 0;
+  cache_map_files = map_files;
+}
+
+bool file_cache_enabled(void) { return cache_enabled; }
+
+void file_cache_release(struct file_cache_entry* entry) {
+  if (__atomic_sub_fetch(&entry->refcount, 1, __ATOMIC_ACQ_REL) != 0) return;
+  if (entry->mapped) munmap(entry->body, entry->size);
+  free(entry);
+}
+
+/* Unlinks ENTRY from SHARD and drops the cache's reference. The shard lock
+ * must be held. */
+static void file_cache_unlink(struct file_cache_shard* shard,
+                              struct file_cache_entry* entry) {
+  struct file_cache_entry** link = file_cache_bucket(shard, entry->hash);
+  while (*link != entry) link = &(*link)->hash_next;
+  *link = entry->hash_next;
+  DL_DELETE(shard->lru, entry);
+  shard->used -= file_cache_charge(entry);
+  file_cache_release(entry);
+}
+
+/*
+ * Allocates an entry for SOURCE, whose file is described by FILE_STAT, with
+ * room for a body of BODY_SIZE bytes, holding one reference. The path, headers
+ * and body share the entry's allocation; with MAPPED the body is left out, for
+ * the caller to point at the mapping. Returns NULL if it would not fit in
+ * CAPACITY.
+ */
+static struct file_cache_entry* file_cache_new_entry(
+    struct file_cache_source* source, uint32_t hash, struct stat* file_stat,
+    size_t body_size, bool mapped, size_t capacity) {
+  char* path = source->path;
+  char* content_type =
+      source->listing ? http_get_mime_type(".html") : http_get_mime_type(path);
+  char etag[LIBHTTP_ETAG_SIZE];
+  http_format_etag(etag, file_stat->st_size, &file_stat->st_mtim,
+                   source->encoding);
+
+  struct http_response response;
+  http_response_start(&response, 200);
+  http_response_file_headers(&response, 200, content_type, source->encoding,
+                             etag, file_stat->st_mtime, body_size, 0,
+                             body_size);
+  char* headers = response.buffer;
+  size_t headers_length = response.length;
+  size_t path_length = strlen(path) + 1;
+  size_t size =
+      sizeof(struct file_cache_entry) + path_length + headers_length + 1 +
+      body_size;
+  if (response.overflow || size > capacity) return NULL;
+
+  struct file_cache_entry* entry = malloc(mapped ? size - body_size : size);
+  if (!entry) return NULL;
+  entry->path = (char*)(entry + 1);
+  entry->headers = entry->path + path_length;
+  entry->body = entry->headers + headers_length + 1;
+  memcpy(entry->path, path, path_length);
+  memcpy(entry->headers, headers, headers_length);
+  entry->headers[headers_length] = '\0';
+  memcpy(entry->etag, etag, sizeof(etag));
+  entry->content_type = content_type;
+  entry->headers_length = headers_length;
+  entry->hash = hash;
+  entry->encoding = source->encoding;
+  entry->is_listing = S_ISDIR(file_stat->st_mode);
+  entry->mtime = file_stat->st_mtim;
+  entry->source_size = file_stat->st_size;
+  entry->size = body_size;
+  entry->mapped = mapped;
+  entry->refcount = 1;
+  return entry;
+}
+
+/*
+ * Maps the file FILEDES of SIZE bytes for sending, asking the kernel to read
+ * it ahead, since a cached file is sent front to back, whole, many times.
+ * Returns NULL if it cannot be mapped.
+ *
+ * The mapping is only ever read by the kernel, in writev() and sendmsg(): if
+ * the file is truncated under us, sending the missing pages fails with EFAULT
+ * rather than raising SIGBUS. Anything that reads the body in user space (the
+ * compressor) must use a copy.
+ */
+static char* file_cache_map(int filedes, size_t size) {
+  if (size == 0) return NULL;
+  void* body = mmap(NULL, size, PROT_READ, MAP_SHARED, filedes, 0);
+  if (body == MAP_FAILED) return NULL;
+  madvise(body, size, MADV_SEQUENTIAL);
+  madvise(body, size, MADV_WILLNEED);
+  return body;
+}
+
+/*
+ * Reads the file of SOURCE into a new entry, or maps it if SOURCE asks for
+ * that and the file can be mapped. Returns NULL if the file does not fit in
+ * CAPACITY or cannot be read in full.
+ */
+static struct file_cache_entry* file_cache_load(
+    struct file_cache_source* source, uint32_t hash, size_t capacity) {
+  int filedes = open(source->file, O_RDONLY);
+  if (filedes == -1) return NULL;
+
+  struct file_cache_entry* entry = NULL;
+  struct stat file_stat;
+  if (fstat(filedes, &file_stat) == -1 || !S_ISREG(file_stat.st_mode))
+    goto done;
+
+  char* mapping = source->map ? file_cache_map(filedes, file_stat.st_size)
+                              : NULL;
+  entry = file_cache_new_entry(source, hash, &file_stat, file_stat.st_size,
+                               mapping != NULL, capacity);
+  if (mapping) {
+    if (entry)
+      entry->body = mapping;
+    else
+      munmap(mapping, file_stat.st_size);
+  }
+  if (!entry || mapping) goto done;
+
+  off_t offset = 0;
+  while (offset < entry->size) {
+    ssize_t bytes_read =
+        pread(filedes, entry->body + offset, entry->size - offset, offset);
+    if (bytes_read <= 0) {
+      /* Shrunk under us, or an I/O error. */
+      free(entry);
+      entry = NULL;
+      break;
+    }
+    offset += bytes_read;
+  }
+
+done:
+  close(filedes);
+  return entry;
+}
+
+#ifdef FILE_CACHE_GZIP
+/*
+ * Gzips the file of SOURCE into a new entry. The uncompressed file must fit
+ * in CAPACITY too, since it is read whole first. Returns NULL on failure.
+ */
+static struct file_cache_entry* file_cache_compress(
+    struct file_cache_source* source, uint32_t hash, size_t capacity) {
+  struct file_cache_source plain = {source->file, source->file, NULL, false,
+                                    false, false};
+  struct file_cache_entry* original = file_cache_load(&plain, hash, capacity);
+  if (!original) return NULL;
+
+  /* 31 window bits asks for a gzip header rather than a zlib one. */
+  struct file_cache_entry* entry = NULL;
+  z_stream stream = {0};
+  if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 31, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK)
+    goto done;
+  size_t bound = deflateBound(&stream, original->size);
+  unsigned char* compressed = malloc(bound);
+  if (compressed) {
+    stream.next_in = (unsigned char*)original->body;
+    stream.avail_in = original->size;
+    stream.next_out = compressed;
+    stream.avail_out = bound;
+    if (deflate(&stream, Z_FINISH) == Z_STREAM_END) {
+      struct stat file_stat = {0};
+      file_stat.st_mode = S_IFREG;
+      file_stat.st_mtim = original->mtime;
+      file_stat.st_size = original->size;
+      entry = file_cache_new_entry(source, hash, &file_stat, stream.total_out,
+                                   false, capacity);
+      if (entry) memcpy(entry->body, compressed, stream.total_out);
+    }
+    free(compressed);
+  }
+  deflateEnd(&stream);
+
+done:
+  file_cache_release(original);
+  return entry;
+}
+#endif
+
+/*
+ * Renders the listing of the directory of SOURCE into a new entry, reading it
+ * all before sending anything, so the listing goes out in one write with a
+ * Content-Length. Returns NULL if the directory cannot be read.
+ */
+static struct file_cache_entry* file_cache_render_listing(
+    struct file_cache_source* source, uint32_t hash) {
+  char* path = source->file;
+  DIR* dir = opendir(path);
+  if (dir == NULL) return NULL;
+
+  /* Stat the directory before reading, so a change made while reading leaves
+   * the entry already out of date. */
+  struct file_cache_entry* entry = NULL;
+  struct stat dir_stat;
+  char* html = NULL;
+  size_t length = 0, capacity = 0;
+  if (fstat(dirfd(dir), &dir_stat) == -1) goto done;
+
+  for (struct dirent* ent = readdir(dir); ent; ent = readdir(dir)) {
+    size_t href_length = strlen("<a href=\"//\"></a><br/>") + strlen(path) +
+                         strlen(ent->d_name) * 2 + 1;
+    if (length + href_length > capacity) {
+      while (length + href_length > capacity)
+        capacity = capacity ? 2 * capacity : 4096;
+      char* grown = realloc(html, capacity);
+      if (!grown) goto done;
+      html = grown;
+    }
+    http_format_href(html + length, path, ent->d_name);
+    length += strlen(html + length);
+  }
+
+  entry = file_cache_new_entry(source, hash, &dir_stat, length, false,
+                               SIZE_MAX);
+  if (entry && length > 0) memcpy(entry->body, html, length);
+
+done:
+  free(html);
+  closedir(dir);
+  return entry;
+}
+
+static bool file_cache_fresh(struct file_cache_entry* entry,
+                             struct stat* file_stat) {
+  return entry->is_listing == S_ISDIR(file_stat->st_mode) &&
+         (entry->is_listing || entry->source_size == file_stat->st_size) &&
+         entry->mtime.tv_sec == file_stat->st_mtim.tv_sec &&
+         entry->mtime.tv_nsec == file_stat->st_mtim.tv_nsec;
+}
+
+static bool file_cache_matches(struct file_cache_entry* entry,
+                               struct file_cache_source* source,
+                               uint32_t hash) {
+  if (entry->hash != hash || strcmp(entry->path, source->path) != 0)
+    return false;
+  if (entry->encoding == NULL || source->encoding == NULL)
+    return entry->encoding == source->encoding;
+  return strcmp(entry->encoding, source->encoding) == 0;
+}
+
+/* Finds SOURCE in SHARD, dropping it if it is out of date. The shard lock
+ * must be held. */
+static struct file_cache_entry* file_cache_lookup(
+    struct file_cache_shard* shard, struct file_cache_source* source,
+    uint32_t hash, struct stat* file_stat) {
+  struct file_cache_entry* entry = *file_cache_bucket(shard, hash);
+  while (entry && !file_cache_matches(entry, source, hash))
+    entry = entry->hash_next;
+  if (entry && !file_cache_fresh(entry, file_stat)) {
+    file_cache_unlink(shard, entry);
+    entry = NULL;
+  }
+  return entry;
+}
+
+/* Builds the entry for SOURCE without looking at the cache. */
+static struct file_cache_entry* file_cache_build(
+    struct file_cache_source* source, uint32_t hash, size_t capacity) {
+  if (source->listing) return file_cache_render_listing(source, hash);
+#ifdef FILE_CACHE_GZIP
+  if (source->compress) return file_cache_compress(source, hash, capacity);
+#else
+  if (source->compress) return NULL;
+#endif
+  return file_cache_load(source, hash, capacity);
+}
+
+/* Looks SOURCE up, and otherwise builds its entry and caches it if it fits. A
+ * listing is returned even if it cannot be cached. */
+static struct file_cache_entry* file_cache_find(
+    struct file_cache_source* source, struct stat* file_stat) {
+  uint32_t hash = file_cache_hash(source->path);
+  struct file_cache_shard* shard = file_cache_shard(hash);
+
+  pthread_mutex_lock(&shard->lock);
+  struct file_cache_entry* entry =
+      file_cache_lookup(shard, source, hash, file_stat);
+  if (entry) {
+    DL_DELETE(shard->lru, entry);
+    DL_APPEND(shard->lru, entry);
+    __atomic_add_fetch(&entry->refcount, 1, __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&shard->lock);
+  if (entry) return entry;
+
+  /* Read the file without holding the lock. */
+  entry = file_cache_build(source, hash, shard->capacity);
+  if (!entry) return NULL;
+  if (!file_cache_fresh(entry, file_stat)) return entry; /* Serve, not keep. */
+
+  size_t charge = file_cache_charge(entry);
+  if (charge > shard->capacity) return entry;
+
+  pthread_mutex_lock(&shard->lock);
+  /* Another thread may have loaded the same file meanwhile. */
+  struct file_cache_entry* existing =
+      file_cache_lookup(shard, source, hash, file_stat);
+  if (existing) file_cache_unlink(shard, existing);
+
+  while (shard->lru && shard->used + charge > shard->capacity)
+    file_cache_unlink(shard, shard->lru);
+
+  struct file_cache_entry** bucket = file_cache_bucket(shard, hash);
+  entry->hash_next = *bucket;
+  *bucket = entry;
+  DL_APPEND(shard->lru, entry);
+  shard->used += charge;
+  entry->refcount++; /* The cache's reference. */
+  pthread_mutex_unlock(&shard->lock);
+
+  return entry;
+}
+
+struct file_cache_entry* file_cache_get(char* path, struct stat* file_stat) {
+  struct file_cache_source source = {path, path, NULL, false, false,
+                                     cache_map_files};
+  if (!cache_enabled) return NULL;
+  return file_cache_find(&source, file_stat);
+}
+
+struct file_cache_entry* file_cache_get_encoded(char* path, char* file,
+                                                struct stat* file_stat,
+                                                char* encoding) {
+  struct file_cache_source source = {path, file ? file : path, encoding, false,
+                                     file == NULL, cache_map_files};
+  if (!cache_enabled) return NULL;
+  return file_cache_find(&source, file_stat);
+}
+
+struct file_cache_entry* file_cache_get_listing(char* path,
+                                                struct stat* dir_stat) {
+  struct file_cache_source source = {path, path, NULL, true, false, false};
+  if (!cache_enabled) return file_cache_render_listing(&source, 0);
+  return file_cache_find(&source, dir_stat);
+}
+
+bool file_cache_can_compress(char* path) {
+#ifdef FILE_CACHE_GZIP
+  /* Images and PDFs are compressed already. */
+  char* content_type = http_get_mime_type(path);
+  return cache_enabled && (strncmp(content_type, "text/", 5) == 0 ||
+                           strcmp(content_type, "application/javascript") == 0);
+#else
+  (void)path;
+  return false;
+#endif
+}
@@ -0,0 +1,99 @@
+/*
+ * In-memory cache of static files for --files mode (--cache-mb N).
+ *
+ * Each entry holds a file's body together with its pre-rendered status line
+ * and headers, so a hit is answered with a single writev() and without
+ * touching the file. Entries are keyed by path and dropped when the file's
+ * size or mtime no longer matches. The cache is split into shards with their
+ * own lock and LRU list; entries are reference counted, so an entry evicted
+ * while it is being sent stays alive until its last user releases it.
+ *
+ * Directory listings are cached the same way, rendered to HTML and keyed by
+ * the directory's mtime, which changes whenever an entry is added, removed or
+ * renamed.
+ *
+ * A file may also be cached in an encoded form, keyed by its path and
+ * Content-Encoding: either read from a precompressed sibling such as
+ * index.html.gz, or, when built with `make GZIP=1`, gzipped on first use.
+ *
+ * With --mmap, files are mapped rather than copied into the cache: the body
+ * of an entry is then the file's own page cache pages, shared by every worker
+ * sending it and by the kernel, and --cache-mb bounds the bytes mapped rather
+ * than bytes allocated. Gzipped bodies and listings are still allocated.
+ */
+
+#ifndef FILECACHE_H
+#define FILECACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "libhttp.h"
+
+struct file_cache_entry {
+  char* path;
+  uint32_t hash;
+  char* encoding;  /* Content-Encoding of the body, or NULL. */
+  bool is_listing; /* The body is the rendered listing of a directory. */
+  struct timespec mtime;
+  off_t source_size; /* Of the file the body was made from. */
+  off_t size;        /* Of the body. */
+
+  /* Validators and type, for answers other than a plain 200. */
+  char etag[LIBHTTP_ETAG_SIZE];
+  char* content_type;
+
+  /* The status line and headers of a 200 response, from
+   * http_response_file_headers(). The sender adds the Connection header and
+   * the blank line. */
+  char* headers;
+  size_t headers_length;
+  char* body;
+  bool mapped; /* The body is an mmap() of the file, not a copy. */
+
+  int refcount; /* One for the cache while linked, one per user. */
+  struct file_cache_entry *prev, *next; /* LRU list, least recent first. */
+  struct file_cache_entry* hash_next;
+};
+
+/* Enables the cache with room for CAPACITY bytes, mapping files instead of
+ * reading them with MAP_FILES. Without it, file_cache_get() always returns
+ * NULL. */
+void file_cache_init(size_t capacity, bool map_files);
+bool file_cache_enabled(void);
+
+/*
+ * Returns the cached entry for the regular file PATH, whose current metadata
+ * is FILE_STAT, loading it if needed. Returns NULL if the cache is disabled,
+ * the file is too large to cache or cannot be read. The caller must release
+ * the entry with file_cache_release().
+ */
+struct file_cache_entry* file_cache_get(char* path, struct stat* file_stat);
+
+/*
+ * Like file_cache_get(), for PATH sent with Content-Encoding ENCODING (a
+ * string that outlives the cache). The body is read from FILE, a sibling
+ * holding PATH already encoded, whose metadata is FILE_STAT. With FILE NULL,
+ * PATH itself (described by FILE_STAT) is gzipped instead, which needs
+ * file_cache_can_compress(PATH),
+ * which holds for text types when the cache is enabled and gzip built in.
+ */
+struct file_cache_entry* file_cache_get_encoded(char* path, char* file,
+                                                struct stat* file_stat,
+                                                char* encoding);
+bool file_cache_can_compress(char* path);
+
+/*
+ * Returns the rendered HTML listing of the directory PATH, whose current
+ * metadata is DIR_STAT, rendering it if needed. Works with the cache disabled
+ * too, in which case the entry is only the caller's. Returns NULL if the
+ * directory cannot be read. The caller must release the entry.
+ */
+struct file_cache_entry* file_cache_get_listing(char* path,
+                                                struct stat* dir_stat);
+void file_cache_release(struct file_cache_entry* entry);
+
+#endif
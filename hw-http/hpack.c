@@ -0,0 +1,512 @@
+#include "hpack.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HPACK_STATIC_ENTRIES 61
+
+/* The static table (RFC 7541, Appendix A). Index 1 is static_table[0], and
+ * the dynamic table's entries follow on from index 62, newest first. */
+static struct {
+  char* name;
+  char* value;
+} static_table[HPACK_STATIC_ENTRIES] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+/* The Huffman code (RFC 7541, Appendix B), with EOS as symbol 256. */
+#define HUFFMAN_EOS 256
+#define HUFFMAN_MAX_LENGTH 30
+
+static const uint32_t huffman_codes[257] = {
+    0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5,
+    0xfffffe6, 0xfffffe7, 0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9,
+    0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec, 0xfffffed, 0xfffffee,
+    0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+    0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9,
+    0xffffffa, 0xffffffb, 0x14, 0x3f8, 0x3f9, 0xffa,
+    0x1ff9, 0x15, 0xf8, 0x7fa, 0x3fa, 0x3fb,
+    0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+    0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b,
+    0x1c, 0x1d, 0x1e, 0x1f, 0x5c, 0xfb,
+    0x7ffc, 0x20, 0xffb, 0x3fc, 0x1ffa, 0x21,
+    0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+    0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x6b, 0x6c, 0x6d, 0x6e,
+    0x6f, 0x70, 0x71, 0x72, 0xfc, 0x73,
+    0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+    0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5,
+    0x25, 0x26, 0x27, 0x6, 0x74, 0x75,
+    0x28, 0x29, 0x2a, 0x7, 0x2b, 0x76,
+    0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+    0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd,
+    0x1ffd, 0xffffffc, 0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8,
+    0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9, 0x3fffd6, 0x7fffda,
+    0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+    0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1,
+    0x7fffe2, 0x7fffe3, 0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5,
+    0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef, 0x3fffda, 0x1fffdd,
+    0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+    0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf,
+    0x7fffeb, 0x7fffec, 0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2,
+    0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef, 0xfffea, 0x3fffe2,
+    0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+    0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2,
+    0x3fffe8, 0x1ffffec, 0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde,
+    0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed, 0x7fff2, 0x1fffe3,
+    0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+    0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3,
+    0x7ffffe4, 0x7ffffe5, 0xfffec, 0xfffff3, 0xfffed, 0x1fffe6,
+    0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3, 0x3fffea, 0x3fffeb,
+    0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+    0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8,
+    0x7ffffe9, 0x7ffffea, 0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed,
+    0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee, 0x3fffffff,
+};
+
+static const uint8_t huffman_lengths[257] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30,
+};
+
+/* The code is canonical: the codes of one length are consecutive, in order of
+ * symbol, and carry on from the last code of the length before. The number
+ * of codes of each length and the symbols in order of code are all a decoder
+ * needs. */
+static const uint16_t huffman_counts[31] = {
+    0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3, 2, 6, 2, 3,
+    0, 0, 0, 3, 8, 13, 26, 29, 12, 4, 15, 19, 29, 0, 4,
+};
+
+static const uint16_t huffman_symbols[257] = {
+    48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37,
+    45, 46, 47, 51, 52, 53, 54, 55, 56, 57, 61, 65,
+    95, 98, 100, 102, 103, 104, 108, 109, 110, 112, 114, 117,
+    58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76,
+    77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 89,
+    106, 107, 113, 118, 119, 120, 121, 122, 38, 42, 44, 59,
+    88, 90, 33, 34, 40, 41, 63, 39, 43, 124, 35, 62,
+    0, 36, 64, 91, 93, 126, 94, 125, 60, 96, 123, 92,
+    195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161,
+    167, 172, 176, 177, 179, 209, 216, 217, 227, 229, 230, 129,
+    132, 133, 134, 136, 146, 154, 156, 160, 163, 164, 169, 170,
+    173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+    233, 1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150,
+    151, 152, 155, 157, 158, 165, 166, 168, 174, 175, 180, 182,
+    183, 188, 191, 197, 231, 239, 9, 142, 144, 145, 148, 159,
+    171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+    200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243,
+    255, 203, 204, 211, 212, 214, 221, 222, 223, 241, 244, 245,
+    246, 247, 248, 250, 251, 252, 253, 254, 2, 3, 4, 5,
+    6, 7, 8, 11, 12, 14, 15, 16, 17, 18, 19, 20,
+    21, 23, 24, 25, 26, 27, 28, 29, 30, 31, 127, 220,
+    249, 10, 13, 22, 256,
+};
+
+
+/* Reads from a header block and copies names and values out of it. */
+struct hpack_reader {
+  const uint8_t *in, *in_end;
+  char *out, *out_end;
+};
+
+static struct hpack_entry* hpack_entry(struct hpack_table* table, int i) {
+  return &table->entries[(table->first + i) % HPACK_MAX_ENTRIES];
+}
+
+/* Drops the oldest entry of TABLE. */
+static void hpack_evict(struct hpack_table* table) {
+  struct hpack_entry* oldest = hpack_entry(table, table->count - 1);
+  table->size -=
+      oldest->name_length + oldest->value_length + HPACK_ENTRY_OVERHEAD;
+  free(oldest->name);
+  table->count--;
+}
+
+static void hpack_shrink(struct hpack_table* table, size_t size) {
+  while (table->size > size) hpack_evict(table);
+}
+
+/* Adds NAME: VALUE as the newest entry of TABLE, evicting the oldest ones to
+ * make room. An entry larger than the whole table empties it instead. */
+static void hpack_add(struct hpack_table* table, const char* name,
+                      size_t name_length, const char* value,
+                      size_t value_length) {
+  size_t size = name_length + value_length + HPACK_ENTRY_OVERHEAD;
+  if (size > table->max_size) {
+    hpack_shrink(table, 0);
+    return;
+  }
+  hpack_shrink(table, table->max_size - size);
+
+  char* copy = malloc(name_length + value_length + 2);
+  if (!copy) {
+    fprintf(stderr, "Malloc failed\n");
+    exit(ENOBUFS);
+  }
+  memcpy(copy, name, name_length);
+  copy[name_length] = '\0';
+  memcpy(copy + name_length + 1, value, value_length);
+  copy[name_length + 1 + value_length] = '\0';
+
+  table->first = (table->first + HPACK_MAX_ENTRIES - 1) % HPACK_MAX_ENTRIES;
+  table->count++;
+  struct hpack_entry* entry = hpack_entry(table, 0);
+  entry->name = copy;
+  entry->name_length = name_length;
+  entry->value = copy + name_length + 1;
+  entry->value_length = value_length;
+  table->size += size;
+}
+
+void hpack_table_init(struct hpack_table* table) {
+  memset(table, 0, sizeof(*table));
+  table->max_size = table->lowest = HPACK_TABLE_SIZE;
+}
+
+void hpack_table_free(struct hpack_table* table) { hpack_shrink(table, 0); }
+
+void hpack_set_max_size(struct hpack_table* table, size_t size) {
+  if (size > HPACK_TABLE_SIZE) size = HPACK_TABLE_SIZE;
+  if (size == table->max_size) return;
+  table->max_size = size;
+  if (size < table->lowest) table->lowest = size;
+  table->update_pending = true;
+  hpack_shrink(table, size);
+}
+
+/* Looks up INDEX in the static and then the dynamic table. */
+static bool hpack_lookup(struct hpack_table* table, size_t index,
+                         const char** name, size_t* name_length,
+                         const char** value, size_t* value_length) {
+  if (index >= 1 && index <= HPACK_STATIC_ENTRIES) {
+    *name = static_table[index - 1].name;
+    *name_length = strlen(*name);
+    *value = static_table[index - 1].value;
+    *value_length = strlen(*value);
+    return true;
+  }
+  if (index > HPACK_STATIC_ENTRIES &&
+      index <= HPACK_STATIC_ENTRIES + (size_t)table->count) {
+    struct hpack_entry* entry =
+        hpack_entry(table, index - HPACK_STATIC_ENTRIES - 1);
+    *name = entry->name;
+    *name_length = entry->name_length;
+    *value = entry->value;
+    *value_length = entry->value_length;
+    return true;
+  }
+  return false;
+}
+
+/* Reads an integer with a PREFIX_BITS prefix (RFC 7541, 5.1). */
+static bool hpack_get_int(struct hpack_reader* r, int prefix_bits,
+                          size_t* value) {
+  size_t max = (1u << prefix_bits) - 1;
+  *value = *r->in++ & max;
+  if (*value < max) return true;
+  for (int shift = 0; shift <= 21; shift += 7) {
+    if (r->in == r->in_end) return false;
+    uint8_t byte = *r->in++;
+    *value += (size_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) return true;
+  }
+  return false;
+}
+
+/* Copies LENGTH bytes of STRING out, NUL-terminated, and points *COPY at
+ * them. */
+static bool hpack_copy(struct hpack_reader* r, const char* string,
+                       size_t length, char** copy) {
+  if ((size_t)(r->out_end - r->out) < length + 1) return false;
+  memcpy(r->out, string, length);
+  r->out[length] = '\0';
+  *copy = r->out;
+  r->out += length + 1;
+  return true;
+}
+
+/* Decodes LENGTH bytes of Huffman code at IN, and copies them out like
+ * hpack_copy(). */
+static bool huffman_decode(struct hpack_reader* r, const uint8_t* in,
+                           size_t length, char** copy, size_t* copy_length) {
+  char* out = r->out;
+  int code = 0, bits = 0; /* Of the symbol so far. */
+  int first = 0;          /* The first code of that many bits. */
+  int index = 0;          /* Where its symbol is in huffman_symbols. */
+
+  for (size_t i = 0; i < length; i++) {
+    for (int bit = 7; bit >= 0; bit--) {
+      code = code << 1 | ((in[i] >> bit) & 1);
+      bits++;
+      int count = huffman_counts[bits];
+      if (code - first < count) {
+        int symbol = huffman_symbols[index + code - first];
+        if (symbol == HUFFMAN_EOS || out == r->out_end) return false;
+        *out++ = symbol;
+        code = bits = first = index = 0;
+        continue;
+      }
+      if (bits == HUFFMAN_MAX_LENGTH) return false;
+      index += count;
+      first = (first + count) << 1;
+    }
+  }
+
+  /* What is left must be padding: the start of EOS, all ones. */
+  if (bits > 7 || code != (1 << bits) - 1 || out == r->out_end) return false;
+  *out = '\0';
+  *copy = r->out;
+  *copy_length = out - r->out;
+  r->out = out + 1;
+  return true;
+}
+
+/* Reads a string literal (RFC 7541, 5.2) and copies it out. */
+static bool hpack_get_string(struct hpack_reader* r, char** string,
+                             size_t* length) {
+  if (r->in == r->in_end) return false;
+  bool huffman = *r->in & 0x80;
+  size_t encoded;
+  if (!hpack_get_int(r, 7, &encoded) ||
+      encoded > (size_t)(r->in_end - r->in))
+    return false;
+  const uint8_t* in = r->in;
+  r->in += encoded;
+  if (huffman) return huffman_decode(r, in, encoded, string, length);
+  *length = encoded;
+  return hpack_copy(r, (const char*)in, encoded, string);
+}
+
+int hpack_decode(struct hpack_table* table, const uint8_t* block,
+                 size_t length, struct http_header* fields, int max_fields,
+                 char* buffer, size_t size) {
+  struct hpack_reader r = {block, block + length, buffer, buffer + size};
+  int kept = 0;
+  bool fields_started = false;
+
+  while (r.in < r.in_end) {
+    uint8_t kind = *r.in;
+    size_t index;
+
+    /* Table size updates may only come before the first field. */
+    if ((kind & 0xe0) == 0x20) {
+      if (fields_started || !hpack_get_int(&r, 5, &index) ||
+          index > HPACK_TABLE_SIZE)
+        return -1;
+      table->max_size = index;
+      hpack_shrink(table, index);
+      continue;
+    }
+    fields_started = true;
+
+    char* mark = r.out;
+    const char *name, *value;
+    size_t name_length, value_length;
+    char *name_copy, *value_copy;
+    if (kind & 0x80) {
+      /* An indexed field. */
+      if (!hpack_get_int(&r, 7, &index) ||
+          !hpack_lookup(table, index, &name, &name_length, &value,
+                        &value_length) ||
+          !hpack_copy(&r, name, name_length, &name_copy) ||
+          !hpack_copy(&r, value, value_length, &value_copy))
+        return -1;
+    } else {
+      /* A literal, with incremental indexing (01), without (0000) or never
+       * to be indexed (0001), and with its name given or indexed. */
+      if (!hpack_get_int(&r, kind & 0x40 ? 6 : 4, &index)) return -1;
+      if (index == 0) {
+        if (!hpack_get_string(&r, &name_copy, &name_length)) return -1;
+      } else if (!hpack_lookup(table, index, &name, &name_length, &value,
+                               &value_length) ||
+                 !hpack_copy(&r, name, name_length, &name_copy)) {
+        return -1;
+      }
+      if (!hpack_get_string(&r, &value_copy, &value_length)) return -1;
+      if (kind & 0x40)
+        hpack_add(table, name_copy, name_length, value_copy, value_length);
+    }
+
+    if (kept < max_fields) {
+      fields[kept].key = name_copy;
+      fields[kept].value = value_copy;
+      kept++;
+    } else {
+      r.out = mark;
+    }
+  }
+  return kept;
+}
+
+/* Writes VALUE as an integer with a PREFIX_BITS prefix, the bits above which
+ * are FLAGS. */
+static size_t hpack_put_int(uint8_t* out, uint8_t flags, int prefix_bits,
+                            size_t value) {
+  size_t max = (1u << prefix_bits) - 1;
+  if (value < max) {
+    out[0] = flags | value;
+    return 1;
+  }
+  out[0] = flags | max;
+  value -= max;
+  size_t n = 1;
+  while (value >= 0x80) {
+    out[n++] = (value & 0x7f) | 0x80;
+    value >>= 7;
+  }
+  out[n++] = value;
+  return n;
+}
+
+/* Writes LENGTH bytes of STRING as a literal, Huffman coded if that is
+ * shorter. */
+static size_t hpack_put_string(uint8_t* out, const char* string,
+                               size_t length) {
+  const uint8_t* in = (const uint8_t*)string;
+  size_t bits = 0;
+  for (size_t i = 0; i < length; i++) bits += huffman_lengths[in[i]];
+  size_t huffman_length = (bits + 7) / 8;
+  if (huffman_length >= length) {
+    size_t n = hpack_put_int(out, 0x00, 7, length);
+    memcpy(out + n, string, length);
+    return n + length;
+  }
+
+  size_t n = hpack_put_int(out, 0x80, 7, huffman_length);
+  uint64_t pending = 0; /* The low PENDING_BITS bits are yet to be written. */
+  int pending_bits = 0;
+  for (size_t i = 0; i < length; i++) {
+    pending = pending << huffman_lengths[in[i]] | huffman_codes[in[i]];
+    pending_bits += huffman_lengths[in[i]];
+    while (pending_bits >= 8) {
+      pending_bits -= 8;
+      out[n++] = pending >> pending_bits;
+    }
+    pending &= (1u << pending_bits) - 1;
+  }
+  /* Padded with the most significant bits of EOS, which are all ones. */
+  if (pending_bits > 0)
+    out[n++] = pending << (8 - pending_bits) | 0xff >> pending_bits;
+  return n;
+}
+
+size_t hpack_encode_start(struct hpack_table* table, uint8_t* out) {
+  if (!table->update_pending) return 0;
+  size_t n = 0;
+  if (table->lowest < table->max_size)
+    n += hpack_put_int(out, 0x20, 5, table->lowest);
+  n += hpack_put_int(out + n, 0x20, 5, table->max_size);
+  table->lowest = table->max_size;
+  table->update_pending = false;
+  return n;
+}
+
+size_t hpack_encode(struct hpack_table* table, uint8_t* out, const char* name,
+                    const char* value, bool index) {
+  size_t name_length = strlen(name);
+  size_t value_length = strlen(value);
+
+  /* A field either table has whole is sent as its index alone. */
+  size_t name_index = 0;
+  for (int i = 0; i < HPACK_STATIC_ENTRIES; i++) {
+    if (strcmp(static_table[i].name, name) != 0) continue;
+    if (strcmp(static_table[i].value, value) == 0)
+      return hpack_put_int(out, 0x80, 7, i + 1);
+    if (name_index == 0) name_index = i + 1;
+  }
+  for (int i = 0; i < table->count; i++) {
+    struct hpack_entry* entry = hpack_entry(table, i);
+    if (entry->name_length != name_length ||
+        memcmp(entry->name, name, name_length) != 0)
+      continue;
+    if (entry->value_length == value_length &&
+        memcmp(entry->value, value, value_length) == 0)
+      return hpack_put_int(out, 0x80, 7, HPACK_STATIC_ENTRIES + 1 + i);
+    if (name_index == 0) name_index = HPACK_STATIC_ENTRIES + 1 + i;
+  }
+
+  size_t n = index ? hpack_put_int(out, 0x40, 6, name_index)
+                   : hpack_put_int(out, 0x00, 4, name_index);
+  if (name_index == 0) n += hpack_put_string(out + n, name, name_length);
+  n += hpack_put_string(out + n, value, value_length);
+  if (index) hpack_add(table, name, name_length, value, value_length);
+  return n;
+}
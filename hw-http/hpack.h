@@ -0,0 +1,83 @@
+/*
+ * HPACK (RFC 7541), the header compression of HTTP/2.
+ *
+ * Each direction of a connection has a dynamic table, which the encoder on
+ * one end and the decoder on the other keep in step: a field sent "with
+ * incremental indexing" is added to both, and can then be sent again as a
+ * single index. The decoder follows whatever the client's encoder does. The
+ * encoder here indexes the response headers that tend to repeat from one
+ * response to the next (Content-Type, Server, Cache-Control) and sends those
+ * that change every time (Content-Length, ETag, Last-Modified) as plain
+ * literals, so that they do not push the useful entries out of the table.
+ *
+ * String literals are Huffman coded whenever that makes them shorter.
+ */
+
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "libhttp.h"
+
+/* The default size of a dynamic table, and the most this side uses. */
+#define HPACK_TABLE_SIZE 4096
+
+/* An entry costs its name and value plus 32 bytes (RFC 7541, 4.1). */
+#define HPACK_ENTRY_OVERHEAD 32
+#define HPACK_MAX_ENTRIES (HPACK_TABLE_SIZE / HPACK_ENTRY_OVERHEAD)
+
+/* Most bytes hpack_encode() adds to the lengths of a name and value. */
+#define HPACK_FIELD_OVERHEAD 12
+
+struct hpack_entry {
+  char* name; /* NUL-terminated, followed by the value in one allocation. */
+  char* value;
+  size_t name_length, value_length;
+};
+
+struct hpack_table {
+  /* A ring: the newest entry is entries[first], older ones follow. */
+  struct hpack_entry entries[HPACK_MAX_ENTRIES];
+  int first, count;
+  size_t size;         /* Of the entries, as RFC 7541 counts it. */
+  size_t max_size;     /* What the size may grow to. */
+  bool update_pending; /* The encoder must announce max_size, */
+  size_t lowest;       /* after the least it was since the last time. */
+};
+
+void hpack_table_init(struct hpack_table* table);
+void hpack_table_free(struct hpack_table* table);
+
+/* Limits the encoder's TABLE to SIZE bytes, the peer's
+ * SETTINGS_HEADER_TABLE_SIZE, or HPACK_TABLE_SIZE if that is less. */
+void hpack_set_max_size(struct hpack_table* table, size_t size);
+
+/*
+ * Decodes the header block BLOCK, of LENGTH bytes, updating TABLE. The names
+ * and values are copied NUL-terminated into BUFFER, of SIZE bytes, and
+ * pointed to by FIELDS; fields past MAX_FIELDS are decoded but not kept.
+ * Returns the number of fields kept, or -1 if the block is malformed or does
+ * not fit in BUFFER. Either way TABLE is then out of step with the peer, and
+ * the connection must end with a COMPRESSION_ERROR.
+ */
+int hpack_decode(struct hpack_table* table, const uint8_t* block,
+                 size_t length, struct http_header* fields, int max_fields,
+                 char* buffer, size_t size);
+
+/* Starts a header block at OUT: announces a new table size if one is
+ * pending. Returns the number of bytes written, at most 6. */
+size_t hpack_encode_start(struct hpack_table* table, uint8_t* out);
+
+/*
+ * Encodes the field NAME: VALUE, where NAME is in lower case, at OUT, which
+ * must have room for HPACK_FIELD_OVERHEAD bytes more than NAME and VALUE. If
+ * INDEX, the field is added to TABLE for later blocks to refer to. Returns
+ * the number of bytes written.
+ */
+size_t hpack_encode(struct hpack_table* table, uint8_t* out, const char* name,
+                    const char* value, bool index);
+
+#endif
@@ -0,0 +1,871 @@
+#define _GNU_SOURCE /* memmem() */
+
+#include "http2.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "accesslog.h"
+#include "hpack.h"
+#include "reload.h"
+#include "response.h"
+#include "stats.h"
+#include "tls.h"
+#include "utlist.h"
+
+#define H2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_PREFACE_REST "SM\r\n\r\n" /* After "PRI * HTTP/2.0" and a blank. */
+
+#define H2_FRAME_HEADER_SIZE 9
+#define H2_FRAME_SIZE 16384 /* The largest frame either side starts with. */
+#define H2_MAX_FRAME_SIZE 16777215
+#define H2_INITIAL_WINDOW 65535
+#define H2_MAX_WINDOW 0x7fffffff
+
+/* Room for a frame and the start of the next. */
+#define H2_INPUT_SIZE (2 * (H2_FRAME_HEADER_SIZE + H2_FRAME_SIZE))
+/* Control frames and headers gathered to go out in one write. */
+#define H2_OUTPUT_SIZE (H2_FRAME_HEADER_SIZE + H2_FRAME_SIZE)
+/* The largest header block accepted, across its CONTINUATION frames. */
+#define H2_HEADER_BLOCK_SIZE 16384
+
+enum h2_frame_type {
+  H2_DATA = 0x0,
+  H2_HEADERS = 0x1,
+  H2_PRIORITY = 0x2,
+  H2_RST_STREAM = 0x3,
+  H2_SETTINGS = 0x4,
+  H2_PUSH_PROMISE = 0x5,
+  H2_PING = 0x6,
+  H2_GOAWAY = 0x7,
+  H2_WINDOW_UPDATE = 0x8,
+  H2_CONTINUATION = 0x9,
+};
+
+#define H2_FLAG_END_STREAM 0x1
+#define H2_FLAG_ACK 0x1
+#define H2_FLAG_END_HEADERS 0x4
+#define H2_FLAG_PADDED 0x8
+#define H2_FLAG_PRIORITY 0x20
+
+enum h2_error {
+  H2_NO_ERROR = 0x0,
+  H2_PROTOCOL_ERROR = 0x1,
+  H2_FLOW_CONTROL_ERROR = 0x3,
+  H2_FRAME_SIZE_ERROR = 0x6,
+  H2_REFUSED_STREAM = 0x7,
+  H2_COMPRESSION_ERROR = 0x9,
+  H2_ENHANCE_YOUR_CALM = 0xb,
+};
+
+enum h2_setting {
+  H2_SETTINGS_HEADER_TABLE_SIZE = 0x1,
+  H2_SETTINGS_ENABLE_PUSH = 0x2,
+  H2_SETTINGS_MAX_CONCURRENT_STREAMS = 0x3,
+  H2_SETTINGS_INITIAL_WINDOW_SIZE = 0x4,
+  H2_SETTINGS_MAX_FRAME_SIZE = 0x5,
+  H2_SETTINGS_MAX_HEADER_LIST_SIZE = 0x6,
+};
+
+/* A stream whose response is still being sent. */
+struct h2_stream {
+  uint32_t id;
+  int64_t window;     /* Body bytes the client will take on it. */
+  bool remote_closed; /* The client has sent all of its request. */
+  struct response response;
+  uint64_t started; /* When its request was decoded. */
+  struct access_log_entry log_entry;
+  struct h2_stream *prev, *next;
+};
+
+struct h2_conn {
+  int fd;
+  struct sockaddr_in* peer;
+
+  uint8_t in[H2_INPUT_SIZE];
+  size_t in_start, in_end;
+  uint8_t out[H2_OUTPUT_SIZE];
+  size_t out_length;
+
+  struct hpack_table decoder; /* For the client's header blocks. */
+  struct hpack_table encoder; /* For ours. */
+
+  /* What the client's settings and WINDOW_UPDATEs allow. */
+  int64_t window;          /* Body bytes it will take on all streams. */
+  int64_t initial_window;  /* For each new stream. */
+  uint32_t max_frame_size; /* Largest frame payload it takes. */
+
+  uint32_t last_stream;      /* The highest it opened. */
+  struct h2_stream* streams; /* Being sent, in turn order. */
+  int num_streams;
+
+  /* A header block arriving in a HEADERS frame and CONTINUATIONs. */
+  uint8_t block[H2_HEADER_BLOCK_SIZE];
+  size_t block_length;
+  uint32_t block_stream; /* 0 unless one is arriving. */
+  bool block_end_stream;
+
+  bool going_away;  /* A GOAWAY went either way: no new streams. */
+  bool goaway_sent;
+  bool failed; /* A connection error or a failed write; stop. */
+};
+
+static void h2_put32(uint8_t* p, uint32_t value) {
+  p[0] = value >> 24;
+  p[1] = value >> 16;
+  p[2] = value >> 8;
+  p[3] = value;
+}
+
+static uint32_t h2_get32(const uint8_t* p) {
+  return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static void h2_frame_header(uint8_t* p, size_t length, int type, int flags,
+                            uint32_t stream) {
+  p[0] = length >> 16;
+  p[1] = length >> 8;
+  p[2] = length;
+  p[3] = type;
+  p[4] = flags;
+  h2_put32(p + 5, stream);
+}
+
+/* Writes the queued frames followed by the LENGTH bytes of DATA, passing
+ * FLAGS (such as MSG_MORE) to the send. */
+static void h2_flush(struct h2_conn* c, const void* data, size_t length,
+                     int flags) {
+  if (c->failed || (c->out_length == 0 && length == 0)) return;
+  struct iovec iov[2] = {{c->out, c->out_length}, {(void*)data, length}};
+  if (http_sendv(c->fd, iov, length > 0 ? 2 : 1, flags) == -1)
+    c->failed = true;
+  c->out_length = 0;
+}
+
+/* Queues a frame; LENGTH is at most H2_FRAME_SIZE. */
+static void h2_queue(struct h2_conn* c, int type, int flags, uint32_t stream,
+                     const void* payload, size_t length) {
+  if (c->out_length + H2_FRAME_HEADER_SIZE + length > H2_OUTPUT_SIZE)
+    h2_flush(c, NULL, 0, 0);
+  h2_frame_header(c->out + c->out_length, length, type, flags, stream);
+  memcpy(c->out + c->out_length + H2_FRAME_HEADER_SIZE, payload, length);
+  c->out_length += H2_FRAME_HEADER_SIZE + length;
+}
+
+static void h2_rst_stream(struct h2_conn* c, uint32_t stream,
+                          enum h2_error error) {
+  uint8_t payload[4];
+  h2_put32(payload, error);
+  h2_queue(c, H2_RST_STREAM, 0, stream, payload, sizeof(payload));
+}
+
+/* Sends GOAWAY with ERROR; any error but H2_NO_ERROR ends the connection. */
+static void h2_goaway(struct h2_conn* c, enum h2_error error) {
+  if (!c->goaway_sent) {
+    uint8_t payload[8];
+    h2_put32(payload, c->last_stream);
+    h2_put32(payload + 4, error);
+    h2_queue(c, H2_GOAWAY, 0, 0, payload, sizeof(payload));
+    c->goaway_sent = true;
+  }
+  c->going_away = true;
+  if (error != H2_NO_ERROR) {
+    h2_flush(c, NULL, 0, 0);
+    c->failed = true;
+  }
+}
+
+static void h2_window_update(struct h2_conn* c, uint32_t stream,
+                             uint32_t increment) {
+  uint8_t payload[4];
+  h2_put32(payload, increment);
+  h2_queue(c, H2_WINDOW_UPDATE, 0, stream, payload, sizeof(payload));
+}
+
+static void h2_send_settings(struct h2_conn* c) {
+  uint8_t payload[12];
+  payload[0] = 0;
+  payload[1] = H2_SETTINGS_MAX_CONCURRENT_STREAMS;
+  h2_put32(payload + 2, HTTP2_MAX_STREAMS);
+  payload[6] = 0;
+  payload[7] = H2_SETTINGS_MAX_HEADER_LIST_SIZE;
+  h2_put32(payload + 8, LIBHTTP_REQUEST_MAX_SIZE);
+  h2_queue(c, H2_SETTINGS, 0, 0, payload, sizeof(payload));
+}
+
+/* Applies the LENGTH bytes of settings in PAYLOAD. Returns the connection
+ * error they amount to, if any. */
+static enum h2_error h2_apply_settings(struct h2_conn* c,
+                                       const uint8_t* payload,
+                                       size_t length) {
+  for (size_t i = 0; i + 6 <= length; i += 6) {
+    int id = payload[i] << 8 | payload[i + 1];
+    uint32_t value = h2_get32(payload + i + 2);
+    struct h2_stream* s;
+    switch (id) {
+      case H2_SETTINGS_HEADER_TABLE_SIZE:
+        hpack_set_max_size(&c->encoder, value);
+        break;
+      case H2_SETTINGS_ENABLE_PUSH:
+        if (value > 1) return H2_PROTOCOL_ERROR;
+        break;
+      case H2_SETTINGS_INITIAL_WINDOW_SIZE:
+        /* Applies to the windows of open streams as well. */
+        if (value > H2_MAX_WINDOW) return H2_FLOW_CONTROL_ERROR;
+        DL_FOREACH(c->streams, s) {
+          s->window += (int64_t)value - c->initial_window;
+          if (s->window > H2_MAX_WINDOW) return H2_FLOW_CONTROL_ERROR;
+        }
+        c->initial_window = value;
+        break;
+      case H2_SETTINGS_MAX_FRAME_SIZE:
+        if (value < H2_FRAME_SIZE || value > H2_MAX_FRAME_SIZE)
+          return H2_PROTOCOL_ERROR;
+        c->max_frame_size = value;
+        break;
+    }
+  }
+  return H2_NO_ERROR;
+}
+
+static struct h2_stream* h2_find_stream(struct h2_conn* c, uint32_t id) {
+  struct h2_stream* s;
+  DL_FOREACH(c->streams, s) {
+    if (s->id == id) return s;
+  }
+  return NULL;
+}
+
+/* Body bytes of S's response left to send. */
+static off_t h2_body_left(struct h2_stream* s) {
+  struct response* r = &s->response;
+  off_t left = r->out_len - r->out_sent;
+  if (response_body_pending(r)) left += r->file_size - r->file_offset;
+  return left;
+}
+
+/* Ends S, sent in full or not, and forgets it. S must not be in the list. */
+static void h2_stream_done(struct h2_conn* c, struct h2_stream* s) {
+  uint64_t latency = stats_now() - s->started;
+  stats_record(STATS_REQUEST, latency);
+  stats_count_response(s->response.status_code);
+  s->log_entry.status_code = s->response.status_code;
+  s->log_entry.latency_ns = latency;
+  access_log_end(&s->log_entry);
+
+  /* The response is complete, so the rest of the request is not needed. */
+  if (!s->remote_closed && !c->failed) h2_rst_stream(c, s->id, H2_NO_ERROR);
+  response_free(&s->response);
+  free(s);
+}
+
+static void h2_drop_stream(struct h2_conn* c, struct h2_stream* s) {
+  DL_DELETE(c->streams, s);
+  c->num_streams--;
+  h2_stream_done(c, s);
+}
+
+/* Connection-specific headers have no place in HTTP/2 (RFC 9113, 8.2.2). */
+static bool h2_connection_header(char* name) {
+  return strcmp(name, "connection") == 0 || strcmp(name, "keep-alive") == 0 ||
+         strcmp(name, "transfer-encoding") == 0 ||
+         strcmp(name, "upgrade") == 0;
+}
+
+/* Whether the value of NAME changes too often to be worth a table entry. */
+static bool h2_changes_often(char* name) {
+  return strcmp(name, "content-length") == 0 ||
+         strcmp(name, "content-range") == 0 || strcmp(name, "etag") == 0 ||
+         strcmp(name, "last-modified") == 0 || strcmp(name, "date") == 0;
+}
+
+/*
+ * Sends the status and headers of S's response, which
+ * response_prepare_files() wrote out for HTTP/1.1, as a header block, and
+ * leaves the rest of the output buffer, if any, as the start of the body.
+ * Returns the size of the block.
+ */
+static size_t h2_send_headers(struct h2_conn* c, struct h2_stream* s,
+                              bool head) {
+  struct response* r = &s->response;
+  char* end = memmem(r->out, r->out_len, "\r\n\r\n", 4);
+  size_t text_length = end + 4 - r->out;
+
+  /* A field costs at most HPACK_FIELD_OVERHEAD more than its line, and each
+   * line is at least 4 bytes. */
+  uint8_t block[3 * text_length + 2 * HPACK_FIELD_OVERHEAD];
+  size_t length = hpack_encode_start(&c->encoder, block);
+  char status[16];
+  snprintf(status, sizeof(status), "%d", r->status_code);
+  length += hpack_encode(&c->encoder, block + length, ":status", status, true);
+
+  /* The header lines, after the status line and up to the blank one. */
+  char* line = memchr(r->out, '\n', text_length) + 1;
+  while (line < end) {
+    char* line_end = memmem(line, end + 2 - line, "\r\n", 2);
+    char* colon = memchr(line, ':', line_end - line);
+    if (colon) {
+      char name[colon - line + 1];
+      for (char* p = line; p < colon; p++)
+        name[p - line] = tolower((unsigned char)*p);
+      name[colon - line] = '\0';
+      char* value = colon + 1;
+      while (value < line_end && *value == ' ') value++;
+      char value_copy[line_end - value + 1];
+      memcpy(value_copy, value, line_end - value);
+      value_copy[line_end - value] = '\0';
+      if (!h2_connection_header(name))
+        length += hpack_encode(&c->encoder, block + length, name, value_copy,
+                               !h2_changes_often(name));
+    }
+    line = line_end + 2;
+  }
+
+  r->out_sent = text_length;
+  if (head) {
+    r->out_sent = r->out_len;
+    r->file_offset = r->file_size;
+  }
+
+  /* In frames of the size the client takes, the first HEADERS and the rest
+   * CONTINUATION. */
+  size_t frame_size = c->max_frame_size < H2_FRAME_SIZE ? c->max_frame_size
+                                                        : H2_FRAME_SIZE;
+  int end_stream = h2_body_left(s) == 0 ? H2_FLAG_END_STREAM : 0;
+  size_t sent = 0;
+  do {
+    size_t n = length - sent < frame_size ? length - sent : frame_size;
+    int flags = sent + n == length ? H2_FLAG_END_HEADERS : 0;
+    if (sent == 0)
+      h2_queue(c, H2_HEADERS, flags | end_stream, s->id, block, n);
+    else
+      h2_queue(c, H2_CONTINUATION, flags, s->id, block + sent, n);
+    sent += n;
+  } while (sent < length);
+  return length;
+}
+
+/* Answers REQUEST, which arrived on the new stream ID. */
+static void h2_start_stream(struct h2_conn* c, uint32_t id,
+                            struct http_request* request, bool end_stream) {
+  struct h2_stream* s = calloc(1, sizeof(*s));
+  if (!s) {
+    fprintf(stderr, "Malloc failed\n");
+    exit(ENOBUFS);
+  }
+  s->id = id;
+  s->window = c->initial_window;
+  s->remote_closed = end_stream;
+  s->started = stats_now();
+  access_log_begin(&s->log_entry, c->peer, request);
+
+  /* Keep-alive means nothing to a stream, but response.c adds a Connection
+   * header either way, which is dropped. */
+  request->keep_alive = 1;
+  response_init(&s->response);
+  response_prepare_files(&s->response, request);
+  stats_record(STATS_OPEN, stats_now() - s->started);
+
+  size_t block_length =
+      h2_send_headers(c, s, strcmp(request->method, "HEAD") == 0);
+  s->log_entry.bytes = block_length + h2_body_left(s);
+  if (h2_body_left(s) == 0) {
+    h2_stream_done(c, s);
+    return;
+  }
+  DL_APPEND(c->streams, s);
+  c->num_streams++;
+}
+
+/* Makes an http_request of the NUM_FIELDS decoded FIELDS of a request
+ * received on the new stream ID, and answers it. */
+static void h2_request(struct h2_conn* c, uint32_t id,
+                       struct http_header* fields, int num_fields,
+                       bool end_stream) {
+  struct http_request request;
+  memset(&request, 0, sizeof(request));
+  request.minor_version = 1;
+  char* authority = NULL;
+  bool scheme = false;
+  for (int i = 0; i < num_fields; i++) {
+    char* name = fields[i].key;
+    if (name[0] == ':') {
+      if (strcmp(name, ":method") == 0)
+        request.method = fields[i].value;
+      else if (strcmp(name, ":path") == 0)
+        request.path = fields[i].value;
+      else if (strcmp(name, ":scheme") == 0)
+        scheme = true;
+      else if (strcmp(name, ":authority") == 0)
+        authority = fields[i].value;
+      continue;
+    }
+    if (strcmp(name, "content-length") == 0)
+      request.content_length = strtol(fields[i].value, NULL, 10);
+    if (request.num_headers < LIBHTTP_MAX_HEADERS)
+      request.headers[request.num_headers++] = fields[i];
+  }
+  if (!request.method || !request.path || !scheme ||
+      request.path[0] == '\0') {
+    h2_rst_stream(c, id, H2_PROTOCOL_ERROR);
+    return;
+  }
+
+  /* :authority stands in for Host. */
+  if (authority && !http_request_header(&request, "Host") &&
+      request.num_headers < LIBHTTP_MAX_HEADERS) {
+    request.headers[request.num_headers].key = "host";
+    request.headers[request.num_headers].value = authority;
+    request.num_headers++;
+  }
+  h2_start_stream(c, id, &request, end_stream);
+}
+
+/* Decodes the header block just completed and acts on it. */
+static void h2_end_block(struct h2_conn* c) {
+  uint32_t id = c->block_stream;
+  c->block_stream = 0;
+
+  /* Pseudo-headers and the fields libhttp would keep. */
+  struct http_header fields[LIBHTTP_MAX_HEADERS + 4];
+  char buffer[LIBHTTP_REQUEST_MAX_SIZE];
+  uint64_t started = stats_now();
+  int num_fields =
+      hpack_decode(&c->decoder, c->block, c->block_length, fields,
+                   LIBHTTP_MAX_HEADERS + 4, buffer, sizeof(buffer));
+  stats_record(STATS_PARSE, stats_now() - started);
+  if (num_fields < 0) {
+    h2_goaway(c, H2_COMPRESSION_ERROR);
+    return;
+  }
+
+  /* Trailers, or a block for a stream already answered. */
+  if (id <= c->last_stream) {
+    struct h2_stream* s = h2_find_stream(c, id);
+    if (s && c->block_end_stream) s->remote_closed = true;
+    return;
+  }
+  if (id % 2 == 0) {
+    h2_goaway(c, H2_PROTOCOL_ERROR);
+    return;
+  }
+  c->last_stream = id;
+  /* After a GOAWAY, the client retries it on a new connection. */
+  if (c->going_away) return;
+  if (c->num_streams >= HTTP2_MAX_STREAMS) {
+    h2_rst_stream(c, id, H2_REFUSED_STREAM);
+    return;
+  }
+  h2_request(c, id, fields, num_fields, c->block_end_stream);
+}
+
+/* Adds LENGTH bytes to the header block arriving. */
+static void h2_append_block(struct h2_conn* c, const uint8_t* data,
+                            size_t length, int flags) {
+  if (c->block_length + length > sizeof(c->block)) {
+    h2_goaway(c, H2_ENHANCE_YOUR_CALM);
+    return;
+  }
+  memcpy(c->block + c->block_length, data, length);
+  c->block_length += length;
+  if (flags & H2_FLAG_END_HEADERS) h2_end_block(c);
+}
+
+/* Strips the padding of a DATA or HEADERS frame. */
+static bool h2_unpad(const uint8_t** payload, size_t* length, int flags) {
+  if (!(flags & H2_FLAG_PADDED)) return true;
+  if (*length < 1 || (*payload)[0] >= *length) return false;
+  *length -= 1 + (*payload)[0];
+  (*payload)++;
+  return true;
+}
+
+static void h2_handle_frame(struct h2_conn* c, const uint8_t* frame,
+                            size_t length) {
+  int type = frame[3];
+  int flags = frame[4];
+  uint32_t stream = h2_get32(frame + 5) & 0x7fffffff;
+  const uint8_t* payload = frame + H2_FRAME_HEADER_SIZE;
+  struct h2_stream* s;
+
+  /* Nothing may come between the frames of a header block. */
+  if (c->block_stream != 0 &&
+      (type != H2_CONTINUATION || stream != c->block_stream)) {
+    h2_goaway(c, H2_PROTOCOL_ERROR);
+    return;
+  }
+
+  switch (type) {
+    case H2_DATA:
+      if (stream == 0 || stream > c->last_stream) {
+        h2_goaway(c, H2_PROTOCOL_ERROR);
+        return;
+      }
+      /* The body is thrown away, so its room is given back at once. */
+      if (length > 0) h2_window_update(c, 0, length);
+      s = h2_find_stream(c, stream);
+      if (s && !s->remote_closed) {
+        if (flags & H2_FLAG_END_STREAM)
+          s->remote_closed = true;
+        else if (length > 0)
+          h2_window_update(c, stream, length);
+      }
+      if (!h2_unpad(&payload, &length, flags))
+        h2_goaway(c, H2_PROTOCOL_ERROR);
+      return;
+
+    case H2_HEADERS:
+      if (stream == 0 || !h2_unpad(&payload, &length, flags)) {
+        h2_goaway(c, H2_PROTOCOL_ERROR);
+        return;
+      }
+      /* Priorities are advisory; this server does not use them. */
+      if (flags & H2_FLAG_PRIORITY) {
+        if (length < 5) {
+          h2_goaway(c, H2_FRAME_SIZE_ERROR);
+          return;
+        }
+        payload += 5;
+        length -= 5;
+      }
+      c->block_stream = stream;
+      c->block_length = 0;
+      c->block_end_stream = flags & H2_FLAG_END_STREAM;
+      h2_append_block(c, payload, length, flags);
+      return;
+
+    case H2_CONTINUATION:
+      if (c->block_stream == 0) {
+        h2_goaway(c, H2_PROTOCOL_ERROR);
+        return;
+      }
+      h2_append_block(c, payload, length, flags);
+      return;
+
+    case H2_PRIORITY:
+      if (stream == 0) h2_goaway(c, H2_PROTOCOL_ERROR);
+      else if (length != 5) h2_rst_stream(c, stream, H2_FRAME_SIZE_ERROR);
+      return;
+
+    case H2_RST_STREAM:
+      if (length != 4) {
+        h2_goaway(c, H2_FRAME_SIZE_ERROR);
+        return;
+      }
+      if (stream == 0 || stream > c->last_stream) {
+        h2_goaway(c, H2_PROTOCOL_ERROR);
+        return;
+      }
+      if ((s = h2_find_stream(c, stream))) {
+        /* The client wants no more of it, nor to hear so. */
+        s->remote_closed = true;
+        h2_drop_stream(c, s);
+      }
+      return;
+
+    case H2_SETTINGS:
+      if (stream != 0) {
+        h2_goaway(c, H2_PROTOCOL_ERROR);
+      } else if (flags & H2_FLAG_ACK) {
+        if (length != 0) h2_goaway(c, H2_FRAME_SIZE_ERROR);
+      } else if (length % 6 != 0) {
+        h2_goaway(c, H2_FRAME_SIZE_ERROR);
+      } else {
+        enum h2_error error = h2_apply_settings(c, payload, length);
+        if (error != H2_NO_ERROR)
+          h2_goaway(c, error);
+        else
+          h2_queue(c, H2_SETTINGS, H2_FLAG_ACK, 0, NULL, 0);
+      }
+      return;
+
+    case H2_PUSH_PROMISE:
+      h2_goaway(c, H2_PROTOCOL_ERROR);
+      return;
+
+    case H2_PING:
+      if (length != 8)
+        h2_goaway(c, H2_FRAME_SIZE_ERROR);
+      else if (stream != 0)
+        h2_goaway(c, H2_PROTOCOL_ERROR);
+      else if (!(flags & H2_FLAG_ACK))
+        h2_queue(c, H2_PING, H2_FLAG_ACK, 0, payload, length);
+      return;
+
+    case H2_GOAWAY:
+      /* It will start no more streams; those under way are finished. */
+      c->going_away = true;
+      return;
+
+    case H2_WINDOW_UPDATE: {
+      if (length != 4) {
+        h2_goaway(c, H2_FRAME_SIZE_ERROR);
+        return;
+      }
+      uint32_t increment = h2_get32(payload) & 0x7fffffff;
+      if (stream == 0) {
+        c->window += increment;
+        if (increment == 0) h2_goaway(c, H2_PROTOCOL_ERROR);
+        if (c->window > H2_MAX_WINDOW) h2_goaway(c, H2_FLOW_CONTROL_ERROR);
+      } else if ((s = h2_find_stream(c, stream))) {
+        s->window += increment;
+        if (increment == 0 || s->window > H2_MAX_WINDOW) {
+          h2_rst_stream(c, stream, increment == 0 ? H2_PROTOCOL_ERROR
+                                                  : H2_FLOW_CONTROL_ERROR);
+          s->remote_closed = true;
+          h2_drop_stream(c, s);
+        }
+      }
+      return;
+    }
+
+    default:
+      /* Unknown frame types are ignored. */
+      return;
+  }
+}
+
+/* Sends S one DATA frame of body, as large as the windows allow. */
+static void h2_send_data(struct h2_conn* c, struct h2_stream* s) {
+  struct response* r = &s->response;
+  off_t left = h2_body_left(s);
+  off_t length = c->max_frame_size;
+  if (length > c->window) length = c->window;
+  if (length > s->window) length = s->window;
+  /* Bytes generated into the output buffer come before the file's. */
+  bool from_out = r->out_sent < r->out_len;
+  if (from_out && length > (off_t)(r->out_len - r->out_sent))
+    length = r->out_len - r->out_sent;
+  if (length > left) length = left;
+
+  uint8_t header[H2_FRAME_HEADER_SIZE];
+  h2_frame_header(header, length, H2_DATA,
+                  length == left ? H2_FLAG_END_STREAM : 0, s->id);
+  if (c->out_length + sizeof(header) > H2_OUTPUT_SIZE)
+    h2_flush(c, NULL, 0, 0);
+  memcpy(c->out + c->out_length, header, sizeof(header));
+  c->out_length += sizeof(header);
+
+  if (from_out) {
+    h2_flush(c, r->out + r->out_sent, length, 0);
+    r->out_sent += length;
+  } else if (r->cached) {
+    h2_flush(c, r->cached->body + r->file_offset, length, 0);
+    r->file_offset += length;
+  } else {
+    /* The file may have shrunk, but the frame's length is promised. */
+    h2_flush(c, NULL, 0, MSG_MORE);
+    if (!c->failed && http_send_file(c->fd, r->file_fd, r->file_offset,
+                                     length) != (ssize_t)length)
+      c->failed = true;
+    r->file_offset += length;
+  }
+  c->window -= length;
+  s->window -= length;
+}
+
+/* Gives each stream its turn at sending body. Returns whether any could send
+ * more right away. */
+static bool h2_send_bodies(struct h2_conn* c) {
+  bool more = false;
+  struct h2_stream *s, *next;
+  DL_FOREACH_SAFE(c->streams, s, next) {
+    off_t turn = 0;
+    while (!c->failed && turn < HTTP2_TURN_SIZE && c->window > 0 &&
+           s->window > 0 && h2_body_left(s) > 0) {
+      off_t left = h2_body_left(s);
+      h2_send_data(c, s);
+      turn += left - h2_body_left(s);
+    }
+    if (c->failed) return false;
+    if (h2_body_left(s) == 0)
+      h2_drop_stream(c, s);
+    else if (c->window > 0 && s->window > 0)
+      more = true;
+  }
+  return more;
+}
+
+/* Reads what the client has sent. Returns false once it hangs up, or the
+ * read fails or times out. */
+static bool h2_fill(struct h2_conn* c) {
+  if (c->in_start > 0) {
+    memmove(c->in, c->in + c->in_start, c->in_end - c->in_start);
+    c->in_end -= c->in_start;
+    c->in_start = 0;
+  }
+  while (1) {
+    char* into = (char*)c->in + c->in_end;
+    size_t room = sizeof(c->in) - c->in_end;
+    ssize_t bytes_read = tls_wraps_reads(c->fd)
+                             ? tls_read(c->fd, into, room)
+                             : read(c->fd, into, room);
+    if (bytes_read < 0 && errno == EINTR) continue;
+    if (bytes_read <= 0) return false;
+    c->in_end += bytes_read;
+    return true;
+  }
+}
+
+static bool h2_readable(struct h2_conn* c) {
+  struct pollfd pollfd = {.fd = c->fd, .events = POLLIN};
+  return poll(&pollfd, 1, 0) > 0;
+}
+
+/* Returns the next frame buffered whole, setting *LENGTH to the length of
+ * its payload, or NULL if there is none yet. */
+static const uint8_t* h2_next_frame(struct h2_conn* c, size_t* length) {
+  size_t available = c->in_end - c->in_start;
+  if (available < H2_FRAME_HEADER_SIZE) return NULL;
+  const uint8_t* frame = c->in + c->in_start;
+  *length = frame[0] << 16 | frame[1] << 8 | frame[2];
+  /* No larger frame was allowed by the settings sent. */
+  if (*length > H2_FRAME_SIZE) {
+    h2_goaway(c, H2_FRAME_SIZE_ERROR);
+    return NULL;
+  }
+  if (available < H2_FRAME_HEADER_SIZE + *length) return NULL;
+  c->in_start += H2_FRAME_HEADER_SIZE + *length;
+  return frame;
+}
+
+/* Consumes PREFACE, reading it in if need be. */
+static bool h2_read_preface(struct h2_conn* c, const char* preface) {
+  size_t length = strlen(preface);
+  while (c->in_end - c->in_start < length)
+    if (!h2_fill(c)) return false;
+  if (memcmp(c->in + c->in_start, preface, length) != 0) return false;
+  c->in_start += length;
+  return true;
+}
+
+/* Decodes the HTTP2-Settings header of an upgrade, unpadded base64url. */
+static size_t h2_decode_settings(char* value, uint8_t* out, size_t size) {
+  static const char alphabet[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+  uint32_t bits = 0;
+  int num_bits = 0;
+  size_t length = 0;
+  for (char* p = value; *p && *p != '='; p++) {
+    char* digit = strchr(alphabet, *p);
+    if (!digit) return 0;
+    bits = bits << 6 | (digit - alphabet);
+    num_bits += 6;
+    if (num_bits >= 8) {
+      num_bits -= 8;
+      if (length == size) return 0;
+      out[length++] = bits >> num_bits;
+    }
+  }
+  return length;
+}
+
+bool http2_is_preface(struct http_request* request) {
+  return strcmp(request->method, "PRI") == 0 &&
+         strcmp(request->path, "*") == 0;
+}
+
+bool http2_is_upgrade(struct http_request* request) {
+  /* h2c is for cleartext; over TLS, h2 is picked by ALPN instead. */
+  if (tls_enabled() || request->content_length > 0) return false;
+  char* upgrade = http_request_header(request, "Upgrade");
+  return upgrade && strcasecmp(upgrade, "h2c") == 0 &&
+         http_request_header(request, "HTTP2-Settings") != NULL;
+}
+
+void http2_serve(int fd, struct http_reader* reader,
+                 struct http_request* request, struct sockaddr_in* peer) {
+  struct h2_conn* c = calloc(1, sizeof(*c));
+  if (!c) {
+    fprintf(stderr, "Malloc failed\n");
+    exit(ENOBUFS);
+  }
+  c->fd = fd;
+  c->peer = peer;
+  hpack_table_init(&c->decoder);
+  hpack_table_init(&c->encoder);
+  c->window = c->initial_window = H2_INITIAL_WINDOW;
+  c->max_frame_size = H2_FRAME_SIZE;
+
+  /* What the HTTP/1 reader read past REQUEST is the start of HTTP/2. */
+  c->in_end = reader->end - reader->start;
+  memcpy(c->in, reader->buffer + reader->start, c->in_end);
+
+  const char* preface = H2_PREFACE;
+  bool upgrade = request && !http2_is_preface(request);
+  if (request && !upgrade) preface = H2_PREFACE_REST;
+  if (upgrade) {
+    static char switching[] =
+        "HTTP/1.1 101 Switching Protocols\r\n"
+        "Connection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+    struct iovec iov = {switching, strlen(switching)};
+    uint8_t settings[H2_FRAME_SIZE];
+    size_t length = h2_decode_settings(
+        http_request_header(request, "HTTP2-Settings"), settings,
+        sizeof(settings));
+    if (http_sendv(fd, &iov, 1, MSG_MORE) == -1 ||
+        h2_apply_settings(c, settings, length - length % 6) != H2_NO_ERROR)
+      c->failed = true;
+  }
+
+  /* The server's preface, then the answer to an upgraded request. */
+  h2_send_settings(c);
+  if (upgrade && !c->failed) {
+    c->last_stream = 1;
+    h2_start_stream(c, 1, request, true);
+  }
+  h2_flush(c, NULL, 0, 0);
+  if (!c->failed && !h2_read_preface(c, preface)) c->failed = true;
+
+  /* Corked, the tail of each DATA frame waits for the next instead of going
+   * out as a small segment that Nagle holds back for the client's ACK. */
+  http_set_cork(fd, 1);
+  bool settings_seen = false;
+  while (!c->failed) {
+    const uint8_t* frame;
+    size_t length;
+    while (!c->failed && (frame = h2_next_frame(c, &length))) {
+      /* The client's preface ends with its SETTINGS. */
+      if (!settings_seen && frame[3] != H2_SETTINGS) {
+        h2_goaway(c, H2_PROTOCOL_ERROR);
+        break;
+      }
+      settings_seen = true;
+      h2_handle_frame(c, frame, length);
+    }
+    if (c->failed) break;
+
+    /* A generation being reloaded finishes the streams it has, then hangs
+     * up so the client reconnects to the new one. */
+    if (reload_draining() && !c->goaway_sent) h2_goaway(c, H2_NO_ERROR);
+
+    bool more = h2_send_bodies(c);
+    if (c->failed || (c->going_away && c->streams == NULL)) break;
+    if (more && !h2_readable(c)) continue;
+    h2_flush(c, NULL, 0, 0);
+    /* Before waiting on the client, send whatever the cork holds. */
+    http_set_cork(fd, 0);
+    if (!h2_fill(c)) break;
+    http_set_cork(fd, 1);
+  }
+
+  if (!c->failed) h2_goaway(c, H2_NO_ERROR);
+  h2_flush(c, NULL, 0, 0);
+  http_set_cork(fd, 0);
+  struct h2_stream *s, *next;
+  DL_FOREACH_SAFE(c->streams, s, next) {
+    s->remote_closed = true;
+    h2_drop_stream(c, s);
+  }
+  hpack_table_free(&c->decoder);
+  hpack_table_free(&c->encoder);
+  free(c);
+}
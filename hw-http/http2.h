@@ -0,0 +1,58 @@
+/*
+ * HTTP/2 (RFC 9113) for --files, in the blocking variants.
+ *
+ * handle_files_request() hands a connection over when the client speaks
+ * HTTP/2: when TLS picked "h2" by ALPN, when a plain connection opens with
+ * the HTTP/2 preface (h2c with prior knowledge), or when an HTTP/1.1 request
+ * asks to be upgraded to h2c. Many requests then share the one connection as
+ * streams, which saves a browser the handshakes of the parallel connections
+ * it would otherwise open.
+ *
+ * The thread serving the connection answers each request as soon as its
+ * headers are in, with response_prepare_files() as the event-driven servers
+ * do, so the open and file caches serve HTTP/2 as they do HTTP/1.1. The
+ * response's headers go out HPACK-encoded (hpack.h) in a HEADERS frame. The
+ * bodies of all the streams in flight are then sent in turns, up to
+ * HTTP2_TURN_SIZE bytes each, so a large file does not hold up the small ones
+ * asked for after it. Between turns the thread handles whatever frames the
+ * client has sent, so a new request does not wait for the bodies either.
+ * Bodies come from memory for cached files and by sendfile() after each DATA
+ * frame's header for the rest.
+ *
+ * Flow control is honoured for what the server sends. Request bodies are
+ * only read to be thrown away, as for HTTP/1.1, and their window is opened
+ * again as they arrive. Server push and priorities are not implemented; the
+ * latter are only advisory.
+ */
+
+#ifndef HTTP2_H
+#define HTTP2_H
+
+#include <netinet/in.h>
+#include <stdbool.h>
+
+#include "libhttp.h"
+
+/* Streams with a response in progress, as SETTINGS_MAX_CONCURRENT_STREAMS. */
+#define HTTP2_MAX_STREAMS 100
+
+/* Body bytes a stream sends before the next stream's turn. */
+#define HTTP2_TURN_SIZE 65536
+
+/* Whether REQUEST, just parsed as HTTP/1, is the first half of the HTTP/2
+ * client preface, "PRI * HTTP/2.0". */
+bool http2_is_preface(struct http_request* request);
+
+/* Whether REQUEST asks to switch its connection to h2c, and may. */
+bool http2_is_upgrade(struct http_request* request);
+
+/*
+ * Serves the HTTP/2 connection FD from PEER until it ends, without closing
+ * FD. READER holds what has been read from FD past REQUEST, which is either
+ * NULL (after ALPN), the preface (see http2_is_preface()) or the request to
+ * upgrade, which is answered on stream 1.
+ */
+void http2_serve(int fd, struct http_reader* reader,
+                 struct http_request* request, struct sockaddr_in* peer);
+
+#endif
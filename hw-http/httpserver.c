@@ -1,23 +1,53 @@
+#define _GNU_SOURCE /* accept4() */
+
 #include <arpa/inet.h>
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <netdb.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/prctl.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <wait.h>
 
+#include "accesslog.h"
+#include "affinity.h"
+#include "filecache.h"
+#include "http2.h"
+#include "httpserver.h"
+#include "iopool.h"
 #include "libhttp.h"
+#include "opencache.h"
+#include "proxycache.h"
+#include "proxypool.h"
+#include "reload.h"
+#include "stats.h"
+#include "tls.h"
+#include "workstealing.h"
 #include "wq.h"
 
+/* Bytes each direction of a proxied connection holds in its pipe. */
+#define RELAY_PIPE_SIZE 65536
+
+/* With --max-threads, a socket queued this long calls for another worker,
+ * and a worker beyond --num-threads idle this long retires. */
+#define POOL_GROW_WAIT_NS 5000000
+#define POOL_IDLE_TIMEOUT 10
+
+/* How often a paused acceptor looks at the queue again should a worker's
+ * wakeup be missed. */
+#define POOL_PAUSE_RECHECK_NS 10000000
+
 /*
  * Global configuration variables.
  * You need to use these in your implementation of handle_files_request and
@@ -26,42 +56,261 @@
  */
 wq_t work_queue;  // Only used by poolserver
 int num_threads;  // Only used by poolserver
+int max_threads;  // Only used by poolserver; 0 keeps num_threads workers
+int work_stealing;  // Only used by poolserver
+int queue_high;  // Only used by poolserver; 0 queues without limit
+int queue_low;  // Only used by poolserver; default queue_high / 2
+int overload_pause;  // Pause accept() above queue_high rather than send 503
+ws_pool_t steal_pool;  // Replaces work_queue with --work-stealing
 int server_port;  // Default value: 8000
+int server_idle_timeout;  // Default value: 5 seconds
+int server_request_timeout;  // Default value: 10 seconds to send the headers
+int server_proxy_timeout;  // Default value: 60 seconds of silence
+int server_drain_timeout;  // Default value: 30 seconds to finish a reload
+int server_acceptors;  // Default value: 1
+int server_prefork;  // Only used by forkserver; 0 forks per connection
+int server_incoming_cpu;  // Steer connections to the acceptor on their CPU
 char* server_files_directory;
-char* server_proxy_hostname;
-int server_proxy_port;
+char* server_proxy_hostname;  // The upstreams, "host:port,host:port,..."
+int server_proxy_pool;  // Default value: 0 warm connections per upstream
+enum proxy_balance server_proxy_balance;  // Default value: least-conn
+
+/* Bytes of the response being sent by this thread, for the access log. */
+static __thread uint64_t response_bytes;
+
+/* Adds SENT, the result of a send, to response_bytes and returns it. */
+static ssize_t count_sent(ssize_t sent) {
+  if (sent > 0) response_bytes += sent;
+  return sent;
+}
+
+/* Sends a response without a body. Returns whether the connection can be
+ * reused. */
+static int send_empty_response(int fd, int status_code, int keep_alive) {
+  struct http_response response;
+  http_response_start(&response, status_code);
+  http_response_header(&response, "Content-Type", "text/html");
+  http_response_header(&response, "Content-Length", "0");
+  http_response_connection(&response, keep_alive);
+  ssize_t sent = count_sent(http_response_send(&response, fd, NULL, 0, 0));
+  return sent < 0 ? 0 : keep_alive;
+}
 
 /*
- * Serves the contents the file stored at `path` to the client socket `fd`.
- * It is the caller's reponsibility to ensure that the file stored at `path`
- * exists.
+ * Like serve_file(), but sends the contents of FILE, which hold PATH encoded
+ * with Content-Encoding ENCODING unless that is NULL, and answers the
+ * conditional and Range headers of REQUEST if it is not NULL. Sets
+ * *STATUS_CODE to the status sent.
  */
-void serve_file(int fd, char* path) {
+static int serve_encoded_file(int fd, struct http_request* request, char* path,
+                              char* file, char* encoding, int keep_alive,
+                              int* status_code) {
   /** DONE: PART 2 */
   /* PART 2 BEGIN */
-  // Read size of the file.
-  int filedes = open(path, O_RDONLY);
-  off_t file_size = lseek(filedes, 0, SEEK_END);
-  char file_size_str[24];
-  snprintf(file_size_str, 24, "%ld", file_size);
+  // Read size and version of the file.
+  uint64_t started = stats_now();
+  struct stat file_stat;
+  struct open_cache_entry* handle;
+  int filedes = open_cache_open(file, &file_stat, &handle);
+  if (filedes == -1) {
+    *status_code = 404;
+    return send_empty_response(fd, 404, keep_alive);
+  }
+  uint64_t opened = stats_now();
+  stats_add(STATS_OPEN, opened - started);
+
+  char etag[LIBHTTP_ETAG_SIZE];
+  off_t start, length;
+  http_format_etag(etag, file_stat.st_size, &file_stat.st_mtim, encoding);
+  int status = http_file_status(request, etag, file_stat.st_mtime,
+                                file_stat.st_size, &start, &length);
+  bool has_body = status == 200 || status == 206;
+  *status_code = status;
+
+  // Send header in one write, held back to share a packet with the body.
+  struct http_response response;
+  http_response_start(&response, status);
+  http_response_file_headers(&response, status, http_get_mime_type(path),
+                             encoding, etag, file_stat.st_mtime,
+                             file_stat.st_size, start, length);
+  http_response_connection(&response, keep_alive);
+  ssize_t sent = count_sent(
+      http_response_send(&response, fd, NULL, 0, has_body ? MSG_MORE : 0));
+
+  // Send body straight from the page cache.
+  if (sent >= 0 && has_body)
+    sent = count_sent(http_send_file(fd, filedes, start, length));
+  stats_add(STATS_SEND, stats_now() - opened);
+
+  open_cache_close(filedes, handle);
 
-  // Send header.
-  http_start_response(fd, 200);
-  http_send_header(fd, "Content-Type", http_get_mime_type(path));
-  http_send_header(fd, "Content-Length", file_size_str);
-  http_end_headers(fd);
+  /* PART 2 END */
+  return keep_alive && sent >= 0 && (!has_body || sent == length);
+}
 
-  // Send body.
-  lseek(filedes, 0, SEEK_SET);
-  char buf[4096];
-  ssize_t len;
+/*
+ * Serves the contents the file stored at `path` to the client socket `fd`.
+ * It is the caller's reponsibility to ensure that the file stored at `path`
+ * exists. Returns whether the connection can carry another request, which is
+ * `keep_alive` unless sending failed.
+ */
+int serve_file(int fd, char* path, int keep_alive) {
+  int status_code;
+  return serve_encoded_file(fd, NULL, path, path, NULL, keep_alive,
+                            &status_code);
+}
 
-  while ((len = read(filedes, buf, 4096)) > 0) write(fd, buf, len);
+/* Sends the cached file ENTRY from memory, answering the conditional and
+ * Range headers of REQUEST. Sets *STATUS_CODE to the status sent. Returns
+ * whether the connection can be reused. */
+static int serve_cached_file(int fd, struct http_request* request,
+                             struct file_cache_entry* entry, int keep_alive,
+                             int* status_code) {
+  off_t start, length;
+  int status = http_file_status(request, entry->etag, entry->mtime.tv_sec,
+                                entry->size, &start, &length);
+  *status_code = status;
+
+  /* Anything but a plain 200 needs headers of its own. */
+  struct http_response response;
+  struct iovec iov[3];
+  int iovcnt = 0;
+  if (status == 200) {
+    char* connection = keep_alive ? "Connection: keep-alive\r\n\r\n"
+                                  : "Connection: close\r\n\r\n";
+    iov[iovcnt++] = (struct iovec){entry->headers, entry->headers_length};
+    iov[iovcnt++] = (struct iovec){connection, strlen(connection)};
+  } else {
+    http_response_start(&response, status);
+    http_response_file_headers(&response, status, entry->content_type,
+                               entry->encoding, entry->etag,
+                               entry->mtime.tv_sec, entry->size, start, length);
+    http_response_connection(&response, keep_alive);
+    if (http_response_end(&response) == -1) return 0;
+    iov[iovcnt++] = (struct iovec){response.buffer, response.length};
+  }
+  if (status == 200 || status == 206)
+    iov[iovcnt++] = (struct iovec){entry->body + start, length};
+  uint64_t started = stats_now();
+  ssize_t sent = count_sent(http_sendv(fd, iov, iovcnt, 0));
+  stats_add(STATS_SEND, stats_now() - started);
+  return sent < 0 ? 0 : keep_alive;
+}
 
-  /* PART 2 END */
+/* The precompressed siblings looked for, best first. */
+static struct {
+  char* encoding;
+  char* extension;
+} precompressed[] = {{"br", ".br"}, {"gzip", ".gz"}};
+
+struct file_cache_entry* negotiate_file(struct http_request* request,
+                                        char* path, struct stat* file_stat,
+                                        char* file, char** encoding) {
+  struct stat sibling_stat;
+  *encoding = NULL;
+  strcpy(file, path);
+  for (size_t i = 0; i < sizeof(precompressed) / sizeof(precompressed[0]);
+       i++) {
+    if (!http_accepts_encoding(request, precompressed[i].encoding)) continue;
+    sprintf(file, "%s%s", path, precompressed[i].extension);
+    /* A sibling older than the file was not made from its current version. */
+    if (open_cache_stat(file, &sibling_stat) == 0 &&
+        S_ISREG(sibling_stat.st_mode) &&
+        sibling_stat.st_mtime >= file_stat->st_mtime) {
+      *encoding = precompressed[i].encoding;
+      return file_cache_get_encoded(path, file, &sibling_stat, *encoding);
+    }
+    strcpy(file, path);
+  }
+
+  struct file_cache_entry* entry = NULL;
+  if (file_cache_can_compress(path) && http_accepts_encoding(request, "gzip"))
+    entry = file_cache_get_encoded(path, NULL, file_stat, "gzip");
+  return entry ? entry : file_cache_get(path, file_stat);
+}
+
+/* Serves the regular file at `path`, whose metadata is `file_stat`, in the
+ * best encoding the client accepts, from the file cache when it is enabled
+ * and the file fits. Sets *STATUS_CODE to the status sent. */
+static int serve_regular_file(int fd, struct http_request* request, char* path,
+                              struct stat* file_stat, int* status_code) {
+  int keep_alive = request->keep_alive;
+  char file[strlen(path) + 4];
+  char* encoding;
+  uint64_t started = stats_now();
+  struct file_cache_entry* entry =
+      negotiate_file(request, path, file_stat, file, &encoding);
+  stats_add(STATS_OPEN, stats_now() - started);
+  if (entry == NULL)
+    return serve_encoded_file(fd, request, path, file, encoding, keep_alive,
+                              status_code);
+
+  keep_alive = serve_cached_file(fd, request, entry, keep_alive, status_code);
+  file_cache_release(entry);
+  return keep_alive;
+}
+
+/*
+ * Streams the listing of the directory PATH, whose metadata is DIR_STAT, as
+ * it is read, in chunked transfer coding, instead of rendering it whole
+ * first. Only for HTTP/1.1 requests without a Range header, since neither an
+ * HTTP/1.0 client nor a byte range can do without the length. Conditional
+ * requests are still answered, with the ETag a cached listing would have.
+ * Sets *STATUS_CODE. Returns whether the connection can be reused, or -1 if
+ * the directory cannot be read and nothing was sent.
+ */
+static int serve_listing_chunked(int fd, struct http_request* request,
+                                 char* path, struct stat* dir_stat,
+                                 int* status_code) {
+  DIR* dir = opendir(path);
+  if (dir == NULL) return -1;
+
+  char etag[LIBHTTP_ETAG_SIZE], last_modified[LIBHTTP_DATE_SIZE];
+  off_t start, length;
+  http_format_etag(etag, dir_stat->st_size, &dir_stat->st_mtim, NULL);
+  http_format_date(last_modified, dir_stat->st_mtime);
+  /* With no Range, the size does not matter: the answer is 200 or 304. */
+  int status = http_file_status(request, etag, dir_stat->st_mtime, 0, &start,
+                                &length);
+  *status_code = status;
+
+  struct http_response response;
+  http_response_start(&response, status);
+  if (status == 200) {
+    http_response_header(&response, "Content-Type",
+                         http_get_mime_type(".html"));
+    http_response_header(&response, "Transfer-Encoding", "chunked");
+  }
+  http_response_header(&response, "ETag", etag);
+  http_response_header(&response, "Last-Modified", last_modified);
+  http_response_connection(&response, request->keep_alive);
+  ssize_t sent = count_sent(http_response_send(&response, fd, NULL, 0,
+                                               status == 200 ? MSG_MORE : 0));
+
+  if (sent >= 0 && status == 200) {
+    struct http_chunked chunked;
+    http_chunked_init(&chunked, fd);
+    for (struct dirent* ent = readdir(dir); ent && sent >= 0;
+         ent = readdir(dir)) {
+      char href[strlen("<a href=\"//\"></a><br/>") + strlen(path) +
+                strlen(ent->d_name) * 2 + 1];
+      http_format_href(href, path, ent->d_name);
+      if (http_chunked_write(&chunked, href, strlen(href)) == -1) sent = -1;
+    }
+    if (sent >= 0) sent = count_sent(http_chunked_finish(&chunked));
+  }
+  closedir(dir);
+  return sent < 0 ? 0 : request->keep_alive;
 }
 
-void serve_directory(int fd, char* path) {
+/*
+ * Serves the directory at `path`: its index.html when there is one, a listing
+ * of its entries otherwise. Sets *STATUS_CODE to the status sent. Returns
+ * whether the connection can be reused.
+ */
+int serve_directory(int fd, struct http_request* request, char* path,
+                    struct stat* dir_stat, int* status_code) {
+  int keep_alive = request->keep_alive;
   /** DONE: PART 3 */
   /* PART 3 BEGIN */
 
@@ -70,36 +319,122 @@ void serve_directory(int fd, char* path) {
   char buf[512 + strlen(path)];
 
   snprintf(index_html_path, 1024, "%s/index.html", path);
-  if (!access(index_html_path, R_OK)) {
+  struct stat index_stat;
+  if (open_cache_stat_readable(index_html_path, &index_stat) == 0) {
     http_format_index(buf, path);
-    serve_file(fd, buf);
-    return;
+    if (open_cache_stat(buf, &index_stat) == 0)
+      return serve_regular_file(fd, request, buf, &index_stat, status_code);
+    *status_code = 404;
+    return send_empty_response(fd, 404, keep_alive);
+  }
+
+  /* Without a index.html in this directory. Unless there is a file cache to
+   * keep it in, the listing is streamed to clients that can take that. */
+  if (!file_cache_enabled() && request->minor_version >= 1 &&
+      http_request_header(request, "Range") == NULL) {
+    keep_alive =
+        serve_listing_chunked(fd, request, path, dir_stat, status_code);
+    if (keep_alive != -1) return keep_alive;
+    *status_code = 404;
+    return send_empty_response(fd, 404, request->keep_alive);
   }
 
-  /* Without a index.html in this directory. */
-  http_start_response(fd, 200);
-  http_send_header(fd, "Content-Type", http_get_mime_type(".html"));
-  http_end_headers(fd);
+  /* Otherwise it is rendered in full (or taken from the file cache) and sent
+   * like a cached file. */
+  uint64_t started = stats_now();
+  struct file_cache_entry* listing = file_cache_get_listing(path, dir_stat);
+  stats_add(STATS_OPEN, stats_now() - started);
+  if (listing == NULL) {
+    *status_code = 404;
+    return send_empty_response(fd, 404, keep_alive);
+  }
+
+  keep_alive =
+      serve_cached_file(fd, request, listing, keep_alive, status_code);
+  file_cache_release(listing);
+  /* PART 3 END */
+  return keep_alive;
+}
+
+/* Answers a request for the metrics endpoint. */
+static int serve_stats(int fd, bool json, int keep_alive) {
+  char* body = stats_render(json);
+  size_t length = strlen(body);
+
+  struct http_response response;
+  http_response_start(&response, 200);
+  http_response_header(&response, "Content-Type",
+                       json ? "application/json" : "text/plain");
+  http_response_header_long(&response, "Content-Length", length);
+  http_response_header(&response, "Cache-Control", "no-store");
+  http_response_connection(&response, keep_alive);
+  ssize_t sent = count_sent(http_response_send(&response, fd, body, length, 0));
+
+  free(body);
+  return sent < 0 ? 0 : keep_alive;
+}
+
+/*
+ * Answers a single request on the client socket (fd), and sets *STATUS_CODE
+ * to the status it was answered with. Returns whether the connection can
+ * carry another request.
+ */
+static int serve_files_request(int fd, struct http_request* request,
+                               int* status_code) {
+  bool json;
+  *status_code = 400;
+  if (request->path[0] != '/')
+    return send_empty_response(fd, 400, 0);
+
+  *status_code = 403;
+  if (strstr(request->path, "..") != NULL)
+    return send_empty_response(fd, 403, request->keep_alive);
+
+  *status_code = 200;
+  if (stats_is_stats_path(request->path, &json))
+    return serve_stats(fd, json, request->keep_alive);
+
+  /* Remove beginning `./`. The copy lives on the stack, so nothing about a
+   * request is allocated from the heap. */
+  char path[2 + strlen(request->path) + 1];
+  path[0] = '.';
+  path[1] = '/';
+  memcpy(path + 2, request->path, strlen(request->path) + 1);
 
-  /** DONE: Open the directory (Hint: opendir() may be useful here) */
-  DIR* dir = opendir(path);
   /**
-   * DONE: For each entry in the directory (Hint: look at the usage of readdir()
-   * ), send a string containing a properly formatted HTML. (Hint: the
-   * http_format_href() function in libhttp.c may be useful here)
+   * DONE: PART 2 is to serve files. If the file given by `path` exists,
+   * call serve_file() on it. Else, serve a 404 Not Found error below.
+   * The `stat()` syscall will be useful here.
+   *
+   * DONE: PART 3 is to serve both files and directories. You will need to
+   * determine when to call serve_file() or serve_directory() depending
+   * on `path`. Make your edits below here in this function.
    */
-  for (struct dirent* ptr = readdir(dir); ptr; ptr = readdir(dir)) {
-    http_format_href(buf, path, ptr->d_name);
-    write(fd, buf, strlen(buf) + 1);
+
+  /* PART 2 & 3 BEGIN */
+  struct stat file_stat;
+  uint64_t started = stats_now();
+  int status = open_cache_stat(path, &file_stat);
+  stats_add(STATS_OPEN, stats_now() - started);
+  int keep_alive;
+
+  if (status == 0 && S_ISREG(file_stat.st_mode))
+    keep_alive = serve_regular_file(fd, request, path, &file_stat, status_code);
+  else if (status == 0 && S_ISDIR(file_stat.st_mode))
+    keep_alive = serve_directory(fd, request, path, &file_stat, status_code);
+  else {
+    *status_code = 404;
+    keep_alive = send_empty_response(fd, 404, request->keep_alive);
   }
 
-  closedir(dir);
-  /* PART 3 END */
+  /* PART 2 & 3 END */
+
+  return keep_alive;
 }
 
 /*
- * Reads an HTTP request from client socket (fd), and writes an HTTP response
- * containing:
+ * Reads HTTP requests from client socket (fd), and writes an HTTP response to
+ * each of them containing:
  *
  *   1) If user requested an existing file, respond with the file
  *   2) If user requested a directory and index.html exists in the directory,
@@ -108,167 +443,492 @@ void serve_directory(int fd, char* path) {
  *      of files in the directory with links to each.
  *   4) Send a 404 Not Found response.
  *
+ *   Requests are served one after another for as long as the client keeps the
+ *   connection alive (HTTP/1.1, or HTTP/1.0 with "Connection: keep-alive"). A
+ *   connection that stays idle for server_idle_timeout seconds, or takes more
+ *   than server_request_timeout seconds to send a request, is dropped, so it
+ *   cannot pin a pool worker forever.
+ *
  *   Closes the client socket (fd) when finished.
  */
 void handle_files_request(int fd) {
-  struct http_request* request = http_request_parse(fd);
+  struct timeval timeout = {.tv_sec = server_idle_timeout, .tv_usec = 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
 
-  if (request == NULL || request->path[0] != '/') {
-    http_start_response(fd, 400);
-    http_send_header(fd, "Content-Type", "text/html");
-    http_end_headers(fd);
+  if (tls_enabled() && tls_accept(fd) == -1) {
     close(fd);
     return;
   }
 
-  if (strstr(request->path, "..") != NULL) {
-    http_start_response(fd, 403);
-    http_send_header(fd, "Content-Type", "text/html");
-    http_end_headers(fd);
-    close(fd);
+  struct http_reader reader;
+  http_reader_init(&reader, fd);
+
+  /* Looked up once, for the access log of every request on the
+   * connection. */
+  struct sockaddr_in peer = {0};
+  socklen_t peer_length = sizeof(peer);
+  if (access_log_enabled())
+    getpeername(fd, (struct sockaddr*)&peer, &peer_length);
+
+  int keep_alive = 1;
+  if (tls_negotiated_h2(fd)) {
+    http2_serve(fd, &reader, NULL, &peer);
+    keep_alive = 0;
+  }
+
+  struct access_log_entry log_entry;
+  while (keep_alive) {
+    /* Same as http_read_request(), but only the parsing is timed, not the
+     * wait for the client to send the request. */
+    struct http_request request;
+    int status;
+    uint64_t first_byte = 0;
+    while (1) {
+      uint64_t started = stats_now();
+      status = http_parse_request(&reader, &request);
+      stats_add(STATS_PARSE, stats_now() - started);
+      if (status != 0 || (status = http_reader_fill(&reader)) != 1) break;
+      /* A client trickling its headers in keeps beating the receive timeout;
+       * the whole request gets server_request_timeout. */
+      if (first_byte == 0) {
+        first_byte = stats_now();
+      } else if (stats_now() - first_byte >
+                 server_request_timeout * 1000000000ull) {
+        status = 0;
+        break;
+      }
+    }
+    if (status == 0 || status == -2) break;
+    if (status < 0) {
+      access_log_begin(&log_entry, &peer, NULL);
+      response_bytes = 0;
+      send_empty_response(fd, 400, 0);
+      stats_request_done(400);
+      log_entry.status_code = 400;
+      log_entry.bytes = response_bytes;
+      access_log_end(&log_entry);
+      break;
+    }
+
+    if (http2_is_preface(&request) || http2_is_upgrade(&request)) {
+      http2_serve(fd, &reader, &request, &peer);
+      break;
+    }
+
+    /* A generation being reloaded answers what it has been asked, then hangs
+     * up so the client reconnects to the new one. */
+    if (reload_draining()) request.keep_alive = 0;
+
+    int status_code;
+    access_log_begin(&log_entry, &peer, &request);
+    response_bytes = 0;
+    uint64_t started = stats_now();
+    keep_alive = serve_files_request(fd, &request, &status_code);
+    uint64_t latency = stats_now() - started;
+    stats_add(STATS_REQUEST, latency);
+    stats_request_done(status_code);
+
+    log_entry.status_code = status_code;
+    log_entry.bytes = response_bytes;
+    log_entry.latency_ns = latency;
+    access_log_end(&log_entry);
+  }
+
+  tls_close(fd);
+  shutdown(fd, SHUT_RDWR);
+  close(fd);
+}
+
+/* One direction of a proxied connection: bytes are spliced from src into a
+ * pipe and from the pipe into dst, never entering user space. */
+struct relay {
+  int src, dst;
+  int pipe_fds[2];
+  size_t in_pipe; /* Bytes read from src, not yet written to dst. */
+  int eof;        /* src has no more data. */
+  int done;       /* Everything was forwarded and dst was shut down. */
+};
+
+/* Moves what it can through RELAY without blocking. Returns -1 on error. */
+static int relay_pump(struct relay* relay) {
+  while (!relay->done) {
+    int moved = 0;
+    if (!relay->eof && relay->in_pipe < RELAY_PIPE_SIZE) {
+      ssize_t n = splice(relay->src, NULL, relay->pipe_fds[1], NULL,
+                         RELAY_PIPE_SIZE - relay->in_pipe,
+                         SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if (n == 0) relay->eof = 1;
+      if (n > 0) relay->in_pipe += n;
+      if (n < 0 && errno != EAGAIN && errno != EINTR) return -1;
+      moved |= n > 0;
+    }
+    if (relay->in_pipe > 0) {
+      ssize_t n = splice(relay->pipe_fds[0], NULL, relay->dst, NULL,
+                         relay->in_pipe, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if (n > 0) relay->in_pipe -= n;
+      if (n < 0 && errno != EAGAIN && errno != EINTR) return -1;
+      moved |= n > 0;
+    }
+    if (relay->eof && relay->in_pipe == 0) {
+      shutdown(relay->dst, SHUT_WR);
+      relay->done = 1;
+    }
+    if (!moved) break;
+  }
+  return 0;
+}
+
+/*
+ * Relays traffic between client_fd and target_fd in both directions on the
+ * calling thread until both sides are finished, or neither has moved for
+ * server_proxy_timeout seconds. The sockets are switched to non-blocking
+ * mode, so that a full socket in one direction cannot stall the other.
+ */
+static void relay_connection(int client_fd, int target_fd) {
+  struct relay relays[2] = {
+      {.src = client_fd, .dst = target_fd},
+      {.src = target_fd, .dst = client_fd},
+  };
+  if (pipe2(relays[0].pipe_fds, O_CLOEXEC) == -1) return;
+  if (pipe2(relays[1].pipe_fds, O_CLOEXEC) == -1) {
+    close(relays[0].pipe_fds[0]);
+    close(relays[0].pipe_fds[1]);
     return;
   }
+  fcntl(client_fd, F_SETFL, fcntl(client_fd, F_GETFL, 0) | O_NONBLOCK);
+  fcntl(target_fd, F_SETFL, fcntl(target_fd, F_GETFL, 0) | O_NONBLOCK);
+
+  while (!relays[0].done || !relays[1].done) {
+    if (relay_pump(&relays[0]) == -1 || relay_pump(&relays[1]) == -1) break;
+
+    /* Wait for a source with room in its pipe, or a destination with bytes
+     * waiting for it. */
+    struct pollfd pollfds[2] = {{.fd = client_fd}, {.fd = target_fd}};
+    for (int i = 0; i < 2; i++) {
+      struct relay* relay = &relays[i];
+      if (!relay->eof && relay->in_pipe < RELAY_PIPE_SIZE)
+        pollfds[i].events |= POLLIN;
+      if (relay->in_pipe > 0) pollfds[1 - i].events |= POLLOUT;
+    }
+    if (pollfds[0].events == 0 && pollfds[1].events == 0) continue;
+    int ready = poll(pollfds, 2, server_proxy_timeout * 1000);
+    if (ready == 0 || (ready == -1 && errno != EINTR)) break;
+    if ((pollfds[0].revents | pollfds[1].revents) & (POLLERR | POLLNVAL)) break;
+  }
 
-  /* Remove beginning `./` */
-  char* path = malloc(2 + strlen(request->path) + 1);
-  path[0] = '.';
-  path[1] = '/';
-  memcpy(path + 2, request->path, strlen(request->path) + 1);
+  for (int i = 0; i < 2; i++) {
+    close(relays[i].pipe_fds[0]);
+    close(relays[i].pipe_fds[1]);
+  }
+}
 
-  /**
-   * DONE: PART 2 is to serve files. If the file given by `path` exists,
-   * call serve_file() on it. Else, serve a 404 Not Found error below.
-   * The `stat()` syscall will be useful here.
-   *
-   * DONE: PART 3 is to serve both files and directories. You will need to
-   * determine when to call serve_file() or serve_directory() depending
-   * on `path`. Make your edits below here in this function.
-   */
+/*
+ * Connects to one of the upstreams, for the client FD, which picks it by its
+ * address under --balance hash. One that cannot be reached is taken out of
+ * rotation, and the next one tried. Returns the connected socket and sets
+ * *UPSTREAM, to be released when done, or returns -1 if none can be reached.
+ */
+static int connect_upstream(int fd, struct proxy_upstream** upstream) {
+  struct sockaddr_in peer;
+  socklen_t peer_length = sizeof(peer);
+  bool have_peer = getpeername(fd, (struct sockaddr*)&peer, &peer_length) == 0;
+  int target_fd = -1;
+  *upstream = NULL;
+  for (int tries = 0; target_fd < 0 && tries < proxy_pool_upstreams();
+       tries++) {
+    if (*upstream) proxy_pool_release(*upstream);
+    *upstream = proxy_pool_pick(have_peer ? &peer : NULL);
+    target_fd = proxy_pool_connect(*upstream);
+  }
+  if (target_fd < 0) {
+    proxy_pool_release(*upstream);
+    *upstream = NULL;
+  }
+  return target_fd;
+}
 
-  /* PART 2 & 3 BEGIN */
-  struct stat file_stat;
-  int status = stat(path, &file_stat);
+/* Sends the client a 502 for a request that no upstream could be reached
+ * for. */
+static void send_bad_gateway(int fd) {
+  struct http_response response;
+  http_response_start(&response, 502);
+  http_response_header(&response, "Content-Type", "text/html");
+  http_response_send(&response, fd, NULL, 0, 0);
+}
 
-  if (status == 0) {
-    if (S_ISREG(file_stat.st_mode))
-      serve_file(fd, path);
-    else if (S_ISDIR(file_stat.st_mode))
-      serve_directory(fd, path);
-  } else {
-    http_start_response(fd, 404);
+/* Headers about the client's connection, not passed on when the proxy
+ * fetches on a connection of its own. */
+static char* client_connection_headers[] = {"Connection", "Keep-Alive",
+                                            "Proxy-Connection", "TE",
+                                            "Upgrade"};
+
+/*
+ * Renders the head of REQUEST, as parsed, into BUFFER of SIZE bytes, for an
+ * upstream. With FETCH, it is asked for in HTTP/1.0 on a connection that is
+ * closed after the response, so that the response comes unchunked and ends
+ * where the upstream closes; the client's connection headers are left out.
+ * Returns the length, or -1 if it does not fit.
+ */
+static int format_upstream_request(char* buffer, size_t size,
+                                   struct http_request* request, bool fetch) {
+  size_t length = snprintf(buffer, size, "%s %s HTTP/1.%d\r\n",
+                           request->method, request->path,
+                           fetch ? 0 : request->minor_version);
+  for (int i = 0; i < request->num_headers && length < size; i++) {
+    bool dropped = false;
+    for (size_t j = 0; fetch && j < sizeof(client_connection_headers) /
+                                        sizeof(client_connection_headers[0]);
+         j++)
+      if (strcasecmp(request->headers[i].key, client_connection_headers[j]) ==
+          0)
+        dropped = true;
+    if (!dropped)
+      length += snprintf(buffer + length, size - length, "%s: %s\r\n",
+                         request->headers[i].key, request->headers[i].value);
   }
+  if (length < size)
+    length += snprintf(buffer + length, size - length, "%s\r\n",
+                       fetch ? "Connection: close\r\n" : "");
+  return length < size ? (int)length : -1;
+}
 
-  /* PART 2 & 3 END */
+/*
+ * Relays the rest of the connection to the client FD as
+ * handle_proxy_request() does without the cache, starting with REQUEST,
+ * which READER has parsed, and the bytes READER holds after it. For requests
+ * the cache does not answer, such as those with bodies.
+ */
+static void relay_rest(int fd, struct http_reader* reader,
+                       struct http_request* request) {
+  char head[LIBHTTP_REQUEST_MAX_SIZE + 256];
+  int head_length = format_upstream_request(head, sizeof(head), request, false);
+  if (head_length < 0) {
+    send_empty_response(fd, 400, 0);
+    return;
+  }
 
-  shutdown(fd, SHUT_RDWR);
-  return;
+  struct proxy_upstream* upstream;
+  int target_fd = connect_upstream(fd, &upstream);
+  if (target_fd < 0) {
+    send_bad_gateway(fd);
+    return;
+  }
+  struct iovec iov[2] = {
+      {.iov_base = head, .iov_len = head_length},
+      {.iov_base = reader->buffer + reader->start,
+       .iov_len = reader->end - reader->start},
+  };
+  if (http_sendv(target_fd, iov, iov[1].iov_len ? 2 : 1, 0) >= 0)
+    relay_connection(fd, target_fd);
+  proxy_pool_release(upstream);
+  close(target_fd);
 }
 
-/**
- * Do proxy work. For parameters args[0] is client_fd; args[1] is proxy_
- * target_fd; args[2] is direction, 0 for client to httpserver, 1 for
- * httpserver to client.
+/*
+ * Fetches the answer to the GET REQUEST from an upstream and returns it as an
+ * entry for KEY, to be released by the caller, reading it whole first. A
+ * response too large to keep, or that cannot be parsed, is relayed to the
+ * client FD as it comes instead, and *RELAYED set, after which the connection
+ * must be closed. Returns NULL if it was relayed, or if no upstream could be
+ * reached or answered.
  */
-static void* do_proxy(void* args) {
-  int* t_args = (int*)args;
-  int client_fd = t_args[0];
-  int proxy_target_fd = t_args[1];
-  int direction = t_args[2];
+static struct proxy_cache_entry* fetch_upstream(int fd,
+                                                struct http_request* request,
+                                                char* key, bool* relayed) {
+  *relayed = false;
+  char head[LIBHTTP_REQUEST_MAX_SIZE + 256];
+  int head_length = format_upstream_request(head, sizeof(head), request, true);
+  if (head_length < 0) return NULL;
+
+  struct proxy_upstream* upstream;
+  int target_fd = connect_upstream(fd, &upstream);
+  if (target_fd < 0) return NULL;
+  struct timeval timeout = {.tv_sec = server_proxy_timeout, .tv_usec = 0};
+  setsockopt(target_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  struct proxy_cache_entry* entry = NULL;
+  struct iovec iov = {.iov_base = head, .iov_len = head_length};
+  size_t limit = proxy_cache_max_response();
+  size_t length = 0, capacity = 0;
+  char* response = NULL;
+  bool complete = false;
+  if (http_sendv(target_fd, &iov, 1, 0) < 0) goto done;
+  while (length < limit) {
+    if (length == capacity) {
+      capacity = capacity ? 2 * capacity : 16384;
+      char* grown = realloc(response, capacity);
+      if (!grown) break;
+      response = grown;
+    }
+    size_t room = capacity - length;
+    if (room > limit - length) room = limit - length;
+    ssize_t bytes_read = read(target_fd, response + length, room);
+    if (bytes_read < 0 && errno == EINTR) continue;
+    if (bytes_read < 0) goto done; /* Timed out, or an error. */
+    if (bytes_read == 0) {
+      complete = true;
+      break;
+    }
+    length += bytes_read;
+  }
+
+  if (complete) entry = proxy_cache_parse(key, response, length);
+  if (entry || length == 0) goto done;
+
+  /* Send on what there is, and then the rest as it comes. */
+  *relayed = true;
+  iov = (struct iovec){.iov_base = response, .iov_len = length};
+  if (count_sent(http_sendv(fd, &iov, 1, 0)) < 0) goto done;
+  while (!complete) {
+    ssize_t bytes_read = read(target_fd, response, capacity);
+    if (bytes_read < 0 && errno == EINTR) continue;
+    if (bytes_read <= 0) break;
+    iov = (struct iovec){.iov_base = response, .iov_len = bytes_read};
+    if (count_sent(http_sendv(fd, &iov, 1, 0)) < 0) break;
+  }
 
-  char buf[4096];
-  ssize_t len;
-  if (direction == 0) {
-    // Client side.
-    while ((len = read(client_fd, buf, 4096)) > 0)
-      write(proxy_target_fd, buf, len);
+done:
+  free(response);
+  proxy_pool_release(upstream);
+  close(target_fd);
+  return entry;
+}
 
-    shutdown(proxy_target_fd, SHUT_RDWR);
-  } else if (direction == 1) {
-    // Httpserver side.
-    while ((len = read(proxy_target_fd, buf, 4096)) > 0)
-      write(client_fd, buf, len);
+/* Sends the upstream response ENTRY to the client FD. Returns whether the
+ * connection can be reused. */
+static int send_proxy_entry(int fd, struct proxy_cache_entry* entry,
+                            int keep_alive) {
+  long age = time(NULL) - entry->date;
+  char trailer[64];
+  int trailer_length =
+      snprintf(trailer, sizeof(trailer), "Age: %ld\r\nConnection: %s\r\n\r\n",
+               age > 0 ? age : 0, keep_alive ? "keep-alive" : "close");
+  struct iovec iov[3] = {
+      {.iov_base = entry->headers, .iov_len = entry->headers_length},
+      {.iov_base = trailer, .iov_len = trailer_length},
+      {.iov_base = entry->body, .iov_len = entry->size},
+  };
+  ssize_t sent = count_sent(http_sendv(fd, iov, entry->size ? 3 : 2, 0));
+  return sent < 0 ? 0 : keep_alive;
+}
 
-    shutdown(client_fd, SHUT_RDWR);
+/* Returns whether the client's REQUEST may be answered from the cache: a
+ * GET that carries no credentials, asks for the whole response
+ * unconditionally, and does not insist on a fresh one. Others are fetched
+ * for the client alone. */
+static bool may_use_cache(struct http_request* request) {
+  char* cache_control = http_request_header(request, "Cache-Control");
+  char* pragma = http_request_header(request, "Pragma");
+  return !http_request_header(request, "Authorization") &&
+         !http_request_header(request, "Range") &&
+         !http_request_header(request, "If-None-Match") &&
+         !http_request_header(request, "If-Modified-Since") &&
+         !(cache_control && (strcasestr(cache_control, "no-cache") ||
+                             strcasestr(cache_control, "no-store"))) &&
+         !(pragma && strcasestr(pragma, "no-cache"));
+}
+
+/* Answers the GET REQUEST from the cache, or from an upstream. Returns
+ * whether the connection can carry another request. */
+static int serve_proxied_get(int fd, struct http_request* request) {
+  char* host = http_request_header(request, "Host");
+  char key[LIBHTTP_REQUEST_MAX_SIZE];
+  snprintf(key, sizeof(key), "%s%s", host ? host : "", request->path);
+
+  struct proxy_flight* flight = NULL;
+  struct proxy_cache_entry* entry = NULL;
+  if (may_use_cache(request)) entry = proxy_cache_lookup(key, &flight);
+
+  bool relayed = false;
+  if (!entry) {
+    entry = fetch_upstream(fd, request, key, &relayed);
+    if (flight) proxy_cache_finish(flight, entry);
+  }
+  if (!entry) {
+    if (!relayed) send_bad_gateway(fd);
+    return 0;
   }
+  int keep_alive = send_proxy_entry(fd, entry, request->keep_alive);
+  proxy_cache_release(entry);
+  return keep_alive;
+}
 
-  pthread_exit(NULL);
+/*
+ * handle_proxy_request() with --cache-mb: reads the client's requests itself,
+ * answering GETs from the cache (see proxycache.h) for as long as the client
+ * keeps the connection alive, and relaying the rest of the connection from
+ * the first request that is not a GET without a body.
+ */
+static void handle_caching_proxy_request(int fd) {
+  struct timeval timeout = {.tv_sec = server_idle_timeout, .tv_usec = 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  struct http_reader reader;
+  http_reader_init(&reader, fd);
+  int keep_alive = 1;
+  while (keep_alive) {
+    struct http_request request;
+    int status = http_read_request(&reader, &request);
+    if (status == 0 || status == -2) break;
+    if (status < 0) {
+      send_empty_response(fd, 400, 0);
+      break;
+    }
+    if (reload_draining()) request.keep_alive = 0;
+
+    if (strcmp(request.method, "GET") != 0 || request.content_length > 0) {
+      relay_rest(fd, &reader, &request);
+      break;
+    }
+    keep_alive = serve_proxied_get(fd, &request);
+  }
+
+  shutdown(fd, SHUT_RDWR);
+  close(fd);
 }
 
 /*
- * Opens a connection to the proxy target (hostname=server_proxy_hostname and
- * port=server_proxy_port) and relays traffic to/from the stream fd and the
- * proxy target_fd. HTTP requests from the client (fd) should be sent to the
- * proxy target (target_fd), and HTTP responses from the proxy target
- * (target_fd) should be sent to the client (fd).
+ * Opens a connection to one of the upstreams in server_proxy_hostname and
+ * relays traffic to/from the stream fd and the proxy target_fd. HTTP requests
+ * from the client (fd) should be sent to the proxy target (target_fd), and
+ * HTTP responses from the proxy target (target_fd) should be sent to the
+ * client (fd).
  *
  *   +--------+     +------------+     +--------------+
  *   | client | <-> | httpserver | <-> | proxy target |
  *   +--------+     +------------+     +--------------+
  *
  *   Closes client socket (fd) and proxy target fd (target_fd) when finished.
+ *
+ *   With --cache-mb, GETs are answered from a cache of upstream responses
+ *   instead; see handle_caching_proxy_request().
  */
 void handle_proxy_request(int fd) {
-  /*
-   * The code below does a DNS lookup of server_proxy_hostname and
-   * opens a connection to it. Please do not modify.
-   */
-  struct sockaddr_in target_address;
-  memset(&target_address, 0, sizeof(target_address));
-  target_address.sin_family = AF_INET;
-  target_address.sin_port = htons(server_proxy_port);
-
-  // Use DNS to resolve the proxy target's IP address
-  struct hostent* target_dns_entry =
-      gethostbyname2(server_proxy_hostname, AF_INET);
-
-  // Create an IPv4 TCP socket to communicate with the proxy target.
-  int target_fd = socket(PF_INET, SOCK_STREAM, 0);
-  if (target_fd == -1) {
-    fprintf(stderr, "Failed to create a new socket: error %d: %s\n", errno,
-            strerror(errno));
-    close(fd);
-    exit(errno);
-  }
-
-  if (target_dns_entry == NULL) {
-    fprintf(stderr, "Cannot find host: %s\n", server_proxy_hostname);
-    close(target_fd);
-    close(fd);
-    exit(ENXIO);
+  if (proxy_cache_enabled()) {
+    handle_caching_proxy_request(fd);
+    return;
   }
 
-  char* dns_address = target_dns_entry->h_addr_list[0];
-
-  // Connect to the proxy target.
-  memcpy(&target_address.sin_addr, dns_address,
-         sizeof(target_address.sin_addr));
-  int connection_status = connect(target_fd, (struct sockaddr*)&target_address,
-                                  sizeof(target_address));
-
-  if (connection_status < 0) {
+  /*
+   * The upstreams were resolved once at startup (see main), and a warm
+   * connection to the one picked is usually waiting in the pool.
+   */
+  struct proxy_upstream* upstream;
+  int target_fd = connect_upstream(fd, &upstream);
+  if (target_fd < 0) {
     /* Dummy request parsing, just to be compliant. */
-    http_request_parse(fd);
-
-    http_start_response(fd, 502);
-    http_send_header(fd, "Content-Type", "text/html");
-    http_end_headers(fd);
-    close(target_fd);
+    http_request_free(http_request_parse(fd));
+    send_bad_gateway(fd);
     close(fd);
     return;
   }
 
   /** DONE: PART 4 */
   /* PART 4 BEGIN */
-  int client_side_args[3] = {fd, target_fd, 0};
-  int server_side_args[3] = {fd, target_fd, 1};
-  pthread_t threads[2];
-
-  pthread_create(&threads[0], NULL, do_proxy, client_side_args);
-  pthread_create(&threads[1], NULL, do_proxy, server_side_args);
-
-  for (int i = 0; i < 2; i++) {
-    pthread_detach(threads[i]);
-  }
+  relay_connection(fd, target_fd);
+  proxy_pool_release(upstream);
+  close(target_fd);
+  close(fd);
   /* PART 4 END */
 }
 
@@ -283,6 +943,7 @@ void* request_handler_wrapper(void* args) {
   struct request_handler_wrapper_args* r_args =
       (struct request_handler_wrapper_args*)args;
   r_args->request_handler(r_args->fd);
+  reload_release();
 
   // Need to free args after handle request.
   free(args);
@@ -291,6 +952,30 @@ void* request_handler_wrapper(void* args) {
 
 #endif
 
+/* One listening socket and the loop accepting on it (see --acceptors). */
+struct acceptor {
+  int index; /* Its affinity slot, see affinity.h. */
+  int socket_number;
+  void (*request_handler)(int);
+  pthread_t thread; /* Where to send a reload's kick, while running. */
+  bool running;
+#ifdef POOLSERVER
+  wq_t* work_queue;      /* This acceptor's share of the pool, */
+  ws_pool_t* steal_pool; /* depending on --work-stealing. */
+  int threads;           /* Live workers, and how many wait for a socket. */
+  int idle_threads;
+
+  /* Admission control (--queue-high): sockets handed to the pool and not
+   * yet taken by a worker, whether new ones are being answered with 503,
+   * and the acceptor's wait while it pauses instead. */
+  int queued;
+  bool shedding;
+  bool paused;
+  pthread_mutex_t pause_lock;
+  pthread_cond_t pause_done;
+#endif
+};
+
 #ifdef POOLSERVER
 /*
  * All worker threads will run this function until the server shutsdown.
@@ -298,8 +983,81 @@ void* request_handler_wrapper(void* args) {
  * When the server accepts a new connection, a thread should be dispatched
  * to send a response to the client.
  */
-void* handle_clients(void* void_request_handler) {
-  void (*request_handler)(int) = (void (*)(int))void_request_handler;
+struct pool_worker {
+  struct acceptor* acceptor; /* Whose queue the worker serves. */
+  int index;                 /* Which deque of steal_pool the worker owns. */
+};
+
+void* handle_clients(void* void_worker);
+
+/* Whether the pools resize themselves between --num-threads and
+ * --max-threads workers. */
+static bool pool_is_adaptive(void) { return max_threads > num_threads; }
+
+/* Starts a worker serving ACCEPTOR, already counted in acceptor->threads.
+ * Returns whether it started. */
+static bool pool_start_worker(struct acceptor* acceptor, int index) {
+  struct pool_worker* worker = malloc(sizeof(*worker));
+  pthread_t thread;
+  if (worker) {
+    worker->acceptor = acceptor;
+    worker->index = index;
+    if (pthread_create(&thread, NULL, handle_clients, worker) == 0) {
+      stats_pool_threads(1);
+      return true;
+    }
+    free(worker);
+  }
+  __atomic_sub_fetch(&acceptor->threads, 1, __ATOMIC_RELAXED);
+  return false;
+}
+
+/* Adds a worker to ACCEPTOR's pool for REASON, unless it is at
+ * --max-threads. */
+static void pool_grow(struct acceptor* acceptor,
+                      enum stats_pool_event reason) {
+  int threads = __atomic_load_n(&acceptor->threads, __ATOMIC_RELAXED);
+  do {
+    if (threads >= max_threads) return;
+  } while (!__atomic_compare_exchange_n(&acceptor->threads, &threads,
+                                        threads + 1, 1, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED));
+  if (pool_start_worker(acceptor, threads)) stats_pool_event(reason);
+}
+
+/* Pops the next socket for a worker of an adaptive pool. Returns -1 if the
+ * worker should retire instead, having been idle for POOL_IDLE_TIMEOUT
+ * seconds while the pool is above --num-threads. */
+static int pool_pop(struct acceptor* acceptor) {
+  __atomic_add_fetch(&acceptor->idle_threads, 1, __ATOMIC_RELAXED);
+  int fd;
+  while ((fd = wq_pop_timed(acceptor->work_queue, POOL_IDLE_TIMEOUT)) == -1) {
+    int threads = __atomic_load_n(&acceptor->threads, __ATOMIC_RELAXED);
+    if (threads > num_threads &&
+        __atomic_compare_exchange_n(&acceptor->threads, &threads, threads - 1,
+                                    0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      break;
+  }
+  __atomic_sub_fetch(&acceptor->idle_threads, 1, __ATOMIC_RELAXED);
+  return fd;
+}
+
+/* Notes that a worker took a socket from ACCEPTOR's pool, and lets the
+ * acceptor resume once the queue is down to --queue-low. */
+static void pool_taken(struct acceptor* acceptor) {
+  int queued = __atomic_sub_fetch(&acceptor->queued, 1, __ATOMIC_RELAXED);
+  if (queued <= queue_low && __atomic_load_n(&acceptor->paused,
+                                             __ATOMIC_RELAXED)) {
+    pthread_mutex_lock(&acceptor->pause_lock);
+    pthread_cond_signal(&acceptor->pause_done);
+    pthread_mutex_unlock(&acceptor->pause_lock);
+  }
+}
+
+void* handle_clients(void* void_worker) {
+  struct pool_worker* worker = void_worker;
+  struct acceptor* acceptor = worker->acceptor;
+  affinity_pin(acceptor->index + worker->index * server_acceptors);
   /* (Valgrind) Detach so thread frees its memory on completion, since we won't
    * be joining on it. */
   pthread_detach(pthread_self());
@@ -307,51 +1065,159 @@ void* handle_clients(void* void_request_handler) {
   /** DONE: PART 7 */
   /* PART 7 BEGIN */
   while (1) {
-    int fd = wq_pop(&work_queue);
-    request_handler(fd);
+    int fd;
+    if (work_stealing)
+      fd = ws_pool_pop(acceptor->steal_pool, worker->index);
+    else if (pool_is_adaptive())
+      fd = pool_pop(acceptor);
+    else
+      fd = wq_pop(acceptor->work_queue);
+    if (fd == -1) break;
+
+    /* A socket that sat in the queue means the workers are all busy. */
+    if (stats_dequeued(fd) > POOL_GROW_WAIT_NS && pool_is_adaptive())
+      pool_grow(acceptor, STATS_POOL_GROW_WAIT);
+    pool_taken(acceptor);
+    acceptor->request_handler(fd);
+    reload_release();
   }
   /* PART 7 END */
+
+  stats_pool_threads(-1);
+  stats_pool_event(STATS_POOL_RETIRE);
+  free(worker);
+  return NULL;
 }
 
 /*
- * Creates `num_threads` amount of threads. Initializes the work queue.
+ * Creates `num_threads` amount of threads serving ACCEPTOR. Initializes its
+ * work queue.
  */
-void init_thread_pool(int num_threads, void (*request_handler)(int)) {
+void init_thread_pool(int num_threads, struct acceptor* acceptor) {
   /** DONE: PART 7 */
   /* PART 7 BEGIN */
-  wq_init(&work_queue);
-
-  pthread_t threads[num_threads];
-  for (int i = 0; i < num_threads; i++)
-    pthread_create(&threads[i], NULL, handle_clients, (void*)request_handler);
+  if (work_stealing)
+    ws_pool_init(acceptor->steal_pool, num_threads);
+  else
+    wq_init(acceptor->work_queue);
+
+  acceptor->threads = num_threads;
+  acceptor->idle_threads = 0;
+  acceptor->queued = 0;
+  acceptor->shedding = acceptor->paused = false;
+  pthread_mutex_init(&acceptor->pause_lock, NULL);
+  pthread_cond_init(&acceptor->pause_done, NULL);
+  for (int i = 0; i < num_threads; i++) pool_start_worker(acceptor, i);
 
   /* PART 7 END */
 }
+
+/* Answers the connection FD, which the pool has no room for, with a 503 and
+ * closes it. The request is read first if it has arrived, so closing does not
+ * reset the connection before the client sees the answer. */
+static void pool_reject(int fd) {
+  char discard[LIBHTTP_REQUEST_MAX_SIZE];
+  while (recv(fd, discard, sizeof(discard), MSG_DONTWAIT) > 0) continue;
+
+  /* Before the handshake a TLS client could not read the answer anyway. */
+  if (!tls_enabled()) {
+    struct http_response response;
+    http_response_start(&response, 503);
+    http_response_header(&response, "Content-Type", "text/html");
+    http_response_header(&response, "Content-Length", "0");
+    http_response_header(&response, "Retry-After", "1");
+    http_response_connection(&response, 0);
+    http_response_send(&response, fd, NULL, 0, MSG_DONTWAIT);
+  }
+  stats_count_response(503);
+  stats_admission_shed();
+  shutdown(fd, SHUT_WR);
+  close(fd);
+  reload_release();
+}
+
+/* Whether ACCEPTOR's pool takes another socket. Above --queue-high it turns
+ * sockets away until the queue is back down to --queue-low. */
+static bool pool_admit(struct acceptor* acceptor) {
+  int queued = __atomic_load_n(&acceptor->queued, __ATOMIC_RELAXED);
+  if (acceptor->shedding && queued <= queue_low)
+    acceptor->shedding = false;
+  else if (!acceptor->shedding && queued >= queue_high)
+    acceptor->shedding = true;
+  return !acceptor->shedding;
+}
+
+/* Holds ACCEPTOR back from accept() until its queue is down to --queue-low,
+ * leaving new connections in the kernel's backlog meanwhile. */
+static void pool_pause(struct acceptor* acceptor) {
+  uint64_t started = stats_now();
+  pthread_mutex_lock(&acceptor->pause_lock);
+  __atomic_store_n(&acceptor->paused, true, __ATOMIC_RELAXED);
+  while (__atomic_load_n(&acceptor->queued, __ATOMIC_RELAXED) > queue_low) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += POOL_PAUSE_RECHECK_NS;
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&acceptor->pause_done, &acceptor->pause_lock,
+                           &deadline);
+  }
+  __atomic_store_n(&acceptor->paused, false, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&acceptor->pause_lock);
+  stats_admission_paused(stats_now() - started);
+}
+
+/* Hands the accepted socket FD to one of ACCEPTOR's workers. */
+static void pool_dispatch(struct acceptor* acceptor, int fd) {
+  if (queue_high > 0 && !overload_pause && !pool_admit(acceptor)) {
+    pool_reject(fd);
+    return;
+  }
+  int queued = __atomic_add_fetch(&acceptor->queued, 1, __ATOMIC_RELAXED);
+  stats_enqueued(fd);
+  if (work_stealing) {
+    ws_pool_push(acceptor->steal_pool, fd);
+  } else {
+    wq_push(acceptor->work_queue, fd);
+    if (pool_is_adaptive() &&
+        wq_size(acceptor->work_queue) >
+            __atomic_load_n(&acceptor->idle_threads, __ATOMIC_RELAXED))
+      pool_grow(acceptor, STATS_POOL_GROW_DEPTH);
+  }
+  if (queue_high > 0 && overload_pause && queued >= queue_high)
+    pool_pause(acceptor);
+}
 #endif
 
 /*
- * Opens a TCP stream socket on all interfaces with port number PORTNO. Saves
- * the fd number of the server socket in *socket_number. For each accepted
- * connection, calls request_handler with the accepted fd number.
+ * Opens a TCP stream socket listening on all interfaces at server_port. With
+ * more than one acceptor every socket sets SO_REUSEPORT, so that they can
+ * share the port and the kernel spreads new connections across them.
  */
-void serve_forever(int* socket_number, void (*request_handler)(int)) {
-  struct sockaddr_in server_address, client_address;
-  size_t client_address_length = sizeof(client_address);
-  int client_socket_number;
+static int open_server_socket(void) {
+  struct sockaddr_in server_address;
 
   // Creates a socket for IPv4 and TCP.
-  *socket_number = socket(PF_INET, SOCK_STREAM, 0);
-  if (*socket_number == -1) {
+  int socket_number = socket(PF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (socket_number == -1) {
     perror("Failed to create a new socket");
     exit(errno);
   }
 
   int socket_option = 1;
-  if (setsockopt(*socket_number, SOL_SOCKET, SO_REUSEADDR, &socket_option,
+  if (setsockopt(socket_number, SOL_SOCKET, SO_REUSEADDR, &socket_option,
                  sizeof(socket_option)) == -1) {
     perror("Failed to set socket options");
     exit(errno);
   }
+  if (server_acceptors > 1 &&
+      setsockopt(socket_number, SOL_SOCKET, SO_REUSEPORT, &socket_option,
+                 sizeof(socket_option)) == -1) {
+    perror("Failed to set SO_REUSEPORT");
+    exit(errno);
+  }
 
   // Setup arguments for bind()
   memset(&server_address, 0, sizeof(server_address));
@@ -369,31 +1235,72 @@ void serve_forever(int* socket_number, void (*request_handler)(int)) {
    */
 
   /* PART 1 BEGIN */
-  bind(*socket_number, (const struct sockaddr*)&server_address,
-       (socklen_t)sizeof(server_address));
-  listen(*socket_number, 1024);
+  if (bind(socket_number, (const struct sockaddr*)&server_address,
+           (socklen_t)sizeof(server_address)) == -1) {
+    perror("Failed to bind on socket");
+    exit(errno);
+  }
+  listen(socket_number, 1024);
   /* PART 1 END */
-  printf("Listening on port %d...\n", server_port);
+  return socket_number;
+}
+
+/*
+ * Accepts connections on ACCEPTOR's socket until a reload drains the server,
+ * calling its request_handler with the accepted fd number. Each acceptor has
+ * its own worker set (poolserver) or event loop (epollserver, uringserver).
+ */
+static void* accept_forever(void* void_acceptor) {
+  struct acceptor* acceptor = void_acceptor;
+  struct sockaddr_in client_address;
+  socklen_t client_address_length;
+  int client_socket_number;
+
+  reload_hold();
+  acceptor->thread = pthread_self();
+  __atomic_store_n(&acceptor->running, true, __ATOMIC_RELEASE);
+
+  /* Before the pool or event loop allocates anything. A --prefork child is
+   * pinned by its own index instead. */
+  if (server_prefork == 0) affinity_pin(acceptor->index);
 
 #ifdef POOLSERVER
   /*
    * The thread pool is initialized *before* the server
    * begins accepting client connections.
    */
-  init_thread_pool(num_threads, request_handler);
+  init_thread_pool(num_threads, acceptor);
 #endif
 
-  while (1) {
+#ifdef EPOLLSERVER
+  /*
+   * The event loop takes over the listening socket: it accepts connections
+   * itself and multiplexes all of them on this thread. It returns once a
+   * reload has drained it.
+   */
+  epoll_serve_forever(acceptor->socket_number, acceptor->request_handler);
+#endif
+
+#ifdef URINGSERVER
+  /* Likewise, with accepts, reads and sends queued on an io_uring. */
+  uring_serve_forever(acceptor->socket_number);
+#endif
+
+  while (!reload_draining()) {
+    /* The handlers use blocking I/O, so only close-on-exec is requested. */
+    client_address_length = sizeof(client_address);
     client_socket_number =
-        accept(*socket_number, (struct sockaddr*)&client_address,
-               (socklen_t*)&client_address_length);
+        accept4(acceptor->socket_number, (struct sockaddr*)&client_address,
+                &client_address_length, SOCK_CLOEXEC);
     if (client_socket_number < 0) {
-      perror("Error accepting socket");
+      /* EINTR is the kick of a reload. */
+      if (errno != EINTR) perror("Error accepting socket");
       continue;
     }
-
-    printf("Accepted connection from %s on port %d\n",
-           inet_ntoa(client_address.sin_addr), client_address.sin_port);
+    /* The accept stage runs from here until the connection is handed off. */
+    uint64_t accepted = stats_now();
+    stats_count_connection();
+    reload_hold();
 
 #ifdef BASICSERVER
     /*
@@ -404,7 +1311,11 @@ void serve_forever(int* socket_number, void (*request_handler)(int)) {
      * Only after a response has been sent to the client can
      * the server accept a new connection.
      */
-    request_handler(client_socket_number);
+    stats_record(STATS_ACCEPT, stats_now() - accepted);
+    reload_allow_kick(false);
+    acceptor->request_handler(client_socket_number);
+    reload_release();
+    reload_allow_kick(true);
 
 #elif FORKSERVER
     /**
@@ -419,11 +1330,24 @@ void serve_forever(int* socket_number, void (*request_handler)(int)) {
      */
 
     /* PART 5 BEGIN */
+    if (server_prefork > 0) {
+      /* This is one of the long-lived --prefork children, which serves the
+       * connection itself before accepting the next one. */
+      stats_record(STATS_ACCEPT, stats_now() - accepted);
+      reload_allow_kick(false);
+      acceptor->request_handler(client_socket_number);
+      reload_release();
+      reload_allow_kick(true);
+      continue;
+    }
+    /* The hold is released when the child is reaped. */
     pid_t cpid = fork();
     if (cpid == 0) {
-      request_handler(client_socket_number);
+      acceptor->request_handler(client_socket_number);
       exit(0);
     }
+    if (cpid == -1) reload_release();
+    close(client_socket_number);
     /* PART 5 END */
 
 #elif THREADSERVER
@@ -443,7 +1367,7 @@ void serve_forever(int* socket_number, void (*request_handler)(int)) {
         (struct request_handler_wrapper_args*)malloc(
             sizeof(struct request_handler_wrapper_args));
     pargs->fd = client_socket_number;
-    pargs->request_handler = request_handler;
+    pargs->request_handler = acceptor->request_handler;
     pthread_create(&thread, NULL, request_handler_wrapper, (void*)pargs);
     pthread_detach(thread);
     /* PART 6 END */
@@ -458,13 +1382,171 @@ void serve_forever(int* socket_number, void (*request_handler)(int)) {
      */
 
     /* PART 7 BEGIN */
-    wq_push(&work_queue, client_socket_number);
+    pool_dispatch(acceptor, client_socket_number);
     /* PART 7 END */
 #endif
+
+#ifndef BASICSERVER
+    stats_record(STATS_ACCEPT, stats_now() - accepted);
+#endif
   }
 
-  shutdown(*socket_number, SHUT_RDWR);
-  close(*socket_number);
+  /* Not shut down: the next generation accepts on the same socket. */
+  close(acceptor->socket_number);
+  __atomic_store_n(&acceptor->running, false, __ATOMIC_RELEASE);
+  reload_release();
+  return NULL;
+}
+
+#ifdef FORKSERVER
+/* Forks the --prefork child INDEX, which accepts on ACCEPTOR until the server
+ * exits. Returns its pid, or -1 if it could not be forked. */
+static pid_t prefork_child(struct acceptor* acceptor, int index) {
+  pid_t parent = getpid();
+  fflush(stdout); /* Or the child prints it again. */
+  pid_t pid = fork();
+  if (pid != 0) return pid;
+
+  /* Children do not outlive the parent, even if it is killed. */
+  prctl(PR_SET_PDEATHSIG, SIGTERM);
+  if (getppid() != parent) exit(0);
+  /* The parent's pool thread did not survive the fork; each child keeps its
+   * own warm connections. */
+  affinity_pin(index);
+  if (server_proxy_hostname != NULL)
+    proxy_pool_init(server_proxy_pool, server_proxy_balance);
+  printf("Worker %d (pid %d) accepting on socket %d\n", index, getpid(),
+         acceptor->socket_number);
+  accept_forever(acceptor);
+  exit(0);
+}
+
+/* The children's pids, while prefork_forever() runs; -1 for none. */
+static pid_t* prefork_children;
+
+/*
+ * Runs forkserver --prefork N: forks N children that each accept on a shared
+ * listening socket (round the acceptors) and serve one connection at a time,
+ * so no process is forked or torn down per connection. A blocked accept() is
+ * woken for one connection only, so the idle children do not stampede. The
+ * parent only restarts children that die, until a reload drains it: then
+ * it returns once they have all finished.
+ */
+static void prefork_forever(struct acceptor* acceptors) {
+  pid_t children[server_prefork];
+  prefork_children = children;
+
+  /* The parent reaps its children itself, to know which to restart. */
+  signal(SIGCHLD, SIG_DFL);
+  for (int i = 0; i < server_prefork; i++) children[i] = -1;
+
+  while (1) {
+    int alive = 0;
+    for (int i = 0; i < server_prefork; i++) {
+      if (children[i] == -1 && !reload_draining()) {
+        children[i] = prefork_child(&acceptors[i % server_acceptors], i);
+        if (children[i] == -1)
+          perror("Failed to fork worker");
+        else
+          reload_hold();
+      }
+      if (children[i] != -1) alive++;
+    }
+    if (alive == 0 && reload_draining()) return;
+
+    int status;
+    pid_t pid = wait(&status);
+    if (pid == -1) {
+      /* With no children at all every fork failed; try again shortly. */
+      if (errno != EINTR) sleep(1);
+      continue;
+    }
+    for (int i = 0; i < server_prefork; i++) {
+      if (children[i] != pid) continue;
+      if (!reload_draining())
+        fprintf(stderr,
+                "Worker %d (pid %d) exited with status %d, restarting\n", i,
+                pid, status);
+      __atomic_store_n(&children[i], -1, __ATOMIC_RELAXED);
+      reload_release();
+    }
+  }
+}
+#endif
+
+static struct acceptor* all_acceptors;
+
+/* Wakes the acceptors of a generation being drained (see reload.h). */
+static void kick_acceptors(void) {
+#ifdef FORKSERVER
+  if (server_prefork > 0) {
+    for (int i = 0; prefork_children && i < server_prefork; i++) {
+      pid_t child = __atomic_load_n(&prefork_children[i], __ATOMIC_RELAXED);
+      if (child != -1) kill(child, RELOAD_KICK_SIGNAL);
+    }
+    return;
+  }
+#endif
+  for (int i = 0; i < server_acceptors; i++)
+    if (__atomic_load_n(&all_acceptors[i].running, __ATOMIC_ACQUIRE))
+      pthread_kill(all_acceptors[i].thread, RELOAD_KICK_SIGNAL);
+}
+
+/*
+ * Opens server_acceptors listening sockets on port server_port and accepts
+ * connections on each of them in its own thread; the calling thread serves
+ * the first one. Saves the fd number of the first server socket in
+ * *socket_number. For each accepted connection, calls request_handler with
+ * the accepted fd number.
+ */
+void serve_forever(int* socket_number, void (*request_handler)(int)) {
+  struct acceptor acceptors[server_acceptors];
+  int sockets[server_acceptors];
+  all_acceptors = acceptors;
+
+  /* Every socket is bound before any accepts, so none briefly gets all the
+   * connections. After a reload they are the previous generation's. */
+  for (int i = 0; i < server_acceptors; i++) {
+    acceptors[i].index = i;
+    acceptors[i].socket_number =
+        reload_inherited_socket(i, server_acceptors, server_port);
+    if (acceptors[i].socket_number == -1)
+      acceptors[i].socket_number = open_server_socket();
+    sockets[i] = acceptors[i].socket_number;
+    acceptors[i].request_handler = request_handler;
+    acceptors[i].running = false;
+    /* With SO_REUSEPORT, the kernel then prefers the listener whose CPU
+     * took the connection's packets. */
+    int cpu = affinity_cpu(i);
+    if (server_incoming_cpu && cpu != -1 &&
+        setsockopt(acceptors[i].socket_number, SOL_SOCKET, SO_INCOMING_CPU,
+                   &cpu, sizeof(cpu)) == -1)
+      perror("Failed to set SO_INCOMING_CPU (ignoring)");
+#ifdef POOLSERVER
+    acceptors[i].work_queue = i == 0 ? &work_queue : malloc(sizeof(wq_t));
+    acceptors[i].steal_pool = i == 0 ? &steal_pool : malloc(sizeof(ws_pool_t));
+#endif
+  }
+  *socket_number = acceptors[0].socket_number;
+  printf("Listening on port %d...\n", server_port);
+  fflush(stdout); /* Or every forked child prints it again as it exits. */
+  reload_ready(sockets, server_acceptors, kick_acceptors);
+
+#ifdef FORKSERVER
+  if (server_prefork > 0) {
+    prefork_forever(acceptors);
+    return;
+  }
+#endif
+
+  /* Not detached, so a kick never finds a thread gone: the process exits
+   * before they would be joined. */
+  for (int i = 1; i < server_acceptors; i++) {
+    pthread_t thread;
+    pthread_create(&thread, NULL, accept_forever, &acceptors[i]);
+  }
+  accept_forever(&acceptors[0]);
+  reload_wait_drained();
 }
 
 int server_fd;
@@ -477,24 +1559,117 @@ void signal_callback_handler(int signum) {
 
 char* USAGE =
     "Usage: ./httpserver --files some_directory/ [--port 8000 --num-threads "
-    "5]\n"
-    "       ./httpserver --proxy inst.eecs.berkeley.edu:80 [--port 8000 "
-    "--num-threads 5]\n";
+    "5 --max-threads 0 --work-stealing --queue-high 0 --queue-low 0 "
+    "--overload 503 --acceptors 1 --prefork 0 --pin-workers --numa compact "
+    "--incoming-cpu --idle-timeout 5 --request-timeout 10 --cache-mb 0 "
+    "--mmap --open-cache 0 --mime-types /etc/mime.types --access-log - "
+    "--tls-cert cert.pem --tls-key key.pem --io-threads 0 --drain-timeout 30 "
+    "--config FILE]\n"
+    "       ./httpserver --proxy inst.eecs.berkeley.edu:80[,host:port...] "
+    "[--port 8000 --num-threads 5 --queue-high 0 --overload 503 "
+    "--acceptors 1 --prefork 0 --balance least-conn --proxy-pool 0 "
+    "--proxy-timeout 60 --cache-mb 0 --drain-timeout 30 --config FILE]\n"
+    "Options may also be read from --config FILE, whitespace-separated with "
+    "# comments;\n"
+    "kill -HUP reloads it, and the binary, without dropping connections.\n";
+
+/*
+ * Resolves the upstreams once, before any client connects, and sets up the
+ * pools of connections to them. A DNS lookup per request would add its
+ * latency to every proxied connection.
+ */
+static void resolve_proxy_target(void) {
+  char* targets = strdup(server_proxy_hostname);
+  char* saveptr;
+  for (char* target = strtok_r(targets, ",", &saveptr); target;
+       target = strtok_r(NULL, ",", &saveptr)) {
+    if (proxy_pool_add(target) == -1) {
+      fprintf(stderr, "Cannot find host: %s\n", target);
+      exit(ENXIO);
+    }
+  }
+  free(targets);
+  if (proxy_pool_upstreams() == 0) {
+    fprintf(stderr, "Expected at least one upstream after --proxy\n");
+    exit(EINVAL);
+  }
+
+#ifdef FORKSERVER
+  /* Children would inherit copies of the same idle sockets. With --prefork
+   * each child starts its own pool instead. */
+  if (server_proxy_pool > 0 && server_prefork == 0) {
+    fprintf(stderr, "--proxy-pool is not supported by forkserver\n");
+    server_proxy_pool = 0;
+  }
+  if (server_prefork > 0) return;
+#endif
+  proxy_pool_init(server_proxy_pool, server_proxy_balance);
+}
 
 void exit_with_usage() {
   fprintf(stderr, "%s", USAGE);
   exit(EXIT_SUCCESS);
 }
 
+/*
+ * Returns ARGV with every "--config FILE" replaced by the options in FILE:
+ * words separated by white space, with # starting a comment that runs to the
+ * end of the line. The file is read again by every generation, so a reload
+ * picks up what was changed in it.
+ */
+static char** expand_config(int* argc, char** argv) {
+  int count = 0, size = *argc + 1;
+  char** expanded = malloc(size * sizeof(char*));
+  for (int i = 0; i < *argc && expanded; i++) {
+    if (strcmp("--config", argv[i]) != 0 || i == 0) {
+      if (count + 1 == size)
+        expanded = realloc(expanded, (size *= 2) * sizeof(char*));
+      if (expanded) expanded[count++] = argv[i];
+      continue;
+    }
+    char* path = argv[++i];
+    FILE* file = path ? fopen(path, "r") : NULL;
+    if (!file) {
+      fprintf(stderr, "Expected a readable file after --config\n");
+      exit_with_usage();
+    }
+    char line[1024];
+    while (fgets(line, sizeof(line), file)) {
+      char* comment = strchr(line, '#');
+      if (comment) *comment = '\0';
+      char* saveptr;
+      for (char* word = strtok_r(line, " \t\r\n", &saveptr); word;
+           word = strtok_r(NULL, " \t\r\n", &saveptr)) {
+        if (count + 1 == size)
+          expanded = realloc(expanded, (size *= 2) * sizeof(char*));
+        if (!expanded) break;
+        expanded[count++] = strdup(word);
+      }
+    }
+    fclose(file);
+  }
+  if (!expanded) {
+    fprintf(stderr, "Malloc failed\n");
+    exit(ENOBUFS);
+  }
+  expanded[count] = NULL;
+  *argc = count;
+  return expanded;
+}
+
 #ifdef FORKSERVER
 
 void recycle_child_process(int signo __attribute__((unused))) {
-  while (waitpid(-1, NULL, WNOHANG) > 0) continue;
+  pid_t pid;
+  while ((pid = waitpid(-1, NULL, WNOHANG)) > 0)
+    if (pid != reload_successor()) reload_release();
 }
 
 #endif
 
 int main(int argc, char** argv) {
+  reload_init(argv);
+  argv = expand_config(&argc, argv);
   signal(SIGINT, signal_callback_handler);
   signal(SIGPIPE, SIG_IGN);
 
@@ -511,7 +1686,21 @@ int main(int argc, char** argv) {
 
   /* Default settings */
   server_port = 8000;
+  server_idle_timeout = 5;
+  server_request_timeout = 10;
+  server_proxy_timeout = 60;
+  server_drain_timeout = 30;
+  server_acceptors = 1;
+  queue_low = -1;
   void (*request_handler)(int) = NULL;
+  bool pin_workers = false;
+  enum affinity_policy numa_policy = AFFINITY_COMPACT;
+  size_t cache_bytes = 0;
+  char* access_log_path = NULL;
+  bool cache_map_files = false;
+  char* tls_cert_path = NULL;
+  char* tls_key_path = NULL;
+  int io_threads = 0;
 
   int i;
   for (i = 1; i < argc; i++) {
@@ -531,15 +1720,22 @@ int main(int argc, char** argv) {
         exit_with_usage();
       }
 
-      char* colon_pointer = strchr(proxy_target, ':');
-      if (colon_pointer != NULL) {
-        *colon_pointer = '\0';
-        server_proxy_hostname = proxy_target;
-        server_proxy_port = atoi(colon_pointer + 1);
-      } else {
-        server_proxy_hostname = proxy_target;
-        server_proxy_port = 80;
+      server_proxy_hostname = proxy_target;
+    } else if (strcmp("--proxy-pool", argv[i]) == 0) {
+      char* proxy_pool_str = argv[++i];
+      if (!proxy_pool_str || (server_proxy_pool = atoi(proxy_pool_str)) < 0) {
+        fprintf(stderr, "Expected non-negative integer after --proxy-pool\n");
+        exit_with_usage();
+      }
+    } else if (strcmp("--balance", argv[i]) == 0) {
+      char* balance = argv[++i];
+      if (!balance ||
+          (strcmp(balance, "least-conn") && strcmp(balance, "hash"))) {
+        fprintf(stderr, "Expected least-conn or hash after --balance\n");
+        exit_with_usage();
       }
+      server_proxy_balance =
+          strcmp(balance, "hash") == 0 ? PROXY_HASH : PROXY_LEAST_CONN;
     } else if (strcmp("--port", argv[i]) == 0) {
       char* server_port_string = argv[++i];
       if (!server_port_string) {
@@ -553,6 +1749,135 @@ int main(int argc, char** argv) {
         fprintf(stderr, "Expected positive integer after --num-threads\n");
         exit_with_usage();
       }
+    } else if (strcmp("--max-threads", argv[i]) == 0) {
+      char* max_threads_str = argv[++i];
+      if (!max_threads_str || (max_threads = atoi(max_threads_str)) < 0) {
+        fprintf(stderr, "Expected non-negative integer after --max-threads\n");
+        exit_with_usage();
+      }
+    } else if (strcmp("--acceptors", argv[i]) == 0) {
+      char* acceptors_str = argv[++i];
+      if (!acceptors_str || (server_acceptors = atoi(acceptors_str)) < 1) {
+        fprintf(stderr, "Expected positive integer after --acceptors\n");
+        exit_with_usage();
+      }
+    } else if (strcmp("--prefork", argv[i]) == 0) {
+      char* prefork_str = argv[++i];
+      if (!prefork_str || (server_prefork = atoi(prefork_str)) < 0) {
+        fprintf(stderr, "Expected non-negative integer after --prefork\n");
+        exit_with_usage();
+      }
+    } else if (strcmp("--queue-high", argv[i]) == 0) {
+      char* queue_high_str = argv[++i];
+      if (!queue_high_str || (queue_high = atoi(queue_high_str)) < 1) {
+        fprintf(stderr, "Expected positive integer after --queue-high\n");
+        exit_with_usage();
+      }
+    } else if (strcmp("--queue-low", argv[i]) == 0) {
+      char* queue_low_str = argv[++i];
+      if (!queue_low_str || (queue_low = atoi(queue_low_str)) < 0) {
+        fprintf(stderr, "Expected non-negative integer after --queue-low\n");
+        exit_with_usage();
+      }
+    } else if (strcmp("--overload", argv[i]) == 0) {
+      char* overload_str = argv[++i];
+      if (!overload_str || (strcmp(overload_str, "pause") != 0 &&
+                            strcmp(overload_str, "503") != 0)) {
+        fprintf(stderr, "Expected \"503\" or \"pause\" after --overload\n");
+        exit_with_usage();
+      }
+      overload_pause = strcmp(overload_str, "pause") == 0;
+    } else if (strcmp("--pin-workers", argv[i]) == 0) {
+      pin_workers = true;
+    } else if (strcmp("--numa", argv[i]) == 0) {
+      char* numa_str = argv[++i];
+      if (!numa_str || (strcmp(numa_str, "compact") != 0 &&
+                        strcmp(numa_str, "spread") != 0)) {
+        fprintf(stderr, "Expected \"compact\" or \"spread\" after --numa\n");
+        exit_with_usage();
+      }
+      numa_policy = strcmp(numa_str, "spread") == 0 ? AFFINITY_SPREAD
+                                                    : AFFINITY_COMPACT;
+    } else if (strcmp("--incoming-cpu", argv[i]) == 0) {
+      server_incoming_cpu = 1;
+    } else if (strcmp("--work-stealing", argv[i]) == 0) {
+      work_stealing = 1;
+    } else if (strcmp("--idle-timeout", argv[i]) == 0) {
+      char* idle_timeout_str = argv[++i];
+      if (!idle_timeout_str ||
+          (server_idle_timeout = atoi(idle_timeout_str)) < 1) {
+        fprintf(stderr, "Expected positive integer after --idle-timeout\n");
+        exit_with_usage();
+      }
+    } else if (strcmp("--request-timeout", argv[i]) == 0) {
+      char* request_timeout_str = argv[++i];
+      if (!request_timeout_str ||
+          (server_request_timeout = atoi(request_timeout_str)) < 1) {
+        fprintf(stderr,
+                "Expected positive integer after --request-timeout\n");
+        exit_with_usage();
+      }
+    } else if (strcmp("--proxy-timeout", argv[i]) == 0) {
+      char* proxy_timeout_str = argv[++i];
+      if (!proxy_timeout_str ||
+          (server_proxy_timeout = atoi(proxy_timeout_str)) < 1) {
+        fprintf(stderr, "Expected positive integer after --proxy-timeout\n");
+        exit_with_usage();
+      }
+    } else if (strcmp("--drain-timeout", argv[i]) == 0) {
+      char* drain_timeout_str = argv[++i];
+      if (!drain_timeout_str ||
+          (server_drain_timeout = atoi(drain_timeout_str)) < 1) {
+        fprintf(stderr, "Expected positive integer after --drain-timeout\n");
+        exit_with_usage();
+      }
+    } else if (strcmp("--cache-mb", argv[i]) == 0) {
+      char* cache_mb_str = argv[++i];
+      if (!cache_mb_str || atoi(cache_mb_str) < 0) {
+        fprintf(stderr, "Expected non-negative integer after --cache-mb\n");
+        exit_with_usage();
+      }
+      cache_bytes = (size_t)atoi(cache_mb_str) << 20;
+    } else if (strcmp("--open-cache", argv[i]) == 0) {
+      char* open_cache_str = argv[++i];
+      if (!open_cache_str || atoi(open_cache_str) < 0) {
+        fprintf(stderr, "Expected non-negative integer after --open-cache\n");
+        exit_with_usage();
+      }
+      open_cache_init(atoi(open_cache_str));
+    } else if (strcmp("--io-threads", argv[i]) == 0) {
+      char* io_threads_str = argv[++i];
+      if (!io_threads_str || (io_threads = atoi(io_threads_str)) < 0) {
+        fprintf(stderr, "Expected non-negative integer after --io-threads\n");
+        exit_with_usage();
+      }
+    } else if (strcmp("--mmap", argv[i]) == 0) {
+      cache_map_files = true;
+    } else if (strcmp("--access-log", argv[i]) == 0) {
+      access_log_path = argv[++i];
+      if (!access_log_path) {
+        fprintf(stderr, "Expected a file or \"off\" after --access-log\n");
+        exit_with_usage();
+      }
+    } else if (strcmp("--tls-cert", argv[i]) == 0) {
+      tls_cert_path = argv[++i];
+      if (!tls_cert_path) {
+        fprintf(stderr, "Expected a PEM certificate chain after --tls-cert\n");
+        exit_with_usage();
+      }
+    } else if (strcmp("--tls-key", argv[i]) == 0) {
+      tls_key_path = argv[++i];
+      if (!tls_key_path) {
+        fprintf(stderr, "Expected a PEM private key after --tls-key\n");
+        exit_with_usage();
+      }
+    } else if (strcmp("--mime-types", argv[i]) == 0) {
+      char* mime_types_path = argv[++i];
+      if (!mime_types_path || http_load_mime_types(mime_types_path) == -1) {
+        fprintf(stderr, "Expected a readable mime.types file after "
+                        "--mime-types\n");
+        exit_with_usage();
+      }
     } else if (strcmp("--help", argv[i]) == 0) {
       exit_with_usage();
     } else {
@@ -568,13 +1893,110 @@ int main(int argc, char** argv) {
     exit_with_usage();
   }
 
+#ifdef URINGSERVER
+  if (request_handler == handle_proxy_request) {
+    fprintf(stderr, "uringserver only serves --files\n");
+    exit_with_usage();
+  }
+#endif
+
+#ifndef FORKSERVER
+  if (server_prefork > 0) {
+    fprintf(stderr, "--prefork is only supported by forkserver\n");
+    server_prefork = 0;
+  }
+#endif
+
 #ifdef POOLSERVER
   if (num_threads < 1) {
     fprintf(stderr, "Please specify \"--num-threads [N]\"\n");
     exit_with_usage();
   }
+  if (max_threads != 0 && max_threads < num_threads) {
+    fprintf(stderr, "Expected --max-threads of at least --num-threads\n");
+    exit_with_usage();
+  }
+  if (queue_low < 0 || queue_low >= queue_high) queue_low = queue_high / 2;
+  /* Each worker owns a deque there, so the pool cannot shrink. */
+  if (pool_is_adaptive() && work_stealing) {
+    fprintf(stderr, "--max-threads is not supported with --work-stealing\n");
+    max_threads = 0;
+  }
 #endif
 
+  /* In proxy mode the cache holds upstream responses rather than files. */
+  if (request_handler == handle_proxy_request) {
+#ifdef EPOLLSERVER
+    if (cache_bytes > 0) {
+      fprintf(stderr, "--cache-mb with --proxy is not supported by "
+                      "epollserver\n");
+      cache_bytes = 0;
+    }
+#endif
+#ifdef FORKSERVER
+    /* A child forked per connection would fill a cache of its own and exit. */
+    if (cache_bytes > 0 && server_prefork == 0) {
+      fprintf(stderr, "--cache-mb with --proxy needs --prefork in "
+                      "forkserver\n");
+      cache_bytes = 0;
+    }
+#endif
+    proxy_cache_init(cache_bytes);
+    cache_bytes = 0;
+  }
+
+  if (cache_map_files && cache_bytes == 0) {
+    fprintf(stderr, "--mmap maps files into the cache; it needs --cache-mb\n");
+    cache_map_files = false;
+  }
+  file_cache_init(cache_bytes, cache_map_files);
+
+#ifndef EPOLLSERVER
+  /* The other variants block in a thread or process of the request's own. */
+  if (io_threads > 0) {
+    fprintf(stderr, "--io-threads is only supported by epollserver\n");
+    io_threads = 0;
+  }
+#endif
+  if (request_handler == handle_files_request) io_pool_init(io_threads);
+
+  /* Opened before chdir(), so a relative path means what the user meant. */
+  int access_log_fd = STDOUT_FILENO;
+  if (access_log_path && strcmp(access_log_path, "off") == 0)
+    access_log_fd = -1;
+  else if (access_log_path && strcmp(access_log_path, "-") != 0 &&
+           (access_log_fd = open(access_log_path,
+                                 O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                                 0644)) == -1) {
+    perror("Failed to open the access log");
+    exit(errno);
+  }
+  access_log_init(access_log_fd);
+
+  if (pin_workers) affinity_init(numa_policy);
+  if (server_incoming_cpu && (!pin_workers || server_acceptors < 2)) {
+    fprintf(stderr, "--incoming-cpu needs --pin-workers and --acceptors\n");
+    server_incoming_cpu = 0;
+  }
+
+  if (tls_cert_path || tls_key_path) {
+#if defined(EPOLLSERVER) || defined(URINGSERVER)
+    fprintf(stderr, "TLS is served by the blocking variants only\n");
+    exit_with_usage();
+#endif
+    if (!tls_cert_path || !tls_key_path) {
+      fprintf(stderr, "--tls-cert and --tls-key go together\n");
+      exit_with_usage();
+    }
+    if (request_handler != handle_files_request) {
+      fprintf(stderr, "TLS is only supported with --files\n");
+      exit_with_usage();
+    }
+    tls_init(tls_cert_path, tls_key_path);
+  }
+
+  if (server_proxy_hostname != NULL) resolve_proxy_target();
+
   chdir(server_files_directory);
   serve_forever(&server_fd, request_handler);
 
@@ -0,0 +1,74 @@
+/*
+ * Configuration and request handlers shared between httpserver.c and the
+ * server variants that live in their own files.
+ */
+
+#ifndef HTTPSERVER_H
+#define HTTPSERVER_H
+
+#include <netinet/in.h>
+#include <sys/stat.h>
+
+#include "filecache.h"
+#include "libhttp.h"
+#include "proxypool.h"
+#include "wq.h"
+
+/* Global configuration variables, set up in main(). See httpserver.c. */
+extern wq_t work_queue;
+extern int num_threads;
+extern int max_threads;
+extern int work_stealing;
+extern int queue_high;
+extern int queue_low;
+extern int overload_pause;
+extern int server_port;
+extern int server_idle_timeout;
+extern int server_request_timeout;
+extern int server_proxy_timeout;
+extern int server_drain_timeout;
+extern int server_acceptors;
+extern int server_prefork;
+extern int server_incoming_cpu;
+extern char* server_files_directory;
+extern char* server_proxy_hostname;
+extern int server_proxy_pool;
+extern enum proxy_balance server_proxy_balance;
+
+int serve_file(int fd, char* path, int keep_alive);
+int serve_directory(int fd, struct http_request* request, char* path,
+                    struct stat* dir_stat, int* status_code);
+
+/*
+ * Picks what to send for the regular file PATH, described by FILE_STAT: a
+ * precompressed sibling (PATH.br, PATH.gz) that REQUEST accepts and that is
+ * not older than PATH, a gzipped copy from the file cache, or PATH as is.
+ * Returns the file cache entry to send if there is one. Otherwise the caller
+ * sends the file named in FILE, which needs room for strlen(PATH) + 4 bytes,
+ * with Content-Encoding *ENCODING unless that is NULL.
+ */
+struct file_cache_entry* negotiate_file(struct http_request* request,
+                                        char* path, struct stat* file_stat,
+                                        char* file, char** encoding);
+void handle_files_request(int fd);
+void handle_proxy_request(int fd);
+
+#ifdef EPOLLSERVER
+/*
+ * Runs the edge-triggered epoll event loop on the listening socket
+ * SERVER_SOCKET. Connections are served according to REQUEST_HANDLER (files or
+ * proxy), but without blocking a thread per connection. Returns once a
+ * reload has drained it (see reload.h).
+ */
+void epoll_serve_forever(int server_socket, void (*request_handler)(int));
+#endif
+
+#ifdef URINGSERVER
+/*
+ * Runs the io_uring event loop on the listening socket SERVER_SOCKET, serving
+ * files only. Returns once a reload has drained it.
+ */
+void uring_serve_forever(int server_socket);
+#endif
+
+#endif
@@ -0,0 +1,109 @@
+#include "iopool.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+/* Jobs submitted and not yet taken, oldest first. */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_nonempty = PTHREAD_COND_INITIALIZER;
+static struct io_job *pending_head, *pending_tail;
+static bool pool_enabled;
+
+static struct io_job* io_take(void) {
+  pthread_mutex_lock(&pool_lock);
+  while (pending_head == NULL) pthread_cond_wait(&pool_nonempty, &pool_lock);
+  struct io_job* job = pending_head;
+  pending_head = job->next;
+  if (pending_head == NULL) pending_tail = NULL;
+  pthread_mutex_unlock(&pool_lock);
+  return job;
+}
+
+/* Hands JOB back to the loop it came from, waking the loop if it was not
+ * already due to look. */
+static void io_finish(struct io_job* job) {
+  struct io_completions* completions = job->completions;
+  pthread_mutex_lock(&completions->lock);
+  bool wake = completions->done == NULL;
+  job->next = completions->done;
+  completions->done = job;
+  pthread_mutex_unlock(&completions->lock);
+
+  uint64_t one = 1;
+  if (wake && write(completions->eventfd, &one, sizeof(one)) == -1)
+    perror("Failed to signal a completed I/O job");
+}
+
+static void* io_thread(void* arg) {
+  (void)arg;
+  while (1) {
+    struct io_job* job = io_take();
+    job->run(job);
+    io_finish(job);
+  }
+  return NULL;
+}
+
+void io_pool_init(int threads) {
+  for (int i = 0; i < threads; i++) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, io_thread, NULL)) {
+      fprintf(stderr, "Failed to start the I/O threads\n");
+      exit(1);
+    }
+    pthread_detach(thread);
+  }
+  pool_enabled = threads > 0;
+}
+
+bool io_pool_enabled(void) { return pool_enabled; }
+
+int io_completions_init(struct io_completions* completions) {
+  completions->eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (completions->eventfd == -1) return -1;
+  pthread_mutex_init(&completions->lock, NULL);
+  completions->done = NULL;
+  return 0;
+}
+
+void io_submit(struct io_completions* completions, struct io_job* job) {
+  job->completions = completions;
+  job->next = NULL;
+  pthread_mutex_lock(&pool_lock);
+  if (pending_tail)
+    pending_tail->next = job;
+  else
+    pending_head = job;
+  pending_tail = job;
+  pthread_cond_signal(&pool_nonempty);
+  pthread_mutex_unlock(&pool_lock);
+}
+
+void io_completions_run(struct io_completions* completions) {
+  /* Reset the eventfd before taking the list. A job finishing in between is
+   * taken along; one finishing after finds the list empty and writes again. */
+  uint64_t count;
+  if (read(completions->eventfd, &count, sizeof(count)) == -1) count = 0;
+
+  pthread_mutex_lock(&completions->lock);
+  struct io_job* done = completions->done;
+  completions->done = NULL;
+  pthread_mutex_unlock(&completions->lock);
+
+  /* The list is newest first. */
+  struct io_job* ordered = NULL;
+  while (done) {
+    struct io_job* next = done->next;
+    done->next = ordered;
+    ordered = done;
+    done = next;
+  }
+  while (ordered) {
+    struct io_job* job = ordered;
+    ordered = job->next;
+    job->complete(job);
+  }
+}
@@ -0,0 +1,49 @@
+/*
+ * Threads for the blocking filesystem calls of epollserver (--io-threads N).
+ *
+ * Resolving a --files request opens, stats and, with --cache-mb, reads the
+ * whole file, and any of those may wait on the disk. Made on the loop's
+ * thread, one slow file holds up every connection of the loop. With the pool,
+ * the loop hands that work over as an io_job and goes on with the others. A
+ * pool thread runs the job and queues it back on the loop's io_completions,
+ * whose eventfd the loop watches; the loop then completes the job on its own
+ * thread.
+ *
+ * The pool is shared by every loop of the process, and its threads take jobs
+ * in the order they were submitted. Each loop has its own completions.
+ */
+
+#ifndef IOPOOL_H
+#define IOPOOL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+
+struct io_completions {
+  int eventfd; /* Readable while jobs are waiting to be completed. */
+  pthread_mutex_t lock;
+  struct io_job* done; /* Most recently finished first. */
+};
+
+struct io_job {
+  void (*run)(struct io_job* job);      /* On a pool thread. */
+  void (*complete)(struct io_job* job); /* On the submitter's, afterwards. */
+  struct io_completions* completions;
+  struct io_job* next;
+};
+
+/* Starts THREADS threads; with none, the pool is disabled. */
+void io_pool_init(int threads);
+bool io_pool_enabled(void);
+
+/* Returns -1 if the eventfd cannot be made. */
+int io_completions_init(struct io_completions* completions);
+
+/* Runs JOB on the pool, then queues it on COMPLETIONS. JOB must stay alive
+ * until it has been completed. */
+void io_submit(struct io_completions* completions, struct io_job* job);
+
+/* Completes the jobs queued on COMPLETIONS, in the order they finished. */
+void io_completions_run(struct io_completions* completions);
+
+#endif
@@ -1,78 +1,341 @@
+#define _GNU_SOURCE /* splice(), strptime(), timegm() */
+
 #include "libhttp.h"
 
+#include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
-#define LIBHTTP_REQUEST_MAX_SIZE 8192
+#include "tls.h"
+
+static void http_reader_fill_request(struct http_reader* reader,
+                                     struct http_request* request);
+
+/* Returns true if the comma-separated header VALUE contains TOKEN. */
+static int http_has_token(char* value, char* token) {
+  size_t value_length = strlen(value);
+  size_t token_length = strlen(token);
+  for (size_t i = 0; i + token_length <= value_length; i++) {
+    if (strncasecmp(value + i, token, token_length) == 0 &&
+        (i == 0 || value[i - 1] == ' ' || value[i - 1] == ',') &&
+        (i + token_length == value_length || value[i + token_length] == ',' ||
+         value[i + token_length] == ' '))
+      return 1;
+  }
+  return 0;
+}
 
 void http_fatal_error(char* message) {
   fprintf(stderr, "%s\n", message);
   exit(ENOBUFS);
 }
 
+/*
+ * A request parsed by http_request_parse() keeps its buffer right behind it,
+ * so the whole thing is a single allocation.
+ */
+struct http_parsed_request {
+  struct http_request request;
+  struct http_reader reader;
+};
+
 struct http_request* http_request_parse(int fd) {
-  struct http_request* request = malloc(sizeof(struct http_request));
-  if (!request) http_fatal_error("Malloc failed");
-
-  char* read_buffer = malloc(LIBHTTP_REQUEST_MAX_SIZE + 1);
-  if (!read_buffer) http_fatal_error("Malloc failed");
-
-  int bytes_read = read(fd, read_buffer, LIBHTTP_REQUEST_MAX_SIZE);
-  read_buffer[bytes_read] = '\0'; /* Always null-terminate. */
-
-  char *read_start, *read_end;
-  size_t read_size;
-
-  do {
-    /* Read in the HTTP method: "[A-Z]*" */
-    read_start = read_end = read_buffer;
-    while (*read_end >= 'A' && *read_end <= 'Z') read_end++;
-    read_size = read_end - read_start;
-    if (read_size == 0) break;
-    request->method = malloc(read_size + 1);
-    memcpy(request->method, read_start, read_size);
-    request->method[read_size] = '\0';
-
-    /* Read in a space character. */
-    read_start = read_end;
-    if (*read_end != ' ') break;
-    read_end++;
+  struct http_parsed_request* parsed = malloc(sizeof(*parsed));
+  if (!parsed) http_fatal_error("Malloc failed");
+  http_reader_init(&parsed->reader, fd);
 
-    /* Read in the path: "[^ \n]*" */
-    read_start = read_end;
-    while (*read_end != '\0' && *read_end != ' ' && *read_end != '\n')
-      read_end++;
-    read_size = read_end - read_start;
-    if (read_size == 0) break;
-    request->path = malloc(read_size + 1);
-    memcpy(request->path, read_start, read_size);
-    request->path[read_size] = '\0';
-
-    /* Read in HTTP version and rest of request line: ".*" */
-    read_start = read_end;
-    while (*read_end != '\0' && *read_end != '\n') read_end++;
-    if (*read_end != '\n') break;
-    read_end++;
+  int bytes_read = read(fd, parsed->reader.buffer, LIBHTTP_REQUEST_MAX_SIZE);
+  if (bytes_read > 0) parsed->reader.end = bytes_read;
 
-    free(read_buffer);
-    return request;
-  } while (0);
+  /* A lone read may stop short of the blank line; settle for the request
+   * line and whatever headers made it. */
+  int status = http_parse_request(&parsed->reader, &parsed->request);
+  if (status == 0 && parsed->reader.lines > 0) {
+    http_reader_fill_request(&parsed->reader, &parsed->request);
+    status = 1;
+  }
+  if (status != 1) {
+    free(parsed);
+    return NULL;
+  }
+  return &parsed->request;
+}
 
-  /* An error occurred. */
+void http_request_free(struct http_request* request) {
+  /* REQUEST is the first member of its http_parsed_request. */
   free(request);
-  free(read_buffer);
+}
+
+char* http_request_header(struct http_request* request, char* key) {
+  for (int i = 0; i < request->num_headers; i++)
+    if (strcasecmp(request->headers[i].key, key) == 0)
+      return request->headers[i].value;
   return NULL;
 }
 
+int http_accepts_encoding(struct http_request* request, char* coding) {
+  char* value = http_request_header(request, "Accept-Encoding");
+  if (value == NULL) return 0;
+
+  int star = 0;
+  size_t coding_length = strlen(coding);
+  for (char* item = value; *item;) {
+    item += strspn(item, " \t,");
+    size_t name_length = strcspn(item, " \t;,");
+    char* params = item + name_length;
+    char* end = params + strcspn(params, ",");
+
+    /* An explicit q=0 refuses the coding. */
+    int accepted = 1;
+    char* q = strstr(params, "q=");
+    if (q && q < end) accepted = strtod(q + 2, NULL) > 0;
+
+    if (name_length == coding_length &&
+        strncasecmp(item, coding, name_length) == 0)
+      return accepted;
+    if (name_length == 1 && *item == '*') star = accepted;
+    item = end;
+  }
+  return star;
+}
+
+/* Forgets the parse state, so the next line read starts a new request. */
+static void http_reader_reset(struct http_reader* reader) {
+  reader->lines = 0;
+  reader->num_headers = 0;
+  reader->minor_version = 0;
+  reader->keep_alive = 0;
+  reader->content_length = 0;
+}
+
+void http_reader_init(struct http_reader* reader, int fd) {
+  reader->fd = fd;
+  reader->start = reader->scan = reader->end = 0;
+  reader->skip = 0;
+  http_reader_reset(reader);
+}
+
+/*
+ * Parses the request line LINE (LENGTH bytes, line terminator excluded) in
+ * place: "METHOD SP PATH [SP HTTP/1.x]". Returns false if it is malformed.
+ */
+static bool http_parse_request_line(struct http_reader* reader, char* line,
+                                    size_t length) {
+  char* line_end = line + length;
+  char* read_end = line;
+
+  /* Read in the HTTP method: "[A-Z]*" */
+  while (read_end < line_end && *read_end >= 'A' && *read_end <= 'Z')
+    read_end++;
+  if (read_end == line || read_end == line_end || *read_end != ' ')
+    return false;
+  *read_end++ = '\0';
+
+  /* Read in the path: "[^ ]*" */
+  char* path = read_end;
+  while (read_end < line_end && *read_end != ' ') read_end++;
+  if (read_end == path) return false;
+  reader->path_offset = path - (reader->buffer + reader->start);
+
+  /* Read in HTTP version; the rest of the request line is ignored. */
+  if (line_end - read_end >= 9 && strncmp(read_end, " HTTP/1.", 8) == 0 &&
+      read_end[8] >= '0' && read_end[8] <= '9')
+    reader->minor_version = read_end[8] - '0';
+  *read_end = '\0';
+
+  /* HTTP/1.1 connections persist unless the client opts out. */
+  reader->keep_alive = reader->minor_version >= 1;
+  return true;
+}
+
+/*
+ * Parses the header line LINE (LENGTH bytes, line terminator excluded) in
+ * place, splitting it into a key and a value. Lines without a colon and
+ * headers past LIBHTTP_MAX_HEADERS are ignored.
+ */
+static void http_parse_header_line(struct http_reader* reader, char* line,
+                                   size_t length) {
+  char* line_end = line + length;
+  char* colon = memchr(line, ':', length);
+  if (colon == NULL) return;
+  *colon = '\0';
+
+  char* value = colon + 1;
+  while (value < line_end && (*value == ' ' || *value == '\t')) value++;
+  while (line_end > value && (line_end[-1] == ' ' || line_end[-1] == '\t'))
+    line_end--;
+  *line_end = '\0';
+
+  if (strcasecmp(line, "Connection") == 0) {
+    if (http_has_token(value, "close"))
+      reader->keep_alive = 0;
+    else if (http_has_token(value, "keep-alive"))
+      reader->keep_alive = 1;
+  } else if (strcasecmp(line, "Content-Length") == 0) {
+    reader->content_length = strtol(value, NULL, 10);
+    if (reader->content_length < 0) reader->content_length = 0;
+  }
+
+  if (reader->num_headers < LIBHTTP_MAX_HEADERS) {
+    char* request_start = reader->buffer + reader->start;
+    reader->header_offsets[reader->num_headers][0] = line - request_start;
+    reader->header_offsets[reader->num_headers][1] = value - request_start;
+    reader->num_headers++;
+  }
+}
+
+/* Points the fields of REQUEST at the parsed request in READER's buffer. */
+static void http_reader_fill_request(struct http_reader* reader,
+                                     struct http_request* request) {
+  char* request_start = reader->buffer + reader->start;
+  request->method = request_start;
+  request->path = request_start + reader->path_offset;
+  request->minor_version = reader->minor_version;
+  request->keep_alive = reader->keep_alive;
+  request->content_length = reader->content_length;
+  request->num_headers = reader->num_headers;
+  for (int i = 0; i < reader->num_headers; i++) {
+    request->headers[i].key = request_start + reader->header_offsets[i][0];
+    request->headers[i].value = request_start + reader->header_offsets[i][1];
+  }
+}
+
+int http_parse_request(struct http_reader* reader,
+                       struct http_request* request) {
+  /* Discard the body of the previous request; only GET is served. */
+  if (reader->skip > 0) {
+    size_t available = reader->end - reader->start;
+    size_t skipped = reader->skip < available ? reader->skip : available;
+    reader->start += skipped;
+    reader->scan = reader->start;
+    reader->skip -= skipped;
+    if (reader->skip > 0) {
+      reader->start = reader->scan = reader->end = 0;
+      return 0;
+    }
+  }
+
+  /* Only lines that were not complete on the previous call are scanned. */
+  while (reader->scan < reader->end) {
+    char* line = reader->buffer + reader->scan;
+    char* newline = memchr(line, '\n', reader->end - reader->scan);
+    if (newline == NULL) break;
+    reader->scan = newline + 1 - reader->buffer;
+
+    size_t length = newline - line;
+    if (length > 0 && line[length - 1] == '\r') length--;
+
+    if (length == 0) {
+      if (reader->lines == 0) {
+        /* Tolerate empty lines ahead of the request line. */
+        reader->start = reader->scan;
+        continue;
+      }
+      http_reader_fill_request(reader, request);
+      reader->start = reader->scan;
+      reader->skip = reader->content_length;
+      http_reader_reset(reader);
+      return 1;
+    }
+
+    if (reader->lines++ == 0) {
+      if (!http_parse_request_line(reader, line, length)) return -1;
+    } else {
+      http_parse_header_line(reader, line, length);
+    }
+  }
+
+  /* Make room at the end of the buffer for the rest of the request. Offsets
+   * are kept relative to start, so moving the request keeps them valid. */
+  if (reader->start > 0) {
+    memmove(reader->buffer, reader->buffer + reader->start,
+            reader->end - reader->start);
+    reader->scan -= reader->start;
+    reader->end -= reader->start;
+    reader->start = 0;
+  }
+  if (reader->end == LIBHTTP_REQUEST_MAX_SIZE) return -1;
+  return 0;
+}
+
+int http_reader_has_request(struct http_reader* reader) {
+  return reader->skip == 0 &&
+         memchr(reader->buffer + reader->scan, '\n',
+                reader->end - reader->scan) != NULL;
+}
+
+int http_reader_feed(struct http_reader* reader, const char* data,
+                     size_t length) {
+  if (length > LIBHTTP_REQUEST_MAX_SIZE - reader->end) return -1;
+  memcpy(reader->buffer + reader->end, data, length);
+  reader->end += length;
+  return 0;
+}
+
+int http_reader_fill(struct http_reader* reader) {
+  while (1) {
+    char* into = reader->buffer + reader->end;
+    size_t room = LIBHTTP_REQUEST_MAX_SIZE - reader->end;
+    ssize_t bytes_read = tls_wraps_reads(reader->fd)
+                             ? tls_read(reader->fd, into, room)
+                             : read(reader->fd, into, room);
+    if (bytes_read < 0 && errno == EINTR) continue;
+    if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      /* A blocking socket reports a receive timeout the same way. */
+      int flags = fcntl(reader->fd, F_GETFL, 0);
+      return flags != -1 && (flags & O_NONBLOCK) ? -2 : 0;
+    }
+    if (bytes_read <= 0) return 0;
+    reader->end += bytes_read;
+    return 1;
+  }
+}
+
+/*
+ * Reads the next request on the connection. Bytes received past the end of
+ * the request are kept in READER, so pipelined requests that arrived in the
+ * same read are answered without another syscall.
+ *
+ * Returns 1 and fills in REQUEST on success, 0 if the client closed the
+ * connection or the read timed out, -1 if the request is malformed or too
+ * large, and -2 if READER's socket is non-blocking and no complete request is
+ * available yet.
+ */
+int http_read_request(struct http_reader* reader,
+                      struct http_request* request) {
+  while (1) {
+    int status = http_parse_request(reader, request);
+    if (status != 0) return status;
+
+    status = http_reader_fill(reader);
+    if (status != 1) return status;
+  }
+}
+
 char* http_get_response_message(int status_code) {
   switch (status_code) {
     case 100:
       return "Continue";
     case 200:
       return "OK";
+    case 206:
+      return "Partial Content";
     case 301:
       return "Moved Permanently";
     case 302:
@@ -89,13 +352,19 @@ char* http_get_response_message(int status_code) {
       return "Not Found";
     case 405:
       return "Method Not Allowed";
+    case 416:
+      return "Range Not Satisfiable";
+    case 502:
+      return "Bad Gateway";
+    case 503:
+      return "Service Unavailable";
     default:
       return "Internal Server Error";
   }
 }
 
 void http_start_response(int fd, int status_code) {
-  dprintf(fd, "HTTP/1.0 %d %s\r\n", status_code,
+  dprintf(fd, "HTTP/1.1 %d %s\r\n", status_code,
           http_get_response_message(status_code));
 }
 
@@ -105,29 +374,718 @@ void http_send_header(int fd, char* key, char* value) {
 
 void http_end_headers(int fd) { dprintf(fd, "\r\n"); }
 
+/* Tells the client whether the connection stays open after this response. */
+void http_send_connection(int fd, int keep_alive) {
+  http_send_header(fd, "Connection", keep_alive ? "keep-alive" : "close");
+}
+
+/* Appends the formatted string to the headers of RESPONSE. */
+static void http_response_printf(struct http_response* response,
+                                 const char* format, ...) {
+  if (response->overflow) return;
+  size_t space = LIBHTTP_RESPONSE_HEADERS_SIZE - response->length;
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(response->buffer + response->length, space, format,
+                         args);
+  va_end(args);
+  if (length < 0 || (size_t)length >= space)
+    response->overflow = 1;
+  else
+    response->length += length;
+}
+
+void http_response_start(struct http_response* response, int status_code) {
+  response->length = 0;
+  response->overflow = 0;
+  http_response_printf(response, "HTTP/1.1 %d %s\r\n", status_code,
+                       http_get_response_message(status_code));
+}
+
+void http_response_header(struct http_response* response, char* key,
+                          char* value) {
+  http_response_printf(response, "%s: %s\r\n", key, value);
+}
+
+void http_response_header_long(struct http_response* response, char* key,
+                               long value) {
+  http_response_printf(response, "%s: %ld\r\n", key, value);
+}
+
+void http_response_connection(struct http_response* response, int keep_alive) {
+  http_response_header(response, "Connection",
+                       keep_alive ? "keep-alive" : "close");
+}
+
+int http_response_end(struct http_response* response) {
+  http_response_printf(response, "\r\n");
+  return response->overflow ? -1 : 0;
+}
+
+ssize_t http_response_send(struct http_response* response, int fd,
+                           const void* body, size_t body_length, int flags) {
+  if (http_response_end(response) == -1) {
+    errno = ENOBUFS;
+    return -1;
+  }
+
+  struct iovec iov[2] = {
+      {.iov_base = response->buffer, .iov_len = response->length},
+      {.iov_base = (void*)body, .iov_len = body_length},
+  };
+  return http_sendv(fd, iov, body_length ? 2 : 1, flags);
+}
+
+void http_format_etag(char* buffer, off_t size, struct timespec* mtime,
+                      char* encoding) {
+  snprintf(buffer, LIBHTTP_ETAG_SIZE, "\"%lx-%lx.%lx%s%s\"", (long)size,
+           (long)mtime->tv_sec, (long)mtime->tv_nsec, encoding ? "-" : "",
+           encoding ? encoding : "");
+}
+
+void http_format_date(char* buffer, time_t date) {
+  struct tm tm;
+  gmtime_r(&date, &tm);
+  strftime(buffer, LIBHTTP_DATE_SIZE, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+time_t http_parse_date(char* date) {
+  struct tm tm;
+  memset(&tm, 0, sizeof(tm));
+  char* end = strptime(date, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+  return end && *end == '\0' ? timegm(&tm) : -1;
+}
+
+/* Returns whether the comma-separated entity tags in LIST include ETAG,
+ * comparing weakly (ignoring W/ prefixes) unless STRONG. */
+static int http_etag_listed(char* list, char* etag, int strong) {
+  size_t length = strlen(etag);
+  for (char* item = list; *item;) {
+    item += strspn(item, " \t,");
+    if (*item == '*') return 1;
+    int weak = strncmp(item, "W/", 2) == 0;
+    if (weak) item += 2;
+    size_t item_length = strcspn(item, " \t,");
+    if (item_length == length && strncmp(item, etag, length) == 0 &&
+        !(strong && weak))
+      return 1;
+    item += item_length;
+  }
+  return 0;
+}
+
+/* Parses a single "bytes=" range of a body of SIZE bytes. Returns 1 and sets
+ * *START and *LENGTH, -1 if the range is unsatisfiable, or 0 to ignore the
+ * header (malformed, or several ranges). */
+static int http_parse_range(char* range, off_t size, off_t* start,
+                            off_t* length) {
+  if (strncmp(range, "bytes=", 6) != 0 || strchr(range, ',')) return 0;
+  range += 6;
+
+  char* end;
+  if (*range == '-') {
+    /* The last N bytes. */
+    long long suffix = strtoll(range + 1, &end, 10);
+    if (end == range + 1 || *end != '\0' || suffix < 0) return 0;
+    if (suffix == 0 || size == 0) return -1;
+    *start = suffix < size ? size - suffix : 0;
+    *length = size - *start;
+    return 1;
+  }
+
+  long long first = strtoll(range, &end, 10);
+  if (end == range || *end != '-' || first < 0) return 0;
+  long long last = size - 1;
+  if (end[1] != '\0') {
+    char* last_end;
+    last = strtoll(end + 1, &last_end, 10);
+    if (*last_end != '\0' || last < first) return 0;
+  }
+  if (first >= size) return -1;
+  if (last >= size) last = size - 1;
+  *start = first;
+  *length = last - first + 1;
+  return 1;
+}
+
+int http_file_status(struct http_request* request, char* etag, time_t mtime,
+                     off_t size, off_t* start, off_t* length) {
+  *start = 0;
+  *length = size;
+  if (request == NULL) return 200;
+
+  /* If-None-Match overrides If-Modified-Since. */
+  char* if_none_match = http_request_header(request, "If-None-Match");
+  char* if_modified_since = http_request_header(request, "If-Modified-Since");
+  if (if_none_match) {
+    if (http_etag_listed(if_none_match, etag, 0)) return 304;
+  } else if (if_modified_since) {
+    time_t since = http_parse_date(if_modified_since);
+    if (since != -1 && mtime <= since) return 304;
+  }
+
+  char* range = http_request_header(request, "Range");
+  if (range == NULL) return 200;
+
+  /* A Range with If-Range only applies if the client's copy is current. */
+  char* if_range = http_request_header(request, "If-Range");
+  if (if_range) {
+    int current = if_range[0] == '"' || strncmp(if_range, "W/", 2) == 0
+                      ? http_etag_listed(if_range, etag, 1)
+                      : http_parse_date(if_range) == mtime;
+    if (!current) return 200;
+  }
+
+  switch (http_parse_range(range, size, start, length)) {
+    case 1:
+      return 206;
+    case -1:
+      return 416;
+    default:
+      *start = 0;
+      *length = size;
+      return 200;
+  }
+}
+
+void http_response_file_headers(struct http_response* response,
+                                int status_code, char* content_type,
+                                char* encoding, char* etag, time_t mtime,
+                                off_t size, off_t start, off_t length) {
+  char last_modified[LIBHTTP_DATE_SIZE];
+  http_format_date(last_modified, mtime);
+
+  if (status_code != 304) {
+    http_response_header(response, "Content-Type", content_type);
+    http_response_header_long(response, "Content-Length",
+                              status_code == 416 ? 0 : length);
+    http_response_header(response, "Accept-Ranges", "bytes");
+  }
+  if (status_code == 206)
+    http_response_printf(response, "Content-Range: bytes %ld-%ld/%ld\r\n",
+                         (long)start, (long)(start + length - 1), (long)size);
+  else if (status_code == 416)
+    http_response_printf(response, "Content-Range: bytes */%ld\r\n",
+                         (long)size);
+  if (encoding) {
+    http_response_header(response, "Content-Encoding", encoding);
+    http_response_header(response, "Vary", "Accept-Encoding");
+  }
+  http_response_header(response, "ETag", etag);
+  http_response_header(response, "Last-Modified", last_modified);
+}
+
+ssize_t http_sendv(int fd, struct iovec* iov, int iovcnt, int flags) {
+  if (tls_wraps_writes(fd)) return tls_sendv(fd, iov, iovcnt, flags & MSG_MORE);
+
+  struct msghdr message = {.msg_iov = iov, .msg_iovlen = iovcnt};
+  size_t total = 0;
+  for (int i = 0; i < iovcnt; i++) total += iov[i].iov_len;
+  size_t sent = 0;
+
+  /* A short write leaves the rest of the iovecs for the next round. */
+  while (sent < total) {
+    ssize_t bytes = sendmsg(fd, &message, flags);
+    if (bytes < 0 && errno == ENOTSOCK)
+      bytes = writev(fd, message.msg_iov, message.msg_iovlen);
+    if (bytes < 0 && errno == EINTR) continue;
+    if (bytes <= 0) return -1;
+    sent += bytes;
+    while (message.msg_iovlen > 0 && (size_t)bytes >= message.msg_iov->iov_len) {
+      bytes -= message.msg_iov->iov_len;
+      message.msg_iov++;
+      message.msg_iovlen--;
+    }
+    if (message.msg_iovlen > 0) {
+      message.msg_iov->iov_base = (char*)message.msg_iov->iov_base + bytes;
+      message.msg_iov->iov_len -= bytes;
+    }
+  }
+  return sent;
+}
+
+void http_chunked_init(struct http_chunked* chunked, int fd) {
+  chunked->fd = fd;
+  chunked->length = 0;
+  chunked->sent = 0;
+}
+
+/* Sends the buffered bytes as a chunk, followed by the last chunk if LAST. An
+ * empty buffer makes no chunk, since a zero-length one would end the body. */
+static int http_chunked_flush(struct http_chunked* chunked, bool last) {
+  if (chunked->sent < 0) return -1;
+  char size_line[24];
+  struct iovec iov[3];
+  int iovcnt = 0;
+  if (chunked->length > 0) {
+    int length =
+        snprintf(size_line, sizeof(size_line), "%zx\r\n", chunked->length);
+    iov[iovcnt++] = (struct iovec){size_line, length};
+    iov[iovcnt++] = (struct iovec){chunked->buffer, chunked->length};
+  }
+  char* trailer = chunked->length > 0 ? (last ? "\r\n0\r\n\r\n" : "\r\n")
+                                      : (last ? "0\r\n\r\n" : "");
+  if (*trailer) iov[iovcnt++] = (struct iovec){trailer, strlen(trailer)};
+  if (iovcnt == 0) return 0;
+
+  ssize_t sent = http_sendv(chunked->fd, iov, iovcnt, last ? 0 : MSG_MORE);
+  chunked->length = 0;
+  chunked->sent = sent < 0 ? -1 : chunked->sent + sent;
+  return sent < 0 ? -1 : 0;
+}
+
+int http_chunked_write(struct http_chunked* chunked, const void* data,
+                       size_t length) {
+  while (length > 0) {
+    if (chunked->sent < 0) return -1;
+    size_t room = LIBHTTP_CHUNK_SIZE - chunked->length;
+    size_t n = length < room ? length : room;
+    memcpy(chunked->buffer + chunked->length, data, n);
+    chunked->length += n;
+    data = (const char*)data + n;
+    length -= n;
+    if (chunked->length == LIBHTTP_CHUNK_SIZE &&
+        http_chunked_flush(chunked, false) == -1)
+      return -1;
+  }
+  return chunked->sent < 0 ? -1 : 0;
+}
+
+ssize_t http_chunked_finish(struct http_chunked* chunked) {
+  if (http_chunked_flush(chunked, true) == -1) return -1;
+  return chunked->sent;
+}
+
+/*
+ * Turns TCP_CORK on or off for the socket FD. While corked, the kernel only
+ * sends full packets, so the headers and the start of the body leave together
+ * instead of as a train of tiny segments.
+ */
+void http_set_cork(int fd, int enable) {
+  setsockopt(fd, IPPROTO_TCP, TCP_CORK, &enable, sizeof(enable));
+}
+
+/* Copies through a user-space buffer; the last resort of http_send_file. */
+static ssize_t http_copy_file(int fd, int filedes, off_t offset,
+                              size_t count) {
+  char buf[4096];
+  size_t sent = 0;
+
+  while (sent < count) {
+    size_t want = count - sent < sizeof(buf) ? count - sent : sizeof(buf);
+    ssize_t len = pread(filedes, buf, want, offset + sent);
+    if (len < 0 && errno == ESPIPE) len = read(filedes, buf, want);
+    if (len <= 0) break;
+
+    for (ssize_t written = 0; written < len;) {
+      ssize_t n = write(fd, buf + written, len - written);
+      if (n < 0) return sent > 0 ? (ssize_t)sent : -1;
+      written += n;
+      sent += n;
+    }
+  }
+  return sent;
+}
+
+/* Moves the data through a pipe with splice(2), for sources sendfile refuses. */
+static ssize_t http_splice_file(int fd, int filedes, off_t offset,
+                                size_t count) {
+  int pipefd[2];
+  if (pipe(pipefd) == -1) return -1;
+
+  /* Non-seekable sources (pipes, character devices) are read from where they
+   * are; everything else honours OFFSET. */
+  off_t* in_offset = lseek(filedes, 0, SEEK_CUR) == -1 ? NULL : &offset;
+  size_t sent = 0;
+  ssize_t status = 0;
+
+  while (sent < count) {
+    ssize_t in = splice(filedes, in_offset, pipefd[1], NULL, count - sent,
+                        SPLICE_F_MOVE | SPLICE_F_MORE);
+    if (in <= 0) {
+      status = in;
+      break;
+    }
+    while (in > 0) {
+      ssize_t out = splice(pipefd[0], NULL, fd, NULL, in,
+                           SPLICE_F_MOVE | SPLICE_F_MORE);
+      if (out <= 0) {
+        status = -1;
+        break;
+      }
+      in -= out;
+      sent += out;
+    }
+    if (status == -1) break;
+  }
+
+  close(pipefd[0]);
+  close(pipefd[1]);
+  if (status == -1 && sent == 0) return -1;
+  return sent;
+}
+
+/*
+ * Sends COUNT bytes of FILEDES, starting at OFFSET, to the socket FD without
+ * copying them through user space when the kernel allows it: sendfile(2) for
+ * regular files, splice(2) through a pipe for other sources, and a plain
+ * read/write loop when neither works. FD must be a blocking socket. Returns
+ * the number of bytes sent, or -1 if nothing could be sent. A TLS connection
+ * without kernel TLS takes the read/write loop of tls_send_file() instead.
+ */
+ssize_t http_send_file(int fd, int filedes, off_t offset, size_t count) {
+  if (tls_wraps_writes(fd)) return tls_send_file(fd, filedes, offset, count);
+
+  struct stat file_stat;
+  if (fstat(filedes, &file_stat) == 0 && S_ISREG(file_stat.st_mode)) {
+    size_t sent = 0;
+    while (sent < count) {
+      ssize_t n = sendfile(fd, filedes, &offset, count - sent);
+      if (n > 0) {
+        sent += n;
+        continue;
+      }
+      if (n == 0) return sent;
+      if (errno == EINTR) continue;
+      if (sent == 0 && (errno == EINVAL || errno == ENOSYS)) break;
+      return sent > 0 ? (ssize_t)sent : -1;
+    }
+    if (sent == count) return sent;
+  }
+
+  ssize_t sent = http_splice_file(fd, filedes, offset, count);
+  if (sent == -1 && (errno == EINVAL || errno == ENOSYS))
+    sent = http_copy_file(fd, filedes, offset, count);
+  return sent;
+}
+
+/* Built-in extension to Content-Type mappings; --mime-types adds more. */
+static struct {
+  char* extension;
+  char* type;
+} default_mime_types[] = {
+    {"html", "text/html"},
+    {"htm", "text/html"},
+    {"shtml", "text/html"},
+    {"css", "text/css"},
+    {"txt", "text/plain"},
+    {"text", "text/plain"},
+    {"conf", "text/plain"},
+    {"log", "text/plain"},
+    {"ini", "text/plain"},
+    {"md", "text/plain"},
+    {"markdown", "text/plain"},
+    {"csv", "text/csv"},
+    {"tsv", "text/tab-separated-values"},
+    {"ics", "text/calendar"},
+    {"xml", "text/xml"},
+    {"vtt", "text/vtt"},
+    {"c", "text/x-c"},
+    {"h", "text/x-c"},
+    {"cc", "text/x-c++"},
+    {"cpp", "text/x-c++"},
+    {"cxx", "text/x-c++"},
+    {"hpp", "text/x-c++"},
+    {"java", "text/x-java"},
+    {"py", "text/x-python"},
+    {"sh", "text/x-shellscript"},
+    {"s", "text/x-asm"},
+    {"asm", "text/x-asm"},
+    {"diff", "text/x-diff"},
+    {"patch", "text/x-diff"},
+    {"tex", "text/x-tex"},
+    {"yaml", "text/x-yaml"},
+    {"yml", "text/x-yaml"},
+    {"htc", "text/x-component"},
+    {"mml", "text/mathml"},
+    {"js", "application/javascript"},
+    {"mjs", "application/javascript"},
+    {"json", "application/json"},
+    {"map", "application/json"},
+    {"jsonld", "application/ld+json"},
+    {"webmanifest", "application/manifest+json"},
+    {"xhtml", "application/xhtml+xml"},
+    {"rss", "application/rss+xml"},
+    {"atom", "application/atom+xml"},
+    {"xsl", "application/xslt+xml"},
+    {"xslt", "application/xslt+xml"},
+    {"pdf", "application/pdf"},
+    {"ps", "application/postscript"},
+    {"eps", "application/postscript"},
+    {"ai", "application/postscript"},
+    {"rtf", "application/rtf"},
+    {"doc", "application/msword"},
+    {"dot", "application/msword"},
+    {"docx", "application/vnd.openxmlformats-officedocument.wordprocessingml.document"},
+    {"xls", "application/vnd.ms-excel"},
+    {"xlt", "application/vnd.ms-excel"},
+    {"xlsx", "application/vnd.openxmlformats-officedocument.spreadsheetml.sheet"},
+    {"ppt", "application/vnd.ms-powerpoint"},
+    {"pps", "application/vnd.ms-powerpoint"},
+    {"pptx", "application/vnd.openxmlformats-officedocument.presentationml.presentation"},
+    {"odt", "application/vnd.oasis.opendocument.text"},
+    {"ods", "application/vnd.oasis.opendocument.spreadsheet"},
+    {"odp", "application/vnd.oasis.opendocument.presentation"},
+    {"odg", "application/vnd.oasis.opendocument.graphics"},
+    {"epub", "application/epub+zip"},
+    {"zip", "application/zip"},
+    {"gz", "application/gzip"},
+    {"tgz", "application/gzip"},
+    {"bz2", "application/x-bzip2"},
+    {"xz", "application/x-xz"},
+    {"zst", "application/zstd"},
+    {"br", "application/x-brotli"},
+    {"tar", "application/x-tar"},
+    {"7z", "application/x-7z-compressed"},
+    {"rar", "application/vnd.rar"},
+    {"jar", "application/java-archive"},
+    {"war", "application/java-archive"},
+    {"ear", "application/java-archive"},
+    {"jnlp", "application/x-java-jnlp-file"},
+    {"apk", "application/vnd.android.package-archive"},
+    {"deb", "application/x-debian-package"},
+    {"rpm", "application/x-redhat-package-manager"},
+    {"iso", "application/x-iso9660-image"},
+    {"dmg", "application/x-apple-diskimage"},
+    {"exe", "application/x-msdownload"},
+    {"dll", "application/x-msdownload"},
+    {"msi", "application/x-msi"},
+    {"bash", "application/x-sh"},
+    {"pl", "application/x-perl"},
+    {"pm", "application/x-perl"},
+    {"rb", "application/x-ruby"},
+    {"php", "application/x-httpd-php"},
+    {"swf", "application/x-shockwave-flash"},
+    {"der", "application/x-x509-ca-cert"},
+    {"pem", "application/x-x509-ca-cert"},
+    {"crt", "application/x-x509-ca-cert"},
+    {"p7m", "application/pkcs7-mime"},
+    {"p8", "application/pkix-pkcs8"},
+    {"sig", "application/pgp-signature"},
+    {"asc", "application/pgp-signature"},
+    {"wasm", "application/wasm"},
+    {"sql", "application/sql"},
+    {"bin", "application/octet-stream"},
+    {"dat", "application/octet-stream"},
+    {"img", "application/octet-stream"},
+    {"sqlite", "application/x-sqlite3"},
+    {"db", "application/x-sqlite3"},
+    {"bdf", "application/x-font-bdf"},
+    {"pcf", "application/x-font-pcf"},
+    {"pfa", "application/x-font-type1"},
+    {"pfb", "application/x-font-type1"},
+    {"eot", "application/vnd.ms-fontobject"},
+    {"hqx", "application/mac-binhex40"},
+    {"latex", "application/x-latex"},
+    {"dvi", "application/x-dvi"},
+    {"t", "application/x-troff"},
+    {"tr", "application/x-troff"},
+    {"roff", "application/x-troff"},
+    {"man", "application/x-troff-man"},
+    {"torrent", "application/x-bittorrent"},
+    {"kml", "application/vnd.google-earth.kml+xml"},
+    {"kmz", "application/vnd.google-earth.kmz"},
+    {"m3u8", "application/vnd.apple.mpegurl"},
+    {"mpd", "application/dash+xml"},
+    {"ogx", "application/ogg"},
+    {"ipynb", "application/x-ipynb+json"},
+    {"toml", "application/toml"},
+    {"yang", "application/yang"},
+    {"woff", "font/woff"},
+    {"woff2", "font/woff2"},
+    {"ttf", "font/ttf"},
+    {"otf", "font/otf"},
+    {"ttc", "font/collection"},
+    {"jpg", "image/jpeg"},
+    {"jpeg", "image/jpeg"},
+    {"jpe", "image/jpeg"},
+    {"jfif", "image/jpeg"},
+    {"png", "image/png"},
+    {"apng", "image/apng"},
+    {"gif", "image/gif"},
+    {"webp", "image/webp"},
+    {"avif", "image/avif"},
+    {"heic", "image/heic"},
+    {"heif", "image/heif"},
+    {"bmp", "image/bmp"},
+    {"tif", "image/tiff"},
+    {"tiff", "image/tiff"},
+    {"svg", "image/svg+xml"},
+    {"svgz", "image/svg+xml"},
+    {"ico", "image/x-icon"},
+    {"cur", "image/x-icon"},
+    {"jxl", "image/jxl"},
+    {"ppm", "image/x-portable-pixmap"},
+    {"pgm", "image/x-portable-graymap"},
+    {"pbm", "image/x-portable-bitmap"},
+    {"pnm", "image/x-portable-anymap"},
+    {"xbm", "image/x-xbitmap"},
+    {"xpm", "image/x-xpixmap"},
+    {"rgb", "image/x-rgb"},
+    {"pcx", "image/x-pcx"},
+    {"ras", "image/x-cmu-raster"},
+    {"psd", "image/vnd.adobe.photoshop"},
+    {"xcf", "image/x-xcf"},
+    {"tga", "image/x-tga"},
+    {"djvu", "image/vnd.djvu"},
+    {"djv", "image/vnd.djvu"},
+    {"jng", "image/x-jng"},
+    {"mp3", "audio/mpeg"},
+    {"mpga", "audio/mpeg"},
+    {"mp2", "audio/mpeg"},
+    {"m4a", "audio/mp4"},
+    {"aac", "audio/aac"},
+    {"ogg", "audio/ogg"},
+    {"oga", "audio/ogg"},
+    {"opus", "audio/ogg"},
+    {"spx", "audio/ogg"},
+    {"wav", "audio/wav"},
+    {"weba", "audio/webm"},
+    {"flac", "audio/flac"},
+    {"mid", "audio/midi"},
+    {"midi", "audio/midi"},
+    {"kar", "audio/midi"},
+    {"aif", "audio/x-aiff"},
+    {"aiff", "audio/x-aiff"},
+    {"aifc", "audio/x-aiff"},
+    {"mka", "audio/x-matroska"},
+    {"m3u", "audio/x-mpegurl"},
+    {"wma", "audio/x-ms-wma"},
+    {"ra", "audio/x-realaudio"},
+    {"au", "audio/basic"},
+    {"snd", "audio/basic"},
+    {"amr", "audio/amr"},
+    {"mp4", "video/mp4"},
+    {"m4v", "video/mp4"},
+    {"mpg4", "video/mp4"},
+    {"mpeg", "video/mpeg"},
+    {"mpg", "video/mpeg"},
+    {"mpe", "video/mpeg"},
+    {"webm", "video/webm"},
+    {"ogv", "video/ogg"},
+    {"mov", "video/quicktime"},
+    {"qt", "video/quicktime"},
+    {"avi", "video/x-msvideo"},
+    {"mkv", "video/x-matroska"},
+    {"flv", "video/x-flv"},
+    {"wmv", "video/x-ms-wmv"},
+    {"asf", "video/x-ms-asf"},
+    {"asx", "video/x-ms-asf"},
+    {"3gp", "video/3gpp"},
+    {"3g2", "video/3gpp2"},
+    {"ts", "video/mp2t"},
+    {"m2ts", "video/mp2t"},
+    {"mng", "video/x-mng"},
+    {"movie", "video/x-sgi-movie"},
+    {"gltf", "model/gltf+json"},
+    {"glb", "model/gltf-binary"},
+    {"obj", "model/obj"},
+    {"stl", "model/stl"},
+    {"eml", "message/rfc822"},
+    {"mht", "message/rfc822"},
+    {"mhtml", "message/rfc822"},
+};
+
+/* Open-addressing hash table from lowercase extension to type, built once and
+ * only read afterwards. */
+#define MIME_TABLE_SIZE 4096
+#define MIME_EXTENSION_MAX 16
+
+struct mime_slot {
+  char* extension;
+  char* type;
+};
+
+static struct mime_slot mime_table[MIME_TABLE_SIZE];
+static int mime_count;
+static pthread_once_t mime_once = PTHREAD_ONCE_INIT;
+
+static uint32_t mime_hash(char* extension) {
+  uint32_t hash = 2166136261u;
+  for (unsigned char* p = (unsigned char*)extension; *p; p++) {
+    hash ^= *p;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+/* Returns the slot holding EXTENSION, or the empty slot where it belongs. */
+static struct mime_slot* mime_slot(char* extension) {
+  uint32_t index = mime_hash(extension) % MIME_TABLE_SIZE;
+  while (mime_table[index].extension &&
+         strcmp(mime_table[index].extension, extension) != 0)
+    index = (index + 1) % MIME_TABLE_SIZE;
+  return &mime_table[index];
+}
+
+/* Maps EXTENSION (lowercase, and kept by the caller) to TYPE, replacing an
+ * earlier mapping. Returns -1 if the table is too full to take it. */
+static int mime_insert(char* extension, char* type) {
+  struct mime_slot* slot = mime_slot(extension);
+  if (slot->extension == NULL) {
+    /* Stay at most three quarters full, so probes stay short. */
+    if (mime_count >= MIME_TABLE_SIZE * 3 / 4) return -1;
+    slot->extension = extension;
+    mime_count++;
+  }
+  slot->type = type;
+  return 0;
+}
+
+static void mime_init(void) {
+  for (size_t i = 0;
+       i < sizeof(default_mime_types) / sizeof(default_mime_types[0]); i++)
+    mime_insert(default_mime_types[i].extension, default_mime_types[i].type);
+}
+
+int http_load_mime_types(char* path) {
+  pthread_once(&mime_once, mime_init);
+  FILE* file = fopen(path, "r");
+  if (file == NULL) return -1;
+
+  /* Each line is a type followed by its extensions; # starts a comment. */
+  char line[1024];
+  while (fgets(line, sizeof(line), file)) {
+    line[strcspn(line, "#")] = '\0';
+    char* saveptr;
+    char* type = strtok_r(line, " \t\r\n", &saveptr);
+    if (type == NULL) continue;
+    type = strdup(type);
+
+    for (char* extension = strtok_r(NULL, " \t\r\n", &saveptr); extension;
+         extension = strtok_r(NULL, " \t\r\n", &saveptr)) {
+      if (strlen(extension) >= MIME_EXTENSION_MAX) continue;
+      for (char* p = extension; *p; p++) *p = tolower((unsigned char)*p);
+      struct mime_slot* slot = mime_slot(extension);
+      if (mime_insert(slot->extension ? slot->extension : strdup(extension),
+                      type) == -1) {
+        fprintf(stderr, "Too many MIME types in %s\n", path);
+        fclose(file);
+        return 0;
+      }
+    }
+  }
+  fclose(file);
+  return 0;
+}
+
 char* http_get_mime_type(char* file_name) {
+  pthread_once(&mime_once, mime_init);
+
+  /* Only a dot in the last path component starts an extension. */
   char* file_extension = strrchr(file_name, '.');
-  if (file_extension == NULL) {
+  if (file_extension == NULL || strchr(file_extension, '/') != NULL) {
     return "text/plain";
   }
 
-  if (strcmp(file_extension, ".html") == 0 ||
-      strcmp(file_extension, ".htm") == 0) {
-    return "text/html";
-  } else if (strcmp(file_extension, ".jpg") == 0 ||
-             strcmp(file_extension, ".jpeg") == 0) {
-    return "image/jpeg";
-  } else if (strcmp(file_extension, ".png") == 0) {
-    return "image/png";
-  } else if (strcmp(file_extension, ".css") == 0) {
-    return "text/css";
-  } else if (strcmp(file_extension, ".js") == 0) {
-    return "application/javascript";
-  } else if (strcmp(file_extension, ".pdf") == 0) {
-    return "application/pdf";
-  } else {
-    return "text/plain";
-  }
+  char extension[MIME_EXTENSION_MAX];
+  size_t length = strlen(++file_extension);
+  if (length == 0 || length >= sizeof(extension)) return "text/plain";
+  for (size_t i = 0; i <= length; i++)
+    extension[i] = tolower((unsigned char)file_extension[i]);
+
+  struct mime_slot* slot = mime_slot(extension);
+  return slot->extension ? slot->type : "text/plain";
 }
 
 /*
@@ -15,33 +15,240 @@
  *     http_send_string(fd, "<html><body><a href='/'>Home</a></body></html>");
  *
  *     close(fd);
+ *
+ * Persistent connections read one request after another instead:
+ *
+ *     struct http_reader reader;
+ *     struct http_request request;
+ *     http_reader_init(&reader, fd);
+ *     while (http_read_request(&reader, &request) == 1) {
+ *       ...
+ *     }
  */
 
 #ifndef LIBHTTP_H
 #define LIBHTTP_H
 
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
+
+/* Largest request (request line plus headers) the parser accepts. */
+#define LIBHTTP_REQUEST_MAX_SIZE 8192
+
+/* Most headers kept per request; further headers are parsed but not kept. */
+#define LIBHTTP_MAX_HEADERS 32
+
 /*
  * Functions for parsing an HTTP request.
+ *
+ * The parser does not copy anything: method, path and header keys and values
+ * are NUL-terminated in place and point into the buffer of the http_reader
+ * that parsed them. They stay valid until the next call on that reader.
  */
+struct http_header {
+  char* key;
+  char* value;
+};
+
 struct http_request {
   char* method;
   char* path;
+  int minor_version;   /* 1 for HTTP/1.1, 0 for HTTP/1.0 and older. */
+  int keep_alive;      /* The client allows the connection to be reused. */
+  long content_length; /* Length of the request body, if any. */
+  struct http_header headers[LIBHTTP_MAX_HEADERS];
+  int num_headers;
 };
 
+/* Reads a request with a single read() into a new buffer. Returns NULL if an
+ * error was encountered; otherwise release it with http_request_free(). */
 struct http_request* http_request_parse(int fd);
+void http_request_free(struct http_request* request);
+
+/* Returns the value of header KEY (case-insensitive), or NULL. */
+char* http_request_header(struct http_request* request, char* key);
+
+/* Returns whether REQUEST's Accept-Encoding header admits CODING (such as
+ * "gzip"), either by name or through "*", with a nonzero q-value. */
+int http_accepts_encoding(struct http_request* request, char* coding);
+
+/*
+ * Buffered, resumable reader for persistent connections. Bytes that arrive
+ * after the end of one request stay in the buffer and are parsed by the next
+ * call, which is what makes pipelining work. A request may arrive in any
+ * number of pieces: lines that were already parsed are not scanned again, and
+ * the buffer is compacted when the next request is moved to its front.
+ */
+struct http_reader {
+  int fd;
+  char buffer[LIBHTTP_REQUEST_MAX_SIZE];
+  size_t start; /* The request being parsed begins at buffer[start]. */
+  size_t scan;  /* buffer[start, scan) holds its complete, parsed lines. */
+  size_t end;   /* Received bytes are buffer[start, end). */
+  size_t skip;  /* Request body bytes still to be discarded. */
+
+  /* Parse state of the current request. Offsets are relative to start. */
+  int lines;
+  unsigned short path_offset;
+  unsigned short header_offsets[LIBHTTP_MAX_HEADERS][2];
+  int num_headers;
+  int minor_version;
+  int keep_alive;
+  long content_length;
+};
+
+void http_reader_init(struct http_reader* reader, int fd);
+int http_reader_has_request(struct http_reader* reader);
+
+/* Appends LENGTH bytes of DATA received by other means to READER's buffer.
+ * Returns -1 if they do not fit. */
+int http_reader_feed(struct http_reader* reader, const char* data,
+                     size_t length);
+
+/* Parses the buffered bytes without reading from the socket. Returns 1 if
+ * REQUEST was filled in, 0 if more bytes are needed and -1 if the request is
+ * malformed or too large. */
+int http_parse_request(struct http_reader* reader,
+                       struct http_request* request);
+int http_read_request(struct http_reader* reader,
+                      struct http_request* request);
+
+/* Reads once from READER's socket into its buffer, for callers that drive
+ * http_parse_request() themselves. Returns 1 if bytes arrived, otherwise what
+ * http_read_request() would return. */
+int http_reader_fill(struct http_reader* reader);
 
 /*
  * Functions for sending an HTTP response.
  */
+/* Room for the status line and headers of a response under construction. */
+#define LIBHTTP_RESPONSE_HEADERS_SIZE 1024
+
+/*
+ * Response builder. The status line and headers are collected in a buffer,
+ * usually on the caller's stack, and go out in a single writev() together with
+ * the first chunk of the body:
+ *
+ *     struct http_response response;
+ *     http_response_start(&response, 200);
+ *     http_response_header(&response, "Content-Type", "text/html");
+ *     http_response_header_long(&response, "Content-Length", length);
+ *     http_response_send(&response, fd, body, length, 0);
+ */
+struct http_response {
+  char buffer[LIBHTTP_RESPONSE_HEADERS_SIZE];
+  size_t length;
+  int overflow; /* A header did not fit; the response will not be sent. */
+};
+
+void http_response_start(struct http_response* response, int status_code);
+void http_response_header(struct http_response* response, char* key,
+                          char* value);
+void http_response_header_long(struct http_response* response, char* key,
+                               long value);
+void http_response_connection(struct http_response* response, int keep_alive);
+
+/* Ends the headers, for callers that send RESPONSE's buffer themselves.
+ * Returns -1 if some header did not fit. */
+int http_response_end(struct http_response* response);
+
+/* Ends the headers and sends them followed by BODY_LENGTH bytes of BODY.
+ * FLAGS are passed to sendmsg(), e.g. MSG_MORE when more of the body follows.
+ * Returns the number of bytes written, or -1 on error. */
+ssize_t http_response_send(struct http_response* response, int fd,
+                           const void* body, size_t body_length, int flags);
+
+/*
+ * Conditional and partial responses for files. A file version is identified
+ * by its ETag, made from its size and mtime (and the encoding it is sent in),
+ * and by its mtime, sent as Last-Modified.
+ */
+#define LIBHTTP_ETAG_SIZE 64
+#define LIBHTTP_DATE_SIZE 32
+
+void http_format_etag(char* buffer, off_t size, struct timespec* mtime,
+                      char* encoding);
+void http_format_date(char* buffer, time_t date);
+
+/* Parses an IMF-fixdate, the only date format servers may send. Returns -1 if
+ * DATE is not one. */
+time_t http_parse_date(char* date);
+
+/*
+ * Decides how to answer REQUEST (which may be NULL) for a body of SIZE bytes
+ * identified by ETAG and MTIME: 304 if the client's copy is current
+ * (If-None-Match, If-Modified-Since), 206 for a satisfiable single Range
+ * (subject to If-Range), 416 for an unsatisfiable one, otherwise 200. Sets
+ * [*START, *START + *LENGTH) to the bytes of the body to send.
+ */
+int http_file_status(struct http_request* request, char* etag, time_t mtime,
+                     off_t size, off_t* start, off_t* length);
+
+/* Adds the headers of a file response with a status from http_file_status():
+ * Content-Type, Content-Length and Content-Range as the status needs, the
+ * Content-Encoding if not NULL, ETag and Last-Modified. */
+void http_response_file_headers(struct http_response* response,
+                                int status_code, char* content_type,
+                                char* encoding, char* etag, time_t mtime,
+                                off_t size, off_t start, off_t length);
+
+/*
+ * Chunked transfer coding, for HTTP/1.1 bodies whose length is not known when
+ * the headers go out, so the connection can still be kept alive. Body bytes
+ * are gathered in the writer's buffer, and every full buffer goes out as one
+ * chunk:
+ *
+ *     http_response_header(&response, "Transfer-Encoding", "chunked");
+ *     http_response_send(&response, fd, NULL, 0, MSG_MORE);
+ *     struct http_chunked chunked;
+ *     http_chunked_init(&chunked, fd);
+ *     http_chunked_write(&chunked, data, length);  (as often as needed)
+ *     http_chunked_finish(&chunked);
+ */
+#define LIBHTTP_CHUNK_SIZE 16384
+
+struct http_chunked {
+  int fd;
+  char buffer[LIBHTTP_CHUNK_SIZE];
+  size_t length;
+  ssize_t sent; /* Bytes written so far, or -1 once a write failed. */
+};
+
+void http_chunked_init(struct http_chunked* chunked, int fd);
+
+/* Adds LENGTH bytes of DATA to the body. Returns -1 if sending failed. */
+int http_chunked_write(struct http_chunked* chunked, const void* data,
+                       size_t length);
+
+/* Sends what is buffered and the last, empty chunk. Returns the number of
+ * bytes written for the body in all, or -1 on error. */
+ssize_t http_chunked_finish(struct http_chunked* chunked);
+
+/* Writes all IOVCNT buffers of IOV to FD, resuming after short writes. IOV is
+ * modified. Returns the number of bytes written, or -1 on error. */
+ssize_t http_sendv(int fd, struct iovec* iov, int iovcnt, int flags);
+
+char* http_get_response_message(int status_code);
 void http_start_response(int fd, int status_code);
 void http_send_header(int fd, char* key, char* value);
+void http_send_connection(int fd, int keep_alive);
 void http_end_headers(int fd);
+void http_set_cork(int fd, int enable);
+ssize_t http_send_file(int fd, int filedes, off_t offset, size_t count);
 void http_format_href(char* buffer, char* path, char* filename);
 void http_format_index(char* buffer, char* path);
 
 /*
- * Helper function: gets the Content-Type based on a file name.
+ * Helper function: gets the Content-Type based on a file name. The lookup is
+ * a single hash probe on the lowercased extension; unknown extensions are
+ * served as text/plain. The returned string lives as long as the program.
  */
 char* http_get_mime_type(char* file_name);
 
+/* Adds the mappings of a mime.types file (such as /etc/mime.types) to the
+ * built-in ones, overriding them. Call before serving. Returns -1 if the file
+ * cannot be read. */
+int http_load_mime_types(char* path);
+
 #endif
@@ -0,0 +1,593 @@
+/*
+ * HTTP load generator for benchmarking the server variants (see bench.sh).
+ *
+ * Each thread drives its share of the connections from its own epoll loop.
+ * In closed-loop mode (the default) every connection keeps --pipeline
+ * requests in flight and sends the next one as soon as a response completes.
+ * In open-loop mode (--rate) requests are sent on a fixed schedule whether or
+ * not the server keeps up, and latency is measured from the scheduled send
+ * time, so a stalled server shows up in the tail instead of being hidden by a
+ * client that politely waited.
+ *
+ * Latencies go into log-linear histograms in the style of HdrHistogram: 32
+ * buckets per power of two, i.e. about 3% relative precision at any
+ * magnitude. Results are printed as text or as a single JSON object.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define READ_BUFFER_SIZE 65536
+#define MAX_IN_FLIGHT 4096 /* Per connection; must be a power of two. */
+
+/* Histogram layout: values below 2^SUB_BITS+1 get a bucket each, every later
+ * power of two is split into 2^SUB_BITS buckets. */
+#define SUB_BITS 5
+#define SUB_BUCKETS (1 << SUB_BITS)
+#define LINEAR_BUCKETS (2 * SUB_BUCKETS)
+#define HISTOGRAM_BUCKETS (LINEAR_BUCKETS + 58 * SUB_BUCKETS)
+
+struct histogram {
+  uint64_t counts[HISTOGRAM_BUCKETS];
+  uint64_t total, sum, min, max;
+};
+
+struct options {
+  char* host;
+  int port;
+  char* path;
+  int connections;
+  int threads;
+  double duration;
+  int pipeline;
+  double rate; /* Requests per second over all connections; 0 = closed loop */
+  bool keep_alive;
+  bool json;
+  char* label;
+};
+
+struct client {
+  int fd;
+  bool connecting;
+  char* request;
+  size_t request_length, request_sent; /* Bytes of queued requests. */
+  size_t request_capacity;
+
+  /* Send, or for open loop scheduled, times of requests in flight. */
+  uint64_t started[MAX_IN_FLIGHT];
+  unsigned head, tail;
+  uint64_t next_send; /* Open loop only. */
+
+  /* Response parsing. */
+  char buffer[READ_BUFFER_SIZE];
+  size_t buffered;
+  bool in_body;
+  int status;          /* Of the response being received. */
+  long body_remaining; /* -1: the body ends when the server closes. */
+  bool chunked;        /* Counting down chunks; 0 left: at a size line. */
+  bool close_after;    /* The server said Connection: close. */
+};
+
+struct worker {
+  pthread_t thread;
+  int index;
+  int epoll_fd;
+  int num_clients;
+  struct client* clients;
+  struct histogram histogram;
+  uint64_t errors, bytes_read, connects;
+  uint64_t unanswered; /* Requests still in flight at the deadline. */
+};
+
+static struct options options;
+static struct sockaddr_in server_address;
+static char* request_text; /* One complete request. */
+static size_t request_text_length;
+static uint64_t deadline;
+
+static uint64_t now_us(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static int histogram_index(uint64_t value) {
+  if (value < LINEAR_BUCKETS) return value;
+  int exponent = 63 - __builtin_clzll(value); /* At least SUB_BITS + 1. */
+  int shift = exponent - SUB_BITS;
+  return LINEAR_BUCKETS + (exponent - SUB_BITS - 1) * SUB_BUCKETS +
+         (int)((value >> shift) - SUB_BUCKETS);
+}
+
+/* Largest value that lands in bucket INDEX. */
+static uint64_t histogram_bucket_max(int index) {
+  if (index < LINEAR_BUCKETS) return index;
+  int exponent = (index - LINEAR_BUCKETS) / SUB_BUCKETS + SUB_BITS + 1;
+  int shift = exponent - SUB_BITS;
+  uint64_t sub = (index - LINEAR_BUCKETS) % SUB_BUCKETS + SUB_BUCKETS;
+  return ((sub + 1) << shift) - 1;
+}
+
+static void histogram_record(struct histogram* histogram, uint64_t value) {
+  int index = histogram_index(value);
+  if (index >= HISTOGRAM_BUCKETS) index = HISTOGRAM_BUCKETS - 1;
+  histogram->counts[index]++;
+  if (histogram->total == 0 || value < histogram->min) histogram->min = value;
+  if (value > histogram->max) histogram->max = value;
+  histogram->total++;
+  histogram->sum += value;
+}
+
+static void histogram_merge(struct histogram* into, struct histogram* from) {
+  if (from->total == 0) return;
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    into->counts[i] += from->counts[i];
+  if (into->total == 0 || from->min < into->min) into->min = from->min;
+  if (from->max > into->max) into->max = from->max;
+  into->total += from->total;
+  into->sum += from->sum;
+}
+
+static uint64_t histogram_percentile(struct histogram* histogram,
+                                     double percentile) {
+  if (histogram->total == 0) return 0;
+  uint64_t rank = (uint64_t)(percentile / 100.0 * histogram->total + 0.5);
+  if (rank < 1) rank = 1;
+  uint64_t seen = 0;
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    seen += histogram->counts[i];
+    if (seen >= rank) {
+      uint64_t value = histogram_bucket_max(i);
+      return value < histogram->max ? value : histogram->max;
+    }
+  }
+  return histogram->max;
+}
+
+static void fatal(char* message) {
+  perror(message);
+  exit(1);
+}
+
+/* Queues one request on C, to be written as soon as the socket allows. */
+static void client_queue_request(struct client* c, uint64_t started) {
+  if (c->request_length + request_text_length > c->request_capacity) {
+    /* Drop what was already sent before growing. */
+    memmove(c->request, c->request + c->request_sent,
+            c->request_length - c->request_sent);
+    c->request_length -= c->request_sent;
+    c->request_sent = 0;
+    while (c->request_length + request_text_length > c->request_capacity) {
+      c->request_capacity = c->request_capacity ? 2 * c->request_capacity
+                                                : 4 * request_text_length;
+      c->request = realloc(c->request, c->request_capacity);
+      if (!c->request) fatal("realloc");
+    }
+  }
+  memcpy(c->request + c->request_length, request_text, request_text_length);
+  c->request_length += request_text_length;
+  c->started[c->tail++ % MAX_IN_FLIGHT] = started;
+}
+
+static int client_in_flight(struct client* c) { return c->tail - c->head; }
+
+static void client_flush(struct worker* w, struct client* c) {
+  while (c->request_sent < c->request_length) {
+    ssize_t n = send(c->fd, c->request + c->request_sent,
+                     c->request_length - c->request_sent, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK) w->errors++;
+      return;
+    }
+    c->request_sent += n;
+  }
+  c->request_sent = c->request_length = 0;
+}
+
+static void client_connect(struct worker* w, struct client* c) {
+  c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (c->fd == -1) fatal("socket");
+  int one = 1;
+  setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  c->connecting = true;
+  c->buffered = 0;
+  c->in_body = false;
+  c->close_after = false;
+  w->connects++;
+  if (connect(c->fd, (struct sockaddr*)&server_address,
+              sizeof(server_address)) == -1 &&
+      errno != EINPROGRESS)
+    fatal("connect");
+
+  struct epoll_event event = {.events = EPOLLIN | EPOLLOUT | EPOLLET,
+                              .data.ptr = c};
+  if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, c->fd, &event) == -1)
+    fatal("epoll_ctl");
+}
+
+/* Starts over on a fresh connection. Requests still in flight on the old
+ * one will never be answered and count as errors. */
+static void client_reconnect(struct worker* w, struct client* c) {
+  close(c->fd);
+  w->errors += client_in_flight(c);
+  c->head = c->tail = 0;
+  c->request_length = c->request_sent = 0;
+  client_connect(w, c);
+
+  if (options.rate == 0) {
+    uint64_t now = now_us();
+    int depth = options.keep_alive ? options.pipeline : 1;
+    for (int i = 0; i < depth; i++) client_queue_request(c, now);
+  }
+}
+
+/* Records the response at the head of C's queue as complete. */
+static void client_complete(struct worker* w, struct client* c, int status) {
+  uint64_t now = now_us();
+  if (c->head == c->tail) return;
+  uint64_t started = c->started[c->head++ % MAX_IN_FLIGHT];
+  if (now <= deadline) {
+    histogram_record(&w->histogram, now - started);
+    if (status < 200 || status >= 400) w->errors++;
+  }
+
+  if (!options.keep_alive || c->close_after) {
+    client_reconnect(w, c);
+    return;
+  }
+  if (options.rate == 0) client_queue_request(c, now);
+}
+
+/* Parses as many responses out of C's buffer as are complete. Returns false
+ * once C was reconnected. */
+static bool client_parse(struct worker* w, struct client* c) {
+  while (1) {
+    if (c->in_body) {
+      if (c->chunked && c->body_remaining == 0) {
+        char* eol = memmem(c->buffer, c->buffered, "\r\n", 2);
+        if (eol == NULL) {
+          if (c->buffered == READ_BUFFER_SIZE) c->buffered = 0; /* Garbage. */
+          return true;
+        }
+        long size = strtol(c->buffer, NULL, 16);
+        size_t line_length = eol + 2 - c->buffer;
+        memmove(c->buffer, c->buffer + line_length, c->buffered - line_length);
+        c->buffered -= line_length;
+        /* Each chunk is followed by CRLF; so is the last, empty one, as no
+         * server variant sends trailers. */
+        c->body_remaining = size + 2;
+        if (size == 0) c->chunked = false;
+        continue;
+      }
+      if (c->body_remaining < 0) {
+        c->buffered = 0; /* Ends at EOF. */
+        return true;
+      }
+      size_t take = c->buffered < (size_t)c->body_remaining
+                        ? c->buffered
+                        : (size_t)c->body_remaining;
+      c->body_remaining -= take;
+      memmove(c->buffer, c->buffer + take, c->buffered - take);
+      c->buffered -= take;
+      if (c->body_remaining > 0) return true;
+      if (c->chunked) continue;
+      c->in_body = false;
+      bool reconnect = !options.keep_alive || c->close_after;
+      client_complete(w, c, c->status);
+      if (reconnect) return false;
+      continue;
+    }
+
+    char* end = memmem(c->buffer, c->buffered, "\r\n\r\n", 4);
+    if (end == NULL) {
+      if (c->buffered == READ_BUFFER_SIZE) c->buffered = 0; /* Garbage. */
+      return true;
+    }
+    *end = '\0';
+    c->status = 0;
+    sscanf(c->buffer, "HTTP/1.%*d %d", &c->status);
+    c->body_remaining = -1;
+    c->close_after = false;
+    c->chunked = false;
+    for (char* line = strstr(c->buffer, "\r\n"); line;
+         line = strstr(line + 2, "\r\n")) {
+      if (strncasecmp(line + 2, "Content-Length:", 15) == 0)
+        c->body_remaining = strtol(line + 17, NULL, 10);
+      else if (strncasecmp(line + 2, "Transfer-Encoding:", 18) == 0 &&
+               strcasestr(line + 20, "chunked") != NULL)
+        c->chunked = true;
+      else if (strncasecmp(line + 2, "Connection:", 11) == 0 &&
+               strcasestr(line + 13, "close") != NULL)
+        c->close_after = true;
+    }
+    size_t header_length = end + 4 - c->buffer;
+    memmove(c->buffer, c->buffer + header_length, c->buffered - header_length);
+    c->buffered -= header_length;
+    c->in_body = true;
+    if (c->chunked)
+      c->body_remaining = 0;
+    else if (c->body_remaining < 0)
+      c->close_after = true;
+  }
+}
+
+static void client_read(struct worker* w, struct client* c) {
+  while (1) {
+    ssize_t n = read(c->fd, c->buffer + c->buffered,
+                     READ_BUFFER_SIZE - c->buffered);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+      w->errors++;
+      client_reconnect(w, c);
+      return;
+    }
+    if (n == 0) {
+      /* A body without Content-Length ends here. */
+      if (c->in_body && c->body_remaining < 0) {
+        c->in_body = false;
+        client_complete(w, c, c->status); /* Reconnects. */
+      } else {
+        client_reconnect(w, c);
+      }
+      return;
+    }
+    w->bytes_read += n;
+    c->buffered += n;
+    if (!client_parse(w, c)) return;
+  }
+}
+
+/* Queues the open-loop requests that are due on C. */
+static void client_schedule(struct client* c, uint64_t now,
+                            uint64_t interval) {
+  while (c->next_send <= now && client_in_flight(c) < MAX_IN_FLIGHT) {
+    client_queue_request(c, c->next_send);
+    c->next_send += interval;
+  }
+}
+
+static void* worker_run(void* arg) {
+  struct worker* w = arg;
+  w->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (w->epoll_fd == -1) fatal("epoll_create1");
+
+  /* Spread open-loop start times so connections do not send in lockstep. */
+  uint64_t interval =
+      options.rate > 0 ? (uint64_t)(options.connections * 1e6 / options.rate)
+                       : 0;
+  uint64_t start = now_us();
+  for (int i = 0; i < w->num_clients; i++) {
+    struct client* c = &w->clients[i];
+    c->next_send = start + interval * (w->index + i * options.threads) /
+                               options.connections;
+    c->head = c->tail = 0;
+    client_connect(w, c);
+    if (options.rate == 0) {
+      int depth = options.keep_alive ? options.pipeline : 1;
+      for (int j = 0; j < depth; j++) client_queue_request(c, start);
+    }
+  }
+
+  struct epoll_event events[256];
+  while (1) {
+    uint64_t now = now_us();
+    if (now >= deadline) break;
+
+    int timeout = (deadline - now) / 1000 + 1;
+    if (options.rate > 0) {
+      uint64_t next = deadline;
+      for (int i = 0; i < w->num_clients; i++) {
+        struct client* c = &w->clients[i];
+        client_schedule(c, now, interval);
+        if (!c->connecting) client_flush(w, c);
+        if (c->next_send < next) next = c->next_send;
+      }
+      timeout = next > now ? (next - now) / 1000 : 0;
+    }
+
+    int n = epoll_wait(w->epoll_fd, events, 256, timeout);
+    if (n < 0 && errno != EINTR) fatal("epoll_wait");
+    for (int i = 0; i < n; i++) {
+      struct client* c = events[i].data.ptr;
+      if (c->connecting && (events[i].events & (EPOLLOUT | EPOLLERR))) {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &error, &length);
+        if (error != 0) {
+          fprintf(stderr, "connect: %s\n", strerror(error));
+          exit(1);
+        }
+        c->connecting = false;
+      }
+      if (c->connecting) continue;
+      if (events[i].events & EPOLLIN) client_read(w, c);
+      if (!c->connecting) client_flush(w, c);
+    }
+  }
+
+  for (int i = 0; i < w->num_clients; i++) {
+    w->unanswered += client_in_flight(&w->clients[i]);
+    close(w->clients[i].fd);
+  }
+  return NULL;
+}
+
+static void print_results(struct histogram* histogram, struct worker* workers,
+                          double elapsed) {
+  uint64_t errors = 0, bytes_read = 0, connects = 0, unanswered = 0;
+  for (int i = 0; i < options.threads; i++) {
+    errors += workers[i].errors;
+    unanswered += workers[i].unanswered;
+    bytes_read += workers[i].bytes_read;
+    connects += workers[i].connects;
+  }
+  double rps = histogram->total / elapsed;
+  double mean =
+      histogram->total ? (double)histogram->sum / histogram->total : 0;
+  double percentiles[] = {50, 90, 99, 99.9, 99.99};
+  char* names[] = {"p50", "p90", "p99", "p99.9", "p99.99"};
+
+  if (options.json) {
+    printf("{\"label\":\"%s\",\"path\":\"%s\",\"mode\":\"%s\","
+           "\"connections\":%d,\"threads\":%d,\"pipeline\":%d,"
+           "\"keep_alive\":%s,\"rate\":%.0f,\"duration_s\":%.3f,"
+           "\"requests\":%lu,\"errors\":%lu,\"unanswered\":%lu,"
+           "\"connects\":%lu,"
+           "\"bytes\":%lu,\"rps\":%.1f,\"latency_us\":{\"min\":%lu,"
+           "\"mean\":%.1f",
+           options.label ? options.label : "", options.path,
+           options.rate > 0 ? "open" : "closed", options.connections,
+           options.threads, options.pipeline,
+           options.keep_alive ? "true" : "false", options.rate, elapsed,
+           histogram->total, errors, unanswered, connects, bytes_read, rps,
+           histogram->min, mean);
+    for (int i = 0; i < 5; i++)
+      printf(",\"%s\":%lu", names[i],
+             histogram_percentile(histogram, percentiles[i]));
+    printf(",\"max\":%lu}}\n", histogram->max);
+    return;
+  }
+
+  printf("%s%s%s %s-loop, %d connections, %d threads, pipeline %d, %s\n",
+         options.label ? options.label : "", options.label ? ": " : "",
+         options.path, options.rate > 0 ? "open" : "closed",
+         options.connections, options.threads, options.pipeline,
+         options.keep_alive ? "keep-alive" : "new connection per request");
+  printf("  %lu requests in %.2fs, %lu errors, %lu unanswered, %lu connects, "
+         "%.1f MB read\n",
+         histogram->total, elapsed, errors, unanswered, connects,
+         bytes_read / 1e6);
+  printf("  Requests/sec: %.1f\n", rps);
+  printf("  Latency (us): min %lu  mean %.1f", histogram->min, mean);
+  for (int i = 0; i < 5; i++)
+    printf("  %s %lu", names[i],
+           histogram_percentile(histogram, percentiles[i]));
+  printf("  max %lu\n", histogram->max);
+}
+
+static char* USAGE =
+    "Usage: ./loadgen [--host localhost] [--port 8000] [--path /]\n"
+    "                 [--connections 16] [--threads 2] [--duration 5]\n"
+    "                 [--pipeline 1] [--rate 0] [--no-keep-alive]\n"
+    "                 [--json] [--label NAME]\n";
+
+static void exit_with_usage(void) {
+  fprintf(stderr, "%s", USAGE);
+  exit(1);
+}
+
+static char* next_arg(int argc, char** argv, int* i) {
+  if (*i + 1 >= argc) exit_with_usage();
+  return argv[++*i];
+}
+
+int main(int argc, char** argv) {
+  options = (struct options){
+      .host = "localhost",
+      .port = 8000,
+      .path = "/",
+      .connections = 16,
+      .threads = 2,
+      .duration = 5,
+      .pipeline = 1,
+      .keep_alive = true,
+  };
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--host") == 0)
+      options.host = next_arg(argc, argv, &i);
+    else if (strcmp(argv[i], "--port") == 0)
+      options.port = atoi(next_arg(argc, argv, &i));
+    else if (strcmp(argv[i], "--path") == 0)
+      options.path = next_arg(argc, argv, &i);
+    else if (strcmp(argv[i], "--connections") == 0)
+      options.connections = atoi(next_arg(argc, argv, &i));
+    else if (strcmp(argv[i], "--threads") == 0)
+      options.threads = atoi(next_arg(argc, argv, &i));
+    else if (strcmp(argv[i], "--duration") == 0)
+      options.duration = atof(next_arg(argc, argv, &i));
+    else if (strcmp(argv[i], "--pipeline") == 0)
+      options.pipeline = atoi(next_arg(argc, argv, &i));
+    else if (strcmp(argv[i], "--rate") == 0)
+      options.rate = atof(next_arg(argc, argv, &i));
+    else if (strcmp(argv[i], "--no-keep-alive") == 0)
+      options.keep_alive = false;
+    else if (strcmp(argv[i], "--json") == 0)
+      options.json = true;
+    else if (strcmp(argv[i], "--label") == 0)
+      options.label = next_arg(argc, argv, &i);
+    else
+      exit_with_usage();
+  }
+  if (options.connections < 1 || options.threads < 1 || options.pipeline < 1 ||
+      options.pipeline > MAX_IN_FLIGHT || options.duration <= 0 ||
+      options.rate < 0)
+    exit_with_usage();
+  if (options.rate > 0 && !options.keep_alive) {
+    fprintf(stderr, "--rate needs keep-alive connections\n");
+    exit_with_usage();
+  }
+  if (options.threads > options.connections)
+    options.threads = options.connections;
+
+  struct hostent* host = gethostbyname2(options.host, AF_INET);
+  if (host == NULL) {
+    fprintf(stderr, "Cannot find host: %s\n", options.host);
+    exit(1);
+  }
+  memset(&server_address, 0, sizeof(server_address));
+  server_address.sin_family = AF_INET;
+  server_address.sin_port = htons(options.port);
+  memcpy(&server_address.sin_addr, host->h_addr_list[0],
+         sizeof(server_address.sin_addr));
+
+  request_text_length =
+      asprintf(&request_text, "GET %s HTTP/1.1\r\nHost: %s\r\n%s\r\n",
+               options.path, options.host,
+               options.keep_alive ? "" : "Connection: close\r\n");
+
+  signal(SIGPIPE, SIG_IGN);
+  struct worker* workers = calloc(options.threads, sizeof(struct worker));
+  struct client* clients = calloc(options.connections, sizeof(struct client));
+  if (!workers || !clients) fatal("calloc");
+
+  uint64_t start = now_us();
+  deadline = start + (uint64_t)(options.duration * 1e6);
+  for (int i = 0, first = 0; i < options.threads; i++) {
+    struct worker* w = &workers[i];
+    w->index = i;
+    w->num_clients = options.connections / options.threads +
+                     (i < options.connections % options.threads);
+    w->clients = &clients[first];
+    first += w->num_clients;
+    pthread_create(&w->thread, NULL, worker_run, w);
+  }
+
+  struct histogram histogram;
+  memset(&histogram, 0, sizeof(histogram));
+  for (int i = 0; i < options.threads; i++) {
+    pthread_join(workers[i].thread, NULL);
+    histogram_merge(&histogram, &workers[i].histogram);
+  }
+
+  print_results(&histogram, workers, (now_us() - start) / 1e6);
+  return 0;
+}
@@ -0,0 +1,219 @@
+#include "opencache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "stats.h"
+#include "utlist.h"
+
+#define OPEN_CACHE_SHARDS 16
+#define OPEN_CACHE_BUCKETS 256
+
+struct open_cache_entry {
+  char* path;
+  uint32_t hash;
+  uint64_t created; /* stats_now() when the path was looked up. */
+
+  int error; /* errno of stat(), 0 if it succeeded. */
+  struct stat stat;
+  int fd;         /* Open for reading if a regular file, else -1. */
+  int open_error; /* errno of open() if that failed on a regular file. */
+
+  int refcount; /* One for the cache while linked, one per user. */
+  struct open_cache_entry *prev, *next; /* LRU list, least recent first. */
+  struct open_cache_entry* hash_next;
+};
+
+struct open_cache_shard {
+  pthread_mutex_t lock;
+  struct open_cache_entry* buckets[OPEN_CACHE_BUCKETS];
+  struct open_cache_entry* lru; /* Least recently used first. */
+  size_t used, capacity;        /* In entries. */
+};
+
+static struct open_cache_shard shards[OPEN_CACHE_SHARDS];
+static bool cache_enabled;
+
+/* FNV-1a; the low bits pick the shard, the next ones the bucket. */
+static uint32_t open_cache_hash(char* path) {
+  uint32_t hash = 2166136261u;
+  for (unsigned char* p = (unsigned char*)path; *p; p++) {
+    hash ^= *p;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static struct open_cache_entry** open_cache_bucket(
+    struct open_cache_shard* shard, uint32_t hash) {
+  return &shard->buckets[(hash / OPEN_CACHE_SHARDS) % OPEN_CACHE_BUCKETS];
+}
+
+void open_cache_init(size_t entries) {
+  for (int i = 0; i < OPEN_CACHE_SHARDS; i++) {
+    pthread_mutex_init(&shards[i].lock, NULL);
+    shards[i].capacity = (entries + OPEN_CACHE_SHARDS - 1) / OPEN_CACHE_SHARDS;
+  }
+  cache_enabled = entries > 0;
+}
+
+static void open_cache_release(struct open_cache_entry* entry) {
+  if (__atomic_sub_fetch(&entry->refcount, 1, __ATOMIC_ACQ_REL) != 0) return;
+  if (entry->fd != -1) close(entry->fd);
+  free(entry);
+}
+
+/* Unlinks ENTRY from SHARD and drops the cache's reference. The shard lock
+ * must be held. */
+static void open_cache_unlink(struct open_cache_shard* shard,
+                              struct open_cache_entry* entry) {
+  struct open_cache_entry** link = open_cache_bucket(shard, entry->hash);
+  while (*link != entry) link = &(*link)->hash_next;
+  *link = entry->hash_next;
+  DL_DELETE(shard->lru, entry);
+  shard->used--;
+  open_cache_release(entry);
+}
+
+/* Looks PATH up on disk, into a new entry holding one reference. */
+static struct open_cache_entry* open_cache_build(char* path, uint32_t hash) {
+  size_t path_length = strlen(path) + 1;
+  struct open_cache_entry* entry = malloc(sizeof(*entry) + path_length);
+  if (!entry) return NULL;
+  entry->path = (char*)(entry + 1);
+  memcpy(entry->path, path, path_length);
+  entry->hash = hash;
+  entry->created = stats_now();
+  entry->fd = -1;
+  entry->open_error = 0;
+  entry->refcount = 1;
+
+  entry->error = stat(path, &entry->stat) == 0 ? 0 : errno;
+  if (entry->error == 0 && S_ISREG(entry->stat.st_mode)) {
+    /* Describe the file actually opened, should it have been replaced. */
+    entry->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (entry->fd == -1 || fstat(entry->fd, &entry->stat) == -1) {
+      entry->open_error = errno;
+      if (entry->fd != -1) close(entry->fd);
+      entry->fd = -1;
+    }
+  }
+  return entry;
+}
+
+/* Returns the entry for PATH, holding a reference for the caller, or NULL if
+ * the cache is disabled or out of memory. */
+static struct open_cache_entry* open_cache_get(char* path) {
+  if (!cache_enabled) return NULL;
+  uint32_t hash = open_cache_hash(path);
+  struct open_cache_shard* shard = &shards[hash % OPEN_CACHE_SHARDS];
+  uint64_t now = stats_now();
+
+  pthread_mutex_lock(&shard->lock);
+  struct open_cache_entry* entry = *open_cache_bucket(shard, hash);
+  while (entry && (entry->hash != hash || strcmp(entry->path, path) != 0))
+    entry = entry->hash_next;
+  if (entry && now - entry->created >= OPEN_CACHE_VALID_NS) {
+    open_cache_unlink(shard, entry);
+    entry = NULL;
+  }
+  if (entry) {
+    DL_DELETE(shard->lru, entry);
+    DL_APPEND(shard->lru, entry);
+    __atomic_add_fetch(&entry->refcount, 1, __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&shard->lock);
+  if (entry) return entry;
+
+  /* Look the path up without holding the lock. */
+  entry = open_cache_build(path, hash);
+  if (!entry) return NULL;
+
+  pthread_mutex_lock(&shard->lock);
+  /* Another thread may have looked up the same path meanwhile. */
+  struct open_cache_entry* existing = *open_cache_bucket(shard, hash);
+  while (existing && (existing->hash != hash ||
+                      strcmp(existing->path, path) != 0))
+    existing = existing->hash_next;
+  if (existing) open_cache_unlink(shard, existing);
+
+  while (shard->lru && shard->used >= shard->capacity)
+    open_cache_unlink(shard, shard->lru);
+
+  struct open_cache_entry** bucket = open_cache_bucket(shard, hash);
+  entry->hash_next = *bucket;
+  *bucket = entry;
+  DL_APPEND(shard->lru, entry);
+  shard->used++;
+  entry->refcount++; /* The cache's reference. */
+  pthread_mutex_unlock(&shard->lock);
+
+  return entry;
+}
+
+int open_cache_stat(char* path, struct stat* file_stat) {
+  struct open_cache_entry* entry = open_cache_get(path);
+  if (!entry) return stat(path, file_stat);
+
+  int error = entry->error;
+  if (error == 0) *file_stat = entry->stat;
+  open_cache_release(entry);
+  if (error == 0) return 0;
+  errno = error;
+  return -1;
+}
+
+int open_cache_stat_readable(char* path, struct stat* file_stat) {
+  struct open_cache_entry* entry = open_cache_get(path);
+  if (!entry || (entry->error == 0 && !S_ISREG(entry->stat.st_mode))) {
+    /* Only regular files are opened ahead. */
+    if (entry) open_cache_release(entry);
+    if (access(path, R_OK) == -1) return -1;
+    return stat(path, file_stat);
+  }
+
+  int error = entry->error ? entry->error : entry->open_error;
+  if (error == 0) *file_stat = entry->stat;
+  open_cache_release(entry);
+  if (error == 0) return 0;
+  errno = error;
+  return -1;
+}
+
+int open_cache_open(char* path, struct stat* file_stat,
+                    struct open_cache_entry** handle) {
+  *handle = NULL;
+  struct open_cache_entry* entry = open_cache_get(path);
+  if (!entry || (entry->error == 0 && !S_ISREG(entry->stat.st_mode))) {
+    /* Only regular files are opened ahead. */
+    if (entry) open_cache_release(entry);
+    int fd = open(path, O_RDONLY);
+    if (fd != -1 && fstat(fd, file_stat) == -1) {
+      close(fd);
+      fd = -1;
+    }
+    return fd;
+  }
+
+  if (entry->fd == -1) {
+    errno = entry->error ? entry->error : entry->open_error;
+    open_cache_release(entry);
+    return -1;
+  }
+  *file_stat = entry->stat;
+  *handle = entry;
+  return entry->fd;
+}
+
+void open_cache_close(int fd, struct open_cache_entry* handle) {
+  if (handle)
+    open_cache_release(handle);
+  else
+    close(fd);
+}
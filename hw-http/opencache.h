@@ -0,0 +1,53 @@
+/*
+ * Cache of open files and their metadata for --files mode (--open-cache N).
+ *
+ * Without it, resolving a request costs a stat() of the path, one for each
+ * precompressed sibling the client could take, an access() and stat() of a
+ * directory's index.html, then an open() and fstat() of the file and a
+ * close() once it is sent. The cache remembers the outcome of all that for up
+ * to N paths: the metadata, or the errno of a path that does not exist (so
+ * missing siblings are not looked for on every request), and for a regular
+ * file a descriptor opened once and shared by every request for it. Senders
+ * pass explicit offsets to sendfile(), pread() and splice(), so sharing a
+ * descriptor is safe.
+ *
+ * An entry is trusted for OPEN_CACHE_VALID_NS after it was made, then looked
+ * up afresh, so a file that is changed, created or removed is seen at most
+ * that late. Entries are reference counted: the descriptor of an entry dropped
+ * while a response is sent from it stays open until the response is done.
+ *
+ * With the cache disabled, every function makes the plain system calls.
+ */
+
+#ifndef OPENCACHE_H
+#define OPENCACHE_H
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+#define OPEN_CACHE_VALID_NS 1000000000
+
+struct open_cache_entry;
+
+/* Enables the cache with room for ENTRIES paths, each holding at most one
+ * descriptor. */
+void open_cache_init(size_t entries);
+
+/* Like stat(). */
+int open_cache_stat(char* path, struct stat* file_stat);
+
+/* Returns 0 and fills in FILE_STAT if PATH is a file that can be opened for
+ * reading, like access(PATH, R_OK) followed by stat(). */
+int open_cache_stat_readable(char* path, struct stat* file_stat);
+
+/*
+ * Opens PATH for reading and fills in FILE_STAT from the descriptor. Returns
+ * the descriptor, or -1 with errno set. The descriptor may be shared, so it
+ * must be given back with open_cache_close() along with *HANDLE, never closed
+ * or seeked.
+ */
+int open_cache_open(char* path, struct stat* file_stat,
+                    struct open_cache_entry** handle);
+void open_cache_close(int fd, struct open_cache_entry* handle);
+
+#endif
@@ -0,0 +1,351 @@
+#define _GNU_SOURCE /* memmem() */
+
+#include "proxycache.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "libhttp.h"
+#include "utlist.h"
+
+#define PROXY_CACHE_BUCKETS 256
+
+struct proxy_flight {
+  char* key;
+  uint32_t hash;
+  bool done;
+  struct proxy_cache_entry* entry; /* For the waiters, or NULL. */
+  int waiters;
+  pthread_cond_t finished;
+  struct proxy_flight* next;
+};
+
+/* The upstream is fetched and read without the lock, so one lock for the
+ * whole cache is only held for bookkeeping. */
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct proxy_cache_entry* buckets[PROXY_CACHE_BUCKETS];
+static struct proxy_cache_entry* lru; /* Least recently used first. */
+static struct proxy_flight* flights;  /* Fetches under way. */
+static size_t used, capacity;         /* In bytes, see proxy_cache_charge(). */
+static bool cache_enabled;
+
+/* Headers about the connection rather than the response, which are dropped.
+ * So are Content-Length and Age, which are sent again from the body as read
+ * and the time it has been kept. */
+static char* dropped_headers[] = {
+    "Connection", "Keep-Alive", "Proxy-Connection", "TE",
+    "Trailer",    "Upgrade",    "Content-Length",   "Age"};
+
+/* Statuses that may be stored, given explicit freshness. */
+static int cacheable_statuses[] = {200, 203, 204, 300, 301, 404, 410};
+
+/* FNV-1a, as in the file cache. */
+static uint32_t proxy_cache_hash(char* key) {
+  uint32_t hash = 2166136261u;
+  for (unsigned char* p = (unsigned char*)key; *p; p++) {
+    hash ^= *p;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static struct proxy_cache_entry** proxy_cache_bucket(uint32_t hash) {
+  return &buckets[hash % PROXY_CACHE_BUCKETS];
+}
+
+/* Memory accounted to ENTRY against the capacity. */
+static size_t proxy_cache_charge(struct proxy_cache_entry* entry) {
+  return sizeof(*entry) + strlen(entry->key) + 1 + entry->headers_length +
+         entry->size;
+}
+
+void proxy_cache_init(size_t capacity_) {
+  capacity = capacity_;
+  cache_enabled = capacity > 0;
+}
+
+bool proxy_cache_enabled(void) { return cache_enabled; }
+
+size_t proxy_cache_max_response(void) { return capacity / 8; }
+
+void proxy_cache_release(struct proxy_cache_entry* entry) {
+  if (__atomic_sub_fetch(&entry->refcount, 1, __ATOMIC_ACQ_REL) == 0)
+    free(entry);
+}
+
+/* Unlinks ENTRY and drops the cache's reference. The lock must be held. */
+static void proxy_cache_unlink(struct proxy_cache_entry* entry) {
+  struct proxy_cache_entry** link = proxy_cache_bucket(entry->hash);
+  while (*link != entry) link = &(*link)->hash_next;
+  *link = entry->hash_next;
+  DL_DELETE(lru, entry);
+  used -= proxy_cache_charge(entry);
+  proxy_cache_release(entry);
+}
+
+/* Finds KEY, dropping it if it is no longer fresh at NOW. The lock must be
+ * held. */
+static struct proxy_cache_entry* proxy_cache_find(char* key, uint32_t hash,
+                                                  time_t now) {
+  struct proxy_cache_entry* entry = *proxy_cache_bucket(hash);
+  while (entry && (entry->hash != hash || strcmp(entry->key, key) != 0))
+    entry = entry->hash_next;
+  if (entry && now >= entry->expires) {
+    proxy_cache_unlink(entry);
+    entry = NULL;
+  }
+  return entry;
+}
+
+/* Links ENTRY in, replacing any entry for its key and evicting the least
+ * recently used until it fits. The lock must be held. */
+static void proxy_cache_insert(struct proxy_cache_entry* entry) {
+  struct proxy_cache_entry* existing =
+      proxy_cache_find(entry->key, entry->hash, 0);
+  if (existing) proxy_cache_unlink(existing);
+
+  size_t charge = proxy_cache_charge(entry);
+  while (lru && used + charge > capacity) proxy_cache_unlink(lru);
+
+  struct proxy_cache_entry** bucket = proxy_cache_bucket(entry->hash);
+  entry->hash_next = *bucket;
+  *bucket = entry;
+  DL_APPEND(lru, entry);
+  used += charge;
+  __atomic_add_fetch(&entry->refcount, 1, __ATOMIC_RELAXED);
+}
+
+/* Frees FLIGHT once it is done and no lookup waits for it any more. The lock
+ * must be held. */
+static void proxy_flight_free(struct proxy_flight* flight) {
+  if (flight->entry) proxy_cache_release(flight->entry);
+  pthread_cond_destroy(&flight->finished);
+  free(flight);
+}
+
+struct proxy_cache_entry* proxy_cache_lookup(char* key,
+                                             struct proxy_flight** flight) {
+  *flight = NULL;
+  if (!cache_enabled) return NULL;
+
+  uint32_t hash = proxy_cache_hash(key);
+  pthread_mutex_lock(&cache_lock);
+  struct proxy_cache_entry* entry = proxy_cache_find(key, hash, time(NULL));
+  if (entry) {
+    DL_DELETE(lru, entry);
+    DL_APPEND(lru, entry);
+    __atomic_add_fetch(&entry->refcount, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&cache_lock);
+    return entry;
+  }
+
+  struct proxy_flight* in_flight = flights;
+  while (in_flight &&
+         (in_flight->hash != hash || strcmp(in_flight->key, key) != 0))
+    in_flight = in_flight->next;
+  if (in_flight) {
+    /* Someone is fetching it already; take what they get. */
+    in_flight->waiters++;
+    while (!in_flight->done)
+      pthread_cond_wait(&in_flight->finished, &cache_lock);
+    entry = in_flight->entry;
+    if (entry) __atomic_add_fetch(&entry->refcount, 1, __ATOMIC_RELAXED);
+    if (--in_flight->waiters == 0) proxy_flight_free(in_flight);
+  } else {
+    /* Without memory for the flight, fetch uncoalesced. */
+    size_t key_length = strlen(key) + 1;
+    in_flight = calloc(1, sizeof(*in_flight) + key_length);
+    if (in_flight) {
+      in_flight->key = (char*)(in_flight + 1);
+      memcpy(in_flight->key, key, key_length);
+      in_flight->hash = hash;
+      pthread_cond_init(&in_flight->finished, NULL);
+      LL_PREPEND(flights, in_flight);
+      *flight = in_flight;
+    }
+  }
+  pthread_mutex_unlock(&cache_lock);
+  return entry;
+}
+
+void proxy_cache_finish(struct proxy_flight* flight,
+                        struct proxy_cache_entry* entry) {
+  pthread_mutex_lock(&cache_lock);
+  if (entry && entry->cacheable) {
+    proxy_cache_insert(entry);
+    if (flight->waiters > 0) {
+      __atomic_add_fetch(&entry->refcount, 1, __ATOMIC_RELAXED);
+      flight->entry = entry;
+    }
+  }
+  flight->done = true;
+  LL_DELETE(flights, flight);
+  pthread_cond_broadcast(&flight->finished);
+  if (flight->waiters == 0) proxy_flight_free(flight);
+  pthread_mutex_unlock(&cache_lock);
+}
+
+/* Returns whether header KEY, of LENGTH bytes, is NAME. */
+static bool proxy_header_is(char* key, size_t length, char* name) {
+  return strlen(name) == length && strncasecmp(key, name, length) == 0;
+}
+
+/* Returns whether header KEY, of LENGTH bytes, is one of dropped_headers. */
+static bool proxy_header_dropped(char* key, size_t length) {
+  size_t count = sizeof(dropped_headers) / sizeof(dropped_headers[0]);
+  for (size_t i = 0; i < count; i++)
+    if (proxy_header_is(key, length, dropped_headers[i])) return true;
+  return false;
+}
+
+/*
+ * Reads the Cache-Control directives in VALUE that decide whether and for
+ * how long a shared cache may keep a response. A directive that is not
+ * understood is ignored; no-cache and private with field names are taken
+ * as applying to the whole response.
+ */
+static void proxy_cache_control(char* value, bool* no_store, long* max_age,
+                                long* s_maxage) {
+  for (char* item = value; *item;) {
+    item += strspn(item, " \t,");
+    size_t name_length = strcspn(item, " \t=,");
+    char* end = item + strcspn(item, ",");
+    if ((name_length == 8 && strncasecmp(item, "no-store", 8) == 0) ||
+        (name_length == 8 && strncasecmp(item, "no-cache", 8) == 0) ||
+        (name_length == 7 && strncasecmp(item, "private", 7) == 0))
+      *no_store = true;
+    else if (name_length == 7 && strncasecmp(item, "max-age", 7) == 0 &&
+             item[7] == '=')
+      *max_age = strtol(item + 8 + (item[8] == '"'), NULL, 10);
+    else if (name_length == 8 && strncasecmp(item, "s-maxage", 8) == 0 &&
+             item[8] == '=')
+      *s_maxage = strtol(item + 9 + (item[9] == '"'), NULL, 10);
+    item = end;
+  }
+}
+
+struct proxy_cache_entry* proxy_cache_parse(char* key, char* response,
+                                            size_t length) {
+  char* head_end = memmem(response, length, "\r\n\r\n", 4);
+  if (!head_end) return NULL;
+  size_t head_length = head_end + 2 - response; /* With its last CRLF. */
+  char* body = head_end + 4;
+  size_t body_size = length - (body - response);
+
+  /* The head is parsed in a copy, terminated and cut into lines. */
+  char* head = malloc(head_length + 1);
+  if (!head) return NULL;
+  memcpy(head, response, head_length);
+  head[head_length] = '\0';
+
+  struct proxy_cache_entry* entry = NULL;
+  int minor_version, status_code;
+  if (sscanf(head, "HTTP/1.%d %3d", &minor_version, &status_code) != 2)
+    goto done;
+
+  size_t key_length = strlen(key) + 1;
+  char content_length_header[48];
+  entry = malloc(sizeof(*entry) + key_length + head_length +
+                 sizeof(content_length_header) + 1 + body_size);
+  if (!entry) goto done;
+  entry->key = (char*)(entry + 1);
+  memcpy(entry->key, key, key_length);
+  entry->headers = entry->key + key_length;
+
+  char* line = head;
+  char* line_end = strstr(line, "\r\n");
+  size_t headers_length = line_end + 2 - line;
+  memcpy(entry->headers, line, headers_length);
+
+  bool no_store = false;
+  long max_age = -1, s_maxage = -1, age = 0, content_length = -1;
+  time_t date = -1, expires = -1;
+  for (line = line_end + 2; *line; line = line_end + 2) {
+    line_end = strstr(line, "\r\n");
+    *line_end = '\0';
+    char* colon = strchr(line, ':');
+    if (!colon) continue;
+    size_t name_length = colon - line;
+    char* value = colon + 1 + strspn(colon + 1, " \t");
+
+    if (proxy_header_is(line, name_length, "Transfer-Encoding")) {
+      /* The body is coded for the upstream connection; relay it. */
+      free(entry);
+      entry = NULL;
+      goto done;
+    } else if (proxy_header_is(line, name_length, "Content-Length")) {
+      content_length = strtol(value, NULL, 10);
+    } else if (proxy_header_is(line, name_length, "Cache-Control")) {
+      proxy_cache_control(value, &no_store, &max_age, &s_maxage);
+    } else if (proxy_header_is(line, name_length, "Expires")) {
+      /* An unreadable date means already expired. */
+      expires = http_parse_date(value);
+      if (expires == -1) expires = 0;
+    } else if (proxy_header_is(line, name_length, "Date")) {
+      date = http_parse_date(value);
+    } else if (proxy_header_is(line, name_length, "Age")) {
+      age = strtol(value, NULL, 10);
+    } else if (proxy_header_is(line, name_length, "Set-Cookie") ||
+               proxy_header_is(line, name_length, "Vary")) {
+      no_store = true;
+    }
+
+    if (proxy_header_dropped(line, name_length)) continue;
+    size_t line_length = line_end - line;
+    memcpy(entry->headers + headers_length, line, line_length);
+    memcpy(entry->headers + headers_length + line_length, "\r\n", 2);
+    headers_length += line_length + 2;
+  }
+
+  /* Statuses without a body have none whatever the headers say. */
+  if (status_code == 204 || status_code == 304 || status_code / 100 == 1)
+    body_size = 0;
+  else if (content_length >= 0) {
+    /* Cut short by the upstream. */
+    if (body_size < (size_t)content_length) {
+      free(entry);
+      entry = NULL;
+      goto done;
+    }
+    body_size = content_length;
+  }
+  snprintf(content_length_header, sizeof(content_length_header),
+           "Content-Length: %zu\r\n", body_size);
+  memcpy(entry->headers + headers_length, content_length_header,
+         strlen(content_length_header) + 1);
+  headers_length += strlen(content_length_header);
+  entry->headers_length = headers_length;
+  entry->body = entry->headers + headers_length + 1;
+  memcpy(entry->body, body, body_size);
+  entry->size = body_size;
+
+  /* The response's age counts against its lifetime. */
+  time_t now = time(NULL);
+  long lifetime = 0;
+  if (s_maxage >= 0)
+    lifetime = s_maxage;
+  else if (max_age >= 0)
+    lifetime = max_age;
+  else if (expires != -1)
+    lifetime = expires - (date != -1 ? date : now);
+  entry->date = now - (age > 0 ? age : 0);
+  entry->expires = entry->date + lifetime;
+
+  bool status_ok = false;
+  for (size_t i = 0;
+       i < sizeof(cacheable_statuses) / sizeof(cacheable_statuses[0]); i++)
+    if (cacheable_statuses[i] == status_code) status_ok = true;
+
+  entry->hash = proxy_cache_hash(key);
+  entry->status_code = status_code;
+  entry->refcount = 1;
+  entry->cacheable = cache_enabled && status_ok && !no_store && lifetime > 0 &&
+                     proxy_cache_charge(entry) <= proxy_cache_max_response();
+
+done:
+  free(head);
+  return entry;
+}
@@ -0,0 +1,97 @@
+/*
+ * In-memory cache of upstream responses for --proxy mode (--cache-mb N).
+ *
+ * Without the cache the proxy relays raw bytes. With it, the proxy reads each
+ * request from the client itself: a GET it may answer from the cache is
+ * looked up by its Host header and path, and a miss is fetched from an
+ * upstream on a connection of its own, read whole, and stored if the
+ * upstream allows. Anything else, a request with a body for instance, ends
+ * the caching and the rest of the connection is relayed as before.
+ *
+ * Only a response with explicit freshness is stored: Cache-Control s-maxage
+ * or max-age, or else Expires, measured against the upstream's Date. One
+ * marked no-store, no-cache or private, one that sets a cookie or varies by
+ * request headers, or a status other than 200, 203, 204, 300, 301, 404 and 410
+ * is relayed but not kept. Nor is one larger than an eighth of the cache, so
+ * that one large file cannot flush the rest. An entry that is no longer
+ * fresh is dropped on the next lookup and fetched again.
+ *
+ * Concurrent misses on the same key are coalesced: the first fetches, and the
+ * others wait for it and are answered from the entry it stores, so a popular
+ * page that expires costs the upstream one request rather than one per
+ * client. If the response turns out not to be cacheable, each waiter fetches
+ * its own, since it may be meant for one client only.
+ *
+ * Entries are reference counted, like the file cache's, so one evicted while
+ * it is being sent stays alive until its last user releases it.
+ */
+
+#ifndef PROXYCACHE_H
+#define PROXYCACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+struct proxy_cache_entry {
+  char* key;
+  uint32_t hash;
+  int status_code;
+  bool cacheable;
+  time_t date;    /* When the upstream made the response, for Age. */
+  time_t expires; /* Fresh until then. */
+
+  /* The status line and end-to-end headers of the response, with a
+   * Content-Length. The sender adds Age, Connection and the blank line. */
+  char* headers;
+  size_t headers_length;
+  char* body;
+  size_t size;
+
+  int refcount; /* One for the cache while linked, one per user. */
+  struct proxy_cache_entry *prev, *next; /* LRU list, least recent first. */
+  struct proxy_cache_entry* hash_next;
+};
+
+/* A fetch of a key that other lookups wait for. */
+struct proxy_flight;
+
+/* Enables the cache with room for CAPACITY bytes. */
+void proxy_cache_init(size_t capacity);
+bool proxy_cache_enabled(void);
+
+/* The largest response, headers and body together, that may be stored. */
+size_t proxy_cache_max_response(void);
+
+/*
+ * Returns the fresh entry for KEY, waiting for a fetch of it under way if
+ * there is one. The caller must release it with proxy_cache_release().
+ * Otherwise returns NULL, and the caller fetches the response itself. If
+ * *FLIGHT is set, other lookups of KEY wait for that fetch, and the caller
+ * must end it with proxy_cache_finish() whether or not it succeeds.
+ */
+struct proxy_cache_entry* proxy_cache_lookup(char* key,
+                                             struct proxy_flight** flight);
+
+/*
+ * Ends FLIGHT with ENTRY, the response fetched, or NULL if there is none.
+ * ENTRY is stored if it is cacheable and fits, and handed to the lookups
+ * waiting for it; otherwise they fetch their own. The caller keeps its
+ * reference to ENTRY.
+ */
+void proxy_cache_finish(struct proxy_flight* flight,
+                        struct proxy_cache_entry* entry);
+
+/*
+ * Builds an entry for KEY from RESPONSE, LENGTH bytes read from an upstream
+ * up to its end of file, holding one reference. The hop-by-hop headers are
+ * dropped, and Content-Length set to the body's length. Returns NULL if
+ * RESPONSE is not a complete response that can be sent this way, such as one
+ * cut short or in chunked coding; it should be relayed as it is.
+ */
+struct proxy_cache_entry* proxy_cache_parse(char* key, char* response,
+                                            size_t length);
+void proxy_cache_release(struct proxy_cache_entry* entry);
+
+#endif
@@ -0,0 +1,320 @@
+#define _GNU_SOURCE /* POLLRDHUP */
+
+#include "proxypool.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "utlist.h"
+
+#define PROXY_MAX_UPSTREAMS 64
+#define PROXY_CONNECT_TIMEOUT_MS 2000
+
+struct pooled_conn {
+  int fd;
+  time_t connected_at;
+  struct pooled_conn *prev, *next;
+};
+
+struct proxy_upstream {
+  char name[64];
+  struct sockaddr_in address;
+  int active; /* Clients relayed to it right now. */
+  bool down;  /* Out of rotation until a health check passes. */
+
+  /* Idle connections, oldest first; protected by pool_lock. */
+  struct pooled_conn* pool;
+  int pool_count;
+};
+
+static struct proxy_upstream upstreams[PROXY_MAX_UPSTREAMS];
+static int num_upstreams;
+static int pool_size;
+static enum proxy_balance balance;
+
+/* The hash ring, sorted by hash. */
+struct ring_point {
+  uint32_t hash;
+  struct proxy_upstream* upstream;
+};
+static struct ring_point ring[PROXY_MAX_UPSTREAMS * PROXY_HASH_POINTS];
+static int ring_size;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_taken = PTHREAD_COND_INITIALIZER;
+
+static time_t monotonic_seconds(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec;
+}
+
+/* FNV-1a. */
+static uint32_t proxy_hash(const void* data, size_t length) {
+  const unsigned char* bytes = data;
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < length; i++) hash = (hash ^ bytes[i]) * 16777619u;
+  return hash;
+}
+
+int proxy_pool_add(char* name) {
+  if (num_upstreams == PROXY_MAX_UPSTREAMS) return -1;
+  struct proxy_upstream* upstream = &upstreams[num_upstreams];
+  snprintf(upstream->name, sizeof(upstream->name), "%s", name);
+
+  char host[sizeof(upstream->name)];
+  snprintf(host, sizeof(host), "%s", name);
+  int port = 80;
+  char* colon = strchr(host, ':');
+  if (colon) {
+    *colon = '\0';
+    port = atoi(colon + 1);
+  }
+  struct hostent* entry = gethostbyname2(host, AF_INET);
+  if (entry == NULL || port <= 0 || port > 65535) return -1;
+
+  memset(&upstream->address, 0, sizeof(upstream->address));
+  upstream->address.sin_family = AF_INET;
+  upstream->address.sin_port = htons(port);
+  memcpy(&upstream->address.sin_addr, entry->h_addr_list[0],
+         sizeof(upstream->address.sin_addr));
+  num_upstreams++;
+  return 0;
+}
+
+int proxy_pool_upstreams(void) { return num_upstreams; }
+
+struct sockaddr_in* proxy_upstream_address(struct proxy_upstream* upstream) {
+  return &upstream->address;
+}
+
+static int compare_points(const void* a, const void* b) {
+  uint32_t x = ((const struct ring_point*)a)->hash;
+  uint32_t y = ((const struct ring_point*)b)->hash;
+  return x < y ? -1 : x > y;
+}
+
+static void build_ring(void) {
+  ring_size = 0;
+  for (int i = 0; i < num_upstreams; i++) {
+    for (int point = 0; point < PROXY_HASH_POINTS; point++) {
+      char key[sizeof(upstreams[i].name) + 16];
+      int length = snprintf(key, sizeof(key), "%s#%d", upstreams[i].name,
+                            point);
+      ring[ring_size++] =
+          (struct ring_point){proxy_hash(key, length), &upstreams[i]};
+    }
+  }
+  qsort(ring, ring_size, sizeof(ring[0]), compare_points);
+}
+
+static bool upstream_down(struct proxy_upstream* upstream) {
+  return __atomic_load_n(&upstream->down, __ATOMIC_RELAXED);
+}
+
+/* The first upstream clockwise from the client's point that is up. */
+static struct proxy_upstream* pick_hash(struct sockaddr_in* peer) {
+  uint32_t key = peer ? proxy_hash(&peer->sin_addr, sizeof(peer->sin_addr))
+                      : (uint32_t)rand();
+  int low = 0, high = ring_size;
+  while (low < high) {
+    int middle = (low + high) / 2;
+    if (ring[middle].hash < key)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  for (int i = 0; i < ring_size; i++) {
+    struct proxy_upstream* upstream = ring[(low + i) % ring_size].upstream;
+    if (!upstream_down(upstream)) return upstream;
+  }
+  return ring[low % ring_size].upstream;
+}
+
+/* The upstream with the fewest clients, among those that are up if any is.
+ * Ties go round-robin. */
+static struct proxy_upstream* pick_least_conn(void) {
+  static unsigned next;
+  bool any_up = false;
+  for (int i = 0; i < num_upstreams; i++)
+    if (!upstream_down(&upstreams[i])) any_up = true;
+
+  struct proxy_upstream* tied[PROXY_MAX_UPSTREAMS];
+  int num_tied = 0, fewest = 0;
+  for (int i = 0; i < num_upstreams; i++) {
+    struct proxy_upstream* upstream = &upstreams[i];
+    if (any_up && upstream_down(upstream)) continue;
+    int active = __atomic_load_n(&upstream->active, __ATOMIC_RELAXED);
+    if (num_tied > 0 && active > fewest) continue;
+    if (num_tied == 0 || active < fewest) {
+      num_tied = 0;
+      fewest = active;
+    }
+    tied[num_tied++] = upstream;
+  }
+  return tied[__atomic_fetch_add(&next, 1, __ATOMIC_RELAXED) % num_tied];
+}
+
+struct proxy_upstream* proxy_pool_pick(struct sockaddr_in* peer) {
+  struct proxy_upstream* upstream =
+      balance == PROXY_HASH ? pick_hash(peer) : pick_least_conn();
+  __atomic_fetch_add(&upstream->active, 1, __ATOMIC_RELAXED);
+  return upstream;
+}
+
+void proxy_pool_release(struct proxy_upstream* upstream) {
+  __atomic_fetch_sub(&upstream->active, 1, __ATOMIC_RELAXED);
+}
+
+void proxy_pool_failed(struct proxy_upstream* upstream) {
+  /* With nowhere else to send clients, there is no rotation to leave. */
+  if (num_upstreams < 2) return;
+  if (!__atomic_exchange_n(&upstream->down, true, __ATOMIC_RELAXED))
+    fprintf(stderr, "Upstream %s is down\n", upstream->name);
+}
+
+/* Connects to UPSTREAM within PROXY_CONNECT_TIMEOUT_MS. */
+static int connect_upstream(struct proxy_upstream* upstream) {
+  int fd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd == -1) return -1;
+  if (connect(fd, (struct sockaddr*)&upstream->address,
+              sizeof(upstream->address)) == -1) {
+    struct pollfd pollfd = {.fd = fd, .events = POLLOUT};
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (errno != EINPROGRESS ||
+        poll(&pollfd, 1, PROXY_CONNECT_TIMEOUT_MS) != 1 ||
+        getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) == -1 ||
+        error != 0) {
+      close(fd);
+      return -1;
+    }
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) & ~O_NONBLOCK);
+  return fd;
+}
+
+/* An idle connection that polls readable was closed (or written to) by the
+ * upstream, and is of no use to a new client. */
+static int conn_is_stale(struct pooled_conn* conn, time_t now) {
+  struct pollfd pollfd = {.fd = conn->fd, .events = POLLIN | POLLRDHUP};
+  return now - conn->connected_at >= PROXY_POOL_MAX_IDLE ||
+         poll(&pollfd, 1, 0) != 0;
+}
+
+/* Drops stale connections from UPSTREAM's pool. Holds pool_lock. */
+static void prune_pool(struct proxy_upstream* upstream) {
+  time_t now = monotonic_seconds();
+  struct pooled_conn *conn, *tmp;
+  DL_FOREACH_SAFE(upstream->pool, conn, tmp) {
+    if (!conn_is_stale(conn, now)) continue;
+    DL_DELETE(upstream->pool, conn);
+    upstream->pool_count--;
+    close(conn->fd);
+    free(conn);
+  }
+}
+
+/* Tops up UPSTREAM's pool. Holds pool_lock, dropping it to connect. */
+static void refill_pool(struct proxy_upstream* upstream) {
+  prune_pool(upstream);
+  while (upstream->pool_count < pool_size) {
+    pthread_mutex_unlock(&pool_lock);
+    int fd = connect_upstream(upstream);
+    pthread_mutex_lock(&pool_lock);
+    if (fd == -1) {
+      proxy_pool_failed(upstream);
+      return;
+    }
+
+    struct pooled_conn* conn = malloc(sizeof(*conn));
+    if (!conn) {
+      close(fd);
+      return;
+    }
+    conn->fd = fd;
+    conn->connected_at = monotonic_seconds();
+    DL_APPEND(upstream->pool, conn);
+    upstream->pool_count++;
+  }
+}
+
+/* Checks on the upstreams that are down and keeps the pools of the others
+ * topped up, waking when a connection is taken or at least every
+ * PROXY_HEALTH_INTERVAL seconds. */
+static void* maintain_upstreams(void* unused __attribute__((unused))) {
+  pthread_mutex_lock(&pool_lock);
+  while (1) {
+    for (int i = 0; i < num_upstreams; i++) {
+      struct proxy_upstream* upstream = &upstreams[i];
+      if (upstream_down(upstream)) {
+        pthread_mutex_unlock(&pool_lock);
+        int fd = connect_upstream(upstream);
+        pthread_mutex_lock(&pool_lock);
+        if (fd == -1) continue;
+        close(fd);
+        __atomic_store_n(&upstream->down, false, __ATOMIC_RELAXED);
+        fprintf(stderr, "Upstream %s is back up\n", upstream->name);
+      }
+      refill_pool(upstream);
+    }
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += PROXY_HEALTH_INTERVAL;
+    pthread_cond_timedwait(&pool_taken, &pool_lock, &deadline);
+  }
+  return NULL;
+}
+
+void proxy_pool_init(int size, enum proxy_balance policy) {
+  pool_size = size;
+  balance = policy;
+  build_ring();
+  if (size == 0 && num_upstreams < 2) return;
+
+  pthread_t thread;
+  pthread_create(&thread, NULL, maintain_upstreams, NULL);
+  pthread_detach(thread);
+}
+
+int proxy_pool_take(struct proxy_upstream* upstream) {
+  if (pool_size == 0) return -1;
+
+  int fd = -1;
+  time_t now = monotonic_seconds();
+  pthread_mutex_lock(&pool_lock);
+  /* The newest connection is the least likely to have been closed. */
+  while (fd == -1 && upstream->pool) {
+    struct pooled_conn* conn = upstream->pool->prev;
+    DL_DELETE(upstream->pool, conn);
+    upstream->pool_count--;
+    if (conn_is_stale(conn, now))
+      close(conn->fd);
+    else
+      fd = conn->fd;
+    free(conn);
+  }
+  pthread_cond_signal(&pool_taken);
+  pthread_mutex_unlock(&pool_lock);
+  return fd;
+}
+
+int proxy_pool_connect(struct proxy_upstream* upstream) {
+  int fd = proxy_pool_take(upstream);
+  if (fd != -1) return fd;
+  fd = connect_upstream(upstream);
+  if (fd == -1) proxy_pool_failed(upstream);
+  return fd;
+}
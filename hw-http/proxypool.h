@@ -0,0 +1,72 @@
+/*
+ * The proxy's upstreams (--proxy host:port,host:port,...), with a pool of
+ * connections opened ahead of time to each (--proxy-pool N).
+ *
+ * Each client is sent to one upstream, chosen by --balance:
+ *   - least-conn: the upstream with the fewest clients relayed right now;
+ *   - hash: client addresses hashed onto a ring of points per upstream, so a
+ *     client keeps going to the same upstream, and an upstream going down or
+ *     coming back moves only its own share of the clients.
+ * The counts are per process, so with --prefork each child balances its own
+ * clients.
+ *
+ * An upstream that refuses a connection is taken out of rotation until a
+ * health check, a TCP connect every PROXY_HEALTH_INTERVAL seconds, gets
+ * through again. If every upstream is down they are all tried anyway, rather
+ * than failing clients on stale news.
+ *
+ * The proxy relays raw bytes without framing HTTP, so an upstream connection
+ * cannot be handed to a second client once the first one is done with it.
+ * What the pool saves instead is the TCP handshake: a background thread keeps
+ * up to N connections established and idle to every healthy upstream, and a
+ * new client is handed one of them. Idle connections are retired after
+ * PROXY_POOL_MAX_IDLE seconds, or as soon as the upstream closes them, so
+ * clients are not given stale sockets.
+ */
+
+#ifndef PROXYPOOL_H
+#define PROXYPOOL_H
+
+#include <netinet/in.h>
+
+#define PROXY_POOL_MAX_IDLE 2
+#define PROXY_HEALTH_INTERVAL 1
+#define PROXY_HASH_POINTS 64 /* Points on the hash ring per upstream. */
+
+enum proxy_balance {
+  PROXY_LEAST_CONN,
+  PROXY_HASH,
+};
+
+struct proxy_upstream;
+
+/* Resolves NAME, "host" or "host:port", and adds it to the upstreams.
+ * Returns -1 if it cannot be resolved. */
+int proxy_pool_add(char* name);
+
+/* Starts the health checks, and keeping SIZE connections warm to each
+ * upstream. A SIZE of 0 opens every connection on demand. */
+void proxy_pool_init(int size, enum proxy_balance balance);
+
+/* The number of upstreams, and so how many a client may try. */
+int proxy_pool_upstreams(void);
+
+/* Chooses the upstream for a client at PEER (which may be NULL) and counts
+ * the client against it until proxy_pool_release(). */
+struct proxy_upstream* proxy_pool_pick(struct sockaddr_in* peer);
+void proxy_pool_release(struct proxy_upstream* upstream);
+
+struct sockaddr_in* proxy_upstream_address(struct proxy_upstream* upstream);
+
+/* Takes UPSTREAM out of rotation after a connection to it failed. */
+void proxy_pool_failed(struct proxy_upstream* upstream);
+
+/* Returns a warm connection to UPSTREAM, or -1 if none is ready. */
+int proxy_pool_take(struct proxy_upstream* upstream);
+
+/* Returns a connected, blocking socket to UPSTREAM, taken from the pool or
+ * opened now. Returns -1, and takes UPSTREAM out of rotation, if it cannot be
+ * reached. */
+int proxy_pool_connect(struct proxy_upstream* upstream);
+
+#endif
@@ -0,0 +1,266 @@
+#define _GNU_SOURCE /* pipe2(), execvpe() */
+#include "reload.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "httpserver.h"
+
+/* How the listening sockets ("3,4") and the pipe to write once the new
+ * generation is ready reach it across execve(). */
+#define RELOAD_SOCKETS_ENV "HTTPSERVER_SOCKETS"
+#define RELOAD_READY_ENV "HTTPSERVER_READY_FD"
+#define RELOAD_MAX_SOCKETS 64
+#define RELOAD_START_TIMEOUT_MS 10000
+
+extern char** environ;
+
+static char** server_argv;
+static char server_path[PATH_MAX];
+static char server_cwd[PATH_MAX];
+
+/* Passed on by the previous generation; -1 once claimed. */
+static int inherited[RELOAD_MAX_SOCKETS];
+static int num_inherited;
+static int ready_fd = -1;
+
+static int listen_sockets[RELOAD_MAX_SOCKETS];
+static int num_sockets;
+static void (*kick_acceptors)(void);
+
+/* Shared with forked children, so forkserver's stop serving keep-alive
+ * connections too once the parent drains. */
+static volatile sig_atomic_t* draining;
+static int holds;
+static volatile pid_t successor = -1;
+
+static void ignore_kick(int signum) { (void)signum; }
+
+static void set_cloexec(int fd, bool cloexec) {
+  int flags = fcntl(fd, F_GETFD);
+  fcntl(fd, F_SETFD, cloexec ? flags | FD_CLOEXEC : flags & ~FD_CLOEXEC);
+}
+
+void reload_init(char** argv) {
+  server_argv = argv;
+  /* Resolved now, since the new generation starts from wherever it was run;
+   * a bare name is looked up on PATH again. */
+  if (!strchr(argv[0], '/') || !realpath(argv[0], server_path))
+    snprintf(server_path, sizeof(server_path), "%s", argv[0]);
+  if (!getcwd(server_cwd, sizeof(server_cwd))) server_cwd[0] = '\0';
+
+  char* sockets = getenv(RELOAD_SOCKETS_ENV);
+  for (char* rest = sockets; rest && *rest;) {
+    char* end;
+    long fd = strtol(rest, &end, 10);
+    if (end == rest || num_inherited == RELOAD_MAX_SOCKETS) break;
+    set_cloexec(fd, true);
+    inherited[num_inherited++] = fd;
+    rest = *end == ',' ? end + 1 : end;
+  }
+  char* ready = getenv(RELOAD_READY_ENV);
+  if (ready) {
+    ready_fd = atoi(ready);
+    set_cloexec(ready_fd, true);
+  }
+  /* Or the server's own children would think they are being reloaded. */
+  unsetenv(RELOAD_SOCKETS_ENV);
+  unsetenv(RELOAD_READY_ENV);
+
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGHUP);
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sigemptyset(&sa.sa_mask);
+  sa.sa_handler = ignore_kick; /* No SA_RESTART: the point is the EINTR. */
+  sigaction(RELOAD_KICK_SIGNAL, &sa, NULL);
+
+  draining = mmap(NULL, sizeof(*draining), PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (draining == MAP_FAILED) {
+    perror("Failed to map the reload flag");
+    exit(errno);
+  }
+}
+
+int reload_inherited_socket(int index, int acceptors, int port) {
+  /* A changed --acceptors or --port opens new sockets instead. */
+  if (num_inherited != acceptors || inherited[index] == -1) return -1;
+  struct sockaddr_in address;
+  socklen_t length = sizeof(address);
+  if (getsockname(inherited[index], (struct sockaddr*)&address, &length) ==
+          -1 ||
+      address.sin_family != AF_INET || ntohs(address.sin_port) != port)
+    return -1;
+  int fd = inherited[index];
+  inherited[index] = -1;
+  return fd;
+}
+
+/* Builds the environment of the new generation: this process's, plus where
+ * to find the sockets and the ready pipe READY_WRITE. free() the array. */
+static char** successor_environment(int ready_write) {
+  size_t count = 0;
+  while (environ[count]) count++;
+  char** envp = malloc((count + 3) * sizeof(char*));
+  static char sockets[sizeof(RELOAD_SOCKETS_ENV) + RELOAD_MAX_SOCKETS * 12];
+  static char ready[sizeof(RELOAD_READY_ENV) + 12];
+  if (!envp) return NULL;
+
+  int length = snprintf(sockets, sizeof(sockets), "%s=", RELOAD_SOCKETS_ENV);
+  for (int i = 0; i < num_sockets; i++)
+    length += snprintf(sockets + length, sizeof(sockets) - length, "%s%d",
+                       i > 0 ? "," : "", listen_sockets[i]);
+  snprintf(ready, sizeof(ready), "%s=%d", RELOAD_READY_ENV, ready_write);
+
+  memcpy(envp, environ, count * sizeof(char*));
+  envp[count] = sockets;
+  envp[count + 1] = ready;
+  envp[count + 2] = NULL;
+  return envp;
+}
+
+/* Starts the next generation and waits for it to be listening. Returns 0 once
+ * it is, or -1 after it failed or took too long, and was killed. */
+static int start_successor(void) {
+  int ready[2];
+  if (pipe2(ready, O_CLOEXEC) == -1) {
+    perror("Failed to reload");
+    return -1;
+  }
+  char** envp = successor_environment(ready[1]);
+  if (!envp) {
+    close(ready[0]);
+    close(ready[1]);
+    return -1;
+  }
+
+  fflush(stdout); /* Or the new generation prints it again. */
+  pid_t pid = fork();
+  if (pid == 0) {
+    /* Only async-signal-safe calls until execve(): other threads may have
+     * held locks at the fork. */
+    for (int i = 0; i < num_sockets; i++) set_cloexec(listen_sockets[i], false);
+    set_cloexec(ready[1], false);
+    if (server_cwd[0] != '\0' && chdir(server_cwd) == -1) _exit(127);
+    execvpe(server_path, server_argv, envp);
+    _exit(127);
+  }
+  successor = pid;
+  close(ready[1]);
+  free(envp);
+  if (pid == -1) {
+    perror("Failed to reload");
+    close(ready[0]);
+    return -1;
+  }
+
+  /* Carries on past the SIGCHLD handler of forkserver. */
+  struct pollfd pollfd = {.fd = ready[0], .events = POLLIN};
+  struct timespec started, now;
+  clock_gettime(CLOCK_MONOTONIC, &started);
+  int waited = 0, polled;
+  do {
+    polled = poll(&pollfd, 1, RELOAD_START_TIMEOUT_MS - waited);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    waited = (now.tv_sec - started.tv_sec) * 1000 +
+             (now.tv_nsec - started.tv_nsec) / 1000000;
+  } while (polled == -1 && errno == EINTR && waited < RELOAD_START_TIMEOUT_MS);
+  char byte;
+  bool started_up = polled == 1 && read(ready[0], &byte, 1) == 1;
+  close(ready[0]);
+  if (started_up) return 0;
+
+  fprintf(stderr, "Reload failed: pid %d did not start, carrying on\n", pid);
+  kill(pid, SIGKILL);
+  waitpid(pid, NULL, 0);
+  successor = -1;
+  return -1;
+}
+
+static void sleep_ms(int ms) {
+  struct timespec delay = {.tv_sec = ms / 1000,
+                           .tv_nsec = ms % 1000 * 1000000};
+  nanosleep(&delay, NULL);
+}
+
+/* Takes SIGHUP, starts the next generation, then drains this one. */
+static void* reload_thread(void* unused __attribute__((unused))) {
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGHUP);
+  int signum;
+  do {
+    sigwait(&set, &signum);
+  } while (start_successor() == -1);
+
+  printf("Pid %d took over, draining pid %d\n", successor, getpid());
+  fflush(stdout);
+  *draining = 1;
+  for (int waited = 0; __atomic_load_n(&holds, __ATOMIC_ACQUIRE) > 0;
+       waited += RELOAD_KICK_MS) {
+    if (waited >= server_drain_timeout * 1000) {
+      fprintf(stderr, "Drain timed out, dropping %d connections\n",
+              __atomic_load_n(&holds, __ATOMIC_ACQUIRE));
+      exit(0);
+    }
+    kick_acceptors();
+    sleep_ms(RELOAD_KICK_MS);
+  }
+  return NULL;
+}
+
+void reload_ready(int* sockets, int count, void (*kick)(void)) {
+  for (int i = 0; i < num_inherited; i++)
+    if (inherited[i] != -1) close(inherited[i]);
+  num_inherited = 0;
+
+  num_sockets = count < RELOAD_MAX_SOCKETS ? count : RELOAD_MAX_SOCKETS;
+  memcpy(listen_sockets, sockets, num_sockets * sizeof(int));
+  kick_acceptors = kick;
+
+  if (ready_fd != -1) {
+    if (write(ready_fd, "", 1) != 1) perror("Failed to report ready");
+    close(ready_fd);
+    ready_fd = -1;
+  }
+
+  pthread_t thread;
+  pthread_create(&thread, NULL, reload_thread, NULL);
+  pthread_detach(thread);
+}
+
+bool reload_draining(void) { return *draining; }
+
+void reload_allow_kick(bool allow) {
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, RELOAD_KICK_SIGNAL);
+  pthread_sigmask(allow ? SIG_UNBLOCK : SIG_BLOCK, &set, NULL);
+}
+
+pid_t reload_successor(void) { return successor; }
+
+void reload_hold(void) { __atomic_fetch_add(&holds, 1, __ATOMIC_RELEASE); }
+
+void reload_release(void) { __atomic_fetch_sub(&holds, 1, __ATOMIC_RELEASE); }
+
+void reload_wait_drained(void) {
+  while (__atomic_load_n(&holds, __ATOMIC_ACQUIRE) > 0)
+    sleep_ms(RELOAD_KICK_MS);
+}
@@ -0,0 +1,63 @@
+/*
+ * Graceful reload on SIGHUP.
+ *
+ * The server starts its next generation by executing itself again with the
+ * same command line, so an edited --config file (or a rebuilt binary) takes
+ * effect, and hands it the listening sockets: connections waiting in the
+ * backlog stay there, and none is refused while the new generation starts.
+ * Once it is listening, this generation drains: its acceptors stop, keep-alive
+ * connections close after the response in progress (idle ones when their
+ * idle timeout runs out), and the process exits when its last connection is
+ * done, or after --drain-timeout seconds. If the new generation fails to
+ * start, this one carries on as if nothing happened.
+ *
+ * Every connection is held from its accept until it is closed, as is every
+ * acceptor until it stops; the generation has drained when nothing holds it.
+ */
+
+#ifndef RELOAD_H
+#define RELOAD_H
+
+#include <signal.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+/* Remembers how the server was started and blocks SIGHUP, which only the
+ * reload thread takes. Call first, before any thread starts. */
+void reload_init(char** argv);
+
+/* Returns the listening socket the previous generation passed on for
+ * acceptor INDEX of ACCEPTORS on PORT, or -1 to open a new one. */
+int reload_inherited_socket(int index, int acceptors, int port);
+
+/* Starts waiting for SIGHUP, once the COUNT listening SOCKETS are ready, and
+ * lets the previous generation know. While draining, KICK is called every
+ * RELOAD_KICK_MS to wake acceptors blocked before they saw the news, by
+ * sending them RELOAD_KICK_SIGNAL: it interrupts accept() and the event
+ * loops' waits, as its handler is installed without SA_RESTART. */
+void reload_ready(int* sockets, int count, void (*kick)(void));
+
+#define RELOAD_KICK_MS 100
+#define RELOAD_KICK_SIGNAL SIGUSR1
+
+/* Blocks the kick signal on this thread while it serves a connection itself
+ * (httpserver, --prefork children), so no blocking read or write of the
+ * connection is interrupted; a kick sent meanwhile arrives once ALLOW is set
+ * again. */
+void reload_allow_kick(bool allow);
+
+/* Also true in the children forkserver forked before the reload. */
+bool reload_draining(void);
+
+/* The process the reload started, so a SIGCHLD handler can tell it from
+ * the server's own children. -1 if there is none. */
+pid_t reload_successor(void);
+
+/* Async-signal-safe. */
+void reload_hold(void);
+void reload_release(void);
+
+/* Waits until nothing holds the generation any more. */
+void reload_wait_drained(void);
+
+#endif
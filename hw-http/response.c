@@ -0,0 +1,248 @@
+#include "response.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "httpserver.h"
+#include "opencache.h"
+#include "stats.h"
+
+void response_init(struct response* r) {
+  memset(r, 0, sizeof(*r));
+  r->file_fd = -1;
+}
+
+bool response_body_pending(struct response* r) {
+  return (r->file_fd != -1 || r->cached) && r->file_offset < r->file_size;
+}
+
+off_t response_length(struct response* r) {
+  off_t body = response_body_pending(r) ? r->file_size - r->file_offset : 0;
+  return r->out_len + body;
+}
+
+void response_reserve(struct response* r, size_t extra) {
+  if (r->out_len + extra <= r->out_cap) return;
+
+  size_t capacity = r->out_cap ? r->out_cap : 1024;
+  while (capacity < r->out_len + extra) capacity *= 2;
+  r->out = realloc(r->out, capacity);
+  if (!r->out) {
+    fprintf(stderr, "Malloc failed\n");
+    exit(ENOBUFS);
+  }
+  r->out_cap = capacity;
+}
+
+/* Appends printf-formatted text to the output buffer of R. */
+static void response_printf(struct response* r, const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(NULL, 0, format, args);
+  va_end(args);
+
+  response_reserve(r, length + 1);
+  va_start(args, format);
+  vsnprintf(r->out + r->out_len, length + 1, format, args);
+  va_end(args);
+  r->out_len += length;
+}
+
+static void response_start(struct response* r, int status_code,
+                           char* content_type) {
+  r->status_code = status_code;
+  response_printf(r, "HTTP/1.1 %d %s\r\n", status_code,
+                  http_get_response_message(status_code));
+  response_printf(r, "Content-Type: %s\r\n", content_type);
+  response_printf(r, "Connection: %s\r\n",
+                  r->keep_alive ? "keep-alive" : "close");
+}
+
+void response_empty(struct response* r, int status_code) {
+  response_start(r, status_code, "text/html");
+  response_printf(r, "Content-Length: 0\r\n\r\n");
+}
+
+/* Queues the status line and headers of a file response with STATUS_CODE
+ * from http_file_status(). Returns whether a body should follow, which is not
+ * the case if the headers did not fit and a 500 went out instead. */
+static bool response_file_headers(struct response* r, int status_code,
+                                  char* content_type, char* encoding,
+                                  char* etag, time_t mtime, off_t size,
+                                  off_t start, off_t length) {
+  struct http_response response;
+  http_response_start(&response, status_code);
+  http_response_file_headers(&response, status_code, content_type, encoding,
+                             etag, mtime, size, start, length);
+  http_response_connection(&response, r->keep_alive);
+  if (http_response_end(&response) == -1) {
+    response_empty(r, 500);
+    return false;
+  }
+  r->status_code = status_code;
+  response_reserve(r, response.length);
+  memcpy(r->out + r->out_len, response.buffer, response.length);
+  r->out_len += response.length;
+  return status_code == 200 || status_code == 206;
+}
+
+/* Queues the response for ENTRY, whose body is sent from memory, answering
+ * the conditional and Range headers of REQUEST. Takes over the caller's
+ * reference. */
+static void response_serve_cached(struct response* r,
+                                  struct http_request* request,
+                                  struct file_cache_entry* entry) {
+  off_t start, length;
+  int status = http_file_status(request, entry->etag, entry->mtime.tv_sec,
+                                entry->size, &start, &length);
+  if (status != 200) {
+    if (!response_file_headers(r, status, entry->content_type,
+                               entry->encoding, entry->etag,
+                               entry->mtime.tv_sec, entry->size, start,
+                               length)) {
+      file_cache_release(entry);
+      return;
+    }
+  } else {
+    /* The common case, with the headers rendered already. */
+    r->status_code = 200;
+    response_reserve(r, entry->headers_length);
+    memcpy(r->out + r->out_len, entry->headers, entry->headers_length);
+    r->out_len += entry->headers_length;
+    response_printf(r, "Connection: %s\r\n\r\n",
+                    r->keep_alive ? "keep-alive" : "close");
+  }
+  r->cached = entry;
+  r->file_offset = start;
+  r->file_size = start + length;
+}
+
+/*
+ * Queues the headers for the regular file PATH, described by FILE_STAT, and
+ * arranges for its body to be sent, in the encoding negotiate_file() picks
+ * for REQUEST and from the file cache if it has the file. Conditional and
+ * Range requests are answered too.
+ */
+static void response_serve_file(struct response* r,
+                                struct http_request* request, char* path,
+                                struct stat* file_stat) {
+  char file[strlen(path) + 4];
+  char* encoding;
+  struct file_cache_entry* entry =
+      negotiate_file(request, path, file_stat, file, &encoding);
+  if (entry) {
+    response_serve_cached(r, request, entry);
+    return;
+  }
+
+  struct stat opened_stat;
+  struct open_cache_entry* handle;
+  int filedes = open_cache_open(file, &opened_stat, &handle);
+  if (filedes == -1) {
+    response_empty(r, 404);
+    return;
+  }
+
+  char etag[LIBHTTP_ETAG_SIZE];
+  off_t start, length;
+  http_format_etag(etag, opened_stat.st_size, &opened_stat.st_mtim, encoding);
+  int status = http_file_status(request, etag, opened_stat.st_mtime,
+                                opened_stat.st_size, &start, &length);
+  if (!response_file_headers(r, status, http_get_mime_type(path), encoding,
+                             etag, opened_stat.st_mtime, opened_stat.st_size,
+                             start, length)) {
+    open_cache_close(filedes, handle);
+    return;
+  }
+
+  /* The body runs from file_offset up to file_size. */
+  r->file_fd = filedes;
+  r->file_handle = handle;
+  r->file_offset = start;
+  r->file_size = start + length;
+  r->use_sendfile = true;
+}
+
+static void response_serve_directory(struct response* r,
+                                     struct http_request* request, char* path,
+                                     struct stat* dir_stat) {
+  char index_html_path[strlen(path) + strlen("/index.html") + 1];
+  struct stat index_stat;
+  http_format_index(index_html_path, path);
+  if (open_cache_stat_readable(index_html_path, &index_stat) == 0) {
+    response_serve_file(r, request, index_html_path, &index_stat);
+    return;
+  }
+
+  struct file_cache_entry* listing = file_cache_get_listing(path, dir_stat);
+  if (listing == NULL) {
+    response_empty(r, 404);
+    return;
+  }
+  response_serve_cached(r, request, listing);
+}
+
+static void response_serve_stats(struct response* r, bool json) {
+  char* body = stats_render(json);
+  size_t length = strlen(body);
+
+  response_start(r, 200, json ? "application/json" : "text/plain");
+  response_printf(r, "Content-Length: %zu\r\nCache-Control: no-store\r\n\r\n",
+                  length);
+  response_reserve(r, length);
+  memcpy(r->out + r->out_len, body, length);
+  r->out_len += length;
+  free(body);
+}
+
+void response_prepare_files(struct response* r,
+                            struct http_request* request) {
+  r->keep_alive = request->keep_alive;
+
+  bool json;
+  if (request->path[0] != '/') {
+    r->keep_alive = false;
+    response_empty(r, 400);
+  } else if (strstr(request->path, "..") != NULL) {
+    response_empty(r, 403);
+  } else if (stats_is_stats_path(request->path, &json)) {
+    response_serve_stats(r, json);
+  } else {
+    char path[2 + strlen(request->path) + 1];
+    path[0] = '.';
+    path[1] = '/';
+    memcpy(path + 2, request->path, strlen(request->path) + 1);
+
+    struct stat file_stat;
+    int status = open_cache_stat(path, &file_stat);
+    if (status == 0 && S_ISREG(file_stat.st_mode)) {
+      response_serve_file(r, request, path, &file_stat);
+    } else if (status == 0 && S_ISDIR(file_stat.st_mode)) {
+      response_serve_directory(r, request, path, &file_stat);
+    } else {
+      response_empty(r, 404);
+    }
+  }
+}
+
+void response_finish(struct response* r) {
+  r->out_len = r->out_sent = 0;
+  if (r->file_fd != -1) open_cache_close(r->file_fd, r->file_handle);
+  r->file_fd = -1;
+  r->file_handle = NULL;
+  if (r->cached) file_cache_release(r->cached);
+  r->cached = NULL;
+}
+
+void response_free(struct response* r) {
+  response_finish(r);
+  free(r->out);
+  r->out = NULL;
+  r->out_cap = 0;
+}
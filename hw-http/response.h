@@ -0,0 +1,62 @@
+/*
+ * Responses to --files requests built in memory, for the event-driven server
+ * variants (epollserver, uringserver). The blocking servers write a response
+ * as they go; a server that must not block instead prepares the headers (and
+ * any generated body) in a buffer, notes which file or cached entry the body
+ * comes from, and sends it all as its socket allows.
+ */
+
+#ifndef RESPONSE_H
+#define RESPONSE_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "filecache.h"
+#include "libhttp.h"
+#include "opencache.h"
+
+struct response {
+  /* Pending bytes: headers, generated bodies or a file chunk. */
+  char* out;
+  size_t out_len, out_sent, out_cap;
+
+  /* File sent once the output buffer drains, -1 if none. Only the bytes from
+   * file_offset to file_size are sent, for Range requests. */
+  int file_fd;
+  struct open_cache_entry* file_handle; /* To give file_fd back with. */
+  off_t file_offset, file_size;
+  bool use_sendfile; /* Cleared if the file's filesystem refuses sendfile. */
+
+  /* Cached file whose body is sent from memory instead, or NULL. */
+  struct file_cache_entry* cached;
+
+  bool keep_alive; /* Whether to read another request after this response. */
+  int status_code;
+};
+
+void response_init(struct response* r);
+
+/* Builds the response to REQUEST, as handle_files_request does for the
+ * blocking servers. */
+void response_prepare_files(struct response* r, struct http_request* request);
+
+/* Queues a complete response without a body. */
+void response_empty(struct response* r, int status_code);
+
+/* Makes room for EXTRA more bytes in the output buffer. */
+void response_reserve(struct response* r, size_t extra);
+
+/* Returns whether body bytes from the file or cache entry remain to be sent
+ * after the output buffer. */
+bool response_body_pending(struct response* r);
+
+/* Returns the length of the response as prepared, headers included. Only
+ * meaningful before any of it is sent. */
+off_t response_length(struct response* r);
+
+/* Forgets the response just sent, so the next one can be built. */
+void response_finish(struct response* r);
+void response_free(struct response* r);
+
+#endif
@@ -0,0 +1,337 @@
+#include "stats.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Values below 2^(SUB_BITS+1) ns get a bucket each; every later power of two
+ * is split into 2^SUB_BITS buckets. */
+#define SUB_BITS 2
+#define SUB_BUCKETS (1 << SUB_BITS)
+#define LINEAR_BUCKETS (2 * SUB_BUCKETS)
+#define HISTOGRAM_BUCKETS (LINEAR_BUCKETS + (64 - SUB_BITS - 1) * SUB_BUCKETS)
+
+/* The queue wait is timed per fd; higher fds are not timed. */
+#define STATS_MAX_FDS 65536
+
+struct stats_histogram {
+  uint64_t counts[HISTOGRAM_BUCKETS];
+  uint64_t total, sum, max;
+};
+
+/* Owned and written by a single thread; read by whoever renders. */
+struct stats_thread {
+  struct stats_histogram stages[STATS_NUM_STAGES];
+  uint64_t responses[6]; /* By status class, index 0 for anything odd. */
+  uint64_t connections;
+  uint64_t pending[STATS_NUM_STAGES]; /* Stage times of the current request. */
+  struct stats_thread* next;      /* In all_threads. */
+  struct stats_thread* next_free; /* In free_threads, once its thread exits. */
+};
+
+/* Every block ever handed out, and those of exited threads. */
+static struct stats_thread* all_threads;
+static struct stats_thread* free_threads;
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t thread_key;
+static pthread_once_t thread_key_once = PTHREAD_ONCE_INIT;
+static __thread struct stats_thread* local;
+
+static int queue_depth, queue_max_depth;
+static int pool_threads, pool_max_threads;
+static uint64_t pool_events[STATS_POOL_NUM_EVENTS];
+static uint64_t admission_shed, admission_pauses, admission_paused_ns;
+static uint64_t enqueued_at[STATS_MAX_FDS];
+static uint64_t started_at;
+
+static char* stage_names[STATS_NUM_STAGES] = {
+    "accept", "queue_wait", "parse", "open", "send", "request",
+};
+
+uint64_t stats_now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* An exiting thread's block is reused by the next new thread, so the
+ * per-connection threads of threadserver do not pile up blocks. Its counts
+ * stay in the totals. */
+static void stats_thread_exit(void* block) {
+  struct stats_thread* stats = block;
+  pthread_mutex_lock(&threads_lock);
+  stats->next_free = free_threads;
+  free_threads = stats;
+  pthread_mutex_unlock(&threads_lock);
+}
+
+static void stats_make_key(void) {
+  pthread_key_create(&thread_key, stats_thread_exit);
+  started_at = stats_now();
+}
+
+/* Hands out this thread's block. Blocks are never freed, and a reused block
+ * keeps its place in all_threads. */
+static struct stats_thread* stats_local(void) {
+  if (local) return local;
+  pthread_once(&thread_key_once, stats_make_key);
+
+  pthread_mutex_lock(&threads_lock);
+  if (free_threads) {
+    local = free_threads;
+    free_threads = local->next_free;
+  } else {
+    local = calloc(1, sizeof(*local));
+    if (!local) {
+      fprintf(stderr, "Malloc failed\n");
+      exit(1);
+    }
+    /* Published with a release store so a renderer never sees a half-made
+     * block. */
+    local->next = all_threads;
+    __atomic_store_n(&all_threads, local, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&threads_lock);
+  pthread_setspecific(thread_key, local);
+  return local;
+}
+
+static int histogram_index(uint64_t value) {
+  if (value < LINEAR_BUCKETS) return value;
+  int exponent = 63 - __builtin_clzll(value);
+  int shift = exponent - SUB_BITS;
+  return LINEAR_BUCKETS + (exponent - SUB_BITS - 1) * SUB_BUCKETS +
+         (int)((value >> shift) - SUB_BUCKETS);
+}
+
+static uint64_t histogram_bucket_max(int index) {
+  if (index < LINEAR_BUCKETS) return index;
+  int exponent = (index - LINEAR_BUCKETS) / SUB_BUCKETS + SUB_BITS + 1;
+  int shift = exponent - SUB_BITS;
+  uint64_t sub = (index - LINEAR_BUCKETS) % SUB_BUCKETS + SUB_BUCKETS;
+  return ((sub + 1) << shift) - 1;
+}
+
+/* Single-writer increment; relaxed atomics keep concurrent readers sane. */
+static void bump(uint64_t* counter, uint64_t amount) {
+  __atomic_store_n(counter, *counter + amount, __ATOMIC_RELAXED);
+}
+
+void stats_record(enum stats_stage stage, uint64_t nanoseconds) {
+  struct stats_histogram* histogram = &stats_local()->stages[stage];
+  bump(&histogram->counts[histogram_index(nanoseconds)], 1);
+  bump(&histogram->total, 1);
+  bump(&histogram->sum, nanoseconds);
+  if (nanoseconds > histogram->max)
+    __atomic_store_n(&histogram->max, nanoseconds, __ATOMIC_RELAXED);
+}
+
+void stats_add(enum stats_stage stage, uint64_t nanoseconds) {
+  stats_local()->pending[stage] += nanoseconds;
+}
+
+void stats_count_response(int status_code) {
+  int class = status_code / 100;
+  bump(&stats_local()->responses[class >= 1 && class <= 5 ? class : 0], 1);
+}
+
+void stats_request_done(int status_code) {
+  struct stats_thread* stats = stats_local();
+  for (int stage = STATS_PARSE; stage < STATS_NUM_STAGES; stage++) {
+    stats_record(stage, stats->pending[stage]);
+    stats->pending[stage] = 0;
+  }
+  stats_count_response(status_code);
+}
+
+void stats_count_connection(void) { bump(&stats_local()->connections, 1); }
+
+void stats_enqueued(int fd) {
+  if (fd >= 0 && fd < STATS_MAX_FDS) enqueued_at[fd] = stats_now();
+  int depth = __atomic_add_fetch(&queue_depth, 1, __ATOMIC_RELAXED);
+  int max = __atomic_load_n(&queue_max_depth, __ATOMIC_RELAXED);
+  while (depth > max &&
+         !__atomic_compare_exchange_n(&queue_max_depth, &max, depth, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    continue;
+}
+
+/* The queue itself orders this after the matching stats_enqueued(). */
+uint64_t stats_dequeued(int fd) {
+  __atomic_sub_fetch(&queue_depth, 1, __ATOMIC_RELAXED);
+  if (fd < 0 || fd >= STATS_MAX_FDS) return 0;
+  uint64_t wait = stats_now() - enqueued_at[fd];
+  stats_record(STATS_QUEUE_WAIT, wait);
+  return wait;
+}
+
+/* Shared by every acceptor's pool; resizing is rare enough for atomics. */
+void stats_pool_threads(int delta) {
+  int threads = __atomic_add_fetch(&pool_threads, delta, __ATOMIC_RELAXED);
+  int max = __atomic_load_n(&pool_max_threads, __ATOMIC_RELAXED);
+  while (threads > max &&
+         !__atomic_compare_exchange_n(&pool_max_threads, &max, threads, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    continue;
+}
+
+void stats_pool_event(enum stats_pool_event event) {
+  __atomic_add_fetch(&pool_events[event], 1, __ATOMIC_RELAXED);
+}
+
+void stats_admission_shed(void) {
+  __atomic_add_fetch(&admission_shed, 1, __ATOMIC_RELAXED);
+}
+
+void stats_admission_paused(uint64_t nanoseconds) {
+  __atomic_add_fetch(&admission_pauses, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&admission_paused_ns, nanoseconds, __ATOMIC_RELAXED);
+}
+
+/* A growable output string. */
+struct output {
+  char* text;
+  size_t length, capacity;
+};
+
+static void output_printf(struct output* out, const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(NULL, 0, format, args);
+  va_end(args);
+
+  if (out->length + length + 1 > out->capacity) {
+    while (out->length + length + 1 > out->capacity)
+      out->capacity = out->capacity ? 2 * out->capacity : 4096;
+    out->text = realloc(out->text, out->capacity);
+    if (!out->text) {
+      fprintf(stderr, "Malloc failed\n");
+      exit(1);
+    }
+  }
+  va_start(args, format);
+  vsnprintf(out->text + out->length, length + 1, format, args);
+  va_end(args);
+  out->length += length;
+}
+
+static uint64_t load(uint64_t* counter) {
+  return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+/* Upper bound of the bucket holding the PERCENTILE-th sample. */
+static uint64_t histogram_percentile(struct stats_histogram* histogram,
+                                     double percentile) {
+  uint64_t rank = (uint64_t)(percentile / 100.0 * histogram->total + 0.5);
+  if (rank < 1) rank = 1;
+  uint64_t seen = 0;
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    seen += histogram->counts[i];
+    if (seen >= rank) {
+      uint64_t value = histogram_bucket_max(i);
+      return value < histogram->max ? value : histogram->max;
+    }
+  }
+  return histogram->max;
+}
+
+char* stats_render(bool json) {
+  struct stats_histogram stages[STATS_NUM_STAGES];
+  uint64_t responses[6] = {0};
+  uint64_t connections = 0;
+  memset(stages, 0, sizeof(stages));
+
+  stats_local(); /* Makes sure started_at is set. */
+  for (struct stats_thread* t = __atomic_load_n(&all_threads, __ATOMIC_ACQUIRE);
+       t; t = t->next) {
+    for (int s = 0; s < STATS_NUM_STAGES; s++) {
+      for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+        stages[s].counts[i] += load(&t->stages[s].counts[i]);
+      stages[s].total += load(&t->stages[s].total);
+      stages[s].sum += load(&t->stages[s].sum);
+      uint64_t max = load(&t->stages[s].max);
+      if (max > stages[s].max) stages[s].max = max;
+    }
+    for (int i = 0; i < 6; i++) responses[i] += load(&t->responses[i]);
+    connections += load(&t->connections);
+  }
+
+  uint64_t requests = 0;
+  for (int i = 0; i < 6; i++) requests += responses[i];
+  double uptime = (stats_now() - started_at) / 1e9;
+  int depth = __atomic_load_n(&queue_depth, __ATOMIC_RELAXED);
+  int max_depth = __atomic_load_n(&queue_max_depth, __ATOMIC_RELAXED);
+  int threads = __atomic_load_n(&pool_threads, __ATOMIC_RELAXED);
+  int max_threads = __atomic_load_n(&pool_max_threads, __ATOMIC_RELAXED);
+  uint64_t events[STATS_POOL_NUM_EVENTS];
+  for (int i = 0; i < STATS_POOL_NUM_EVENTS; i++)
+    events[i] = load(&pool_events[i]);
+  uint64_t shed = load(&admission_shed);
+  uint64_t pauses = load(&admission_pauses);
+  double paused_ms = load(&admission_paused_ns) / 1e6;
+
+  struct output out = {NULL, 0, 0};
+  if (json) {
+    output_printf(&out,
+                  "{\"uptime_s\":%.3f,\"connections\":%lu,\"requests\":%lu,"
+                  "\"responses\":{\"1xx\":%lu,\"2xx\":%lu,\"3xx\":%lu,"
+                  "\"4xx\":%lu,\"5xx\":%lu,\"other\":%lu},"
+                  "\"queue\":{\"depth\":%d,\"max_depth\":%d},"
+                  "\"pool\":{\"threads\":%d,\"max_threads\":%d,"
+                  "\"grown_on_depth\":%lu,\"grown_on_wait\":%lu,"
+                  "\"retired\":%lu},"
+                  "\"admission\":{\"shed\":%lu,\"pauses\":%lu,"
+                  "\"paused_ms\":%.1f},\"stages_us\":{",
+                  uptime, connections, requests, responses[1], responses[2],
+                  responses[3], responses[4], responses[5], responses[0],
+                  depth, max_depth, threads, max_threads,
+                  events[STATS_POOL_GROW_DEPTH], events[STATS_POOL_GROW_WAIT],
+                  events[STATS_POOL_RETIRE], shed, pauses, paused_ms);
+  } else {
+    output_printf(&out,
+                  "uptime %.3f s\nconnections %lu\nrequests %lu\n"
+                  "responses 1xx %lu 2xx %lu 3xx %lu 4xx %lu 5xx %lu other "
+                  "%lu\nqueue depth %d max %d\n"
+                  "pool threads %d max %d grown on depth %lu on wait %lu "
+                  "retired %lu\n"
+                  "admission shed %lu paused %lu times for %.1f ms\n\n"
+                  "%-10s %10s %10s %10s %10s %10s %10s\n",
+                  uptime, connections, requests, responses[1], responses[2],
+                  responses[3], responses[4], responses[5], responses[0],
+                  depth, max_depth, threads, max_threads,
+                  events[STATS_POOL_GROW_DEPTH], events[STATS_POOL_GROW_WAIT],
+                  events[STATS_POOL_RETIRE], shed, pauses, paused_ms,
+                  "stage (us)", "count", "mean", "p50", "p90", "p99", "max");
+  }
+
+  for (int s = 0; s < STATS_NUM_STAGES; s++) {
+    struct stats_histogram* h = &stages[s];
+    double mean = h->total ? h->sum / 1e3 / h->total : 0;
+    double p50 = h->total ? histogram_percentile(h, 50) / 1e3 : 0;
+    double p90 = h->total ? histogram_percentile(h, 90) / 1e3 : 0;
+    double p99 = h->total ? histogram_percentile(h, 99) / 1e3 : 0;
+    if (json)
+      output_printf(&out,
+                    "%s\"%s\":{\"count\":%lu,\"mean\":%.1f,\"p50\":%.1f,"
+                    "\"p90\":%.1f,\"p99\":%.1f,\"max\":%.1f}",
+                    s ? "," : "", stage_names[s], h->total, mean, p50, p90,
+                    p99, h->max / 1e3);
+    else
+      output_printf(&out, "%-10s %10lu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+                    stage_names[s], h->total, mean, p50, p90, p99,
+                    h->max / 1e3);
+  }
+  if (json) output_printf(&out, "}}\n");
+  return out.text;
+}
+
+bool stats_is_stats_path(char* path, bool* json) {
+  size_t length = strlen(STATS_PATH);
+  if (strncmp(path, STATS_PATH, length) != 0) return false;
+  *json = strcmp(path + length, ".json") == 0 ||
+          strcmp(path + length, "?format=json") == 0;
+  return path[length] == '\0' || *json;
+}
@@ -0,0 +1,77 @@
+/*
+ * Server metrics, served on the reserved path /__stats (text) and
+ * /__stats.json.
+ *
+ * Every thread updates its own block of counters and latency histograms with
+ * plain relaxed stores, so recording a sample never takes a lock or bounces a
+ * cache line between cores; a /__stats request sums the blocks of all
+ * threads. Histograms have four buckets per power of two nanoseconds, which
+ * is plenty to tell queueing delay from service time.
+ *
+ * Blocking handlers time the stages of a request with stats_add(), possibly
+ * in several pieces, and call stats_request_done() once the response is out.
+ * The event loop, which interleaves requests on one thread, records complete
+ * samples with stats_record() instead.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define STATS_PATH "/__stats"
+
+enum stats_stage {
+  STATS_ACCEPT,     /* Handing an accepted connection off to its handler. */
+  STATS_QUEUE_WAIT, /* In the work queue, from push to pop (poolserver). */
+  STATS_PARSE,      /* Parsing the request line and headers. */
+  STATS_OPEN,       /* stat(), open() or the file cache lookup. */
+  STATS_SEND,       /* Writing the response. */
+  STATS_REQUEST,    /* From the parsed request to the response being sent. */
+  STATS_NUM_STAGES,
+};
+
+/* Monotonic clock in nanoseconds. */
+uint64_t stats_now(void);
+
+void stats_record(enum stats_stage stage, uint64_t nanoseconds);
+void stats_add(enum stats_stage stage, uint64_t nanoseconds);
+void stats_request_done(int status_code);
+
+/* For the event loop, which records its stages directly. */
+void stats_count_response(int status_code);
+
+void stats_count_connection(void);
+
+/* Work queue depth, and the queue wait of the connection FD. Returns the
+ * wait in nanoseconds, 0 if FD is not timed. */
+void stats_enqueued(int fd);
+uint64_t stats_dequeued(int fd);
+
+/* Why the worker pool changed size (poolserver --max-threads). */
+enum stats_pool_event {
+  STATS_POOL_GROW_DEPTH, /* Sockets were queued with no worker idle. */
+  STATS_POOL_GROW_WAIT,  /* A socket waited too long in the queue. */
+  STATS_POOL_RETIRE,     /* A surplus worker stayed idle too long. */
+  STATS_POOL_NUM_EVENTS,
+};
+
+/* Counts worker threads started (DELTA 1) or retired (-1). */
+void stats_pool_threads(int delta);
+void stats_pool_event(enum stats_pool_event event);
+
+/* Admission control at the pool queue (poolserver --queue-high): a
+ * connection turned away with a 503, and accept() held back for NANOSECONDS
+ * while the queue drained. */
+void stats_admission_shed(void);
+void stats_admission_paused(uint64_t nanoseconds);
+
+/* Renders the metrics as text or JSON into a new malloc()ed string. */
+char* stats_render(bool json);
+
+/* Returns whether PATH (as requested) names the metrics endpoint; sets *JSON
+ * for the JSON flavour. */
+bool stats_is_stats_path(char* path, bool* json);
+
+#endif
@@ -0,0 +1,93 @@
+#include "timerwheel.h"
+
+#include <stddef.h>
+#include <time.h>
+
+#include "utlist.h"
+
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+/* Ticks the wheel spans; later timers are clamped to its last tick. */
+#define TIMER_WHEEL_SPAN (1ull << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+uint64_t timer_ticks(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return ((uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000) /
+         TIMER_TICK_MS;
+}
+
+void timer_wheel_init(struct timer_wheel* wheel) {
+  wheel->now = timer_ticks();
+  wheel->armed = 0;
+  for (int level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    for (int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++)
+      wheel->slots[level][slot] = NULL;
+}
+
+/* Puts TIMER, due no earlier than the current tick, in its slot: the lowest
+ * level whose span covers the wait. */
+static void timer_insert(struct timer_wheel* wheel, struct timer* timer) {
+  uint64_t delta = timer->expires - wheel->now;
+  if (delta >= TIMER_WHEEL_SPAN) {
+    timer->expires = wheel->now + TIMER_WHEEL_SPAN - 1;
+    delta = TIMER_WHEEL_SPAN - 1;
+  }
+  int level = 0;
+  while (delta >= 1ull << (TIMER_WHEEL_BITS * (level + 1))) level++;
+  int slot = (timer->expires >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+  timer->slot = &wheel->slots[level][slot];
+  DL_APPEND(*timer->slot, timer);
+}
+
+bool timer_armed(struct timer* timer) { return timer->slot != NULL; }
+
+void timer_cancel(struct timer_wheel* wheel, struct timer* timer) {
+  if (!timer->slot) return;
+  DL_DELETE(*timer->slot, timer);
+  timer->slot = NULL;
+  wheel->armed--;
+}
+
+void timer_arm(struct timer_wheel* wheel, struct timer* timer, int seconds) {
+  timer_cancel(wheel, timer);
+  timer->expires = timer_ticks() + (uint64_t)seconds * 1000 / TIMER_TICK_MS;
+  /* The current tick has run already. */
+  if (timer->expires <= wheel->now) timer->expires = wheel->now + 1;
+  timer_insert(wheel, timer);
+  wheel->armed++;
+}
+
+/* Moves the timers of slot SLOT of LEVEL down to where they now belong. */
+static void timer_cascade(struct timer_wheel* wheel, int level, int slot) {
+  struct timer* list = wheel->slots[level][slot];
+  wheel->slots[level][slot] = NULL;
+  struct timer *timer, *next;
+  DL_FOREACH_SAFE(list, timer, next) timer_insert(wheel, timer);
+}
+
+void timer_wheel_advance(struct timer_wheel* wheel,
+                         void (*expire)(struct timer* timer)) {
+  uint64_t target = timer_ticks();
+  if (wheel->armed == 0) {
+    wheel->now = target > wheel->now ? target : wheel->now;
+    return;
+  }
+
+  while (wheel->now < target) {
+    uint64_t now = ++wheel->now;
+    for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+      if ((now >> (TIMER_WHEEL_BITS * (level - 1))) & TIMER_WHEEL_MASK) break;
+      timer_cascade(wheel, level,
+                    (now >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK);
+    }
+
+    struct timer** due = &wheel->slots[0][now & TIMER_WHEEL_MASK];
+    while (*due) {
+      struct timer* timer = *due;
+      DL_DELETE(*due, timer);
+      timer->slot = NULL;
+      wheel->armed--;
+      expire(timer);
+    }
+  }
+}
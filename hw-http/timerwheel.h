@@ -0,0 +1,56 @@
+/*
+ * Hierarchical timer wheel for the per-connection deadlines of the event
+ * loops (epollserver, uringserver).
+ *
+ * Time is counted in ticks of TIMER_TICK_MS. The wheel has TIMER_WHEEL_LEVELS
+ * levels of TIMER_WHEEL_SLOTS slots each: a timer due within 64 ticks sits in
+ * the slot of its tick on level 0, one due within 64 * 64 ticks in a slot of
+ * 64 ticks on level 1, and so on. Whenever level 0 comes round, the next slot
+ * of level 1 is spread over it (and likewise up the levels), so every timer
+ * reaches level 0 by the time it is due. Arming, re-arming and cancelling a
+ * timer are O(1) list operations, however many connections there are, and a
+ * tick only looks at the timers that are due or cascade.
+ *
+ * Timers are embedded in the structure they time, and a wheel belongs to a
+ * single thread.
+ */
+
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TIMER_TICK_MS 100
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4
+
+struct timer {
+  uint64_t expires;     /* The tick the timer is due at. */
+  struct timer** slot;  /* The list it is in, NULL while not armed. */
+  struct timer *prev, *next;
+};
+
+struct timer_wheel {
+  uint64_t now; /* The last tick run. */
+  int armed;    /* Timers in the wheel. */
+  struct timer* slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+};
+
+/* The monotonic clock in ticks. */
+uint64_t timer_ticks(void);
+
+void timer_wheel_init(struct timer_wheel* wheel);
+
+/* Arms TIMER to expire SECONDS from now, re-arming it if it is armed. */
+void timer_arm(struct timer_wheel* wheel, struct timer* timer, int seconds);
+void timer_cancel(struct timer_wheel* wheel, struct timer* timer);
+bool timer_armed(struct timer* timer);
+
+/* Runs the ticks up to now, calling EXPIRE on every timer due, which is
+ * disarmed first and may be armed again. */
+void timer_wheel_advance(struct timer_wheel* wheel,
+                         void (*expire)(struct timer* timer));
+
+#endif
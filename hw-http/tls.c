@@ -0,0 +1,263 @@
+#include "tls.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#ifdef HTTP_TLS
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <string.h>
+
+#define TLS_RECORD_SIZE 16384 /* The largest record TLS allows. */
+
+struct tls_conn {
+  int fd;
+  SSL* ssl;
+  bool ktls_send, ktls_recv; /* The kernel keys that direction. */
+  size_t staged;             /* Bytes of output waiting in buffer. */
+  char buffer[TLS_RECORD_SIZE];
+};
+
+static SSL_CTX* ctx;
+static bool warned_no_ktls;
+
+/* The protocols offered by ALPN, most preferred first. */
+static const unsigned char alpn_protocols[] = "\x02h2\x08http/1.1";
+
+/* The connection the calling thread is serving, if it is a TLS one. */
+static __thread struct tls_conn* current;
+
+/* Picks the first of alpn_protocols the client offers too. A client that
+ * offers none of them gets no ALPN answer and is spoken to as HTTP/1.1. */
+static int tls_select_alpn(SSL* ssl, const unsigned char** out,
+                           unsigned char* out_length,
+                           const unsigned char* in, unsigned int in_length,
+                           void* arg) {
+  (void)ssl;
+  (void)arg;
+  unsigned char* selected;
+  if (SSL_select_next_proto(&selected, out_length, alpn_protocols,
+                            sizeof(alpn_protocols) - 1, in,
+                            in_length) != OPENSSL_NPN_NEGOTIATED)
+    return SSL_TLSEXT_ERR_NOACK;
+  *out = selected;
+  return SSL_TLSEXT_ERR_OK;
+}
+
+void tls_init(char* cert_file, char* key_file) {
+  ctx = SSL_CTX_new(TLS_server_method());
+  if (!ctx) {
+    ERR_print_errors_fp(stderr);
+    exit(ENOMEM);
+  }
+  SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+  /* A client that hangs up without close_notify is an ordinary end of the
+   * connection, as it is for plain HTTP. */
+  SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS | SSL_OP_NO_RENEGOTIATION |
+                               SSL_OP_IGNORE_UNEXPECTED_EOF);
+  /* Stateless tickets only: forkserver's children would not share a session
+   * cache, and the threads need not lock one. */
+  SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+  SSL_CTX_set_session_id_context(ctx, (const unsigned char*)"httpserver",
+                                 strlen("httpserver"));
+  SSL_CTX_set_alpn_select_cb(ctx, tls_select_alpn, NULL);
+
+  if (SSL_CTX_use_certificate_chain_file(ctx, cert_file) != 1 ||
+      SSL_CTX_use_PrivateKey_file(ctx, key_file, SSL_FILETYPE_PEM) != 1 ||
+      SSL_CTX_check_private_key(ctx) != 1) {
+    fprintf(stderr, "Failed to load %s and %s\n", cert_file, key_file);
+    ERR_print_errors_fp(stderr);
+    exit(EINVAL);
+  }
+}
+
+bool tls_enabled(void) { return ctx != NULL; }
+
+int tls_accept(int fd) {
+  struct tls_conn* c = malloc(sizeof(*c));
+  if (!c) return -1;
+  c->ssl = SSL_new(ctx);
+  if (!c->ssl || SSL_set_fd(c->ssl, fd) != 1) goto fail;
+  ERR_clear_error();
+  if (SSL_accept(c->ssl) != 1) goto fail;
+
+  c->fd = fd;
+  c->ktls_send = BIO_get_ktls_send(SSL_get_wbio(c->ssl));
+  c->ktls_recv = BIO_get_ktls_recv(SSL_get_rbio(c->ssl));
+  c->staged = 0;
+  if (!c->ktls_send && !__atomic_exchange_n(&warned_no_ktls, true,
+                                            __ATOMIC_RELAXED))
+    fprintf(stderr, "No kernel TLS, encrypting in user space\n");
+  current = c;
+  return 0;
+
+fail:
+  ERR_clear_error();
+  SSL_free(c->ssl);
+  free(c);
+  return -1;
+}
+
+/* Writes out the staged output. */
+static int tls_flush(struct tls_conn* c) {
+  size_t done = 0;
+  while (done < c->staged) {
+    size_t n;
+    ERR_clear_error();
+    if (SSL_write_ex(c->ssl, c->buffer + done, c->staged - done, &n) != 1) {
+      /* An interrupted write is retried with the same bytes. */
+      if (SSL_get_error(c->ssl, 0) == SSL_ERROR_WANT_WRITE && errno == EINTR)
+        continue;
+      c->staged = 0;
+      return -1;
+    }
+    done += n;
+  }
+  c->staged = 0;
+  return 0;
+}
+
+bool tls_negotiated_h2(int fd) {
+  struct tls_conn* c = current;
+  if (!c || c->fd != fd) return false;
+  const unsigned char* protocol;
+  unsigned int length;
+  SSL_get0_alpn_selected(c->ssl, &protocol, &length);
+  return length == 2 && memcmp(protocol, "h2", 2) == 0;
+}
+
+void tls_close(int fd) {
+  struct tls_conn* c = current;
+  if (!c || c->fd != fd) return;
+  if (c->staged > 0) tls_flush(c);
+  /* Only sends ours; the client's close_notify is not waited for. */
+  ERR_clear_error();
+  SSL_shutdown(c->ssl);
+  SSL_free(c->ssl);
+  free(c);
+  current = NULL;
+}
+
+bool tls_wraps_reads(int fd) {
+  return current && current->fd == fd && !current->ktls_recv;
+}
+
+bool tls_wraps_writes(int fd) {
+  return current && current->fd == fd && !current->ktls_send;
+}
+
+ssize_t tls_read(int fd, void* buf, size_t count) {
+  (void)fd;
+  struct tls_conn* c = current;
+  if (c->staged > 0 && tls_flush(c) == -1) return -1;
+
+  size_t n;
+  ERR_clear_error();
+  if (SSL_read_ex(c->ssl, buf, count, &n) == 1) return n;
+  switch (SSL_get_error(c->ssl, 0)) {
+    case SSL_ERROR_ZERO_RETURN:
+      return 0;
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+      /* EINTR, or EAGAIN once SO_RCVTIMEO runs out, as for read(). */
+      return -1;
+    case SSL_ERROR_SYSCALL:
+      if (errno == 0) return 0;
+      return -1;
+    default:
+      errno = EPROTO;
+      return -1;
+  }
+}
+
+ssize_t tls_sendv(int fd, struct iovec* iov, int iovcnt, bool more) {
+  (void)fd;
+  struct tls_conn* c = current;
+  size_t total = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    const char* data = iov[i].iov_base;
+    size_t length = iov[i].iov_len;
+    total += length;
+    while (length > 0) {
+      size_t n = TLS_RECORD_SIZE - c->staged;
+      if (n > length) n = length;
+      memcpy(c->buffer + c->staged, data, n);
+      c->staged += n;
+      data += n;
+      length -= n;
+      if (c->staged == TLS_RECORD_SIZE && tls_flush(c) == -1) return -1;
+    }
+  }
+  if (!more && c->staged > 0 && tls_flush(c) == -1) return -1;
+  return total;
+}
+
+ssize_t tls_send_file(int fd, int filedes, off_t offset, size_t count) {
+  (void)fd;
+  struct tls_conn* c = current;
+  size_t sent = 0;
+  while (sent < count) {
+    if (c->staged == TLS_RECORD_SIZE && tls_flush(c) == -1) return -1;
+    size_t want = TLS_RECORD_SIZE - c->staged;
+    if (want > count - sent) want = count - sent;
+    ssize_t n = pread(filedes, c->buffer + c->staged, want, offset + sent);
+    if (n < 0 && errno == ESPIPE)
+      n = read(filedes, c->buffer + c->staged, want);
+    if (n <= 0) break;
+    c->staged += n;
+    sent += n;
+  }
+  if (c->staged > 0 && tls_flush(c) == -1) return -1;
+  return sent > 0 || count == 0 ? (ssize_t)sent : -1;
+}
+
+#else
+
+void tls_init(char* cert_file, char* key_file) {
+  (void)cert_file;
+  (void)key_file;
+  fprintf(stderr, "Built without TLS; rebuild with `make TLS=1`\n");
+  exit(ENOSYS);
+}
+
+bool tls_enabled(void) { return false; }
+int tls_accept(int fd) {
+  (void)fd;
+  return -1;
+}
+bool tls_negotiated_h2(int fd) {
+  (void)fd;
+  return false;
+}
+void tls_close(int fd) { (void)fd; }
+bool tls_wraps_reads(int fd) {
+  (void)fd;
+  return false;
+}
+bool tls_wraps_writes(int fd) {
+  (void)fd;
+  return false;
+}
+
+ssize_t tls_read(int fd, void* buf, size_t count) {
+  return read(fd, buf, count);
+}
+
+ssize_t tls_sendv(int fd, struct iovec* iov, int iovcnt, bool more) {
+  (void)more;
+  return writev(fd, iov, iovcnt);
+}
+
+ssize_t tls_send_file(int fd, int filedes, off_t offset, size_t count) {
+  (void)fd;
+  (void)filedes;
+  (void)offset;
+  (void)count;
+  errno = ENOSYS;
+  return -1;
+}
+
+#endif
@@ -0,0 +1,59 @@
+/*
+ * HTTPS for --files, with --tls-cert and --tls-key (`make TLS=1`, OpenSSL).
+ *
+ * The handshake runs on the thread serving the connection, at the start of
+ * handle_files_request(), so only the blocking variants (httpserver,
+ * forkserver, threadserver, poolserver) speak TLS.
+ *
+ * Where the kernel has kernel TLS ("tls" TCP ULP), OpenSSL hands it the
+ * session keys once the handshake is done and the socket encrypts whatever is
+ * written to it: libhttp keeps sending with sendmsg() and sendfile(), so
+ * static files still go out without a copy through user space. Without it,
+ * or for the direction the kernel does not offer, libhttp routes the bytes
+ * through tls_read(), tls_sendv() and tls_send_file() instead.
+ *
+ * ALPN offers "h2" ahead of "http/1.1", and a connection that picks it is
+ * served by http2.h.
+ *
+ * Sessions resume from tickets, TLS 1.3 or 1.2. The ticket keys belong to the
+ * one SSL_CTX made by tls_init() before any acceptor starts or child is
+ * forked, so a ticket issued by any thread or process of the server is good
+ * for all of them.
+ */
+
+#ifndef TLS_H
+#define TLS_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/* Loads the certificate chain and private key; exits if they are unusable. */
+void tls_init(char* cert_file, char* key_file);
+bool tls_enabled(void);
+
+/* Runs the server handshake on FD, a blocking socket, and makes FD this
+ * thread's TLS connection. Returns 0, or -1 if the handshake failed. */
+int tls_accept(int fd);
+
+/* Whether the client of FD, just accepted, picked HTTP/2 by ALPN. */
+bool tls_negotiated_h2(int fd);
+
+/* Sends close_notify and forgets FD's session. */
+void tls_close(int fd);
+
+/* Whether the calling thread has to read from, or write to, FD through
+ * OpenSSL rather than the socket. */
+bool tls_wraps_reads(int fd);
+bool tls_wraps_writes(int fd);
+
+/* read() and http_sendv() for FD. Output is gathered into records of up to
+ * 16 KB; with MORE it is held back for the next call, so that headers share
+ * a record with the start of the body. */
+ssize_t tls_read(int fd, void* buf, size_t count);
+ssize_t tls_sendv(int fd, struct iovec* iov, int iovcnt, bool more);
+
+/* http_send_file() for FD, through the same record buffer. */
+ssize_t tls_send_file(int fd, int filedes, off_t offset, size_t count);
+
+#endif
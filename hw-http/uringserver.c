@@ -0,0 +1,633 @@
+/*
+ * io_uring server variant (URINGSERVER), for --files only.
+ *
+ * Like epollserver, one thread owns every connection of its acceptor, but
+ * instead of waiting for readiness and then making the syscalls itself it
+ * queues the operations on an io_uring and collects their results, so a
+ * single io_uring_enter() per loop iteration submits and reaps the work of
+ * every connection:
+ *
+ *   - The listening socket has one multishot accept outstanding, which
+ *     installs each new connection straight into the ring's fixed file
+ *     table. The connection's slot in that table is also its index in the
+ *     connection slab, and later operations on it skip the fd lookup.
+ *   - The slab is registered as a fixed buffer, so requests are read into the
+ *     connections' http_reader buffers without the kernel pinning pages for
+ *     every read. Without the memlock allowance for that, plain reads are used.
+ *   - Headers and cached bodies go out in one sendmsg; other files are
+ *     spliced file -> pipe -> socket by a linked pair of operations.
+ *   - Each connection has a timer in the loop's timer wheel, which closes it
+ *     once it has been idle for server_idle_timeout seconds or has taken
+ *     server_request_timeout seconds to send a request's headers. A timeout
+ *     operation ticks the wheel while any timer is running.
+ *
+ * Each acceptor holds up to URING_MAX_CONNS connections. Accept is re-armed
+ * as slots free up, but the kernel must accept a connection before it finds
+ * the table full, so one accepted in a burst past the limit is closed right
+ * away, much as nginx does past worker_connections. Use more --acceptors for
+ * more connections.
+ *
+ * A reload that drains the server cancels the accept; the loop returns once
+ * the connections it has are closed, each after the response in progress.
+ *
+ * Only the stat()/open() of the file being served stay synchronous, as they
+ * are for epollserver; the file cache takes most of them away. Needs Linux
+ * 6.0 or later. Speaks to the kernel through the raw syscalls, so no liburing
+ * is required.
+ */
+
+#ifdef URINGSERVER
+
+#define _GNU_SOURCE /* pipe2() */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "accesslog.h"
+#include "httpserver.h"
+#include "libhttp.h"
+#include "reload.h"
+#include "response.h"
+#include "stats.h"
+#include "timerwheel.h"
+
+/* Connections per acceptor, which is also the size of the fixed file table. */
+#define URING_MAX_CONNS 1024
+#define URING_ENTRIES 2048
+#define FILE_CHUNK_SIZE 16384
+#define PIPE_CHUNK_SIZE 65536 /* The default pipe capacity. */
+
+/* Operations, kept in the low byte of user_data; the slot is above it. */
+enum uring_op {
+  OP_ACCEPT,
+  OP_TIMEOUT,
+  OP_CLOSE,
+  OP_CANCEL,
+  OP_READ,       /* Request bytes into the reader. */
+  OP_SEND,       /* Output buffer and cached body. */
+  OP_SPLICE_IN,  /* File to pipe. */
+  OP_SPLICE_OUT, /* Pipe to socket. */
+  OP_FILE_READ,  /* File to output buffer, where splice is refused. */
+};
+
+enum conn_state {
+  CONN_FREE,
+  CONN_READ_REQUEST,  /* Accumulating the request line and headers. */
+  CONN_SEND_RESPONSE, /* Sending the output buffer, then the body. */
+  CONN_CLOSING,       /* Waiting for its operations to finish or cancel. */
+};
+
+struct conn {
+  /* Buffered request bytes; may hold several pipelined requests. */
+  struct http_reader reader;
+  struct response response;
+
+  enum conn_state state;
+  int slot;
+  int inflight; /* Operations submitted and not completed yet. */
+
+  /* For the send in flight. */
+  struct msghdr msg;
+  struct iovec iov[2];
+
+  /* Splicing the file body; bytes only leave the pipe for the socket. */
+  int pipe[2];
+  size_t in_pipe;
+
+  /* Stage timings of the current request, recorded once it is sent. */
+  uint64_t request_started, parse_ns, send_started;
+  /* The client is not logged: a direct accept gives no address to a
+   * multishot request, and getpeername() needs a real descriptor. */
+  struct access_log_entry log_entry;
+
+  /* The connection's deadline, as in epollserver. */
+  struct timer timer;
+  bool deadline;
+};
+
+/* The mmapped rings; head and tail are shared with the kernel. */
+struct uring {
+  int fd;
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned sq_entries, sq_local_tail, to_submit;
+  struct io_uring_sqe* sqes;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_cqe* cqes;
+};
+
+/* With --acceptors N there are N loops, each on its own thread and with its
+ * own copy of this state. */
+static __thread struct uring ring;
+static __thread struct conn* conns;
+static __thread bool fixed_buffers;
+static __thread int listen_fd;
+static __thread bool accept_armed;
+static __thread int open_conns;
+static __thread struct __kernel_timespec tick = {
+    .tv_nsec = TIMER_TICK_MS * 1000000};
+static __thread bool tick_armed;
+static __thread struct timer_wheel timers;
+
+static void conn_send(struct conn* c);
+
+/* Submits the queued entries, waiting for at least one completion if WAIT. */
+static void uring_enter(bool wait) {
+  __atomic_store_n(ring.sq_tail, ring.sq_local_tail, __ATOMIC_RELEASE);
+  int submitted = syscall(__NR_io_uring_enter, ring.fd, ring.to_submit,
+                          wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0,
+                          NULL, 0);
+  if (submitted < 0) {
+    if (errno == EINTR || errno == EBUSY || errno == EAGAIN) return;
+    perror("Failed to enter io_uring");
+    exit(errno);
+  }
+  ring.to_submit -= submitted;
+}
+
+/* Returns a zeroed submission entry, flushing the queue first if it is full. */
+static struct io_uring_sqe* uring_get_sqe(enum uring_op op, int slot) {
+  while (ring.sq_local_tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE) >=
+         ring.sq_entries)
+    uring_enter(false);
+
+  unsigned index = ring.sq_local_tail++ & *ring.sq_mask;
+  struct io_uring_sqe* sqe = &ring.sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->user_data = (uint64_t)slot << 8 | op;
+  ring.sq_array[index] = index;
+  ring.to_submit++;
+  return sqe;
+}
+
+static void uring_init(void) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  /* Completions are only run when this thread asks for them. */
+  params.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_SINGLE_ISSUER |
+                 IORING_SETUP_DEFER_TASKRUN;
+  ring.fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+  if (ring.fd == -1 && errno == EINVAL) {
+    memset(&params, 0, sizeof(params));
+    ring.fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+  }
+  if (ring.fd == -1) {
+    perror("Failed to set up io_uring");
+    exit(errno);
+  }
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP) ||
+      !(params.features & IORING_FEAT_NODROP)) {
+    fprintf(stderr, "uringserver needs Linux 6.0 or later\n");
+    exit(ENOSYS);
+  }
+
+  size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  size_t cq_size = params.cq_off.cqes +
+                   params.cq_entries * sizeof(struct io_uring_cqe);
+  size_t size = sq_size > cq_size ? sq_size : cq_size;
+  char* rings = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+  ring.sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe),
+                   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd,
+                   IORING_OFF_SQES);
+  if (rings == MAP_FAILED || ring.sqes == MAP_FAILED) {
+    perror("Failed to map io_uring");
+    exit(errno);
+  }
+
+  ring.sq_head = (unsigned*)(rings + params.sq_off.head);
+  ring.sq_tail = (unsigned*)(rings + params.sq_off.tail);
+  ring.sq_mask = (unsigned*)(rings + params.sq_off.ring_mask);
+  ring.sq_array = (unsigned*)(rings + params.sq_off.array);
+  ring.sq_entries = params.sq_entries;
+  ring.sq_local_tail = *ring.sq_tail;
+  ring.cq_head = (unsigned*)(rings + params.cq_off.head);
+  ring.cq_tail = (unsigned*)(rings + params.cq_off.tail);
+  ring.cq_mask = (unsigned*)(rings + params.cq_off.ring_mask);
+  ring.cqes = (struct io_uring_cqe*)(rings + params.cq_off.cqes);
+
+  /* An empty fixed file table for accept to fill. */
+  struct io_uring_rsrc_register files;
+  memset(&files, 0, sizeof(files));
+  files.nr = URING_MAX_CONNS;
+  files.flags = IORING_RSRC_REGISTER_SPARSE;
+  if (syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_FILES2, &files,
+              sizeof(files)) == -1) {
+    perror("Failed to register the fixed file table");
+    exit(errno);
+  }
+
+  conns = calloc(URING_MAX_CONNS, sizeof(struct conn));
+  if (!conns) {
+    fprintf(stderr, "Malloc failed\n");
+    exit(ENOBUFS);
+  }
+  struct iovec slab = {conns, URING_MAX_CONNS * sizeof(struct conn)};
+  fixed_buffers = syscall(__NR_io_uring_register, ring.fd,
+                          IORING_REGISTER_BUFFERS, &slab, 1) == 0;
+  if (!fixed_buffers)
+    perror("Failed to register read buffers (using plain reads)");
+}
+
+static void arm_accept(void) {
+  if (reload_draining()) return;
+  struct io_uring_sqe* sqe = uring_get_sqe(OP_ACCEPT, 0);
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = listen_fd;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->file_index = IORING_FILE_INDEX_ALLOC;
+  accept_armed = true;
+}
+
+static void arm_tick(void) {
+  struct io_uring_sqe* sqe = uring_get_sqe(OP_TIMEOUT, 0);
+  sqe->opcode = IORING_OP_TIMEOUT;
+  sqe->addr = (uintptr_t)&tick;
+  sqe->len = 1;
+  tick_armed = true;
+}
+
+/* Queues an operation on C's socket. */
+static struct io_uring_sqe* conn_sqe(struct conn* c, enum uring_op op,
+                                     int opcode) {
+  struct io_uring_sqe* sqe = uring_get_sqe(op, c->slot);
+  sqe->opcode = opcode;
+  sqe->fd = c->slot;
+  sqe->flags = IOSQE_FIXED_FILE;
+  c->inflight++;
+  return sqe;
+}
+
+/* Arms C's timer for the state it is waiting in: a deadline for the headers
+ * of a request once some of them are in, else the idle timeout. */
+static void conn_schedule(struct conn* c) {
+  bool deadline = c->state == CONN_READ_REQUEST &&
+                  c->reader.end > c->reader.start;
+  if (!(deadline && c->deadline)) {
+    c->deadline = deadline;
+    timer_arm(&timers, &c->timer,
+              deadline ? server_request_timeout : server_idle_timeout);
+  }
+  if (!tick_armed) arm_tick();
+}
+
+/* Marks C for closing once its operations in flight have completed. */
+static void conn_fail(struct conn* c) {
+  if (c->state == CONN_CLOSING) return;
+  timer_cancel(&timers, &c->timer);
+  c->state = CONN_CLOSING;
+}
+
+/* Frees C and closes its slot. Nothing of C may be in flight. */
+static void conn_release(struct conn* c) {
+  response_free(&c->response);
+  if (c->pipe[0] != -1) {
+    close(c->pipe[0]);
+    close(c->pipe[1]);
+  }
+  c->state = CONN_FREE;
+  open_conns--;
+
+  struct io_uring_sqe* sqe = uring_get_sqe(OP_CLOSE, c->slot);
+  sqe->opcode = IORING_OP_CLOSE;
+  sqe->file_index = c->slot + 1;
+}
+
+/* Closes C now, cancelling the operations it has in flight. */
+static void conn_close(struct conn* c) {
+  conn_fail(c);
+  if (c->inflight == 0) {
+    conn_release(c);
+    return;
+  }
+  struct io_uring_sqe* sqe = uring_get_sqe(OP_CANCEL, c->slot);
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = c->slot;
+  sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_FD_FIXED |
+                      IORING_ASYNC_CANCEL_ALL;
+}
+
+/* Records the stage timings of the response just sent. */
+static void conn_record_request(struct conn* c) {
+  uint64_t now = stats_now();
+  stats_record(STATS_PARSE, c->parse_ns);
+  stats_record(STATS_SEND, now - c->send_started);
+  stats_record(STATS_REQUEST, now - c->request_started);
+  stats_count_response(c->response.status_code);
+  c->parse_ns = 0;
+
+  c->log_entry.status_code = c->response.status_code;
+  c->log_entry.latency_ns = now - c->request_started;
+  access_log_end(&c->log_entry);
+}
+
+/* Parses the next buffered request and starts its response, or reads more of
+ * it. */
+static void conn_read_request(struct conn* c) {
+  struct http_request request;
+  uint64_t started = stats_now();
+  int status = http_parse_request(&c->reader, &request);
+  c->parse_ns += stats_now() - started;
+
+  if (status == 0) {
+    struct http_reader* reader = &c->reader;
+    struct io_uring_sqe* sqe =
+        conn_sqe(c, OP_READ, fixed_buffers ? IORING_OP_READ_FIXED
+                                           : IORING_OP_RECV);
+    sqe->addr = (uintptr_t)(reader->buffer + reader->end);
+    sqe->len = LIBHTTP_REQUEST_MAX_SIZE - reader->end;
+    return;
+  }
+
+  c->request_started = stats_now();
+  c->deadline = false;
+  access_log_begin(&c->log_entry, NULL, status == -1 ? NULL : &request);
+  if (status == -1) {
+    c->response.keep_alive = false;
+    response_empty(&c->response, 400);
+  } else {
+    if (reload_draining()) request.keep_alive = 0;
+    response_prepare_files(&c->response, &request);
+    stats_record(STATS_OPEN, stats_now() - c->request_started);
+  }
+  c->log_entry.bytes = response_length(&c->response);
+  c->state = CONN_SEND_RESPONSE;
+  c->send_started = stats_now();
+  conn_send(c);
+}
+
+/* Queues a linked splice of the next chunk of the file into C's pipe and on
+ * to the socket. If the first is short, the second fails with -ECANCELED and
+ * the rest of the pipe goes out on the next round. */
+static void conn_splice_file(struct conn* c) {
+  struct response* r = &c->response;
+  if (c->pipe[0] == -1 && pipe2(c->pipe, O_CLOEXEC) == -1) {
+    r->use_sendfile = false; /* Out of descriptors; read it in chunks. */
+    conn_send(c);
+    return;
+  }
+
+  off_t chunk = r->file_size - r->file_offset;
+  if (chunk > PIPE_CHUNK_SIZE) chunk = PIPE_CHUNK_SIZE;
+  struct io_uring_sqe* sqe = uring_get_sqe(OP_SPLICE_IN, c->slot);
+  sqe->opcode = IORING_OP_SPLICE;
+  sqe->fd = c->pipe[1];
+  sqe->off = -1;
+  sqe->splice_fd_in = r->file_fd;
+  sqe->splice_off_in = r->file_offset;
+  sqe->len = chunk;
+  sqe->flags = IOSQE_IO_LINK;
+  c->inflight++;
+
+  sqe = conn_sqe(c, OP_SPLICE_OUT, IORING_OP_SPLICE);
+  sqe->off = -1;
+  sqe->splice_fd_in = c->pipe[0];
+  sqe->splice_off_in = -1;
+  sqe->len = chunk;
+}
+
+/* Queues the next piece of C's response, or moves on once it is all sent. */
+static void conn_send(struct conn* c) {
+  struct response* r = &c->response;
+  bool body = response_body_pending(r);
+
+  if (r->out_sent < r->out_len || (r->cached && body)) {
+    int iovcnt = 0;
+    if (r->out_sent < r->out_len) {
+      c->iov[iovcnt].iov_base = r->out + r->out_sent;
+      c->iov[iovcnt++].iov_len = r->out_len - r->out_sent;
+    }
+    if (r->cached && body) {
+      c->iov[iovcnt].iov_base = r->cached->body + r->file_offset;
+      c->iov[iovcnt++].iov_len = r->file_size - r->file_offset;
+    }
+    memset(&c->msg, 0, sizeof(c->msg));
+    c->msg.msg_iov = c->iov;
+    c->msg.msg_iovlen = iovcnt;
+
+    struct io_uring_sqe* sqe = conn_sqe(c, OP_SEND, IORING_OP_SENDMSG);
+    sqe->addr = (uintptr_t)&c->msg;
+    sqe->len = 1;
+    /* MSG_MORE lets the headers share a packet with the file body. */
+    sqe->msg_flags = MSG_NOSIGNAL | (body && !r->cached ? MSG_MORE : 0);
+    return;
+  }
+
+  if (c->in_pipe > 0) {
+    struct io_uring_sqe* sqe = conn_sqe(c, OP_SPLICE_OUT, IORING_OP_SPLICE);
+    sqe->off = -1;
+    sqe->splice_fd_in = c->pipe[0];
+    sqe->splice_off_in = -1;
+    sqe->len = c->in_pipe;
+    return;
+  }
+
+  if (body) {
+    if (r->use_sendfile) {
+      conn_splice_file(c);
+      return;
+    }
+    /* Refill the output buffer with the next chunk of the file. */
+    r->out_len = r->out_sent = 0;
+    response_reserve(r, FILE_CHUNK_SIZE);
+    off_t chunk = r->file_size - r->file_offset;
+    if (chunk > FILE_CHUNK_SIZE) chunk = FILE_CHUNK_SIZE;
+    struct io_uring_sqe* sqe = uring_get_sqe(OP_FILE_READ, c->slot);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = r->file_fd;
+    sqe->addr = (uintptr_t)r->out;
+    sqe->len = chunk;
+    sqe->off = r->file_offset;
+    c->inflight++;
+    return;
+  }
+
+  conn_record_request(c);
+  if (!r->keep_alive) {
+    conn_close(c);
+    return;
+  }
+  response_finish(r);
+  c->state = CONN_READ_REQUEST;
+  conn_read_request(c);
+}
+
+/* Applies the result RES of operation OP to C. */
+static void conn_complete(struct conn* c, enum uring_op op, int res) {
+  struct response* r = &c->response;
+  c->inflight--;
+  if (c->state == CONN_CLOSING) goto done;
+
+  switch (op) {
+    case OP_READ:
+      if (res <= 0) {
+        conn_fail(c);
+        break;
+      }
+      c->reader.end += res;
+      break;
+
+    case OP_SEND:
+      if (res <= 0) {
+        conn_fail(c);
+        break;
+      }
+      size_t sent = res;
+      if (r->out_sent < r->out_len) {
+        size_t header = r->out_len - r->out_sent;
+        size_t n = sent < header ? sent : header;
+        r->out_sent += n;
+        sent -= n;
+      }
+      r->file_offset += sent;
+      break;
+
+    case OP_SPLICE_IN:
+      if (res > 0) {
+        c->in_pipe += res;
+        r->file_offset += res;
+      } else if ((res == -EINVAL || res == -ENOSYS) && c->in_pipe == 0) {
+        r->use_sendfile = false; /* Read the file in chunks instead. */
+      } else {
+        conn_fail(c); /* Includes a file that shrank under us. */
+      }
+      break;
+
+    case OP_SPLICE_OUT:
+      if (res > 0)
+        c->in_pipe -= res;
+      else if (res != -ECANCELED)
+        conn_fail(c);
+      break;
+
+    case OP_FILE_READ:
+      if (res <= 0) {
+        conn_fail(c);
+        break;
+      }
+      r->out_len = res;
+      r->file_offset += res;
+      break;
+
+    default:
+      break;
+  }
+  if (c->state != CONN_CLOSING) conn_schedule(c);
+
+done:
+  if (c->inflight > 0) return;
+  if (c->state == CONN_CLOSING)
+    conn_release(c);
+  else if (c->state == CONN_READ_REQUEST)
+    conn_read_request(c);
+  else
+    conn_send(c);
+}
+
+static void conn_accepted(int slot) {
+  uint64_t accepted = stats_now();
+  stats_count_connection();
+
+  struct conn* c = &conns[slot];
+  http_reader_init(&c->reader, -1); /* The socket is a fixed file. */
+  response_init(&c->response);
+  c->state = CONN_READ_REQUEST;
+  c->slot = slot;
+  c->inflight = 0;
+  c->pipe[0] = c->pipe[1] = -1;
+  c->in_pipe = 0;
+  c->parse_ns = 0;
+  c->timer.slot = NULL;
+  c->deadline = false;
+  open_conns++;
+  conn_schedule(c);
+
+  conn_read_request(c);
+  stats_record(STATS_ACCEPT, stats_now() - accepted);
+}
+
+static void conn_expired(struct timer* timer) {
+  conn_close((struct conn*)((char*)timer - offsetof(struct conn, timer)));
+}
+
+static void handle_completion(struct io_uring_cqe* cqe) {
+  enum uring_op op = cqe->user_data & 0xff;
+  int slot = cqe->user_data >> 8;
+
+  switch (op) {
+    case OP_ACCEPT:
+      accept_armed = cqe->flags & IORING_CQE_F_MORE;
+      if (cqe->res >= 0) {
+        conn_accepted(cqe->res);
+      } else if (cqe->res == -EINVAL) {
+        fprintf(stderr, "uringserver needs Linux 6.0 or later\n");
+        exit(ENOSYS);
+      } else if (cqe->res != -ENFILE && cqe->res != -ECANCELED) {
+        fprintf(stderr, "Error accepting socket: %s\n", strerror(-cqe->res));
+      }
+      /* With every slot taken, accept again once a connection closes. */
+      if (!accept_armed && cqe->res != -ENFILE) arm_accept();
+      break;
+
+    case OP_TIMEOUT:
+      tick_armed = false;
+      timer_wheel_advance(&timers, conn_expired);
+      if (timers.armed > 0) arm_tick();
+      break;
+
+    case OP_CLOSE:
+      if (!accept_armed) arm_accept();
+      break;
+
+    case OP_CANCEL:
+      break;
+
+    default:
+      conn_complete(&conns[slot], op, cqe->res);
+      break;
+  }
+}
+
+void uring_serve_forever(int server_socket) {
+  uring_init();
+  listen_fd = server_socket;
+  timer_wheel_init(&timers);
+  arm_accept();
+
+  bool cancelled = false;
+  while (1) {
+    if (reload_draining()) {
+      /* The socket stays open for the next generation to accept on. */
+      if (accept_armed && !cancelled) {
+        struct io_uring_sqe* sqe = uring_get_sqe(OP_CANCEL, 0);
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = OP_ACCEPT; /* The accept's user_data, slot 0. */
+        cancelled = true;
+      }
+      if (!accept_armed && open_conns == 0) break;
+    }
+    uring_enter(true);
+
+    unsigned head = *ring.cq_head;
+    unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+      struct io_uring_cqe cqe = ring.cqes[head & *ring.cq_mask];
+      __atomic_store_n(ring.cq_head, ++head, __ATOMIC_RELEASE);
+      handle_completion(&cqe);
+    }
+  }
+  close(ring.fd);
+}
+
+#endif
@@ -0,0 +1,114 @@
+#include "workstealing.h"
+
+#include <linux/futex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define WS_DEQUE_INITIAL_CAPACITY 64
+
+static void ws_fatal_error(void) {
+  fprintf(stderr, "Malloc failed\n");
+  exit(1);
+}
+
+/* Initializes a pool of NUM_WORKERS empty deques. */
+void ws_pool_init(ws_pool_t* pool, int num_workers) {
+  pool->num_workers = num_workers;
+  if (posix_memalign((void**)&pool->deques, sizeof(ws_deque_t),
+                     num_workers * sizeof(ws_deque_t)) != 0)
+    ws_fatal_error();
+
+  for (int i = 0; i < num_workers; i++) {
+    ws_deque_t* deque = &pool->deques[i];
+    pthread_mutex_init(&deque->mutex, NULL);
+    deque->fds = malloc(WS_DEQUE_INITIAL_CAPACITY * sizeof(int));
+    if (!deque->fds) ws_fatal_error();
+    deque->head = deque->size = 0;
+    deque->capacity = WS_DEQUE_INITIAL_CAPACITY;
+  }
+  pool->next_worker = 0;
+  pool->epoch = 0;
+  pool->sleepers = 0;
+}
+
+/* Appends FD to the back of DEQUE, doubling the ring when it is full. */
+static void ws_deque_push(ws_deque_t* deque, int fd) {
+  pthread_mutex_lock(&deque->mutex);
+  if (deque->size == deque->capacity) {
+    int* fds = malloc(2 * deque->capacity * sizeof(int));
+    if (!fds) ws_fatal_error();
+    for (int i = 0; i < deque->size; i++)
+      fds[i] = deque->fds[(deque->head + i) % deque->capacity];
+    free(deque->fds);
+    deque->fds = fds;
+    deque->head = 0;
+    deque->capacity *= 2;
+  }
+  deque->fds[(deque->head + deque->size) % deque->capacity] = fd;
+  __atomic_store_n(&deque->size, deque->size + 1, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&deque->mutex);
+}
+
+/*
+ * Removes an fd from DEQUE, from the front for its owner and from the back
+ * for a thief, so the two mostly work on different connections. Returns -1 if
+ * DEQUE is empty.
+ */
+static int ws_deque_take(ws_deque_t* deque, int steal) {
+  /* An unlocked peek; a thief skips empty deques without touching the lock. */
+  if (__atomic_load_n(&deque->size, __ATOMIC_RELAXED) == 0) return -1;
+
+  int fd = -1;
+  pthread_mutex_lock(&deque->mutex);
+  if (deque->size > 0) {
+    if (steal) {
+      fd = deque->fds[(deque->head + deque->size - 1) % deque->capacity];
+    } else {
+      fd = deque->fds[deque->head];
+      deque->head = (deque->head + 1) % deque->capacity;
+    }
+    __atomic_store_n(&deque->size, deque->size - 1, __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&deque->mutex);
+  return fd;
+}
+
+/* Tries WORKER's own deque, then each peer's in turn. */
+static int ws_pool_try_pop(ws_pool_t* pool, int worker) {
+  int fd = ws_deque_take(&pool->deques[worker], 0);
+  for (int i = 1; fd == -1 && i < pool->num_workers; i++)
+    fd = ws_deque_take(&pool->deques[(worker + i) % pool->num_workers], 1);
+  return fd;
+}
+
+/* Hands CLIENT_SOCKET_FD to the next worker in round-robin order and wakes a
+ * single sleeping worker, which serves or steals it. */
+void ws_pool_push(ws_pool_t* pool, int client_socket_fd) {
+  int worker = pool->next_worker++ % pool->num_workers;
+  ws_deque_push(&pool->deques[worker], client_socket_fd);
+
+  __atomic_add_fetch(&pool->epoch, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&pool->sleepers, __ATOMIC_SEQ_CST) > 0)
+    syscall(SYS_futex, &pool->epoch, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/* Returns the next client socket for WORKER, blocking until there is one. */
+int ws_pool_pop(ws_pool_t* pool, int worker) {
+  while (1) {
+    int fd = ws_pool_try_pop(pool, worker);
+    if (fd != -1) return fd;
+
+    /* Announce ourselves before the final check, so that a push racing with
+     * it either is seen by the check or sees us and wakes us. */
+    int epoch = __atomic_load_n(&pool->epoch, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+    fd = ws_pool_try_pop(pool, worker);
+    if (fd == -1)
+      syscall(SYS_futex, &pool->epoch, FUTEX_WAIT_PRIVATE, epoch, NULL, NULL,
+              0);
+    __atomic_sub_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+    if (fd != -1) return fd;
+  }
+}
@@ -0,0 +1,30 @@
+#ifndef __WORKSTEALING__
+#define __WORKSTEALING__
+
+#include <pthread.h>
+
+/* A work-stealing pool gives each worker thread its own deque of accepted
+ * client sockets (poolserver --work-stealing). The acceptor deals sockets out
+ * round-robin; a worker serves its own deque from the front and, once that is
+ * empty, steals from the back of its peers' before going to sleep. */
+
+typedef struct ws_deque {
+  pthread_mutex_t mutex; /* Only contended by the owner and a thief. */
+  int* fds;
+  int head, size, capacity; /* Ring of capacity entries starting at head. */
+} __attribute__((aligned(64))) ws_deque_t;
+
+typedef struct ws_pool {
+  int num_workers;
+  ws_deque_t* deques;
+  unsigned next_worker; /* Round-robin cursor, only touched by the acceptor. */
+  /* Futex that idle workers sleep on; bumped by every push. */
+  int epoch __attribute__((aligned(64)));
+  int sleepers;
+} ws_pool_t;
+
+void ws_pool_init(ws_pool_t* pool, int num_workers);
+void ws_pool_push(ws_pool_t* pool, int client_socket_fd);
+int ws_pool_pop(ws_pool_t* pool, int worker);
+
+#endif
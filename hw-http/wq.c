@@ -1,9 +1,135 @@
 #include "wq.h"
 
+#include <stdbool.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include "utlist.h"
 
+/* The deadline TIMEOUT seconds from now on CLOCK. */
+static struct timespec wq_deadline(clockid_t clock, int timeout) {
+  struct timespec deadline;
+  clock_gettime(clock, &deadline);
+  deadline.tv_sec += timeout;
+  return deadline;
+}
+
+#ifdef WQ_RING
+
+#include <linux/futex.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static void wq_count_init(wq_count_t* count, int value) {
+  count->value = value;
+  count->waiters = 0;
+}
+
+/* Takes one unit from COUNT, sleeping on the futex while there is none.
+ * Returns false if DEADLINE (on CLOCK_MONOTONIC, NULL for none) passes
+ * first. */
+static bool wq_count_take(wq_count_t* count, struct timespec* deadline) {
+  while (1) {
+    int value = __atomic_load_n(&count->value, __ATOMIC_SEQ_CST);
+    if (value > 0) {
+      if (__atomic_compare_exchange_n(&count->value, &value, value - 1, 0,
+                                      __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+        return true;
+      continue;
+    }
+
+    /* FUTEX_WAIT takes a relative timeout. */
+    struct timespec remaining, *timeout = NULL;
+    if (deadline) {
+      clock_gettime(CLOCK_MONOTONIC, &remaining);
+      remaining.tv_sec = deadline->tv_sec - remaining.tv_sec;
+      remaining.tv_nsec = deadline->tv_nsec - remaining.tv_nsec;
+      if (remaining.tv_nsec < 0) {
+        remaining.tv_sec--;
+        remaining.tv_nsec += 1000000000;
+      }
+      if (remaining.tv_sec < 0) return false;
+      timeout = &remaining;
+    }
+
+    /* The kernel rechecks that the value is still 0 before sleeping. */
+    __atomic_add_fetch(&count->waiters, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &count->value, FUTEX_WAIT_PRIVATE, 0, timeout, NULL,
+            0);
+    __atomic_sub_fetch(&count->waiters, 1, __ATOMIC_SEQ_CST);
+  }
+}
+
+/* Returns one unit to COUNT and wakes a single sleeper, if there is one. */
+static void wq_count_give(wq_count_t* count) {
+  __atomic_add_fetch(&count->value, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&count->waiters, __ATOMIC_SEQ_CST) > 0)
+    syscall(SYS_futex, &count->value, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/* Waits for SLOT to reach SEQUENCE. Only spins when a peer that claimed the
+ * slot a lap earlier is still between its claim and its store. */
+static void wq_slot_wait(wq_slot_t* slot, unsigned long sequence) {
+  while (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != sequence)
+    sched_yield();
+}
+
+/* Initializes a work queue WQ. */
+void wq_init(wq_t* wq) {
+  for (unsigned long i = 0; i < WQ_RING_CAPACITY; i++)
+    wq->slots[i].sequence = i;
+  wq->head = wq->tail = 0;
+  wq_count_init(&wq->filled, 0);
+  wq_count_init(&wq->vacant, WQ_RING_CAPACITY);
+}
+
+/* Takes the next socket out of its slot, once a filled one is claimed. */
+static int wq_take_slot(wq_t* wq) {
+  unsigned long position = __atomic_fetch_add(&wq->head, 1, __ATOMIC_RELAXED);
+  wq_slot_t* slot = &wq->slots[position & (WQ_RING_CAPACITY - 1)];
+
+  wq_slot_wait(slot, position + 1);
+  int client_socket_fd = slot->client_socket_fd;
+  __atomic_store_n(&slot->sequence, position + WQ_RING_CAPACITY,
+                   __ATOMIC_RELEASE);
+
+  wq_count_give(&wq->vacant);
+  return client_socket_fd;
+}
+
+/* Remove an item from the WQ. This function should block until there
+ * is at least one item on the queue. */
+int wq_pop(wq_t* wq) {
+  wq_count_take(&wq->filled, NULL);
+  return wq_take_slot(wq);
+}
+
+int wq_pop_timed(wq_t* wq, int timeout) {
+  struct timespec deadline = wq_deadline(CLOCK_MONOTONIC, timeout);
+  if (!wq_count_take(&wq->filled, &deadline)) return -1;
+  return wq_take_slot(wq);
+}
+
+int wq_size(wq_t* wq) {
+  return __atomic_load_n(&wq->filled.value, __ATOMIC_RELAXED);
+}
+
+/* Add ITEM to WQ. Blocks while the ring is full. */
+void wq_push(wq_t* wq, int client_socket_fd) {
+  wq_count_take(&wq->vacant, NULL);
+  unsigned long position = __atomic_fetch_add(&wq->tail, 1, __ATOMIC_RELAXED);
+  wq_slot_t* slot = &wq->slots[position & (WQ_RING_CAPACITY - 1)];
+
+  wq_slot_wait(slot, position);
+  slot->client_socket_fd = client_socket_fd;
+  __atomic_store_n(&slot->sequence, position + 1, __ATOMIC_RELEASE);
+
+  wq_count_give(&wq->filled);
+}
+
+#else
+
 /* Initializes a work queue WQ. */
 void wq_init(wq_t* wq) {
   pthread_mutex_init(&wq->mutex, NULL);
@@ -12,11 +138,9 @@ void wq_init(wq_t* wq) {
   wq->head = NULL;
 }
 
-/* Remove an item from the WQ. This function should block until there
- * is at least one item on the queue. */
-int wq_pop(wq_t* wq) {
-  pthread_mutex_lock(&wq->mutex);
-  while (wq->size == 0) pthread_cond_wait(&wq->condvar, &wq->mutex);
+/* Unlinks the first item of WQ, which must have one. Holds wq->mutex and
+ * releases it. */
+static int wq_take_head(wq_t* wq) {
   wq_item_t* wq_item = wq->head;
   int client_socket_fd = wq->head->client_socket_fd;
   wq->size--;
@@ -27,6 +151,29 @@ int wq_pop(wq_t* wq) {
   return client_socket_fd;
 }
 
+/* Remove an item from the WQ. This function should block until there
+ * is at least one item on the queue. */
+int wq_pop(wq_t* wq) {
+  pthread_mutex_lock(&wq->mutex);
+  while (wq->size == 0) pthread_cond_wait(&wq->condvar, &wq->mutex);
+  return wq_take_head(wq);
+}
+
+int wq_pop_timed(wq_t* wq, int timeout) {
+  struct timespec deadline = wq_deadline(CLOCK_REALTIME, timeout);
+  pthread_mutex_lock(&wq->mutex);
+  while (wq->size == 0) {
+    if (pthread_cond_timedwait(&wq->condvar, &wq->mutex, &deadline) != 0 &&
+        wq->size == 0) {
+      pthread_mutex_unlock(&wq->mutex);
+      return -1;
+    }
+  }
+  return wq_take_head(wq);
+}
+
+int wq_size(wq_t* wq) { return __atomic_load_n(&wq->size, __ATOMIC_RELAXED); }
+
 /* Add ITEM to WQ. */
 void wq_push(wq_t* wq, int client_socket_fd) {
   pthread_mutex_lock(&wq->mutex);
@@ -37,3 +184,5 @@ void wq_push(wq_t* wq, int client_socket_fd) {
   pthread_cond_broadcast(&wq->condvar);
   pthread_mutex_unlock(&wq->mutex);
 }
+
+#endif
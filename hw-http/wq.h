@@ -6,6 +6,38 @@
 /* WQ defines a work queue which will be used to store accepted client sockets
  * waiting to be served. */
 
+#ifdef WQ_RING
+
+/*
+ * Lock-free backend (make WQ_RING=1): a bounded ring of WQ_RING_CAPACITY
+ * slots shared by any number of pushers and poppers. Two futex-backed
+ * counters track filled and free slots; a push wakes at most one parked
+ * worker, and nothing is allocated per item.
+ */
+#define WQ_RING_CAPACITY 1024 /* Must be a power of two. */
+
+typedef struct wq_slot {
+  unsigned long sequence; /* Which lap of the ring the slot is ready for. */
+  int client_socket_fd;
+} wq_slot_t;
+
+/* A counter that parks callers on a futex while it is zero. */
+typedef struct wq_count {
+  int value;
+  int waiters;
+} wq_count_t;
+
+typedef struct wq {
+  wq_slot_t slots[WQ_RING_CAPACITY];
+  /* Kept on separate cache lines, pushers and poppers do not share one. */
+  unsigned long head __attribute__((aligned(64))); /* Next slot to pop. */
+  unsigned long tail __attribute__((aligned(64))); /* Next slot to push. */
+  wq_count_t filled __attribute__((aligned(64)));
+  wq_count_t vacant __attribute__((aligned(64)));
+} wq_t;
+
+#else
+
 typedef struct wq_item {
   int client_socket_fd;  // Client socket to be served.
   struct wq_item* next;
@@ -20,8 +52,16 @@ typedef struct wq {
   /** DONE: More stuff here, maybe? */
 } wq_t;
 
+#endif
+
 void wq_init(wq_t* wq);
 void wq_push(wq_t* wq, int client_socket_fd);
 int wq_pop(wq_t* wq);
 
+/* Like wq_pop(), but gives up after TIMEOUT seconds and returns -1. */
+int wq_pop_timed(wq_t* wq, int timeout);
+
+/* Number of sockets waiting in WQ; only a snapshot. */
+int wq_size(wq_t* wq);
+
 #endif
@@ -29,6 +29,12 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "word_count.h"
 
@@ -38,6 +44,108 @@ WordCount *word_counts = NULL;
 /* The maximum length of each word in a file */
 #define MAX_WORD_LEN 64
 
+/* Bytes classified at a time by classify_block(). */
+#define BLOCK_LEN 16
+
+/*
+ * Maps infile, if it is a regular file, privately and writably so that
+ * words can be lowercased in place. Returns NULL, leaving infile to be read
+ * a character at a time, if it cannot be mapped.
+ */
+static char *map_file(FILE *infile, size_t *length) {
+  struct stat st;
+  if (fstat(fileno(infile), &st) == -1 || !S_ISREG(st.st_mode) ||
+      st.st_size == 0) {
+    return NULL;
+  }
+  char *text = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                    fileno(infile), 0);
+  if (text == MAP_FAILED) {
+    return NULL;
+  }
+  madvise(text, st.st_size, MADV_SEQUENTIAL);
+  *length = st.st_size;
+  return text;
+}
+
+/*
+ * Lowercases the LENGTH (at most BLOCK_LEN) bytes at BLOCK and returns a
+ * mask with bit i set if BLOCK[i] is a letter. Only ASCII letters count, as
+ * isalpha() has it in the C locale.
+ */
+static unsigned classify_block(char *block, size_t length) {
+#ifdef __SSE2__
+  if (length == BLOCK_LEN) {
+    __m128i bytes = _mm_loadu_si128((__m128i *)block);
+    /* Setting bit 5 folds 'A'-'Z' onto 'a'-'z'; bytes from 0x80 up compare
+     * as negative and so are not letters. */
+    __m128i folded = _mm_or_si128(bytes, _mm_set1_epi8(0x20));
+    __m128i alpha =
+        _mm_and_si128(_mm_cmpgt_epi8(folded, _mm_set1_epi8('a' - 1)),
+                      _mm_cmplt_epi8(folded, _mm_set1_epi8('z' + 1)));
+    __m128i lowered = _mm_or_si128(
+        bytes, _mm_and_si128(alpha, _mm_set1_epi8(0x20)));
+    /* Stores only into blocks with capitals, sparing the others' pages a
+     * copy-on-write fault. */
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(lowered, bytes)) != 0xffff) {
+      _mm_storeu_si128((__m128i *)block, lowered);
+    }
+    return _mm_movemask_epi8(alpha);
+  }
+#endif
+  unsigned mask = 0;
+  for (size_t i = 0; i < length; i++) {
+    unsigned char c = block[i];
+    if (isalpha(c)) {
+      mask |= 1u << i;
+      block[i] = tolower(c);
+    }
+  }
+  return mask;
+}
+
+/*
+ * Calls span() with each run of letters in the LENGTH bytes at TEXT,
+ * lowercased in place. Classifies BLOCK_LEN bytes at a time, finding where
+ * runs start and end from the block's mask rather than byte by byte.
+ */
+static void for_each_word(char *text, size_t length,
+                          void span(char *word, size_t length, void *aux),
+                          void *aux) {
+  size_t start = 0;
+  bool in_word = false;
+  for (size_t base = 0; base < length; base += BLOCK_LEN) {
+    size_t block_len = length - base < BLOCK_LEN ? length - base : BLOCK_LEN;
+    unsigned mask = classify_block(text + base, block_len);
+    unsigned full = block_len == BLOCK_LEN ? 0xffff : (1u << block_len) - 1;
+    for (size_t i = 0; i < block_len;) {
+      /* Skip to the next byte that changes in_word. */
+      unsigned rest = (in_word ? ~mask & full : mask) >> i;
+      if (!rest) {
+        break;
+      }
+      i += __builtin_ctz(rest);
+      if (in_word) {
+        span(text + start, base + i - start, aux);
+      } else {
+        start = base + i;
+      }
+      in_word = !in_word;
+    }
+  }
+  if (in_word) {
+    span(text + start, length - start, aux);
+  }
+}
+
+static void count_span(char *word, size_t length, void *aux) {
+  (*(int *)aux)++;
+}
+
+static void add_span(char *word, size_t length, void *aux) {
+  add_word_span(aux, word, length);
+}
+
 /*
  * 3.1.1 Total Word Count
  *
@@ -47,6 +155,14 @@ WordCount *word_counts = NULL;
 int num_words(FILE *infile) {
   int num_words = 0;
 
+  size_t length;
+  char *text = map_file(infile, &length);
+  if (text) {
+    for_each_word(text, length, count_span, &num_words);
+    munmap(text, length);
+    return num_words;
+  }
+
   bool in_word = false;
   while (!feof(infile)) {
     char c = fgetc(infile);
@@ -81,6 +197,14 @@ int count_words(WordCount **wclist, FILE *infile) {
     return 1;
   }
 
+  size_t length;
+  char *text = map_file(infile, &length);
+  if (text) {
+    for_each_word(text, length, add_span, wclist);
+    munmap(text, length);
+    return 0;
+  }
+
   char buffer[MAX_WORD_LEN];
   unsigned short index = 0;
   bool in_word = false;
@@ -209,5 +333,6 @@ int main(int argc, char *argv[]) {
     printf("The frequencies of each word are: \n");
     fprint_words(word_counts, stdout);
   }
+  free_words(&word_counts);
   return 0;
 }
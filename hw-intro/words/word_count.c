@@ -24,12 +24,78 @@ Mutators take a reference to a list as first arg.
 
 /* Basic utilities */
 
-char *new_string(char *str) {
-  char *new_str = (char *)malloc(strlen(str) + 1);
+/* Words and nodes are carved out of big blocks rather than malloc'd one by
+   one: word bytes are packed back to back in one pool, nodes in slabs of
+   another, and free_words() releases each pool in one pass over its blocks.
+   Nodes are shared by every list (wordcount_sort relinks them), so the pools
+   are too. */
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+struct arena_block {
+  struct arena_block *next;
+  size_t used, size;
+  max_align_t data[];
+};
+
+struct arena {
+  struct arena_block *blocks; /* Newest first. */
+};
+
+static struct arena word_arena, node_arena;
+
+/* Returns SIZE bytes from ARENA, aligned for ALIGN, or NULL if out of
+   memory. */
+static void *arena_alloc(struct arena *arena, size_t size, size_t align) {
+  struct arena_block *block = arena->blocks;
+  size_t offset = block ? (block->used + align - 1) & ~(align - 1) : 0;
+  if (!block || offset + size > block->size) {
+    size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+    block = malloc(sizeof(*block) + block_size);
+    if (!block) {
+      return NULL;
+    }
+    block->size = block_size;
+    block->next = arena->blocks;
+    arena->blocks = block;
+    offset = 0;
+  }
+  block->used = offset + size;
+  return (char *)block->data + offset;
+}
+
+static void arena_free(struct arena *arena) {
+  while (arena->blocks) {
+    struct arena_block *next = arena->blocks->next;
+    free(arena->blocks);
+    arena->blocks = next;
+  }
+}
+
+/* Copies the LENGTH characters at STR into the word pool. */
+static char *new_string_span(const char *str, size_t length) {
+  char *new_str = arena_alloc(&word_arena, length + 1, 1);
   if (!new_str) {
     return NULL;
   }
-  return strcpy(new_str, str);
+  memcpy(new_str, str, length);
+  new_str[length] = '\0';
+  return new_str;
+}
+
+char *new_string(char *str) { return new_string_span(str, strlen(str)); }
+
+/* A node for WORD, with count 1, at the head of *WCLIST. */
+static WordCount *new_word(WordCount **wclist, const char *word,
+                           size_t length) {
+  WordCount *res = arena_alloc(&node_arena, sizeof(WordCount),
+                               _Alignof(WordCount));
+  if (!res || !(res->word = new_string_span(word, length))) {
+    return NULL;
+  }
+  res->count = 1;
+  res->next = *wclist;
+  *wclist = res;
+  return res;
 }
 
 int init_words(WordCount **wclist) {
@@ -88,16 +154,35 @@ int add_word(WordCount **wclist, char *word) {
     res->count++;
   } else {
     // Insert with count 1.
-    res = (WordCount *)malloc(sizeof(WordCount));
-    res->count = 1;
-    res->word = new_string(word);
-    res->next = *wclist;
-    *wclist = res;
+    if (!new_word(wclist, word, strlen(word))) {
+      return 1;
+    }
   }
 
   return 0;
 }
 
+int add_word_span(WordCount **wclist, const char *word, size_t length) {
+  if (!wclist || !word) {
+    return 1;
+  }
+
+  for (WordCount *wc = *wclist; wc; wc = wc->next) {
+    if (strncmp(wc->word, word, length) == 0 && wc->word[length] == '\0') {
+      wc->count++;
+      return 0;
+    }
+  }
+
+  return new_word(wclist, word, length) ? 0 : 1;
+}
+
+void free_words(WordCount **wclist) {
+  arena_free(&node_arena);
+  arena_free(&word_arena);
+  *wclist = NULL;
+}
+
 void fprint_words(WordCount *wchead, FILE *ofile) {
   /* print word counts to a file */
   WordCount *wc;
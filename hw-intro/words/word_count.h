@@ -57,6 +57,13 @@ WordCount* find_word(WordCount* wchead, char* word);
  */
 int add_word(WordCount** wclist, char* word);
 
+/* Like add_word, for the LENGTH characters at WORD, which need not be
+ * null-terminated. */
+int add_word_span(WordCount** wclist, const char* word, size_t length);
+
+/* Free every word and node of every list, all at once */
+void free_words(WordCount** wclist);
+
 // static int wordcntcmp(const WordCount *wc1, WordCount *wc2);
 
 /* print word counts to a file */
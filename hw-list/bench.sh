@@ -0,0 +1,85 @@
+#!/bin/sh
+#
+# Benchmarks the word counters over the gutenberg corpus; run by "make bench".
+#
+# BENCH_COPIES   copies of the corpus to count, as that many sets of files
+#                (default 2);
+# BENCH_THREADS  thread counts to run pwords and hpwords at (default 1, 2, 4
+#                ... up to the number of CPUs);
+# BENCH_PROGRAMS which of words lwords pwords hwords hpwords spwords to run
+#                (default all).
+#
+# Each run's output is checked against the counts lwords gives for one copy,
+# times BENCH_COPIES (spwords, being approximate, is not checked), and
+# reported with its throughput, peak RSS, and voluntary context switches: how
+# often it blocked, which for these programs means mostly on a lock.
+
+copies=${BENCH_COPIES:-2}
+programs=${BENCH_PROGRAMS:-"words lwords pwords hwords hpwords spwords"}
+if [ -z "$BENCH_THREADS" ]; then
+  cpus=$(getconf _NPROCESSORS_ONLN)
+  BENCH_THREADS=1
+  n=2
+  while [ "$n" -le "$cpus" ]; do
+    BENCH_THREADS="$BENCH_THREADS $n"
+    n=$((n * 2))
+  done
+fi
+
+work=$(mktemp -d) || exit 1
+trap 'rm -rf "$work"' EXIT
+
+i=0
+while [ "$i" -lt "$copies" ]; do
+  for file in gutenberg/*.txt; do
+    cp "$file" "$work/$i-$(basename "$file")"
+  done
+  i=$((i + 1))
+done
+files=$(ls "$work"/*.txt)
+
+# Counts scale with the copies, and so keep their order.
+# Compared as "count word" lines, since words pads its counts differently.
+./lwords gutenberg/*.txt | awk -v copies="$copies" '{ print $1 * copies, $2 }' |
+  sort > "$work/reference"
+tokens=$(awk '{ total += $1 } END { print total }' "$work/reference")
+bytes=$(cat $files | wc -c)
+echo "$copies copies: $((bytes / 1024)) KiB, $tokens words"
+printf "%-28s %8s %12s %10s %10s %s\n" \
+  program seconds words/sec "rss KiB" blocked output
+
+run() {
+  name=$1
+  shift
+  cost=$(./bench_run "$work/out" "$@" $files 2>/dev/null) || {
+    printf "%-28s failed\n" "$name"
+    return
+  }
+  set -- $cost
+  case $name in
+    spwords*) check=approximate ;;
+    *) if awk '{ print $1, $2 }' "$work/out" | sort |
+           cmp -s - "$work/reference"; then
+         check=ok
+       else
+         check=WRONG
+       fi ;;
+  esac
+  printf "%-28s %8s %12.0f %10s %10s %s\n" \
+    "$name" "$1" "$(echo "$tokens $1" | awk '{ print $1 / $2 }')" "$2" "$3" \
+    "$check"
+}
+
+for program in $programs; do
+  case $program in
+    pwords | hpwords | spwords)
+      for threads in $BENCH_THREADS; do
+        run "$program -t$threads" "./$program" -t "$threads"
+        run "$program -t$threads --local" "./$program" -t "$threads" --local
+        run "$program -t$threads --split" "./$program" -t "$threads" \
+          --split="$threads"
+      done ;;
+    *)
+      run "$program" "./$program" ;;
+  esac
+done
@@ -0,0 +1,61 @@
+/*
+ * Runs a command for bench.sh and reports what it cost.
+ *
+ *   bench_run OUTFILE COMMAND [ARG...]
+ *
+ * runs COMMAND with its standard output sent to OUTFILE, then prints
+ *
+ *   SECONDS MAX_RSS_KB VOLUNTARY_SWITCHES
+ *
+ * from its rusage: the wall-clock time, its peak resident set size, and how
+ * many times it blocked, which for the word counters is mostly on contended
+ * locks (they read their input from the page cache).
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+int main(int argc, char* argv[]) {
+  if (argc < 3) {
+    fprintf(stderr, "Usage: %s OUTFILE COMMAND [ARG...]\n", argv[0]);
+    return 2;
+  }
+
+  struct timespec started, finished;
+  clock_gettime(CLOCK_MONOTONIC, &started);
+  pid_t pid = fork();
+  if (pid == -1) {
+    perror("fork");
+    return 1;
+  }
+  if (pid == 0) {
+    int fd = open(argv[1], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1 || dup2(fd, STDOUT_FILENO) == -1) {
+      perror(argv[1]);
+      _exit(127);
+    }
+    close(fd);
+    execvp(argv[2], &argv[2]);
+    perror(argv[2]);
+    _exit(127);
+  }
+
+  int status;
+  struct rusage usage;
+  if (wait4(pid, &status, 0, &usage) == -1) {
+    perror("wait4");
+    return 1;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &finished);
+
+  double seconds = (finished.tv_sec - started.tv_sec) +
+                   (finished.tv_nsec - started.tv_nsec) / 1e9;
+  printf("%.3f %ld %ld\n", seconds, usage.ru_maxrss, usage.ru_nvcsw);
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
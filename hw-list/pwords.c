@@ -1,5 +1,6 @@
 /*
- * Word count application with one thread per input file.
+ * Word count application with a pool of threads taking the input files, or
+ * ranges of them with --split, one at a time.
  *
  * You may modify this file in any way you like, and are expected to modify it.
  * Your solution must read each input file from a separate thread. We encourage
@@ -22,68 +23,728 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#include <ctype.h>
+#include <errno.h>
+#include <getopt.h>
 #include <pthread.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "word_count.h"
 #include "word_helpers.h"
+#include "word_index.h"
+#include "word_ngrams.h"
+#include "word_tokens.h"
+
+/*
+ * An input file, opened by the first worker to take a range of it and closed
+ * by the last one to finish with it, so that no more files are open at once
+ * than there are workers.
+ */
+typedef struct InputFile {
+  char *name;
+  bool opened;
+  FILE *fileptr;
+  char *text; /* Mapped, with --split; NULL to read fileptr as a stream. */
+  size_t size;
+  int ranges_left;
+
+  /* With --index: the file's own counts, so they can be indexed, and its
+   * size and modification time from before it was read. */
+  word_count_list_t *counts;
+  struct stat st;
+} InputFile;
+
+/*
+ * The work the threads share: range r of file f is item f * split + r, and
+ * each thread takes the next item until there are none left.
+ */
+typedef struct Work {
+  InputFile *files;
+  size_t num_items;
+  size_t next; /* Taken with an atomic fetch-and-add. */
+  int split;
+  pthread_mutex_t lock; /* Taken to open or close a file. */
+} Work;
+
 typedef struct Args {
   word_count_list_t *wclistptr;
-  FILE *fileptr;
+  Work *work;
+  char *buffer; /* What read_words() reads the files into. */
+  size_t buffer_size;
+
+  /* With --ngram: the thread's phrases, added to the list once it is done. */
+  struct ngram_counter *ngrams;
+
+  /* With --local: the thread counts into its own table, then merges in those
+   * of the threads after it, see merge_tables(). */
+  word_count_list_t local;
+  int index, num_threads;
+  struct Args *all;
+  pthread_t thread;
 } Args;
 
-void read_words_from_file(Args *args) {
-  count_words(args->wclistptr, args->fileptr);
-  pthread_exit(NULL);
+/*
+ * Folds into this thread's table those of threads index + 1, + 2, + 4, ...
+ * as long as index is a multiple of twice the step, so that the tables are
+ * merged pairwise in a tree: the merges of each level run in parallel, and
+ * thread 0 ends up with every count after log2(num_threads) levels.
+ */
+static void merge_tables(Args *args) {
+  for (int step = 1;
+       args->index % (2 * step) == 0 && args->index + step < args->num_threads;
+       step *= 2) {
+    Args *other = &args->all[args->index + step];
+    pthread_join(other->thread, NULL);
+    if (!merge_words(&args->local, &other->local))
+      fprintf(stderr, "Out of memory merging %d word tables\n",
+              args->num_threads);
+  }
+}
+
+/* With --unicode, set before any thread starts: see word_tokens.h. */
+static bool unicode;
+
+static void count_word(char *word, void *wclist) {
+  if (!add_word(wclist, word)) free(word);
+}
+
+/* With --ngram, the number of words in the phrases counted; 0 without. */
+static int ngram;
+
+/* How much read_words() asks for at a time. */
+#define READ_BLOCK (64 * 1024)
+
+/*
+ * Calls VISIT with the words read from FD, as tokenize_words() does, reading
+ * a block at a time into *BUFFER, of *SIZE bytes, instead of a character at a
+ * time under a stream's lock. A run of letters cut off by the end of a block
+ * is moved to the front to be finished by the next one, and the buffer grown
+ * if a word is as long as it. The buffer is kept for the next call; free() it
+ * when done.
+ */
+static void read_words(int fd, char **buffer, size_t *size,
+                       void visit(char *word, void *aux), void *aux) {
+  size_t carried = 0;
+  for (;;) {
+    if (*size - carried < READ_BLOCK / 2) {
+      size_t new_size = *size ? *size * 2 : READ_BLOCK;
+      char *grown = realloc(*buffer, new_size);
+      if (!grown) {
+        perror("realloc");
+        return;
+      }
+      *buffer = grown;
+      *size = new_size;
+    }
+    ssize_t n = read(fd, *buffer + carried, *size - carried);
+    if (n == -1 && errno == EINTR) continue;
+    if (n <= 0) {
+      if (n == -1) perror("read");
+      tokenize_words(*buffer, carried, unicode, visit, aux);
+      return;
+    }
+
+    size_t length = carried + n, end = length;
+    while (end > 0 && word_byte((*buffer)[end - 1])) end--;
+    tokenize_words(*buffer, end, unicode, visit, aux);
+    carried = length - end;
+    memmove(*buffer, *buffer + end, carried);
+  }
+}
+
+/*
+ * Maps FILE, once it is open, if it can be split; otherwise, a pipe for
+ * one, it is read as a stream by whoever takes its first range.
+ */
+static void map_file(InputFile *file) {
+  struct stat st;
+  int fd = fileno(file->fileptr);
+  if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0)
+    return;
+  char *text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (text == MAP_FAILED) return;
+  madvise(text, st.st_size, MADV_SEQUENTIAL);
+  file->text = text;
+  file->size = st.st_size;
+}
+
+static void take_file(Work *work, InputFile *file) {
+  pthread_mutex_lock(&work->lock);
+  if (!file->opened) {
+    file->opened = true;
+    file->fileptr = fopen(file->name, "r");
+    if (!file->fileptr)
+      perror(file->name);
+    else if (work->split > 1)
+      map_file(file);
+  }
+  pthread_mutex_unlock(&work->lock);
+}
+
+static void release_file(Work *work, InputFile *file) {
+  pthread_mutex_lock(&work->lock);
+  if (--file->ranges_left == 0) {
+    if (file->text) munmap(file->text, file->size);
+    if (file->fileptr) fclose(file->fileptr);
+  }
+  pthread_mutex_unlock(&work->lock);
+}
+
+/*
+ * Where range RANGE of a mapped file starts (and range RANGE - 1 ends): an
+ * equal share of its bytes in, moved past the run of letters it might cut
+ * in two. Each range is worked out on its own, so they can be taken in any
+ * order, and no word falls into two of them.
+ */
+static size_t range_start(InputFile *file, int range, int split) {
+  if (range == split) return file->size;
+  size_t start = file->size / split * range;
+  while (start > 0 && start < file->size && word_byte(file->text[start]))
+    start++;
+  return start;
+}
+
+/*
+ * Fills NGRAMS' window with the words of FILE just before START, so that the
+ * phrases that end in the range from START and begin before it are counted
+ * there. Looks back twice as far each time until it has enough, from a byte
+ * between words.
+ */
+static void prime_ngrams(struct ngram_counter *ngrams, InputFile *file,
+                         size_t start) {
+  for (size_t back = 64 * ngram;; back *= 2) {
+    size_t from = back < start ? start - back : 0;
+    while (from > 0 && word_byte(file->text[from - 1])) from--;
+    ngram_break(ngrams);
+    tokenize_words(file->text + from, start - from, unicode,
+                   ngram_context_word, ngrams);
+    if (from == 0 || ngram_context_full(ngrams)) return;
+  }
+}
+
+void *count_words_worker(void *void_args) {
+  Args *args = void_args;
+  Work *work = args->work;
+  size_t item;
+  while ((item = __atomic_fetch_add(&work->next, 1, __ATOMIC_RELAXED)) <
+         work->num_items) {
+    InputFile *file = &work->files[item / work->split];
+    int range = item % work->split;
+    void *counts = file->counts ? file->counts : args->wclistptr;
+    void (*visit)(char *, void *) = count_word;
+    if (args->ngrams) {
+      counts = args->ngrams;
+      visit = ngram_add_word;
+      ngram_break(args->ngrams);
+    }
+    take_file(work, file);
+    if (file->text) {
+      size_t start = range_start(file, range, work->split);
+      size_t end = range_start(file, range + 1, work->split);
+      if (args->ngrams && start > 0) prime_ngrams(args->ngrams, file, start);
+      tokenize_words(file->text + start, end - start, unicode, visit, counts);
+    } else if (file->fileptr && range == 0) {
+      read_words(fileno(file->fileptr), &args->buffer, &args->buffer_size,
+                 visit, counts);
+    }
+    release_file(work, file);
+  }
+  free(args->buffer);
+  if (args->wclistptr == &args->local) merge_tables(args);
+  return NULL;
+}
+
+/* The words to count, with --vocabulary. */
+typedef struct Vocabulary {
+  char *path; /* NULL without it. */
+  char **words;
+  size_t num_words, capacity;
+  bool failed;
+} Vocabulary;
+
+static void add_vocabulary_word(char *word, void *aux) {
+  Vocabulary *vocabulary = aux;
+  if (!vocabulary->failed && vocabulary->num_words == vocabulary->capacity) {
+    size_t capacity = vocabulary->capacity ? vocabulary->capacity * 2 : 64;
+    char **words = realloc(vocabulary->words, capacity * sizeof(char *));
+    vocabulary->failed = words == NULL;
+    if (words) {
+      vocabulary->words = words;
+      vocabulary->capacity = capacity;
+    }
+  }
+  if (vocabulary->failed)
+    free(word);
+  else
+    vocabulary->words[vocabulary->num_words++] = word;
+}
+
+/*
+ * Reads the words of VOCABULARY's file, split and lowercased as those counted
+ * are. Returns false, with errno set, on failure.
+ */
+static bool read_vocabulary(Vocabulary *vocabulary) {
+  FILE *infile = fopen(vocabulary->path, "r");
+  if (!infile) return false;
+  char *buffer = NULL;
+  size_t buffer_size = 0;
+  read_words(fileno(infile), &buffer, &buffer_size, add_vocabulary_word,
+             vocabulary);
+  free(buffer);
+  fclose(infile);
+  if (vocabulary->failed) errno = ENOMEM;
+  return !vocabulary->failed;
+}
+
+/* Initializes WCLIST, seeded with VOCABULARY if there is one. */
+static bool init_counts(word_count_list_t *wclist, Vocabulary *vocabulary) {
+  init_words(wclist);
+#ifdef HASH_TABLE
+  if (vocabulary->path &&
+      !seed_words(wclist, vocabulary->words, vocabulary->num_words)) {
+    perror("seed_words");
+    return false;
+  }
+#else
+  (void)vocabulary;
+#endif
+  return true;
+}
+
+/* What replay_word() adds an indexed file's words to. */
+typedef struct Replay {
+  word_count_list_t *wclist;
+  struct word_index_writer *writer;
+  bool failed;
+} Replay;
+
+static void replay_word(const char *word, int count, void *aux) {
+  Replay *replay = aux;
+  if (!word_index_add(replay->writer, word, count)) replay->failed = true;
+  char *copy = strdup(word);
+  word_count_t *wc = copy ? add_word(replay->wclist, copy) : NULL;
+  if (!wc) {
+    free(copy);
+    replay->failed = true;
+    return;
+  }
+  /* Nothing else adds words yet, so the entry is still good. */
+  wc->count += count - 1;
+}
+
+/* Adds a phrase counted with --ngram to the list AUX. Only the main thread
+ * adds them, so the entry is still good. */
+static void add_phrase(const char *phrase, int count, void *aux) {
+  char *copy = strdup(phrase);
+  word_count_t *wc = copy ? add_word(aux, copy) : NULL;
+  if (!wc) {
+    free(copy);
+    fprintf(stderr, "Out of memory adding phrases\n");
+    return;
+  }
+  wc->count += count - 1;
+}
+
+/* Adds the phrases of NGRAMS to WCLIST, and frees NGRAMS. */
+static void add_phrases(word_count_list_t *wclist,
+                        struct ngram_counter *ngrams) {
+  if (!ngrams) return;
+  ngram_for_each(ngrams, add_phrase, wclist);
+  if (ngram_failed(ngrams))
+    fprintf(stderr, "Out of memory counting phrases; some are left out\n");
+  ngram_counter_free(ngrams);
+}
+
+static void index_word(word_count_t *wc, void *aux) {
+  Replay *replay = aux;
+  if (!word_index_add(replay->writer, wc->word, wc->count))
+    replay->failed = true;
+}
+
+/*
+ * The name a file is indexed under: its absolute path, so the index holds
+ * wherever pwords is run from. free() it.
+ */
+static char *index_key(const char *name) {
+  char *key = realpath(name, NULL);
+  return key ? key : strdup(name);
+}
+
+/*
+ * Takes the counts of the files on the command line that are in INDEX and
+ * unchanged from it, adding them to WCLIST and REPLAY's writer, and leaves
+ * the others in WORK to be counted. Returns false if out of memory.
+ */
+static bool replay_index(struct word_index *index, char **names, int count,
+                         Work *work, Replay *replay, int *reused) {
+  int file_nums = 0;
+  for (int i = 0; i < count; i++) {
+    InputFile *file = &work->files[file_nums];
+    file->name = names[i];
+    if (stat(names[i], &file->st) == -1) {
+      /* Left to fail when opened. */
+      file_nums++;
+      continue;
+    }
+    char *key = index_key(names[i]);
+    long found = key ? word_index_find(index, key, &file->st) : -1;
+    if (found != -1) {
+      if (!word_index_begin_file(replay->writer, key, &file->st))
+        replay->failed = true;
+      word_index_replay(index, found, replay_word, replay);
+      (*reused)++;
+    } else {
+      file->counts = malloc(sizeof(word_count_list_t));
+      if (file->counts) init_words(file->counts);
+      if (!file->counts) replay->failed = true;
+      file_nums++;
+    }
+    free(key);
+    if (replay->failed) return false;
+  }
+  work->num_items = (size_t)file_nums * work->split;
+  return true;
+}
+
+/*
+ * Adds the counts of the files counted to the index, and to WCLIST, once
+ * the threads are done with them.
+ */
+static void index_counted(Work *work, int file_nums,
+                          word_count_list_t *wclist, Replay *replay) {
+  for (int i = 0; i < file_nums; i++) {
+    InputFile *file = &work->files[i];
+    if (!file->counts) continue;
+    char *key = index_key(file->name);
+    /* A file that could not be opened (its fileptr is still set once
+     * closed) is left out, to be tried again next time. */
+    if (file->fileptr &&
+        (!key || !word_index_begin_file(replay->writer, key, &file->st)))
+      replay->failed = true;
+    if (file->fileptr) for_each_word(file->counts, index_word, replay);
+    free(key);
+    merge_words(wclist, file->counts);
+    free(file->counts);
+  }
+}
+
+/*
+ * The K greatest words under LESS so far, kept as a min-heap: the least of
+ * them is at the root, and is the one a greater word displaces.
+ */
+typedef struct TopWords {
+  word_count_t **heap;
+  size_t size, k;
+  bool (*less)(const word_count_t *, const word_count_t *);
+} TopWords;
+
+static void sift_down(TopWords *top, size_t i) {
+  while (2 * i + 1 < top->size) {
+    size_t child = 2 * i + 1;
+    if (child + 1 < top->size &&
+        top->less(top->heap[child + 1], top->heap[child]))
+      child++;
+    if (!top->less(top->heap[child], top->heap[i])) break;
+    word_count_t *tmp = top->heap[i];
+    top->heap[i] = top->heap[child];
+    top->heap[child] = tmp;
+    i = child;
+  }
+}
+
+static void offer_word(word_count_t *wc, void *aux) {
+  TopWords *top = aux;
+  if (top->size < top->k) {
+    /* Sift up. */
+    size_t i = top->size++;
+    for (; i > 0 && top->less(wc, top->heap[(i - 1) / 2]); i = (i - 1) / 2)
+      top->heap[i] = top->heap[(i - 1) / 2];
+    top->heap[i] = wc;
+  } else if (top->less(top->heap[0], wc)) {
+    top->heap[0] = wc;
+    sift_down(top, 0);
+  }
+}
+
+/*
+ * Prints the K greatest words of WCLIST under LESS, least first, as the last
+ * K lines of a full wordcount_sort() and fprint_words() would be; but in
+ * O(n log k) rather than sorting all n words.
+ */
+static void fprint_top_words(word_count_list_t *wclist, size_t k,
+                             bool less(const word_count_t *,
+                                       const word_count_t *),
+                             FILE *outfile) {
+  size_t len = len_words(wclist);
+  if (k > len) k = len;
+  TopWords top = {malloc(k * sizeof(word_count_t *)), 0, k, less};
+  if (!top.heap) {
+    perror("malloc");
+    return;
+  }
+  for_each_word(wclist, offer_word, &top);
+
+  /* Popping the root repeatedly yields them least first. */
+  while (top.size > 0) {
+    word_count_t *wc = top.heap[0];
+    fprintf(outfile, "       %d\t%s\n", wc->count, wc->word);
+    top.heap[0] = top.heap[--top.size];
+    sift_down(&top, 0);
+  }
+  free(top.heap);
+}
+
+static void usage(char *name) {
+  fprintf(stderr,
+          "Usage: %s [--threads N] [--local] [--split[=N]] [--top K] "
+          "[--index FILE]\n"
+          "       [--vocabulary FILE] [--unicode] [--ngram N] [FILE...]\n"
+          "--threads (-t): Count with N threads (by default one per CPU).\n"
+          "--local (-l):   Count into a table per thread and merge the "
+          "tables at the end,\n"
+          "                instead of sharing one table between the "
+          "threads.\n"
+          "--split (-s):   Split each file into N ranges (by default one per "
+          "CPU), counted\n"
+          "                by the threads in parallel.\n"
+          "--top (-k):     Print only the K most frequent words.\n"
+          "--index (-i):   Keep the counts of each file in the index FILE, "
+          "and take those\n"
+          "                of files unchanged since the last run from it.\n"
+          "--vocabulary (-v): Count only the words in FILE, without locks "
+          "(hpwords only).\n"
+          "--unicode (-u): Count letters encoded in UTF-8, not only ASCII "
+          "ones.\n"
+          "--ngram (-n):   Count phrases of N words in a row, 2 to %d, "
+          "instead of words,\n"
+          "                into a table per thread (not spwords).\n",
+          name, NGRAM_MAX);
 }
 
 /*
- * main - handle command line, spawning one thread per file.
+ * main - handle command line, spawning the pool of threads.
  */
 int main(int argc, char *argv[]) {
+  bool local = false;
+  int split = 1;
+  long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  long top = 0;
+  char *index_path = NULL;
+  Vocabulary vocabulary = {0};
+  static struct option long_options[] = {{"threads", required_argument, 0, 't'},
+                                         {"local", no_argument, 0, 'l'},
+                                         {"split", optional_argument, 0, 's'},
+                                         {"top", required_argument, 0, 'k'},
+                                         {"index", required_argument, 0, 'i'},
+                                         {"vocabulary", required_argument, 0,
+                                          'v'},
+                                         {"unicode", no_argument, 0, 'u'},
+                                         {"ngram", required_argument, 0, 'n'},
+                                         {"help", no_argument, 0, 'h'},
+                                         {0, 0, 0, 0}};
+  int opt;
+  while ((opt = getopt_long(argc, argv, "t:ls::k:i:v:un:h", long_options,
+                            NULL)) != -1) {
+    switch (opt) {
+      case 't':
+        num_threads = atol(optarg);
+        if (num_threads < 1) {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'l':
+        local = true;
+        break;
+      case 's':
+        split = optarg ? atoi(optarg) : sysconf(_SC_NPROCESSORS_ONLN);
+        if (split < 1) {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'k':
+        top = atol(optarg);
+        if (top < 1) {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'i':
+#ifdef SKETCH
+        fprintf(stderr, "%s: approximate counts cannot be indexed\n",
+                argv[0]);
+        return 1;
+#endif
+        index_path = optarg;
+        break;
+      case 'v':
+#ifndef HASH_TABLE
+        fprintf(stderr, "%s: only hpwords can be seeded with a vocabulary\n",
+                argv[0]);
+        return 1;
+#endif
+        vocabulary.path = optarg;
+        break;
+      case 'u':
+        unicode = true;
+        break;
+      case 'n':
+#ifdef SKETCH
+        fprintf(stderr, "%s: approximate counts cannot count phrases\n",
+                argv[0]);
+        return 1;
+#endif
+        ngram = atoi(optarg);
+        if (ngram < 2 || ngram > NGRAM_MAX) {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+
+  /* The index would keep counts of only the vocabulary's words, or of words
+   * split differently. */
+  if (index_path && (vocabulary.path || unicode || ngram)) {
+    fprintf(stderr, "%s: --index cannot be used with --%s\n", argv[0],
+            vocabulary.path ? "vocabulary" : unicode ? "unicode" : "ngram");
+    return 1;
+  }
+  /* The vocabulary is of words, which phrases are not. */
+  if (vocabulary.path && ngram) {
+    fprintf(stderr, "%s: --vocabulary cannot be used with --ngram\n",
+            argv[0]);
+    return 1;
+  }
+  if (vocabulary.path && !read_vocabulary(&vocabulary)) {
+    perror(vocabulary.path);
+    return 1;
+  }
+
   /* Create the empty data structure. */
   word_count_list_t word_counts;
-  init_words(&word_counts);
+  if (!init_counts(&word_counts, &vocabulary)) return 1;
 
-  if (argc <= 1) {
+  if (optind == argc) {
     /* Process stdin in a single thread. */
-    count_words(&word_counts, stdin);
+    char *buffer = NULL;
+    size_t buffer_size = 0;
+    struct ngram_counter *ngrams = ngram ? ngram_counter_create(ngram) : NULL;
+    if (ngram && !ngrams) {
+      perror("ngram_counter_create");
+      return 1;
+    }
+    if (ngrams)
+      read_words(STDIN_FILENO, &buffer, &buffer_size, ngram_add_word, ngrams);
+    else
+      read_words(STDIN_FILENO, &buffer, &buffer_size, count_word,
+                 &word_counts);
+    free(buffer);
+    add_phrases(&word_counts, ngrams);
   } else {
-    /* Process multiple files in multiple threads. */
-    int file_nums = argc - 1;
-    FILE *infiles[file_nums];
-    pthread_t threads[file_nums];
-    Args args[file_nums];
-
-    // For each file, create a thread to count words.
-    for (int i = 0; i < file_nums; i++) {
-      infiles[i] = fopen(argv[i + 1], "r");
-      if (!infiles[i]) {
-        continue;
+    /* Process the files with a pool of threads, however many there are. */
+    int file_nums = argc - optind;
+    Work work = {.num_items = (size_t)file_nums * split, .split = split};
+    work.files = calloc(file_nums, sizeof(InputFile));
+    if (!work.files) {
+      perror("calloc");
+      return 1;
+    }
+    pthread_mutex_init(&work.lock, NULL);
+    for (int i = 0; i < file_nums; i++)
+      work.files[i].name = argv[optind + i];
+
+    /* With --index, only the files new or changed since it was written. */
+    struct word_index *index = NULL;
+    Replay replay = {.wclist = &word_counts};
+    int reused = 0;
+    if (index_path) {
+      index = word_index_open(index_path);
+      if (!index && errno != ENOENT)
+        fprintf(stderr, "%s: %s, rebuilding it\n", index_path,
+                strerror(errno));
+      replay.writer = word_index_writer_create();
+      if (!replay.writer || !replay_index(index, argv + optind, file_nums,
+                                          &work, &replay, &reused)) {
+        perror(index_path);
+        return 1;
       }
+      file_nums = work.num_items / split;
+    }
+    for (int i = 0; i < file_nums; i++) work.files[i].ranges_left = split;
 
-      args[i].wclistptr = &word_counts;
-      args[i].fileptr = infiles[i];
-      pthread_create(&threads[i], NULL, read_words_from_file, &args[i]);
+    if ((size_t)num_threads > work.num_items) num_threads = work.num_items;
+    Args *args = calloc(num_threads ? num_threads : 1, sizeof(Args));
+    if (!args) {
+      perror("calloc");
+      return 1;
+    }
+    for (int i = 0; i < num_threads; i++) {
+      args[i].work = &work;
+      args[i].index = i;
+      args[i].num_threads = num_threads;
+      args[i].all = args;
+      if (ngram && !(args[i].ngrams = ngram_counter_create(ngram))) {
+        perror("ngram_counter_create");
+        return 1;
+      }
+      if (local && !ngram) {
+        if (!init_counts(&args[i].local, &vocabulary)) return 1;
+        args[i].wclistptr = &args[i].local;
+      } else {
+        args[i].wclistptr = &word_counts;
+      }
     }
+    /* Last first, as a thread joins only those after it in merge_tables(). */
+    for (int i = num_threads - 1; i >= 0; i--)
+      pthread_create(&args[i].thread, NULL, count_words_worker, &args[i]);
 
-    for (int i = 0; i < file_nums; i++) {
-      pthread_join(threads[i], NULL);
+    if (local && !ngram && num_threads > 0) {
+      /* The others were joined by the merges. */
+      pthread_join(args[0].thread, NULL);
+      merge_words(&word_counts, &args[0].local);
+    } else {
+      for (int i = 0; i < num_threads; i++) pthread_join(args[i].thread, NULL);
     }
+    for (int i = 0; i < num_threads; i++)
+      add_phrases(&word_counts, args[i].ngrams);
+    free(args);
 
-    // Recycle file resources.
-    for (int i = 0; i < file_nums; i++) {
-      fclose(infiles[i]);
+    if (index_path) {
+      index_counted(&work, file_nums, &word_counts, &replay);
+      if (replay.failed) {
+        perror(index_path);
+        word_index_abort(replay.writer);
+      } else if (!word_index_commit(replay.writer, index_path)) {
+        perror(index_path);
+      } else {
+        fprintf(stderr, "%s: %d files taken from the index, %d counted\n",
+                index_path, reused, file_nums);
+      }
+      word_index_close(index);
     }
+    free(work.files);
   }
-
   /* Output final result of all threads' work. */
-  wordcount_sort(&word_counts, less_count);
-  fprint_words(&word_counts, stdout);
+#ifdef SKETCH
+  fprintf(stderr, "About %zu distinct words\n", len_words(&word_counts));
+#endif
+  if (top) {
+    fprint_top_words(&word_counts, top, less_count, stdout);
+  } else {
+    wordcount_sort(&word_counts, less_count);
+    fprint_words(&word_counts, stdout);
+  }
 
   return 0;
 }
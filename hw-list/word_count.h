@@ -33,10 +33,108 @@
 
 /*
  * Representation of a word count object and word count list object.
- * PINTOS_LIST and/or PTHREADS are #define'd prior to #include to select the
- * representations.
+ * SKETCH, HASH_TABLE or PINTOS_LIST, and/or PTHREADS are #define'd prior to
+ * #include to select the representations. With PINTOS_LIST and PTHREADS,
+ * COUNTED_LIST may be too, to keep the words in a counted list, so that
+ * len_words() needn't walk them, and RWLOCK, to guard them with a
+ * reader-writer lock rather than a mutex.
  */
 
+#ifdef SKETCH
+#include <stdint.h>
+
+typedef struct word_count {
+  char* word;
+  int count; /* An estimate, never below the true count. */
+  uint64_t hash;
+  int heap_index;
+} word_count_t;
+
+/*
+ * Approximate counts in fixed memory, for input whose distinct words would
+ * not fit in a table. Every word is counted in a Count-Min Sketch, which
+ * overestimates a word's count by at most EPSILON times the number of words
+ * added, with probability 1 - DELTA; and in a HyperLogLog, whose estimate of
+ * the number of distinct words, returned by len_words(), is off by about
+ * DISTINCT_ERROR (relative standard error). Only the TRACKED words with the
+ * highest estimates are kept, with those, and are the list as find_word(),
+ * fprint_words() and the rest see it.
+ *
+ * The bounds are read by init_words() from WORD_COUNT_EPSILON (default
+ * 0.0001), WORD_COUNT_DELTA (0.001), WORD_COUNT_DISTINCT_ERROR (0.01) and
+ * WORD_COUNT_TRACKED (1000) in the environment: the sketches take (e /
+ * EPSILON) * ln(1 / DELTA) * 4 bytes and (1.04 / DISTINCT_ERROR)^2 bytes.
+ *
+ * add_word() of a word that is not kept frees it, and returns an entry with
+ * its estimate but no word, good until the next add_word(). Lists being
+ * merged must have been initialized with the same bounds.
+ */
+typedef struct word_count_list {
+  struct word_count_sketch* sketch;
+} word_count_list_t;
+
+#elif defined(HASH_TABLE)
+#include <stdint.h>
+
+/* Words this short (with their NUL) are kept inside the entry. */
+#define WORD_COUNT_INLINE 16
+
+typedef struct word_count {
+  char* word; /* Points at inline_word when the word fits there. */
+  int count;
+  uint32_t hash;
+  char inline_word[WORD_COUNT_INLINE];
+} word_count_t;
+
+/*
+ * Open-addressing hash tables with linear probing, each kept at most half
+ * full; a slot with a NULL word is empty. Entries move when a table grows, so
+ * a pointer from find_word() or add_word() is good until the next add_word().
+ * wordcount_sort() records the order for fprint_words() in sorted, a NULL-
+ * terminated array, rather than moving entries, so lookups still work after
+ * it.
+ *
+ * With PTHREADS the words are striped across WORD_COUNT_SHARDS tables by the
+ * top bits of their hash, each with its own lock and cache line, so threads
+ * adding words mostly take different locks. Without, there is one table, and
+ * the whole list fits in the struct list the prebuilt lwords.o reserves for
+ * its table, so hwords reuses that main().
+ *
+ * A list with PTHREADS can instead be seeded with a fixed vocabulary, see
+ * seed_words(), and then counts only those words, in a table that never
+ * changes: each word has a slot of its own, found by a perfect hash, on a
+ * cache line of its own, and add_word() takes no lock but only increments
+ * the count atomically. Entries of a seeded list never move.
+ */
+#ifdef PTHREADS
+#include <pthread.h>
+#define WORD_COUNT_SHARD_BITS 6
+#define WORD_COUNT_SHARD_ALIGN __attribute__((aligned(64)))
+#else
+#define WORD_COUNT_SHARD_BITS 0
+#define WORD_COUNT_SHARD_ALIGN
+#endif
+#define WORD_COUNT_SHARDS (1 << WORD_COUNT_SHARD_BITS)
+
+struct word_count_shard {
+  word_count_t* slots;
+  size_t capacity; /* A power of two. */
+  size_t size;
+#ifdef PTHREADS
+  pthread_mutex_t lock;
+#endif
+} WORD_COUNT_SHARD_ALIGN;
+
+typedef struct word_count_list {
+  struct word_count_shard shards[WORD_COUNT_SHARDS];
+  word_count_t** sorted;
+#ifdef PTHREADS
+  struct word_count_vocabulary* vocabulary; /* NULL unless seeded. */
+#endif
+} word_count_list_t;
+
+#else /* HASH_TABLE */
+
 #ifdef PINTOS_LIST
 #include "list.h"
 typedef struct word_count {
@@ -48,8 +146,16 @@ typedef struct word_count {
 #ifdef PTHREADS
 #include <pthread.h>
 typedef struct word_count_list {
+#ifdef COUNTED_LIST
+  struct counted_list lst;
+#else
   struct list lst;
+#endif
+#ifdef RWLOCK
+  pthread_rwlock_t lock; /* Exclusive only to insert a word. */
+#else
   pthread_mutex_t lock;
+#endif
 } word_count_list_t;
 #else  /* PTHREADS */
 typedef struct list word_count_list_t;
@@ -66,9 +172,23 @@ typedef struct word_count {
 typedef word_count_t* word_count_list_t;
 #endif /* PINTOS_LIST */
 
+#endif /* HASH_TABLE */
+
 /* Initialize a word count list. */
 void init_words(word_count_list_t* wclist);
 
+#if defined(HASH_TABLE) && defined(PTHREADS)
+/*
+ * Seeds WCLIST, freshly initialized, with the NUM_WORDS words in WORDS
+ * (copied, and counted once however often they are repeated) at a count of
+ * zero, and freezes it: from then on add_word() only counts those words, and
+ * for any other frees it and returns an entry with no word, which must not
+ * be written to. Lists being merged must both be seeded with the same words,
+ * or neither. Returns false if out of memory.
+ */
+bool seed_words(word_count_list_t* wclist, char* const* words, size_t num_words);
+#endif
+
 /* Get length of a word count list. */
 size_t len_words(word_count_list_t* wclist);
 
@@ -81,6 +201,17 @@ word_count_t* find_word(word_count_list_t* wclist, char* word);
  */
 word_count_t* add_word(word_count_list_t* wclist, char* word);
 
+/*
+ * Add the counts in other to wclist, which takes ownership of its words, and
+ * leave other empty. Returns false if memory ran out before every word was
+ * added.
+ */
+bool merge_words(word_count_list_t* wclist, word_count_list_t* other);
+
+/* Call visit on every word in the list, in no particular order. */
+void for_each_word(word_count_list_t* wclist, void visit(word_count_t* wc, void* aux),
+                   void* aux);
+
 /* Print word counts to a file. */
 void fprint_words(word_count_list_t* wclist, FILE* outfile);
 
@@ -0,0 +1,517 @@
+/*
+ * Implementation of the word_count interface using open-addressing hash
+ * tables, so that counting a word takes amortized constant time instead of a
+ * scan of every distinct word seen so far. With PTHREADS the words are
+ * striped across tables with a lock each, or kept in a perfect hash table if
+ * seeded (see word_count.h).
+ */
+
+#ifndef HASH_TABLE
+#error "HASH_TABLE must be #define'd when compiling word_count_h.c"
+#endif
+
+#define _GNU_SOURCE /* qsort_r() */
+#include "word_count.h"
+#ifdef PTHREADS
+#include "word_print.h"
+#endif
+
+/* Slots in each table to begin with. */
+#define INITIAL_CAPACITY (1024 >> WORD_COUNT_SHARD_BITS)
+
+#ifdef PTHREADS
+#define LOCK(shard) pthread_mutex_lock(&(shard)->lock)
+#define UNLOCK(shard) pthread_mutex_unlock(&(shard)->lock)
+#else
+#define LOCK(shard)
+#define UNLOCK(shard)
+#endif
+
+/* FNV-1a. */
+static uint32_t hash_word(const char* word) {
+  uint32_t hash = 2166136261u;
+  for (const unsigned char* c = (const unsigned char*)word; *c; c++)
+    hash = (hash ^ *c) * 16777619u;
+  return hash;
+}
+
+/* The table for HASH: the top bits pick it, the bottom ones the slot. */
+static struct word_count_shard* shard_of(word_count_list_t* wclist,
+                                         uint32_t hash) {
+#if WORD_COUNT_SHARD_BITS > 0
+  return &wclist->shards[hash >> (32 - WORD_COUNT_SHARD_BITS)];
+#else
+  (void)hash;
+  return &wclist->shards[0];
+#endif
+}
+
+/* The slot holding WORD, or the empty slot where it would go. */
+static word_count_t* probe(struct word_count_shard* shard, const char* word,
+                           uint32_t hash) {
+  size_t mask = shard->capacity - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    word_count_t* wc = &shard->slots[i];
+    if (!wc->word || (wc->hash == hash && strcmp(wc->word, word) == 0))
+      return wc;
+  }
+}
+
+/* Moves the entry FROM into the empty slot TO. */
+static void move_entry(word_count_t* to, word_count_t* from) {
+  *to = *from;
+  if (from->word == from->inline_word) to->word = to->inline_word;
+}
+
+/* Doubles SHARD. Returns false, leaving it as it was, if out of memory. */
+static bool grow(struct word_count_shard* shard) {
+  size_t capacity = shard->capacity * 2;
+  word_count_t* slots = calloc(capacity, sizeof(word_count_t));
+  if (!slots) return false;
+
+  word_count_t* old_slots = shard->slots;
+  size_t old_capacity = shard->capacity;
+  shard->slots = slots;
+  shard->capacity = capacity;
+  for (size_t i = 0; i < old_capacity; i++) {
+    word_count_t* wc = &old_slots[i];
+    if (wc->word) move_entry(probe(shard, wc->word, wc->hash), wc);
+  }
+  free(old_slots);
+  return true;
+}
+
+/* Empties SHARD, whose words have been taken over or freed. */
+static void reset_shard(struct word_count_shard* shard) {
+  free(shard->slots);
+  shard->capacity = INITIAL_CAPACITY;
+  shard->slots = calloc(shard->capacity, sizeof(word_count_t));
+  shard->size = 0;
+}
+
+/*
+ * A seeded vocabulary: the words hashed into NUM_BUCKETS buckets, and the
+ * words of bucket b into slots by their hash mixed with DISPLACEMENTS[b],
+ * picked when seeding so that no two words share a slot ("hash, displace").
+ */
+struct word_count_vocabulary {
+  struct vocabulary_slot {
+    word_count_t wc;
+  } __attribute__((aligned(64))) * slots;
+  size_t num_slots, num_buckets, num_words;
+  uint32_t* displacements;
+  word_count_t missed; /* What add_word() returns for other words. */
+};
+
+#ifdef PTHREADS
+#define VOCABULARY(wclist) ((wclist)->vocabulary)
+#else
+#define VOCABULARY(wclist) ((struct word_count_vocabulary*)NULL)
+#endif
+
+/* FNV-1a, 64 bits wide for the perfect hash. */
+static uint64_t hash_word64(const char* word) {
+  uint64_t hash = 14695981039346656037u;
+  for (const unsigned char* c = (const unsigned char*)word; *c; c++)
+    hash = (hash ^ *c) * 1099511628211u;
+  return hash;
+}
+
+/* Scales the 32 bits X to [0, N). */
+static size_t scale(uint32_t x, size_t n) { return (uint64_t)x * n >> 32; }
+
+static size_t bucket_of(struct word_count_vocabulary* vocabulary,
+                        uint64_t hash) {
+  return scale(hash >> 32, vocabulary->num_buckets);
+}
+
+static size_t slot_of(struct word_count_vocabulary* vocabulary, uint64_t hash,
+                      uint32_t displacement) {
+  /* The splitmix64 finalizer, so displacements rehash independently. */
+  uint64_t x = hash ^ (displacement * 0x9e3779b97f4a7c15u);
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9u;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebu;
+  return scale(x ^ (x >> 31), vocabulary->num_slots);
+}
+
+/* The entry of WORD in VOCABULARY, or NULL if it is not one of its words. */
+static word_count_t* vocabulary_find(struct word_count_vocabulary* vocabulary,
+                                     const char* word) {
+  uint64_t hash = hash_word64(word);
+  uint32_t displacement =
+      vocabulary->displacements[bucket_of(vocabulary, hash)];
+  word_count_t* wc = &vocabulary->slots[slot_of(vocabulary, hash,
+                                                displacement)].wc;
+  return wc->word && strcmp(wc->word, word) == 0 ? wc : NULL;
+}
+
+static word_count_t* vocabulary_slot(struct word_count_vocabulary* vocabulary,
+                                     size_t i) {
+  word_count_t* wc = &vocabulary->slots[i].wc;
+  return wc->word ? wc : NULL;
+}
+
+/* Drops the order wordcount_sort() recorded, once it misses a word. */
+static void forget_order(word_count_list_t* wclist) {
+  if (wclist->sorted)
+    free(__atomic_exchange_n(&wclist->sorted, NULL, __ATOMIC_ACQ_REL));
+}
+
+void init_words(word_count_list_t* wclist) {
+  for (int s = 0; s < WORD_COUNT_SHARDS; s++) {
+    struct word_count_shard* shard = &wclist->shards[s];
+    shard->slots = NULL;
+    reset_shard(shard);
+#ifdef PTHREADS
+    pthread_mutex_init(&shard->lock, NULL);
+#endif
+  }
+  wclist->sorted = NULL;
+#ifdef PTHREADS
+  wclist->vocabulary = NULL;
+#endif
+}
+
+#ifdef PTHREADS
+/* Tries at each number of slots to place a bucket before there are more. */
+#define MAX_DISPLACEMENT (1u << 20)
+
+static int compare_words(const void* a, const void* b) {
+  return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/* Orders buckets by decreasing size, with their ends in AUX. */
+static int compare_buckets(const void* a, const void* b, void* aux) {
+  const size_t* ends = aux;
+  size_t bucket1 = *(const size_t*)a, bucket2 = *(const size_t*)b;
+  size_t size1 = ends[bucket1] - (bucket1 ? ends[bucket1 - 1] : 0);
+  size_t size2 = ends[bucket2] - (bucket2 ? ends[bucket2 - 1] : 0);
+  return size1 < size2 ? 1 : size1 > size2 ? -1 : 0;
+}
+
+/*
+ * Puts the NUM_WORDS distinct WORDS in distinct slots of VOCABULARY, whose
+ * slots are empty: bucket by bucket, the largest first while most slots are
+ * free, it tries displacements until one puts all of the bucket's words in
+ * free slots. Returns false if one fits nowhere, or if out of memory.
+ */
+static bool place_words(struct word_count_vocabulary* vocabulary,
+                        char** words, size_t num_words) {
+  size_t num_buckets = vocabulary->num_buckets;
+  uint64_t* hashes = malloc(num_words * sizeof(uint64_t));
+  size_t* ends = calloc(num_buckets + 1, sizeof(size_t));
+  size_t* members = malloc(num_words * sizeof(size_t));
+  size_t* buckets = malloc(num_buckets * sizeof(size_t));
+  size_t* tried = malloc(num_words * sizeof(size_t));
+  bool placed = hashes && ends && members && buckets && tried;
+
+  if (placed) {
+    /* Groups the words by bucket, bucket b's in [ends[b - 1], ends[b]). */
+    for (size_t i = 0; i < num_words; i++) {
+      hashes[i] = hash_word64(words[i]);
+      ends[bucket_of(vocabulary, hashes[i]) + 1]++;
+    }
+    for (size_t b = 0; b < num_buckets; b++) ends[b + 1] += ends[b];
+    for (size_t i = 0; i < num_words; i++)
+      members[ends[bucket_of(vocabulary, hashes[i])]++] = i;
+    for (size_t b = 0; b < num_buckets; b++) buckets[b] = b;
+    qsort_r(buckets, num_buckets, sizeof(size_t), compare_buckets, ends);
+  }
+
+  for (size_t i = 0; placed && i < num_buckets; i++) {
+    size_t b = buckets[i];
+    size_t begin = b ? ends[b - 1] : 0, size = ends[b] - begin;
+    if (size == 0) break; /* As are all the ones after it. */
+    uint32_t displacement;
+    for (displacement = 0; displacement < MAX_DISPLACEMENT; displacement++) {
+      size_t k;
+      for (k = 0; k < size; k++) {
+        tried[k] = slot_of(vocabulary, hashes[members[begin + k]],
+                           displacement);
+        if (vocabulary->slots[tried[k]].wc.word) break;
+        size_t j = 0;
+        while (j < k && tried[j] != tried[k]) j++;
+        if (j < k) break;
+      }
+      if (k == size) break;
+    }
+    if (displacement == MAX_DISPLACEMENT) {
+      placed = false;
+      break;
+    }
+    vocabulary->displacements[b] = displacement;
+    for (size_t k = 0; k < size; k++)
+      vocabulary->slots[tried[k]].wc.word = words[members[begin + k]];
+  }
+  free(hashes);
+  free(ends);
+  free(members);
+  free(buckets);
+  free(tried);
+  return placed;
+}
+
+static void free_vocabulary(struct word_count_vocabulary* vocabulary) {
+  free(vocabulary->slots);
+  free(vocabulary->displacements);
+  free(vocabulary);
+}
+
+bool seed_words(word_count_list_t* wclist, char* const* words,
+                size_t num_words) {
+  struct word_count_vocabulary* vocabulary = calloc(1, sizeof(*vocabulary));
+  char** unique = malloc((num_words ? num_words : 1) * sizeof(char*));
+  if (!vocabulary || !unique) {
+    free(vocabulary);
+    free(unique);
+    return false;
+  }
+
+  /* Copies each word once. */
+  memcpy(unique, words, num_words * sizeof(char*));
+  qsort(unique, num_words, sizeof(char*), compare_words);
+  size_t n = 0;
+  bool copied = true;
+  for (size_t i = 0; copied && i < num_words; i++) {
+    if (n > 0 && strcmp(unique[n - 1], unique[i]) == 0) continue;
+    copied = (unique[n] = strdup(unique[i])) != NULL;
+    if (copied) n++;
+  }
+
+  /* The words one per four buckets, and in four fifths of the slots: more
+   * are tried if they do not fit. */
+  vocabulary->num_words = n;
+  vocabulary->num_buckets = n / 4 + 1;
+  vocabulary->displacements =
+      calloc(vocabulary->num_buckets, sizeof(uint32_t));
+  bool placed = false;
+  size_t num_slots = n + n / 4 + 1;
+  for (int tries = 0;
+       copied && vocabulary->displacements && !placed && tries < 4;
+       tries++, num_slots *= 2) {
+    free(vocabulary->slots);
+    vocabulary->num_slots = num_slots;
+    vocabulary->slots =
+        aligned_alloc(64, num_slots * sizeof(struct vocabulary_slot));
+    if (!vocabulary->slots) break;
+    memset(vocabulary->slots, 0, num_slots * sizeof(struct vocabulary_slot));
+    placed = place_words(vocabulary, unique, n);
+  }
+  if (!placed) {
+    for (size_t i = 0; i < n; i++) free(unique[i]);
+    free(unique);
+    free_vocabulary(vocabulary);
+    return false;
+  }
+  free(unique);
+
+  for (size_t i = 0; i < vocabulary->num_slots; i++) {
+    word_count_t* wc = vocabulary_slot(vocabulary, i);
+    size_t length = wc ? strlen(wc->word) : 0;
+    if (wc && length < WORD_COUNT_INLINE) {
+      memcpy(wc->inline_word, wc->word, length + 1);
+      free(wc->word);
+      wc->word = wc->inline_word;
+    }
+  }
+  forget_order(wclist);
+  wclist->vocabulary = vocabulary;
+  return true;
+}
+#endif
+
+size_t len_words(word_count_list_t* wclist) {
+  if (VOCABULARY(wclist)) return VOCABULARY(wclist)->num_words;
+  size_t len = 0;
+  for (int s = 0; s < WORD_COUNT_SHARDS; s++) {
+    struct word_count_shard* shard = &wclist->shards[s];
+    LOCK(shard);
+    len += shard->size;
+    UNLOCK(shard);
+  }
+  return len;
+}
+
+word_count_t* find_word(word_count_list_t* wclist, char* word) {
+  if (VOCABULARY(wclist)) return vocabulary_find(VOCABULARY(wclist), word);
+  uint32_t hash = hash_word(word);
+  struct word_count_shard* shard = shard_of(wclist, hash);
+  LOCK(shard);
+  word_count_t* wc = shard->slots ? probe(shard, word, hash) : NULL;
+  UNLOCK(shard);
+  return wc && wc->word ? wc : NULL;
+}
+
+word_count_t* add_word(word_count_list_t* wclist, char* word) {
+  struct word_count_vocabulary* vocabulary = VOCABULARY(wclist);
+  if (vocabulary) {
+    word_count_t* wc = vocabulary_find(vocabulary, word);
+    if (wc) __atomic_fetch_add(&wc->count, 1, __ATOMIC_RELAXED);
+    free(word);
+    return wc ? wc : &vocabulary->missed;
+  }
+
+  uint32_t hash = hash_word(word);
+  struct word_count_shard* shard = shard_of(wclist, hash);
+  LOCK(shard);
+  if (!shard->slots) {
+    UNLOCK(shard);
+    return NULL;
+  }
+  word_count_t* wc = probe(shard, word, hash);
+  if (wc->word) {
+    wc->count++;
+    UNLOCK(shard);
+    free(word);
+    return wc;
+  }
+
+  if ((shard->size + 1) * 2 > shard->capacity) {
+    if (!grow(shard)) {
+      UNLOCK(shard);
+      return NULL;
+    }
+    wc = probe(shard, word, hash);
+  }
+  forget_order(wclist);
+
+  size_t length = strlen(word);
+  if (length < WORD_COUNT_INLINE) {
+    memcpy(wc->inline_word, word, length + 1);
+    wc->word = wc->inline_word;
+    free(word);
+  } else {
+    wc->word = word;
+  }
+  wc->count = 1;
+  wc->hash = hash;
+  shard->size++;
+  UNLOCK(shard);
+  return wc;
+}
+
+bool merge_words(word_count_list_t* wclist, word_count_list_t* other) {
+  if (VOCABULARY(wclist) || VOCABULARY(other)) {
+    if (!VOCABULARY(wclist) || !VOCABULARY(other)) return false;
+    /* Seeded with the same words, they put them in the same slots. */
+    for (size_t i = 0; i < VOCABULARY(wclist)->num_slots; i++) {
+      word_count_t* wc = vocabulary_slot(VOCABULARY(wclist), i);
+      word_count_t* from = vocabulary_slot(VOCABULARY(other), i);
+      if (wc && from) {
+        wc->count += from->count;
+        from->count = 0;
+      }
+    }
+    return true;
+  }
+
+  bool merged = true;
+  /* Both lists stripe a word into the same table. */
+  for (int s = 0; s < WORD_COUNT_SHARDS; s++) {
+    struct word_count_shard* shard = &wclist->shards[s];
+    struct word_count_shard* from_shard = &other->shards[s];
+    LOCK(shard);
+    LOCK(from_shard);
+    for (size_t i = 0; from_shard->slots && i < from_shard->capacity; i++) {
+      word_count_t* from = &from_shard->slots[i];
+      if (!from->word) continue;
+      word_count_t* to = probe(shard, from->word, from->hash);
+      if (to->word) {
+        to->count += from->count;
+        if (from->word != from->inline_word) free(from->word);
+        continue;
+      }
+
+      /* Short of memory to grow, the table fills up past half first. */
+      if ((shard->size + 1) * 2 > shard->capacity && grow(shard))
+        to = probe(shard, from->word, from->hash);
+      else if (shard->size + 1 == shard->capacity) {
+        merged = false;
+        if (from->word != from->inline_word) free(from->word);
+        continue;
+      }
+      move_entry(to, from);
+      shard->size++;
+    }
+    reset_shard(from_shard);
+    UNLOCK(from_shard);
+    UNLOCK(shard);
+  }
+  forget_order(wclist);
+  forget_order(other);
+  return merged;
+}
+
+void for_each_word(word_count_list_t* wclist,
+                   void visit(word_count_t* wc, void* aux), void* aux) {
+  if (VOCABULARY(wclist)) {
+    for (size_t i = 0; i < VOCABULARY(wclist)->num_slots; i++) {
+      word_count_t* wc = vocabulary_slot(VOCABULARY(wclist), i);
+      if (wc) visit(wc, aux);
+    }
+    return;
+  }
+  for (int s = 0; s < WORD_COUNT_SHARDS; s++) {
+    struct word_count_shard* shard = &wclist->shards[s];
+    LOCK(shard);
+    for (size_t i = 0; shard->slots && i < shard->capacity; i++)
+      if (shard->slots[i].word) visit(&shard->slots[i], aux);
+    UNLOCK(shard);
+  }
+}
+
+void fprint_words(word_count_list_t* wclist, FILE* outfile) {
+  if (wclist->sorted) {
+#ifdef PTHREADS
+    size_t n = 0;
+    while (wclist->sorted[n]) n++;
+    fprint_entries(wclist->sorted, n, outfile);
+#else
+    for (word_count_t** wc = wclist->sorted; *wc; wc++)
+      fprintf(outfile, "       %d\t%s\n", (*wc)->count, (*wc)->word);
+#endif
+    return;
+  }
+  for (size_t i = 0; VOCABULARY(wclist) && i < VOCABULARY(wclist)->num_slots;
+       i++) {
+    word_count_t* wc = vocabulary_slot(VOCABULARY(wclist), i);
+    if (wc) fprintf(outfile, "       %d\t%s\n", wc->count, wc->word);
+  }
+  for (int s = 0; !VOCABULARY(wclist) && s < WORD_COUNT_SHARDS; s++) {
+    struct word_count_shard* shard = &wclist->shards[s];
+    for (size_t i = 0; shard->slots && i < shard->capacity; i++) {
+      word_count_t* wc = &shard->slots[i];
+      if (wc->word) fprintf(outfile, "       %d\t%s\n", wc->count, wc->word);
+    }
+  }
+}
+
+static int compare_entries(const void* a, const void* b, void* aux) {
+  const word_count_t* wc1 = *(word_count_t* const*)a;
+  const word_count_t* wc2 = *(word_count_t* const*)b;
+  bool (*less)(const word_count_t*, const word_count_t*) = aux;
+  if (less(wc1, wc2)) return -1;
+  return less(wc2, wc1) ? 1 : 0;
+}
+
+void wordcount_sort(word_count_list_t* wclist,
+                    bool less(const word_count_t*, const word_count_t*)) {
+  forget_order(wclist);
+  word_count_t** sorted = malloc((len_words(wclist) + 1) * sizeof(*sorted));
+  if (!sorted) return;
+
+  size_t n = 0;
+  for (size_t i = 0; VOCABULARY(wclist) && i < VOCABULARY(wclist)->num_slots;
+       i++) {
+    word_count_t* wc = vocabulary_slot(VOCABULARY(wclist), i);
+    if (wc) sorted[n++] = wc;
+  }
+  for (int s = 0; !VOCABULARY(wclist) && s < WORD_COUNT_SHARDS; s++) {
+    struct word_count_shard* shard = &wclist->shards[s];
+    for (size_t i = 0; shard->slots && i < shard->capacity; i++)
+      if (shard->slots[i].word) sorted[n++] = &shard->slots[i];
+  }
+  sorted[n] = NULL;
+  qsort_r(sorted, n, sizeof(*sorted), compare_entries, less);
+  wclist->sorted = sorted;
+}
@@ -25,6 +25,8 @@
 #endif
 
 #include "word_count.h"
+#include "word_helpers.h"
+#include "word_sort.h"
 
 void init_words(word_count_list_t *wclist) { list_init(wclist); }
 
@@ -66,6 +68,30 @@ word_count_t *add_word(word_count_list_t *wclist, char *word) {
   }
 }
 
+bool merge_words(word_count_list_t *wclist, word_count_list_t *other) {
+  while (!list_empty(other)) {
+    struct list_elem *e = list_pop_front(other);
+    word_count_t *wc = list_entry(e, word_count_t, elem);
+    word_count_t *word_entry = find_word(wclist, wc->word);
+    if (word_entry) {
+      word_entry->count += wc->count;
+      free(wc->word);
+      free(wc);
+    } else {
+      list_push_back(wclist, e);
+    }
+  }
+  return true;
+}
+
+void for_each_word(word_count_list_t *wclist,
+                   void visit(word_count_t *wc, void *aux), void *aux) {
+  for (struct list_elem *e = list_begin(wclist); e != list_end(wclist);
+       e = list_next(e)) {
+    visit(list_entry(e, word_count_t, elem), aux);
+  }
+}
+
 void fprint_words(word_count_list_t *wclist, FILE *outfile) {
   for (struct list_elem *e = list_begin(wclist); e != list_end(wclist);
        e = list_next(e)) {
@@ -81,7 +107,30 @@ static bool less_list(const struct list_elem *ewc1,
   return ((bool (*)(const word_count_t *, const word_count_t *))aux)(wc1, wc2);
 }
 
+/*
+ * Sorts the list by count with sort_by_count(), gathering the entries into
+ * an array and relinking them in order. Returns false if out of memory.
+ */
+static bool sort_list_by_count(struct list *lst) {
+  size_t n = list_size(lst);
+  word_count_t **entries = malloc(n * sizeof(*entries));
+  if (!entries) return false;
+  size_t i = 0;
+  for (struct list_elem *e = list_begin(lst); e != list_end(lst);
+       e = list_next(e)) {
+    entries[i++] = list_entry(e, word_count_t, elem);
+  }
+  bool sorted = sort_by_count(entries, n);
+  if (sorted) {
+    list_init(lst);
+    for (i = 0; i < n; i++) list_push_back(lst, &entries[i]->elem);
+  }
+  free(entries);
+  return sorted;
+}
+
 void wordcount_sort(word_count_list_t *wclist,
                     bool less(const word_count_t *, const word_count_t *)) {
+  if (less == less_count && sort_list_by_count(wclist)) return;
   list_sort(wclist, less_list, less);
 }
\ No newline at end of file
@@ -29,51 +29,104 @@
 #endif
 
 #include "word_count.h"
+#include "word_helpers.h"
+#include "word_print.h"
+#include "word_sort.h"
+
+/* The words, in a counted list with COUNTED_LIST and a plain one without. */
+#ifdef COUNTED_LIST
+#define WORDS(wclist) (&(wclist)->lst.list)
+#define WORDS_INIT(wclist) counted_list_init(&(wclist)->lst)
+#define WORDS_SIZE(wclist) counted_list_size(&(wclist)->lst)
+#define WORDS_EMPTY(wclist) counted_list_empty(&(wclist)->lst)
+#define WORDS_PUSH_BACK(wclist, e) counted_list_push_back(&(wclist)->lst, e)
+#define WORDS_POP_FRONT(wclist) counted_list_pop_front(&(wclist)->lst)
+#else
+#define WORDS(wclist) (&(wclist)->lst)
+#define WORDS_INIT(wclist) list_init(WORDS(wclist))
+#define WORDS_SIZE(wclist) list_size(WORDS(wclist))
+#define WORDS_EMPTY(wclist) list_empty(WORDS(wclist))
+#define WORDS_PUSH_BACK(wclist, e) list_push_back(WORDS(wclist), e)
+#define WORDS_POP_FRONT(wclist) list_pop_front(WORDS(wclist))
+#endif
+
+/*
+ * With RWLOCK the list is guarded by a reader-writer lock: looking words up,
+ * and counting those already in it, takes it shared, with the count
+ * incremented atomically, and only inserting a new word takes it exclusive.
+ * Writers are preferred, so a stream of lookups cannot hold an insert off for
+ * good; the lock is not recursive, so the functions below that hold it look
+ * words up with lookup(), not find_word(). Without, it is guarded by a mutex,
+ * which READ_LOCK() and WRITE_LOCK() both simply take.
+ */
+#ifdef RWLOCK
+#define READ_LOCK(wclist) pthread_rwlock_rdlock(&(wclist)->lock)
+#define WRITE_LOCK(wclist) pthread_rwlock_wrlock(&(wclist)->lock)
+#define UNLOCK(wclist) pthread_rwlock_unlock(&(wclist)->lock)
+#else
+#define READ_LOCK(wclist) pthread_mutex_lock(&(wclist)->lock)
+#define WRITE_LOCK(wclist) pthread_mutex_lock(&(wclist)->lock)
+#define UNLOCK(wclist) pthread_mutex_unlock(&(wclist)->lock)
+#endif
 
 void init_words(word_count_list_t* wclist) {
-  list_init(&wclist->lst);
+  WORDS_INIT(wclist);
 
+#ifdef RWLOCK
+  pthread_rwlockattr_t attr;
+  pthread_rwlockattr_init(&attr);
+  pthread_rwlockattr_setkind_np(&attr,
+                                PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+  pthread_rwlock_init(&wclist->lock, &attr);
+  pthread_rwlockattr_destroy(&attr);
+#else
   pthread_mutexattr_t attr;
   pthread_mutexattr_init(&attr);
   pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE_NP);
   pthread_mutex_init(&wclist->lock, &attr);
+#endif
 }
 
 size_t len_words(word_count_list_t* wclist) {
   /* Critical section. */
-  pthread_mutex_lock(&wclist->lock);
-  size_t len = 0;
-  struct list_elem* begin = list_begin(&wclist->lst);
-  struct list_elem* end = list_end(&wclist->lst);
-  for (struct list_elem* e = begin; e != end; e = list_next(e)) {
-    len++;
-  }
-  pthread_mutex_unlock(&wclist->lock);
+  READ_LOCK(wclist);
+  size_t len = WORDS_SIZE(wclist);
+  UNLOCK(wclist);
 
   return len;
 }
 
-word_count_t* find_word(word_count_list_t* wclist, char* word) {
-  pthread_mutex_lock(&wclist->lock);
-  word_count_t* res = NULL;
-  struct list_elem* begin = list_begin(&wclist->lst);
-  struct list_elem* end = list_end(&wclist->lst);
-  for (struct list_elem* e = begin; e != end; e = list_next(e)) {
+/* Finds WORD among the entries after AFTER, with the lock held. */
+static word_count_t* lookup(word_count_list_t* wclist, struct list_elem* after,
+                            const char* word) {
+  struct list_elem* end = list_end(WORDS(wclist));
+  for (struct list_elem* e = list_next(after); e != end; e = list_next(e)) {
     word_count_t* wc = list_entry(e, word_count_t, elem);
-    char* store_word = wc->word;
-    if (strcmp(store_word, word) == 0) {
-      res = wc;
-      break;
-    }
+    if (strcmp(wc->word, word) == 0) return wc;
   }
+  return NULL;
+}
 
-  pthread_mutex_unlock(&wclist->lock);
+word_count_t* find_word(word_count_list_t* wclist, char* word) {
+  READ_LOCK(wclist);
+  word_count_t* res = lookup(wclist, list_head(WORDS(wclist)), word);
+  UNLOCK(wclist);
   return res;
 }
 
 word_count_t* add_word(word_count_list_t* wclist, char* word) {
-  pthread_mutex_lock(&wclist->lock);
-  word_count_t* word_entry = find_word(wclist, word);
+  READ_LOCK(wclist);
+  word_count_t* word_entry =
+      lookup(wclist, list_head(WORDS(wclist)), word);
+  /* Words are only ever appended while counting, so another thread can only
+   * have inserted this one after what was the last entry. */
+  struct list_elem* last = list_rbegin(WORDS(wclist));
+  if (word_entry) __atomic_fetch_add(&word_entry->count, 1, __ATOMIC_RELAXED);
+  UNLOCK(wclist);
+  if (word_entry) return word_entry;
+
+  WRITE_LOCK(wclist);
+  word_entry = lookup(wclist, last, word);
   if (word_entry) {
     /* If present. */
     word_entry->count++;
@@ -82,16 +135,58 @@ word_count_t* add_word(word_count_list_t* wclist, char* word) {
     word_count_t* new_word_entry = (word_count_t*)malloc(sizeof(word_count_t));
     new_word_entry->count = 1;
     new_word_entry->word = word;
-    list_push_back(wclist, &new_word_entry->elem);
+    WORDS_PUSH_BACK(wclist, &new_word_entry->elem);
     word_entry = new_word_entry;
   }
-  pthread_mutex_unlock(&wclist->lock);
+  UNLOCK(wclist);
   return word_entry;
 }
 
+bool merge_words(word_count_list_t* wclist, word_count_list_t* other) {
+  WRITE_LOCK(wclist);
+  WRITE_LOCK(other);
+  while (!WORDS_EMPTY(other)) {
+    struct list_elem* e = WORDS_POP_FRONT(other);
+    word_count_t* wc = list_entry(e, word_count_t, elem);
+    word_count_t* word_entry =
+        lookup(wclist, list_head(WORDS(wclist)), wc->word);
+    if (word_entry) {
+      word_entry->count += wc->count;
+      free(wc->word);
+      free(wc);
+    } else {
+      WORDS_PUSH_BACK(wclist, e);
+    }
+  }
+  UNLOCK(other);
+  UNLOCK(wclist);
+  return true;
+}
+
+void for_each_word(word_count_list_t* wclist,
+                   void visit(word_count_t* wc, void* aux), void* aux) {
+  READ_LOCK(wclist);
+  struct list_elem* begin = list_begin(WORDS(wclist));
+  struct list_elem* end = list_end(WORDS(wclist));
+  for (struct list_elem* e = begin; e != end; e = list_next(e)) {
+    visit(list_entry(e, word_count_t, elem), aux);
+  }
+  UNLOCK(wclist);
+}
+
 void fprint_words(word_count_list_t* wclist, FILE* outfile) {
-  struct list_elem* begin = list_begin(&wclist->lst);
-  struct list_elem* end = list_end(&wclist->lst);
+  struct list_elem* begin = list_begin(WORDS(wclist));
+  struct list_elem* end = list_end(WORDS(wclist));
+  size_t n = WORDS_SIZE(wclist);
+  word_count_t** entries = malloc(n * sizeof(*entries));
+  if (entries) {
+    size_t i = 0;
+    for (struct list_elem* e = begin; e != end; e = list_next(e))
+      entries[i++] = list_entry(e, word_count_t, elem);
+    fprint_entries(entries, n, outfile);
+    free(entries);
+    return;
+  }
   for (struct list_elem* e = begin; e != end; e = list_next(e)) {
     word_count_t* wc = list_entry(e, word_count_t, elem);
     fprintf(outfile, "       %d\t%s\n", wc->count, wc->word);
@@ -105,7 +200,31 @@ static bool less_list(const struct list_elem* ewc1,
   return ((bool (*)(const word_count_t*, const word_count_t*))aux)(wc1, wc2);
 }
 
+/*
+ * Sorts the list by count with sort_by_count(), gathering the entries into
+ * an array and relinking them in order. Returns false if out of memory.
+ */
+static bool sort_list_by_count(word_count_list_t* wclist) {
+  struct list* lst = WORDS(wclist);
+  size_t n = WORDS_SIZE(wclist);
+  word_count_t** entries = malloc(n * sizeof(*entries));
+  if (!entries) return false;
+  size_t i = 0;
+  for (struct list_elem* e = list_begin(lst); e != list_end(lst);
+       e = list_next(e)) {
+    entries[i++] = list_entry(e, word_count_t, elem);
+  }
+  bool sorted = sort_by_count(entries, n);
+  if (sorted) {
+    list_init(lst);
+    for (i = 0; i < n; i++) list_push_back(lst, &entries[i]->elem);
+  }
+  free(entries);
+  return sorted;
+}
+
 void wordcount_sort(word_count_list_t* wclist,
-                    bool less(const word_count_t*, const word_count_t*)) {
-  list_sort(&wclist->lst, less_list, less);
+                    bool less(const word_count_t* , const word_count_t* )) {
+  if (less == less_count && sort_list_by_count(wclist)) return;
+  list_sort(WORDS(wclist), less_list, less);
 }
\ No newline at end of file
@@ -0,0 +1,401 @@
+/*
+ * Implementation of the word_count interface with a Count-Min Sketch for the
+ * counts, a HyperLogLog for the number of distinct words, and a min-heap of
+ * the words with the highest counts (see word_count.h).
+ */
+
+#ifndef SKETCH
+#error "SKETCH must be #define'd when compiling word_count_s.c"
+#endif
+
+#define _GNU_SOURCE /* qsort_r() */
+#include "word_count.h"
+
+#include <limits.h>
+#include <math.h>
+
+#ifdef PTHREADS
+#include <pthread.h>
+#define LOCK(sketch) pthread_mutex_lock(&(sketch)->lock)
+#define UNLOCK(sketch) pthread_mutex_unlock(&(sketch)->lock)
+#else
+#define LOCK(sketch)
+#define UNLOCK(sketch)
+#endif
+
+#define DEFAULT_EPSILON 0.0001
+#define DEFAULT_DELTA 0.001
+#define DEFAULT_DISTINCT_ERROR 0.01
+#define DEFAULT_TRACKED 1000
+
+struct word_count_sketch {
+  /* Count-Min Sketch: DEPTH rows of WIDTH counters. */
+  uint32_t* counters;
+  size_t width;
+  int depth;
+
+  /* HyperLogLog: 2^REGISTER_BITS registers. */
+  uint8_t* registers;
+  int register_bits;
+
+  /* The words kept, at most TRACKED of them; INDEX maps hashes to ENTRIES
+   * (-1 for an empty slot), HEAP orders them by count, least first. */
+  word_count_t* entries;
+  size_t tracked, num_entries;
+  int32_t* index;
+  size_t index_mask;
+  int32_t* heap;
+
+  word_count_t untracked;
+  word_count_t** sorted; /* NULL-terminated, from wordcount_sort(). */
+#ifdef PTHREADS
+  pthread_mutex_t lock;
+#endif
+};
+
+static double env_double(const char* name, double fallback) {
+  char* value = getenv(name);
+  double parsed = value ? atof(value) : 0;
+  return parsed > 0 && parsed < 1 ? parsed : fallback;
+}
+
+/* FNV-1a, then the splitmix64 finalizer, so every bit of the hash depends on
+ * every bit of the word: the sketches slice it up. */
+static uint64_t hash_word(const char* word) {
+  uint64_t hash = 14695981039346656037ull;
+  for (const unsigned char* c = (const unsigned char*)word; *c; c++)
+    hash = (hash ^ *c) * 1099511628211ull;
+  hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ull;
+  hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebull;
+  return hash ^ (hash >> 31);
+}
+
+/* Row ROW's counter for HASH, by double hashing. */
+static uint32_t* counter(struct word_count_sketch* sketch, uint64_t hash,
+                         int row) {
+  uint32_t h1 = hash, h2 = (hash >> 32) | 1;
+  return &sketch->counters[row * sketch->width +
+                           (h1 + (uint64_t)row * h2) % sketch->width];
+}
+
+static uint32_t estimate(struct word_count_sketch* sketch, uint64_t hash) {
+  uint32_t least = UINT32_MAX;
+  for (int row = 0; row < sketch->depth; row++) {
+    uint32_t count = *counter(sketch, hash, row);
+    if (count < least) least = count;
+  }
+  return least;
+}
+
+/* Adds one to HASH's count with a conservative update: only the counters at
+ * the current estimate are raised, which keeps the others' overestimates
+ * down. Returns the new estimate. */
+static uint32_t count_hash(struct word_count_sketch* sketch, uint64_t hash) {
+  uint32_t least = estimate(sketch, hash);
+  if (least == UINT32_MAX) return least;
+  for (int row = 0; row < sketch->depth; row++) {
+    uint32_t* count = counter(sketch, hash, row);
+    if (*count == least) *count = least + 1;
+  }
+  return least + 1;
+}
+
+static void observe_hash(struct word_count_sketch* sketch, uint64_t hash) {
+  int bits = sketch->register_bits;
+  /* The sentinel bit caps the rank when the rest of the hash is zero. */
+  uint8_t rank =
+      __builtin_clzll((hash << bits) | (1ull << (bits - 1))) + 1;
+  uint8_t* reg = &sketch->registers[hash >> (64 - bits)];
+  if (rank > *reg) *reg = rank;
+}
+
+static int entry_count(uint32_t count) {
+  return count > INT_MAX ? INT_MAX : (int)count;
+}
+
+/* Heap of entries, by count. */
+
+static word_count_t* heap_entry(struct word_count_sketch* sketch, size_t i) {
+  return &sketch->entries[sketch->heap[i]];
+}
+
+static void heap_swap(struct word_count_sketch* sketch, size_t i, size_t j) {
+  int32_t tmp = sketch->heap[i];
+  sketch->heap[i] = sketch->heap[j];
+  sketch->heap[j] = tmp;
+  heap_entry(sketch, i)->heap_index = i;
+  heap_entry(sketch, j)->heap_index = j;
+}
+
+static void sift_up(struct word_count_sketch* sketch, size_t i) {
+  for (; i > 0 && heap_entry(sketch, i)->count <
+                      heap_entry(sketch, (i - 1) / 2)->count;
+       i = (i - 1) / 2)
+    heap_swap(sketch, i, (i - 1) / 2);
+}
+
+static void sift_down(struct word_count_sketch* sketch, size_t i) {
+  size_t size = sketch->num_entries;
+  while (2 * i + 1 < size) {
+    size_t child = 2 * i + 1;
+    if (child + 1 < size &&
+        heap_entry(sketch, child + 1)->count < heap_entry(sketch, child)->count)
+      child++;
+    if (heap_entry(sketch, child)->count >= heap_entry(sketch, i)->count)
+      break;
+    heap_swap(sketch, i, child);
+    i = child;
+  }
+}
+
+/* Index of entries, by word. */
+
+/* The index slot holding WORD, or the empty one where it would go. */
+static size_t index_slot(struct word_count_sketch* sketch, const char* word,
+                         uint64_t hash) {
+  size_t mask = sketch->index_mask;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    int32_t entry = sketch->index[i];
+    if (entry == -1) return i;
+    word_count_t* wc = &sketch->entries[entry];
+    if (wc->hash == hash && strcmp(wc->word, word) == 0) return i;
+  }
+}
+
+/* Empties index slot I, moving back the entries probed past it so that none
+ * is cut off from its home slot. */
+static void index_remove(struct word_count_sketch* sketch, size_t i) {
+  size_t mask = sketch->index_mask;
+  for (size_t j = (i + 1) & mask; sketch->index[j] != -1; j = (j + 1) & mask) {
+    size_t home = sketch->entries[sketch->index[j]].hash & mask;
+    /* Whether HOME lies cyclically in (I, J]: then J stays reachable. */
+    bool reachable = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+    if (reachable) continue;
+    sketch->index[i] = sketch->index[j];
+    i = j;
+  }
+  sketch->index[i] = -1;
+}
+
+static void forget_order(struct word_count_sketch* sketch) {
+  free(sketch->sorted);
+  sketch->sorted = NULL;
+}
+
+/* Keeps WORD, with COUNT, if there is room or it beats the least of the
+ * words kept, which it displaces. Returns its entry, or NULL if it is not
+ * kept; either way WORD is taken over. */
+static word_count_t* offer(struct word_count_sketch* sketch, char* word,
+                           uint64_t hash, uint32_t count) {
+  if (sketch->tracked == 0) {
+    free(word);
+    return NULL;
+  }
+  int32_t entry;
+  if (sketch->num_entries < sketch->tracked) {
+    entry = sketch->num_entries++;
+    sketch->heap[entry] = entry;
+    sketch->entries[entry].heap_index = entry;
+  } else {
+    word_count_t* least = heap_entry(sketch, 0);
+    if (entry_count(count) <= least->count) {
+      free(word);
+      return NULL;
+    }
+    index_remove(sketch, index_slot(sketch, least->word, least->hash));
+    free(least->word);
+    entry = sketch->heap[0];
+  }
+  forget_order(sketch);
+
+  word_count_t* wc = &sketch->entries[entry];
+  wc->word = word;
+  wc->hash = hash;
+  wc->count = entry_count(count);
+  sketch->index[index_slot(sketch, word, hash)] = entry;
+  sift_up(sketch, wc->heap_index);
+  sift_down(sketch, wc->heap_index);
+  return wc;
+}
+
+static void clear_sketch(struct word_count_sketch* sketch) {
+  for (size_t i = 0; i < sketch->num_entries; i++)
+    free(sketch->entries[i].word);
+  sketch->num_entries = 0;
+  memset(sketch->index, -1, (sketch->index_mask + 1) * sizeof(int32_t));
+  memset(sketch->counters, 0,
+         sketch->width * sketch->depth * sizeof(uint32_t));
+  memset(sketch->registers, 0, (size_t)1 << sketch->register_bits);
+  forget_order(sketch);
+}
+
+void init_words(word_count_list_t* wclist) {
+  double epsilon = env_double("WORD_COUNT_EPSILON", DEFAULT_EPSILON);
+  double delta = env_double("WORD_COUNT_DELTA", DEFAULT_DELTA);
+  double error =
+      env_double("WORD_COUNT_DISTINCT_ERROR", DEFAULT_DISTINCT_ERROR);
+  char* tracked = getenv("WORD_COUNT_TRACKED");
+
+  struct word_count_sketch* sketch = calloc(1, sizeof(*sketch));
+  if (!sketch) {
+    perror("Failed to allocate the word count sketch");
+    exit(1);
+  }
+  sketch->width = ceil(M_E / epsilon);
+  sketch->depth = ceil(log(1 / delta));
+  /* The standard error is 1.04 / sqrt(registers). */
+  double registers = (1.04 / error) * (1.04 / error);
+  for (sketch->register_bits = 4;
+       sketch->register_bits < 24 &&
+       (double)(1 << sketch->register_bits) < registers;
+       sketch->register_bits++)
+    ;
+  sketch->tracked = tracked ? strtoul(tracked, NULL, 10) : DEFAULT_TRACKED;
+  if (sketch->tracked > INT32_MAX / 2) sketch->tracked = INT32_MAX / 2;
+
+  size_t index_size = 2;
+  while (index_size < sketch->tracked * 2) index_size *= 2;
+  sketch->index_mask = index_size - 1;
+
+  sketch->counters = malloc(sketch->width * sketch->depth * sizeof(uint32_t));
+  sketch->registers = malloc((size_t)1 << sketch->register_bits);
+  sketch->entries = malloc((sketch->tracked + 1) * sizeof(word_count_t));
+  sketch->index = malloc(index_size * sizeof(int32_t));
+  sketch->heap = malloc((sketch->tracked + 1) * sizeof(int32_t));
+  if (!sketch->counters || !sketch->registers || !sketch->entries ||
+      !sketch->index || !sketch->heap) {
+    perror("Failed to allocate the word count sketch");
+    exit(1);
+  }
+  clear_sketch(sketch);
+#ifdef PTHREADS
+  pthread_mutex_init(&sketch->lock, NULL);
+#endif
+  wclist->sketch = sketch;
+}
+
+/* The HyperLogLog estimate, with the small-range correction. */
+size_t len_words(word_count_list_t* wclist) {
+  struct word_count_sketch* sketch = wclist->sketch;
+  LOCK(sketch);
+  size_t m = (size_t)1 << sketch->register_bits;
+  double sum = 0;
+  size_t zeros = 0;
+  for (size_t i = 0; i < m; i++) {
+    sum += ldexp(1, -sketch->registers[i]);
+    if (sketch->registers[i] == 0) zeros++;
+  }
+  UNLOCK(sketch);
+
+  double estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+  if (estimate <= 2.5 * m && zeros > 0) estimate = m * log((double)m / zeros);
+  return estimate + 0.5;
+}
+
+word_count_t* find_word(word_count_list_t* wclist, char* word) {
+  struct word_count_sketch* sketch = wclist->sketch;
+  LOCK(sketch);
+  int32_t entry = sketch->index[index_slot(sketch, word, hash_word(word))];
+  UNLOCK(sketch);
+  return entry == -1 ? NULL : &sketch->entries[entry];
+}
+
+word_count_t* add_word(word_count_list_t* wclist, char* word) {
+  struct word_count_sketch* sketch = wclist->sketch;
+  uint64_t hash = hash_word(word);
+  LOCK(sketch);
+  observe_hash(sketch, hash);
+  uint32_t count = count_hash(sketch, hash);
+
+  word_count_t* wc;
+  int32_t entry = sketch->index[index_slot(sketch, word, hash)];
+  if (entry != -1) {
+    wc = &sketch->entries[entry];
+    wc->count = entry_count(count);
+    sift_down(sketch, wc->heap_index);
+    free(word);
+  } else if (!(wc = offer(sketch, word, hash, count))) {
+    wc = &sketch->untracked;
+    wc->word = NULL;
+    wc->count = entry_count(count);
+  }
+  UNLOCK(sketch);
+  return wc;
+}
+
+bool merge_words(word_count_list_t* wclist, word_count_list_t* other) {
+  struct word_count_sketch* sketch = wclist->sketch;
+  struct word_count_sketch* from = other->sketch;
+  LOCK(sketch);
+  LOCK(from);
+  for (size_t i = 0; i < sketch->width * sketch->depth; i++) {
+    uint64_t sum = (uint64_t)sketch->counters[i] + from->counters[i];
+    sketch->counters[i] = sum > UINT32_MAX ? UINT32_MAX : sum;
+  }
+  for (size_t i = 0; i < (size_t)1 << sketch->register_bits; i++)
+    if (from->registers[i] > sketch->registers[i])
+      sketch->registers[i] = from->registers[i];
+
+  /* Every estimate may have risen: re-read them, then restore the heap. */
+  for (size_t i = 0; i < sketch->num_entries; i++) {
+    word_count_t* wc = &sketch->entries[i];
+    wc->count = entry_count(estimate(sketch, wc->hash));
+  }
+  for (size_t i = sketch->num_entries / 2; i-- > 0;) sift_down(sketch, i);
+
+  for (size_t i = 0; i < from->num_entries; i++) {
+    word_count_t* wc = &from->entries[i];
+    if (sketch->index[index_slot(sketch, wc->word, wc->hash)] == -1)
+      offer(sketch, wc->word, wc->hash, estimate(sketch, wc->hash));
+    else
+      free(wc->word);
+  }
+  from->num_entries = 0;
+  clear_sketch(from);
+  forget_order(sketch);
+  UNLOCK(from);
+  UNLOCK(sketch);
+  return true;
+}
+
+void for_each_word(word_count_list_t* wclist,
+                   void visit(word_count_t* wc, void* aux), void* aux) {
+  struct word_count_sketch* sketch = wclist->sketch;
+  LOCK(sketch);
+  for (size_t i = 0; i < sketch->num_entries; i++)
+    visit(&sketch->entries[i], aux);
+  UNLOCK(sketch);
+}
+
+void fprint_words(word_count_list_t* wclist, FILE* outfile) {
+  struct word_count_sketch* sketch = wclist->sketch;
+  if (sketch->sorted) {
+    for (word_count_t** wc = sketch->sorted; *wc; wc++)
+      fprintf(outfile, "       %d\t%s\n", (*wc)->count, (*wc)->word);
+    return;
+  }
+  for (size_t i = 0; i < sketch->num_entries; i++)
+    fprintf(outfile, "       %d\t%s\n", sketch->entries[i].count,
+            sketch->entries[i].word);
+}
+
+static int compare_entries(const void* a, const void* b, void* aux) {
+  const word_count_t* wc1 = *(word_count_t* const*)a;
+  const word_count_t* wc2 = *(word_count_t* const*)b;
+  bool (*less)(const word_count_t*, const word_count_t*) = aux;
+  if (less(wc1, wc2)) return -1;
+  return less(wc2, wc1) ? 1 : 0;
+}
+
+void wordcount_sort(word_count_list_t* wclist,
+                    bool less(const word_count_t*, const word_count_t*)) {
+  struct word_count_sketch* sketch = wclist->sketch;
+  forget_order(sketch);
+  word_count_t** sorted = malloc((sketch->num_entries + 1) * sizeof(*sorted));
+  if (!sorted) return;
+  for (size_t i = 0; i < sketch->num_entries; i++)
+    sorted[i] = &sketch->entries[i];
+  sorted[sketch->num_entries] = NULL;
+  qsort_r(sorted, sketch->num_entries, sizeof(*sorted), compare_entries, less);
+  sketch->sorted = sorted;
+}
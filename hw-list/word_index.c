@@ -0,0 +1,339 @@
+/*
+ * Implementation of the word count index (see word_index.h).
+ */
+
+#define _GNU_SOURCE /* qsort_r() */
+#include "word_index.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define INDEX_MAGIC "WCINDEX1"
+
+struct index_header {
+  char magic[8];
+  uint32_t num_files;
+  uint32_t num_entries;
+  uint64_t strings_size;
+};
+
+struct index_file {
+  int64_t mtime_sec, mtime_nsec;
+  uint64_t size;
+  uint32_t path; /* Offsets into the strings. */
+  uint32_t first_entry, num_entries;
+  uint32_t unused;
+};
+
+struct index_entry {
+  uint32_t word;
+  uint32_t count;
+};
+
+struct word_index {
+  void* map;
+  size_t length;
+  const struct index_header* header;
+  const struct index_file* files;
+  const struct index_entry* entries;
+  const char* strings;
+};
+
+struct word_index* word_index_open(const char* path) {
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) return NULL;
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    return NULL;
+  }
+  struct word_index* index = calloc(1, sizeof(*index));
+  if (!index) {
+    close(fd);
+    return NULL;
+  }
+  index->length = st.st_size;
+  index->map = index->length < sizeof(struct index_header)
+                   ? MAP_FAILED
+                   : mmap(NULL, index->length, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (index->map == MAP_FAILED) {
+    free(index);
+    if (errno != ENOMEM) errno = EINVAL;
+    return NULL;
+  }
+
+  /* Checks everything an offset could run off the end of, once. */
+  const struct index_header* header = index->map;
+  uint64_t tables = sizeof(*header) +
+                    (uint64_t)header->num_files * sizeof(struct index_file) +
+                    (uint64_t)header->num_entries * sizeof(struct index_entry);
+  bool valid = memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic)) == 0 &&
+               tables + header->strings_size == index->length &&
+               header->strings_size > 0;
+  if (valid) {
+    index->header = header;
+    index->files = (const struct index_file*)(header + 1);
+    index->entries =
+        (const struct index_entry*)(index->files + header->num_files);
+    index->strings = (const char*)(index->entries + header->num_entries);
+    valid = index->strings[header->strings_size - 1] == '\0';
+  }
+  for (uint32_t i = 0; valid && i < header->num_files; i++) {
+    const struct index_file* file = &index->files[i];
+    valid = file->path < header->strings_size &&
+            file->first_entry <= header->num_entries &&
+            file->num_entries <= header->num_entries - file->first_entry;
+  }
+  for (uint32_t i = 0; valid && i < header->num_entries; i++)
+    valid = index->entries[i].word < header->strings_size;
+  if (!valid) {
+    word_index_close(index);
+    errno = EINVAL;
+    return NULL;
+  }
+  return index;
+}
+
+void word_index_close(struct word_index* index) {
+  if (!index) return;
+  munmap(index->map, index->length);
+  free(index);
+}
+
+long word_index_find(struct word_index* index, const char* path,
+                     const struct stat* st) {
+  if (!index) return -1;
+  size_t low = 0, high = index->header->num_files;
+  while (low < high) {
+    size_t middle = (low + high) / 2;
+    const struct index_file* file = &index->files[middle];
+    int cmp = strcmp(index->strings + file->path, path);
+    if (cmp == 0) {
+      bool unchanged = file->size == (uint64_t)st->st_size &&
+                       file->mtime_sec == st->st_mtim.tv_sec &&
+                       file->mtime_nsec == st->st_mtim.tv_nsec;
+      return unchanged ? (long)middle : -1;
+    }
+    if (cmp < 0)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return -1;
+}
+
+void word_index_replay(struct word_index* index, long file,
+                       void visit(const char* word, int count, void* aux),
+                       void* aux) {
+  const struct index_file* record = &index->files[file];
+  for (uint32_t i = 0; i < record->num_entries; i++) {
+    const struct index_entry* entry =
+        &index->entries[record->first_entry + i];
+    visit(index->strings + entry->word, entry->count, aux);
+  }
+}
+
+struct word_index_writer {
+  struct index_file* files;
+  size_t num_files, files_capacity;
+  struct index_entry* entries;
+  size_t num_entries, entries_capacity;
+
+  /* Each distinct string once; INTERNED is a hash table of their offsets,
+   * UINT32_MAX for an empty slot, kept at most half full. */
+  char* strings;
+  size_t strings_size, strings_capacity;
+  uint32_t* interned;
+  size_t interned_capacity, num_interned;
+};
+
+/* Makes room in the array at *ARRAY for one more of SIZE bytes. */
+static bool reserve(void* array, size_t count, size_t* capacity, size_t size) {
+  if (count < *capacity) return true;
+  size_t new_capacity = *capacity ? *capacity * 2 : 64;
+  void* grown = realloc(*(void**)array, new_capacity * size);
+  if (!grown) return false;
+  *(void**)array = grown;
+  *capacity = new_capacity;
+  return true;
+}
+
+/* FNV-1a. */
+static uint32_t hash_string(const char* s) {
+  uint32_t hash = 2166136261u;
+  for (const unsigned char* c = (const unsigned char*)s; *c; c++)
+    hash = (hash ^ *c) * 16777619u;
+  return hash;
+}
+
+static uint32_t* intern_slot(struct word_index_writer* writer, const char* s) {
+  size_t mask = writer->interned_capacity - 1;
+  for (size_t i = hash_string(s) & mask;; i = (i + 1) & mask) {
+    uint32_t offset = writer->interned[i];
+    if (offset == UINT32_MAX || strcmp(writer->strings + offset, s) == 0)
+      return &writer->interned[i];
+  }
+}
+
+static bool grow_interned(struct word_index_writer* writer) {
+  size_t old_capacity = writer->interned_capacity;
+  uint32_t* old = writer->interned;
+  size_t capacity = old_capacity ? old_capacity * 2 : 1024;
+  writer->interned = malloc(capacity * sizeof(uint32_t));
+  if (!writer->interned) {
+    writer->interned = old;
+    return false;
+  }
+  memset(writer->interned, 0xff, capacity * sizeof(uint32_t));
+  writer->interned_capacity = capacity;
+  for (size_t i = 0; i < old_capacity; i++)
+    if (old[i] != UINT32_MAX)
+      *intern_slot(writer, writer->strings + old[i]) = old[i];
+  free(old);
+  return true;
+}
+
+/* Adds S to the strings, unless it is there already, and returns its offset
+ * in *OFFSET. */
+static bool intern(struct word_index_writer* writer, const char* s,
+                   uint32_t* offset) {
+  if ((writer->num_interned + 1) * 2 > writer->interned_capacity &&
+      !grow_interned(writer))
+    return false;
+  uint32_t* slot = intern_slot(writer, s);
+  if (*slot == UINT32_MAX) {
+    size_t length = strlen(s) + 1;
+    if (writer->strings_size + length >= UINT32_MAX) {
+      errno = EFBIG;
+      return false;
+    }
+    while (writer->strings_size + length > writer->strings_capacity) {
+      size_t capacity =
+          writer->strings_capacity ? writer->strings_capacity * 2 : 64 * 1024;
+      char* grown = realloc(writer->strings, capacity);
+      if (!grown) return false;
+      writer->strings = grown;
+      writer->strings_capacity = capacity;
+    }
+    memcpy(writer->strings + writer->strings_size, s, length);
+    *slot = writer->strings_size;
+    writer->strings_size += length;
+    writer->num_interned++;
+  }
+  *offset = *slot;
+  return true;
+}
+
+struct word_index_writer* word_index_writer_create(void) {
+  return calloc(1, sizeof(struct word_index_writer));
+}
+
+static int compare_entries(const void* a, const void* b, void* strings) {
+  return strcmp((char*)strings + ((const struct index_entry*)a)->word,
+                (char*)strings + ((const struct index_entry*)b)->word);
+}
+
+static int compare_files(const void* a, const void* b, void* strings) {
+  return strcmp((char*)strings + ((const struct index_file*)a)->path,
+                (char*)strings + ((const struct index_file*)b)->path);
+}
+
+/* Sorts the entries of the file last begun. */
+static void end_file(struct word_index_writer* writer) {
+  if (writer->num_files == 0) return;
+  struct index_file* file = &writer->files[writer->num_files - 1];
+  file->num_entries = writer->num_entries - file->first_entry;
+  qsort_r(writer->entries + file->first_entry, file->num_entries,
+          sizeof(struct index_entry), compare_entries, writer->strings);
+}
+
+bool word_index_begin_file(struct word_index_writer* writer, const char* path,
+                           const struct stat* st) {
+  end_file(writer);
+  if (!reserve(&writer->files, writer->num_files, &writer->files_capacity,
+               sizeof(struct index_file)))
+    return false;
+  struct index_file* file = &writer->files[writer->num_files];
+  memset(file, 0, sizeof(*file));
+  if (!intern(writer, path, &file->path)) return false;
+  file->size = st->st_size;
+  file->mtime_sec = st->st_mtim.tv_sec;
+  file->mtime_nsec = st->st_mtim.tv_nsec;
+  file->first_entry = writer->num_entries;
+  writer->num_files++;
+  return true;
+}
+
+bool word_index_add(struct word_index_writer* writer, const char* word,
+                    int count) {
+  if (!reserve(&writer->entries, writer->num_entries,
+               &writer->entries_capacity, sizeof(struct index_entry)))
+    return false;
+  struct index_entry* entry = &writer->entries[writer->num_entries];
+  if (!intern(writer, word, &entry->word)) return false;
+  entry->count = count;
+  writer->num_entries++;
+  return true;
+}
+
+void word_index_abort(struct word_index_writer* writer) {
+  free(writer->files);
+  free(writer->entries);
+  free(writer->strings);
+  free(writer->interned);
+  free(writer);
+}
+
+bool word_index_commit(struct word_index_writer* writer, const char* path) {
+  end_file(writer);
+  qsort_r(writer->files, writer->num_files, sizeof(struct index_file),
+          compare_files, writer->strings);
+  /* An index with no strings would not be told from a truncated one. */
+  uint32_t unused;
+  if (!intern(writer, "", &unused)) {
+    word_index_abort(writer);
+    return false;
+  }
+
+  struct index_header header = {.num_files = writer->num_files,
+                                .num_entries = writer->num_entries,
+                                .strings_size = writer->strings_size};
+  memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+
+  size_t length = strlen(path);
+  char* temp = malloc(length + sizeof(".tmp"));
+  if (!temp) {
+    word_index_abort(writer);
+    return false;
+  }
+  memcpy(temp, path, length);
+  memcpy(temp + length, ".tmp", sizeof(".tmp"));
+
+  FILE* out = fopen(temp, "w");
+  bool written =
+      out && fwrite(&header, sizeof(header), 1, out) == 1 &&
+      fwrite(writer->files, sizeof(struct index_file), writer->num_files,
+             out) == writer->num_files &&
+      fwrite(writer->entries, sizeof(struct index_entry), writer->num_entries,
+             out) == writer->num_entries &&
+      fwrite(writer->strings, 1, writer->strings_size, out) ==
+          writer->strings_size;
+  if (out && fclose(out) != 0) written = false;
+  int saved_errno = errno;
+  if (written && rename(temp, path) == -1) {
+    written = false;
+    saved_errno = errno;
+  }
+  if (!written) unlink(temp);
+  free(temp);
+  word_index_abort(writer);
+  errno = saved_errno;
+  return written;
+}
@@ -0,0 +1,64 @@
+/*
+ * A word count index on disk, so that pwords --index only needs to count the
+ * files that are new or have changed since the last run.
+ *
+ * The index holds the counts of each file it was built from, with the
+ * file's size and modification time. A file whose size and time still match
+ * is taken from the index instead of being read again.
+ *
+ * The format is meant to be mapped and used in place: a header, a table of
+ * the files sorted by path, each file's (word, count) entries sorted by word,
+ * and one pool of NUL-terminated strings that every entry and path points
+ * into, holding each distinct word once. Numbers are in host byte order.
+ */
+
+#ifndef WORD_INDEX_H
+#define WORD_INDEX_H
+
+#include <stdbool.h>
+#include <sys/stat.h>
+
+struct word_index;
+struct word_index_writer;
+
+/*
+ * Maps the index at PATH. Returns NULL, with errno set, if there is none or
+ * it is not a valid index (EINVAL).
+ */
+struct word_index* word_index_open(const char* path);
+void word_index_close(struct word_index* index);
+
+/*
+ * Returns a handle on the file at PATH in INDEX (which may be NULL) if it
+ * has it with the size and modification time in ST, or -1 if the file is new
+ * or has changed.
+ */
+long word_index_find(struct word_index* index, const char* path,
+                     const struct stat* st);
+
+/* Calls VISIT with each word of FILE, found in INDEX, and its count. */
+void word_index_replay(struct word_index* index, long file,
+                       void visit(const char* word, int count, void* aux),
+                       void* aux);
+
+/*
+ * Builds a new index: a file at a time with word_index_begin_file(), then
+ * its words in any order with word_index_add(), until word_index_commit()
+ * writes it out and frees WRITER, or word_index_abort() frees it. The calls
+ * return false, with errno set, if out of memory.
+ */
+struct word_index_writer* word_index_writer_create(void);
+bool word_index_begin_file(struct word_index_writer* writer, const char* path,
+                           const struct stat* st);
+bool word_index_add(struct word_index_writer* writer, const char* word,
+                    int count);
+
+/*
+ * Replaces the index at PATH (through a temporary file and rename(), so a
+ * failed run leaves the old one) and frees WRITER, whether or not it
+ * succeeds. Returns false, with errno set, on failure.
+ */
+bool word_index_commit(struct word_index_writer* writer, const char* path);
+void word_index_abort(struct word_index_writer* writer);
+
+#endif /* WORD_INDEX_H */
@@ -0,0 +1,273 @@
+/*
+ * Implementation of the phrase counter (see word_ngrams.h).
+ */
+
+#include "word_ngrams.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The multiplier of the rolling hash, an odd 64-bit constant. */
+#define ROLL_BASE 0x100000001b3ull
+
+struct ngram_counter {
+  int n;
+  bool failed;
+
+  /* The words, by number, and a table of their numbers + 1 (0 for an empty
+   * slot) by hash. */
+  char** words;
+  uint32_t* word_hashes;
+  uint32_t num_words, words_capacity;
+  uint32_t* word_slots;
+  size_t word_slots_capacity; /* A power of two, at least twice num_words. */
+
+  /* The last N word numbers, oldest at ring[first] once there are N, and
+   * their rolling hash: the sum of (number + 1) * ROLL_BASE^age. */
+  uint32_t ring[NGRAM_MAX];
+  int first, seen;
+  uint64_t hash;
+  uint64_t drop; /* ROLL_BASE^N, to take the oldest out. */
+
+  /* The phrases, at most half of capacity of them, in slots of 2 + N words
+   * so that a probe touches one cache line: the count (0 for an empty slot),
+   * the top half of the hash, and the N numbers. */
+  uint32_t* slots;
+  size_t capacity, size;
+};
+
+#define SLOT_COUNT 0
+#define SLOT_TAG 1
+#define SLOT_KEY 2
+
+/* FNV-1a. */
+static uint32_t hash_word(const char* word) {
+  uint32_t hash = 2166136261u;
+  for (const unsigned char* c = (const unsigned char*)word; *c; c++)
+    hash = (hash ^ *c) * 16777619u;
+  return hash;
+}
+
+/* Spreads the rolling hash's high bits, where the newest words count the
+ * most, over the bits a slot is picked by. */
+static size_t slot_of(uint64_t hash, size_t capacity) {
+  hash ^= hash >> 29;
+  hash *= 0xbf58476d1ce4e5b9ull;
+  hash ^= hash >> 32;
+  return hash & (capacity - 1);
+}
+
+struct ngram_counter* ngram_counter_create(int n) {
+  if (n < 2 || n > NGRAM_MAX) return NULL;
+  struct ngram_counter* counter = calloc(1, sizeof(*counter));
+  if (!counter) return NULL;
+  counter->n = n;
+  counter->drop = 1;
+  for (int i = 0; i < n; i++) counter->drop *= ROLL_BASE;
+  return counter;
+}
+
+void ngram_counter_free(struct ngram_counter* counter) {
+  if (!counter) return;
+  for (uint32_t i = 0; i < counter->num_words; i++) free(counter->words[i]);
+  free(counter->words);
+  free(counter->word_hashes);
+  free(counter->word_slots);
+  free(counter->slots);
+  free(counter);
+}
+
+void ngram_break(struct ngram_counter* counter) {
+  counter->first = 0;
+  counter->seen = 0;
+  counter->hash = 0;
+}
+
+bool ngram_failed(struct ngram_counter* counter) { return counter->failed; }
+
+bool ngram_context_full(struct ngram_counter* counter) {
+  return counter->seen >= counter->n - 1;
+}
+
+/* Doubles the table of word numbers. Returns false if out of memory. */
+static bool grow_word_slots(struct ngram_counter* counter) {
+  size_t capacity =
+      counter->word_slots_capacity ? counter->word_slots_capacity * 2 : 1024;
+  uint32_t* slots = calloc(capacity, sizeof(*slots));
+  if (!slots) return false;
+  for (uint32_t i = 0; i < counter->num_words; i++) {
+    size_t slot = counter->word_hashes[i] & (capacity - 1);
+    while (slots[slot]) slot = (slot + 1) & (capacity - 1);
+    slots[slot] = i + 1;
+  }
+  free(counter->word_slots);
+  counter->word_slots = slots;
+  counter->word_slots_capacity = capacity;
+  return true;
+}
+
+/*
+ * The number of WORD, which the counter takes ownership of, numbering it
+ * first if it is new. Returns -1 if out of memory.
+ */
+static int64_t intern(struct ngram_counter* counter, char* word) {
+  uint32_t hash = hash_word(word);
+  size_t mask = counter->word_slots_capacity - 1;
+  size_t slot = hash & mask;
+  if (counter->word_slots) {
+    for (uint32_t id; (id = counter->word_slots[slot]);
+         slot = (slot + 1) & mask) {
+      if (counter->word_hashes[id - 1] == hash &&
+          strcmp(counter->words[id - 1], word) == 0) {
+        free(word);
+        return id - 1;
+      }
+    }
+  }
+
+  if (counter->num_words == counter->words_capacity) {
+    uint32_t capacity =
+        counter->words_capacity ? counter->words_capacity * 2 : 1024;
+    char** words = realloc(counter->words, capacity * sizeof(*words));
+    if (words) counter->words = words;
+    uint32_t* hashes =
+        realloc(counter->word_hashes, capacity * sizeof(*hashes));
+    if (hashes) counter->word_hashes = hashes;
+    if (!words || !hashes) return -1;
+    counter->words_capacity = capacity;
+  }
+  if ((size_t)(counter->num_words + 1) * 2 > counter->word_slots_capacity) {
+    if (!grow_word_slots(counter)) return -1;
+    mask = counter->word_slots_capacity - 1;
+    slot = hash & mask;
+    while (counter->word_slots[slot]) slot = (slot + 1) & mask;
+  }
+  uint32_t id = counter->num_words++;
+  counter->words[id] = word;
+  counter->word_hashes[id] = hash;
+  counter->word_slots[slot] = id + 1;
+  return id;
+}
+
+/* Shifts WORD into the ring. Returns false if out of memory. */
+static bool shift(struct ngram_counter* counter, char* word) {
+  int64_t id = intern(counter, word);
+  if (id == -1) {
+    free(word);
+    counter->failed = true;
+    ngram_break(counter);
+    return false;
+  }
+  counter->hash = counter->hash * ROLL_BASE + (uint64_t)id + 1;
+  if (counter->seen < counter->n) {
+    counter->ring[counter->seen++] = id;
+  } else {
+    uint64_t oldest = counter->ring[counter->first];
+    counter->hash -= counter->drop * (oldest + 1);
+    counter->ring[counter->first] = id;
+    counter->first = (counter->first + 1) % counter->n;
+  }
+  return true;
+}
+
+static uint32_t* slot_at(struct ngram_counter* counter, size_t slot) {
+  return counter->slots + slot * (SLOT_KEY + counter->n);
+}
+
+/* The rolling hash of the N numbers at KEY, oldest first. */
+static uint64_t hash_key(struct ngram_counter* counter, const uint32_t* key) {
+  uint64_t hash = 0;
+  for (int i = 0; i < counter->n; i++)
+    hash = hash * ROLL_BASE + (uint64_t)key[i] + 1;
+  return hash;
+}
+
+/* Whether the phrase at KEY is the one in the ring. */
+static bool ring_matches(struct ngram_counter* counter, const uint32_t* key) {
+  for (int i = 0; i < counter->n; i++)
+    if (key[i] != counter->ring[(counter->first + i) % counter->n])
+      return false;
+  return true;
+}
+
+/* Doubles the table of phrases. Returns false if out of memory. */
+static bool grow_phrases(struct ngram_counter* counter) {
+  size_t capacity = counter->capacity ? counter->capacity * 2 : 4096;
+  size_t stride = SLOT_KEY + counter->n;
+  uint32_t* slots = calloc(capacity * stride, sizeof(*slots));
+  if (!slots) return false;
+  for (size_t old = 0; old < counter->capacity; old++) {
+    const uint32_t* from = slot_at(counter, old);
+    if (!from[SLOT_COUNT]) continue;
+    size_t slot = slot_of(hash_key(counter, from + SLOT_KEY), capacity);
+    while (slots[slot * stride + SLOT_COUNT])
+      slot = (slot + 1) & (capacity - 1);
+    memcpy(slots + slot * stride, from, stride * sizeof(*slots));
+  }
+  free(counter->slots);
+  counter->slots = slots;
+  counter->capacity = capacity;
+  return true;
+}
+
+/* Counts the phrase in the ring, which is full. */
+static void count_ring(struct ngram_counter* counter) {
+  if ((counter->size + 1) * 2 > counter->capacity && !grow_phrases(counter)) {
+    counter->failed = true;
+    return;
+  }
+  size_t mask = counter->capacity - 1;
+  uint32_t tag = counter->hash >> 32;
+  uint32_t* slot = slot_at(counter, slot_of(counter->hash, counter->capacity));
+  for (size_t i = slot_of(counter->hash, counter->capacity); slot[SLOT_COUNT];
+       i = (i + 1) & mask, slot = slot_at(counter, i)) {
+    if (slot[SLOT_TAG] == tag && ring_matches(counter, slot + SLOT_KEY)) {
+      slot[SLOT_COUNT]++;
+      return;
+    }
+  }
+  for (int i = 0; i < counter->n; i++)
+    slot[SLOT_KEY + i] = counter->ring[(counter->first + i) % counter->n];
+  slot[SLOT_TAG] = tag;
+  slot[SLOT_COUNT] = 1;
+  counter->size++;
+}
+
+void ngram_add_word(char* word, void* aux) {
+  struct ngram_counter* counter = aux;
+  if (shift(counter, word) && counter->seen == counter->n) count_ring(counter);
+}
+
+void ngram_context_word(char* word, void* aux) { shift(aux, word); }
+
+void ngram_for_each(struct ngram_counter* counter,
+                    void visit(const char* phrase, int count, void* aux),
+                    void* aux) {
+  char* phrase = NULL;
+  size_t phrase_size = 0;
+  for (size_t i = 0; i < counter->capacity; i++) {
+    const uint32_t* slot = slot_at(counter, i);
+    if (!slot[SLOT_COUNT]) continue;
+    const uint32_t* key = slot + SLOT_KEY;
+    size_t length = 0;
+    for (int i = 0; i < counter->n; i++)
+      length += strlen(counter->words[key[i]]) + 1;
+    if (length > phrase_size) {
+      char* grown = realloc(phrase, length * 2);
+      if (!grown) {
+        counter->failed = true;
+        continue;
+      }
+      phrase = grown;
+      phrase_size = length * 2;
+    }
+    char* end = phrase;
+    for (int i = 0; i < counter->n; i++) {
+      if (i > 0) *end++ = ' ';
+      end = stpcpy(end, counter->words[key[i]]);
+    }
+    visit(phrase, slot[SLOT_COUNT], aux);
+  }
+  free(phrase);
+}
@@ -0,0 +1,59 @@
+/*
+ * Counting runs of N words in a row, for pwords --ngram, without building a
+ * string for each one.
+ *
+ * Each distinct word is interned once, as a number, and the numbers of the
+ * last N words are kept in a ring with a rolling hash of them, which takes
+ * the word leaving the window out and the one coming in in constant time.
+ * The counter's table is keyed on the N numbers, found by that hash, so
+ * counting a phrase costs about what counting a word does. A phrase is
+ * spelled out once, however often it occurs, by ngram_for_each() when the
+ * counting is done.
+ *
+ * A counter belongs to one thread. The numbers of two counters mean nothing
+ * to each other; their phrases are merged as strings.
+ */
+
+#ifndef WORD_NGRAMS_H
+#define WORD_NGRAMS_H
+
+#include <stdbool.h>
+
+/* The longest phrase counted. */
+#define NGRAM_MAX 8
+
+struct ngram_counter;
+
+/* Returns a counter of phrases of N words, 2 to NGRAM_MAX, or NULL if out of
+ * memory. */
+struct ngram_counter* ngram_counter_create(int n);
+void ngram_counter_free(struct ngram_counter* counter);
+
+/* Forgets the words seen so far, so that no phrase spans what came before
+ * and what comes after: the start of another file. */
+void ngram_break(struct ngram_counter* counter);
+
+/*
+ * Adds WORD, in a string from malloc() that the counter takes ownership of,
+ * counting the phrase it ends if N words have been seen since the last break.
+ * ngram_context_word() adds it without counting anything, to begin a range
+ * of text with the words before it; ngram_context_full() says whether there
+ * have been N - 1 of those yet. Both add functions take the counter as AUX,
+ * as tokenize_words() calls them.
+ */
+void ngram_add_word(char* word, void* counter);
+void ngram_context_word(char* word, void* counter);
+bool ngram_context_full(struct ngram_counter* counter);
+
+/* Whether memory ran out, and words or phrases were left out. */
+bool ngram_failed(struct ngram_counter* counter);
+
+/*
+ * Calls VISIT with each phrase counted, its words separated by spaces, and
+ * its count. PHRASE is only good until VISIT returns.
+ */
+void ngram_for_each(struct ngram_counter* counter,
+                    void visit(const char* phrase, int count, void* aux),
+                    void* aux);
+
+#endif /* WORD_NGRAMS_H */
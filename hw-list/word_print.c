@@ -0,0 +1,128 @@
+/*
+ * Implementation of fprint_entries() (see word_print.h).
+ */
+
+#include "word_print.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/* Entries worth a thread of their own to format. */
+#define MIN_ENTRIES_PER_THREAD (64 * 1024)
+#define MAX_PRINT_THREADS 64
+
+/* What precedes the count on each line. */
+#define INDENT "       "
+
+struct print_range {
+  word_count_t* const* entries;
+  size_t n;
+  char* buffer; /* NULL if out of memory. */
+  size_t length;
+  pthread_t thread;
+};
+
+/* Writes COUNT in decimal at OUT, returning how many bytes it took. */
+static size_t format_count(char* out, int count) {
+  char digits[sizeof(int) * CHAR_BIT / 3 + 2];
+  unsigned value = count < 0 ? -(unsigned)count : (unsigned)count;
+  size_t n = 0;
+  do {
+    digits[n++] = '0' + value % 10;
+    value /= 10;
+  } while (value > 0);
+  size_t length = 0;
+  if (count < 0) out[length++] = '-';
+  while (n > 0) out[length++] = digits[--n];
+  return length;
+}
+
+static void* format_range(void* aux) {
+  struct print_range* range = aux;
+  size_t size = 0;
+  for (size_t i = 0; i < range->n; i++)
+    size += sizeof(INDENT) + sizeof(int) * CHAR_BIT / 3 + 3 +
+            strlen(range->entries[i]->word);
+  range->buffer = malloc(size ? size : 1);
+  if (!range->buffer) return NULL;
+
+  char* out = range->buffer;
+  for (size_t i = 0; i < range->n; i++) {
+    const word_count_t* wc = range->entries[i];
+    memcpy(out, INDENT, sizeof(INDENT) - 1);
+    out += sizeof(INDENT) - 1;
+    out += format_count(out, wc->count);
+    *out++ = '\t';
+    size_t length = strlen(wc->word);
+    memcpy(out, wc->word, length);
+    out += length;
+    *out++ = '\n';
+  }
+  range->length = out - range->buffer;
+  return NULL;
+}
+
+/* Writes the COUNT buffers in IOV to FD, in as many calls as it takes. */
+static bool write_all(int fd, struct iovec* iov, int count) {
+  while (count > 0) {
+    ssize_t written = writev(fd, iov, count);
+    if (written == -1) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    for (; count > 0 && (size_t)written >= iov->iov_len; iov++, count--)
+      written -= iov->iov_len;
+    if (count > 0) {
+      iov->iov_base = (char*)iov->iov_base + written;
+      iov->iov_len -= written;
+    }
+  }
+  return true;
+}
+
+void fprint_entries(word_count_t* const* entries, size_t n, FILE* outfile) {
+  long threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if ((size_t)threads > n / MIN_ENTRIES_PER_THREAD)
+    threads = n / MIN_ENTRIES_PER_THREAD;
+  if (threads > MAX_PRINT_THREADS) threads = MAX_PRINT_THREADS;
+  if (threads < 1) threads = 1;
+
+  struct print_range ranges[MAX_PRINT_THREADS];
+  for (long t = 0; t < threads; t++) {
+    size_t begin = n * t / threads, end = n * (t + 1) / threads;
+    ranges[t].entries = entries + begin;
+    ranges[t].n = end - begin;
+  }
+  long started = 1;
+  for (; started < threads; started++)
+    if (pthread_create(&ranges[started].thread, NULL, format_range,
+                       &ranges[started]) != 0)
+      break;
+  /* The rest, if a thread could not be created, here. */
+  for (long t = started; t < threads; t++) format_range(&ranges[t]);
+  format_range(&ranges[0]);
+  for (long t = 1; t < started; t++) pthread_join(ranges[t].thread, NULL);
+
+  bool formatted = true;
+  struct iovec iov[MAX_PRINT_THREADS];
+  for (long t = 0; t < threads; t++) {
+    formatted &= ranges[t].buffer != NULL;
+    iov[t].iov_base = ranges[t].buffer;
+    iov[t].iov_len = ranges[t].length;
+  }
+  int fd = fileno(outfile);
+  fflush(outfile);
+  if (!formatted) {
+    for (size_t i = 0; i < n; i++)
+      fprintf(outfile, INDENT "%d\t%s\n", entries[i]->count, entries[i]->word);
+  } else if (fd == -1) {
+    for (long t = 0; t < threads; t++)
+      fwrite(ranges[t].buffer, 1, ranges[t].length, outfile);
+  } else if (!write_all(fd, iov, threads)) {
+    perror("writev");
+  }
+  for (long t = 0; t < threads; t++) free(ranges[t].buffer);
+}
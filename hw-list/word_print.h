@@ -0,0 +1,18 @@
+/*
+ * Printing word count entries gathered into an array, for the threaded
+ * representations' fprint_words().
+ */
+
+#ifndef WORD_PRINT_H
+#define WORD_PRINT_H
+
+#include "word_count.h"
+
+/*
+ * Prints the N entries at ENTRIES to OUTFILE, in order, as fprint_words()
+ * does: a large list is split into ranges, formatted by a thread each into
+ * a buffer of its own, and the buffers are written with one writev().
+ */
+void fprint_entries(word_count_t* const* entries, size_t n, FILE* outfile);
+
+#endif /* WORD_PRINT_H */
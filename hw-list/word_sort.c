@@ -0,0 +1,52 @@
+/*
+ * Implementation of sort_by_count() (see word_sort.h).
+ */
+
+#include "word_sort.h"
+
+#include <limits.h>
+
+static int compare_words(const void* a, const void* b) {
+  return strcmp((*(word_count_t* const*)a)->word,
+                (*(word_count_t* const*)b)->word);
+}
+
+bool sort_by_count(word_count_t** entries, size_t n) {
+  if (n < 2) return true;
+  word_count_t** scratch = malloc(n * sizeof(*scratch));
+  if (!scratch) return false;
+
+  /* Least significant byte first; each pass is stable, so the earlier ones'
+   * order survives among entries equal in the later bytes. A pass whose
+   * byte is the same for every count is skipped. */
+  word_count_t** from = entries;
+  word_count_t** to = scratch;
+  for (int shift = 0; shift < (int)sizeof(unsigned) * CHAR_BIT; shift += 8) {
+    size_t offsets[256] = {0};
+    for (size_t i = 0; i < n; i++)
+      offsets[((unsigned)from[i]->count >> shift) & 0xff]++;
+    if (offsets[((unsigned)from[0]->count >> shift) & 0xff] == n) continue;
+
+    size_t total = 0;
+    for (int byte = 0; byte < 256; byte++) {
+      size_t count = offsets[byte];
+      offsets[byte] = total;
+      total += count;
+    }
+    for (size_t i = 0; i < n; i++)
+      to[offsets[((unsigned)from[i]->count >> shift) & 0xff]++] = from[i];
+
+    word_count_t** tmp = from;
+    from = to;
+    to = tmp;
+  }
+  if (from != entries) memcpy(entries, from, n * sizeof(*entries));
+  free(scratch);
+
+  for (size_t start = 0, end; start < n; start = end) {
+    end = start + 1;
+    while (end < n && entries[end]->count == entries[start]->count) end++;
+    qsort(entries + start, end - start, sizeof(*entries), compare_words);
+  }
+  return true;
+}
@@ -0,0 +1,19 @@
+/*
+ * Sorting word count entries gathered into an array, for the list
+ * representations' wordcount_sort().
+ */
+
+#ifndef WORD_SORT_H
+#define WORD_SORT_H
+
+#include "word_count.h"
+
+/*
+ * Sorts the N entries at ENTRIES as less_count() orders them, by count and
+ * then by word: a radix sort on the counts, a byte at a time, then a
+ * comparison sort of each run of equal counts. Returns false, leaving them
+ * as they were, if out of memory.
+ */
+bool sort_by_count(word_count_t** entries, size_t n);
+
+#endif /* WORD_SORT_H */
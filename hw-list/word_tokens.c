@@ -0,0 +1,204 @@
+/*
+ * Implementation of the word tokenizer (see word_tokens.h).
+ */
+
+#include "word_tokens.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static const bool ascii_letter[256] = {['A' ... 'Z'] = true,
+                                       ['a' ... 'z'] = true};
+
+/* The code points counted as letters, in order. */
+static const struct letter_range {
+  uint32_t first, last;
+} letter_ranges[] = {
+    {0x00aa, 0x00aa}, {0x00b5, 0x00b5}, {0x00ba, 0x00ba},
+    {0x00c0, 0x00d6}, {0x00d8, 0x00f6}, {0x00f8, 0x02af}, /* Latin, IPA */
+    {0x0300, 0x036f},                                     /* Combining marks */
+    {0x0370, 0x0374}, {0x0376, 0x037d}, {0x037f, 0x0386},
+    {0x0388, 0x03ff},                                     /* Greek */
+    {0x0400, 0x0481}, {0x0483, 0x052f},                   /* Cyrillic */
+    {0x0531, 0x0556}, {0x0561, 0x0587},                   /* Armenian */
+    {0x0591, 0x05c7}, {0x05d0, 0x05ea},                   /* Hebrew */
+    {0x0610, 0x061a}, {0x0620, 0x065f}, {0x066e, 0x06d3}, /* Arabic */
+    {0x0900, 0x0963}, {0x0966, 0x0dff},                   /* Indic */
+    {0x1e00, 0x1eff},                                     /* Latin */
+    {0x3041, 0x30fa}, {0x30fc, 0x30ff},                   /* Kana */
+    {0x3400, 0x4dbf}, {0x4e00, 0x9fff},                   /* CJK */
+    {0xac00, 0xd7a3},                                     /* Hangul */
+};
+
+static bool unicode_letter(uint32_t cp) {
+  size_t low = 0, high = sizeof(letter_ranges) / sizeof(letter_ranges[0]);
+  while (low < high) {
+    size_t middle = (low + high) / 2;
+    if (cp < letter_ranges[middle].first)
+      high = middle;
+    else if (cp > letter_ranges[middle].last)
+      low = middle + 1;
+    else
+      return true;
+  }
+  return false;
+}
+
+/* The lowercase of CP, if it has one encoded in as many bytes. */
+static uint32_t unicode_lower(uint32_t cp) {
+  if ((cp >= 0x00c0 && cp <= 0x00de && cp != 0x00d7) ||
+      (cp >= 0x0391 && cp <= 0x03ab && cp != 0x03a2) ||
+      (cp >= 0x0410 && cp <= 0x042f))
+    return cp + 0x20;
+  if (cp >= 0x0400 && cp <= 0x040f) return cp + 0x50;
+  if (cp >= 0x0531 && cp <= 0x0556) return cp + 0x30;
+  if (cp == 0x0178) return 0x00ff;
+  if (cp == 0x0386) return 0x03ac;
+  if (cp >= 0x0388 && cp <= 0x038a) return cp + 0x25;
+  if (cp == 0x038c) return 0x03cc;
+  if (cp == 0x038e || cp == 0x038f) return cp + 0x3f;
+  if (cp == 0x04c0) return 0x04cf;
+  if (cp == 0x0130) return cp; /* İ, whose lowercase is i and a mark. */
+  /* Pairs, the capital first, on an even code point or (where the blocks
+   * are shifted by one) an odd one. */
+  if ((cp >= 0x0100 && cp <= 0x0137) || (cp >= 0x014a && cp <= 0x0177) ||
+      (cp >= 0x0460 && cp <= 0x0481) || (cp >= 0x048a && cp <= 0x04bf) ||
+      (cp >= 0x04d0 && cp <= 0x052f) || (cp >= 0x1e00 && cp <= 0x1e95) ||
+      (cp >= 0x1ea0 && cp <= 0x1eff))
+    return cp % 2 == 0 ? cp + 1 : cp;
+  if ((cp >= 0x0139 && cp <= 0x0148) || (cp >= 0x0179 && cp <= 0x017e) ||
+      (cp >= 0x04c1 && cp <= 0x04ce))
+    return cp % 2 == 1 ? cp + 1 : cp;
+  return cp;
+}
+
+/*
+ * Decodes the UTF-8 sequence at C, before END, into *CP. Returns its length,
+ * or 0 if it is not valid: truncated, overlong, a surrogate or too large.
+ */
+static size_t utf8_decode(const unsigned char* c, const unsigned char* end,
+                          uint32_t* cp) {
+  size_t length;
+  uint32_t min;
+  if (*c >= 0xc2 && *c <= 0xdf) {
+    length = 2;
+    *cp = *c & 0x1f;
+    min = 0x80;
+  } else if (*c >= 0xe0 && *c <= 0xef) {
+    length = 3;
+    *cp = *c & 0x0f;
+    min = 0x800;
+  } else if (*c >= 0xf0 && *c <= 0xf4) {
+    length = 4;
+    *cp = *c & 0x07;
+    min = 0x10000;
+  } else {
+    return 0;
+  }
+  if ((size_t)(end - c) < length) return 0;
+  for (size_t i = 1; i < length; i++) {
+    if ((c[i] & 0xc0) != 0x80) return 0;
+    *cp = *cp << 6 | (c[i] & 0x3f);
+  }
+  if (*cp < min || *cp > 0x10ffff || (*cp >= 0xd800 && *cp <= 0xdfff))
+    return 0;
+  return length;
+}
+
+static void utf8_encode(uint32_t cp, unsigned char* c, size_t length) {
+  static const unsigned char lead[] = {0, 0, 0xc0, 0xe0, 0xf0};
+  for (size_t i = length - 1; i > 0; i--) {
+    c[i] = 0x80 | (cp & 0x3f);
+    cp >>= 6;
+  }
+  c[0] = lead[length] | cp;
+}
+
+/* How many of the bytes from C on, before END, are ASCII. */
+static size_t ascii_run(const unsigned char* c, const unsigned char* end) {
+  const unsigned char* p = c;
+#ifdef __SSE2__
+  for (; end - p >= 16; p += 16) {
+    int high = _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)p));
+    if (high != 0) return p - c + __builtin_ctz(high);
+  }
+#endif
+  while (p < end && *p < 0x80) p++;
+  return p - c;
+}
+
+/* Copies the LENGTH bytes of the word at START into WORD, lowercased. */
+static void lower_word(char* word, const unsigned char* start, size_t length,
+                       bool ascii) {
+  unsigned char* out = (unsigned char*)word;
+  for (size_t i = 0; i < length;) {
+    uint32_t cp;
+    size_t n = ascii || start[i] < 0x80 ? 0 : utf8_decode(start + i,
+                                                          start + length, &cp);
+    if (n == 0) {
+      out[i] = ascii_letter[start[i]] ? start[i] | 0x20 : start[i];
+      i++;
+    } else {
+      utf8_encode(unicode_lower(cp), out + i, n);
+      i += n;
+    }
+  }
+  word[length] = '\0';
+}
+
+/* The length of the letter at C, before END, or 0 if it is none. */
+static size_t unicode_letter_at(const unsigned char* c,
+                                const unsigned char* end) {
+  uint32_t cp;
+  size_t length = utf8_decode(c, end, &cp);
+  return length && unicode_letter(cp) ? length : 0;
+}
+
+void tokenize_words(const char* text, size_t length, bool unicode,
+                    void visit(char* word, void* aux), void* aux) {
+  const unsigned char* c = (const unsigned char*)text;
+  const unsigned char* end = c + length;
+  const unsigned char* ascii_end = c; /* Up to which the bytes are ASCII. */
+  while (c < end) {
+    if (c >= ascii_end) ascii_end = c + ascii_run(c, end);
+    while (c < ascii_end && !ascii_letter[*c]) c++;
+    if (c == end) break;
+
+    const unsigned char* start = c;
+    size_t letters = 0;
+    bool ascii = true;
+    for (;;) {
+      for (; c < ascii_end && ascii_letter[*c]; c++) letters++;
+      if (c < ascii_end || c == end) break;
+      size_t n = unicode ? unicode_letter_at(c, end) : 0;
+      if (n == 0) break;
+      c += n;
+      letters++;
+      ascii = false;
+      ascii_end = c + ascii_run(c, end);
+    }
+    if (letters == 0) {
+      /* The whole of a character that is not a letter. */
+      uint32_t cp;
+      size_t n = utf8_decode(c, end, &cp);
+      c += n ? n : 1;
+      continue;
+    }
+    if (letters < 2) continue;
+
+    char* word = malloc(c - start + 1);
+    if (!word) {
+      perror("malloc");
+      return;
+    }
+    lower_word(word, start, c - start, ascii);
+    visit(word, aux);
+  }
+}
+
+bool word_byte(char c) { return ascii_letter[(unsigned char)c] || c & 0x80; }
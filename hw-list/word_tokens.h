@@ -0,0 +1,35 @@
+/*
+ * Splitting text into the words pwords counts: runs of letters, lowercased,
+ * of two letters or more, as the prebuilt count_words() does.
+ *
+ * Letters are the ASCII ones, table-driven rather than through the locale,
+ * and with UNICODE those encoded in UTF-8 too, for the scripts in use (Latin,
+ * Greek, Cyrillic, Armenian, Hebrew, Arabic, the Indic scripts, kana, CJK
+ * and Hangul) and with combining marks. Lowercasing covers the case pairs
+ * of Latin, Greek, Cyrillic and Armenian that keep their encoded length.
+ * Bytes that are not valid UTF-8 separate words.
+ *
+ * Runs of ASCII are found 16 bytes at a time, and only bytes outside of them
+ * are decoded, so plain English costs no more than it would without UNICODE.
+ */
+
+#ifndef WORD_TOKENS_H
+#define WORD_TOKENS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Calls VISIT with each word of the LENGTH bytes of TEXT, in a string from
+ * malloc() that VISIT takes ownership of.
+ */
+void tokenize_words(const char* text, size_t length, bool unicode,
+                    void visit(char* word, void* aux), void* aux);
+
+/*
+ * Whether C may be part of a word: an ASCII letter, or any byte of a UTF-8
+ * sequence. Text cut only before a byte that is not keeps every word whole.
+ */
+bool word_byte(char c);
+
+#endif /* WORD_TOKENS_H */
@@ -1,26 +1,992 @@
 /*
  * mm_alloc.c
+ *
+ * A heap grown with sbrk(), carved into blocks with boundary tags. Free blocks
+ * are kept in segregated lists by size class, so that mm_malloc() finds one to
+ * fit without walking the heap:
+ *
+ *   - Blocks under SMALL_LIMIT bytes have a class per multiple of ALIGNMENT,
+ *     and every block in the class fits exactly.
+ *   - Larger ones have a class per quarter of each power of two. A request
+ *     looks through its own class for the first block to fit, and then takes
+ *     the first block of the next class that is not empty, found in a bitmap,
+ *     which is sure to fit.
+ *
+ * A block being freed is merged with the free blocks on either side of it, and
+ * one at the end of the heap goes back to the top: the space past the last
+ * block, which requests no free block fits are split off, and which sbrk()
+ * extends. Memory handed out is zero-filled, all of what its block holds.
+ *
+ * mm_realloc() resizes a block where it is when it can: it splits what it no
+ * longer needs off the end, and grows into a free block after it or into the
+ * top, extending that first if it must, so that growing a buffer a little at
+ * a time does not copy it each time.
+ *
+ * The heap is shared, under one lock. In front of it, each thread caches the
+ * small blocks it frees, a list per class, and has its small requests met
+ * from them without the lock. The heap still sees those blocks in use. An
+ * empty list is refilled with CACHE_BATCH blocks at a time, and a full one
+ * gives half of its blocks back, so that a thread takes the lock once in that
+ * many calls at the most. A thread's cache goes back to the heap when it exits.
+ *
+ * A block a thread hands out from its cache is tagged, in the spare high bits
+ * of its size, with the thread's slot in remote_frees. Freed by another
+ * thread, as when a producer passes blocks to a consumer, it is pushed onto
+ * that slot's stack with a compare-and-swap rather than cached by the thread
+ * freeing it, and the owner takes the whole stack with one exchange the next
+ * time it allocates. Blocks then go round between the two threads' caches
+ * without either taking the lock, where the consumer's cache would otherwise
+ * fill and go back to the heap only for the producer to take it out again.
+ *
+ * Requests of mmap_threshold bytes or more are not served from the heap at
+ * all, where they would leave holes that only requests as big could fill, but
+ * get pages of their own from mmap(), unmapped when they are freed and moved
+ * with mremap() when they are reallocated.
+ *
+ * Freed memory goes back to the system once there is trim_threshold bytes of
+ * it together: a top that big is cut back to MIN_GROWTH with sbrk(), and the
+ * pages of a free block that big elsewhere are dropped with madvise(), to be
+ * faulted back in zero-filled when the block is used again.
+ *
+ * mm_stats() counts what the heap holds from the free lists, which keep a
+ * count of their blocks and bytes, so that nothing is walked. Profiling, off
+ * unless mm_profile() turns it on, times every call and counts requests by
+ * class, and samples callers into a table of call sites.
+ *
+ * mm_memalign() takes a block with room to spare for the alignment, and
+ * splits a free block off the front to align it, as well as the rest off the
+ * end, so that what the alignment costs stays in the heap to be used.
+ *
+ * A pool from mm_pool_create() hands out objects of one size from slabs it
+ * takes from the heap, packed with no header between them. Freed objects are
+ * listed through their first word, and a slab is carved as it is used.
  */
 
+#define _GNU_SOURCE /* mremap() */
 #include "mm_alloc.h"
 
-#include <stdlib.h>
-#include <unistd.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <time.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
-void* mm_malloc(size_t size) {
-  //TODO: Implement malloc
+#define ALIGNMENT 16
+#define SMALL_LIMIT 512
+#define NUM_CLASSES MM_NUM_CLASSES
+/* How much more than a request the heap grows by at the least. */
+#define MIN_GROWTH (64 * 1024)
+/* How many blocks of a class a thread caches at the most, and how many it
+ * takes from the heap at a time. */
+#define CACHE_LIMIT 64
+#define CACHE_BATCH 16
+#define DEFAULT_MMAP_THRESHOLD (128 * 1024)
+#define DEFAULT_TRIM_THRESHOLD (128 * 1024)
+/* How many call sites profiling keeps track of. */
+#define SITE_TABLE_SIZE 1024
+
+/* Flags in the low bits of a block's size. */
+#define IN_USE 1
+#define PREV_IN_USE 2
+#define MAPPED 4 /* Pages of its own, from mmap(). */
+#define FLAGS (IN_USE | PREV_IN_USE | MAPPED)
+
+/* The thread whose cache a block in use came from, in the bits of its size
+ * above any size; 0 for none. */
+#define OWNER_SHIFT 48
+#define MAX_OWNERS 1024
+#define OWNER_BITS ((size_t)(MAX_OWNERS - 1) << OWNER_SHIFT)
+
+/*
+ * A block: its header, then the memory handed out. PREV_SIZE belongs to the
+ * block before, and holds its size only while that block is free (in a
+ * mapped block, it is how far into its mapping the block starts); NEXT and
+ * PREV are part of the memory handed out, and link a free block into the list
+ * of its class.
+ */
+typedef struct block {
+  size_t prev_size;
+  size_t size; /* Of the whole block, header included, and flags. */
+  struct block* next;
+  struct block* prev;
+} block_t;
+
+#define HEADER_SIZE offsetof(block_t, next)
+#define MIN_BLOCK sizeof(block_t)
+
+static size_t mmap_threshold = DEFAULT_MMAP_THRESHOLD;
+static size_t trim_threshold = DEFAULT_TRIM_THRESHOLD;
+
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static block_t* classes[NUM_CLASSES];
+static uint64_t nonempty[NUM_CLASSES / 64]; /* A bit per class listed. */
+static size_t class_blocks[NUM_CLASSES];
+static size_t free_bytes;  /* In the lists. */
+static size_t heap_bytes; /* In blocks and the top, fences left out. */
+
+/* Kept with atomics, as they are changed without the heap lock. */
+static size_t mapped_bytes, mapped_blocks;
+
+/* Profiling: calls to sample a caller in, or 0 if it is off. */
+static unsigned sample_every;
+static unsigned long long class_requests[NUM_CLASSES];
+static unsigned long long latency[MM_LATENCY_BUCKETS];
+static __thread unsigned until_sample;
+
+static pthread_mutex_t site_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct mm_call_site sites[SITE_TABLE_SIZE];
+
+/* A thread's cache of blocks, listed through NEXT, for each small class. */
+struct cache {
+  block_t* blocks[SMALL_LIMIT / ALIGNMENT];
+  unsigned counts[SMALL_LIMIT / ALIGNMENT];
+  bool registered; /* For flush_cache() at thread exit. */
+  unsigned owner;  /* Its slot in remote_frees, or 0 if it has none. */
+};
+
+static __thread struct cache cache;
+static pthread_key_t cache_key;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+
+/* For each thread with a slot, the blocks that other threads have freed to
+ * it, listed through NEXT down to REMOTE_END. A slot no thread has is NULL. */
+#define REMOTE_END ((block_t*)1)
+static block_t* remote_frees[MAX_OWNERS];
+
+/* The top: free space from here to the fence, a header marked in use at the
+ * end of the heap that no block can be merged with. NULL before the first
+ * mm_malloc(). */
+static block_t* top;
 
-  return NULL;
+static size_t block_size(const block_t* block) {
+  return block->size & ~(FLAGS | OWNER_BITS);
 }
 
-void* mm_realloc(void* ptr, size_t size) {
-  //TODO: Implement realloc
+static block_t* next_block(const block_t* block) {
+  return (block_t*)((char*)block + block_size(block));
+}
+
+static block_t* prev_block(const block_t* block) {
+  return (block_t*)((char*)block - block->prev_size);
+}
+
+static void* payload(block_t* block) { return (char*)block + HEADER_SIZE; }
+
+static block_t* block_of(void* ptr) {
+  return (block_t*)((char*)ptr - HEADER_SIZE);
+}
+
+/* Sets BLOCK's size, keeping its flags. */
+static void set_size(block_t* block, size_t size) {
+  block->size = size | (block->size & FLAGS);
+}
+
+static int class_of(size_t size) {
+  if (size < SMALL_LIMIT) return size / ALIGNMENT;
+  int log = 63 - __builtin_clzl(size);
+  return SMALL_LIMIT / ALIGNMENT + (log - __builtin_ctz(SMALL_LIMIT)) * 4 +
+         (int)((size >> (log - 2)) & 3);
+}
+
+static void list_insert(block_t* block) {
+  int class = class_of(block_size(block));
+  block->prev = NULL;
+  block->next = classes[class];
+  if (block->next) block->next->prev = block;
+  classes[class] = block;
+  nonempty[class / 64] |= 1ull << (class % 64);
+  class_blocks[class]++;
+  free_bytes += block_size(block);
+}
+
+static void list_remove(block_t* block) {
+  int class = class_of(block_size(block));
+  if (block->prev)
+    block->prev->next = block->next;
+  else
+    classes[class] = block->next;
+  if (block->next) block->next->prev = block->prev;
+  if (!classes[class]) nonempty[class / 64] &= ~(1ull << (class % 64));
+  class_blocks[class]--;
+  free_bytes -= block_size(block);
+}
+
+/* The first class after CLASS with a block listed, or -1 if there is none. */
+static int next_nonempty(int class) {
+  for (int word = (class + 1) / 64; word < NUM_CLASSES / 64; word++) {
+    uint64_t bits = nonempty[word];
+    if (word == (class + 1) / 64) bits &= ~0ull << ((class + 1) % 64);
+    if (bits) return word * 64 + __builtin_ctzll(bits);
+  }
+  return -1;
+}
+
+/* Marks BLOCK free, telling the block after it, and lists it. */
+static void make_free(block_t* block) {
+  block->size &= ~IN_USE;
+  block_t* next = next_block(block);
+  next->prev_size = block_size(block);
+  next->size &= ~PREV_IN_USE;
+  list_insert(block);
+}
+
+/*
+ * Finds a free block of SIZE bytes or more and takes it off its list, or
+ * returns NULL if there is none.
+ */
+static block_t* find_free(size_t size) {
+  int class = class_of(size);
+  if (class >= SMALL_LIMIT / ALIGNMENT) {
+    for (block_t* block = classes[class]; block; block = block->next) {
+      if (block_size(block) >= size) {
+        list_remove(block);
+        return block;
+      }
+    }
+  } else if (classes[class]) {
+    block_t* block = classes[class];
+    list_remove(block);
+    return block;
+  }
+  class = next_nonempty(class);
+  if (class == -1) return NULL;
+  block_t* block = classes[class];
+  list_remove(block);
+  return block;
+}
+
+/*
+ * Grows the top to SIZE bytes or more. Returns false if sbrk() fails. If the
+ * heap cannot grow where it ends, something else having moved the break, the
+ * top so far is freed and a new one starts at the break.
+ */
+static bool grow_top(size_t size) {
+  /* Enough for a new top, should the old one not be extended. */
+  size_t growth = size + HEADER_SIZE + ALIGNMENT;
+  if (growth < size) return false;
+  if (growth < MIN_GROWTH) growth = MIN_GROWTH;
+  growth = (growth + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1);
+  if ((intptr_t)growth < 0) return false;
+  char* brk = sbrk(growth);
+  if (brk == (char*)-1) return false;
+
+  char* end = top ? (char*)next_block(top) + HEADER_SIZE : NULL;
+  if (brk == end) {
+    /* The top grows over the old fence. */
+    set_size(top, block_size(top) + growth);
+    heap_bytes += growth;
+  } else {
+    if (top) make_free(top);
+    char* start = (char*)(((uintptr_t)brk + ALIGNMENT - 1) &
+                          ~(uintptr_t)(ALIGNMENT - 1));
+    top = (block_t*)start;
+    top->size = ((brk + growth - start - HEADER_SIZE) &
+                 ~(size_t)(ALIGNMENT - 1)) |
+                PREV_IN_USE;
+    heap_bytes += block_size(top);
+  }
+  next_block(top)->size = 0 | IN_USE;
+  return true;
+}
+
+/* Drops the pages wholly inside the free BLOCK, past its links and before
+ * the next block's header, if there are trim_threshold bytes of them. */
+static void discard_pages(block_t* block) {
+  uintptr_t page = sysconf(_SC_PAGESIZE);
+  uintptr_t start = ((uintptr_t)block + MIN_BLOCK + page - 1) & ~(page - 1);
+  uintptr_t end = (uintptr_t)next_block(block) & ~(page - 1);
+  if (end > start && end - start >= trim_threshold)
+    madvise((void*)start, end - start, MADV_DONTNEED);
+}
+
+/*
+ * Gives what the top has past MIN_GROWTH back to the system, if it has
+ * trim_threshold bytes or more: shrinking the heap, if it still ends at the
+ * break, else dropping the pages.
+ */
+static void trim_top(void) {
+  size_t size = block_size(top);
+  if (size < trim_threshold) return;
+  size_t keep = MIN_GROWTH < trim_threshold ? MIN_GROWTH : trim_threshold;
+  if (keep < MIN_BLOCK) keep = MIN_BLOCK;
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t release = (size - keep) & ~(page - 1);
+  char* end = (char*)next_block(top) + HEADER_SIZE;
+  if (release == 0 || sbrk(0) != end) {
+    discard_pages(top);
+    return;
+  }
+  if (sbrk(-(intptr_t)release) == (void*)-1) return;
+  set_size(top, size - release);
+  heap_bytes -= release;
+  next_block(top)->size = 0 | IN_USE;
+}
+
+/* Takes a block of SIZE bytes off the front of the top. */
+static block_t* take_top(size_t size) {
+  if ((!top || block_size(top) < size + MIN_BLOCK) &&
+      !grow_top(size + MIN_BLOCK))
+    return NULL;
+  block_t* block = top;
+  size_t top_size = block_size(top);
+  top = (block_t*)((char*)block + size);
+  top->size = (top_size - size) | PREV_IN_USE;
+  block->size = size | (block->size & PREV_IN_USE) | IN_USE;
+  return block;
+}
+
+/* Splits what BLOCK, in use, has past SIZE bytes off into a free block, if
+ * that is enough for one. */
+static void split(block_t* block, size_t size) {
+  size_t rest = block_size(block) - size;
+  if (rest < MIN_BLOCK) return;
+  set_size(block, size);
+  block_t* tail = next_block(block);
+  tail->size = rest | PREV_IN_USE | IN_USE;
+  block_t* next = next_block(tail);
+  if (next == top) {
+    tail->size = (rest + block_size(top)) | PREV_IN_USE;
+    top = tail;
+  } else if (!(next->size & IN_USE)) {
+    /* Merged with the free block after it. */
+    list_remove(next);
+    set_size(tail, rest + block_size(next));
+    make_free(tail);
+  } else {
+    make_free(tail);
+  }
+}
+
+/* The size of block needed for SIZE bytes, or 0 if it would overflow. */
+static size_t block_size_for(size_t size) {
+  if (size > SIZE_MAX - HEADER_SIZE - ALIGNMENT) return 0;
+  size = (size + HEADER_SIZE + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1);
+  return size < MIN_BLOCK ? MIN_BLOCK : size;
+}
+
+/* Takes a block of SIZE bytes, rounded as block_size_for() does, from the
+ * heap, or returns NULL if it is out of memory. The heap lock is held. */
+static block_t* alloc_block(size_t size) {
+  block_t* block = find_free(size);
+  if (block) {
+    block->size |= IN_USE;
+    next_block(block)->size |= PREV_IN_USE;
+    split(block, size);
+  } else {
+    block = take_top(size);
+  }
+  return block;
+}
+
+/* Gives BLOCK back to the heap, merged with its neighbours if they are free.
+ * The heap lock is held. */
+static void free_block(block_t* block) {
+  size_t size = block_size(block);
+  if (!(block->size & PREV_IN_USE)) {
+    block_t* prev = prev_block(block);
+    list_remove(prev);
+    size += block_size(prev);
+    block = prev;
+  }
+  block_t* next = (block_t*)((char*)block + size);
+  if (next == top) {
+    size += block_size(top);
+    top = block;
+    top->size = size | (block->size & PREV_IN_USE);
+    trim_top();
+  } else {
+    if (!(next->size & IN_USE)) {
+      list_remove(next);
+      size += block_size(next);
+    }
+    block->size = size | (block->size & PREV_IN_USE) | IN_USE;
+    make_free(block);
+    discard_pages(block);
+  }
+}
+
+/* Gives the first COUNT blocks of the thread's CLASS back to the heap. */
+static void flush_class(int class, unsigned count) {
+  pthread_mutex_lock(&heap_lock);
+  for (unsigned i = 0; i < count; i++) {
+    block_t* block = cache.blocks[class];
+    cache.blocks[class] = block->next;
+    free_block(block);
+  }
+  pthread_mutex_unlock(&heap_lock);
+  cache.counts[class] -= count;
+}
+
+/* Adds BLOCK to the thread's cache, giving half of its class back to the
+ * heap if that makes too many. */
+static void cache_block(block_t* block) {
+  int class = class_of(block_size(block));
+  block->next = cache.blocks[class];
+  cache.blocks[class] = block;
+  if (++cache.counts[class] > CACHE_LIMIT) flush_class(class, CACHE_LIMIT / 2);
+}
+
+/* Moves the blocks other threads have freed to this one into its cache. */
+static void drain_remote(void) {
+  block_t** stack = &remote_frees[cache.owner];
+  if (!cache.owner || __atomic_load_n(stack, __ATOMIC_RELAXED) == REMOTE_END)
+    return;
+  block_t* block = __atomic_exchange_n(stack, REMOTE_END, __ATOMIC_ACQUIRE);
+  while (block != REMOTE_END) {
+    block_t* next = block->next;
+    cache_block(block);
+    block = next;
+  }
+}
+
+/* Gives BLOCK, from another thread's cache, back to that thread. Returns false
+ * if it came from this thread's, or from none, or its thread has exited. */
+static bool free_remote(block_t* block) {
+  unsigned owner = block->size >> OWNER_SHIFT;
+  if (owner == 0 || owner == cache.owner) return false;
+  block_t** stack = &remote_frees[owner];
+  block_t* head = __atomic_load_n(stack, __ATOMIC_RELAXED);
+  do {
+    if (!head) return false;
+    block->next = head;
+  } while (!__atomic_compare_exchange_n(stack, &head, block, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+  return true;
+}
+
+/* Takes a slot in remote_frees for the thread, if one is free. */
+static void claim_owner(void) {
+  for (unsigned owner = 1; owner < MAX_OWNERS && !cache.owner; owner++) {
+    block_t* expected = NULL;
+    if (__atomic_compare_exchange_n(&remote_frees[owner], &expected,
+                                    REMOTE_END, false, __ATOMIC_ACQ_REL,
+                                    __ATOMIC_RELAXED))
+      cache.owner = owner;
+  }
+}
+
+/* Gives up the thread's slot, with what was freed to it. A block pushed after
+ * the last drain makes the exchange fail, and is drained in turn. */
+static void release_owner(void) {
+  if (!cache.owner) return;
+  block_t* expected;
+  do {
+    drain_remote();
+    expected = REMOTE_END;
+  } while (!__atomic_compare_exchange_n(&remote_frees[cache.owner], &expected,
+                                        NULL, false, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_RELAXED));
+  cache.owner = 0;
+}
+
+static void flush_cache(void* unused) {
+  (void)unused;
+  cache.registered = false;
+  release_owner();
+  for (int class = 0; class < SMALL_LIMIT / ALIGNMENT; class++)
+    if (cache.counts[class] > 0) flush_class(class, cache.counts[class]);
+}
 
-  return NULL;
+static void make_cache_key(void) { pthread_key_create(&cache_key, flush_cache); }
+
+/* Sets the thread's cache to be flushed when it exits, which takes a value
+ * for the key. Returns false if that is not possible. */
+static bool register_cache(void) {
+  if (cache.registered) return true;
+  pthread_once(&cache_key_once, make_cache_key);
+  cache.registered = pthread_setspecific(cache_key, &cache) == 0;
+  if (cache.registered) claim_owner();
+  return cache.registered;
+}
+
+/* Takes a block of SIZE bytes, under SMALL_LIMIT, from the thread's cache,
+ * refilling it from the heap first if it has none. */
+static block_t* cached_block(size_t size) {
+  int class = class_of(size);
+  drain_remote();
+  if (!cache.blocks[class] && register_cache()) {
+    pthread_mutex_lock(&heap_lock);
+    for (unsigned i = 0; i < CACHE_BATCH; i++) {
+      block_t* block = alloc_block(size);
+      if (!block) break;
+      /* Left bigger than asked for, it belongs to another class. */
+      if (block_size(block) != size) {
+        free_block(block);
+        break;
+      }
+      block->next = cache.blocks[class];
+      cache.blocks[class] = block;
+      cache.counts[class]++;
+    }
+    pthread_mutex_unlock(&heap_lock);
+  }
+  block_t* block = cache.blocks[class];
+  if (!block) return NULL;
+  cache.blocks[class] = block->next;
+  cache.counts[class]--;
+  block->size =
+      (block->size & ~OWNER_BITS) | (size_t)cache.owner << OWNER_SHIFT;
+  return block;
+}
+
+/* The length of mapping for a block of SIZE bytes, or 0 if it would
+ * overflow. */
+static size_t map_length(size_t size) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  if (size > SIZE_MAX - HEADER_SIZE - page) return 0;
+  return (size + HEADER_SIZE + page - 1) & ~(page - 1);
+}
+
+/* Maps a block of SIZE bytes, handing out memory aligned to ALIGNMENT, or
+ * returns NULL if mmap() fails. */
+static block_t* map_block(size_t size, size_t alignment) {
+  if (size > SIZE_MAX - alignment) return NULL;
+  size_t length = map_length(size + alignment - ALIGNMENT);
+  if (length == 0) return NULL;
+  char* map = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED) return NULL;
+  uintptr_t aligned = ((uintptr_t)map + HEADER_SIZE + alignment - 1) &
+                      ~(uintptr_t)(alignment - 1);
+  block_t* block = block_of((void*)aligned);
+  block->prev_size = (char*)block - map;
+  block->size = (length - block->prev_size) | MAPPED | IN_USE;
+  __atomic_add_fetch(&mapped_bytes, length, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&mapped_blocks, 1, __ATOMIC_RELAXED);
+  return block;
+}
+
+static void unmap_block(block_t* block) {
+  size_t length = block->prev_size + block_size(block);
+  munmap((char*)block - block->prev_size, length);
+  __atomic_sub_fetch(&mapped_bytes, length, __ATOMIC_RELAXED);
+  __atomic_sub_fetch(&mapped_blocks, 1, __ATOMIC_RELAXED);
+}
+
+static void* allocate(size_t size);
+
+/* Reallocates BLOCK, mapped, to SIZE bytes: moved into the heap if it is
+ * under the threshold now, and otherwise into a mapping of the new length.
+ * One aligned within its mapping is copied instead. */
+static void* remap_block(block_t* block, size_t size) {
+  size_t old_length = block_size(block);
+  if (size < mmap_threshold || block->prev_size != 0) {
+    void* new_ptr = allocate(size);
+    if (!new_ptr) return NULL;
+    size_t old_size = old_length - HEADER_SIZE;
+    memcpy(new_ptr, payload(block), size < old_size ? size : old_size);
+    unmap_block(block);
+    return new_ptr;
+  }
+
+  size_t length = map_length(size);
+  if (length == 0) return NULL;
+  if (length != old_length) {
+    block_t* moved = mremap(block, old_length, length, MREMAP_MAYMOVE);
+    if (moved != MAP_FAILED) {
+      block = moved;
+      block->size = length | MAPPED | IN_USE;
+      __atomic_add_fetch(&mapped_bytes, length - old_length, __ATOMIC_RELAXED);
+    } else if (length > old_length) {
+      return NULL;
+    }
+  }
+  /* New pages come zero-filled, and the old ones were past the old size. */
+  size_t end = block_size(block) - HEADER_SIZE;
+  if (size < end) memset((char*)payload(block) + size, 0, end - size);
+  return payload(block);
+}
+
+void mm_set_mmap_threshold(size_t threshold) { mmap_threshold = threshold; }
+
+void mm_set_trim_threshold(size_t threshold) { trim_threshold = threshold; }
+
+static void* allocate(size_t size) {
+  size_t needed = block_size_for(size);
+  if (size == 0 || needed == 0) return NULL;
+
+  if (size >= mmap_threshold) {
+    block_t* block = map_block(size, ALIGNMENT);
+    /* Out of mappings, the heap may still have room. */
+    if (block) return payload(block);
+  }
+  block_t* block = needed < SMALL_LIMIT ? cached_block(needed) : NULL;
+  if (!block) {
+    pthread_mutex_lock(&heap_lock);
+    block = alloc_block(needed);
+    pthread_mutex_unlock(&heap_lock);
+    if (!block) return NULL;
+  }
+
+  memset(payload(block), 0, block_size(block) - HEADER_SIZE);
+  return payload(block);
+}
+
+/*
+ * Resizes BLOCK, in use in the heap, to SIZE bytes where it is, if the block
+ * after it is free or the top and big enough. Returns false if it cannot. The
+ * heap lock is held.
+ */
+static bool resize_block(block_t* block, size_t size) {
+  size_t old_size = block_size(block);
+  if (size <= old_size) {
+    split(block, size);
+    if (next_block(block) == top) trim_top();
+    return true;
+  }
+
+  block_t* next = next_block(block);
+  if (next == top) {
+    size_t grown = size - old_size;
+    if (block_size(top) < grown + MIN_BLOCK &&
+        (!grow_top(grown + MIN_BLOCK) || next != top))
+      return false;
+    size_t top_size = block_size(top);
+    set_size(block, size);
+    top = next_block(block);
+    top->size = (top_size - grown) | PREV_IN_USE;
+    return true;
+  }
+  if (next->size & IN_USE || old_size + block_size(next) < size) return false;
+  list_remove(next);
+  set_size(block, old_size + block_size(next));
+  next_block(block)->size |= PREV_IN_USE;
+  split(block, size);
+  return true;
+}
+
+/*
+ * Takes a block of SIZE bytes, rounded as block_size_for() does, whose memory
+ * is aligned to ALIGNMENT, more than ALIGNMENT, from the heap. The heap lock
+ * is held.
+ */
+static block_t* alloc_aligned_block(size_t size, size_t alignment) {
+  /* Room to move the start up to a free block's worth past the alignment. */
+  if (size > SIZE_MAX - alignment - MIN_BLOCK) return NULL;
+  block_t* block = alloc_block(size + alignment + MIN_BLOCK);
+  if (!block) return NULL;
+  uintptr_t start = (uintptr_t)payload(block);
+  uintptr_t aligned = (start + alignment - 1) & ~(uintptr_t)(alignment - 1);
+  if (aligned != start) {
+    if (aligned - start < MIN_BLOCK) aligned += alignment;
+    size_t lead = aligned - start;
+    block_t* aligned_block = block_of((void*)aligned);
+    aligned_block->size = (block_size(block) - lead) | IN_USE;
+    block->size = lead | (block->size & PREV_IN_USE) | IN_USE;
+    free_block(block);
+    block = aligned_block;
+  }
+  split(block, size);
+  return block;
+}
+
+void* mm_memalign(size_t alignment, size_t size) {
+  if (alignment == 0 || (alignment & (alignment - 1)) != 0) return NULL;
+  if (alignment <= ALIGNMENT) return allocate(size);
+  size_t needed = block_size_for(size);
+  if (size == 0 || needed == 0) return NULL;
+
+  if (size >= mmap_threshold) {
+    block_t* block = map_block(size, alignment);
+    if (block) return payload(block);
+  }
+  pthread_mutex_lock(&heap_lock);
+  block_t* block = alloc_aligned_block(needed, alignment);
+  pthread_mutex_unlock(&heap_lock);
+  if (!block) return NULL;
+  memset(payload(block), 0, block_size(block) - HEADER_SIZE);
+  return payload(block);
+}
+
+void* mm_aligned_alloc(size_t alignment, size_t size) {
+  return mm_memalign(alignment, size);
+}
+
+void* mm_calloc(size_t nmemb, size_t size) {
+  if (size != 0 && nmemb > SIZE_MAX / size) return NULL;
+  /* Zero-filled already. */
+  return allocate(nmemb * size);
+}
+
+static void release(void* ptr);
+
+static void* reallocate(void* ptr, size_t size) {
+  if (!ptr) return allocate(size);
+  if (size == 0) {
+    release(ptr);
+    return NULL;
+  }
+  block_t* block = block_of(ptr);
+  if (block->size & MAPPED) return remap_block(block, size);
+  size_t needed = block_size_for(size);
+  if (needed == 0) return NULL;
+
+  size_t old_size = block_size(block) - HEADER_SIZE;
+  /* Grown past the threshold, it moves to a mapping of its own. */
+  if (size <= old_size || size < mmap_threshold) {
+    pthread_mutex_lock(&heap_lock);
+    bool resized = resize_block(block, needed);
+    pthread_mutex_unlock(&heap_lock);
+    if (resized) {
+      /* Zero-filled past SIZE, as the block was past its old size: what it
+       * grew into may not be, and what is left may be grown back into. */
+      size_t start = size < old_size ? size : old_size;
+      size_t end = block_size(block) - HEADER_SIZE;
+      if (start < end) memset((char*)ptr + start, 0, end - start);
+      return ptr;
+    }
+  }
+
+  void* new_ptr = allocate(size);
+  if (!new_ptr) return NULL;
+  memcpy(new_ptr, ptr, old_size);
+  release(ptr);
+  return new_ptr;
+}
+
+static void release(void* ptr) {
+  if (!ptr) return;
+  block_t* block = block_of(ptr);
+  size_t size = block_size(block);
+  if (block->size & MAPPED) {
+    unmap_block(block);
+    return;
+  }
+  if (size < SMALL_LIMIT && register_cache()) {
+    if (!free_remote(block)) cache_block(block);
+    return;
+  }
+  pthread_mutex_lock(&heap_lock);
+  free_block(block);
+  pthread_mutex_unlock(&heap_lock);
+}
+
+static uint64_t now_ns(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* Counts a call that began at START, asking for SIZE bytes (0 for a free),
+ * from CALLER. */
+static void profile(uint64_t start, size_t size, void* caller) {
+  uint64_t elapsed = now_ns() - start;
+  int bucket = 63 - __builtin_clzll(elapsed | 1);
+  if (bucket >= MM_LATENCY_BUCKETS) bucket = MM_LATENCY_BUCKETS - 1;
+  __atomic_add_fetch(&latency[bucket], 1, __ATOMIC_RELAXED);
+  if (size == 0) return;
+  size_t needed = block_size_for(size);
+  int class = class_of(needed ? needed : SIZE_MAX);
+  __atomic_add_fetch(&class_requests[class], 1, __ATOMIC_RELAXED);
+
+  if (until_sample-- > 0) return;
+  until_sample = sample_every - 1;
+  pthread_mutex_lock(&site_lock);
+  size_t mask = SITE_TABLE_SIZE - 1;
+  size_t i = ((uintptr_t)caller >> 4) & mask;
+  /* A full table leaves new sites out. */
+  for (size_t probes = 0; probes < SITE_TABLE_SIZE; probes++) {
+    if (!sites[i].caller || sites[i].caller == caller) {
+      sites[i].caller = caller;
+      sites[i].samples++;
+      sites[i].bytes += size;
+      break;
+    }
+    i = (i + 1) & mask;
+  }
+  pthread_mutex_unlock(&site_lock);
+}
+
+void* mm_malloc(size_t size) {
+  if (!__atomic_load_n(&sample_every, __ATOMIC_RELAXED))
+    return allocate(size);
+  uint64_t start = now_ns();
+  void* ptr = allocate(size);
+  profile(start, size, __builtin_return_address(0));
+  return ptr;
+}
+
+void* mm_realloc(void* ptr, size_t size) {
+  if (!__atomic_load_n(&sample_every, __ATOMIC_RELAXED))
+    return reallocate(ptr, size);
+  uint64_t start = now_ns();
+  void* new_ptr = reallocate(ptr, size);
+  profile(start, size, __builtin_return_address(0));
+  return new_ptr;
 }
 
 void mm_free(void* ptr) {
-  //TODO: Implement free
+  if (!__atomic_load_n(&sample_every, __ATOMIC_RELAXED)) {
+    release(ptr);
+    return;
+  }
+  uint64_t start = now_ns();
+  release(ptr);
+  profile(start, 0, NULL);
+}
+
+void mm_profile(unsigned sample_every_calls) {
+  __atomic_store_n(&sample_every, sample_every_calls, __ATOMIC_RELAXED);
+}
+
+static int compare_sites(const void* a, const void* b) {
+  const struct mm_call_site* x = a;
+  const struct mm_call_site* y = b;
+  return (x->bytes < y->bytes) - (x->bytes > y->bytes);
+}
+
+void mm_stats(struct mm_stats* stats) {
+  memset(stats, 0, sizeof(*stats));
+  pthread_mutex_lock(&heap_lock);
+  size_t top_size = top ? block_size(top) : 0;
+  stats->heap_bytes = heap_bytes;
+  stats->free_bytes = free_bytes + top_size;
+  stats->in_use_bytes = heap_bytes - stats->free_bytes;
+  memcpy(stats->free_blocks, class_blocks, sizeof(class_blocks));
+  stats->largest_free = top_size;
+  int last = next_nonempty(-1);
+  for (int class = last; class != -1; class = next_nonempty(class))
+    last = class;
+  for (block_t* block = last == -1 ? NULL : classes[last]; block;
+       block = block->next)
+    if (block_size(block) > stats->largest_free)
+      stats->largest_free = block_size(block);
+  pthread_mutex_unlock(&heap_lock);
+  if (stats->free_bytes > 0)
+    stats->fragmentation =
+        1 - (double)stats->largest_free / (double)stats->free_bytes;
+
+  stats->mapped_bytes = __atomic_load_n(&mapped_bytes, __ATOMIC_RELAXED);
+  stats->mapped_blocks = __atomic_load_n(&mapped_blocks, __ATOMIC_RELAXED);
+  for (int class = 0; class < NUM_CLASSES; class++)
+    stats->requests[class] =
+        __atomic_load_n(&class_requests[class], __ATOMIC_RELAXED);
+  for (int i = 0; i < MM_LATENCY_BUCKETS; i++)
+    stats->latency[i] = __atomic_load_n(&latency[i], __ATOMIC_RELAXED);
+
+  static struct mm_call_site sorted[SITE_TABLE_SIZE];
+  pthread_mutex_lock(&site_lock);
+  memcpy(sorted, sites, sizeof(sites));
+  qsort(sorted, SITE_TABLE_SIZE, sizeof(sorted[0]), compare_sites);
+  memcpy(stats->call_sites, sorted, sizeof(stats->call_sites));
+  pthread_mutex_unlock(&site_lock);
+}
+
+/* The least size of block in CLASS. */
+static size_t class_size(int class) {
+  if (class < SMALL_LIMIT / ALIGNMENT) return (size_t)class * ALIGNMENT;
+  int large = class - SMALL_LIMIT / ALIGNMENT;
+  int log = large / 4 + __builtin_ctz(SMALL_LIMIT);
+  return ((size_t)4 + large % 4) << (log - 2);
+}
+
+void mm_dump(FILE* out) {
+  struct mm_stats stats;
+  mm_stats(&stats);
+  fprintf(out,
+          "heap: %zu bytes, %zu in use, %zu free (largest %zu, "
+          "fragmentation %.1f%%)\n",
+          stats.heap_bytes, stats.in_use_bytes, stats.free_bytes,
+          stats.largest_free, stats.fragmentation * 100);
+  fprintf(out, "mapped: %zu bytes in %zu blocks\n", stats.mapped_bytes,
+          stats.mapped_blocks);
+  fprintf(out, "class   from       free   requests\n");
+  for (int class = 0; class < NUM_CLASSES; class++)
+    if (stats.free_blocks[class] || stats.requests[class])
+      fprintf(out, "%5d %6zu %10zu %10llu\n", class, class_size(class),
+              stats.free_blocks[class], stats.requests[class]);
+  bool profiled = false;
+  for (int i = 0; i < MM_LATENCY_BUCKETS; i++) {
+    if (!stats.latency[i]) continue;
+    if (!profiled) fprintf(out, "latency (ns)     calls\n");
+    profiled = true;
+    fprintf(out, "%10llu %10llu\n", 1ull << i, stats.latency[i]);
+  }
+  for (int i = 0; i < MM_CALL_SITES && stats.call_sites[i].caller; i++)
+    fprintf(out, "call site %p: %llu samples, %llu bytes\n",
+            stats.call_sites[i].caller, stats.call_sites[i].samples,
+            stats.call_sites[i].bytes);
+}
+
+#define SLAB_SIZE (64 * 1024)
+#define SLAB_OBJECTS 16 /* At the least. */
+
+struct slab {
+  struct slab* next;
+};
+
+struct mm_pool {
+  pthread_mutex_t lock;
+  size_t stride, align, slab_size;
+  void* free_objects; /* Each holds the next. */
+  char *fresh, *fresh_end; /* What is left of the last slab. */
+  struct slab* slabs;
+};
+
+struct mm_pool* mm_pool_create(size_t size, size_t align) {
+  if (align == 0) align = sizeof(void*);
+  if ((align & (align - 1)) != 0 || size == 0) return NULL;
+  if (size < sizeof(void*)) size = sizeof(void*);
+  size_t limit = SIZE_MAX / 4 / SLAB_OBJECTS;
+  if (size > limit || align > limit) return NULL;
+  struct mm_pool* pool = allocate(sizeof(*pool));
+  if (!pool) return NULL;
+  pthread_mutex_init(&pool->lock, NULL);
+  pool->stride = (size + align - 1) & ~(align - 1);
+  pool->align = align;
+  size_t objects = pool->stride * SLAB_OBJECTS;
+  pool->slab_size = sizeof(struct slab) + align - 1 +
+                    (objects < SLAB_SIZE ? SLAB_SIZE : objects);
+  return pool;
+}
+
+/* Starts a new slab for POOL. The pool's lock is held. */
+static bool add_slab(struct mm_pool* pool) {
+  struct slab* slab = allocate(pool->slab_size);
+  if (!slab) return false;
+  slab->next = pool->slabs;
+  pool->slabs = slab;
+  uintptr_t first = ((uintptr_t)(slab + 1) + pool->align - 1) &
+                    ~(uintptr_t)(pool->align - 1);
+  pool->fresh = (char*)first;
+  pool->fresh_end = (char*)slab + pool->slab_size;
+  return true;
+}
+
+void* mm_pool_alloc(struct mm_pool* pool) {
+  pthread_mutex_lock(&pool->lock);
+  void* object = pool->free_objects;
+  if (object) {
+    pool->free_objects = *(void**)object;
+  } else if ((size_t)(pool->fresh_end - pool->fresh) >= pool->stride ||
+             add_slab(pool)) {
+    object = pool->fresh;
+    pool->fresh += pool->stride;
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return object;
+}
+
+void mm_pool_free(struct mm_pool* pool, void* object) {
+  if (!object) return;
+  pthread_mutex_lock(&pool->lock);
+  *(void**)object = pool->free_objects;
+  pool->free_objects = object;
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void mm_pool_destroy(struct mm_pool* pool) {
+  if (!pool) return;
+  for (struct slab* slab = pool->slabs; slab;) {
+    struct slab* next = slab->next;
+    release(slab);
+    slab = next;
+  }
+  pthread_mutex_destroy(&pool->lock);
+  release(pool);
 }
@@ -9,10 +9,66 @@
 #ifndef _malloc_H_
 #define _malloc_H_
 
+#include <stdio.h>
 #include <stdlib.h>
 
+#include "mm_stats.h"
+
 void* mm_malloc(size_t size);
 void* mm_realloc(void* ptr, size_t size);
 void mm_free(void* ptr);
+void* mm_calloc(size_t nmemb, size_t size);
+
+/*
+ * Allocates SIZE bytes aligned to ALIGNMENT, a power of two, to be freed
+ * with mm_free(). mm_aligned_alloc() is the same, under C11's name.
+ */
+void* mm_memalign(size_t alignment, size_t size);
+void* mm_aligned_alloc(size_t alignment, size_t size);
+
+/*
+ * Sets the size from which requests get pages of their own from mmap() rather
+ * than space in the heap: 128 KiB to begin with. Meant to be called before
+ * any allocation, and not while other threads allocate.
+ */
+void mm_set_mmap_threshold(size_t threshold);
+
+/*
+ * Sets how much free memory, at the end of the heap or in one free block
+ * elsewhere, is given back to the system: 128 KiB to begin with. As with the
+ * threshold above, meant to be called before any allocation.
+ */
+void mm_set_trim_threshold(size_t threshold);
+
+void mm_stats(struct mm_stats* stats);
+
+/* Prints the stats to OUT, a line per size class in use. */
+void mm_dump(FILE* out);
+
+/*
+ * Turns profiling on, sampling the caller of one call in SAMPLE_EVERY to
+ * mm_malloc() or mm_realloc() in each thread, or off, given 0. Profiling
+ * costs two clock readings and a few atomic adds a call.
+ */
+void mm_profile(unsigned sample_every);
+
+/*
+ * A pool of objects of one size, carved from slabs with no header for each,
+ * and handed out and taken back in constant time. Objects are not zeroed, and
+ * all of a pool's memory goes back to the heap only with mm_pool_destroy().
+ */
+struct mm_pool;
+
+/*
+ * Creates a pool of objects of SIZE bytes, each aligned to ALIGN, a power of
+ * two (or 0 for a pointer's alignment). Returns NULL if out of memory or the
+ * arguments are not valid.
+ */
+struct mm_pool* mm_pool_create(size_t size, size_t align);
+void* mm_pool_alloc(struct mm_pool* pool);
+void mm_pool_free(struct mm_pool* pool, void* object);
+
+/* Frees POOL and every object in it, whether freed or not. */
+void mm_pool_destroy(struct mm_pool* pool);
 
 #endif
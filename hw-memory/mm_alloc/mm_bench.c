@@ -0,0 +1,414 @@
+/*
+ * mm_bench.c
+ *
+ * Runs allocation workloads against hw3lib.so and the C library's malloc side
+ * by side, and reports for each the operations per second, the peak resident
+ * set, and how much of what is resident at the end is not live data.
+ *
+ * Every run is in a process of its own, so that one allocator's memory does
+ * not count towards the other's. The workloads are:
+ *
+ *   mixed     Each thread allocates and frees at random among its own slots,
+ *             mostly small sizes with a few of up to 256 KiB.
+ *   prodcons  Half the threads allocate and pass the blocks, through a queue,
+ *             to the other half to free.
+ *   realloc   Each thread grows buffers a few bytes at a time, as a string
+ *             builder would, to up to 64 KiB.
+ *
+ * and a trace given on the command line, replayed on one thread: a line per
+ * call, "a ID SIZE" for malloc, "r ID SIZE" for realloc and "f ID" for free,
+ * with ID naming the block.
+ *
+ * Usage: mm_bench [-n OPS] [-t THREADS] [TRACE...]
+ */
+
+#include <dlfcn.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SLOTS 4096
+#define QUEUE_SIZE 1024
+#define BUILDERS 64
+
+struct allocator {
+  const char* name;
+  void* (*malloc)(size_t);
+  void* (*realloc)(void*, size_t);
+  void (*free)(void*);
+};
+
+/* What a run sends back to the parent. */
+struct result {
+  double seconds;
+  unsigned long long ops;
+  size_t live_bytes; /* At the end, before everything is freed. */
+  size_t resident;   /* Then, less what was resident before the run. */
+};
+
+static long num_ops = 2000000;
+static int num_threads = 4;
+
+/* The workload being run, and what it runs against. */
+static const struct allocator* alloc;
+static const char* trace_path;
+
+/* xorshift64*, a generator per thread. */
+static uint64_t next_random(uint64_t* state) {
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 2685821657736338717ull;
+}
+
+static size_t random_between(uint64_t* state, size_t low, size_t high) {
+  return low + next_random(state) % (high - low + 1);
+}
+
+/* Sizes much as programs ask for them: most under a cache line or two, a few
+ * pages, and seldom more. */
+static size_t random_size(uint64_t* state) {
+  unsigned percent = next_random(state) % 100;
+  if (percent < 60) return random_between(state, 8, 64);
+  if (percent < 90) return random_between(state, 65, 512);
+  if (percent < 99) return random_between(state, 513, 8192);
+  return random_between(state, 8193, 256 * 1024);
+}
+
+static double now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static size_t resident_bytes(void) {
+  FILE* statm = fopen("/proc/self/statm", "r");
+  long pages = 0;
+  if (statm) {
+    if (fscanf(statm, "%*s %ld", &pages) != 1) pages = 0;
+    fclose(statm);
+  }
+  return (size_t)pages * sysconf(_SC_PAGESIZE);
+}
+
+static void* checked(void* ptr) {
+  if (!ptr) {
+    fprintf(stderr, "%s: out of memory\n", alloc->name);
+    exit(EXIT_FAILURE);
+  }
+  return ptr;
+}
+
+/* Writes to each page of the SIZE bytes at PTR, as a program using them
+ * would, so that they are resident. */
+static void touch(char* ptr, size_t size) {
+  for (size_t i = 0; i < size; i += 4096) ptr[i] = 1;
+  ptr[size - 1] = 1;
+}
+
+/* A thread's part of a workload. */
+struct worker {
+  pthread_t thread;
+  int index;
+  long ops;
+  void* slots[SLOTS];
+  size_t sizes[SLOTS];
+};
+
+static void* run_mixed(void* aux) {
+  struct worker* worker = aux;
+  uint64_t state = worker->index * 7919 + 1;
+  for (long i = 0; i < worker->ops; i++) {
+    size_t slot = next_random(&state) % SLOTS;
+    if (worker->slots[slot]) {
+      alloc->free(worker->slots[slot]);
+      worker->slots[slot] = NULL;
+      worker->sizes[slot] = 0;
+    } else {
+      size_t size = random_size(&state);
+      char* ptr = checked(alloc->malloc(size));
+      touch(ptr, size);
+      worker->slots[slot] = ptr;
+      worker->sizes[slot] = size;
+    }
+  }
+  return NULL;
+}
+
+static void* run_realloc(void* aux) {
+  struct worker* worker = aux;
+  uint64_t state = worker->index * 7919 + 1;
+  size_t targets[BUILDERS] = {0};
+  for (long i = 0; i < worker->ops; i++) {
+    size_t slot = next_random(&state) % BUILDERS;
+    if (worker->sizes[slot] >= targets[slot]) {
+      alloc->free(worker->slots[slot]);
+      worker->slots[slot] = NULL;
+      worker->sizes[slot] = 0;
+      targets[slot] = random_between(&state, 64, 64 * 1024);
+      continue;
+    }
+    size_t size = worker->sizes[slot] + random_between(&state, 1, 64);
+    char* ptr = checked(alloc->realloc(worker->slots[slot], size));
+    memset(ptr + worker->sizes[slot], 'x', size - worker->sizes[slot]);
+    worker->slots[slot] = ptr;
+    worker->sizes[slot] = size;
+  }
+  return NULL;
+}
+
+/* The blocks on their way from producers to consumers. */
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  void* blocks[QUEUE_SIZE];
+  size_t head, count;
+} queue = {.lock = PTHREAD_MUTEX_INITIALIZER,
+           .changed = PTHREAD_COND_INITIALIZER};
+
+static void* run_producer(void* aux) {
+  struct worker* worker = aux;
+  uint64_t state = worker->index * 7919 + 1;
+  for (long i = 0; i < worker->ops; i++) {
+    size_t size = random_size(&state);
+    char* ptr = checked(alloc->malloc(size));
+    touch(ptr, size);
+    pthread_mutex_lock(&queue.lock);
+    while (queue.count == QUEUE_SIZE)
+      pthread_cond_wait(&queue.changed, &queue.lock);
+    queue.blocks[(queue.head + queue.count++) % QUEUE_SIZE] = ptr;
+    pthread_cond_broadcast(&queue.changed);
+    pthread_mutex_unlock(&queue.lock);
+  }
+  return NULL;
+}
+
+static void* run_consumer(void* aux) {
+  struct worker* worker = aux;
+  for (long i = 0; i < worker->ops; i++) {
+    pthread_mutex_lock(&queue.lock);
+    while (queue.count == 0) pthread_cond_wait(&queue.changed, &queue.lock);
+    void* ptr = queue.blocks[queue.head];
+    queue.head = (queue.head + 1) % QUEUE_SIZE;
+    queue.count--;
+    pthread_cond_broadcast(&queue.changed);
+    pthread_mutex_unlock(&queue.lock);
+    alloc->free(ptr);
+  }
+  return NULL;
+}
+
+/* Runs NUM_OPS of a workload over the threads, and frees what it left. */
+static void run_threads(void* run(void*), struct result* result) {
+  struct worker* workers = checked(calloc(num_threads, sizeof(*workers)));
+  size_t resident = resident_bytes();
+  double start = now();
+  for (int i = 0; i < num_threads; i++) {
+    workers[i].index = i;
+    workers[i].ops = num_ops / num_threads;
+    pthread_create(&workers[i].thread, NULL, run, &workers[i]);
+  }
+  for (int i = 0; i < num_threads; i++) pthread_join(workers[i].thread, NULL);
+  result->seconds = now() - start;
+  result->resident = resident_bytes() - resident;
+
+  for (int i = 0; i < num_threads; i++) {
+    result->ops += workers[i].ops;
+    for (size_t slot = 0; slot < SLOTS; slot++) {
+      result->live_bytes += workers[i].sizes[slot];
+      alloc->free(workers[i].slots[slot]);
+    }
+  }
+  free(workers);
+}
+
+static void* run_prodcons(void* aux) {
+  struct worker* worker = aux;
+  return worker->index % 2 == 0 ? run_producer(aux) : run_consumer(aux);
+}
+
+/* One call in a trace. */
+struct call {
+  char op;
+  size_t id, size;
+};
+
+static void run_trace(struct result* result) {
+  FILE* file = fopen(trace_path, "r");
+  if (!file) {
+    perror(trace_path);
+    exit(EXIT_FAILURE);
+  }
+  struct call* calls = NULL;
+  size_t num_calls = 0, capacity = 0, num_ids = 0;
+  struct call call;
+  char line[128];
+  while (fgets(line, sizeof(line), file)) {
+    call.size = 0;
+    int fields = sscanf(line, " %c %zu %zu", &call.op, &call.id, &call.size);
+    if (fields < 2 || !strchr("arf", call.op) || (call.op != 'f' && fields < 3))
+      continue;
+    if (num_calls == capacity) {
+      capacity = capacity ? capacity * 2 : 1024;
+      calls = checked(realloc(calls, capacity * sizeof(*calls)));
+    }
+    calls[num_calls++] = call;
+    if (call.id >= num_ids) num_ids = call.id + 1;
+  }
+  fclose(file);
+
+  void** blocks = checked(calloc(num_ids + 1, sizeof(*blocks)));
+  size_t* sizes = checked(calloc(num_ids + 1, sizeof(*sizes)));
+  size_t resident = resident_bytes();
+  double start = now();
+  for (size_t i = 0; i < num_calls; i++) {
+    struct call* c = &calls[i];
+    if (c->op == 'f') {
+      alloc->free(blocks[c->id]);
+      blocks[c->id] = NULL;
+      sizes[c->id] = 0;
+      continue;
+    }
+    if (c->op == 'a') {
+      /* An ID used again without a free in between. */
+      alloc->free(blocks[c->id]);
+      blocks[c->id] = alloc->malloc(c->size);
+    } else {
+      void* ptr = alloc->realloc(blocks[c->id], c->size);
+      if (!ptr && c->size > 0) continue;
+      blocks[c->id] = ptr;
+    }
+    sizes[c->id] = blocks[c->id] ? c->size : 0;
+  }
+  result->seconds = now() - start;
+  result->resident = resident_bytes() - resident;
+  result->ops = num_calls;
+  for (size_t id = 0; id < num_ids; id++) {
+    result->live_bytes += sizes[id];
+    alloc->free(blocks[id]);
+  }
+  free(blocks);
+  free(sizes);
+  free(calls);
+}
+
+static void run_workload(const char* name, struct result* result) {
+  if (trace_path)
+    run_trace(result);
+  else if (strcmp(name, "mixed") == 0)
+    run_threads(run_mixed, result);
+  else if (strcmp(name, "prodcons") == 0)
+    run_threads(run_prodcons, result);
+  else
+    run_threads(run_realloc, result);
+}
+
+static void* try_dlsym(void* handle, const char* symbol) {
+  void* function = dlsym(handle, symbol);
+  if (!function) {
+    fprintf(stderr, "%s\n", dlerror());
+    exit(EXIT_FAILURE);
+  }
+  return function;
+}
+
+static void load_allocator(struct allocator* hw3) {
+  void* handle = dlopen("hw3lib.so", RTLD_NOW);
+  if (!handle) {
+    fprintf(stderr, "%s\n", dlerror());
+    exit(EXIT_FAILURE);
+  }
+  hw3->name = "hw3lib";
+  hw3->malloc = try_dlsym(handle, "mm_malloc");
+  hw3->realloc = try_dlsym(handle, "mm_realloc");
+  hw3->free = try_dlsym(handle, "mm_free");
+}
+
+/* Runs the workload (or trace) NAME against ALLOCATOR in a child process, and
+ * prints how it went. */
+static void bench(const char* name, const struct allocator* allocator) {
+  int fds[2];
+  if (pipe(fds) == -1) {
+    perror("pipe");
+    exit(EXIT_FAILURE);
+  }
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == -1) {
+    perror("fork");
+    exit(EXIT_FAILURE);
+  }
+  if (pid == 0) {
+    struct allocator hw3;
+    if (allocator == NULL) {
+      load_allocator(&hw3);
+      allocator = &hw3;
+    }
+    alloc = allocator;
+    struct result result = {0};
+    run_workload(name, &result);
+    ssize_t written = write(fds[1], &result, sizeof(result));
+    _exit(written == sizeof(result) ? EXIT_SUCCESS : EXIT_FAILURE);
+  }
+
+  close(fds[1]);
+  struct result result;
+  bool received = read(fds[0], &result, sizeof(result)) == sizeof(result);
+  close(fds[0]);
+  int status;
+  struct rusage usage;
+  wait4(pid, &status, 0, &usage);
+  const char* allocator_name = allocator ? allocator->name : "hw3lib";
+  if (!received || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    printf("%-10.10s %-8s failed\n", name, allocator_name);
+    return;
+  }
+  double waste = result.resident > result.live_bytes
+                     ? 1 - (double)result.live_bytes / result.resident
+                     : 0;
+  printf("%-10.10s %-8s %12.0f %10.1f %9.1f%%\n", name, allocator_name,
+         result.ops / result.seconds, usage.ru_maxrss / 1024.0, waste * 100);
+}
+
+static void usage(const char* program) {
+  fprintf(stderr, "usage: %s [-n OPS] [-t THREADS] [TRACE...]\n", program);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char* argv[]) {
+  int opt;
+  while ((opt = getopt(argc, argv, "n:t:")) != -1) {
+    if (opt == 'n')
+      num_ops = atol(optarg);
+    else if (opt == 't')
+      num_threads = atoi(optarg);
+    else
+      usage(argv[0]);
+  }
+  /* The producers and consumers go in pairs. */
+  if (num_ops <= 0 || num_threads < 2 || num_threads % 2 != 0) usage(argv[0]);
+
+  static const struct allocator libc = {"libc", malloc, realloc, free};
+  printf("%-10s %-8s %12s %10s %10s\n", "workload", "malloc", "ops/s",
+         "peak MiB", "not live");
+  const char* workloads[] = {"mixed", "prodcons", "realloc"};
+  for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++) {
+    bench(workloads[i], NULL);
+    bench(workloads[i], &libc);
+  }
+  for (int i = optind; i < argc; i++) {
+    trace_path = argv[i];
+    const char* slash = strrchr(trace_path, '/');
+    const char* name = slash ? slash + 1 : trace_path;
+    bench(name, NULL);
+    bench(name, &libc);
+  }
+  return 0;
+}
@@ -0,0 +1,44 @@
+/*
+ * mm_stats.h
+ *
+ * What mm_stats() reports, apart from the rest of mm_alloc.h so that a
+ * program loading the library with dlopen() can use it.
+ */
+
+#pragma once
+
+#ifndef _mm_stats_H_
+#define _mm_stats_H_
+
+#include <stddef.h>
+
+#define MM_NUM_CLASSES 256
+#define MM_LATENCY_BUCKETS 32
+#define MM_CALL_SITES 16
+
+struct mm_call_site {
+  void* caller; /* The return address of the call. */
+  unsigned long long samples;
+  unsigned long long bytes; /* Asked for in the calls sampled. */
+};
+
+/*
+ * What the allocator holds. Bytes are those of whole blocks, headers
+ * included, and blocks that threads keep cached count as in use.
+ */
+struct mm_stats {
+  size_t heap_bytes; /* Got from sbrk() and not given back. */
+  size_t in_use_bytes;
+  size_t free_bytes; /* In free blocks and the top of the heap. */
+  size_t largest_free;
+  double fragmentation; /* 1 - LARGEST_FREE / FREE_BYTES. */
+  size_t mapped_bytes, mapped_blocks; /* Pages of their own from mmap(). */
+  size_t free_blocks[MM_NUM_CLASSES]; /* By size class. */
+
+  /* Counted only while profiling. */
+  unsigned long long requests[MM_NUM_CLASSES]; /* By size class. */
+  unsigned long long latency[MM_LATENCY_BUCKETS]; /* Calls taking 2^i ns on. */
+  struct mm_call_site call_sites[MM_CALL_SITES]; /* Most bytes first. */
+};
+
+#endif
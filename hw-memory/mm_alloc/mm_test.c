@@ -1,12 +1,27 @@
 #include <assert.h>
 #include <dlfcn.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mm_stats.h"
 
 /* Function pointers to hw3 functions */
 void* (*mm_malloc)(size_t);
 void* (*mm_realloc)(void*, size_t);
 void (*mm_free)(void*);
+void* (*mm_calloc)(size_t, size_t);
+void* (*mm_memalign)(size_t, size_t);
+void (*mm_stats)(struct mm_stats*);
+void (*mm_profile)(unsigned);
+struct mm_pool* (*mm_pool_create)(size_t, size_t);
+void* (*mm_pool_alloc)(struct mm_pool*);
+void (*mm_pool_free)(struct mm_pool*, void*);
+void (*mm_pool_destroy)(struct mm_pool*);
 
 static void* try_dlsym(void* handle, const char* symbol) {
   char* error;
@@ -28,6 +43,193 @@ static void load_alloc_functions() {
   mm_malloc = try_dlsym(handle, "mm_malloc");
   mm_realloc = try_dlsym(handle, "mm_realloc");
   mm_free = try_dlsym(handle, "mm_free");
+  mm_calloc = try_dlsym(handle, "mm_calloc");
+  mm_memalign = try_dlsym(handle, "mm_memalign");
+  mm_stats = try_dlsym(handle, "mm_stats");
+  mm_profile = try_dlsym(handle, "mm_profile");
+  mm_pool_create = try_dlsym(handle, "mm_pool_create");
+  mm_pool_alloc = try_dlsym(handle, "mm_pool_alloc");
+  mm_pool_free = try_dlsym(handle, "mm_pool_free");
+  mm_pool_destroy = try_dlsym(handle, "mm_pool_destroy");
+}
+
+static int* alloc_filled(size_t num_ints) {
+  int* ptr = mm_malloc(num_ints * sizeof(int));
+  assert(ptr != NULL);
+  for (size_t i = 0; i < num_ints; i++) {
+    assert(ptr[i] == 0);
+    ptr[i] = 0x05158E57;
+  }
+  return ptr;
+}
+
+/* Free blocks next to each other are merged, and big ones are split, as the
+ * Pintos malloc-merge-* and malloc-fit tests expect. */
+static void test_merge_and_fit() {
+  int* p = alloc_filled(2 * 4096);
+  int* q = alloc_filled(2 * 4096);
+  int* r = alloc_filled(2 * 4096);
+  int* s = alloc_filled(2 * 4096);
+  mm_free(r);
+  mm_free(s);
+  mm_free(p);
+  mm_free(q);
+  int* t = alloc_filled(3 * 4096);
+  assert(p <= t && t < r);
+
+  int* u = alloc_filled(4096);
+  mm_free(t);
+  int* v = alloc_filled(1024);
+  int* w = alloc_filled(1024);
+  assert(p <= v && v < u);
+  assert(p <= w && w < u);
+  mm_free(u);
+  mm_free(v);
+  mm_free(w);
+}
+
+static void test_realloc() {
+  int* p = alloc_filled(3787);
+  int* q = mm_realloc(p, 3 * 3787 * sizeof(int));
+  assert(q != NULL);
+  for (size_t i = 0; i < 3 * 3787; i++)
+    assert(q[i] == (i < 3787 ? 0x05158E57 : 0));
+  mm_free(q);
+  assert(mm_realloc(NULL, 0) == NULL);
+}
+
+/* Growing a little at a time, the buffer is grown where it is. */
+static void test_realloc_in_place() {
+  char* buffer = mm_malloc(100);
+  assert(buffer != NULL);
+  int moves = 0;
+  for (size_t size = 200; size < 64 * 1024; size += 100) {
+    char* grown = mm_realloc(buffer, size);
+    assert(grown != NULL && grown[size - 1] == 0);
+    grown[size - 1] = 1;
+    moves += grown != buffer;
+    buffer = grown;
+  }
+  assert(moves <= 2);
+  assert(mm_realloc(buffer, 100) == buffer);
+  mm_free(buffer);
+}
+
+/* Once freed, the heap shrinks back. */
+static void test_trim() {
+  char* start = sbrk(0);
+  void* blocks[1000];
+  for (int i = 0; i < 1000; i++) blocks[i] = alloc_filled(2500);
+  assert((char*)sbrk(0) - start >= 1000 * 9000);
+  for (int i = 0; i < 1000; i++) mm_free(blocks[i]);
+  assert((char*)sbrk(0) - start < 1024 * 1024);
+}
+
+static void test_stats() {
+  struct mm_stats before, after;
+  mm_stats(&before);
+  mm_profile(1);
+  void* small = mm_malloc(50000);
+  void* large = mm_malloc(1 << 20);
+  mm_stats(&after);
+  mm_profile(0);
+  assert(after.in_use_bytes >= before.in_use_bytes + 50000);
+  assert(after.mapped_blocks == before.mapped_blocks + 1);
+  assert(after.mapped_bytes >= before.mapped_bytes + (1 << 20));
+  assert(after.call_sites[0].caller != NULL);
+  assert(after.call_sites[0].bytes >= (1 << 20));
+  mm_free(small);
+  mm_free(large);
+  mm_stats(&after);
+  assert(after.in_use_bytes == before.in_use_bytes);
+  assert(after.mapped_blocks == before.mapped_blocks);
+}
+
+static void test_memalign() {
+  char* blocks[300];
+  for (int i = 0; i < 300; i++) {
+    size_t alignment = (size_t)32 << (i % 8);
+    size_t size = 1 + (size_t)i * 37 % 5000;
+    if (i % 100 == 99) size = 1 << 20;
+    blocks[i] = mm_memalign(alignment, size);
+    assert(blocks[i] != NULL && (uintptr_t)blocks[i] % alignment == 0);
+    assert(blocks[i][0] == 0 && blocks[i][size - 1] == 0);
+    memset(blocks[i], 1, size);
+    if (i % 3 == 0) {
+      mm_free(blocks[i]);
+      blocks[i] = NULL;
+    }
+  }
+  for (int i = 0; i < 300; i++) mm_free(blocks[i]);
+  assert(mm_memalign(48, 16) == NULL);
+
+  int* zeroes = mm_calloc(1000, sizeof(int));
+  assert(zeroes != NULL && zeroes[0] == 0 && zeroes[999] == 0);
+  mm_free(zeroes);
+  assert(mm_calloc(SIZE_MAX / 2, 4) == NULL);
+}
+
+static void test_pool() {
+  struct mm_pool* pool = mm_pool_create(24, 32);
+  assert(pool != NULL);
+  char* objects[10000];
+  for (int i = 0; i < 10000; i++) {
+    objects[i] = mm_pool_alloc(pool);
+    assert(objects[i] != NULL && (uintptr_t)objects[i] % 32 == 0);
+    memset(objects[i], i, 24);
+  }
+  for (int i = 0; i < 10000; i++)
+    assert(objects[i][0] == (char)i && objects[i][23] == (char)i);
+  mm_pool_free(pool, objects[42]);
+  assert(mm_pool_alloc(pool) == objects[42]);
+  mm_pool_destroy(pool);
+  assert(mm_pool_create(24, 48) == NULL);
+}
+
+static void* alloc_all(void* blocks) {
+  for (int i = 0; i < 8; i++) ((void**)blocks)[i] = alloc_filled(25);
+  return NULL;
+}
+
+static void* free_all(void* blocks) {
+  for (int i = 0; i < 8; i++) mm_free(((void**)blocks)[i]);
+  return NULL;
+}
+
+/* Blocks freed on another thread come back to the thread they came from, the
+ * next time it allocates, and blocks from a thread that has exited can still
+ * be freed. */
+static void test_remote_free() {
+  void* blocks[8];
+  alloc_all(blocks);
+  pthread_t thread;
+  pthread_create(&thread, NULL, free_all, blocks);
+  pthread_join(thread, NULL);
+  for (int i = 0; i < 8; i++) {
+    int* ptr = alloc_filled(25);
+    bool returned = false;
+    for (int j = 0; j < 8; j++) returned |= ptr == blocks[j];
+    assert(returned);
+    blocks[i] = ptr;
+  }
+  free_all(blocks);
+
+  pthread_create(&thread, NULL, alloc_all, blocks);
+  pthread_join(thread, NULL);
+  free_all(blocks);
+}
+
+/* Big enough to be mapped rather than taken from the heap. */
+static void test_large() {
+  size_t n = 1 << 20;
+  int* p = alloc_filled(n);
+  int* q = mm_realloc(p, 4 * n * sizeof(int));
+  assert(q != NULL);
+  for (size_t i = 0; i < 4 * n; i++)
+    assert(q[i] == (i < n ? 0x05158E57 : 0));
+  q = mm_realloc(q, 16);
+  assert(q != NULL && q[3] == 0x05158E57);
+  mm_free(q);
 }
 
 int main() {
@@ -37,5 +239,14 @@ int main() {
   assert(data != NULL);
   data[0] = 0x162;
   mm_free(data);
+  test_merge_and_fit();
+  test_realloc();
+  test_realloc_in_place();
+  test_large();
+  test_trim();
+  test_stats();
+  test_memalign();
+  test_pool();
+  test_remote_free();
   puts("malloc test successful!");
 }
@@ -228,6 +228,29 @@ bool bitmap_all(const struct bitmap* b, size_t start, size_t cnt) {
 
 /* Finding set or unset bits. */
 
+/* Finds the first bit in B at or after START that is set to
+   VALUE, an element at a time: elements with none are skipped
+   whole, and the bit is found in the first one that has one
+   with a find-first-set.  Returns BITMAP_ERROR if there is
+   none. */
+static size_t bitmap_scan_one(const struct bitmap* b, size_t start, bool value) {
+  size_t cnt = elem_cnt(b->bit_cnt);
+  elem_type flip = value ? 0 : (elem_type)-1;
+  size_t i = elem_idx(start);
+  if (i >= cnt)
+    return BITMAP_ERROR;
+
+  /* Bits set in WORD are those equal to VALUE, from START on. */
+  elem_type word = (b->bits[i] ^ flip) & ~(bit_mask(start) - 1);
+  while (word == 0) {
+    if (++i == cnt)
+      return BITMAP_ERROR;
+    word = b->bits[i] ^ flip;
+  }
+  size_t idx = i * ELEM_BITS + __builtin_ctzl(word);
+  return idx < b->bit_cnt ? idx : BITMAP_ERROR;
+}
+
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
@@ -236,6 +259,8 @@ size_t bitmap_scan(const struct bitmap* b, size_t start, size_t cnt, bool value)
   ASSERT(b != NULL);
   ASSERT(start <= b->bit_cnt);
 
+  if (cnt == 1)
+    return bitmap_scan_one(b, start, value);
   if (cnt <= b->bit_cnt) {
     size_t last = b->bit_cnt - cnt;
     size_t i;
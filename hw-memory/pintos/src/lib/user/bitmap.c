@@ -0,0 +1,7 @@
+/* The kernel's bitmaps, built again for user programs, which
+   have none of the file system that bitmap_read() and
+   bitmap_write() need.  The kernel's own object is built with
+   FILESYS, so it cannot be shared as the rest of lib is. */
+
+#undef FILESYS
+#include "../kernel/bitmap.c"
@@ -0,0 +1,298 @@
+/* Dynamic memory allocation for user programs, in the heap that
+   sbrk() grows.
+
+   Requests of SMALL_MAX bytes or less come from small-object
+   pages: a page holds objects of one size class, with no header
+   for each, and a bitmap of which of its slots are in use, so
+   that taking one is a find-first-zero over a word of it.  The
+   pages are carved from regions of REGION_PAGES pages, which
+   have a bitmap of the pages in use in the same way.
+
+   Everything else, the regions included, is a block of the
+   heap, with a header before it.  The blocks are listed in
+   address order; one is found first-fit and split if it is big
+   enough to hold another block besides, and a freed one merges
+   with free blocks on either side of it.  When no block fits,
+   the last one is grown if it is free, and a new one is added
+   at the end otherwise. */
+
+#include <stdlib.h>
+#include <debug.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <round.h>
+#include <syscall.h>
+#include "kernel/bitmap.h"
+
+/* A block of the heap. */
+struct block {
+  bool free;
+  size_t size;        /* Bytes after the header. */
+  struct block* next; /* The blocks after and before, in the heap. */
+  struct block* prev;
+};
+
+/* The first block of the heap, or NULL if there is none yet. */
+static struct block* heap;
+
+#define PAGE_SIZE 4096
+#define REGION_PAGES 16
+#define SMALL_MIN 8  /* The size of the smallest class. */
+#define SMALL_MAX 64 /* The size of the largest class. */
+#define NUM_CLASSES 4
+
+/* The start of a small-object page. */
+struct page {
+  struct page* next; /* In the list of pages of its class with a slot free. */
+  struct page* prev;
+  size_t object_size;
+  size_t free_cnt;
+  struct bitmap* used; /* A bit per slot. */
+};
+
+/* Room for the header and the biggest bitmap a page needs, that
+   of the smallest class, before the first object. */
+#define PAGE_HEADER_SIZE (sizeof(struct page) + bitmap_buf_size(PAGE_SIZE / SMALL_MIN))
+
+/* Pages of small objects, carved from a block of the heap. */
+struct region {
+  struct region* next;
+  uint8_t* pages;        /* The first of them, page-aligned. */
+  struct bitmap* in_use; /* A bit per page. */
+};
+
+static struct region* regions;
+
+/* For each class, the pages that have a slot free. */
+static struct page* partial[NUM_CLASSES];
+
+/* Inserts block B into the heap after block A. */
+static void heap_insert(struct block* a, struct block* b) {
+  b->next = a->next;
+  b->prev = a;
+  if (a->next != NULL)
+    a->next->prev = b;
+  a->next = b;
+}
+
+static void heap_remove(struct block* b) {
+  if (b->prev != NULL)
+    b->prev->next = b->next;
+  if (b->next != NULL)
+    b->next->prev = b->prev;
+  if (heap == b)
+    heap = b->next;
+}
+
+static void* heap_malloc(size_t size) {
+  struct block* b;
+  struct block* last = NULL;
+  for (b = heap; b != NULL; b = b->next) {
+    if (b->free && b->size >= size) {
+      /* Split off what is left, if it can hold a block. */
+      if (b->size > size + sizeof(struct block)) {
+        struct block* rest = (struct block*)((uint8_t*)(b + 1) + size);
+        rest->free = true;
+        rest->size = b->size - size - sizeof(struct block);
+        b->size = size;
+        heap_insert(b, rest);
+      }
+      b->free = false;
+      return b + 1;
+    }
+    last = b;
+  }
+
+  /* The last block ends at the break: grow it if it is free. */
+  if (last != NULL && last->free) {
+    if (sbrk(size - last->size) == (void*)-1)
+      return NULL;
+    last->free = false;
+    last->size = size;
+    return last + 1;
+  }
+
+  if (size > SIZE_MAX - sizeof(struct block))
+    return NULL;
+  b = sbrk(size + sizeof(struct block));
+  if (b == (void*)-1)
+    return NULL;
+  b->free = false;
+  b->size = size;
+  if (last != NULL)
+    heap_insert(last, b);
+  else {
+    b->next = b->prev = NULL;
+    heap = b;
+  }
+  return b + 1;
+}
+
+static void heap_free(void* ptr) {
+  struct block* b = (struct block*)ptr - 1;
+  b->free = true;
+  if (b->next != NULL && b->next->free) {
+    b->size += b->next->size + sizeof(struct block);
+    heap_remove(b->next);
+  }
+  if (b->prev != NULL && b->prev->free) {
+    b->prev->size += b->size + sizeof(struct block);
+    heap_remove(b);
+  }
+}
+
+/* Returns the class of objects of SIZE bytes, at most SMALL_MAX. */
+static int class_of(size_t size) {
+  int class = 0;
+  while ((size_t)SMALL_MIN << class < size)
+    class++;
+  return class;
+}
+
+static uint8_t* first_object(struct page* page) {
+  return (uint8_t*)page + ROUND_UP(PAGE_HEADER_SIZE, page->object_size);
+}
+
+static void partial_push(struct page* page, int class) {
+  page->prev = NULL;
+  page->next = partial[class];
+  if (page->next != NULL)
+    page->next->prev = page;
+  partial[class] = page;
+}
+
+static void partial_remove(struct page* page, int class) {
+  if (page->prev != NULL)
+    page->prev->next = page->next;
+  else
+    partial[class] = page->next;
+  if (page->next != NULL)
+    page->next->prev = page->prev;
+}
+
+/* Adds a region to the heap, or returns NULL if out of memory. */
+static struct region* add_region(void) {
+  size_t header = sizeof(struct region) + bitmap_buf_size(REGION_PAGES);
+  uint8_t* block = heap_malloc(header + (REGION_PAGES + 1) * PAGE_SIZE - 1);
+  if (block == NULL)
+    return NULL;
+  struct region* region = (struct region*)block;
+  region->pages = (uint8_t*)ROUND_UP((uintptr_t)block + header, PAGE_SIZE);
+  region->in_use =
+      bitmap_create_in_buf(REGION_PAGES, region + 1, bitmap_buf_size(REGION_PAGES));
+  region->next = regions;
+  regions = region;
+  return region;
+}
+
+/* Takes a page for objects of CLASS, and lists it as partial. */
+static struct page* add_page(int class) {
+  struct region* region;
+  size_t idx = BITMAP_ERROR;
+  for (region = regions; region != NULL; region = region->next) {
+    idx = bitmap_scan_and_flip(region->in_use, 0, 1, false);
+    if (idx != BITMAP_ERROR)
+      break;
+  }
+  if (region == NULL) {
+    region = add_region();
+    if (region == NULL)
+      return NULL;
+    idx = bitmap_scan_and_flip(region->in_use, 0, 1, false);
+  }
+
+  struct page* page = (struct page*)(region->pages + idx * PAGE_SIZE);
+  page->object_size = (size_t)SMALL_MIN << class;
+  page->free_cnt = (PAGE_SIZE - (first_object(page) - (uint8_t*)page)) / page->object_size;
+  page->used = bitmap_create_in_buf(page->free_cnt, page + 1,
+                                    PAGE_HEADER_SIZE - sizeof(struct page));
+  partial_push(page, class);
+  return page;
+}
+
+static void* small_malloc(size_t size) {
+  int class = class_of(size);
+  struct page* page = partial[class];
+  if (page == NULL) {
+    page = add_page(class);
+    if (page == NULL)
+      return NULL;
+  }
+  size_t slot = bitmap_scan_and_flip(page->used, 0, 1, false);
+  if (--page->free_cnt == 0)
+    partial_remove(page, class);
+  return first_object(page) + slot * page->object_size;
+}
+
+/* Returns the region PTR is in, or NULL if it is not in one. */
+static struct region* region_of(void* ptr) {
+  struct region* region;
+  for (region = regions; region != NULL; region = region->next)
+    if ((uint8_t*)ptr >= region->pages && (uint8_t*)ptr < region->pages + REGION_PAGES * PAGE_SIZE)
+      return region;
+  return NULL;
+}
+
+static struct page* page_of(void* ptr) {
+  return (struct page*)ROUND_DOWN((uintptr_t)ptr, PAGE_SIZE);
+}
+
+/* Frees PTR, an object in REGION.  A page left empty goes back
+   to the region. */
+static void small_free(struct region* region, void* ptr) {
+  struct page* page = page_of(ptr);
+  int class = class_of(page->object_size);
+  size_t slot = ((uint8_t*)ptr - first_object(page)) / page->object_size;
+  ASSERT(bitmap_test(page->used, slot));
+  bitmap_reset(page->used, slot);
+  if (page->free_cnt++ == 0)
+    partial_push(page, class);
+  if (page->free_cnt == bitmap_size(page->used)) {
+    partial_remove(page, class);
+    bitmap_reset(region->in_use, ((uint8_t*)page - region->pages) / PAGE_SIZE);
+  }
+}
+
+void* malloc(size_t size) {
+  if (size == 0)
+    return NULL;
+  return size <= SMALL_MAX ? small_malloc(size) : heap_malloc(size);
+}
+
+void free(void* ptr) {
+  if (ptr == NULL)
+    return;
+  struct region* region = region_of(ptr);
+  if (region != NULL)
+    small_free(region, ptr);
+  else
+    heap_free(ptr);
+}
+
+void* calloc(size_t nmemb, size_t size) {
+  if (size != 0 && nmemb > SIZE_MAX / size)
+    return NULL;
+  void* ptr = malloc(nmemb * size);
+  if (ptr != NULL)
+    memset(ptr, 0, nmemb * size);
+  return ptr;
+}
+
+void* realloc(void* ptr, size_t size) {
+  if (ptr == NULL)
+    return malloc(size);
+  if (size == 0) {
+    free(ptr);
+    return NULL;
+  }
+
+  size_t old_size =
+      region_of(ptr) != NULL ? page_of(ptr)->object_size : ((struct block*)ptr - 1)->size;
+  void* new_ptr = malloc(size);
+  if (new_ptr == NULL)
+    return NULL;
+  memcpy(new_ptr, ptr, size < old_size ? size : old_size);
+  free(ptr);
+  return new_ptr;
+}
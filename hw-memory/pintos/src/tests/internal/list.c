@@ -28,6 +28,7 @@ static void shuffle(struct value[], size_t);
 static bool value_less(const struct list_elem*, const struct list_elem*, void*);
 static void verify_list_fwd(struct list*, int size);
 static void verify_list_bkwd(struct list*, int size);
+static void test_counted_list(struct value[], int size);
 
 /* Test the linked list implementation. */
 void test(void) {
@@ -89,6 +90,8 @@ void test(void) {
       ASSERT((size_t)ofs < sizeof values / sizeof *values);
       list_unique(&list, NULL, value_less, NULL);
       verify_list_fwd(&list, size);
+
+      test_counted_list(values, size);
     }
   }
 
@@ -96,6 +99,49 @@ void test(void) {
   printf("list: PASS\n");
 }
 
+/* Checks that a counted list built from the SIZE elements of
+   VALUES keeps its count as they are added, moved and removed. */
+static void test_counted_list(struct value* values, int size) {
+  struct counted_list clist, other;
+  int i;
+
+  shuffle(values, size);
+  counted_list_init(&clist);
+  counted_list_init(&other);
+  for (i = 0; i < size; i++) {
+    counted_list_insert_ordered(&clist, &values[i].elem, value_less, NULL);
+    ASSERT(counted_list_size(&clist) == (size_t)i + 1);
+  }
+  verify_list_fwd(&clist.list, size);
+  ASSERT(counted_list_size(&clist) == list_size(&clist.list));
+
+  /* Move everything over, then back: half of it an element at
+     a time, then one element and the rest by splicing. */
+  counted_list_splice(&other, list_end(&other.list), &clist, list_begin(&clist.list),
+                      list_end(&clist.list));
+  ASSERT(counted_list_empty(&clist) && counted_list_size(&other) == (size_t)size);
+  for (i = 0; i < size / 2; i++)
+    counted_list_push_back(&clist, counted_list_pop_front(&other));
+  if (!counted_list_empty(&other))
+    counted_list_splice(&clist, list_end(&clist.list), &other, list_begin(&other.list),
+                        list_next(list_begin(&other.list)));
+  ASSERT(counted_list_size(&clist) + counted_list_size(&other) == (size_t)size);
+  counted_list_splice(&clist, list_end(&clist.list), &other, list_begin(&other.list),
+                      list_end(&other.list));
+  verify_list_fwd(&clist.list, size);
+  ASSERT(counted_list_size(&clist) == (size_t)size && counted_list_empty(&other));
+
+  /* Empty it from both ends. */
+  for (i = size; i > 0; i--) {
+    ASSERT(counted_list_size(&clist) == (size_t)i);
+    if (i % 2)
+      counted_list_pop_back(&clist);
+    else
+      counted_list_remove(&clist, list_begin(&clist.list));
+  }
+  ASSERT(counted_list_empty(&clist) && list_empty(&clist.list));
+}
+
 /* Shuffles the CNT elements in ARRAY into random order. */
 static void shuffle(struct value* array, size_t cnt) {
   size_t i;
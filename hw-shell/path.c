@@ -0,0 +1,103 @@
+#include "path.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* A program found on $PATH. */
+struct location {
+  char* name;
+  char* path;
+  struct location* next; /* In the same bucket. */
+};
+
+#define BUCKETS 64
+
+static struct location* buckets[BUCKETS];
+
+/* The $PATH the locations were found under. */
+static char* searched_path;
+
+static unsigned int hash(const char* name) {
+  unsigned int h = 2166136261u;
+  for (; *name; name++) h = (h ^ (unsigned char)*name) * 16777619u;
+  return h % BUCKETS;
+}
+
+void path_forget(void) {
+  for (int i = 0; i < BUCKETS; i++) {
+    while (buckets[i]) {
+      struct location* loc = buckets[i];
+      buckets[i] = loc->next;
+      free(loc->name);
+      free(loc->path);
+      free(loc);
+    }
+  }
+  free(searched_path);
+  searched_path = NULL;
+}
+
+void path_print(void) {
+  for (int i = 0; i < BUCKETS; i++)
+    for (struct location* loc = buckets[i]; loc; loc = loc->next)
+      printf("%s %s\n", loc->name, loc->path);
+}
+
+/* Searches each directory of PATH for an executable NAME. Returns its path,
+ * allocated with malloc, or NULL. */
+static char* search(const char* path, const char* name) {
+  size_t name_len = strlen(name);
+  for (const char* dir = path;; dir++) {
+    const char* end = strchr(dir, ':');
+    size_t dir_len = end ? (size_t)(end - dir) : strlen(dir);
+
+    /* An empty directory is the current one. */
+    char* file = malloc(dir_len + name_len + 3);
+    if (dir_len == 0)
+      sprintf(file, "./%s", name);
+    else
+      sprintf(file, "%.*s/%s", (int)dir_len, dir, name);
+    if (access(file, X_OK) == 0) return file;
+    free(file);
+
+    if (!end) return NULL;
+    dir = end;
+  }
+}
+
+const char* path_lookup(const char* name) {
+  if (strchr(name, '/')) return name;
+
+  const char* path = getenv("PATH");
+  if (!path) path = "";
+  if (searched_path && strcmp(searched_path, path)) path_forget();
+
+  struct location** bucket = &buckets[hash(name)];
+  for (struct location** loc = bucket; *loc; loc = &(*loc)->next) {
+    if (strcmp((*loc)->name, name)) continue;
+    if (access((*loc)->path, X_OK) == 0 || errno != ENOENT)
+      return (*loc)->path;
+
+    /* It has been removed: look for it again. */
+    struct location* stale = *loc;
+    *loc = stale->next;
+    free(stale->name);
+    free(stale->path);
+    free(stale);
+    break;
+  }
+
+  char* file = search(path, name);
+  if (!file) return name;
+
+  struct location* loc = malloc(sizeof(struct location));
+  loc->name = strdup(name);
+  loc->path = file;
+  loc->next = *bucket;
+  *bucket = loc;
+  if (!searched_path) searched_path = strdup(path);
+  return file;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+/* Finds the program NAME would run: NAME itself if it contains a slash,
+ * otherwise the first executable NAME in a $PATH directory. The locations
+ * found are remembered, so a program is only searched for the first time it
+ * is run, until $PATH changes or it is no longer where it was found. Returns
+ * NAME if it is not found anywhere. The result is valid until the next call
+ * or path_forget(). */
+const char* path_lookup(const char* name);
+
+/* Forgets every location remembered. */
+void path_forget(void);
+
+/* Prints the locations remembered, one "name path" per line. */
+void path_print(void);
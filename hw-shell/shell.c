@@ -2,15 +2,20 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <spawn.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "path.h"
 #include "tokenizer.h"
 
 /* Convenience macro to silence compiler warnings about unused function
@@ -18,8 +23,6 @@
 #define unused __attribute__((unused))
 
 /* Global environment variables. */
-const char* INPUT_FILE = "./.input";
-const char* OUTPUT_FILE = "./.output";
 const size_t BUF_SIZE = 4096;
 
 /* Whether the shell is connected to an actual terminal or not. */
@@ -34,10 +37,287 @@ struct termios shell_tmodes;
 /* Process group id for the shell */
 pid_t shell_pgid;
 
+/* How many lines of a script may run at once, with -j, and whether they do. */
+int max_jobs = 1;
+bool parallel;
+
+/* The line of input being run. */
+const char* current_line;
+
+extern char** environ;
+
+/* A process of a job. */
+struct process {
+  pid_t pid;
+  char* name; /* The program it runs. */
+  bool completed;
+  bool stopped;
+  struct timespec start, end; /* When it was started and reaped. */
+  struct rusage usage;        /* Its resource usage, once reaped. */
+};
+
+/* A command line being run: its programs, in one process group so that the
+ * terminal can be handed to all of them at once. */
+struct job {
+  int id;        /* The number the user refers to it by, from 1. */
+  char* command; /* The line it was started from. */
+  pid_t pgid;    /* 0 until its first process is started. */
+  size_t process_num;
+  struct process* processes;
+  bool notified;         /* Whether the user was told it stopped. */
+  bool timed;            /* Whether to report its times when it is done. */
+  struct timespec start;
+  struct termios tmodes; /* The terminal modes it last ran with. */
+  struct job* next;
+};
+
+/* The jobs not yet reported done, oldest first. */
+struct job* first_job;
+
+/* Starts an empty job for COMMAND, a line of input. It is not one of the jobs
+ * listed, and has no number, until it has a process. */
+struct job* create_job(const char* command) {
+  struct job* job = calloc(1, sizeof(struct job));
+  job->command = strndup(command, strcspn(command, "\n"));
+  job->tmodes = shell_tmodes;
+  clock_gettime(CLOCK_MONOTONIC, &job->start);
+  return job;
+}
+
+/* Adds the process PID, running the program NAME, to JOB, listing the job if
+ * it is its first. */
+void add_process(struct job* job, pid_t pid, const char* name) {
+  if (job->process_num == 0) {
+    int id = 0;
+    struct job** last = &first_job;
+    for (; *last; last = &(*last)->next)
+      if ((*last)->id > id) id = (*last)->id;
+    job->id = id + 1;
+    *last = job;
+  }
+
+  if (job->pgid == 0) job->pgid = pid;
+  job->processes = realloc(job->processes,
+                           (job->process_num + 1) * sizeof(struct process));
+  struct process* process = &job->processes[job->process_num++];
+  *process = (struct process){.pid = pid, .name = strdup(name)};
+  clock_gettime(CLOCK_MONOTONIC, &process->start);
+}
+
+/* Removes JOB from the list of jobs and frees it. */
+void remove_job(struct job* job) {
+  for (struct job** j = &first_job; *j; j = &(*j)->next) {
+    if (*j == job) {
+      *j = job->next;
+      break;
+    }
+  }
+  for (size_t i = 0; i < job->process_num; i++) free(job->processes[i].name);
+  free(job->command);
+  free(job->processes);
+  free(job);
+}
+
+/* Returns the job numbered by ARG, "N" or "%N", or the newest if ARG is
+ * NULL. Returns NULL if there is no such job. */
+struct job* find_job(const char* arg) {
+  struct job* found = NULL;
+  if (arg && *arg == '%') arg++;
+  for (struct job* job = first_job; job; job = job->next)
+    if (!arg || job->id == atoi(arg)) found = job;
+  return found;
+}
+
+bool job_is_completed(struct job* job) {
+  for (size_t i = 0; i < job->process_num; i++)
+    if (!job->processes[i].completed) return false;
+  return true;
+}
+
+/* Whether every process of JOB has stopped or completed, and some stopped. */
+bool job_is_stopped(struct job* job) {
+  bool stopped = false;
+  for (size_t i = 0; i < job->process_num; i++) {
+    if (!job->processes[i].completed && !job->processes[i].stopped)
+      return false;
+    stopped |= job->processes[i].stopped;
+  }
+  return stopped;
+}
+
+/* Records STATUS and USAGE, from wait4, for the process PID. Returns false if
+ * no job has such a process. */
+bool mark_process_status(pid_t pid, int status, struct rusage* usage) {
+  for (struct job* job = first_job; job; job = job->next) {
+    for (size_t i = 0; i < job->process_num; i++) {
+      struct process* process = &job->processes[i];
+      if (process->pid != pid) continue;
+      if (WIFSTOPPED(status)) {
+        process->stopped = true;
+      } else {
+        process->completed = true;
+        process->usage = *usage;
+        clock_gettime(CLOCK_MONOTONIC, &process->end);
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Waits for a child to change, as waitpid does with OPTIONS, and records how.
+ * Returns its pid, 0 if none has changed with WNOHANG, or -1 if there is none
+ * to wait for. */
+pid_t reap_child(int options) {
+  int status;
+  struct rusage usage;
+  pid_t pid;
+  while ((pid = wait4(-1, &status, options | WUNTRACED, &usage)) == -1 &&
+         errno == EINTR)
+    continue;
+  if (pid > 0) mark_process_status(pid, status, &usage);
+  return pid;
+}
+
+double seconds(struct timeval time) {
+  return time.tv_sec + time.tv_usec / 1e6;
+}
+
+double seconds_between(struct timespec start, struct timespec end) {
+  return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+/* Prints the times of a completed JOB, for each stage of a pipeline and then
+ * for all of it: the time from its start to the end of the last stage, the
+ * CPU times summed, and the largest resident set. */
+void report_job_times(struct job* job) {
+  fprintf(stderr, "%-16s %10s %10s %10s %10s\n", "", "real", "user", "sys",
+          "maxrss");
+  struct timespec end = job->start;
+  double user = 0, sys = 0;
+  long maxrss = 0;
+  for (size_t i = 0; i < job->process_num; i++) {
+    struct process* process = &job->processes[i];
+    double stage_user = seconds(process->usage.ru_utime);
+    double stage_sys = seconds(process->usage.ru_stime);
+    if (job->process_num > 1)
+      fprintf(stderr, "%-16.16s %9.3fs %9.3fs %9.3fs %9ldk\n", process->name,
+              seconds_between(process->start, process->end), stage_user,
+              stage_sys, process->usage.ru_maxrss);
+    if (seconds_between(end, process->end) > 0) end = process->end;
+    user += stage_user;
+    sys += stage_sys;
+    if (process->usage.ru_maxrss > maxrss) maxrss = process->usage.ru_maxrss;
+  }
+  fprintf(stderr, "%-16s %9.3fs %9.3fs %9.3fs %9ldk\n", "total",
+          seconds_between(job->start, end), user, sys, maxrss);
+}
+
+/* Forgets JOB, which has completed, reporting its times if it was timed. */
+void finish_job(struct job* job) {
+  if (job->timed) report_job_times(job);
+  remove_job(job);
+}
+
+/* Waits until JOB has completed or stopped, recording what happens to the
+ * other jobs meanwhile. */
+void wait_for_job(struct job* job) {
+  while (!job_is_completed(job) && !job_is_stopped(job))
+    if (reap_child(0) == -1) break;
+}
+
+/* Sends SIGCONT to the stopped processes of JOB. */
+void continue_job(struct job* job) {
+  for (size_t i = 0; i < job->process_num; i++) {
+    struct process* process = &job->processes[i];
+    if (process->stopped) {
+      process->stopped = false;
+      kill(process->pid, SIGCONT);
+    }
+  }
+  job->notified = false;
+}
+
+/* Runs JOB in the foreground, giving it the terminal, until it completes or
+ * stops. Continues it first if CONT. */
+void foreground_job(struct job* job, bool cont) {
+  if (shell_is_interactive) {
+    tcsetpgrp(shell_terminal, job->pgid);
+    if (cont) tcsetattr(shell_terminal, TCSADRAIN, &job->tmodes);
+  }
+  if (cont) continue_job(job);
+
+  wait_for_job(job);
+
+  if (shell_is_interactive) {
+    tcsetpgrp(shell_terminal, shell_pgid);
+    tcgetattr(shell_terminal, &job->tmodes);
+    tcsetattr(shell_terminal, TCSADRAIN, &shell_tmodes);
+  }
+
+  if (job_is_completed(job)) {
+    finish_job(job);
+  } else {
+    printf("\n[%d] Stopped\t%s\n", job->id, job->command);
+    job->notified = true;
+  }
+}
+
+/* Waits until fewer than MAX jobs are running, forgetting those that
+ * complete. */
+void wait_for_jobs(int max) {
+  for (;;) {
+    int running = 0;
+    struct job* next;
+    for (struct job* job = first_job; job; job = next) {
+      next = job->next;
+      if (job_is_completed(job)) {
+        finish_job(job);
+      } else if (!job_is_stopped(job)) {
+        running++;
+      }
+    }
+    if (running < max || reap_child(0) == -1) return;
+  }
+}
+
+/* Lets JOB run in the background, continuing it first if CONT. */
+void background_job(struct job* job, bool cont) {
+  if (cont) continue_job(job);
+}
+
+/* Records the status of every child that has changed, without waiting, and
+ * tells the user of the jobs that have completed or stopped since. */
+void update_jobs(void) {
+  while (reap_child(WNOHANG) > 0)
+    continue;
+
+  struct job* next;
+  for (struct job* job = first_job; job; job = next) {
+    next = job->next;
+    if (job_is_completed(job)) {
+      if (shell_is_interactive)
+        printf("[%d] Done\t%s\n", job->id, job->command);
+      finish_job(job);
+    } else if (job_is_stopped(job) && !job->notified) {
+      printf("[%d] Stopped\t%s\n", job->id, job->command);
+      job->notified = true;
+    }
+  }
+}
+
 int cmd_exit(struct tokens* tokens);
 int cmd_help(struct tokens* tokens);
 int cmd_cd(struct tokens* tokens);
 int cmd_pwd(struct tokens* tokens);
+int cmd_hash(struct tokens* tokens);
+int cmd_jobs(struct tokens* tokens);
+int cmd_fg(struct tokens* tokens);
+int cmd_bg(struct tokens* tokens);
+int cmd_wait(struct tokens* tokens);
+int cmd_time(struct tokens* tokens);
+
+void run_job(struct tokens* tokens, size_t offset, bool timed);
 
 /* Built-in command functions take token array (see parse.h) and return int */
 typedef int cmd_fun_t(struct tokens* tokens);
@@ -49,13 +329,23 @@ typedef struct fun_desc {
   char* doc;
 } fun_desc_t;
 
+/* Sorted by command name, for lookup(). */
 fun_desc_t cmd_table[] = {
     {cmd_help, "?", "show this help menu"},
-    {cmd_exit, "exit", "exit the command shell"},
+    {cmd_bg, "bg", "Continues the job given, or the newest, in the background"},
     {cmd_cd, "cd",
      "Changes the current working directory to that specified directory"},
+    {cmd_exit, "exit", "exit the command shell"},
+    {cmd_fg, "fg", "Continues the job given, or the newest, in the foreground"},
+    {cmd_hash, "hash",
+     "Lists the programs found on PATH so far, or forgets them with -r"},
+    {cmd_jobs, "jobs", "Lists the jobs running in the background or stopped"},
     {cmd_pwd, "pwd",
-     "Prints the current working directory to standard output"}};
+     "Prints the current working directory to standard output"},
+    {cmd_time, "time",
+     "Runs a command line and reports its times, for each stage of a pipeline"},
+    {cmd_wait, "wait",
+     "Waits for the job given, or for every job running in the background"}};
 
 /* Prints a helpful description for the given command */
 int cmd_help(unused struct tokens* tokens) {
@@ -82,11 +372,92 @@ int cmd_pwd(unused struct tokens* tokens) {
   return 1;
 }
 
-/* Looks up the built-in command, if it exists. */
+/* Lists or, given -r, forgets the remembered locations of programs */
+int cmd_hash(struct tokens* tokens) {
+  char* option = tokens_get_token(tokens, 1);
+  if (option && !strcmp(option, "-r"))
+    path_forget();
+  else
+    path_print();
+  return 1;
+}
+
+/* Lists the jobs not yet reported done */
+int cmd_jobs(unused struct tokens* tokens) {
+  for (struct job* job = first_job; job; job = job->next)
+    printf("[%d] %s\t%s\n", job->id,
+           job_is_stopped(job) ? "Stopped" : "Running", job->command);
+  return 1;
+}
+
+/* Continues a job in the foreground */
+int cmd_fg(struct tokens* tokens) {
+  struct job* job = find_job(tokens_get_token(tokens, 1));
+  if (!job) {
+    fprintf(stderr, "fg: no such job\n");
+    return 1;
+  }
+  printf("%s\n", job->command);
+  fflush(stdout);
+  foreground_job(job, true);
+  return 1;
+}
+
+/* Continues a stopped job in the background */
+int cmd_bg(struct tokens* tokens) {
+  struct job* job = find_job(tokens_get_token(tokens, 1));
+  if (!job) {
+    fprintf(stderr, "bg: no such job\n");
+    return 1;
+  }
+  printf("[%d] %s &\n", job->id, job->command);
+  background_job(job, true);
+  return 1;
+}
+
+/* Waits for a job, or for all that are running, to complete */
+int cmd_wait(struct tokens* tokens) {
+  char* arg = tokens_get_token(tokens, 1);
+  if (arg) {
+    struct job* job = find_job(arg);
+    if (!job) {
+      fprintf(stderr, "wait: no such job\n");
+      return 1;
+    }
+    wait_for_job(job);
+    if (job_is_completed(job)) finish_job(job);
+    return 1;
+  }
+
+  struct job* next;
+  for (struct job* job = first_job; job; job = next) {
+    next = job->next;
+    if (job_is_stopped(job)) continue;
+    wait_for_job(job);
+    if (job_is_completed(job)) finish_job(job);
+  }
+  return 1;
+}
+
+int compare_cmd(const void* cmd, const void* desc) {
+  return strcmp(cmd, ((const fun_desc_t*)desc)->cmd);
+}
+
+/* Runs the rest of the line, and reports the real, user and sys times and the
+ * maximum resident set size of each stage and of all of it */
+int cmd_time(struct tokens* tokens) {
+  if (tokens_get_length(tokens) > 1) run_job(tokens, 1, true);
+  return 1;
+}
+
+/* Looks up the built-in command, if it exists, by binary search, so that the
+ * cost of a line that is not one does not grow with every builtin added. */
 int lookup(char cmd[]) {
-  for (unsigned int i = 0; i < sizeof(cmd_table) / sizeof(fun_desc_t); i++)
-    if (cmd && (strcmp(cmd_table[i].cmd, cmd) == 0)) return i;
-  return -1;
+  if (!cmd) return -1;
+  fun_desc_t* desc =
+      bsearch(cmd, cmd_table, sizeof(cmd_table) / sizeof(fun_desc_t),
+              sizeof(fun_desc_t), compare_cmd);
+  return desc ? desc - cmd_table : -1;
 }
 
 /* Intialization procedures for this shell */
@@ -104,8 +475,18 @@ void init_shell() {
     while (tcgetpgrp(shell_terminal) != (shell_pgid = getpgrp()))
       kill(-shell_pgid, SIGTTIN);
 
-    /* Saves the shell's process id */
+    /* The shell ignores the signals the terminal sends for job control, which
+     * are meant for the job in the foreground. */
+    signal(SIGINT, SIG_IGN);
+    signal(SIGQUIT, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTTOU, SIG_IGN);
+
+    /* Saves the shell's process id, and puts it in a process group of its
+     * own. */
     shell_pgid = getpid();
+    setpgid(shell_pgid, shell_pgid);
 
     /* Take control of the terminal */
     tcsetpgrp(shell_terminal, shell_pgid);
@@ -115,51 +496,390 @@ void init_shell() {
   }
 }
 
+/* A redirection of a program's file descriptor FD, applied after its stdin
+ * and stdout are connected to the rest of the pipeline. */
+struct redirection {
+  int fd;
+  int source;  /* The descriptor FD is made a copy of. */
+  bool opened; /* Whether SOURCE was opened for it, to be closed after. */
+};
+
+/*
+ * Sets up a child the shell has forked as a process of JOB: puts it in the
+ * job's process group, with the default handlers for the signals the shell
+ * ignores, if there is job control, and redirects its stdin to INDES, its
+ * stdout to OUTDES and then makes its REDIRECTION_NUM REDIRECTIONS.
+ */
+void enter_child(int indes, int outdes, struct redirection* redirections,
+                 size_t redirection_num, struct job* job) {
+  if (shell_is_interactive) {
+    setpgid(0, job->pgid);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGTTIN, SIG_DFL);
+    signal(SIGTTOU, SIG_DFL);
+  }
+
+  // Redirect stdin and stdout.
+  dup2(indes, STDIN_FILENO);
+  dup2(outdes, STDOUT_FILENO);
+  for (size_t i = 0; i < redirection_num; i++)
+    dup2(redirections[i].source, redirections[i].fd);
+}
+
 /*
- * Execute program by [offset~offset+argc) tokens arguments in struct tokens.
- * The program will be execute in child process. The stdin will be redirect to *
- * ind and stdout will be redirect to outd.
+ * Runs the builtin FUNDEX with the ARGC arguments ARGV in the shell itself,
+ * with the REDIRECTION_NUM REDIRECTIONS made for as long as it runs, so that
+ * the common "pwd > file" costs no process at all.
  */
-void execute_program(struct tokens* tokens, size_t offset, size_t argc,
-                     int indes, int outdes) {
+void run_builtin(int fundex, char* argv[], int argc,
+                 struct redirection* redirections, size_t redirection_num) {
+  /* The shell's own descriptors, put back after; close-on-exec meanwhile, so
+   * that what the builtin starts does not get them. -1 if one was closed. */
+  int saved[redirection_num];
+  fflush(stdout);
+  for (size_t i = 0; i < redirection_num; i++) {
+    saved[i] = fcntl(redirections[i].fd, F_DUPFD_CLOEXEC, 10);
+    dup2(redirections[i].source, redirections[i].fd);
+  }
+
+  struct tokens* tokens = tokens_of_words(argv, argc);
+  cmd_table[fundex].fun(tokens);
+  tokens_destroy(tokens);
+
+  fflush(stdout);
+  for (size_t i = redirection_num; i-- > 0;) {
+    if (saved[i] != -1) {
+      dup2(saved[i], redirections[i].fd);
+      close(saved[i]);
+    } else {
+      close(redirections[i].fd);
+    }
+  }
+}
+
+/*
+ * Runs the builtin FUNDEX with the arguments ARGV in a child of the shell, as
+ * execute_program() does a program: for a builtin in a pipeline, which has to
+ * run at the same time as the other stages. Returns the child's pid, or -1.
+ */
+pid_t fork_builtin(int fundex, char* argv[], int argc, int indes, int outdes,
+                   struct redirection* redirections, size_t redirection_num,
+                   struct job* job) {
+  fflush(stdout);
   pid_t cpid = fork();
   if (cpid == 0) {
-    // Redirect stdin and stdout.
-    dup2(indes, STDIN_FILENO);
-    dup2(outdes, STDOUT_FILENO);
-    /* Create arguments pointers array. */
-    char* relative_path = tokens_get_token(tokens, offset);
-    char* argv[argc + 1];
-    for (size_t i = 0; i < argc; i++)
-      argv[i] = tokens_get_token(tokens, offset + i);
+    enter_child(indes, outdes, redirections, redirection_num, job);
+    /* The child is no longer the shell that controls the terminal or the
+     * jobs, even for the programs a builtin like time starts. */
+    shell_is_interactive = false;
+    parallel = false;
+    first_job = NULL;
+
+    struct tokens* tokens = tokens_of_words(argv, argc);
+    cmd_table[fundex].fun(tokens);
+    fflush(stdout);
+    exit(0);
+  }
+  if (cpid == -1) {
+    perror("fork");
+    return -1;
+  }
+  if (shell_is_interactive) setpgid(cpid, job->pgid ? job->pgid : cpid);
+  add_process(job, cpid, argv[0]);
+  return cpid;
+}
 
-    argv[argc] = NULL;
+/*
+ * Execute program by the arguments ARGV, a null-terminated array. The program
+ * will be execute in child process, as a process of JOB. The stdin will be
+ * redirect to indes and stdout will be redirect to outdes, and then the
+ * REDIRECTION_NUM REDIRECTIONS made in order. Returns the pid of the child, or
+ * -1 if it could not be started.
+ */
+pid_t execute_program(char* argv[], int indes, int outdes,
+                      struct redirection* redirections, size_t redirection_num,
+                      struct job* job) {
+  /* Found before starting the child, so that the search is remembered for the
+   * next time and the child only has to exec once. */
+  const char* path = path_lookup(argv[0]);
+
+  /* Or the child would write out what builtins left buffered again. */
+  fflush(stdout);
+
+#ifdef _POSIX_SPAWN
+  /* posix_spawn does not copy the shell's page tables as fork does, which is
+   * most of the cost of starting a short command. */
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  // Redirect stdin and stdout.
+  if (indes != STDIN_FILENO)
+    posix_spawn_file_actions_adddup2(&actions, indes, STDIN_FILENO);
+  if (outdes != STDOUT_FILENO)
+    posix_spawn_file_actions_adddup2(&actions, outdes, STDOUT_FILENO);
+  for (size_t i = 0; i < redirection_num; i++)
+    posix_spawn_file_actions_adddup2(&actions, redirections[i].source,
+                                     redirections[i].fd);
+
+  /* With job control, the job gets a process group of its own, led by its
+   * first process, and the signals the shell ignores back. */
+  posix_spawnattr_t attr;
+  posix_spawnattr_init(&attr);
+  if (shell_is_interactive) {
+    sigset_t defaults;
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGINT);
+    sigaddset(&defaults, SIGQUIT);
+    sigaddset(&defaults, SIGTSTP);
+    sigaddset(&defaults, SIGTTIN);
+    sigaddset(&defaults, SIGTTOU);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setpgroup(&attr, job->pgid);
+    posix_spawnattr_setflags(&attr,
+                             POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF);
+  }
+
+  pid_t cpid;
+  int error = posix_spawn(&cpid, path, &actions, &attr, argv, environ);
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+  if (error != 0) {
+    if (error == ENOENT)
+      fprintf(stderr, "%s: command not found\n", argv[0]);
+    else
+      fprintf(stderr, "%s: %s\n", argv[0], strerror(error));
+    return -1;
+  }
+#else
+  pid_t cpid = fork();
+  if (cpid == 0) {
+    enter_child(indes, outdes, redirections, redirection_num, job);
 
     // Execute program.
-    execv(relative_path, argv);
-
-    // Need environment variables to get absolute path
-    // to run program.
-    char* pathstr = getenv("PATH");
-    char absolute_path[128];
-    for (char* prefix_path = strtok(pathstr, ":"); prefix_path;
-         prefix_path = strtok(NULL, ":")) {
-      strcpy(absolute_path, prefix_path);
-      strcat(absolute_path, "/");
-      strcat(absolute_path, relative_path);
-      execv(absolute_path, argv);
-    }
+    execv(path, argv);
 
     // Command not found.
-    printf("%s: command not found\n", relative_path);
+    fprintf(stderr, "%s: command not found\n", argv[0]);
     exit(0);
+  }
+  if (cpid == -1) {
+    perror("fork");
+    return -1;
+  }
+  /* Also set here, in case the shell gets to the group before the child. */
+  if (shell_is_interactive) setpgid(cpid, job->pgid ? job->pgid : cpid);
+#endif
+
+  add_process(job, cpid, argv[0]);
+  return cpid;
+}
+
+/*
+ * Parses TOKEN as a redirection operator: "<", ">" or ">>", optionally after
+ * the descriptor it redirects, which is otherwise stdin for "<" and stdout for
+ * the others; ">" and "<" can be followed by "&N" to make it a copy of
+ * descriptor N, as in "2>&1". Returns false if TOKEN is not one.
+ */
+bool parse_redirection(const char* token, int* fd, int* flags, int* source) {
+  const char* c = token;
+  *fd = -1;
+  if (isdigit(*c)) *fd = strtol(c, (char**)&c, 10);
+
+  if (*c == '<') {
+    *flags = O_RDONLY;
+    if (*fd == -1) *fd = STDIN_FILENO;
+    c++;
+  } else if (*c == '>') {
+    *flags = O_WRONLY | O_CREAT | O_TRUNC;
+    if (*fd == -1) *fd = STDOUT_FILENO;
+    if (*++c == '>') {
+      *flags = O_WRONLY | O_CREAT | O_APPEND;
+      c++;
+    }
   } else {
-    wait(NULL);
+    return false;
   }
+
+  *source = -1;
+  if (*c == '&' && isdigit(c[1]) && !(*flags & O_APPEND))
+    *source = strtol(c + 1, (char**)&c, 10);
+  return *c == '\0';
 }
 
-int main(unused int argc, unused char* argv[]) {
+/* Closes the files opened for the first REDIRECTION_NUM REDIRECTIONS. */
+void close_redirections(struct redirection* redirections,
+                        size_t redirection_num) {
+  for (size_t i = 0; i < redirection_num; i++)
+    if (redirections[i].opened) close(redirections[i].source);
+}
+
+/*
+ * Splits the tokens from the START-th to before the END-th into the arguments
+ * of a program, in ARGV, and its redirections, in REDIRECTIONS, opening the
+ * files they name. Returns the number of arguments and stores that of the
+ * redirections in *REDIRECTION_NUM, or returns -1 after printing why if a file
+ * could not be opened or is missing.
+ */
+int parse_stage(struct tokens* tokens, size_t start, size_t end, char* argv[],
+                struct redirection* redirections, size_t* redirection_num) {
+  int argc = 0;
+  *redirection_num = 0;
+  for (size_t i = start; i < end; i++) {
+    char* token = tokens_get_token(tokens, i);
+    int fd, flags, source;
+    if (!parse_redirection(token, &fd, &flags, &source)) {
+      argv[argc++] = token;
+      continue;
+    }
+
+    struct redirection* redirection = &redirections[(*redirection_num)++];
+    redirection->fd = fd;
+    redirection->source = source;
+    redirection->opened = false;
+    if (source != -1) continue;
+
+    /* The file is opened by the shell, to report why if it cannot be, and
+     * close-on-exec so that only the copy the program gets stays open. */
+    char* filename = i + 1 < end ? tokens_get_token(tokens, ++i) : NULL;
+    if (!filename) {
+      fprintf(stderr, "syntax error: %s needs a file\n", token);
+    } else {
+      redirection->source = open(filename, flags | O_CLOEXEC, 0666);
+      if (redirection->source == -1) perror(filename);
+    }
+    if (redirection->source == -1) {
+      (*redirection_num)--;
+      close_redirections(redirections, *redirection_num);
+      return -1;
+    }
+    redirection->opened = true;
+  }
+  argv[argc] = NULL;
+  return argc;
+}
+
+/*
+ * Starts the stages of a pipeline, the tokens from the OFFSET-th to before the
+ * TOKENS_LEN-th separated by "|" tokens, all at once as the processes of JOB:
+ * each stage's stdout is connected to the next one's stdin by a pipe, so the
+ * data streams between them and no stage waits for the one before it to
+ * finish. A stage's own redirections apply after the pipes, so that "2>&1"
+ * sends its stderr down the pipe too. A builtin runs in the shell itself when
+ * it is the only stage, and in a child of the shell otherwise.
+ */
+void execute_pipeline(struct tokens* tokens, size_t offset, size_t tokens_len,
+                      struct job* job) {
+  size_t process_num = 1;
+  for (size_t i = offset; i < tokens_len; i++)
+    if (!strcmp(tokens_get_token(tokens, i), "|")) process_num++;
+
+  int input_filedes = STDIN_FILENO;
+  size_t slow = offset, fast = offset;
+  for (size_t i = 0; i < process_num; i++) {
+    while (fast < tokens_len && strcmp(tokens_get_token(tokens, fast), "|"))
+      fast++;
+
+    /* The pipe to the next stage. Its ends are close-on-exec so that no
+     * stage holds on to a pipe it does not use, which would keep the stage
+     * reading from it from ever seeing end-of-file; dup2 clears the flag on
+     * the copies that become a stage's stdin and stdout. */
+    int pipe_filedes[2] = {-1, STDOUT_FILENO};
+    if (i + 1 < process_num) {
+      if (pipe(pipe_filedes) == -1) {
+        perror("pipe");
+        break;
+      }
+      fcntl(pipe_filedes[0], F_SETFD, FD_CLOEXEC);
+      fcntl(pipe_filedes[1], F_SETFD, FD_CLOEXEC);
+    }
+
+    char* argv[fast - slow + 1];
+    struct redirection redirections[fast - slow + 1];
+    size_t redirection_num;
+    int argc = parse_stage(tokens, slow, fast, argv, redirections,
+                           &redirection_num);
+    int fundex = argc > 0 ? lookup(argv[0]) : -1;
+    if (fundex >= 0 && process_num == 1)
+      run_builtin(fundex, argv, argc, redirections, redirection_num);
+    else if (fundex >= 0)
+      fork_builtin(fundex, argv, argc, input_filedes, pipe_filedes[1],
+                   redirections, redirection_num, job);
+    else if (argc > 0)
+      execute_program(argv, input_filedes, pipe_filedes[1], redirections,
+                      redirection_num, job);
+    if (argc >= 0) close_redirections(redirections, redirection_num);
+
+    // The shell keeps only the read end, as the input of next program.
+    if (input_filedes != STDIN_FILENO) close(input_filedes);
+    if (pipe_filedes[1] != STDOUT_FILENO) close(pipe_filedes[1]);
+    input_filedes = pipe_filedes[0];
+
+    slow = ++fast;
+  }
+  if (input_filedes != STDIN_FILENO && input_filedes != -1)
+    close(input_filedes);
+}
+
+/*
+ * Runs the command line of TOKENS from the OFFSET-th on, a pipeline of one or
+ * more programs or builtins with their redirections, as a job that runs in the
+ * foreground or, if the line ends in "&" or lines run in parallel, the
+ * background. If TIMED, reports its times once it is done.
+ */
+void run_job(struct tokens* tokens, size_t offset, bool timed) {
+  /* "time" times all of the pipeline after it, so it is read here rather
+   * than run as the builtin of the first stage. */
+  if (!strcmp(tokens_get_token(tokens, offset), "time") &&
+      tokens_get_length(tokens) > offset + 1) {
+    offset++;
+    timed = true;
+  }
+
+  // Get total command arguments count(s), without a final "&".
+  size_t command_argc = tokens_get_length(tokens);
+  bool background = !strcmp(tokens_get_token(tokens, command_argc - 1), "&");
+  if (background) command_argc--;
+  if (parallel) wait_for_jobs(max_jobs);
+  struct job* job = create_job(current_line);
+  job->timed = timed;
+  execute_pipeline(tokens, offset, command_argc, job);
+
+  if (job->process_num == 0)
+    remove_job(job);
+  else if (background) {
+    printf("[%d] %d\n", job->id, job->pgid);
+    fflush(stdout);
+    background_job(job, false);
+  } else if (parallel)
+    background_job(job, false);
+  else
+    foreground_job(job, false);
+}
+
+int main(int argc, char* argv[]) {
+  /* shell [-j N] [script]: with -j, up to N lines of a script run at once, as
+   * if each ended in "&"; a builtin line still runs in turn, and "wait" waits
+   * for the lines before it. */
+  int opt;
+  while ((opt = getopt(argc, argv, "j:")) != -1) {
+    if (opt == 'j' && (max_jobs = atoi(optarg)) > 0) continue;
+    fprintf(stderr, "usage: %s [-j jobs] [script]\n", argv[0]);
+    return 1;
+  }
+  if (optind < argc) {
+    int script = open(argv[optind], O_RDONLY);
+    if (script == -1) {
+      perror(argv[optind]);
+      return 1;
+    }
+    dup2(script, STDIN_FILENO);
+    close(script);
+  }
+
   init_shell();
+  /* Lines are only run in parallel from a script, not as they are typed. */
+  parallel = max_jobs > 1 && !shell_is_interactive;
 
   static char line[4096];
   int line_num = 0;
@@ -170,83 +890,13 @@ int main(unused int argc, unused char* argv[]) {
   while (fgets(line, BUF_SIZE, stdin)) {
     /* Split our line into words. */
     struct tokens* tokens = tokenize(line);
+    current_line = line;
 
-    /* Find which built-in function to run. */
-    int fundex = lookup(tokens_get_token(tokens, 0));
-
-    if (fundex >= 0)
-      cmd_table[fundex].fun(tokens);
-    else {
-      /* Need to run specified program in command-line. */
-      // Get total command arguments count(s).
-      size_t command_argc = tokens_get_length(tokens);
-      int filedes;
-
-      if (is_contains_word(tokens, "|")) {
-        // Pipes.
-        // Get the number of process to be run.
-        int input_filedes = open(INPUT_FILE, O_CREAT | O_RDWR, S_IRWXU);
-        int output_filedes = open(OUTPUT_FILE, O_CREAT | O_RDWR, S_IRWXU);
-        char buf[BUF_SIZE];
-
-        // Clear file.
-        ftruncate(input_filedes, 0);
-        ftruncate(output_filedes, 0);
-
-        size_t process_num = 1;
-        size_t tokens_len = tokens_get_length(tokens);
-        for (size_t i = 0; i < tokens_len; i++)
-          if (!strcmp(tokens_get_token(tokens, i), "|")) process_num++;
-
-        size_t slow = 0, fast = 0;
-        for (size_t i = 0; i < process_num; i++) {
-          // Execute next program.
-          while (fast < tokens_len &&
-                 strcmp(tokens_get_token(tokens, fast), "|"))
-            fast++;
-
-          lseek(input_filedes, 0, SEEK_SET);
-          execute_program(tokens, slow, fast - slow, input_filedes,
-                          output_filedes);
-
-          // Move cotent of output file to input file as the input of
-          // next program.
-          ftruncate(input_filedes, 0);
-          lseek(output_filedes, 0, SEEK_SET);
-          ssize_t len;
-          while ((len = read(output_filedes, buf, BUF_SIZE)) > 0)
-            write(input_filedes, buf, len);
-          ftruncate(output_filedes, 0);
-
-          slow = ++fast;
-        }
-
-        // Print result to console.
-        lseek(input_filedes, 0, SEEK_SET);
-        ssize_t len;
-        while ((len = read(input_filedes, buf, BUF_SIZE)) > 0)
-          write(STDIN_FILENO, buf, len);
-
-        // Close.
-        close(input_filedes), close(output_filedes);
-      } else if (is_contains_word(tokens, ">")) {
-        // Redirection >.
-        char* filename = tokens_get_token(tokens, command_argc - 1);
-        filedes = open(filename, O_CREAT | O_WRONLY);
-        execute_program(tokens, 0, command_argc - 2, STDIN_FILENO, filedes);
-        close(filedes);
-      } else if (is_contains_word(tokens, "<")) {
-        // Redirection <.
-        char* filename = tokens_get_token(tokens, command_argc - 1);
-        filedes = open(filename, O_RDONLY);
-        dup2(filedes, STDIN_FILENO);
-        execute_program(tokens, 0, command_argc - 2, filedes, STDOUT_FILENO);
-        close(filedes);
-      } else {
-        // Run program.
-        execute_program(tokens, 0, command_argc, STDIN_FILENO, STDOUT_FILENO);
-      }
-    }
+    /* Run the programs and built-in functions of the line. */
+    if (tokens_get_length(tokens) > 0) run_job(tokens, 0, false);
+
+    /* Report the background jobs that have finished. */
+    update_jobs();
 
     if (shell_is_interactive)
       /* Please only print shell prompts when standard input is not a tty */
@@ -256,5 +906,6 @@ int main(unused int argc, unused char* argv[]) {
     tokens_destroy(tokens);
   }
 
+  if (parallel) wait_for_jobs(1);
   return 0;
 }
\ No newline at end of file
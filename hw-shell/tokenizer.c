@@ -7,90 +7,92 @@
 struct tokens {
   size_t tokens_length;
   char** tokens;
-  size_t buffers_length;
-  char** buffers;
 };
 
-static void* vector_push(char*** pointer, size_t* size, void* elem) {
-  *pointer = (char**)realloc(*pointer, sizeof(char*) * (*size + 1));
-  (*pointer)[*size] = elem;
-  *size += 1;
-  return elem;
-}
-
-static void* copy_word(char* source, size_t n) {
-  source[n] = '\0';
-  char* word = (char*)malloc(n + 1);
-  strncpy(word, source, n + 1);
-  return word;
-}
-
-struct tokens* tokenize(const char* line) {
-  if (line == NULL) return NULL;
-
-  static char token[4096];
-  size_t n = 0, n_max = 4096;
-  struct tokens* tokens;
-  size_t line_length = strlen(line);
-
-  tokens = (struct tokens*)malloc(sizeof(struct tokens));
+/* Allocates the tokens of a line of LINE_LENGTH bytes, with room for
+ * EXTRA_BYTES more after them, in one block. A line has at most one word
+ * for every two of its bytes, with the space after it, rounded up. */
+static struct tokens* allocate_tokens(size_t line_length, size_t extra_bytes) {
+  size_t max_tokens = (line_length + 1) / 2;
+  struct tokens* tokens = (struct tokens*)malloc(
+      sizeof(struct tokens) + max_tokens * sizeof(char*) + extra_bytes);
+  if (tokens == NULL) return NULL;
   tokens->tokens_length = 0;
-  tokens->tokens = NULL;
-  tokens->buffers_length = 0;
-  tokens->buffers = NULL;
+  tokens->tokens = (char**)(tokens + 1);
+  return tokens;
+}
 
+/* Splits LINE into TOKENS. Each word is written back over the line, without
+ * its quotes and backslashes, so it never gets ahead of what is being read,
+ * and terminated by a null byte where the space after it was. */
+static void split_words(char* line, struct tokens* tokens) {
   const int MODE_NORMAL = 0, MODE_SQUOTE = 1, MODE_DQUOTE = 2;
   int mode = MODE_NORMAL;
+  char* word = line; /* Where the word being read is written. */
+  size_t n = 0;      /* Its length so far. */
 
-  for (unsigned int i = 0; i < line_length; i++) {
-    char c = line[i];
+  for (char* c = line; *c; c++) {
     if (mode == MODE_NORMAL) {
-      if (c == '\'') {
+      if (*c == '\'') {
         mode = MODE_SQUOTE;
-      } else if (c == '"') {
+      } else if (*c == '"') {
         mode = MODE_DQUOTE;
-      } else if (c == '\\') {
-        if (i + 1 < line_length) {
-          token[n++] = line[++i];
-        }
-      } else if (isspace(c)) {
+      } else if (*c == '\\') {
+        if (c[1] != '\0') word[n++] = *++c;
+      } else if (isspace(*c)) {
         if (n > 0) {
-          void* word = copy_word(token, n);
-          vector_push(&tokens->tokens, &tokens->tokens_length, word);
+          word[n] = '\0';
+          tokens->tokens[tokens->tokens_length++] = word;
+          word += n + 1;
           n = 0;
         }
       } else {
-        token[n++] = c;
-      }
-    } else if (mode == MODE_SQUOTE) {
-      if (c == '\'') {
-        mode = MODE_NORMAL;
-      } else if (c == '\\') {
-        if (i + 1 < line_length) {
-          token[n++] = line[++i];
-        }
-      } else {
-        token[n++] = c;
-      }
-    } else if (mode == MODE_DQUOTE) {
-      if (c == '"') {
-        mode = MODE_NORMAL;
-      } else if (c == '\\') {
-        if (i + 1 < line_length) {
-          token[n++] = line[++i];
-        }
-      } else {
-        token[n++] = c;
+        word[n++] = *c;
       }
+    } else if ((mode == MODE_SQUOTE && *c == '\'') ||
+               (mode == MODE_DQUOTE && *c == '"')) {
+      mode = MODE_NORMAL;
+    } else if (*c == '\\') {
+      if (c[1] != '\0') word[n++] = *++c;
+    } else {
+      word[n++] = *c;
     }
-    if (n + 1 >= n_max) abort();
   }
 
   if (n > 0) {
-    void* word = copy_word(token, n);
-    vector_push(&tokens->tokens, &tokens->tokens_length, word);
-    n = 0;
+    word[n] = '\0';
+    tokens->tokens[tokens->tokens_length++] = word;
   }
+}
+
+struct tokens* tokenize(const char* line) {
+  if (line == NULL) return NULL;
+
+  /* The words are split from a copy of the line, kept after the tokens. */
+  size_t line_length = strlen(line);
+  struct tokens* tokens = allocate_tokens(line_length, line_length + 1);
+  if (tokens == NULL) return NULL;
+  size_t max_tokens = (line_length + 1) / 2;
+  char* copy = (char*)(tokens->tokens + max_tokens);
+  memcpy(copy, line, line_length + 1);
+  split_words(copy, tokens);
+  return tokens;
+}
+
+struct tokens* tokenize_in_place(char* line) {
+  if (line == NULL) return NULL;
+
+  struct tokens* tokens = allocate_tokens(strlen(line), 0);
+  if (tokens == NULL) return NULL;
+  split_words(line, tokens);
+  return tokens;
+}
+
+struct tokens* tokens_of_words(char* words[], size_t n) {
+  struct tokens* tokens = allocate_tokens(2 * n, 0);
+  if (tokens == NULL) return NULL;
+  memcpy(tokens->tokens, words, n * sizeof(char*));
+  tokens->tokens_length = n;
   return tokens;
 }
 
@@ -108,17 +110,7 @@ char* tokens_get_token(struct tokens* tokens, size_t n) {
     return tokens->tokens[n];
 }
 
-void tokens_destroy(struct tokens* tokens) {
-  if (tokens == NULL) return;
-
-  for (int i = 0; i < tokens->tokens_length; i++) free(tokens->tokens[i]);
-
-  for (int i = 0; i < tokens->buffers_length; i++) free(tokens->buffers[i]);
-
-  if (tokens->tokens) free(tokens->tokens);
-
-  free(tokens);
-}
+void tokens_destroy(struct tokens* tokens) { free(tokens); }
 
 int is_contains_word(struct tokens* tokens, const char* word) {
   size_t length = tokens_get_length(tokens);
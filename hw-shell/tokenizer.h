@@ -7,6 +7,13 @@ struct tokens;
 /* Turn a string into a list of words. */
 struct tokens* tokenize(const char* line);
 
+/* Like tokenize, but the words are kept in LINE itself, which is overwritten
+ * and must outlive the tokens. */
+struct tokens* tokenize_in_place(char* line);
+
+/* Make a list of the N words WORDS, which must outlive it. */
+struct tokens* tokens_of_words(char* words[], size_t n);
+
 /* How many words are there? */
 size_t tokens_get_length(struct tokens* tokens);
 
@@ -2,8 +2,13 @@
 #include <list.h>
 #include <string.h>
 #include <stdio.h>
+#include <syscall-types.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
+#include "devices/trace.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* A block device. */
 struct block {
@@ -16,8 +21,22 @@ struct block {
   const struct block_operations* ops; /* Driver operations. */
   void* aux;                          /* Extra data owned by driver. */
 
-  unsigned long long read_cnt;  /* Number of sectors read. */
-  unsigned long long write_cnt; /* Number of sectors written. */
+  /* Statistics.  Requests may complete in interrupt handlers, so
+     these are guarded by disabling interrupts. */
+  unsigned long long read_cnt;       /* Number of sectors read. */
+  unsigned long long write_cnt;      /* Number of sectors written. */
+  unsigned long long request_cnt;    /* Number of requests. */
+  unsigned long long sequential_cnt; /* Requests that began at NEXT_SECTOR. */
+  block_sector_t next_sector;        /* Where the last request ended. */
+
+  /* For requests submitted to this device itself, rather than
+     passed on to it by a device layered over it. */
+  int depth;                       /* Requests outstanding. */
+  int max_depth;                   /* Most requests outstanding at once. */
+  unsigned long long depth_sum;    /* Sum of DEPTH as each request began. */
+  unsigned long long service_us;   /* Microseconds from submission to completion. */
+  unsigned long long latency[BLOCK_LATENCY_BUCKETS]; /* Requests, by log2 of
+                                                         microseconds taken. */
 };
 
 /* List of all block devices. */
@@ -90,14 +109,67 @@ static void check_sector(struct block* block, block_sector_t sector) {
   }
 }
 
+/* Verifies that the CNT sectors starting at SECTOR are all
+   within BLOCK.  Panics if not. */
+static void check_sectors(struct block* block, block_sector_t sector, size_t cnt) {
+  check_sector(block, sector);
+  if (cnt > block->size - sector)
+    PANIC("Access past end of device %s (sector=%" PRDSNu ", cnt=%zu, "
+          "size=%" PRDSNu ")\n",
+          block_name(block), sector, cnt, block->size);
+}
+
+/* Has BLOCK's driver read or write the CNT sectors starting at
+   SECTOR, for a driver without a request queue. */
+static void transfer(struct block* block, block_sector_t sector, size_t cnt, void* buffer,
+                     bool write) {
+  const struct block_operations* ops = block->ops;
+  size_t i;
+
+  if (write && ops->write_multiple != NULL)
+    ops->write_multiple(block->aux, sector, cnt, buffer);
+  else if (!write && ops->read_multiple != NULL)
+    ops->read_multiple(block->aux, sector, cnt, buffer);
+  else
+    for (i = 0; i < cnt; i++) {
+      uint8_t* sector_buffer = (uint8_t*)buffer + i * BLOCK_SECTOR_SIZE;
+      if (write)
+        ops->write(block->aux, sector + i, sector_buffer);
+      else
+        ops->read(block->aux, sector + i, sector_buffer);
+    }
+}
+
+/* Returns the time, in microseconds. */
+static int64_t now_us(void) { return timer_ns() / 1000; }
+
+/* Wakes up the thread waiting in transfer_and_wait(). */
+static void wake_up(struct block_request* r) { sema_up(r->aux); }
+
+/* Submits a request to read or write the CNT sectors starting at
+   SECTOR of BLOCK, and waits for it to be carried out. */
+static void transfer_and_wait(struct block* block, block_sector_t sector, size_t cnt,
+                              void* buffer, bool write) {
+  struct semaphore done;
+  struct block_request r;
+
+  sema_init(&done, 0);
+  r.sector = sector;
+  r.cnt = cnt;
+  r.buffer = buffer;
+  r.write = write;
+  r.done = wake_up;
+  r.aux = &done;
+  block_submit(block, &r);
+  sema_down(&done);
+}
+
 /* Reads sector SECTOR from BLOCK into BUFFER, which must
    have room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to block devices, so external
    per-block device locking is unneeded. */
 void block_read(struct block* block, block_sector_t sector, void* buffer) {
-  check_sector(block, sector);
-  block->ops->read(block->aux, sector, buffer);
-  block->read_cnt++;
+  transfer_and_wait(block, sector, 1, buffer, false);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -106,10 +178,109 @@ void block_read(struct block* block, block_sector_t sector, void* buffer) {
    Internally synchronizes accesses to block devices, so external
    per-block device locking is unneeded. */
 void block_write(struct block* block, block_sector_t sector, const void* buffer) {
-  check_sector(block, sector);
-  ASSERT(block->type != BLOCK_FOREIGN);
-  block->ops->write(block->aux, sector, buffer);
-  block->write_cnt++;
+  /* The buffer is only read, though requests have room to write
+     into it. */
+  transfer_and_wait(block, sector, 1, (void*)buffer, true);
+}
+
+/* Reads the CNT sectors starting at SECTOR from BLOCK into
+   BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  If the driver can, they are read with one request.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void block_read_multiple(struct block* block, block_sector_t sector, size_t cnt, void* buffer) {
+  if (cnt > 0)
+    transfer_and_wait(block, sector, cnt, buffer, false);
+}
+
+/* Writes the CNT sectors starting at SECTOR to BLOCK from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.  If
+   the driver can, they are written with one request.  Returns
+   after the block device has acknowledged receiving all of them.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void block_write_multiple(struct block* block, block_sector_t sector, size_t cnt,
+                          const void* buffer) {
+  if (cnt > 0)
+    transfer_and_wait(block, sector, cnt, (void*)buffer, true);
+}
+
+/* Submits request R to BLOCK, and returns without waiting for it
+   to be carried out, if BLOCK's driver has a request queue.
+   R->done is called once it has been.  Until then R, and its
+   buffer, belong to BLOCK. */
+void block_submit(struct block* block, struct block_request* r) {
+  enum intr_level old_level;
+
+  TRACE(r->write ? TRACE_BLOCK_WRITE : TRACE_BLOCK_READ, r->sector, r->cnt);
+  r->owner = block;
+  r->start = now_us();
+  old_level = intr_disable();
+  block->depth++;
+  if (block->depth > block->max_depth)
+    block->max_depth = block->depth;
+  block->depth_sum += block->depth;
+  intr_set_level(old_level);
+
+  block_pass(block, r);
+}
+
+/* Passes request R on to BLOCK's driver.  R is either being
+   submitted to BLOCK or was submitted to a device layered over
+   BLOCK, such as a partition of it. */
+void block_pass(struct block* block, struct block_request* r) {
+  enum intr_level old_level;
+
+  ASSERT(r->cnt > 0);
+  check_sectors(block, r->sector, r->cnt);
+  ASSERT(!r->write || block->type != BLOCK_FOREIGN);
+
+  old_level = intr_disable();
+  if (r->write)
+    block->write_cnt += r->cnt;
+  else
+    block->read_cnt += r->cnt;
+  block->request_cnt++;
+  if (r->sector == block->next_sector)
+    block->sequential_cnt++;
+  block->next_sector = r->sector + r->cnt;
+  intr_set_level(old_level);
+
+  if (block->ops->submit != NULL)
+    block->ops->submit(block->aux, r);
+  else {
+    transfer(block, r->sector, r->cnt, r->buffer, r->write);
+    block_request_done(r);
+  }
+}
+
+/* Returns the latency bucket for a request that took US
+   microseconds. */
+static int latency_bucket(int64_t us) {
+  int bucket = 0;
+  while (us > 0 && bucket < BLOCK_LATENCY_BUCKETS - 1) {
+    us >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+/* Called by a driver once it has carried out request R.  Lets
+   whoever submitted R know.  May be called from an interrupt
+   handler. */
+void block_request_done(struct block_request* r) {
+  struct block* block = r->owner;
+  int64_t us = now_us() - r->start;
+  enum intr_level old_level;
+
+  TRACE(TRACE_BLOCK_DONE, r->sector, r->cnt);
+  old_level = intr_disable();
+  block->depth--;
+  block->service_us += us;
+  block->latency[latency_bucket(us)]++;
+  intr_set_level(old_level);
+
+  r->done(r);
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -128,12 +299,62 @@ void block_print_stats(void) {
   for (i = 0; i < BLOCK_ROLE_CNT; i++) {
     struct block* block = block_by_role[i];
     if (block != NULL) {
+      unsigned long long done = 0;
+      int j, last = 0;
+
       printf("%s (%s): %llu reads, %llu writes\n", block->name, block_type_name(block->type),
              block->read_cnt, block->write_cnt);
+
+      for (j = 0; j < BLOCK_LATENCY_BUCKETS; j++)
+        if (block->latency[j] > 0) {
+          done += block->latency[j];
+          last = j;
+        }
+      if (block->request_cnt == 0 || done == 0)
+        continue;
+      printf("  %llu requests, %llu%% sequential, %llu bytes; "
+             "%llu us mean service, %llu.%llu mean depth, %d max depth\n",
+             block->request_cnt, block->sequential_cnt * 100 / block->request_cnt,
+             (block->read_cnt + block->write_cnt) * BLOCK_SECTOR_SIZE, block->service_us / done,
+             block->depth_sum / done, block->depth_sum * 10 / done % 10, block->max_depth);
+      printf("  requests by log2 us taken:");
+      for (j = 0; j <= last; j++)
+        printf(" %llu", block->latency[j]);
+      printf("\n");
     }
   }
 }
 
+/* Returns statistic STAT, one of the BLOCK_STAT_* values in
+   <syscall-nr.h>, for the block device in ROLE, or -1 if there
+   is no such device or statistic. */
+long long block_stat(int role, int stat) {
+  struct block* block;
+
+  if (role < 0 || role >= BLOCK_ROLE_CNT || block_by_role[role] == NULL)
+    return -1;
+  block = block_by_role[role];
+
+  if (stat == BLOCK_STAT_READS)
+    return block->read_cnt;
+  else if (stat == BLOCK_STAT_WRITES)
+    return block->write_cnt;
+  else if (stat == BLOCK_STAT_REQUESTS)
+    return block->request_cnt;
+  else if (stat == BLOCK_STAT_SEQUENTIAL)
+    return block->sequential_cnt;
+  else if (stat == BLOCK_STAT_SERVICE_US)
+    return block->service_us;
+  else if (stat == BLOCK_STAT_DEPTH_SUM)
+    return block->depth_sum;
+  else if (stat == BLOCK_STAT_MAX_DEPTH)
+    return block->max_depth;
+  else if (stat >= BLOCK_STAT_LATENCY && stat < BLOCK_STAT_LATENCY + BLOCK_LATENCY_BUCKETS)
+    return block->latency[stat - BLOCK_STAT_LATENCY];
+  else
+    return -1;
+}
+
 /* Registers a new block device with the given NAME.  If
    EXTRA_INFO is non-null, it is printed as part of a user
    message.  The block device's SIZE in sectors and its TYPE must
@@ -141,7 +362,7 @@ void block_print_stats(void) {
    will be passed AUX in each function call. */
 struct block* block_register(const char* name, enum block_type type, const char* extra_info,
                              block_sector_t size, const struct block_operations* ops, void* aux) {
-  struct block* block = malloc(sizeof *block);
+  struct block* block = calloc(1, sizeof *block);
   if (block == NULL)
     PANIC("Failed to allocate memory for block device descriptor");
 
@@ -151,8 +372,6 @@ struct block* block_register(const char* name, enum block_type type, const char*
   block->size = size;
   block->ops = ops;
   block->aux = aux;
-  block->read_cnt = 0;
-  block->write_cnt = 0;
 
   printf("%s: %'" PRDSNu " sectors (", block->name, block->size);
   print_human_readable_size((uint64_t)block->size * BLOCK_SECTOR_SIZE);
@@ -1,8 +1,10 @@
 #ifndef DEVICES_BLOCK_H
 #define DEVICES_BLOCK_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <inttypes.h>
+#include <list.h>
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -52,20 +54,60 @@ struct block* block_next(struct block*);
 block_sector_t block_size(struct block*);
 void block_read(struct block*, block_sector_t, void*);
 void block_write(struct block*, block_sector_t, const void*);
+void block_read_multiple(struct block*, block_sector_t, size_t cnt, void*);
+void block_write_multiple(struct block*, block_sector_t, size_t cnt, const void*);
+
+/* A request to read or write a run of sectors, carried out
+   asynchronously by block_submit().  Requests that are pending at
+   the same time must not overlap: the device may carry them out
+   in any order. */
+struct block_request {
+  block_sector_t sector; /* First sector.  The device may change it. */
+  size_t cnt;            /* Number of sectors, at least 1. */
+  void* buffer;          /* CNT * BLOCK_SECTOR_SIZE bytes. */
+  bool write;            /* Write BUFFER to the sectors, or read them? */
+
+  /* Called with the request once it has been carried out,
+     maybe from another thread or an interrupt handler, and maybe
+     before block_submit() returns.  It must not sleep. */
+  void (*done)(struct block_request*);
+  void* aux; /* For DONE. */
+
+  struct list_elem elem; /* Owned by the device until DONE. */
+
+  /* Owned by the block layer. */
+  struct block* owner; /* Device it was submitted to. */
+  int64_t start;       /* When, in microseconds. */
+};
+
+void block_submit(struct block*, struct block_request*);
 const char* block_name(struct block*);
 enum block_type block_type(struct block*);
 
 /* Statistics. */
 void block_print_stats(void);
+long long block_stat(int role, int stat);
 
 /* Lower-level interface to block device drivers. */
 
 struct block_operations {
   void (*read)(void* aux, block_sector_t, void* buffer);
   void (*write)(void* aux, block_sector_t, const void* buffer);
+
+  /* Transfer a run of sectors at once.  Either may be null, in
+     which case the run is transferred a sector at a time. */
+  void (*read_multiple)(void* aux, block_sector_t, size_t cnt, void* buffer);
+  void (*write_multiple)(void* aux, block_sector_t, size_t cnt, const void* buffer);
+
+  /* Queues a request, to be carried out in whatever order suits
+     the device.  If this is not null, all transfers go through
+     it, and the members above are not used. */
+  void (*submit)(void* aux, struct block_request*);
 };
 
 struct block* block_register(const char* name, enum block_type, const char* extra_info,
                              block_sector_t size, const struct block_operations*, void* aux);
+void block_pass(struct block*, struct block_request*);
+void block_request_done(struct block_request*);
 
 #endif /* devices/block.h */
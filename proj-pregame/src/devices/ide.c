@@ -5,13 +5,34 @@
 #include <stdio.h>
 #include "devices/block.h"
 #include "devices/partition.h"
+#include "devices/pci.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].
+
+   If the controller is a PCI bus master, as the PIIX ones in PCs
+   and emulators are, sectors are moved by DMA: the controller
+   copies them to or from memory itself, described by a table of
+   physical regions, and interrupts once when it is done.  Then
+   the CPU only sets up each command and runs other threads while
+   it is carried out.  Otherwise, the CPU moves them a word at a
+   time through the data register, and the disk interrupts for
+   each block it wants moved.
+
+   Requests are queued for each disk, in order of sector, and a
+   thread for each channel carries them out.  It takes the disks
+   in turn, and for each sweeps across the disk in one direction,
+   C-LOOK fashion: the next request is the first at or beyond
+   where the last one ended, or the lowest if there is none.
+   Requests that continue one another in the same direction are
+   carried out together, as one command if DMA or the PIO
+   sector count allows. */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)   /* Data. */
@@ -34,6 +55,7 @@
 #define STA_BSY 0x80  /* Busy. */
 #define STA_DRDY 0x40 /* Device Ready. */
 #define STA_DRQ 0x08  /* Data Request. */
+#define STA_ERR 0x01  /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04 /* Software Reset. */
@@ -43,12 +65,52 @@
 #define DEV_LBA 0x40 /* Linear based addressing. */
 #define DEV_DEV 0x10 /* Select device: 0=master, 1=slave. */
 
+/* Bus master registers, in I/O space at the base given by BAR 4
+   of the controller, 8 bytes for each channel.  See [BMIDE]. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)    /* PRD table address. */
+
+/* Bus master Command Register bits. */
+#define BM_CMD_START 0x01 /* Start transfer. */
+#define BM_CMD_READ 0x08  /* Transfer to memory, that is, a disk read. */
+
+/* Bus master Status Register bits.  INTR and ERR are cleared by
+   writing 1 to them. */
+#define BM_STA_ERR 0x02  /* Transfer failed. */
+#define BM_STA_INTR 0x04 /* Disk interrupted. */
+
 /* Commands.
    Many more are defined but this is the small subset that we
    use. */
 #define CMD_IDENTIFY_DEVICE 0xec    /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20  /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30 /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4      /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5     /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6  /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8           /* READ DMA. */
+#define CMD_WRITE_DMA 0xca          /* WRITE DMA. */
+
+/* Most sectors one command can transfer: a sector count of 0 in
+   the Sector Count register means 256. */
+#define MAX_COMMAND_SECTORS 256
+
+/* A physical region descriptor, one entry of the table that
+   describes the memory a DMA transfer reads or writes.  A region
+   may not cross a 64 kB boundary. */
+struct prd {
+  uint32_t addr;  /* Physical address, which must be even. */
+  uint16_t size;  /* Bytes, which must be even, or 0 for 64 kB. */
+  uint16_t flags; /* PRD_EOT in the last entry. */
+};
+
+#define PRD_EOT 0x8000 /* End of table. */
+
+/* Entries in a PRD table.  Each sector of a transfer may need
+   two, if its buffer crosses a 64 kB boundary, but a run of
+   sectors in one buffer share them. */
+#define PRD_CNT 64
 
 /* An ATA device. */
 struct ata_disk {
@@ -56,6 +118,13 @@ struct ata_disk {
   struct channel* channel; /* Channel that disk is attached to. */
   int dev_no;              /* Device 0 or 1 for master or slave. */
   bool is_ata;             /* Is device an ATA disk? */
+  size_t multiple;         /* Sectors per interrupt in READ/WRITE MULTIPLE,
+                              or 1 if we use READ/WRITE SECTOR. */
+  bool dma;                /* Transfer by bus-master DMA? */
+
+  /* Guarded by the channel's lock. */
+  struct list queue;    /* Pending block_requests, in order of sector. */
+  block_sector_t head;  /* Where the last request carried out ended. */
 };
 
 /* An ATA channel (aka controller).
@@ -65,11 +134,15 @@ struct channel {
   uint16_t reg_base; /* Base I/O port. */
   uint8_t irq;       /* Interrupt in use. */
 
-  struct lock lock;                 /* Must acquire to access the controller. */
+  struct lock lock;                 /* Guards the devices' queues. */
+  struct condition queued;          /* Signaled when a request is queued. */
   bool expecting_interrupt;         /* True if an interrupt is expected, false if
                                    any interrupt would be spurious. */
   struct semaphore completion_wait; /* Up'd by interrupt handler. */
 
+  uint16_t bm_base; /* Base bus master I/O port, or 0 if no DMA. */
+  struct prd* prdt; /* PRD table, if BM_BASE is nonzero. */
+
   struct ata_disk devices[2]; /* The devices on this channel. */
 };
 
@@ -77,16 +150,24 @@ struct channel {
 #define CHANNEL_CNT 2
 static struct channel channels[CHANNEL_CNT];
 
+/* PRD tables for each channel.  Aligning a table to its size
+   keeps it from crossing a 64 kB boundary, as it must not. */
+static struct prd prdts[CHANNEL_CNT][PRD_CNT]
+    __attribute__((aligned(sizeof(struct prd) * PRD_CNT)));
+
 static struct block_operations ide_operations;
 
+static uint16_t find_bus_master(void);
+static void channel_thread(void* channel_);
 static void reset_channel(struct channel*);
 static bool check_device_type(struct ata_disk*);
 static void identify_ata_device(struct ata_disk*);
+static void set_multiple_mode(struct ata_disk*, size_t multiple);
 
-static void select_sector(struct ata_disk*, block_sector_t);
+static void select_sector(struct ata_disk*, block_sector_t, size_t cnt);
 static void issue_pio_command(struct channel*, uint8_t command);
-static void input_sector(struct channel*, void*);
-static void output_sector(struct channel*, const void*);
+static void input_sectors(struct channel*, void*, size_t cnt);
+static void output_sectors(struct channel*, const void*, size_t cnt);
 
 static void wait_until_idle(const struct ata_disk*);
 static bool wait_while_busy(const struct ata_disk*);
@@ -97,6 +178,7 @@ static void interrupt_handler(struct intr_frame*);
 
 /* Initialize the disk subsystem and detect disks. */
 void ide_init(void) {
+  uint16_t bm_base = find_bus_master();
   size_t chan_no;
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++) {
@@ -118,8 +200,11 @@ void ide_init(void) {
         NOT_REACHED();
     }
     lock_init(&c->lock);
+    cond_init(&c->queued);
     c->expecting_interrupt = false;
     sema_init(&c->completion_wait, 0);
+    c->bm_base = bm_base != 0 ? bm_base + chan_no * 8 : 0;
+    c->prdt = prdts[chan_no];
 
     /* Initialize devices. */
     for (dev_no = 0; dev_no < 2; dev_no++) {
@@ -128,6 +213,10 @@ void ide_init(void) {
       d->channel = c;
       d->dev_no = dev_no;
       d->is_ata = false;
+      d->multiple = 1;
+      d->dma = false;
+      list_init(&d->queue);
+      d->head = 0;
     }
 
     /* Register interrupt handler. */
@@ -140,6 +229,12 @@ void ide_init(void) {
     if (check_device_type(&c->devices[0]))
       check_device_type(&c->devices[1]);
 
+    /* Only the channel's thread touches the controller once the
+       disks are registered, and their partition tables are read
+       through it. */
+    if (c->devices[0].is_ata || c->devices[1].is_ata)
+      thread_create(c->name, PRI_MAX, channel_thread, c);
+
     /* Read hard disk identity information. */
     for (dev_no = 0; dev_no < 2; dev_no++)
       if (c->devices[dev_no].is_ata)
@@ -149,6 +244,30 @@ void ide_init(void) {
 
 /* Disk detection and identification. */
 
+/* Looks for a PCI IDE controller that is a bus master and whose
+   channels are at the legacy ports we use.  If there is one,
+   lets it master the bus and returns its base bus master I/O
+   port.  Otherwise, returns 0. */
+static uint16_t find_bus_master(void) {
+  struct pci_dev pci;
+  uint32_t prog_if, bar;
+
+  if (!pci_find_class(0x01, 0x01, &pci))
+    return 0;
+
+  /* Prog IF bit 7 says the controller is a bus master, and bits
+     0 and 2 that a channel has been moved off its legacy ports. */
+  prog_if = (pci_read_config(&pci, PCI_REG_CLASS) >> 8) & 0xff;
+  bar = pci_read_config(&pci, PCI_REG_BAR0 + 4 * 4);
+  if ((prog_if & 0x85) != 0x80 || (bar & 1) == 0 || (bar & 0xfffc) == 0)
+    return 0;
+
+  pci_write_config(&pci, PCI_REG_COMMAND,
+                   (pci_read_config(&pci, PCI_REG_COMMAND) & 0xffff) | PCI_COMMAND_IO |
+                       PCI_COMMAND_MASTER);
+  return bar & 0xfffc;
+}
+
 static char* descramble_ata_string(char*, int size);
 
 /* Resets an ATA channel and waits for any devices present on it
@@ -255,7 +374,7 @@ static void identify_ata_device(struct ata_disk* d) {
     d->is_ata = false;
     return;
   }
-  input_sector(c, id);
+  input_sectors(c, id, 1);
 
   /* Calculate capacity.
      Read model name and serial number. */
@@ -277,11 +396,39 @@ static void identify_ata_device(struct ata_disk* d) {
     return;
   }
 
+  /* Have the disk interrupt once for as many sectors as it can
+     in READ/WRITE MULTIPLE, which it gives in the low byte of
+     word 47. */
+  set_multiple_mode(d, *(uint16_t*)&id[47 * 2] & 0xff);
+
+  /* Use DMA if the controller can and the disk says, in bit 8 of
+     word 49, that it can too. */
+  d->dma = c->bm_base != 0 && (*(uint16_t*)&id[49 * 2] & 0x0100) != 0;
+
   /* Register. */
   block = block_register(d->name, BLOCK_RAW, extra_info, capacity, &ide_operations, d);
   partition_scan(block);
 }
 
+/* Sets disk D to transfer MULTIPLE sectors between interrupts in
+   READ/WRITE MULTIPLE, if MULTIPLE is more than 1 and D accepts
+   it.  Otherwise, D's transfers are made a sector at a time. */
+static void set_multiple_mode(struct ata_disk* d, size_t multiple) {
+  struct channel* c = d->channel;
+
+  d->multiple = 1;
+  if (multiple <= 1)
+    return;
+
+  select_device_wait(d);
+  outb(reg_nsect(c), multiple);
+  issue_pio_command(c, CMD_SET_MULTIPLE_MODE);
+  sema_down(&c->completion_wait);
+  wait_while_busy(d);
+  if ((inb(reg_status(c)) & STA_ERR) == 0)
+    d->multiple = multiple;
+}
+
 /* Translates STRING, which consists of SIZE bytes in a funky
    format, into a null-terminated string in-place.  Drops
    trailing whitespace and null bytes.  Returns STRING.  */
@@ -306,53 +453,290 @@ static char* descramble_ata_string(char* string, int size) {
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
-   Internally synchronizes accesses to disks, so external
-   per-disk locking is unneeded. */
-static void ide_read(void* d_, block_sector_t sec_no, void* buffer) {
+/* Queued requests. */
+
+/* Returns the request that list element E is in. */
+static struct block_request* request_of(struct list_elem* e) {
+  return list_entry(e, struct block_request, elem);
+}
+
+/* Orders requests by sector. */
+static bool request_less(const struct list_elem* a_, const struct list_elem* b_,
+                         void* aux UNUSED) {
+  return request_of((struct list_elem*)a_)->sector < request_of((struct list_elem*)b_)->sector;
+}
+
+/* Queues request R for disk D. */
+static void ide_submit(void* d_, struct block_request* r) {
   struct ata_disk* d = d_;
   struct channel* c = d->channel;
+
   lock_acquire(&c->lock);
-  select_sector(d, sec_no);
-  issue_pio_command(c, CMD_READ_SECTOR_RETRY);
-  sema_down(&c->completion_wait);
-  if (!wait_while_busy(d))
-    PANIC("%s: disk read failed, sector=%" PRDSNu, d->name, sec_no);
-  input_sector(c, buffer);
+  list_insert_ordered(&d->queue, &r->elem, request_less, NULL);
+  cond_signal(&c->queued, &c->lock);
   lock_release(&c->lock);
 }
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
-   Internally synchronizes accesses to disks, so external
-   per-disk locking is unneeded. */
-static void ide_write(void* d_, block_sector_t sec_no, const void* buffer) {
-  struct ata_disk* d = d_;
+static struct block_operations ide_operations = {NULL, NULL, NULL, NULL, ide_submit};
+
+/* Moves the requests that D should carry out next to BATCH: the
+   first in C-LOOK order, and those after it that continue it in
+   the same direction, up to MAX_COMMAND_SECTORS in all unless
+   the first is bigger.  D's queue must not be empty.  Returns
+   the number of sectors in BATCH.  The channel's lock must be
+   held. */
+static size_t take_batch(struct ata_disk* d, struct list* batch) {
+  struct list_elem* e;
+  struct block_request* r;
+  size_t cnt;
+
+  ASSERT(!list_empty(&d->queue));
+
+  for (e = list_begin(&d->queue); e != list_end(&d->queue); e = list_next(e))
+    if (request_of(e)->sector >= d->head)
+      break;
+  if (e == list_end(&d->queue))
+    e = list_begin(&d->queue);
+
+  r = request_of(e);
+  cnt = 0;
+  list_init(batch);
+  for (;;) {
+    e = list_remove(e);
+    list_push_back(batch, &r->elem);
+    cnt += r->cnt;
+    d->head = r->sector + r->cnt;
+
+    if (e == list_end(&d->queue))
+      break;
+    r = request_of(e);
+    if (r->sector != d->head || r->write != request_of(list_front(batch))->write ||
+        cnt >= MAX_COMMAND_SECTORS || r->cnt > MAX_COMMAND_SECTORS - cnt)
+      break;
+  }
+  return cnt;
+}
+
+/* A position in a batch of requests, a sector at a time. */
+struct cursor {
+  struct list_elem* e; /* The request. */
+  size_t ofs;          /* Sectors into it. */
+};
+
+/* Returns the buffer for the sector at CUR. */
+static uint8_t* cursor_peek(const struct cursor* cur) {
+  return (uint8_t*)request_of(cur->e)->buffer + cur->ofs * BLOCK_SECTOR_SIZE;
+}
+
+/* Returns the buffer for the sector at CUR, and advances CUR to
+   the next sector. */
+static uint8_t* cursor_next(struct cursor* cur) {
+  uint8_t* buffer = cursor_peek(cur);
+
+  if (++cur->ofs == request_of(cur->e)->cnt) {
+    cur->e = list_next(cur->e);
+    cur->ofs = 0;
+  }
+  return buffer;
+}
+
+/* Returns true if sectors at BUFFER can be moved by DMA for disk
+   D: D and its controller must be able to, and BUFFER must be
+   even and mapped where its physical address is known. */
+static bool can_dma(const struct ata_disk* d, const void* buffer) {
+  return d->dma && is_kernel_vaddr(buffer) && ((uintptr_t)buffer & 1) == 0;
+}
+
+/* Fills in channel C's PRD table to describe the buffers for as
+   many sectors of the CNT at CUR as it has room for, advancing
+   CUR past them.  Returns the number described. */
+static size_t fill_prdt(struct channel* c, struct cursor* cur, size_t cnt) {
+  size_t i = 0;   /* Entries used. */
+  size_t len = 0; /* Bytes in entry I - 1. */
+  size_t n;
+
+  for (n = 0; n < cnt && i + 2 <= PRD_CNT; n++) {
+    uintptr_t addr = vtop(cursor_next(cur));
+    size_t size = BLOCK_SECTOR_SIZE;
+
+    while (size > 0) {
+      size_t piece = 0x10000 - (addr & 0xffff);
+      if (piece > size)
+        piece = size;
+
+      /* Extend the last entry if this continues it within the
+         same 64 kB region. */
+      if (i > 0 && c->prdt[i - 1].addr + len == addr && (addr & 0xffff) != 0)
+        len += piece;
+      else {
+        if (i > 0)
+          c->prdt[i - 1].size = len & 0xffff;
+        c->prdt[i].addr = addr;
+        c->prdt[i].flags = 0;
+        len = piece;
+        i++;
+      }
+      addr += piece;
+      size -= piece;
+    }
+  }
+  c->prdt[i - 1].size = len & 0xffff;
+  c->prdt[i - 1].flags = PRD_EOT;
+  return n;
+}
+
+/* Moves sectors starting at SEC_NO between disk D and the
+   buffers at CUR by DMA, reading them if WRITE is false and
+   writing them otherwise: as many of the next CNT, which must be
+   at most MAX_COMMAND_SECTORS, as the PRD table can describe.
+   Sleeps until the disk interrupts when the transfer is done.
+   Returns the number of sectors moved. */
+static size_t dma_transfer(struct ata_disk* d, block_sector_t sec_no, size_t cnt,
+                           struct cursor* cur, bool write) {
   struct channel* c = d->channel;
-  lock_acquire(&c->lock);
-  select_sector(d, sec_no);
-  issue_pio_command(c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy(d))
-    PANIC("%s: disk write failed, sector=%" PRDSNu, d->name, sec_no);
-  output_sector(c, buffer);
+  uint8_t direction = write ? 0 : BM_CMD_READ;
+  uint8_t status;
+
+  cnt = fill_prdt(c, cur, cnt);
+  outl(reg_bm_prdt(c), vtop(c->prdt));
+  outb(reg_bm_command(c), direction);
+  outb(reg_bm_status(c), inb(reg_bm_status(c)) | BM_STA_INTR | BM_STA_ERR);
+
+  select_sector(d, sec_no, cnt);
+  issue_pio_command(c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+  outb(reg_bm_command(c), direction | BM_CMD_START);
+  sema_down(&c->completion_wait);
+  outb(reg_bm_command(c), direction);
+
+  status = inb(reg_bm_status(c));
+  outb(reg_bm_status(c), status | BM_STA_INTR | BM_STA_ERR);
+  if ((status & BM_STA_ERR) != 0 || (inb(reg_alt_status(c)) & STA_ERR) != 0)
+    PANIC("%s: disk %s failed, sector=%" PRDSNu, d->name, write ? "write" : "read", sec_no);
+  return cnt;
+}
+
+/* Reads the CNT sectors starting at SEC_NO from disk D into the
+   buffers at CUR through the data register, with one command.
+   CNT must be at most MAX_COMMAND_SECTORS.  The disk interrupts
+   once for every D->multiple of them. */
+static void pio_read(struct ata_disk* d, block_sector_t sec_no, size_t cnt, struct cursor* cur) {
+  struct channel* c = d->channel;
+
+  select_sector(d, sec_no, cnt);
+  issue_pio_command(c, d->multiple > 1 ? CMD_READ_MULTIPLE : CMD_READ_SECTOR_RETRY);
+  while (cnt > 0) {
+    size_t n = cnt < d->multiple ? cnt : d->multiple;
+    size_t i;
+
+    sema_down(&c->completion_wait);
+    if (!wait_while_busy(d))
+      PANIC("%s: disk read failed, sector=%" PRDSNu, d->name, sec_no);
+    for (i = 0; i < n; i++)
+      input_sectors(c, cursor_next(cur), 1);
+    sec_no += n;
+    cnt -= n;
+  }
+}
+
+/* Writes the CNT sectors starting at SEC_NO to disk D from the
+   buffers at CUR through the data register, with one command,
+   and waits for the disk to acknowledge them.  CNT must be at
+   most MAX_COMMAND_SECTORS.  The disk interrupts once for every
+   D->multiple of them. */
+static void pio_write(struct ata_disk* d, block_sector_t sec_no, size_t cnt, struct cursor* cur) {
+  struct channel* c = d->channel;
+  bool first = true;
+
+  select_sector(d, sec_no, cnt);
+  issue_pio_command(c, d->multiple > 1 ? CMD_WRITE_MULTIPLE : CMD_WRITE_SECTOR_RETRY);
+  while (cnt > 0) {
+    size_t n = cnt < d->multiple ? cnt : d->multiple;
+    size_t i;
+
+    /* The disk asks for the first block of data right away, and
+       interrupts for each one after that. */
+    if (!first)
+      sema_down(&c->completion_wait);
+    first = false;
+    if (!wait_while_busy(d))
+      PANIC("%s: disk write failed, sector=%" PRDSNu, d->name, sec_no);
+    for (i = 0; i < n; i++)
+      output_sectors(c, cursor_next(cur), 1);
+    sec_no += n;
+    cnt -= n;
+  }
   sema_down(&c->completion_wait);
-  lock_release(&c->lock);
 }
 
-static struct block_operations ide_operations = {ide_read, ide_write};
+/* Carries out BATCH, CNT sectors of requests for disk D that
+   continue one another in the same direction, and lets each
+   requester know. */
+static void carry_out(struct ata_disk* d, struct list* batch, size_t cnt) {
+  struct block_request* first = request_of(list_front(batch));
+  block_sector_t sec_no = first->sector;
+  struct cursor cur = {list_begin(batch), 0};
+  bool dma = true;
+  struct list_elem* e;
+
+  for (e = list_begin(batch); e != list_end(batch); e = list_next(e))
+    dma = dma && can_dma(d, request_of(e)->buffer);
+
+  while (cnt > 0) {
+    size_t n = cnt < MAX_COMMAND_SECTORS ? cnt : MAX_COMMAND_SECTORS;
+
+    if (dma)
+      n = dma_transfer(d, sec_no, n, &cur, first->write);
+    else if (first->write)
+      pio_write(d, sec_no, n, &cur);
+    else
+      pio_read(d, sec_no, n, &cur);
+    sec_no += n;
+    cnt -= n;
+  }
+
+  while (!list_empty(batch)) {
+    struct block_request* r = request_of(list_pop_front(batch));
+    block_request_done(r);
+  }
+}
+
+/* Carries out the requests queued for the disks on CHANNEL_,
+   taking the disks in turn. */
+static void channel_thread(void* channel_) {
+  struct channel* c = channel_;
+  int dev_no = 0;
+
+  for (;;) {
+    struct ata_disk* d;
+    struct list batch;
+    size_t cnt;
+
+    lock_acquire(&c->lock);
+    while (list_empty(&c->devices[0].queue) && list_empty(&c->devices[1].queue))
+      cond_wait(&c->queued, &c->lock);
+    dev_no = !dev_no;
+    if (list_empty(&c->devices[dev_no].queue))
+      dev_no = !dev_no;
+    d = &c->devices[dev_no];
+    cnt = take_batch(d, &batch);
+    lock_release(&c->lock);
+
+    carry_out(d, &batch, cnt);
+  }
+}
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
-static void select_sector(struct ata_disk* d, block_sector_t sec_no) {
+   writes SEC_NO and CNT, which must be at most
+   MAX_COMMAND_SECTORS, to the disk's sector selection registers.
+   (We use LBA mode.) */
+static void select_sector(struct ata_disk* d, block_sector_t sec_no, size_t cnt) {
   struct channel* c = d->channel;
 
-  ASSERT(sec_no < (1UL << 28));
+  ASSERT(cnt > 0 && cnt <= MAX_COMMAND_SECTORS);
+  ASSERT(sec_no < (1UL << 28) && cnt <= (1UL << 28) - sec_no);
 
   select_device_wait(d);
-  outb(reg_nsect(c), 1);
+  outb(reg_nsect(c), cnt == MAX_COMMAND_SECTORS ? 0 : cnt);
   outb(reg_lbal(c), sec_no);
   outb(reg_lbam(c), sec_no >> 8);
   outb(reg_lbah(c), (sec_no >> 16));
@@ -370,16 +754,18 @@ static void issue_pio_command(struct channel* c, uint8_t command) {
   outb(reg_command(c), command);
 }
 
-/* Reads a sector from channel C's data register in PIO mode into
-   SECTOR, which must have room for BLOCK_SECTOR_SIZE bytes. */
-static void input_sector(struct channel* c, void* sector) {
-  insw(reg_data(c), sector, BLOCK_SECTOR_SIZE / 2);
+/* Reads CNT sectors from channel C's data register in PIO mode
+   into SECTORS, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes. */
+static void input_sectors(struct channel* c, void* sectors, size_t cnt) {
+  insw(reg_data(c), sectors, cnt * BLOCK_SECTOR_SIZE / 2);
 }
 
-/* Writes SECTOR to channel C's data register in PIO mode.
-   SECTOR must contain BLOCK_SECTOR_SIZE bytes. */
-static void output_sector(struct channel* c, const void* sector) {
-  outsw(reg_data(c), sector, BLOCK_SECTOR_SIZE / 2);
+/* Writes CNT sectors from SECTORS to channel C's data register
+   in PIO mode.  SECTORS must contain CNT * BLOCK_SECTOR_SIZE
+   bytes. */
+static void output_sectors(struct channel* c, const void* sectors, size_t cnt) {
+  outsw(reg_data(c), sectors, cnt * BLOCK_SECTOR_SIZE / 2);
 }
 
 /* Low-level ATA primitives. */
@@ -1,11 +1,35 @@
 #include "devices/input.h"
 #include <debug.h>
+#include <string.h>
 #include "devices/intq.h"
 #include "devices/serial.h"
 
-/* Stores keys from the keyboard and serial port. */
+/* Stores keys from the keyboard and serial port, ready to be
+   read. */
 static struct intq buffer;
 
+/* Most bytes in a line being typed.  A longer line is passed on
+   in pieces of this size. */
+#define LINE_MAX 256
+
+/* Line discipline, guarded by turning interrupts off.
+
+   In cooked mode, the default, keys are held back in LINE until
+   a new-line completes it, with carriage return read as new-line
+   and backspace or delete erasing the key before it.  The line
+   then goes into BUFFER all at once, waking a reader waiting in
+   input_getc() once per line rather than once per key.  If
+   BUFFER lacks room for all of it, the rest stays in LINE, which
+   takes no more keys until it has gone.
+
+   In raw mode, keys go into BUFFER as they come. */
+static bool raw;
+static uint8_t line[LINE_MAX];
+static size_t line_len;
+static bool line_done; /* Is LINE complete, waiting for room in BUFFER? */
+
+static void pass_line(void);
+
 /* Initializes the input buffer. */
 void input_init(void) { intq_init(&buffer); }
 
@@ -13,20 +37,34 @@ void input_init(void) { intq_init(&buffer); }
    Interrupts must be off and the buffer must not be full. */
 void input_putc(uint8_t key) {
   ASSERT(intr_get_level() == INTR_OFF);
-  ASSERT(!intq_full(&buffer));
+  ASSERT(!input_full());
 
-  intq_putc(&buffer, key);
+  if (raw)
+    intq_putc(&buffer, key);
+  else if (key == '\b' || key == 0x7f) {
+    if (line_len > 0)
+      line_len--;
+  } else {
+    if (key == '\r')
+      key = '\n';
+    line[line_len++] = key;
+    if (key == '\n' || line_len == LINE_MAX)
+      pass_line();
+  }
   serial_notify();
 }
 
 /* Retrieves a key from the input buffer.
-   If the buffer is empty, waits for a key to be pressed. */
+   If the buffer is empty, waits for a key to be pressed, or in
+   cooked mode for a line to be typed. */
 uint8_t input_getc(void) {
   enum intr_level old_level;
   uint8_t key;
 
   old_level = intr_disable();
   key = intq_getc(&buffer);
+  if (line_done)
+    pass_line();
   serial_notify();
   intr_set_level(old_level);
 
@@ -38,5 +76,24 @@ uint8_t input_getc(void) {
    Interrupts must be off. */
 bool input_full(void) {
   ASSERT(intr_get_level() == INTR_OFF);
-  return intq_full(&buffer);
+  return line_done || intq_full(&buffer);
+}
+
+/* Switches to raw mode if RAW_ is true, and to cooked mode
+   otherwise.  Keys of a line not yet completed are passed on
+   as they are. */
+void input_set_raw(bool raw_) {
+  enum intr_level old_level = intr_disable();
+  raw = raw_;
+  if (raw && line_len > 0)
+    pass_line();
+  intr_set_level(old_level);
+}
+
+/* Moves as much of LINE into BUFFER as it has room for. */
+static void pass_line(void) {
+  size_t n = intq_put(&buffer, line, line_len);
+  memmove(line, line + n, line_len - n);
+  line_len -= n;
+  line_done = line_len > 0;
 }
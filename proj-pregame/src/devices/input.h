@@ -8,5 +8,6 @@ void input_init(void);
 void input_putc(uint8_t);
 uint8_t input_getc(void);
 bool input_full(void);
+void input_set_raw(bool);
 
 #endif /* devices/input.h */
@@ -62,6 +62,21 @@ void intq_putc(struct intq* q, uint8_t byte) {
   signal(q, &q->not_empty);
 }
 
+/* Adds as many of the CNT bytes in BUF to the end of Q as there
+   is room for, without sleeping, and returns the number added. */
+size_t intq_put(struct intq* q, const uint8_t* buf, size_t cnt) {
+  size_t n = 0;
+
+  ASSERT(intr_get_level() == INTR_OFF);
+  while (n < cnt && !intq_full(q)) {
+    q->buf[q->head] = buf[n++];
+    q->head = next(q->head);
+  }
+  if (n > 0)
+    signal(q, &q->not_empty);
+  return n;
+}
+
 /* Returns the position after POS within an intq. */
 static int next(int pos) { return (pos + 1) % INTQ_BUFSIZE; }
 
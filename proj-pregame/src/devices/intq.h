@@ -17,8 +17,10 @@
    protect kernel threads from one another, not from interrupt
    handlers. */
 
-/* Queue buffer size, in bytes. */
-#define INTQ_BUFSIZE 64
+/* Queue buffer size, in bytes.  Big enough that the serial
+   port's transmit queue takes most writes to the console at
+   once. */
+#define INTQ_BUFSIZE 2048
 
 /* A circular queue of bytes. */
 struct intq {
@@ -38,5 +40,6 @@ bool intq_empty(const struct intq*);
 bool intq_full(const struct intq*);
 uint8_t intq_getc(struct intq*);
 void intq_putc(struct intq*, uint8_t);
+size_t intq_put(struct intq*, const uint8_t*, size_t);
 
 #endif /* devices/intq.h */
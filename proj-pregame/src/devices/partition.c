@@ -271,19 +271,12 @@ static const char* partition_type_name(uint8_t type) {
   return type_names[type] != NULL ? type_names[type] : "Unknown";
 }
 
-/* Reads sector SECTOR from partition P into BUFFER, which must
-   have room for BLOCK_SECTOR_SIZE bytes. */
-static void partition_read(void* p_, block_sector_t sector, void* buffer) {
+/* Passes request R, for sectors within partition P, on to the
+   device that holds P. */
+static void partition_submit(void* p_, struct block_request* r) {
   struct partition* p = p_;
-  block_read(p->block, p->start + sector, buffer);
+  r->sector += p->start;
+  block_pass(p->block, r);
 }
 
-/* Write sector SECTOR to partition P from BUFFER, which must
-   contain BLOCK_SECTOR_SIZE bytes.  Returns after the block has
-   acknowledged receiving the data. */
-static void partition_write(void* p_, block_sector_t sector, const void* buffer) {
-  struct partition* p = p_;
-  block_write(p->block, p->start + sector, buffer);
-}
-
-static struct block_operations partition_operations = {partition_read, partition_write};
+static struct block_operations partition_operations = {NULL, NULL, NULL, NULL, partition_submit};
@@ -0,0 +1,97 @@
+#include "devices/pci.h"
+#include <debug.h>
+#include "threads/io.h"
+
+/* The code in this file reads and writes PCI configuration space
+   through configuration mechanism #1, which every PC chipset
+   since the original PCI ones supports.  See [PCI] for details. */
+
+/* Configuration mechanism #1 ports. */
+#define CONFIG_ADDRESS 0xcf8 /* Selects a function and register. */
+#define CONFIG_DATA 0xcfc    /* The selected register. */
+
+/* Selects register REG of function D for the next access to
+   CONFIG_DATA. */
+static void select_config(const struct pci_dev* d, uint8_t reg) {
+  ASSERT(d->dev < 32 && d->func < 8);
+  ASSERT(reg % 4 == 0);
+
+  outl(CONFIG_ADDRESS, 0x80000000 | (uint32_t)d->bus << 16 | (uint32_t)d->dev << 11 |
+                           (uint32_t)d->func << 8 | reg);
+}
+
+/* Returns the 32-bit configuration register REG of function D. */
+uint32_t pci_read_config(const struct pci_dev* d, uint8_t reg) {
+  select_config(d, reg);
+  return inl(CONFIG_DATA);
+}
+
+/* Sets the 32-bit configuration register REG of function D to
+   VALUE. */
+void pci_write_config(const struct pci_dev* d, uint8_t reg, uint32_t value) {
+  select_config(d, reg);
+  outl(CONFIG_DATA, value);
+}
+
+/* Finds the function, in bus order, that is the INDEXth (from
+   0) for which MATCH returns true when passed the function and
+   AUX.  Returns true and stores its location in *D if there is
+   one, and returns false otherwise. */
+static bool find(bool (*match)(const struct pci_dev*, void* aux), void* aux, int index,
+                 struct pci_dev* d) {
+  unsigned bus, dev, func;
+
+  for (bus = 0; bus < 256; bus++)
+    for (dev = 0; dev < 32; dev++)
+      for (func = 0; func < 8; func++) {
+        d->bus = bus;
+        d->dev = dev;
+        d->func = func;
+        if ((pci_read_config(d, PCI_REG_ID) & 0xffff) == 0xffff) {
+          /* No such function.  Without function 0 there are no
+             others. */
+          if (func == 0)
+            break;
+          continue;
+        }
+
+        if (match(d, aux) && index-- == 0)
+          return true;
+
+        /* Only multi-function devices have functions besides 0. */
+        if (func == 0 && (pci_read_config(d, PCI_REG_HEADER) & 0x00800000) == 0)
+          break;
+      }
+  return false;
+}
+
+/* Returns true if function D's class code and subclass are the
+   first two bytes of AUX_. */
+static bool class_matches(const struct pci_dev* d, void* aux_) {
+  const uint8_t* aux = aux_;
+  uint32_t class_reg = pci_read_config(d, PCI_REG_CLASS);
+  return class_reg >> 24 == aux[0] && ((class_reg >> 16) & 0xff) == aux[1];
+}
+
+/* Finds the first function, in bus order, whose class code and
+   subclass are CLASS and SUBCLASS.  Returns true and stores its
+   location in *D if there is one, and returns false otherwise. */
+bool pci_find_class(uint8_t class, uint8_t subclass, struct pci_dev* d) {
+  uint8_t aux[2] = {class, subclass};
+  return find(class_matches, aux, 0, d);
+}
+
+/* Returns true if function D's ID register is *AUX_. */
+static bool id_matches(const struct pci_dev* d, void* aux_) {
+  const uint32_t* aux = aux_;
+  return pci_read_config(d, PCI_REG_ID) == *aux;
+}
+
+/* Finds the INDEXth function (from 0), in bus order, whose
+   vendor and device IDs are VENDOR and DEVICE.  Returns true and
+   stores its location in *D if there is one, and returns false
+   otherwise. */
+bool pci_find_device(uint16_t vendor, uint16_t device, int index, struct pci_dev* d) {
+  uint32_t id = (uint32_t)device << 16 | vendor;
+  return find(id_matches, &id, index, d);
+}
@@ -0,0 +1,32 @@
+#ifndef DEVICES_PCI_H
+#define DEVICES_PCI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* A PCI function, named by where it is on the bus. */
+struct pci_dev {
+  uint8_t bus;  /* Bus number. */
+  uint8_t dev;  /* Device number on the bus. */
+  uint8_t func; /* Function number within the device. */
+};
+
+/* Configuration space registers, as offsets of 32-bit words. */
+#define PCI_REG_ID 0x00      /* Device ID (31:16), Vendor ID (15:0). */
+#define PCI_REG_COMMAND 0x04 /* Status (31:16), Command (15:0). */
+#define PCI_REG_CLASS 0x08   /* Class (31:24), Subclass, Prog IF, Revision. */
+#define PCI_REG_HEADER 0x0c  /* Header Type in 23:16. */
+#define PCI_REG_BAR0 0x10    /* Base address registers 0 through 5. */
+#define PCI_REG_INTR 0x3c    /* Interrupt Line in 7:0. */
+
+/* Command register bits. */
+#define PCI_COMMAND_IO 0x0001     /* Respond to I/O space accesses. */
+#define PCI_COMMAND_MEMORY 0x0002 /* Respond to memory space accesses. */
+#define PCI_COMMAND_MASTER 0x0004 /* May act as a bus master. */
+
+uint32_t pci_read_config(const struct pci_dev*, uint8_t reg);
+void pci_write_config(const struct pci_dev*, uint8_t reg, uint32_t value);
+bool pci_find_class(uint8_t class, uint8_t subclass, struct pci_dev*);
+bool pci_find_device(uint16_t vendor, uint16_t device, int index, struct pci_dev*);
+
+#endif /* devices/pci.h */
@@ -11,9 +11,6 @@
 #define PIT_PORT_CONTROL 0x43                        /* Control port. */
 #define PIT_PORT_COUNTER(CHANNEL) (0x40 + (CHANNEL)) /* Counter port. */
 
-/* PIT cycles per second. */
-#define PIT_HZ 1193180
-
 /* Configure the given CHANNEL in the PIT.  In a PC, the PIT's
    three output channels are hooked up like this:
 
@@ -44,7 +41,6 @@
    FREQUENCY is the number of periods per second, in Hz. */
 void pit_configure_channel(int channel, int mode, int frequency) {
   uint16_t count;
-  enum intr_level old_level;
 
   ASSERT(channel == 0 || channel == 2);
   ASSERT(mode == 2 || mode == 3);
@@ -68,6 +64,19 @@ void pit_configure_channel(int channel, int mode, int frequency) {
   } else
     count = (PIT_HZ + frequency / 2) / frequency;
 
+  pit_set_count(channel, mode, count);
+}
+
+/* Configures CHANNEL in the PIT as pit_configure_channel() does,
+   but with a period of COUNT cycles of the PIT's clock, where 0
+   stands for 65536.  The channel starts counting the new period
+   down right away. */
+void pit_set_count(int channel, int mode, uint16_t count) {
+  enum intr_level old_level;
+
+  ASSERT(channel == 0 || channel == 2);
+  ASSERT(mode == 2 || mode == 3);
+
   /* Configure the PIT mode and load its counters. */
   old_level = intr_disable();
   outb(PIT_PORT_CONTROL, (channel << 6) | 0x30 | (mode << 1));
@@ -75,3 +84,20 @@ void pit_configure_channel(int channel, int mode, int frequency) {
   outb(PIT_PORT_COUNTER(channel), count >> 8);
   intr_set_level(old_level);
 }
+
+/* Returns the cycles left in the current period of CHANNEL. */
+uint16_t pit_read_count(int channel) {
+  enum intr_level old_level;
+  uint16_t count;
+
+  ASSERT(channel == 0 || channel == 2);
+
+  /* Latch the counter, then read it low byte first. */
+  old_level = intr_disable();
+  outb(PIT_PORT_CONTROL, channel << 6);
+  count = inb(PIT_PORT_COUNTER(channel));
+  count |= inb(PIT_PORT_COUNTER(channel)) << 8;
+  intr_set_level(old_level);
+
+  return count;
+}
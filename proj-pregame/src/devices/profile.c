@@ -0,0 +1,112 @@
+#include "devices/profile.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* A sampling profiler, with the "-profile" option.  Each timer
+   interrupt counts the address of the instruction it interrupted,
+   in kernel and user code alike, in a hash table.  At shutdown
+   the addresses are printed, the most often sampled first, in a
+   form the "backtrace" utility turns into function names:
+
+     grep '^Profile: 0x' OUTPUT | cut -d' ' -f2 | xargs backtrace kernel.o
+
+   Code that runs with interrupts off is never interrupted, so its
+   samples land where it turns them back on. */
+bool profile_enabled;
+
+/* A sampled address and the number of times it was sampled. */
+struct sample {
+  uintptr_t eip;
+  unsigned cnt;
+};
+
+/* The hash table, open-addressed, which fills no more than
+   three-quarters of its SLOT_CNT slots so that probes stay
+   short.  Samples of new addresses past that are dropped. */
+#define PROFILE_PAGES 8
+#define SLOT_CNT (PROFILE_PAGES * PGSIZE / sizeof(struct sample))
+static struct sample* samples;
+static size_t used_cnt;
+
+/* Statistics. */
+static long long sample_cnt;  /* Samples taken. */
+static long long user_cnt;    /* Samples of user code. */
+static long long dropped_cnt; /* Samples the table had no room for. */
+
+/* Allocates the table, if profiling is enabled. */
+void profile_init(void) {
+  if (!profile_enabled)
+    return;
+  samples = palloc_get_multiple(PAL_ASSERT | PAL_ZERO, PROFILE_PAGES);
+}
+
+/* Counts the instruction that F interrupted.  Called by the
+   timer interrupt handler if profiling is enabled. */
+void profile_sample(struct intr_frame* f) {
+  uintptr_t eip = (uintptr_t)f->eip;
+  size_t i;
+
+  if (samples == NULL)
+    return;
+
+  sample_cnt++;
+  if (eip < (uintptr_t)PHYS_BASE)
+    user_cnt++;
+
+  for (i = (eip * 2654435761u) % SLOT_CNT;; i = (i + 1) % SLOT_CNT) {
+    struct sample* s = &samples[i];
+    if (s->cnt != 0 && s->eip == eip) {
+      s->cnt++;
+      return;
+    }
+    if (s->cnt == 0) {
+      if (used_cnt >= SLOT_CNT / 4 * 3) {
+        dropped_cnt++;
+        return;
+      }
+      used_cnt++;
+      s->eip = eip;
+      s->cnt = 1;
+      return;
+    }
+  }
+}
+
+/* Orders samples A_ and B_ from the most to the least often
+   sampled. */
+static int more_samples(const void* a_, const void* b_) {
+  const struct sample* a = a_;
+  const struct sample* b = b_;
+  return a->cnt < b->cnt ? 1 : a->cnt > b->cnt ? -1 : 0;
+}
+
+/* Prints the profile and stops profiling. */
+void profile_print_stats(void) {
+  struct sample* table = samples;
+  enum intr_level old_level;
+  size_t i, cnt;
+
+  if (table == NULL)
+    return;
+
+  /* The table is about to be rearranged. */
+  old_level = intr_disable();
+  samples = NULL;
+  intr_set_level(old_level);
+
+  printf("Profile: %lld samples, %lld in user code, %lld dropped\n", sample_cnt, user_cnt,
+         dropped_cnt);
+  cnt = 0;
+  for (i = 0; i < SLOT_CNT; i++)
+    if (table[i].cnt != 0)
+      table[cnt++] = table[i];
+  qsort(table, cnt, sizeof *table, more_samples);
+  for (i = 0; i < cnt; i++)
+    printf("Profile: 0x%08" PRIxPTR " %u%s\n", table[i].eip, table[i].cnt,
+           table[i].eip < (uintptr_t)PHYS_BASE ? " (user)" : "");
+}
@@ -0,0 +1,14 @@
+#ifndef DEVICES_PROFILE_H
+#define DEVICES_PROFILE_H
+
+#include <stdbool.h>
+#include "threads/interrupt.h"
+
+/* -profile: Sample where the timer interrupt finds the CPU? */
+extern bool profile_enabled;
+
+void profile_init(void);
+void profile_sample(struct intr_frame*);
+void profile_print_stats(void);
+
+#endif /* devices/profile.h */
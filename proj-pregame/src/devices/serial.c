@@ -33,6 +33,15 @@
 #define MCR_REG (IO_BASE + 4) /* MODEM Control Register. */
 #define LSR_REG (IO_BASE + 5) /* Line Status Register (read-only). */
 
+/* FIFO Control Register bits. */
+#define FCR_ENABLE 0x01   /* Enable the FIFOs. */
+#define FCR_CLEAR_RX 0x02 /* Empty the receive FIFO. */
+#define FCR_CLEAR_TX 0x04 /* Empty the transmit FIFO. */
+
+/* Bytes the transmit FIFO holds.  Once THR Empty is set, this
+   many may be written without looking again. */
+#define TX_FIFO_SIZE 16
+
 /* Interrupt Enable Register bits. */
 #define IER_RECV 0x01 /* Interrupt when data received. */
 #define IER_XMIT 0x02 /* Interrupt when transmit finishes. */
@@ -83,6 +92,10 @@ void serial_init_queue(void) {
     init_poll();
   ASSERT(mode == POLL);
 
+  /* With the FIFOs on, each transmit interrupt can take up to
+     TX_FIFO_SIZE bytes instead of one. */
+  outb(FCR_REG, FCR_ENABLE | FCR_CLEAR_RX | FCR_CLEAR_TX);
+
   intr_register_ext(0x20 + 4, serial_interrupt, "serial");
   mode = QUEUE;
   old_level = intr_disable();
@@ -91,29 +104,43 @@ void serial_init_queue(void) {
 }
 
 /* Sends BYTE to the serial port. */
-void serial_putc(uint8_t byte) {
+void serial_putc(uint8_t byte) { serial_write(&byte, 1); }
+
+/* Sends the CNT bytes in BUF to the serial port. */
+void serial_write(const uint8_t* buf, size_t cnt) {
   enum intr_level old_level = intr_disable();
 
   if (mode != QUEUE) {
     /* If we're not set up for interrupt-driven I/O yet,
-         use dumb polling to transmit a byte. */
+         use dumb polling to transmit the bytes. */
     if (mode == UNINIT)
       init_poll();
-    putc_poll(byte);
+    while (cnt-- > 0)
+      putc_poll(*buf++);
   } else {
-    /* Otherwise, queue a byte and update the interrupt enable
-         register. */
-    if (old_level == INTR_OFF && intq_full(&txq)) {
-      /* Interrupts are off and the transmit queue is full.
+    /* Otherwise, queue as much as fits at once and update the
+         interrupt enable register. */
+    for (;;) {
+      size_t n = intq_put(&txq, buf, cnt);
+      buf += n;
+      cnt -= n;
+      write_ier();
+      if (cnt == 0)
+        break;
+
+      if (old_level == INTR_OFF) {
+        /* Interrupts are off and the transmit queue is full.
              If we wanted to wait for the queue to empty,
              we'd have to reenable interrupts.
              That's impolite, so we'll send a character via
              polling instead. */
-      putc_poll(intq_getc(&txq));
+        putc_poll(intq_getc(&txq));
+      } else {
+        /* Sleep until the interrupt handler makes room. */
+        intq_putc(&txq, *buf++);
+        cnt--;
+      }
     }
-
-    intq_putc(&txq, byte);
-    write_ier();
   }
 
   intr_set_level(old_level);
@@ -196,10 +223,13 @@ static void serial_interrupt(struct intr_frame* f UNUSED) {
   while (!input_full() && (inb(LSR_REG) & LSR_DR) != 0)
     input_putc(inb(RBR_REG));
 
-  /* As long as we have a byte to transmit, and the hardware is
-     ready to accept a byte for transmission, transmit a byte. */
-  while (!intq_empty(&txq) && (inb(LSR_REG) & LSR_THRE) != 0)
-    outb(THR_REG, intq_getc(&txq));
+  /* Once the hardware is ready to accept bytes for transmission,
+     fill its FIFO from the queue. */
+  if ((inb(LSR_REG) & LSR_THRE) != 0) {
+    int i;
+    for (i = 0; i < TX_FIFO_SIZE && !intq_empty(&txq); i++)
+      outb(THR_REG, intq_getc(&txq));
+  }
 
   /* Update interrupt enable register based on queue status. */
   write_ier();
@@ -2,7 +2,9 @@
 #include <console.h>
 #include <stdio.h>
 #include "devices/kbd.h"
+#include "devices/profile.h"
 #include "devices/serial.h"
+#include "devices/trace.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/thread.h"
@@ -124,4 +126,6 @@ static void print_stats(void) {
 #ifdef USERPROG
   exception_print_stats();
 #endif
+  profile_print_stats();
+  trace_print_stats();
 }
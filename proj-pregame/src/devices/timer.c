@@ -4,6 +4,7 @@
 #include <round.h>
 #include <stdio.h>
 #include "devices/pit.h"
+#include "devices/profile.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
@@ -20,26 +21,75 @@
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* Threads sleeping in timer_sleep(), in the order they are to
+   wake up: by wakeup_tick, and in the order they went to sleep
+   among those to wake at the same tick. */
+static struct rb_tree sleep_tree;
+
+/* Wakes the sleepers once the timer interrupt returns. */
+static struct intr_deferred wake_work;
+
+/* Tickless idle, with the "-tickless" option: while the idle
+   thread runs, the PIT is set to interrupt at the first tick
+   something has to happen at, the next sleeper's wakeup tick or
+   at most TICKLESS_MAX ticks away, instead of at every tick.  The
+   interrupt then stands for all the ticks since the last one.  An
+   interrupt from another device ends the period early, counting
+   the ticks that have passed from what is left of it. */
+bool timer_tickless;
+
+#define TICK_COUNT ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ) /* PIT cycles per tick. */
+#define TICKLESS_MAX (65535 / TICK_COUNT)                   /* Most ticks in a period. */
+
+/* Ticks the next timer interrupt stands for. */
+static int64_t period_ticks = 1;
+
+/* If the PIT's period is not TICK_COUNT, what it is instead, so
+   that the next timer interrupt puts it back. */
+static uint16_t period_count;
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/* Nanoseconds per timer tick. */
+#define NS_PER_TICK (1000 * 1000 * 1000 / TIMER_FREQ)
+
+/* Ticks over which the time stamp counter is calibrated. */
+#define TSC_CALIBRATE_TICKS 5
+
+/* Time stamp counter cycles per timer tick, or 0 until
+   timer_calibrate() has measured it.  timer_ns() counts from
+   TSC_BASE, read at the nanosecond NS_BASE. */
+static uint64_t tsc_per_tick;
+static uint64_t tsc_base;
+static int64_t ns_base;
+
 static intr_handler_func timer_interrupt;
+static void advance(int64_t);
+static intr_deferred_func wake_sleepers;
+static rb_less_func wakes_earlier;
 static bool too_many_loops(unsigned loops);
 static void busy_wait(int64_t loops);
 static void real_time_sleep(int64_t num, int32_t denom);
 static void real_time_delay(int64_t num, int32_t denom);
+static uint64_t rdtsc(void);
 
 /* Sets up the timer to interrupt TIMER_FREQ times per second,
    and registers the corresponding interrupt. */
 void timer_init(void) {
+  rb_init(&sleep_tree, wakes_earlier, NULL);
+  intr_deferred_init(&wake_work, wake_sleepers, NULL);
   pit_configure_channel(0, 2, TIMER_FREQ);
   intr_register_ext(0x20, timer_interrupt, "8254 Timer");
 }
 
-/* Calibrates loops_per_tick, used to implement brief delays. */
+/* Calibrates loops_per_tick, used to implement brief delays,
+   and the rate of the time stamp counter, used by timer_ns(). */
 void timer_calibrate(void) {
   unsigned high_bit, test_bit;
+  int64_t start;
+  uint64_t tsc;
 
   ASSERT(intr_get_level() == INTR_ON);
   printf("Calibrating timer...  ");
@@ -58,7 +108,21 @@ void timer_calibrate(void) {
     if (!too_many_loops(loops_per_tick | test_bit))
       loops_per_tick |= test_bit;
 
-  printf("%'" PRIu64 " loops/s.\n", (uint64_t)loops_per_tick * TIMER_FREQ);
+  /* Count cycles from one tick to another TSC_CALIBRATE_TICKS
+     later. */
+  start = ticks;
+  while (ticks == start)
+    barrier();
+  tsc = rdtsc();
+  start = ticks;
+  while (ticks - start < TSC_CALIBRATE_TICKS)
+    barrier();
+  tsc_base = rdtsc();
+  ns_base = ticks * NS_PER_TICK;
+  tsc_per_tick = (tsc_base - tsc) / TSC_CALIBRATE_TICKS;
+
+  printf("%'" PRIu64 " loops/s, %'" PRIu64 " TSC cycles/s.\n",
+         (uint64_t)loops_per_tick * TIMER_FREQ, tsc_per_tick * TIMER_FREQ);
 }
 
 /* Returns the number of timer ticks since the OS booted. */
@@ -73,14 +137,50 @@ int64_t timer_ticks(void) {
    should be a value once returned by timer_ticks(). */
 int64_t timer_elapsed(int64_t then) { return timer_ticks() - then; }
 
+/* Returns the number of nanoseconds since the OS booted, from
+   the time stamp counter.  It never goes backward, and keeps
+   pace with timer_ticks(), but is only as fine as a timer tick
+   until timer_calibrate() has run.  May be called with
+   interrupts off, and from an interrupt handler. */
+int64_t timer_ns(void) {
+  uint64_t cycles;
+
+  if (tsc_per_tick == 0)
+    return timer_ticks() * NS_PER_TICK;
+
+  /* Whole ticks and the rest apart, so that the product cannot
+     overflow. */
+  cycles = rdtsc() - tsc_base;
+  return ns_base + cycles / tsc_per_tick * NS_PER_TICK +
+         cycles % tsc_per_tick * NS_PER_TICK / tsc_per_tick;
+}
+
+/* Returns true if the thread A_ is to wake up before B_. */
+static bool wakes_earlier(const struct rb_node* a_, const struct rb_node* b_, void* aux UNUSED) {
+  const struct thread* a = rb_entry(a_, struct thread, sleepelem);
+  const struct thread* b = rb_entry(b_, struct thread, sleepelem);
+  return a->wakeup_tick < b->wakeup_tick;
+}
+
 /* Sleeps for approximately TICKS timer ticks.  Interrupts must
-   be turned on. */
+   be turned on.
+
+   The thread is blocked in sleep_tree until timer_interrupt()
+   finds its wakeup tick has come, so it takes no CPU time while
+   it sleeps. */
 void timer_sleep(int64_t ticks) {
-  int64_t start = timer_ticks();
+  struct thread* cur = thread_current();
+  enum intr_level old_level;
 
   ASSERT(intr_get_level() == INTR_ON);
-  while (timer_elapsed(start) < ticks)
-    thread_yield();
+  if (ticks <= 0)
+    return;
+
+  old_level = intr_disable();
+  cur->wakeup_tick = timer_ticks() + ticks;
+  rb_insert(&sleep_tree, &cur->sleepelem);
+  thread_block();
+  intr_set_level(old_level);
 }
 
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
@@ -122,13 +222,123 @@ void timer_udelay(int64_t us) { real_time_delay(us, 1000 * 1000); }
    instead if interrupts are enabled.*/
 void timer_ndelay(int64_t ns) { real_time_delay(ns, 1000 * 1000 * 1000); }
 
+/* Called by the idle thread, with interrupts off, just before
+   it halts the CPU.  With tickless idle, sets the PIT to
+   interrupt at the next tick anything is due at, keeping ticks
+   on the boundaries they would have had. */
+void timer_idle(void) {
+  int64_t wait = TICKLESS_MAX;
+  unsigned left;
+
+  ASSERT(intr_get_level() == INTR_OFF);
+
+  if (!timer_tickless || period_count != 0)
+    return;
+
+  if (!rb_empty(&sleep_tree)) {
+    int64_t wakeup = rb_entry(rb_first(&sleep_tree), struct thread, sleepelem)->wakeup_tick;
+    if (wakeup - ticks < wait)
+      wait = wakeup - ticks;
+  }
+  /* The MLFQS does its work once a second, at the tick itself. */
+  if (active_sched_policy == SCHED_MLFQS && TIMER_FREQ - ticks % TIMER_FREQ < wait)
+    wait = TIMER_FREQ - ticks % TIMER_FREQ;
+  if (wait <= 1)
+    return;
+
+  /* What is left of the current tick, then whole ones. */
+  left = pit_read_count(0);
+  period_count = left + (wait - 1) * TICK_COUNT;
+  period_ticks = wait;
+  pit_set_count(0, 2, period_count);
+}
+
+/* Called on every external interrupt but the timer's, before its
+   handler runs.  Ends a tickless period, counting the ticks it
+   lasted so far, and sets the PIT to interrupt at the end of the
+   current tick, from which on it is periodic again. */
+void timer_interrupted(void) {
+  unsigned first, elapsed, next;
+  int64_t passed = 0;
+
+  if (period_count == 0 || period_ticks == 1)
+    return;
+
+  /* The period began with what was left of a tick. */
+  first = period_count - (period_ticks - 1) * TICK_COUNT;
+  elapsed = period_count - pit_read_count(0);
+  if (elapsed >= first)
+    passed = 1 + (elapsed - first) / TICK_COUNT;
+  next = first + passed * TICK_COUNT - elapsed;
+
+  /* A count of 1 is not allowed in mode 2. */
+  period_count = next < 2 ? 2 : next;
+  period_ticks = 1;
+  pit_set_count(0, 2, period_count);
+  advance(passed);
+}
+
 /* Prints timer statistics. */
 void timer_print_stats(void) { printf("Timer: %" PRId64 " ticks\n", timer_ticks()); }
 
-/* Timer interrupt handler. */
-static void timer_interrupt(struct intr_frame* args UNUSED) {
-  ticks++;
-  thread_tick();
+/* Returns the first sleeper in sleep_tree if its wakeup tick
+   has come, and otherwise a null pointer.  Interrupts must be
+   off. */
+static struct thread* first_due(void) {
+  struct thread* t;
+
+  if (rb_empty(&sleep_tree))
+    return NULL;
+  t = rb_entry(rb_first(&sleep_tree), struct thread, sleepelem);
+  return t->wakeup_tick <= ticks ? t : NULL;
+}
+
+/* Counts N ticks, leaving the threads whose wakeup tick has come
+   to be woken once the interrupt returns. */
+static void advance(int64_t n) {
+  while (n-- > 0) {
+    ticks++;
+    thread_tick();
+  }
+  if (first_due() != NULL)
+    intr_defer(&wake_work);
+}
+
+/* Wakes the threads whose wakeup tick has come, which are first
+   in sleep_tree, so that it looks at no more sleepers than it
+   wakes.  Deferred work, which turns interrupts off only to wake
+   one sleeper at a time. */
+static void wake_sleepers(void* aux UNUSED) {
+  for (;;) {
+    enum intr_level old_level = intr_disable();
+    struct thread* t = first_due();
+    if (t != NULL) {
+      rb_remove(&sleep_tree, &t->sleepelem);
+      thread_unblock(t);
+    }
+    intr_set_level(old_level);
+    if (t == NULL)
+      break;
+  }
+}
+
+/* Timer interrupt handler.  Counts the ticks since the last one,
+   more than one at the end of a tickless period, after which it
+   puts the PIT back to a tick a period. */
+static void timer_interrupt(struct intr_frame* args) {
+  int64_t n = period_ticks;
+
+  if (profile_enabled)
+    profile_sample(args);
+
+  if (period_count != 0) {
+    pit_set_count(0, 2, TICK_COUNT);
+    period_count = 0;
+    period_ticks = 1;
+  }
+
+  advance(n);
+  thread_preempt();
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
@@ -185,8 +395,24 @@ static void real_time_sleep(int64_t num, int32_t denom) {
 
 /* Busy-wait for approximately NUM/DENOM seconds. */
 static void real_time_delay(int64_t num, int32_t denom) {
-  /* Scale the numerator and denominator down by 1000 to avoid
-     the possibility of overflow. */
   ASSERT(denom % 1000 == 0);
-  busy_wait(loops_per_tick * num / 1000 * TIMER_FREQ / (denom / 1000));
+
+  if (tsc_per_tick != 0) {
+    /* Watch the clock, which does not depend on how fast the
+       loop happens to run. */
+    int64_t end = timer_ns() + num * (1000 * 1000 * 1000 / denom);
+    while (timer_ns() < end)
+      barrier();
+  } else {
+    /* Scale the numerator and denominator down by 1000 to avoid
+       the possibility of overflow. */
+    busy_wait(loops_per_tick * num / 1000 * TIMER_FREQ / (denom / 1000));
+  }
+}
+
+/* Reads the processor's time stamp counter. */
+static uint64_t rdtsc(void) {
+  uint64_t tsc;
+  asm volatile("rdtsc" : "=A"(tsc));
+  return tsc;
 }
@@ -0,0 +1,98 @@
+#include "devices/trace.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* A tracer, with the "-trace" option.  Tracepoints throughout the
+   kernel record timestamped events in a ring buffer, which keeps
+   the latest TRACE_PAGES worth of them.  At shutdown they are
+   printed, oldest first, in a form the "pintos-trace" utility
+   turns into Chrome trace JSON, for chrome://tracing or Perfetto:
+
+     grep '^Trace: [0-9]' OUTPUT | pintos-trace > trace.json */
+bool trace_enabled;
+
+/* A recorded event. */
+struct trace_rec {
+  int64_t ns;    /* When, from timer_ns(). */
+  tid_t tid;     /* Thread running. */
+  uint32_t type; /* A trace_type. */
+  uint32_t a, b; /* Arguments. */
+};
+
+/* The ring buffer.  Event number N goes in slot N % REC_CNT,
+   overwriting the one REC_CNT events older. */
+#define TRACE_PAGES 16
+#define REC_CNT (TRACE_PAGES * PGSIZE / sizeof(struct trace_rec))
+static struct trace_rec* recs;
+static uint64_t rec_cnt; /* Events recorded. */
+
+/* Names of the trace types, as printed. */
+static const char* type_names[TRACE_TYPE_CNT] = {
+    [TRACE_SCHEDULE] = "schedule",       [TRACE_BLOCK] = "block",
+    [TRACE_UNBLOCK] = "unblock",         [TRACE_SEMA_DOWN] = "sema_down",
+    [TRACE_SEMA_UP] = "sema_up",         [TRACE_BLOCK_READ] = "block_read",
+    [TRACE_BLOCK_WRITE] = "block_write", [TRACE_BLOCK_DONE] = "block_done",
+    [TRACE_PAGE_FAULT] = "page_fault",   [TRACE_SYSCALL] = "syscall",
+};
+
+/* Allocates the ring buffer, if tracing is enabled. */
+void trace_init(void) {
+  if (!trace_enabled)
+    return;
+  recs = palloc_get_multiple(PAL_ASSERT | PAL_ZERO, TRACE_PAGES);
+}
+
+/* Records an event of TYPE with arguments A and B.  Called
+   through TRACE, from any context. */
+void trace_record(enum trace_type type, uint32_t a, uint32_t b) {
+  struct thread* t;
+  enum intr_level old_level;
+  struct trace_rec* r;
+
+  ASSERT(type < TRACE_TYPE_CNT);
+
+  /* thread_current() insists that the thread be running, which
+     in schedule() it no longer is, so find it the way
+     running_thread() does, from the stack pointer. */
+  t = pg_round_down(&type);
+
+  old_level = intr_disable();
+  if (recs != NULL) {
+    r = &recs[rec_cnt++ % REC_CNT];
+    r->ns = timer_ns();
+    r->tid = t->tid;
+    r->type = type;
+    r->a = a;
+    r->b = b;
+  }
+  intr_set_level(old_level);
+}
+
+/* Prints the events recorded and stops tracing. */
+void trace_print_stats(void) {
+  struct trace_rec* ring = recs;
+  enum intr_level old_level;
+  uint64_t first, i;
+
+  if (ring == NULL)
+    return;
+
+  old_level = intr_disable();
+  recs = NULL;
+  intr_set_level(old_level);
+
+  first = rec_cnt > REC_CNT ? rec_cnt - REC_CNT : 0;
+  printf("Trace: %" PRIu64 " events, %" PRIu64 " overwritten\n", rec_cnt, first);
+  for (i = first; i < rec_cnt; i++) {
+    struct trace_rec* r = &ring[i % REC_CNT];
+    printf("Trace: %" PRId64 " %d %s %#" PRIx32 " %#" PRIx32 "\n", r->ns, r->tid,
+           type_names[r->type], r->a, r->b);
+  }
+  palloc_free_multiple(ring, TRACE_PAGES);
+}
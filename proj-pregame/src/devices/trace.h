@@ -0,0 +1,35 @@
+#ifndef DEVICES_TRACE_H
+#define DEVICES_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* -trace: Record trace events? */
+extern bool trace_enabled;
+
+/* Kinds of trace events, and what their two arguments are. */
+enum trace_type {
+  TRACE_SCHEDULE,    /* Switch to another thread: its tid, the old thread's status. */
+  TRACE_BLOCK,       /* Thread blocks. */
+  TRACE_UNBLOCK,     /* Thread unblocks another: its tid. */
+  TRACE_SEMA_DOWN,   /* Semaphore down: its address, its value. */
+  TRACE_SEMA_UP,     /* Semaphore up: its address, its value. */
+  TRACE_BLOCK_READ,  /* Block read submitted: first sector, sector count. */
+  TRACE_BLOCK_WRITE, /* Block write submitted: first sector, sector count. */
+  TRACE_BLOCK_DONE,  /* Block request done: first sector, sector count. */
+  TRACE_PAGE_FAULT,  /* Page fault: faulting address, error code. */
+  TRACE_SYSCALL,     /* System call: its number. */
+  TRACE_TYPE_CNT
+};
+
+/* Records an event of TYPE with arguments A and B, if tracing.
+   A macro, so that a tracepoint costs only the test while
+   tracing is off. */
+#define TRACE(TYPE, A, B)                                                                          \
+  (trace_enabled ? trace_record(TYPE, (uint32_t)(A), (uint32_t)(B)) : (void)0)
+
+void trace_init(void);
+void trace_record(enum trace_type, uint32_t a, uint32_t b);
+void trace_print_stats(void);
+
+#endif /* devices/trace.h */
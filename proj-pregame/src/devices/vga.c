@@ -29,6 +29,7 @@ static uint8_t (*fb)[COL_CNT][2];
 static void clear_row(size_t y);
 static void cls(void);
 static void newline(void);
+static void put(uint8_t c, enum intr_level level);
 static void move_cursor(void);
 static void find_cursor(size_t* x, size_t* y);
 
@@ -46,12 +47,32 @@ static void init(void) {
 /* Writes C to the VGA text display, interpreting control
    characters in the conventional ways.  */
 void vga_putc(int c) {
+  char byte = c;
+  vga_write(&byte, 1);
+}
+
+/* Writes the CNT characters in BUF to the VGA text display, as
+   vga_putc() would one at a time, but moving the hardware cursor
+   only once at the end. */
+void vga_write(const char* buf, size_t cnt) {
   /* Disable interrupts to lock out interrupt handlers
      that might write to the console. */
   enum intr_level old_level = intr_disable();
 
   init();
 
+  while (cnt-- > 0)
+    put(*buf++, old_level);
+
+  /* Update cursor position. */
+  move_cursor();
+
+  intr_set_level(old_level);
+}
+
+/* Writes C at the cursor and advances it.  Interrupts must be
+   off; LEVEL is what to restore them to while beeping. */
+static void put(uint8_t c, enum intr_level level) {
   switch (c) {
     case '\n':
       newline();
@@ -77,7 +98,7 @@ void vga_putc(int c) {
       break;
 
     case '\a':
-      intr_set_level(old_level);
+      intr_set_level(level);
       speaker_beep();
       intr_disable();
       break;
@@ -89,11 +110,6 @@ void vga_putc(int c) {
         newline();
       break;
   }
-
-  /* Update cursor position. */
-  move_cursor();
-
-  intr_set_level(old_level);
 }
 
 /* Clears the screen and moves the cursor to the upper left. */
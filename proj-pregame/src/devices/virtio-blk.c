@@ -0,0 +1,308 @@
+#include "devices/virtio-blk.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "devices/block.h"
+#include "devices/partition.h"
+#include "devices/pci.h"
+#include "threads/interrupt.h"
+#include "threads/io.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* The code in this file is a driver for virtio block devices,
+   the disks that QEMU and other hypervisors offer guests as a
+   cheaper alternative to emulated IDE.  It uses the legacy PCI
+   interface of [VIRTIO].
+
+   Requests go to the device through a ring of descriptors in
+   memory that the device reads and writes itself, so there is
+   no data to move through ports, and many requests can be
+   outstanding at once: the device interrupts as it finishes
+   them, in whatever order suits it. */
+
+/* PCI IDs of a legacy virtio block device. */
+#define VIRTIO_VENDOR 0x1af4
+#define VIRTIO_BLK_DEVICE 0x1001
+
+/* Legacy virtio registers, in I/O space at the base given by
+   BAR 0. */
+#define reg_features(DISK) ((DISK)->io_base + 0x00)       /* Device features. */
+#define reg_guest_features(DISK) ((DISK)->io_base + 0x04) /* Driver features. */
+#define reg_queue_pfn(DISK) ((DISK)->io_base + 0x08)      /* Queue page number. */
+#define reg_queue_size(DISK) ((DISK)->io_base + 0x0c)     /* Queue size (r/o). */
+#define reg_queue_select(DISK) ((DISK)->io_base + 0x0e)   /* Queue select. */
+#define reg_queue_notify(DISK) ((DISK)->io_base + 0x10)   /* Queue notify. */
+#define reg_status(DISK) ((DISK)->io_base + 0x12)         /* Device status. */
+#define reg_isr(DISK) ((DISK)->io_base + 0x13)            /* ISR status. */
+#define reg_capacity(DISK) ((DISK)->io_base + 0x14)       /* Capacity, 64 bits. */
+
+/* Device Status Register bits. */
+#define STATUS_ACKNOWLEDGE 0x01 /* Driver has noticed the device. */
+#define STATUS_DRIVER 0x02      /* Driver knows how to drive it. */
+#define STATUS_DRIVER_OK 0x04   /* Driver is ready. */
+
+/* ISR Status Register bits. */
+#define ISR_QUEUE 0x01 /* The device has used buffers. */
+
+/* A virtqueue descriptor, naming a buffer. */
+struct vring_desc {
+  uint64_t addr;  /* Physical address. */
+  uint32_t len;   /* Length in bytes. */
+  uint16_t flags; /* VRING_DESC_F_*. */
+  uint16_t next;  /* Next in the chain, if VRING_DESC_F_NEXT. */
+};
+
+#define VRING_DESC_F_NEXT 1  /* NEXT is valid. */
+#define VRING_DESC_F_WRITE 2 /* The device writes the buffer. */
+
+/* The ring of chains the driver offers the device. */
+struct vring_avail {
+  uint16_t flags;
+  volatile uint16_t idx; /* Where the next entry goes, mod the size. */
+  uint16_t ring[];       /* Head descriptor of each chain. */
+};
+
+/* An entry in the ring of chains the device has used. */
+struct vring_used_elem {
+  uint32_t id;  /* Head descriptor of the chain. */
+  uint32_t len; /* Bytes written into it. */
+};
+
+/* The ring of chains the device gives back. */
+struct vring_used {
+  uint16_t flags;
+  volatile uint16_t idx; /* Where the next entry goes, mod the size. */
+  struct vring_used_elem ring[];
+};
+
+/* The header that starts a virtio block request. */
+struct virtio_blk_header {
+  uint32_t type;     /* VIRTIO_BLK_T_*. */
+  uint32_t reserved; /* Must be zero. */
+  uint64_t sector;   /* First sector. */
+};
+
+#define VIRTIO_BLK_T_IN 0  /* Read. */
+#define VIRTIO_BLK_T_OUT 1 /* Write. */
+
+/* Most requests outstanding on one disk.  Each takes a chain of
+   three descriptors: the header, the data, and a status byte. */
+#define SLOT_CNT 32
+
+/* An outstanding request.  Its header and status must be where
+   the device can find them by physical address. */
+struct slot {
+  struct list_elem elem;         /* In the disk's free_slots. */
+  struct virtio_blk_header hdr;  /* Read by the device. */
+  uint8_t status;                /* Written by the device: 0 on success. */
+  struct block_request* request; /* The request being carried out. */
+};
+
+/* A virtio block device. */
+struct vblk_disk {
+  char name[8];     /* Name, e.g. "vda". */
+  uint16_t io_base; /* Base I/O port. */
+  uint8_t irq;      /* Interrupt in use. */
+  bool irq_first;   /* The first disk with IRQ, which registered it? */
+  uint16_t size;    /* Entries in the queue. */
+
+  struct vring_desc* desc;   /* Descriptor table. */
+  struct vring_avail* avail; /* Available ring. */
+  struct vring_used* used;   /* Used ring, or null if the disk is not set up. */
+  uint16_t used_idx;         /* Next entry of USED to look at. */
+
+  /* Guarded by disabling interrupts. */
+  struct list free_slots;    /* Slots not in use. */
+  struct semaphore free_cnt; /* Number of free slots. */
+  struct slot slots[SLOT_CNT];
+};
+
+/* We support a few disks, named vda, vdb... in bus order. */
+#define DISK_MAX 4
+static struct vblk_disk disks[DISK_MAX];
+static size_t disk_cnt;
+
+static struct block_operations vblk_operations;
+
+static bool setup_disk(struct vblk_disk*, const struct pci_dev*);
+static void interrupt_handler(struct intr_frame*);
+
+/* Finds virtio block devices and registers them. */
+void virtio_blk_init(void) {
+  struct pci_dev pci;
+
+  while (disk_cnt < DISK_MAX &&
+         pci_find_device(VIRTIO_VENDOR, VIRTIO_BLK_DEVICE, disk_cnt, &pci)) {
+    struct vblk_disk* d = &disks[disk_cnt++];
+    uint64_t capacity;
+    struct block* block;
+    size_t i;
+
+    snprintf(d->name, sizeof d->name, "vd%c", 'a' + (int)(d - disks));
+    if (!setup_disk(d, &pci))
+      continue;
+
+    /* Several disks may share an interrupt line. */
+    d->irq_first = true;
+    for (i = 0; d->irq_first && disks + i < d; i++)
+      if (disks[i].irq == d->irq && disks[i].irq_first)
+        d->irq_first = false;
+    if (d->irq_first)
+      intr_register_ext(d->irq, interrupt_handler, d->name);
+
+    capacity = inl(reg_capacity(d)) | (uint64_t)inl(reg_capacity(d) + 4) << 32;
+    if (capacity > (block_sector_t)-1) {
+      printf("%s: ignoring disk too big to address\n", d->name);
+      continue;
+    }
+    block = block_register(d->name, BLOCK_RAW, "virtio", capacity, &vblk_operations, d);
+    partition_scan(block);
+  }
+}
+
+/* Resets the device at PCI for use as disk D and sets up its
+   queue.  Returns true if successful, false otherwise. */
+static bool setup_disk(struct vblk_disk* d, const struct pci_dev* pci) {
+  uint32_t bar = pci_read_config(pci, PCI_REG_BAR0);
+  uint8_t line = pci_read_config(pci, PCI_REG_INTR) & 0xff;
+  size_t avail_bytes, pages, i;
+  uint8_t* queue;
+
+  if ((bar & 1) == 0 || line == 0 || line >= 16) {
+    printf("%s: no I/O ports or interrupt line\n", d->name);
+    return false;
+  }
+  d->io_base = bar & 0xfffc;
+  d->irq = 0x20 + line;
+  pci_write_config(pci, PCI_REG_COMMAND,
+                   (pci_read_config(pci, PCI_REG_COMMAND) & 0xffff) | PCI_COMMAND_IO |
+                       PCI_COMMAND_MASTER);
+
+  /* Reset, say we are here, and ask for none of the optional
+     features. */
+  outb(reg_status(d), 0);
+  outb(reg_status(d), STATUS_ACKNOWLEDGE);
+  outb(reg_status(d), STATUS_ACKNOWLEDGE | STATUS_DRIVER);
+  inl(reg_features(d));
+  outl(reg_guest_features(d), 0);
+
+  /* Lay out queue 0 as the legacy interface requires: the
+     descriptor table and available ring, then the used ring at
+     the next page boundary. */
+  outw(reg_queue_select(d), 0);
+  d->size = inw(reg_queue_size(d));
+  if (d->size < SLOT_CNT * 3) {
+    printf("%s: queue too small\n", d->name);
+    return false;
+  }
+  avail_bytes = ROUND_UP(sizeof *d->desc * d->size + sizeof *d->avail + 2 * (d->size + 1), PGSIZE);
+  pages = DIV_ROUND_UP(avail_bytes + sizeof *d->used + sizeof *d->used->ring * d->size + 2, PGSIZE);
+  queue = palloc_get_multiple(PAL_ZERO, pages);
+  if (queue == NULL) {
+    printf("%s: out of memory for queue\n", d->name);
+    return false;
+  }
+  d->desc = (struct vring_desc*)queue;
+  d->avail = (struct vring_avail*)(queue + sizeof *d->desc * d->size);
+  d->used_idx = 0;
+  outl(reg_queue_pfn(d), vtop(queue) >> PGBITS);
+
+  /* Each slot owns three descriptors, chained for good. */
+  list_init(&d->free_slots);
+  sema_init(&d->free_cnt, SLOT_CNT);
+  for (i = 0; i < SLOT_CNT; i++) {
+    struct slot* s = &d->slots[i];
+    struct vring_desc* desc = &d->desc[i * 3];
+
+    desc[0].addr = vtop(&s->hdr);
+    desc[0].len = sizeof s->hdr;
+    desc[0].flags = VRING_DESC_F_NEXT;
+    desc[0].next = i * 3 + 1;
+    desc[1].next = i * 3 + 2;
+    desc[2].addr = vtop(&s->status);
+    desc[2].len = sizeof s->status;
+    desc[2].flags = VRING_DESC_F_WRITE;
+    list_push_back(&d->free_slots, &s->elem);
+  }
+
+  d->used = (struct vring_used*)(queue + avail_bytes);
+  outb(reg_status(d), STATUS_ACKNOWLEDGE | STATUS_DRIVER | STATUS_DRIVER_OK);
+  return true;
+}
+
+/* Offers request R to disk D_'s device, waiting for a free slot
+   if all are in use.  R->buffer must be in kernel memory. */
+static void vblk_submit(void* d_, struct block_request* r) {
+  struct vblk_disk* d = d_;
+  enum intr_level old_level;
+  struct vring_desc* data;
+  struct slot* s;
+  size_t i;
+
+  ASSERT(is_kernel_vaddr(r->buffer));
+
+  sema_down(&d->free_cnt);
+  old_level = intr_disable();
+  s = list_entry(list_pop_front(&d->free_slots), struct slot, elem);
+  intr_set_level(old_level);
+
+  i = s - d->slots;
+  s->hdr.type = r->write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+  s->hdr.reserved = 0;
+  s->hdr.sector = r->sector;
+  s->status = 0xff;
+  s->request = r;
+  data = &d->desc[i * 3 + 1];
+  data->addr = vtop(r->buffer);
+  data->len = r->cnt * BLOCK_SECTOR_SIZE;
+  data->flags = VRING_DESC_F_NEXT | (r->write ? 0 : VRING_DESC_F_WRITE);
+
+  /* The device must see the chain before the ring entry, and the
+     entry before the new index. */
+  old_level = intr_disable();
+  d->avail->ring[d->avail->idx % d->size] = i * 3;
+  barrier();
+  d->avail->idx++;
+  barrier();
+  outw(reg_queue_notify(d), 0);
+  intr_set_level(old_level);
+}
+
+static struct block_operations vblk_operations = {NULL, NULL, NULL, NULL, vblk_submit};
+
+/* Completes the requests that disk D's device has used. */
+static void complete_requests(struct vblk_disk* d) {
+  while (d->used_idx != d->used->idx) {
+    struct vring_used_elem* e;
+    struct slot* s;
+
+    barrier();
+    e = &d->used->ring[d->used_idx++ % d->size];
+    s = &d->slots[e->id / 3];
+    if (s->status != 0)
+      PANIC("%s: disk %s failed, sector=%" PRDSNu, d->name, s->request->write ? "write" : "read",
+            s->request->sector);
+
+    block_request_done(s->request);
+    list_push_back(&d->free_slots, &s->elem);
+    sema_up(&d->free_cnt);
+  }
+}
+
+/* Virtio interrupt handler, for every disk on the line. */
+static void interrupt_handler(struct intr_frame* f) {
+  size_t i;
+
+  for (i = 0; i < disk_cnt; i++) {
+    struct vblk_disk* d = &disks[i];
+
+    /* Reading the ISR status acknowledges the interrupt. */
+    if (d->used != NULL && d->irq == f->vec_no && (inb(reg_isr(d)) & ISR_QUEUE) != 0)
+      complete_requests(d);
+  }
+}
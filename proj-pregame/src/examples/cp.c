@@ -31,16 +31,10 @@ int main(int argc, char* argv[]) {
     return EXIT_FAILURE;
   }
 
-  /* Copy data. */
-  for (;;) {
-    char buffer[1024];
-    int bytes_read = read(in_fd, buffer, sizeof buffer);
-    if (bytes_read == 0)
-      break;
-    if (write(out_fd, buffer, bytes_read) != bytes_read) {
-      printf("%s: write failed\n", argv[2]);
-      return EXIT_FAILURE;
-    }
+  /* Copy data, in the kernel. */
+  if (sendfile(out_fd, in_fd, filesize(in_fd)) != filesize(in_fd)) {
+    printf("%s: write failed\n", argv[2]);
+    return EXIT_FAILURE;
   }
 
   return EXIT_SUCCESS;
@@ -12,6 +12,31 @@
 #include <stdio.h>
 #include <string.h>
 
+/* Prints NAME, an entry in DIR, and if VERBOSE is true, what it
+   is. */
+static void list_entry(const char* dir, const char* name, bool verbose) {
+  printf("%s", name);
+  if (verbose) {
+    char full_name[128];
+    int entry_fd;
+
+    snprintf(full_name, sizeof full_name, "%s/%s", dir, name);
+    entry_fd = open(full_name);
+
+    printf(": ");
+    if (entry_fd != -1) {
+      if (isdir(entry_fd))
+        printf("directory");
+      else
+        printf("%d-byte file", filesize(entry_fd));
+      printf(", inumber %d", inumber(entry_fd));
+    } else
+      printf("open failed");
+    close(entry_fd);
+  }
+  printf("\n");
+}
+
 static bool list_dir(const char* dir, bool verbose) {
   int dir_fd = open(dir);
   if (dir_fd == -1) {
@@ -20,34 +45,19 @@ static bool list_dir(const char* dir, bool verbose) {
   }
 
   if (isdir(dir_fd)) {
-    char name[READDIR_MAX_LEN];
+    char names[512];
+    int n;
 
     printf("%s", dir);
     if (verbose)
       printf(" (inumber %d)", inumber(dir_fd));
     printf(":\n");
 
-    while (readdir(dir_fd, name)) {
-      printf("%s", name);
-      if (verbose) {
-        char full_name[128];
-        int entry_fd;
-
-        snprintf(full_name, sizeof full_name, "%s/%s", dir, name);
-        entry_fd = open(full_name);
-
-        printf(": ");
-        if (entry_fd != -1) {
-          if (isdir(entry_fd))
-            printf("directory");
-          else
-            printf("%d-byte file", filesize(entry_fd));
-          printf(", inumber %d", inumber(entry_fd));
-        } else
-          printf("open failed");
-        close(entry_fd);
-      }
-      printf("\n");
+    /* Many names come back from each call. */
+    while ((n = getdents(dir_fd, names, sizeof names)) > 0) {
+      const char* name;
+      for (name = names; name < names + n; name += strlen(name) + 1)
+        list_entry(dir, name, verbose);
     }
   } else
     printf("%s: not a directory\n", dir);
@@ -8,6 +8,7 @@
    and store the result back to the file system!
  */
 
+#include <parallel.h>
 #include <stdio.h>
 #include <syscall.h>
 
@@ -28,13 +29,26 @@
  16,384 3,145,728 kB */
 #define DIM 128
 
+/* Threads that share the multiplication. */
+#define THREAD_CNT 4
+
 int A[DIM][DIM];
 int B[DIM][DIM];
 int C[DIM][DIM];
 
-int main(void) {
+/* Computes rows START through END - 1 of C. */
+static void multiply_rows(int start, int end, void* aux UNUSED) {
   int i, j, k;
 
+  for (i = start; i < end; i++)
+    for (j = 0; j < DIM; j++)
+      for (k = 0; k < DIM; k++)
+        C[i][j] += A[i][k] * B[k][j];
+}
+
+int main(void) {
+  int i, j;
+
   /* Initialize the matrices. */
   for (i = 0; i < DIM; i++)
     for (j = 0; j < DIM; j++) {
@@ -43,11 +57,8 @@ int main(void) {
       C[i][j] = 0;
     }
 
-  /* Multiply matrices. */
-  for (i = 0; i < DIM; i++)
-    for (j = 0; j < DIM; j++)
-      for (k = 0; k < DIM; k++)
-        C[i][j] += A[i][k] * B[k][j];
+  /* Multiply matrices, a band of rows in each thread. */
+  parallel_for(0, DIM, THREAD_CNT, multiply_rows, NULL);
 
   /* Done. */
   exit(C[DIM - 1][DIM - 1]);
@@ -0,0 +1,457 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* The buffer cache: the file system's sectors, as they are on
+   disk or as they will be once written back.  All reads and
+   writes of fs_device go through it.
+
+   An entry is found by searching for its sector under
+   cache_lock, which also guards each entry's bookkeeping.  Its
+   data is guarded by its own readers-writer lock, so that any
+   number of threads may read it while none writes.  An entry is
+   pinned while a thread holds or waits for that lock, and only
+   an unpinned entry may be given to another sector, which the
+   clock hand picks the way the frame table does.
+
+   A write only marks the entry dirty.  Its sector is written
+   back when the entry is evicted, when the flusher thread wakes
+   up, every FLUSH_INTERVAL ticks, and when the file system is
+   shut down.  The exception is cache_write_multiple(), for runs
+   of whole sectors of file data, which goes straight to disk in
+   one request and only brings copies already in the cache up to
+   date.
+
+   Sectors asked for by cache_prefetch() are read in by the
+   prefetcher thread, in the order they were asked for, while the
+   thread that asked gets on with what it has.
+
+   A metadata write, through cache_write_logged(), also marks the
+   entry logged: it is part of the journal's running transaction,
+   and may not be written back, or evicted, until the journal has
+   committed it.  To leave room for other sectors, at most half of
+   the entries are logged at once; a metadata write past that is
+   an ordinary one. */
+
+/* Ticks between writing back all dirty entries. */
+#define FLUSH_INTERVAL TIMER_FREQ
+
+/* Most sectors waiting to be prefetched.  Requests beyond that
+   are dropped. */
+#define PREFETCH_MAX 32
+
+/* -cache: Number of entries in the buffer cache. */
+size_t cache_sectors = CACHE_SECTORS;
+
+/* A sector in the buffer cache. */
+struct cache_entry {
+  /* Guarded by cache_lock. */
+  block_sector_t sector; /* Sector held, if VALID. */
+  bool valid;            /* Holds a sector? */
+  bool accessed;         /* Used since the hand last passed it? */
+  int pins;              /* Threads holding or waiting for RW. */
+  bool writing;          /* Writing OLD_SECTOR back on eviction? */
+  block_sector_t old_sector;
+  bool logged; /* Waiting for the journal to commit it? */
+  bool stale;  /* Pinned by cache_write_multiple() to bring up to date? */
+
+  /* Guarded by RW. */
+  struct rw_lock rw;
+  bool dirty; /* Changed since read or written back? */
+  uint8_t data[BLOCK_SECTOR_SIZE];
+};
+
+static struct cache_entry* entries;
+static size_t hand;
+static struct lock cache_lock;
+static struct condition unpinned; /* Signaled when an entry is unpinned or unlogged. */
+static size_t logged_cnt;         /* Number of logged entries. */
+static size_t logged_max;         /* Most entries logged at once. */
+static struct condition written;  /* Signaled when an evicted sector is written. */
+
+/* Sectors to prefetch, a ring guarded by cache_lock. */
+static block_sector_t prefetch_queue[PREFETCH_MAX];
+static size_t prefetch_head, prefetch_cnt;
+static struct semaphore prefetch_wanted; /* Up once per queued sector. */
+
+static thread_func flusher, prefetcher;
+
+/* Initializes the buffer cache and starts the flusher thread. */
+void cache_init(void) {
+  size_t i;
+
+  if (cache_sectors == 0)
+    PANIC("cache_init: the cache needs at least one sector");
+  entries = calloc(cache_sectors, sizeof *entries);
+  if (entries == NULL)
+    PANIC("cache_init: out of memory");
+  for (i = 0; i < cache_sectors; i++)
+    rw_lock_init(&entries[i].rw);
+  logged_max = cache_sectors / 2 < JOURNAL_TXN_MAX ? cache_sectors / 2 : JOURNAL_TXN_MAX;
+  lock_init(&cache_lock);
+  cond_init(&unpinned);
+  cond_init(&written);
+  sema_init(&prefetch_wanted, 0);
+
+  thread_create("flusher", PRI_DEFAULT, flusher, NULL);
+  thread_create("prefetcher", PRI_DEFAULT, prefetcher, NULL);
+}
+
+/* Returns the entry that holds SECTOR, or a null pointer if there
+   is none.  cache_lock must be held. */
+static struct cache_entry* lookup(block_sector_t sector) {
+  size_t i;
+
+  for (i = 0; i < cache_sectors; i++)
+    if (entries[i].valid && entries[i].sector == sector)
+      return &entries[i];
+  return NULL;
+}
+
+/* Returns true if SECTOR is being written back from an entry that
+   was given to another sector.  cache_lock must be held. */
+static bool being_written(block_sector_t sector) {
+  size_t i;
+
+  for (i = 0; i < cache_sectors; i++)
+    if (entries[i].writing && entries[i].old_sector == sector)
+      return true;
+  return false;
+}
+
+/* Returns true if SECTOR is one of the CNT sectors from FIRST. */
+static bool in_run(block_sector_t sector, block_sector_t first, size_t cnt) {
+  return sector >= first && sector - first < cnt;
+}
+
+/* Returns true if any of the CNT sectors from FIRST is being
+   written back from an entry that was given to another sector.
+   cache_lock must be held. */
+static bool run_being_written(block_sector_t first, size_t cnt) {
+  size_t i;
+
+  for (i = 0; i < cache_sectors; i++)
+    if (entries[i].writing && in_run(entries[i].old_sector, first, cnt))
+      return true;
+  return false;
+}
+
+/* Picks an entry that is neither pinned nor logged by the clock
+   algorithm, waiting for one if need be.  cache_lock must be
+   held. */
+static struct cache_entry* pick_victim(void) {
+  for (;;) {
+    size_t looked;
+
+    /* Twice around clears every accessed bit. */
+    for (looked = 0; looked < 2 * cache_sectors; looked++) {
+      struct cache_entry* e = &entries[hand];
+
+      hand = (hand + 1) % cache_sectors;
+      if (e->pins > 0 || e->logged)
+        continue;
+      if (!e->valid || !e->accessed)
+        return e;
+      e->accessed = false;
+    }
+    cond_wait(&unpinned, &cache_lock);
+  }
+}
+
+/* Returns the entry for SECTOR, pinned, with its lock held for
+   reading if READER is true and for writing otherwise.  Its data
+   is the sector's, unless it was not in the cache and FILL is
+   false, in which case the caller is about to overwrite all of
+   it. */
+static struct cache_entry* cache_get(block_sector_t sector, bool reader, bool fill) {
+  struct cache_entry* e;
+  bool write_back;
+
+  lock_acquire(&cache_lock);
+  for (;;) {
+    e = lookup(sector);
+    if (e != NULL) {
+      e->pins++;
+      e->accessed = true;
+      lock_release(&cache_lock);
+      rw_lock_acquire(&e->rw, reader);
+      return e;
+    }
+
+    /* Reading the sector now would miss what is on its way to
+       disk. */
+    if (!being_written(sector))
+      break;
+    cond_wait(&written, &cache_lock);
+  }
+
+  e = pick_victim();
+  write_back = e->valid && e->dirty;
+  e->old_sector = e->sector;
+  e->writing = write_back;
+  e->sector = sector;
+  e->valid = true;
+  e->accessed = true;
+  e->pins = 1;
+
+  /* Nobody else had it pinned, so this does not block, and
+     whoever finds the entry from now on waits until it is
+     filled. */
+  rw_lock_acquire(&e->rw, RW_WRITER);
+  lock_release(&cache_lock);
+
+  if (write_back) {
+    block_write(fs_device, e->old_sector, e->data);
+    lock_acquire(&cache_lock);
+    e->writing = false;
+    cond_broadcast(&written, &cache_lock);
+    lock_release(&cache_lock);
+  }
+  e->dirty = false;
+  if (fill)
+    block_read(fs_device, sector, e->data);
+
+  if (reader) {
+    rw_lock_release(&e->rw, RW_WRITER);
+    rw_lock_acquire(&e->rw, RW_READER);
+  }
+  return e;
+}
+
+/* Releases entry E, which cache_get() returned with READER. */
+static void cache_put(struct cache_entry* e, bool reader) {
+  rw_lock_release(&e->rw, reader);
+  lock_acquire(&cache_lock);
+  if (--e->pins == 0)
+    cond_signal(&unpinned, &cache_lock);
+  lock_release(&cache_lock);
+}
+
+/* Reads SECTOR into BUFFER, which must have room for
+   BLOCK_SECTOR_SIZE bytes. */
+void cache_read(block_sector_t sector, void* buffer) {
+  cache_read_at(sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes SECTOR from BUFFER, which must contain BLOCK_SECTOR_SIZE
+   bytes. */
+void cache_write(block_sector_t sector, const void* buffer) {
+  cache_write_at(sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Reads SIZE bytes at offset OFS in SECTOR into BUFFER. */
+void cache_read_at(block_sector_t sector, void* buffer, size_t ofs, size_t size) {
+  struct cache_entry* e;
+
+  ASSERT(ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get(sector, RW_READER, true);
+  memcpy(buffer, e->data + ofs, size);
+  cache_put(e, RW_READER);
+}
+
+/* Writes SIZE bytes from BUFFER at offset OFS in SECTOR.  A write
+   of the whole sector does not read it first. */
+void cache_write_at(block_sector_t sector, const void* buffer, size_t ofs, size_t size) {
+  struct cache_entry* e;
+
+  ASSERT(ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get(sector, RW_WRITER, size < BLOCK_SECTOR_SIZE);
+  memcpy(e->data + ofs, buffer, size);
+  e->dirty = true;
+  cache_put(e, RW_WRITER);
+}
+
+/* Writes the CNT sectors from SECTOR, which hold file data, from
+   BUFFER straight to disk in one request, rather than giving each
+   an entry on its way there.  Entries that already hold any of
+   them are brought up to date. */
+void cache_write_multiple(block_sector_t sector, size_t cnt, const void* buffer) {
+  const uint8_t* data = buffer;
+  size_t i;
+
+  lock_acquire(&cache_lock);
+
+  /* An older copy on its way to disk must not land after this
+     one. */
+  while (run_being_written(sector, cnt))
+    cond_wait(&written, &cache_lock);
+
+  /* Entries that hold the sectors stay where they are until they
+     are brought up to date.  Holding cache_lock during the write
+     keeps any other entry from reading one in beforehand. */
+  for (i = 0; i < cache_sectors; i++) {
+    struct cache_entry* e = &entries[i];
+    if (e->valid && in_run(e->sector, sector, cnt)) {
+      e->pins++;
+      e->stale = true;
+    }
+  }
+  block_write_multiple(fs_device, sector, cnt, buffer);
+
+  for (i = 0; i < cache_sectors; i++) {
+    struct cache_entry* e = &entries[i];
+    if (e->stale && in_run(e->sector, sector, cnt)) {
+      e->stale = false;
+      lock_release(&cache_lock);
+      rw_lock_acquire(&e->rw, RW_WRITER);
+      memcpy(e->data, data + (e->sector - sector) * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE);
+
+      /* A write back of the old data may have raced with this
+         one, so write it again to be sure. */
+      e->dirty = true;
+      cache_put(e, RW_WRITER);
+      lock_acquire(&cache_lock);
+    }
+  }
+  lock_release(&cache_lock);
+}
+
+/* Writes SECTOR, which holds metadata, from BUFFER, which must
+   contain BLOCK_SECTOR_SIZE bytes. */
+void cache_write_logged(block_sector_t sector, const void* buffer) {
+  cache_write_logged_at(sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes SIZE bytes from BUFFER at offset OFS in SECTOR, which
+   holds metadata, adding SECTOR to the journal's running
+   transaction if the journal is open. */
+void cache_write_logged_at(block_sector_t sector, const void* buffer, size_t ofs, size_t size) {
+  struct cache_entry* e;
+
+  ASSERT(ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get(sector, RW_WRITER, size < BLOCK_SECTOR_SIZE);
+  memcpy(e->data + ofs, buffer, size);
+  e->dirty = true;
+  if (journal_enabled()) {
+    lock_acquire(&cache_lock);
+    if (!e->logged && logged_cnt < logged_max) {
+      e->logged = true;
+      logged_cnt++;
+    }
+    lock_release(&cache_lock);
+  }
+  cache_put(e, RW_WRITER);
+}
+
+/* Returns the number of entries that may still be logged. */
+size_t cache_log_room(void) {
+  size_t room;
+
+  lock_acquire(&cache_lock);
+  room = logged_max - logged_cnt;
+  lock_release(&cache_lock);
+  return room;
+}
+
+/* Stores the sectors of the logged entries in SECTORS and
+   returns how many there are. */
+size_t cache_logged(block_sector_t sectors[JOURNAL_TXN_MAX]) {
+  size_t cnt = 0;
+  size_t i;
+
+  lock_acquire(&cache_lock);
+  for (i = 0; i < cache_sectors; i++)
+    if (entries[i].logged)
+      sectors[cnt++] = entries[i].sector;
+  lock_release(&cache_lock);
+  return cnt;
+}
+
+/* Marks every logged entry unlogged, once the journal has
+   committed them, so that they are written back as usual. */
+void cache_unlog(void) {
+  size_t i;
+
+  lock_acquire(&cache_lock);
+  for (i = 0; i < cache_sectors; i++)
+    entries[i].logged = false;
+  logged_cnt = 0;
+  cond_broadcast(&unpinned, &cache_lock);
+  lock_release(&cache_lock);
+}
+
+/* Returns true if SECTOR is waiting to be prefetched.
+   cache_lock must be held. */
+static bool prefetch_queued(block_sector_t sector) {
+  size_t i;
+
+  for (i = 0; i < prefetch_cnt; i++)
+    if (prefetch_queue[(prefetch_head + i) % PREFETCH_MAX] == sector)
+      return true;
+  return false;
+}
+
+/* Asks for SECTOR to be read into the cache in the background,
+   unless it is there already. */
+void cache_prefetch(block_sector_t sector) {
+  lock_acquire(&cache_lock);
+  if (lookup(sector) == NULL && !prefetch_queued(sector) && prefetch_cnt < PREFETCH_MAX) {
+    prefetch_queue[(prefetch_head + prefetch_cnt++) % PREFETCH_MAX] = sector;
+    sema_up(&prefetch_wanted);
+  }
+  lock_release(&cache_lock);
+}
+
+/* Writes every dirty entry that is not logged back to disk. */
+void cache_flush(void) {
+  size_t i;
+
+  for (i = 0; i < cache_sectors; i++) {
+    struct cache_entry* e = &entries[i];
+
+    /* DIRTY is read without E's lock only to skip clean entries
+       cheaply; it is checked again below. */
+    lock_acquire(&cache_lock);
+    if (!e->valid || !e->dirty || e->logged) {
+      lock_release(&cache_lock);
+      continue;
+    }
+    e->pins++;
+    lock_release(&cache_lock);
+
+    /* Readers never change DIRTY, so holding the lock for reading
+       is enough to write the data back and clear it. */
+    rw_lock_acquire(&e->rw, RW_READER);
+    if (e->dirty) {
+      block_write(fs_device, e->sector, e->data);
+      e->dirty = false;
+    }
+    cache_put(e, RW_READER);
+  }
+}
+
+/* Reads in the sectors that cache_prefetch() queues. */
+static void prefetcher(void* aux UNUSED) {
+  for (;;) {
+    block_sector_t sector;
+
+    sema_down(&prefetch_wanted);
+    lock_acquire(&cache_lock);
+    sector = prefetch_queue[prefetch_head];
+    prefetch_head = (prefetch_head + 1) % PREFETCH_MAX;
+    prefetch_cnt--;
+    lock_release(&cache_lock);
+
+    cache_put(cache_get(sector, RW_READER, true), RW_READER);
+  }
+}
+
+/* Commits the journal and writes back dirty entries every
+   FLUSH_INTERVAL ticks, so that little is lost if the machine
+   goes down. */
+static void flusher(void* aux UNUSED) {
+  for (;;) {
+    timer_sleep(FLUSH_INTERVAL);
+    journal_commit();
+    cache_flush();
+  }
+}
@@ -0,0 +1,27 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stddef.h>
+#include "devices/block.h"
+#include "filesys/journal.h"
+
+/* Default number of sectors in the buffer cache. */
+#define CACHE_SECTORS 64
+
+extern size_t cache_sectors;
+
+void cache_init(void);
+void cache_read(block_sector_t, void* buffer);
+void cache_write(block_sector_t, const void* buffer);
+void cache_read_at(block_sector_t, void* buffer, size_t ofs, size_t size);
+void cache_write_at(block_sector_t, const void* buffer, size_t ofs, size_t size);
+void cache_write_multiple(block_sector_t, size_t cnt, const void* buffer);
+void cache_write_logged(block_sector_t, const void* buffer);
+void cache_write_logged_at(block_sector_t, const void* buffer, size_t ofs, size_t size);
+size_t cache_log_room(void);
+size_t cache_logged(block_sector_t sectors[JOURNAL_TXN_MAX]);
+void cache_unlog(void);
+void cache_prefetch(block_sector_t);
+void cache_flush(void);
+
+#endif /* filesys/cache.h */
@@ -1,10 +1,12 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* A directory. */
 struct dir {
@@ -19,10 +21,275 @@ struct dir_entry {
   bool in_use;                 /* In use or free? */
 };
 
+/* An in-memory index of the entries of a directory, built the
+   first time the directory is searched, so that finding a name
+   or a free slot does not read the whole directory.  Only the
+   functions here write directories, and they keep the index up
+   to date as they do. */
+struct dir_index {
+  struct list_elem elem;   /* In `indexes'. */
+  block_sector_t sector;   /* Directory's inode sector. */
+  struct hash names;       /* Entries in use, as `struct name's. */
+  struct list free_slots;  /* Entries not in use, as `struct slot's. */
+};
+
+/* An entry in use, in a directory's index. */
+struct name {
+  struct hash_elem elem;
+  char name[NAME_MAX + 1];     /* Null terminated file name. */
+  block_sector_t inode_sector; /* Sector number of header. */
+  off_t ofs;                   /* Byte offset of the entry. */
+};
+
+/* An entry not in use, in a directory's index. */
+struct slot {
+  struct list_elem elem;
+  off_t ofs; /* Byte offset of the entry. */
+};
+
+/* Most directories indexed at once.  Past this, the least
+   recently used index is dropped, to be built again if needed. */
+#define INDEX_MAX 16
+
+/* Directory indexes, most recently used first. */
+static struct list indexes;
+
+/* A name looked up in a directory, and what it was found to
+   be.  These cover many more directories than the indexes do, so
+   that walking a deep path finds each name in memory. */
+struct dentry {
+  struct hash_elem elem;       /* In `dentries'. */
+  struct list_elem lru_elem;   /* In `dentry_lru'. */
+  block_sector_t parent;       /* Directory's inode sector. */
+  char name[NAME_MAX + 1];     /* Null terminated file name. */
+  block_sector_t inode_sector; /* Sector number of header, or 0 if NAME is not there. */
+};
+
+/* Most names cached at once. */
+#define DENTRY_MAX 256
+
+static struct hash dentries;   /* Cached names, by directory and name. */
+static struct list dentry_lru; /* Cached names, most recently used first. */
+
+/* Guards the indexes and the cached names.  It is not held
+   while a directory is written, so changing entries in one
+   directory does not hold up lookups in another; a directory's
+   own lock, from inode_lock_dir(), keeps its index and names
+   from changing underneath it meanwhile, because every change
+   to them is made by a thread holding that lock. */
+static struct lock names_lock;
+
+static hash_hash_func name_hash;
+static hash_less_func name_less;
+static hash_hash_func dentry_hash;
+static hash_less_func dentry_less;
+
+/* Initializes the directory module. */
+void dir_init(void) {
+  lock_init(&names_lock);
+  list_init(&indexes);
+  list_init(&dentry_lru);
+  if (!hash_init(&dentries, dentry_hash, dentry_less, NULL))
+    PANIC("dir_init: out of memory");
+}
+
+static unsigned name_hash(const struct hash_elem* e, void* aux UNUSED) {
+  return hash_string(hash_entry(e, struct name, elem)->name);
+}
+
+static bool name_less(const struct hash_elem* a, const struct hash_elem* b, void* aux UNUSED) {
+  return strcmp(hash_entry(a, struct name, elem)->name, hash_entry(b, struct name, elem)->name) <
+         0;
+}
+
+static void free_name(struct hash_elem* e, void* aux UNUSED) {
+  free(hash_entry(e, struct name, elem));
+}
+
+/* Frees INDEX, which is not in `indexes'. */
+static void index_free(struct dir_index* index) {
+  while (!list_empty(&index->free_slots))
+    free(list_entry(list_pop_front(&index->free_slots), struct slot, elem));
+  hash_destroy(&index->names, free_name);
+  free(index);
+}
+
+/* Drops INDEX, for example because memory ran out while bringing
+   it up to date. */
+static void index_drop(struct dir_index* index) {
+  list_remove(&index->elem);
+  index_free(index);
+}
+
+/* Returns the index of the directory in SECTOR, or a null pointer
+   if it is not indexed. */
+static struct dir_index* index_find(block_sector_t sector) {
+  struct list_elem* e;
+
+  for (e = list_begin(&indexes); e != list_end(&indexes); e = list_next(e)) {
+    struct dir_index* index = list_entry(e, struct dir_index, elem);
+    if (index->sector == sector)
+      return index;
+  }
+  return NULL;
+}
+
+/* Adds the entry at OFS, named NAME and for the inode in
+   INODE_SECTOR, to INDEX.  Returns false if memory runs out. */
+static bool index_add_name(struct dir_index* index, const char* name,
+                           block_sector_t inode_sector, off_t ofs) {
+  struct name* n = malloc(sizeof *n);
+
+  if (n == NULL)
+    return false;
+  strlcpy(n->name, name, sizeof n->name);
+  n->inode_sector = inode_sector;
+  n->ofs = ofs;
+  hash_insert(&index->names, &n->elem);
+  return true;
+}
+
+/* Adds the free entry at OFS to INDEX.  Returns false if memory
+   runs out. */
+static bool index_add_slot(struct dir_index* index, off_t ofs) {
+  struct slot* s = malloc(sizeof *s);
+
+  if (s == NULL)
+    return false;
+  s->ofs = ofs;
+  list_push_back(&index->free_slots, &s->elem);
+  return true;
+}
+
+/* Returns the index of DIR, building it if need be, or a null
+   pointer if memory runs out. */
+static struct dir_index* get_index(const struct dir* dir) {
+  block_sector_t sector = inode_get_inumber(dir->inode);
+  struct dir_index* index = index_find(sector);
+  struct dir_entry e;
+  off_t ofs;
+
+  if (index != NULL) {
+    list_remove(&index->elem);
+    list_push_front(&indexes, &index->elem);
+    return index;
+  }
+
+  index = malloc(sizeof *index);
+  if (index == NULL)
+    return NULL;
+  if (!hash_init(&index->names, name_hash, name_less, NULL)) {
+    free(index);
+    return NULL;
+  }
+  index->sector = sector;
+  list_init(&index->free_slots);
+  list_push_front(&indexes, &index->elem);
+
+  for (ofs = 0; inode_read_at(dir->inode, &e, sizeof e, ofs) == sizeof e; ofs += sizeof e)
+    if (e.in_use ? !index_add_name(index, e.name, e.inode_sector, ofs)
+                 : !index_add_slot(index, ofs)) {
+      index_drop(index);
+      return NULL;
+    }
+
+  if (list_size(&indexes) > INDEX_MAX)
+    index_free(list_entry(list_pop_back(&indexes), struct dir_index, elem));
+  return index;
+}
+
+/* Returns the entry for NAME in INDEX, or a null pointer if there
+   is none. */
+static struct name* index_lookup(struct dir_index* index, const char* name) {
+  struct name key;
+  struct hash_elem* e;
+
+  strlcpy(key.name, name, sizeof key.name);
+  e = hash_find(&index->names, &key.elem);
+  return e != NULL ? hash_entry(e, struct name, elem) : NULL;
+}
+
+static unsigned dentry_hash(const struct hash_elem* e, void* aux UNUSED) {
+  const struct dentry* d = hash_entry(e, struct dentry, elem);
+  return hash_string(d->name) ^ hash_int(d->parent);
+}
+
+static bool dentry_less(const struct hash_elem* a_, const struct hash_elem* b_, void* aux UNUSED) {
+  const struct dentry* a = hash_entry(a_, struct dentry, elem);
+  const struct dentry* b = hash_entry(b_, struct dentry, elem);
+  return a->parent != b->parent ? a->parent < b->parent : strcmp(a->name, b->name) < 0;
+}
+
+/* Returns the cached entry for NAME in the directory in PARENT,
+   or a null pointer if there is none. */
+static struct dentry* dentry_find(block_sector_t parent, const char* name) {
+  struct dentry key;
+  struct hash_elem* e;
+
+  if (strlen(name) > NAME_MAX)
+    return NULL;
+  key.parent = parent;
+  strlcpy(key.name, name, sizeof key.name);
+  e = hash_find(&dentries, &key.elem);
+  return e != NULL ? hash_entry(e, struct dentry, elem) : NULL;
+}
+
+/* Forgets cached entry D. */
+static void dentry_drop(struct dentry* d) {
+  hash_delete(&dentries, &d->elem);
+  list_remove(&d->lru_elem);
+  free(d);
+}
+
+/* Forgets what is cached about NAME in the directory in PARENT. */
+static void dentry_invalidate(block_sector_t parent, const char* name) {
+  struct dentry* d = dentry_find(parent, name);
+  if (d != NULL)
+    dentry_drop(d);
+}
+
+/* Caches that NAME in the directory in PARENT is the inode in
+   INODE_SECTOR, or is not there if INODE_SECTOR is 0.  Caching
+   is skipped if memory runs out. */
+static void dentry_add(block_sector_t parent, const char* name, block_sector_t inode_sector) {
+  struct dentry* d;
+
+  if (strlen(name) > NAME_MAX)
+    return;
+  d = malloc(sizeof *d);
+  if (d == NULL)
+    return;
+  d->parent = parent;
+  strlcpy(d->name, name, sizeof d->name);
+  d->inode_sector = inode_sector;
+  hash_insert(&dentries, &d->elem);
+  list_push_front(&dentry_lru, &d->lru_elem);
+
+  if (list_size(&dentry_lru) > DENTRY_MAX)
+    dentry_drop(list_entry(list_back(&dentry_lru), struct dentry, lru_elem));
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
 bool dir_create(block_sector_t sector, size_t entry_cnt) {
-  return inode_create(sector, entry_cnt * sizeof(struct dir_entry));
+  /* An index or cached names left over from a removed directory
+     in the same sector describe entries that are gone. */
+  struct dir_index* index;
+  struct list_elem* e;
+
+  lock_acquire(&names_lock);
+  index = index_find(sector);
+  if (index != NULL)
+    index_drop(index);
+  for (e = list_begin(&dentry_lru); e != list_end(&dentry_lru);) {
+    struct dentry* d = list_entry(e, struct dentry, lru_elem);
+    e = list_next(e);
+    if (d->parent == sector)
+      dentry_drop(d);
+  }
+  lock_release(&names_lock);
+
+  return inode_create(sector, entry_cnt * sizeof(struct dir_entry), true);
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -30,6 +297,7 @@ bool dir_create(block_sector_t sector, size_t entry_cnt) {
 struct dir* dir_open(struct inode* inode) {
   struct dir* dir = calloc(1, sizeof *dir);
   if (inode != NULL && dir != NULL) {
+    inode_set_metadata(inode);
     dir->inode = inode;
     dir->pos = 0;
     return dir;
@@ -69,14 +337,35 @@ struct inode* dir_get_inode(struct dir* dir) {
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
    directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
+   otherwise, returns false and ignores EP and OFSP.
+   The caller must hold DIR's lock. */
 static bool lookup(const struct dir* dir, const char* name, struct dir_entry* ep, off_t* ofsp) {
+  struct dir_index* index;
   struct dir_entry e;
   size_t ofs;
 
   ASSERT(dir != NULL);
   ASSERT(name != NULL);
 
+  lock_acquire(&names_lock);
+  index = get_index(dir);
+  if (index != NULL) {
+    struct name* n = index_lookup(index, name);
+    if (n != NULL) {
+      if (ep != NULL) {
+        ep->inode_sector = n->inode_sector;
+        strlcpy(ep->name, n->name, sizeof ep->name);
+        ep->in_use = true;
+      }
+      if (ofsp != NULL)
+        *ofsp = n->ofs;
+    }
+    lock_release(&names_lock);
+    return n != NULL;
+  }
+  lock_release(&names_lock);
+
+  /* Without an index, search the whole directory. */
   for (ofs = 0; inode_read_at(dir->inode, &e, sizeof e, ofs) == sizeof e; ofs += sizeof e)
     if (e.in_use && !strcmp(name, e.name)) {
       if (ep != NULL)
@@ -93,16 +382,37 @@ static bool lookup(const struct dir* dir, const char* name, struct dir_entry* ep
    On success, sets *INODE to an inode for the file, otherwise to
    a null pointer.  The caller must close *INODE. */
 bool dir_lookup(const struct dir* dir, const char* name, struct inode** inode) {
+  block_sector_t parent;
+  struct dentry* d;
   struct dir_entry e;
+  bool cached;
 
   ASSERT(dir != NULL);
   ASSERT(name != NULL);
 
-  if (lookup(dir, name, &e, NULL))
-    *inode = inode_open(e.inode_sector);
-  else
-    *inode = NULL;
+  parent = inode_get_inumber(dir->inode);
+  inode_lock_dir(dir->inode);
+
+  lock_acquire(&names_lock);
+  d = dentry_find(parent, name);
+  cached = d != NULL;
+  if (cached) {
+    list_remove(&d->lru_elem);
+    list_push_front(&dentry_lru, &d->lru_elem);
+    e.inode_sector = d->inode_sector;
+  }
+  lock_release(&names_lock);
+
+  if (!cached) {
+    if (!lookup(dir, name, &e, NULL))
+      e.inode_sector = 0;
+    lock_acquire(&names_lock);
+    dentry_add(parent, name, e.inode_sector);
+    lock_release(&names_lock);
+  }
+  *inode = e.inode_sector != 0 ? inode_open(e.inode_sector) : NULL;
 
+  inode_unlock_dir(dir->inode);
   return *inode != NULL;
 }
 
@@ -113,6 +423,9 @@ bool dir_lookup(const struct dir* dir, const char* name, struct inode** inode) {
    Fails if NAME is invalid (i.e. too long) or a disk or memory
    error occurs. */
 bool dir_add(struct dir* dir, const char* name, block_sector_t inode_sector) {
+  block_sector_t sector;
+  struct dir_index* index;
+  bool from_slot = false;
   struct dir_entry e;
   off_t ofs;
   bool success = false;
@@ -124,6 +437,9 @@ bool dir_add(struct dir* dir, const char* name, block_sector_t inode_sector) {
   if (*name == '\0' || strlen(name) > NAME_MAX)
     return false;
 
+  sector = inode_get_inumber(dir->inode);
+  inode_lock_dir(dir->inode);
+
   /* Check that NAME is not in use. */
   if (lookup(dir, name, NULL, NULL))
     goto done;
@@ -135,9 +451,20 @@ bool dir_add(struct dir* dir, const char* name, block_sector_t inode_sector) {
      inode_read_at() will only return a short read at end of file.
      Otherwise, we'd need to verify that we didn't get a short
      read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at(dir->inode, &e, sizeof e, ofs) == sizeof e; ofs += sizeof e)
-    if (!e.in_use)
-      break;
+  lock_acquire(&names_lock);
+  index = get_index(dir);
+  if (index != NULL && !list_empty(&index->free_slots)) {
+    struct slot* slot = list_entry(list_pop_front(&index->free_slots), struct slot, elem);
+    ofs = slot->ofs;
+    free(slot);
+    from_slot = true;
+  } else if (index != NULL)
+    ofs = inode_length(dir->inode);
+  lock_release(&names_lock);
+  if (index == NULL)
+    for (ofs = 0; inode_read_at(dir->inode, &e, sizeof e, ofs) == sizeof e; ofs += sizeof e)
+      if (!e.in_use)
+        break;
 
   /* Write slot. */
   e.in_use = true;
@@ -145,7 +472,18 @@ bool dir_add(struct dir* dir, const char* name, block_sector_t inode_sector) {
   e.inode_sector = inode_sector;
   success = inode_write_at(dir->inode, &e, sizeof e, ofs) == sizeof e;
 
+  /* Bring the index, if it is still there, and the cached names
+     up to date. */
+  lock_acquire(&names_lock);
+  dentry_invalidate(sector, name);
+  index = index_find(sector);
+  if (index != NULL && (success ? !index_add_name(index, name, inode_sector, ofs)
+                                : from_slot && !index_add_slot(index, ofs)))
+    index_drop(index);
+  lock_release(&names_lock);
+
 done:
+  inode_unlock_dir(dir->inode);
   return success;
 }
 
@@ -153,6 +491,8 @@ done:
    Returns true if successful, false on failure,
    which occurs only if there is no file with the given NAME. */
 bool dir_remove(struct dir* dir, const char* name) {
+  block_sector_t sector;
+  struct dir_index* index;
   struct dir_entry e;
   struct inode* inode = NULL;
   bool success = false;
@@ -161,6 +501,9 @@ bool dir_remove(struct dir* dir, const char* name) {
   ASSERT(dir != NULL);
   ASSERT(name != NULL);
 
+  sector = inode_get_inumber(dir->inode);
+  inode_lock_dir(dir->inode);
+
   /* Find directory entry. */
   if (!lookup(dir, name, &e, &ofs))
     goto done;
@@ -175,11 +518,25 @@ bool dir_remove(struct dir* dir, const char* name) {
   if (inode_write_at(dir->inode, &e, sizeof e, ofs) != sizeof e)
     goto done;
 
+  /* Move it to the free slots in the index, and forget the name. */
+  lock_acquire(&names_lock);
+  dentry_invalidate(sector, name);
+  index = index_find(sector);
+  if (index != NULL) {
+    struct name* n = index_lookup(index, name);
+    hash_delete(&index->names, &n->elem);
+    free(n);
+    if (!index_add_slot(index, ofs))
+      index_drop(index);
+  }
+  lock_release(&names_lock);
+
   /* Remove inode. */
   inode_remove(inode);
   success = true;
 
 done:
+  inode_unlock_dir(dir->inode);
   inode_close(inode);
   return success;
 }
@@ -188,14 +545,39 @@ done:
    NAME.  Returns true if successful, false if the directory
    contains no more entries. */
 bool dir_readdir(struct dir* dir, char name[NAME_MAX + 1]) {
-  struct dir_entry e;
+  return dir_getdents(dir->inode, &dir->pos, name, NAME_MAX + 1) > 0;
+}
 
-  while (inode_read_at(dir->inode, &e, sizeof e, dir->pos) == sizeof e) {
-    dir->pos += sizeof e;
-    if (e.in_use) {
-      strlcpy(name, e.name, NAME_MAX + 1);
-      return true;
+/* Entries read from a directory at a time by dir_getdents(), a
+   sector's worth. */
+#define GETDENTS_BATCH (BLOCK_SECTOR_SIZE / sizeof(struct dir_entry))
+
+/* Reads the entries in use in directory INODE, starting at byte
+   offset *POS, and packs their names into the SIZE bytes of BUF,
+   each null terminated and right after the one before, as many
+   as fit.  Advances *POS past the entries read.  Returns the
+   number of bytes stored, 0 at the end of the directory.  SIZE
+   should be at least NAME_MAX + 1, or a long name never fits. */
+size_t dir_getdents(struct inode* inode, off_t* pos, char* buf, size_t size) {
+  struct dir_entry entries[GETDENTS_BATCH];
+  size_t used = 0;
+
+  for (;;) {
+    size_t cnt = inode_read_at(inode, entries, sizeof entries, *pos) / sizeof *entries;
+    size_t i;
+
+    if (cnt == 0)
+      return used;
+    for (i = 0; i < cnt; i++) {
+      const struct dir_entry* e = &entries[i];
+      if (e->in_use) {
+        size_t len = strnlen(e->name, NAME_MAX) + 1;
+        if (len > size - used)
+          return used;
+        strlcpy(buf + used, e->name, len);
+        used += len;
+      }
+      *pos += sizeof *e;
     }
   }
-  return false;
 }
@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include "devices/block.h"
+#include "filesys/off_t.h"
 
 /* Maximum length of a file name component.
    This is the traditional UNIX maximum length.
@@ -13,6 +14,8 @@
 
 struct inode;
 
+void dir_init(void);
+
 /* Opening and closing directories. */
 bool dir_create(block_sector_t sector, size_t entry_cnt);
 struct dir* dir_open(struct inode*);
@@ -26,5 +29,6 @@ bool dir_lookup(const struct dir*, const char* name, struct inode**);
 bool dir_add(struct dir*, const char* name, block_sector_t);
 bool dir_remove(struct dir*, const char* name);
 bool dir_readdir(struct dir*, char name[NAME_MAX + 1]);
+size_t dir_getdents(struct inode*, off_t* pos, char* buf, size_t size);
 
 #endif /* filesys/directory.h */
@@ -3,11 +3,15 @@
 #include "filesys/inode.h"
 #include "threads/malloc.h"
 
+/* Sectors read ahead of a sequential reader. */
+#define READ_AHEAD_SECTORS 8
+
 /* An open file. */
 struct file {
   struct inode* inode; /* File's inode. */
   off_t pos;           /* Current position. */
   bool deny_write;     /* Has file_deny_write() been called? */
+  off_t next_read;     /* Where the last read ended. */
 };
 
 /* Opens a file for the given INODE, of which it takes ownership,
@@ -19,6 +23,7 @@ struct file* file_open(struct inode* inode) {
     file->inode = inode;
     file->pos = 0;
     file->deny_write = false;
+    file->next_read = 0;
     return file;
   } else {
     inode_close(inode);
@@ -47,13 +52,28 @@ struct inode* file_get_inode(struct file* file) {
   return file->inode;
 }
 
+/* Reads SIZE bytes from FILE into BUFFER, starting at offset
+   FILE_OFS.  A read that starts where the last one ended, as does
+   the first read from the start of the file, is taken to be part
+   of a sequential scan, and the sectors that follow it are read
+   into the buffer cache in the background, so that they are there
+   by the time the reader asks for them. */
+static off_t read_at(struct file* file, void* buffer, off_t size, off_t file_ofs) {
+  off_t bytes_read = inode_read_at(file->inode, buffer, size, file_ofs);
+
+  if (bytes_read > 0 && file_ofs == file->next_read)
+    inode_read_ahead(file->inode, file_ofs + bytes_read, READ_AHEAD_SECTORS);
+  file->next_read = file_ofs + bytes_read;
+  return bytes_read;
+}
+
 /* Reads SIZE bytes from FILE into BUFFER,
    starting at the file's current position.
    Returns the number of bytes actually read,
    which may be less than SIZE if end of file is reached.
    Advances FILE's position by the number of bytes read. */
 off_t file_read(struct file* file, void* buffer, off_t size) {
-  off_t bytes_read = inode_read_at(file->inode, buffer, size, file->pos);
+  off_t bytes_read = read_at(file, buffer, size, file->pos);
   file->pos += bytes_read;
   return bytes_read;
 }
@@ -64,15 +84,14 @@ off_t file_read(struct file* file, void* buffer, off_t size) {
    which may be less than SIZE if end of file is reached.
    The file's current position is unaffected. */
 off_t file_read_at(struct file* file, void* buffer, off_t size, off_t file_ofs) {
-  return inode_read_at(file->inode, buffer, size, file_ofs);
+  return read_at(file, buffer, size, file_ofs);
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at the file's current position.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk is full.
+   Writing past end of file grows the file.
    Advances FILE's position by the number of bytes read. */
 off_t file_write(struct file* file, const void* buffer, off_t size) {
   off_t bytes_written = inode_write_at(file->inode, buffer, size, file->pos);
@@ -83,9 +102,8 @@ off_t file_write(struct file* file, const void* buffer, off_t size) {
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk is full.
+   Writing past end of file grows the file.
    The file's current position is unaffected. */
 off_t file_write_at(struct file* file, const void* buffer, off_t size, off_t file_ofs) {
   return inode_write_at(file->inode, buffer, size, file_ofs);
@@ -2,10 +2,12 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/journal.h"
 
 /* Partition that contains the file system. */
 struct block* fs_device;
@@ -19,18 +21,26 @@ void filesys_init(bool format) {
   if (fs_device == NULL)
     PANIC("No file system device found, can't initialize file system.");
 
+  cache_init();
+  journal_init();
   inode_init();
+  dir_init();
   free_map_init();
 
   if (format)
     do_format();
 
+  journal_open();
   free_map_open();
 }
 
 /* Shuts down the file system module, writing any unwritten data
    to disk. */
-void filesys_done(void) { free_map_close(); }
+void filesys_done(void) {
+  free_map_close();
+  journal_close();
+  cache_flush();
+}
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
    Returns true if successful, false otherwise.
@@ -38,17 +48,23 @@ void filesys_done(void) { free_map_close(); }
    or if internal memory allocation fails. */
 bool filesys_create(const char* name, off_t initial_size) {
   block_sector_t inode_sector = 0;
-  struct dir* dir = dir_open_root();
-  bool success = (dir != NULL && free_map_allocate(1, &inode_sector) &&
-                  inode_create(inode_sector, initial_size) && dir_add(dir, name, inode_sector));
+  struct dir* dir;
+  bool success;
+
+  journal_begin();
+  dir = dir_open_root();
+  success = (dir != NULL && free_map_allocate(1, &inode_sector) &&
+             inode_create(inode_sector, initial_size, false) && dir_add(dir, name, inode_sector));
   if (!success && inode_sector != 0)
     free_map_release(inode_sector, 1);
   dir_close(dir);
+  journal_end();
 
   return success;
 }
 
-/* Opens the file with the given NAME.
+/* Opens the file with the given NAME, or the root directory if
+   NAME is "/" or ".".
    Returns the new file if successful or a null pointer
    otherwise.
    Fails if no file named NAME exists,
@@ -57,8 +73,12 @@ struct file* filesys_open(const char* name) {
   struct dir* dir = dir_open_root();
   struct inode* inode = NULL;
 
-  if (dir != NULL)
-    dir_lookup(dir, name, &inode);
+  if (dir != NULL) {
+    if (!strcmp(name, "/") || !strcmp(name, "."))
+      inode = inode_reopen(dir_get_inode(dir));
+    else
+      dir_lookup(dir, name, &inode);
+  }
   dir_close(dir);
 
   return file_open(inode);
@@ -69,9 +89,14 @@ struct file* filesys_open(const char* name) {
    Fails if no file named NAME exists,
    or if an internal memory allocation fails. */
 bool filesys_remove(const char* name) {
-  struct dir* dir = dir_open_root();
-  bool success = dir != NULL && dir_remove(dir, name);
+  struct dir* dir;
+  bool success;
+
+  journal_begin();
+  dir = dir_open_root();
+  success = dir != NULL && dir_remove(dir, name);
   dir_close(dir);
+  journal_end();
 
   return success;
 }
@@ -82,6 +107,7 @@ static void do_format(void) {
   free_map_create();
   if (!dir_create(ROOT_DIR_SECTOR, 16))
     PANIC("root directory creation failed");
+  journal_create();
   free_map_close();
   printf("done.\n");
 }
@@ -1,20 +1,99 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
 
 static struct file* free_map_file; /* Free map file. */
 static struct bitmap* free_map;    /* Free map, one bit per sector. */
+static struct lock free_map_lock;  /* Guards the free map and its summaries. */
+
+/* The free map is split into regions of REGION_SECTORS sectors,
+   as many as one sector of the free map file describes, with a
+   count of the free sectors in each, so that a search can step
+   over a full region without looking at its bits. */
+#define REGION_SECTORS (BLOCK_SECTOR_SIZE * 8)
+static size_t* region_free; /* Free sectors in each region. */
+static size_t region_cnt;   /* Number of regions. */
+
+/* Where the next search without a hint starts: just after the
+   last run allocated. */
+static block_sector_t cursor;
+
+/* Recounts the free sectors in every region. */
+static void count_regions(void) {
+  size_t size = bitmap_size(free_map);
+  size_t i;
+
+  for (i = 0; i < region_cnt; i++) {
+    size_t start = i * REGION_SECTORS;
+    size_t cnt = size - start < REGION_SECTORS ? size - start : REGION_SECTORS;
+    region_free[i] = bitmap_count(free_map, start, cnt, false);
+  }
+}
+
+/* Sets the CNT sectors starting at SECTOR to USED, in the bitmap
+   and in the region counts. */
+static void set_sectors(block_sector_t sector, size_t cnt, bool used) {
+  size_t i;
+
+  bitmap_set_multiple(free_map, sector, cnt, used);
+  for (i = 0; i < cnt; i++)
+    if (used)
+      region_free[(sector + i) / REGION_SECTORS]--;
+    else
+      region_free[(sector + i) / REGION_SECTORS]++;
+}
+
+/* Returns the first sector at or after START that begins a run of
+   CNT free sectors, or BITMAP_ERROR if there is none. */
+static size_t scan(size_t start, size_t cnt) {
+  size_t size = bitmap_size(free_map);
+  size_t i = start;
+
+  while (cnt > 0 && i < size && cnt <= size - i) {
+    size_t region = i / REGION_SECTORS;
+    size_t end = (region + 1) * REGION_SECTORS;
+
+    /* A run starting in a full region would start on a used
+       sector. */
+    if (region_free[region] == 0) {
+      i = end;
+      continue;
+    }
+    for (; i < end && cnt <= size - i; i++)
+      if (!bitmap_test(free_map, i) && !bitmap_contains(free_map, i, cnt, true))
+        return i;
+  }
+  return BITMAP_ERROR;
+}
+
+/* Writes the part of the free map that holds the CNT sectors
+   starting at SECTOR to the free map file, if it is open.
+   Returns false if the write fails. */
+static bool write_sectors(block_sector_t sector, size_t cnt) {
+  return free_map_file == NULL || bitmap_write_range(free_map, free_map_file, sector, cnt);
+}
 
 /* Initializes the free map. */
 void free_map_init(void) {
+  lock_init(&free_map_lock);
   free_map = bitmap_create(block_size(fs_device));
   if (free_map == NULL)
     PANIC("bitmap creation failed--file system device is too large");
-  bitmap_mark(free_map, FREE_MAP_SECTOR);
-  bitmap_mark(free_map, ROOT_DIR_SECTOR);
+  region_cnt = DIV_ROUND_UP(bitmap_size(free_map), REGION_SECTORS);
+  region_free = malloc(region_cnt * sizeof *region_free);
+  if (region_free == NULL && region_cnt > 0)
+    PANIC("free map region counts allocation failed");
+  count_regions();
+  set_sectors(FREE_MAP_SECTOR, 1, true);
+  set_sectors(ROOT_DIR_SECTOR, 1, true);
+  set_sectors(JOURNAL_SECTOR, 1, true);
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
@@ -23,11 +102,33 @@ void free_map_init(void) {
    sectors were available or if the free_map file could not be
    written. */
 bool free_map_allocate(size_t cnt, block_sector_t* sectorp) {
-  block_sector_t sector = bitmap_scan_and_flip(free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR && free_map_file != NULL && !bitmap_write(free_map, free_map_file)) {
-    bitmap_set_multiple(free_map, sector, cnt, false);
-    sector = BITMAP_ERROR;
+  return free_map_allocate_near(cnt, cursor, sectorp);
+}
+
+/* Like free_map_allocate(), but takes the first run of CNT free
+   sectors at or after HINT, wrapping around to the start of the
+   disk if there is none, so that a file can grow next to the
+   sectors it already has. */
+bool free_map_allocate_near(size_t cnt, block_sector_t hint, block_sector_t* sectorp) {
+  size_t sector;
+
+  journal_begin();
+  lock_acquire(&free_map_lock);
+  sector = scan(hint, cnt);
+  if (sector == BITMAP_ERROR && hint > 0)
+    sector = scan(0, cnt);
+  if (sector != BITMAP_ERROR) {
+    set_sectors(sector, cnt, true);
+    if (write_sectors(sector, cnt))
+      cursor = sector + cnt;
+    else {
+      set_sectors(sector, cnt, false);
+      sector = BITMAP_ERROR;
+    }
   }
+  lock_release(&free_map_lock);
+  journal_end();
+
   if (sector != BITMAP_ERROR)
     *sectorp = sector;
   return sector != BITMAP_ERROR;
@@ -35,9 +136,13 @@ bool free_map_allocate(size_t cnt, block_sector_t* sectorp) {
 
 /* Makes CNT sectors starting at SECTOR available for use. */
 void free_map_release(block_sector_t sector, size_t cnt) {
+  journal_begin();
+  lock_acquire(&free_map_lock);
   ASSERT(bitmap_all(free_map, sector, cnt));
-  bitmap_set_multiple(free_map, sector, cnt, false);
-  bitmap_write(free_map, free_map_file);
+  set_sectors(sector, cnt, false);
+  write_sectors(sector, cnt);
+  lock_release(&free_map_lock);
+  journal_end();
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -45,8 +150,10 @@ void free_map_open(void) {
   free_map_file = file_open(inode_open(FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC("can't open free map");
+  inode_set_metadata(file_get_inode(free_map_file));
   if (!bitmap_read(free_map, free_map_file))
     PANIC("can't read free map");
+  count_regions();
 }
 
 /* Writes the free map to disk and closes the free map file. */
@@ -56,13 +163,14 @@ void free_map_close(void) { file_close(free_map_file); }
    it. */
 void free_map_create(void) {
   /* Create inode. */
-  if (!inode_create(FREE_MAP_SECTOR, bitmap_file_size(free_map)))
+  if (!inode_create(FREE_MAP_SECTOR, bitmap_file_size(free_map), false))
     PANIC("free map creation failed");
 
   /* Write bitmap to file. */
   free_map_file = file_open(inode_open(FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC("can't open free map");
+  inode_set_metadata(file_get_inode(free_map_file));
   if (!bitmap_write(free_map, free_map_file))
     PANIC("can't write free map");
 }
@@ -1,63 +1,416 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
+#include "threads/spinlock.h"
+#include "threads/synch.h"
 
-/* Identifies an inode. */
+/* Identifies an inode, and says whether its data is inline. */
 #define INODE_MAGIC 0x494e4f44
+#define INLINE_MAGIC 0x4e4c4e49 /* "INLN" */
+
+/* Sector numbers in an index block, in the inode itself, and in
+   the blocks an indirect and a doubly indirect pointer lead to. */
+#define PTRS_PER_SECTOR (BLOCK_SECTOR_SIZE / sizeof(block_sector_t))
+#define DIRECT_CNT 123
+#define INDIRECT_CNT PTRS_PER_SECTOR
+#define DOUBLY_INDIRECT_CNT (PTRS_PER_SECTOR * PTRS_PER_SECTOR)
 
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   A file's sectors are found through an index: the first
+   DIRECT_CNT from the inode itself, the next INDIRECT_CNT from
+   the index block that INDIRECT points to, and the rest from the
+   index blocks that the index block DOUBLY_INDIRECT points to
+   point to.  A zero pointer, which no file's sector can be since
+   sector 0 holds the free map's inode, is a hole: it reads as
+   zeros and is filled in when it is first written, so that a
+   file can grow, and can grow sparsely, one sector at a time.
+   The index blocks go through the buffer cache like the data,
+   so finding a sector costs at most two cache lookups.
+
+   A file created no longer than INLINE_MAX bytes keeps its data
+   in the inode itself instead, in place of the pointers, so that
+   reading it costs no sector beyond the inode's.  Bytes past the
+   end are kept zero.  Once it grows past INLINE_MAX, its data
+   moves out to a data sector and the index takes over. */
 struct inode_disk {
-  block_sector_t start; /* First data sector. */
-  off_t length;         /* File size in bytes. */
-  unsigned magic;       /* Magic number. */
-  uint32_t unused[125]; /* Not used. */
+  off_t length;    /* File size in bytes. */
+  unsigned magic;  /* INODE_MAGIC, or INLINE_MAGIC if data is inline. */
+  uint32_t is_dir; /* Nonzero if the inode is a directory. */
+  union {
+    struct {
+      block_sector_t direct[DIRECT_CNT]; /* Data sectors. */
+      block_sector_t indirect;           /* Index block of data sectors. */
+      block_sector_t doubly_indirect;    /* Index block of index blocks. */
+    };
+    uint8_t bytes[DIRECT_CNT * sizeof(block_sector_t) + 2 * sizeof(block_sector_t)];
+  };
 };
 
+/* Most bytes of data an inode holds inline. */
+#define INLINE_MAX ((off_t)sizeof((struct inode_disk*)NULL)->bytes)
+
+/* Returns true if DISK holds its file's data inline. */
+static inline bool is_inline(const struct inode_disk* disk) { return disk->magic == INLINE_MAGIC; }
+
 /* Returns the number of sectors to allocate for an inode SIZE
    bytes long. */
 static inline size_t bytes_to_sectors(off_t size) { return DIV_ROUND_UP(size, BLOCK_SECTOR_SIZE); }
 
+/* Number of sectors a growing file claims from the free map at
+   a time. */
+#define RESERVE_SECTORS 16
+
+/* Sectors claimed in the free map for a file to grow into, but
+   not yet part of it.  Handing them out in order keeps a file's
+   sectors together even while other files grow alongside it, and
+   touches the free map once per run rather than once per
+   sector. */
+struct reservation {
+  block_sector_t next; /* First unused sector, or where to look for more. */
+  size_t cnt;          /* Number of unused sectors from NEXT. */
+  bool overwrite;      /* Data sectors are about to be written in full? */
+};
+
+/* Starts reservation R empty, looking for space just after the
+   inode in SECTOR. */
+static void reservation_init(struct reservation* r, block_sector_t sector) {
+  r->next = sector + 1;
+  r->cnt = 0;
+  r->overwrite = false;
+}
+
+/* Gives the sectors left in reservation R back to the free map. */
+static void reservation_release(struct reservation* r) {
+  if (r->cnt > 0)
+    free_map_release(r->next, r->cnt);
+  r->cnt = 0;
+}
+
+/* Allocates a sector of zeros from reservation R, claiming a new
+   run for R near the last one first if R is empty, and stores it
+   in *SECTORP, which is left zero if the disk is full.  The zeros
+   go through the journal if the sector is to be an index block,
+   so that a pointer to it is never replayed without them, and
+   are left out for data while R->overwrite is set.
+   Returns *SECTORP. */
+static block_sector_t allocate_zeroed(struct reservation* r, bool index, block_sector_t* sectorp) {
+  static char zeros[BLOCK_SECTOR_SIZE];
+  size_t cnt;
+
+  /* Take the longest run, up to RESERVE_SECTORS, that fits. */
+  for (cnt = RESERVE_SECTORS; r->cnt == 0 && cnt > 0; cnt /= 2)
+    if (free_map_allocate_near(cnt, r->next, &r->next))
+      r->cnt = cnt;
+  if (r->cnt == 0) {
+    *sectorp = 0;
+    return 0;
+  }
+
+  *sectorp = r->next++;
+  r->cnt--;
+  if (index)
+    cache_write_logged(*sectorp, zeros);
+  else if (!r->overwrite)
+    cache_write(*sectorp, zeros);
+  return *sectorp;
+}
+
+/* Returns the sector at *SLOT, a pointer in an inode, filling it
+   in first from R if it is a hole and R is nonnull.  INDEX says
+   whether the sector is an index block.  Sets *CHANGED if it
+   filled it in. */
+static block_sector_t inode_slot(block_sector_t* slot, struct reservation* r, bool index,
+                                 bool* changed) {
+  if (*slot == 0 && r != NULL && allocate_zeroed(r, index, slot) != 0)
+    *changed = true;
+  return *slot;
+}
+
+/* Returns pointer IDX in index block INDEX, filling it in first
+   from R if it is a hole and R is nonnull.  LEAF says whether
+   the sector it points to holds data rather than pointers. */
+static block_sector_t index_slot(block_sector_t index, size_t idx, struct reservation* r,
+                                 bool leaf) {
+  block_sector_t sector;
+
+  cache_read_at(index, &sector, idx * sizeof sector, sizeof sector);
+  if (sector == 0 && r != NULL && allocate_zeroed(r, !leaf, &sector) != 0)
+    cache_write_logged_at(index, &sector, idx * sizeof sector, sizeof sector);
+  return sector;
+}
+
+/* Returns the sector that holds sector IDX of the file whose
+   inode is DISK, or 0 if it is a hole.  If R is nonnull, a hole
+   is filled in first from R, along with the index blocks that
+   lead to it, so that 0 is returned only if the disk is full,
+   and *CHANGED is set if DISK itself was changed. */
+static block_sector_t data_sector(struct inode_disk* disk, size_t idx, struct reservation* r,
+                                  bool* changed) {
+  block_sector_t index;
+
+  if (idx < DIRECT_CNT)
+    return inode_slot(&disk->direct[idx], r, false, changed);
+  idx -= DIRECT_CNT;
+
+  if (idx < INDIRECT_CNT) {
+    index = inode_slot(&disk->indirect, r, true, changed);
+    return index != 0 ? index_slot(index, idx, r, true) : 0;
+  }
+  idx -= INDIRECT_CNT;
+
+  if (idx < DOUBLY_INDIRECT_CNT) {
+    index = inode_slot(&disk->doubly_indirect, r, true, changed);
+    if (index != 0)
+      index = index_slot(index, idx / PTRS_PER_SECTOR, r, false);
+    return index != 0 ? index_slot(index, idx % PTRS_PER_SECTOR, r, true) : 0;
+  }
+  return 0;
+}
+
+/* Most sectors a run of mapped sectors covers (see struct
+   sector_run). */
+#define RUN_MAX 32
+
+/* Returns the number of sectors of the file whose inode is DISK,
+   from sector IDX and at most RUN_MAX of them, that lie one after
+   another on disk from the one it stores in *FIRST, or that are
+   all holes if it stores 0 there.  The run stops at the end of
+   the index block it starts in, which is read once for it. */
+static size_t mapped_run(struct inode_disk* disk, size_t idx, block_sector_t* first) {
+  block_sector_t ptrs[RUN_MAX];
+  const block_sector_t* p = ptrs;
+  block_sector_t index;
+  size_t cnt, n;
+
+  if (idx < DIRECT_CNT) {
+    p = disk->direct + idx;
+    cnt = DIRECT_CNT - idx;
+  } else {
+    idx -= DIRECT_CNT;
+    if (idx < INDIRECT_CNT)
+      index = disk->indirect;
+    else {
+      idx -= INDIRECT_CNT;
+      if (idx >= DOUBLY_INDIRECT_CNT) {
+        *first = 0;
+        return 1;
+      }
+      index = disk->doubly_indirect;
+      if (index != 0)
+        index = index_slot(index, idx / PTRS_PER_SECTOR, NULL, false);
+      idx %= PTRS_PER_SECTOR;
+    }
+    cnt = PTRS_PER_SECTOR - idx;
+    if (cnt > RUN_MAX)
+      cnt = RUN_MAX;
+    if (index == 0) {
+      *first = 0;
+      return cnt;
+    }
+    cache_read_at(index, ptrs, idx * sizeof *ptrs, cnt * sizeof *ptrs);
+  }
+  if (cnt > RUN_MAX)
+    cnt = RUN_MAX;
+
+  *first = p[0];
+  for (n = 1; n < cnt && p[n] == (*first != 0 ? *first + n : 0); n++)
+    continue;
+  return n;
+}
+
+/* Frees the sectors that index block INDEX points to, which are
+   themselves index blocks LEVELS - 1 deep, and then INDEX. */
+static void release_index(block_sector_t index, int levels) {
+  if (levels > 0) {
+    block_sector_t* ptrs = malloc(BLOCK_SECTOR_SIZE);
+    size_t i;
+
+    if (ptrs == NULL)
+      PANIC("release_index: out of memory");
+    cache_read(index, ptrs);
+    for (i = 0; i < PTRS_PER_SECTOR; i++)
+      if (ptrs[i] != 0)
+        release_index(ptrs[i], levels - 1);
+    free(ptrs);
+  }
+  free_map_release(index, 1);
+}
+
+/* Frees all of the data and index sectors of the file whose inode
+   is DISK. */
+static void release_sectors(struct inode_disk* disk) {
+  size_t i;
+
+  if (is_inline(disk))
+    return;
+  for (i = 0; i < DIRECT_CNT; i++)
+    if (disk->direct[i] != 0)
+      free_map_release(disk->direct[i], 1);
+  if (disk->indirect != 0)
+    release_index(disk->indirect, 1);
+  if (disk->doubly_indirect != 0)
+    release_index(disk->doubly_indirect, 2);
+}
+
+/* A run of sectors of a file, IDX through IDX + CNT - 1, that
+   lie one after another on disk from FIRST, or are all holes if
+   FIRST is 0.  An open inode keeps the last run a lookup went
+   through its index for, so that reading or writing a file in
+   order reads its index blocks once per run rather than once per
+   sector.  Sectors, once filled in, never move while the inode
+   is open, so only filling in a hole can make a run wrong. */
+struct sector_run {
+  size_t idx;           /* First sector of the file in the run. */
+  size_t cnt;           /* Number of sectors, 0 if there is no run. */
+  block_sector_t first; /* Sector on disk of sector IDX, or 0. */
+};
+
 /* In-memory inode. */
 struct inode {
-  struct list_elem elem;  /* Element in inode list. */
-  block_sector_t sector;  /* Sector number of disk location. */
-  int open_cnt;           /* Number of openers. */
-  bool removed;           /* True if deleted, false otherwise. */
-  int deny_write_cnt;     /* 0: writes ok, >0: deny writes. */
-  struct inode_disk data; /* Inode content. */
+  struct hash_elem elem;      /* Element in `open_inodes'. */
+  block_sector_t sector;      /* Sector number of disk location. */
+  int open_cnt;               /* Number of openers. */
+  bool removed;               /* True if deleted, false otherwise. */
+  bool metadata;              /* Data written through the journal? */
+  int deny_write_cnt;         /* 0: writes ok, >0: deny writes. */
+  unsigned version;           /* Changes whenever the contents may have. */
+  struct reservation reserve; /* Sectors to grow into. */
+  struct rw_lock rw;          /* Guards the file data, DATA, RESERVE, DENY_WRITE_CNT. */
+  struct lock dir_lock;       /* Guards the entries, if a directory. */
+  struct spinlock run_lock;   /* Guards RUN. */
+  struct sector_run run;      /* Sectors last looked up. */
+  struct inode_disk data;     /* Inode content. */
 };
 
+/* Returns the sector that holds sector IDX of INODE's file, or 0
+   if it is a hole, from INODE's run if it covers IDX, and
+   otherwise from the index, making the run the one that IDX
+   begins.  Must be called with INODE's RW held. */
+static block_sector_t lookup_sector(struct inode* inode, size_t idx) {
+  struct sector_run run;
+  enum intr_level old_level;
+
+  old_level = spin_lock(&inode->run_lock);
+  run = inode->run;
+  spin_unlock(&inode->run_lock, old_level);
+
+  if (idx - run.idx >= run.cnt) {
+    run.idx = idx;
+    run.cnt = mapped_run(&inode->data, idx, &run.first);
+    old_level = spin_lock(&inode->run_lock);
+    inode->run = run;
+    spin_unlock(&inode->run_lock, old_level);
+  }
+  return run.first != 0 ? run.first + (idx - run.idx) : 0;
+}
+
+/* Forgets INODE's run, after a hole it might cover was filled
+   in.  Must be called with INODE's RW held for writing. */
+static void forget_run(struct inode* inode) {
+  enum intr_level old_level = spin_lock(&inode->run_lock);
+  inode->run.cnt = 0;
+  spin_unlock(&inode->run_lock, old_level);
+}
+
+/* Returns the sector that holds sector IDX of INODE's file,
+   filling it in first from INODE's reservation if it is a hole,
+   as data_sector() does.  Returns 0 if the disk is full. */
+static block_sector_t write_sector(struct inode* inode, size_t idx, bool* changed) {
+  block_sector_t sector = 0;
+
+  /* Past the end of file there is nothing to look up. */
+  if (idx < bytes_to_sectors(inode->data.length))
+    sector = lookup_sector(inode, idx);
+  if (sector == 0) {
+    sector = data_sector(&inode->data, idx, &inode->reserve, changed);
+    forget_run(inode);
+  }
+  return sector;
+}
+
+/* Returns the number of sectors of INODE's file, from sector IDX
+   and at most CNT of them, that lie one after another on disk
+   from the one it stores in *FIRST.  Holes are filled in without
+   zeros, since the caller is about to write all CNT sectors.
+   Returns 0 if the disk is full. */
+static size_t data_run(struct inode* inode, size_t idx, size_t cnt, bool* changed,
+                       block_sector_t* first) {
+  size_t n = 1;
+
+  inode->reserve.overwrite = true;
+  *first = write_sector(inode, idx, changed);
+  if (*first == 0)
+    n = 0;
+  else
+    while (n < cnt && write_sector(inode, idx + n, changed) == *first + n)
+      n++;
+  inode->reserve.overwrite = false;
+  return n;
+}
+
 /* Returns the block device sector that contains byte offset POS
    within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
-static block_sector_t byte_to_sector(const struct inode* inode, off_t pos) {
+   Returns 0 if INODE does not contain data for a byte at offset
+   POS, because it is past the end of the file or in a hole. */
+static block_sector_t byte_to_sector(struct inode* inode, off_t pos) {
   ASSERT(inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
+  if (pos < inode->data.length && !is_inline(&inode->data))
+    return lookup_sector(inode, pos / BLOCK_SECTOR_SIZE);
   else
-    return -1;
+    return 0;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Open inodes, by sector, so that opening a single inode twice
+   returns the same `struct inode'.  OPEN_LOCK guards it and each
+   inode's open_cnt. */
+static struct hash open_inodes;
+static struct lock open_lock;
+
+/* Memory for in-memory inodes. */
+static struct kmem_cache* inode_cache;
+
+/* The last version given to an inode, guarded by VERSION_LOCK.
+   Each inode opened or written gets a new one, so that no two
+   inodes, even at the same address one after the other, have the
+   same version with different contents. */
+static unsigned last_version;
+static struct lock version_lock;
+
+static hash_hash_func inode_hash;
+static hash_less_func inode_less;
 
 /* Initializes the inode module. */
-void inode_init(void) { list_init(&open_inodes); }
+void inode_init(void) {
+  lock_init(&open_lock);
+  lock_init(&version_lock);
+  if (!hash_init(&open_inodes, inode_hash, inode_less, NULL))
+    PANIC("inode_init: out of memory");
+  inode_cache = kmem_cache_create("inode", sizeof(struct inode));
+}
+
+static unsigned inode_hash(const struct hash_elem* e, void* aux UNUSED) {
+  return hash_int(hash_entry(e, struct inode, elem)->sector);
+}
+
+static bool inode_less(const struct hash_elem* a, const struct hash_elem* b, void* aux UNUSED) {
+  return hash_entry(a, struct inode, elem)->sector < hash_entry(b, struct inode, elem)->sector;
+}
 
-/* Initializes an inode with LENGTH bytes of data and
-   writes the new inode to sector SECTOR on the file system
-   device.
+/* Initializes an inode with LENGTH bytes of data, a directory's
+   if IS_DIR is true, and writes the new inode to sector SECTOR on
+   the file system device.
    Returns true if successful.
    Returns false if memory or disk allocation fails. */
-bool inode_create(block_sector_t sector, off_t length) {
+bool inode_create(block_sector_t sector, off_t length, bool is_dir) {
   struct inode_disk* disk_inode = NULL;
   bool success = false;
 
@@ -67,62 +420,95 @@ bool inode_create(block_sector_t sector, off_t length) {
      one sector in size, and you should fix that. */
   ASSERT(sizeof *disk_inode == BLOCK_SECTOR_SIZE);
 
+  journal_begin();
   disk_inode = calloc(1, sizeof *disk_inode);
   if (disk_inode != NULL) {
     size_t sectors = bytes_to_sectors(length);
+    struct reservation reserve;
+    bool changed;
+    size_t i;
+
+    /* Space for the initial size is allocated up front, so that
+       creating a file fails if the disk cannot hold it. */
     disk_inode->length = length;
-    disk_inode->magic = INODE_MAGIC;
-    if (free_map_allocate(sectors, &disk_inode->start)) {
-      block_write(fs_device, sector, disk_inode);
-      if (sectors > 0) {
-        static char zeros[BLOCK_SECTOR_SIZE];
-        size_t i;
-
-        for (i = 0; i < sectors; i++)
-          block_write(fs_device, disk_inode->start + i, zeros);
-      }
-      success = true;
+    disk_inode->magic = length <= INLINE_MAX ? INLINE_MAGIC : INODE_MAGIC;
+    disk_inode->is_dir = is_dir;
+    success = true;
+    if (!is_inline(disk_inode)) {
+      reservation_init(&reserve, sector);
+      for (i = 0; i < sectors && success; i++)
+        success = data_sector(disk_inode, i, &reserve, &changed) != 0;
+      reservation_release(&reserve);
     }
+    if (success)
+      cache_write_logged(sector, disk_inode);
+    else
+      release_sectors(disk_inode);
     free(disk_inode);
   }
+  journal_end();
   return success;
 }
 
+/* Returns a version no inode has had yet. */
+static unsigned new_version(void) {
+  unsigned version;
+
+  lock_acquire(&version_lock);
+  version = ++last_version;
+  lock_release(&version_lock);
+  return version;
+}
+
 /* Reads an inode from SECTOR
    and returns a `struct inode' that contains it.
    Returns a null pointer if memory allocation fails. */
 struct inode* inode_open(block_sector_t sector) {
-  struct list_elem* e;
+  struct inode key;
+  struct hash_elem* e;
   struct inode* inode;
 
+  lock_acquire(&open_lock);
+
   /* Check whether this inode is already open. */
-  for (e = list_begin(&open_inodes); e != list_end(&open_inodes); e = list_next(e)) {
-    inode = list_entry(e, struct inode, elem);
-    if (inode->sector == sector) {
-      inode_reopen(inode);
-      return inode;
-    }
+  key.sector = sector;
+  e = hash_find(&open_inodes, &key.elem);
+  if (e != NULL) {
+    inode = hash_entry(e, struct inode, elem);
+    inode->open_cnt++;
+    lock_release(&open_lock);
+    return inode;
   }
 
   /* Allocate memory. */
-  inode = malloc(sizeof *inode);
-  if (inode == NULL)
-    return NULL;
-
-  /* Initialize. */
-  list_push_front(&open_inodes, &inode->elem);
-  inode->sector = sector;
-  inode->open_cnt = 1;
-  inode->deny_write_cnt = 0;
-  inode->removed = false;
-  block_read(fs_device, inode->sector, &inode->data);
+  inode = kmem_cache_alloc(inode_cache);
+  if (inode != NULL) {
+    /* Initialize. */
+    inode->sector = sector;
+    hash_insert(&open_inodes, &inode->elem);
+    inode->open_cnt = 1;
+    inode->deny_write_cnt = 0;
+    inode->removed = false;
+    inode->metadata = false;
+    inode->version = new_version();
+    reservation_init(&inode->reserve, sector);
+    rw_lock_init(&inode->rw);
+    lock_init(&inode->dir_lock);
+    spinlock_init(&inode->run_lock);
+    inode->run.cnt = 0;
+    cache_read(inode->sector, &inode->data);
+  }
+  lock_release(&open_lock);
   return inode;
 }
 
 /* Reopens and returns INODE. */
 struct inode* inode_reopen(struct inode* inode) {
-  if (inode != NULL)
+  if (inode != NULL) {
+    lock_acquire(&open_lock);
     inode->open_cnt++;
+    lock_release(&open_lock);
+  }
   return inode;
 }
 
@@ -133,22 +519,33 @@ block_sector_t inode_get_inumber(const struct inode* inode) { return inode->sect
    If this was the last reference to INODE, frees its memory.
    If INODE was also a removed inode, frees its blocks. */
 void inode_close(struct inode* inode) {
+  bool last;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
+  lock_acquire(&open_lock);
+  last = --inode->open_cnt == 0;
+  if (last) {
+    /* Remove from open inodes, so that no one else finds it. */
+    hash_delete(&open_inodes, &inode->elem);
+  }
+  lock_release(&open_lock);
+
   /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0) {
-    /* Remove from inode list and release lock. */
-    list_remove(&inode->elem);
+  if (last) {
+    journal_begin();
+    reservation_release(&inode->reserve);
 
     /* Deallocate blocks if removed. */
     if (inode->removed) {
       free_map_release(inode->sector, 1);
-      free_map_release(inode->data.start, bytes_to_sectors(inode->data.length));
+      release_sectors(&inode->data);
     }
+    journal_end();
 
-    free(inode);
+    kmem_cache_free(inode_cache, inode);
   }
 }
 
@@ -165,8 +562,19 @@ void inode_remove(struct inode* inode) {
 off_t inode_read_at(struct inode* inode, void* buffer_, off_t size, off_t offset) {
   uint8_t* buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t* bounce = NULL;
 
+  rw_lock_acquire(&inode->rw, RW_READER);
+  if (is_inline(&inode->data)) {
+    /* Copy out of the inode. */
+    off_t inode_left = inode_length(inode) - offset;
+    if (size > inode_left)
+      size = inode_left;
+    if (size > 0) {
+      memcpy(buffer, inode->data.bytes + offset, size);
+      bytes_read = size;
+    }
+    size = 0;
+  }
   while (size > 0) {
     /* Disk sector to read, starting byte offset within sector. */
     block_sector_t sector_idx = byte_to_sector(inode, offset);
@@ -182,79 +590,138 @@ off_t inode_read_at(struct inode* inode, void* buffer_, off_t size, off_t offset
     if (chunk_size <= 0)
       break;
 
-    if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE) {
-      /* Read full sector directly into caller's buffer. */
-      block_read(fs_device, sector_idx, buffer + bytes_read);
-    } else {
-      /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-      if (bounce == NULL) {
-        bounce = malloc(BLOCK_SECTOR_SIZE);
-        if (bounce == NULL)
-          break;
-      }
-      block_read(fs_device, sector_idx, bounce);
-      memcpy(buffer + bytes_read, bounce + sector_ofs, chunk_size);
-    }
+    /* Copy out of the cached sector, or zeros out of a hole. */
+    if (sector_idx != 0)
+      cache_read_at(sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
+    else
+      memset(buffer + bytes_read, 0, chunk_size);
 
     /* Advance. */
     size -= chunk_size;
     offset += chunk_size;
     bytes_read += chunk_size;
   }
-  free(bounce);
+  rw_lock_release(&inode->rw, RW_READER);
 
   return bytes_read;
 }
 
+/* Starts reading the CNT sectors of INODE from the one that holds
+   byte OFFSET into the buffer cache, in the background, stopping
+   at the end of the file. */
+void inode_read_ahead(struct inode* inode, off_t offset, size_t cnt) {
+  size_t i;
+
+  rw_lock_acquire(&inode->rw, RW_READER);
+  for (i = 0; i < cnt && !is_inline(&inode->data); i++) {
+    off_t pos = offset + (off_t)i * BLOCK_SECTOR_SIZE;
+    block_sector_t sector;
+
+    if (pos >= inode_length(inode))
+      break;
+    sector = byte_to_sector(inode, pos);
+    if (sector != 0)
+      cache_prefetch(sector);
+  }
+  rw_lock_release(&inode->rw, RW_READER);
+}
+
+/* Moves the data of INODE, which is inline, out to a data
+   sector, so that the file can grow past INLINE_MAX bytes.  Sets
+   *CHANGED.  Returns false, leaving INODE as it was, if memory
+   or disk allocation fails. */
+static bool move_out_of_line(struct inode* inode, bool* changed) {
+  struct inode_disk* disk = &inode->data;
+  uint8_t* sector_buf = calloc(1, BLOCK_SECTOR_SIZE);
+  block_sector_t sector = 0;
+
+  if (sector_buf == NULL)
+    return false;
+  memcpy(sector_buf, disk->bytes, disk->length);
+  memset(disk->bytes, 0, sizeof disk->bytes);
+  disk->magic = INODE_MAGIC;
+
+  if (disk->length > 0) {
+    sector = data_sector(disk, 0, &inode->reserve, changed);
+    if (sector == 0) {
+      memcpy(disk->bytes, sector_buf, disk->length);
+      disk->magic = INLINE_MAGIC;
+      free(sector_buf);
+      return false;
+    }
+    if (inode->metadata)
+      cache_write_logged(sector, sector_buf);
+    else
+      cache_write(sector, sector_buf);
+  }
+  free(sector_buf);
+  *changed = true;
+  return true;
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk fills up or the file reaches the
+   largest size an inode can index.  A write past the end of
+   file extends the file, leaving any gap before OFFSET as a
+   hole. */
 off_t inode_write_at(struct inode* inode, const void* buffer_, off_t size, off_t offset) {
   const uint8_t* buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t* bounce = NULL;
+  bool changed = false;
 
-  if (inode->deny_write_cnt)
+  journal_begin();
+  rw_lock_acquire(&inode->rw, RW_WRITER);
+  if (inode->deny_write_cnt) {
+    rw_lock_release(&inode->rw, RW_WRITER);
+    journal_end();
     return 0;
+  }
+  inode->version = new_version();
+
+  if (is_inline(&inode->data)) {
+    if (offset + size <= INLINE_MAX) {
+      /* Copy into the inode, which is written below. */
+      memcpy(inode->data.bytes + offset, buffer, size);
+      bytes_written = size;
+      offset += size;
+      size = 0;
+      changed = true;
+    } else if (!move_out_of_line(inode, &changed))
+      size = 0;
+  }
 
   while (size > 0) {
-    /* Sector to write, starting byte offset within sector. */
-    block_sector_t sector_idx = byte_to_sector(inode, offset);
+    block_sector_t sector_idx;
     int sector_ofs = offset % BLOCK_SECTOR_SIZE;
-
-    /* Bytes left in inode, bytes left in sector, lesser of the two. */
-    off_t inode_left = inode_length(inode) - offset;
-    int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-    int min_left = inode_left < sector_left ? inode_left : sector_left;
-
-    /* Number of bytes to actually write into this sector. */
-    int chunk_size = size < min_left ? size : min_left;
-    if (chunk_size <= 0)
-      break;
-
-    if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE) {
-      /* Write full sector directly to disk. */
-      block_write(fs_device, sector_idx, buffer + bytes_written);
+    int chunk_size;
+
+    if (sector_ofs == 0 && size >= 2 * BLOCK_SECTOR_SIZE && !inode->metadata) {
+      /* Whole sectors of data that lie together on disk go
+         straight there in one request. */
+      size_t cnt = data_run(inode, offset / BLOCK_SECTOR_SIZE, size / BLOCK_SECTOR_SIZE, &changed,
+                            &sector_idx);
+      if (cnt == 0)
+        break;
+      chunk_size = cnt * BLOCK_SECTOR_SIZE;
+      if (cnt > 1)
+        cache_write_multiple(sector_idx, cnt, buffer + bytes_written);
+      else
+        cache_write(sector_idx, buffer + bytes_written);
     } else {
-      /* We need a bounce buffer. */
-      if (bounce == NULL) {
-        bounce = malloc(BLOCK_SECTOR_SIZE);
-        if (bounce == NULL)
-          break;
-      }
-
-      /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-      if (sector_ofs > 0 || chunk_size < sector_left)
-        block_read(fs_device, sector_idx, bounce);
+      /* Sector to write, filled in if it is a hole. */
+      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
+      chunk_size = size < sector_left ? size : sector_left;
+      sector_idx = write_sector(inode, offset / BLOCK_SECTOR_SIZE, &changed);
+      if (sector_idx == 0)
+        break;
+
+      /* Copy into the cached sector, which reads it first unless
+         the whole of it is being written. */
+      if (inode->metadata)
+        cache_write_logged_at(sector_idx, buffer + bytes_written, sector_ofs, chunk_size);
       else
-        memset(bounce, 0, BLOCK_SECTOR_SIZE);
-      memcpy(bounce + sector_ofs, buffer + bytes_written, chunk_size);
-      block_write(fs_device, sector_idx, bounce);
+        cache_write_at(sector_idx, buffer + bytes_written, sector_ofs, chunk_size);
     }
 
     /* Advance. */
@@ -262,7 +729,15 @@ off_t inode_write_at(struct inode* inode, const void* buffer_, off_t size, off_t
     offset += chunk_size;
     bytes_written += chunk_size;
   }
-  free(bounce);
+
+  if (bytes_written > 0 && offset > inode->data.length) {
+    inode->data.length = offset;
+    changed = true;
+  }
+  if (changed)
+    cache_write_logged(inode->sector, &inode->data);
+  rw_lock_release(&inode->rw, RW_WRITER);
+  journal_end();
 
   return bytes_written;
 }
@@ -270,18 +745,43 @@ off_t inode_write_at(struct inode* inode, const void* buffer_, off_t size, off_t
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void inode_deny_write(struct inode* inode) {
+  rw_lock_acquire(&inode->rw, RW_WRITER);
   inode->deny_write_cnt++;
   ASSERT(inode->deny_write_cnt <= inode->open_cnt);
+  rw_lock_release(&inode->rw, RW_WRITER);
 }
 
 /* Re-enables writes to INODE.
    Must be called once by each inode opener who has called
    inode_deny_write() on the inode, before closing the inode. */
 void inode_allow_write(struct inode* inode) {
+  rw_lock_acquire(&inode->rw, RW_WRITER);
   ASSERT(inode->deny_write_cnt > 0);
   ASSERT(inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rw_lock_release(&inode->rw, RW_WRITER);
 }
 
+/* Returns INODE's version, which changes whenever its contents
+   may have, so that a copy of them made at one version is known
+   to be good as long as the version stays the same. */
+unsigned inode_version(const struct inode* inode) { return inode->version; }
+
 /* Returns the length, in bytes, of INODE's data. */
 off_t inode_length(const struct inode* inode) { return inode->data.length; }
+
+/* Returns true if INODE is a directory. */
+bool inode_is_dir(const struct inode* inode) { return inode->data.is_dir != 0; }
+
+/* Marks INODE as holding metadata, a directory or the free map,
+   whose data is written through the journal. */
+void inode_set_metadata(struct inode* inode) { inode->metadata = true; }
+
+/* Locks the entries of INODE, a directory, against changes by
+   other threads, so that looking for a name and then adding it,
+   say, happens as one step.  Operations on other directories
+   and on the directory's data go ahead meanwhile. */
+void inode_lock_dir(struct inode* inode) { lock_acquire(&inode->dir_lock); }
+
+/* Unlocks the entries of INODE, a directory. */
+void inode_unlock_dir(struct inode* inode) { lock_release(&inode->dir_lock); }
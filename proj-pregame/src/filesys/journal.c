@@ -0,0 +1,283 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* A write-ahead journal of metadata: inodes, index blocks,
+   directories and the free map.  Their sectors are written
+   through cache_write_logged(), which holds them back in the
+   buffer cache instead of letting them go to their home sectors.
+   A commit copies all of them to the journal, one sequential run
+   of sectors, and only then lets them go home in the usual way.
+   After a crash, journal_open() copies every transaction that
+   was committed in full to its home sectors, so that the disk
+   reflects either all of an operation or none of it.
+
+   An operation that changes metadata is bracketed by
+   journal_begin() and journal_end(), so that a commit, which
+   waits until no operation is under way, never includes part of
+   one.  Commits are made in groups: every time the flusher
+   wakes, when the logged sectors fill half of the room the
+   cache has for them, and when the file system is shut down.
+   Many small operations thus cost one write to the journal.
+
+   The journal is a run of JOURNAL_SECTORS sectors, described by
+   the superblock in JOURNAL_SECTOR.  A transaction takes a
+   descriptor sector naming the home sectors, a copy of each, and
+   a commit sector, all with the same sequence number.  When a
+   transaction would run past the end, everything committed so
+   far is written home and the journal starts over at its
+   beginning, with the superblock recording the sequence number
+   it starts from. */
+
+#define SUPER_MAGIC 0x4c4e524a  /* "JRNL" */
+#define DESC_MAGIC 0x4353444a   /* "JDSC" */
+#define COMMIT_MAGIC 0x544d434a /* "JCMT" */
+
+/* The journal superblock, in JOURNAL_SECTOR. */
+struct journal_super {
+  unsigned magic;       /* SUPER_MAGIC, or the disk has no journal. */
+  block_sector_t start; /* First sector of the journal. */
+  uint32_t cnt;         /* Number of sectors in the journal. */
+  uint32_t seq;         /* Sequence number of the first transaction. */
+  uint8_t unused[496];
+};
+
+/* The first sector of a transaction. */
+struct journal_desc {
+  unsigned magic;                          /* DESC_MAGIC. */
+  uint32_t seq;                            /* Sequence number. */
+  uint32_t cnt;                            /* Number of sectors. */
+  block_sector_t sectors[JOURNAL_TXN_MAX]; /* Home of each copy that follows. */
+};
+
+/* The last sector of a transaction, written once the rest is on
+   disk. */
+struct journal_commit {
+  unsigned magic; /* COMMIT_MAGIC. */
+  uint32_t seq;   /* Sequence number. */
+  uint8_t unused[504];
+};
+
+static bool enabled; /* Does the disk have a journal, and is it open? */
+
+/* Guarded by journal_lock. */
+static struct lock journal_lock;
+static struct condition idle;      /* Signaled when no operation is under way. */
+static struct condition may_begin; /* Signaled when a commit is done. */
+static int active;                 /* Operations under way. */
+static bool commit_wanted;         /* Hold off new operations until a commit? */
+static size_t commit_room;         /* Commit once the cache has only this room. */
+static struct journal_super super;
+static uint32_t seq;  /* Sequence number of the next transaction. */
+static uint32_t head; /* Where it goes, relative to the start. */
+
+/* Copies to or from the journal go through BUFFER this many at
+   a time, so that each batch is one request to the disk. */
+#define BATCH_SECTORS 32
+
+/* Scratch sectors, guarded by journal_lock. */
+static struct journal_desc desc;
+static struct journal_commit commit_rec;
+static uint8_t buffer[BATCH_SECTORS][BLOCK_SECTOR_SIZE];
+
+/* Initializes the journal module.  Until journal_open() finds a
+   journal on disk, operations are bracketed but not logged. */
+void journal_init(void) {
+  ASSERT(sizeof super == BLOCK_SECTOR_SIZE);
+  ASSERT(sizeof desc == BLOCK_SECTOR_SIZE);
+  ASSERT(sizeof commit_rec == BLOCK_SECTOR_SIZE);
+
+  lock_init(&journal_lock);
+  cond_init(&idle);
+  cond_init(&may_begin);
+}
+
+/* Sets aside the sectors of the journal on a disk being
+   formatted, and writes its superblock. */
+void journal_create(void) {
+  memset(&super, 0, sizeof super);
+  if (free_map_allocate(JOURNAL_SECTORS, &super.start)) {
+    super.magic = SUPER_MAGIC;
+    super.cnt = JOURNAL_SECTORS;
+    super.seq = 1;
+
+    /* Whatever the first sector held, it must not pass for a
+       descriptor. */
+    memset(buffer[0], 0, sizeof buffer[0]);
+    block_write(fs_device, super.start, buffer[0]);
+  } else
+    printf("journal: no room for a journal, formatting without one\n");
+  block_write(fs_device, JOURNAL_SECTOR, &super);
+}
+
+/* Starts the journal over at its beginning, once everything
+   committed to it is in its home sectors.  journal_lock must be
+   held, unless the file system is being brought up. */
+static void restart(void) {
+  super.seq = seq;
+  block_write(fs_device, JOURNAL_SECTOR, &super);
+  head = 0;
+}
+
+/* Copies each transaction committed in full to its home sectors,
+   in order, stopping at the first that is not.  Returns the
+   number copied. */
+static size_t replay(void) {
+  size_t cnt = 0;
+
+  seq = super.seq;
+  head = 0;
+  while (head + 2 <= super.cnt) {
+    size_t i, j;
+
+    block_read(fs_device, super.start + head, &desc);
+    if (desc.magic != DESC_MAGIC || desc.seq != seq || desc.cnt > JOURNAL_TXN_MAX ||
+        head + desc.cnt + 2 > super.cnt)
+      break;
+    block_read(fs_device, super.start + head + desc.cnt + 1, &commit_rec);
+    if (commit_rec.magic != COMMIT_MAGIC || commit_rec.seq != seq)
+      break;
+
+    for (i = 0; i < desc.cnt; i += BATCH_SECTORS) {
+      size_t n = desc.cnt - i < BATCH_SECTORS ? desc.cnt - i : BATCH_SECTORS;
+      block_read_multiple(fs_device, super.start + head + 1 + i, n, buffer);
+      for (j = 0; j < n; j++)
+        block_write(fs_device, desc.sectors[i + j], buffer[j]);
+    }
+    head += desc.cnt + 2;
+    seq++;
+    cnt++;
+  }
+  return cnt;
+}
+
+/* Finds the disk's journal, if it has one, brings the disk up to
+   date from it, and starts logging metadata. */
+void journal_open(void) {
+  size_t cnt;
+
+  block_read(fs_device, JOURNAL_SECTOR, &super);
+  if (super.magic != SUPER_MAGIC)
+    return;
+
+  cnt = replay();
+  if (cnt > 0)
+    printf("journal: replayed %zu transactions\n", cnt);
+  restart();
+
+  commit_room = cache_log_room() / 2;
+  enabled = true;
+}
+
+/* Returns true if metadata is being logged. */
+bool journal_enabled(void) { return enabled; }
+
+/* Commits the sectors logged so far as one transaction, and lets
+   blocked operations begin.  journal_lock must be held. */
+static void commit(void) {
+  size_t cnt = enabled ? cache_logged(desc.sectors) : 0;
+
+  if (cnt > 0) {
+    size_t i;
+
+    if (head + cnt + 2 > super.cnt) {
+      cache_flush();
+      restart();
+    }
+
+    desc.magic = DESC_MAGIC;
+    desc.seq = seq;
+    desc.cnt = cnt;
+    block_write(fs_device, super.start + head, &desc);
+    for (i = 0; i < cnt; i += BATCH_SECTORS) {
+      size_t n = cnt - i < BATCH_SECTORS ? cnt - i : BATCH_SECTORS;
+      size_t j;
+      for (j = 0; j < n; j++)
+        cache_read(desc.sectors[i + j], buffer[j]);
+      block_write_multiple(fs_device, super.start + head + 1 + i, n, buffer);
+    }
+    commit_rec.magic = COMMIT_MAGIC;
+    commit_rec.seq = seq;
+    block_write(fs_device, super.start + head + cnt + 1, &commit_rec);
+
+    head += cnt + 2;
+    seq++;
+    cache_unlog();
+  }
+
+  commit_wanted = false;
+  cond_broadcast(&may_begin, &journal_lock);
+  cond_broadcast(&idle, &journal_lock);
+}
+
+/* Begins an operation that changes metadata.  Operations nest:
+   only the outermost one a thread begins counts.  It must be
+   begun before taking any lock that another operation could be
+   waiting for, since it may wait for a commit. */
+void journal_begin(void) {
+  struct thread* t = thread_current();
+
+  if (t->journal_depth++ > 0)
+    return;
+
+  lock_acquire(&journal_lock);
+  while (commit_wanted)
+    cond_wait(&may_begin, &journal_lock);
+  active++;
+  lock_release(&journal_lock);
+}
+
+/* Ends the operation begun by the matching journal_begin(). */
+void journal_end(void) {
+  struct thread* t = thread_current();
+
+  ASSERT(t->journal_depth > 0);
+  if (--t->journal_depth > 0)
+    return;
+
+  lock_acquire(&journal_lock);
+  active--;
+  if (enabled && cache_log_room() <= commit_room)
+    commit_wanted = true;
+  if (active == 0) {
+    if (commit_wanted)
+      commit();
+    else
+      cond_broadcast(&idle, &journal_lock);
+  }
+  lock_release(&journal_lock);
+}
+
+/* Commits every operation ended so far, waiting for those under
+   way to end and holding off new ones meanwhile. */
+void journal_commit(void) {
+  ASSERT(thread_current()->journal_depth == 0);
+
+  if (!enabled)
+    return;
+  lock_acquire(&journal_lock);
+  commit_wanted = true;
+  while (active > 0)
+    cond_wait(&idle, &journal_lock);
+  commit();
+  lock_release(&journal_lock);
+}
+
+/* Commits what is left and writes everything home, so that the
+   next journal_open() has nothing to replay. */
+void journal_close(void) {
+  journal_commit();
+  if (enabled) {
+    lock_acquire(&journal_lock);
+    cache_flush();
+    restart();
+    lock_release(&journal_lock);
+  }
+}
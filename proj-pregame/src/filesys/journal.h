@@ -0,0 +1,23 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+
+/* Most sectors in one transaction: as many as a descriptor
+   sector has room to name. */
+#define JOURNAL_TXN_MAX 125
+
+/* Sectors set aside for the journal when formatting. */
+#define JOURNAL_SECTORS 256
+
+void journal_init(void);
+void journal_create(void);
+void journal_open(void);
+void journal_close(void);
+bool journal_enabled(void);
+
+void journal_begin(void);
+void journal_end(void);
+void journal_commit(void);
+
+#endif /* filesys/journal.h */
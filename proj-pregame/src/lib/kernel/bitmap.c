@@ -165,16 +165,21 @@ void bitmap_set_all(struct bitmap* b, bool value) {
   bitmap_set_multiple(b, 0, bitmap_size(b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Sets the CNT bits starting at START in B to VALUE, a whole
+   element at a time where the range covers one. */
 void bitmap_set_multiple(struct bitmap* b, size_t start, size_t cnt, bool value) {
-  size_t i;
+  size_t end = start + cnt;
 
   ASSERT(b != NULL);
   ASSERT(start <= b->bit_cnt);
   ASSERT(start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    bitmap_set(b, start + i, value);
+  for (; start < end && start % ELEM_BITS != 0; start++)
+    bitmap_set(b, start, value);
+  for (; end - start >= ELEM_BITS; start += ELEM_BITS)
+    b->bits[elem_idx(start)] = value ? (elem_type)-1 : 0;
+  for (; start < end; start++)
+    bitmap_set(b, start, value);
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -193,19 +198,35 @@ size_t bitmap_count(const struct bitmap* b, size_t start, size_t cnt, bool value
   return value_cnt;
 }
 
+/* Returns the index of the first bit in B at or after START, and
+   before END, that is set to VALUE, or END if there is none.
+   Elements with no such bit are passed over whole. */
+static size_t find_bit(const struct bitmap* b, size_t start, size_t end, bool value) {
+  size_t idx;
+
+  if (start >= end)
+    return end;
+  for (idx = elem_idx(start); idx <= elem_idx(end - 1); idx++) {
+    elem_type bits = value ? b->bits[idx] : ~b->bits[idx];
+
+    if (idx == elem_idx(start))
+      bits &= ~(bit_mask(start) - 1);
+    if (bits != 0) {
+      size_t bit_idx = idx * ELEM_BITS + __builtin_ctzl(bits);
+      return bit_idx < end ? bit_idx : end;
+    }
+  }
+  return end;
+}
+
 /* Returns true if any bits in B between START and START + CNT,
    exclusive, are set to VALUE, and false otherwise. */
 bool bitmap_contains(const struct bitmap* b, size_t start, size_t cnt, bool value) {
-  size_t i;
-
   ASSERT(b != NULL);
   ASSERT(start <= b->bit_cnt);
   ASSERT(start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test(b, start + i) == value)
-      return true;
-  return false;
+  return find_bit(b, start, start + cnt, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -231,17 +252,32 @@ bool bitmap_all(const struct bitmap* b, size_t start, size_t cnt) {
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
-   If there is no such group, returns BITMAP_ERROR. */
+   If there is no such group, returns BITMAP_ERROR.
+
+   A candidate group starts at the next bit set to VALUE.  If a
+   bit within it is not, no group that starts before that bit can
+   succeed either, so the search goes on just past it. */
 size_t bitmap_scan(const struct bitmap* b, size_t start, size_t cnt, bool value) {
   ASSERT(b != NULL);
   ASSERT(start <= b->bit_cnt);
 
+  if (cnt == 0)
+    return start;
   if (cnt <= b->bit_cnt) {
     size_t last = b->bit_cnt - cnt;
-    size_t i;
-    for (i = start; i <= last; i++)
-      if (!bitmap_contains(b, i, cnt, !value))
+    size_t i = start;
+
+    while (i <= last) {
+      size_t miss;
+
+      i = find_bit(b, i, last + 1, value);
+      if (i > last)
+        break;
+      miss = find_bit(b, i, i + cnt, !value);
+      if (miss == i + cnt)
         return i;
+      i = miss + 1;
+    }
   }
   return BITMAP_ERROR;
 }
@@ -284,6 +320,22 @@ bool bitmap_write(const struct bitmap* b, struct file* file) {
   off_t size = byte_cnt(b->bit_cnt);
   return file_write_at(file, b->bits, size, 0) == size;
 }
+
+/* Writes the part of B that holds the CNT bits starting at START
+   to FILE, where bitmap_write() would put it, rounded out to
+   whole elements.  Returns true if successful, false otherwise. */
+bool bitmap_write_range(const struct bitmap* b, struct file* file, size_t start, size_t cnt) {
+  size_t first, last;
+  off_t size;
+
+  ASSERT(start + cnt <= b->bit_cnt);
+  if (cnt == 0)
+    return true;
+  first = elem_idx(start);
+  last = elem_idx(start + cnt - 1);
+  size = (last - first + 1) * sizeof(elem_type);
+  return file_write_at(file, b->bits + first, size, first * sizeof(elem_type)) == size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
@@ -1,6 +1,7 @@
 #include <console.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 #include "devices/serial.h"
 #include "devices/vga.h"
 #include "threads/init.h"
@@ -8,7 +9,16 @@
 #include "threads/synch.h"
 
 static void vprintf_helper(char, void*);
-static void putchar_have_lock(uint8_t c);
+static void write_have_lock(const char* buffer, size_t n);
+
+/* vprintf() output is gathered here and written a chunk at a
+   time. */
+#define VPRINTF_CHUNK 64
+struct vprintf_aux {
+  int char_cnt;            /* Characters written so far. */
+  size_t len;              /* Characters in BUF. */
+  char buf[VPRINTF_CHUNK]; /* Not yet written. */
+};
 
 /* The console lock.
    Both the vga and serial layers do their own locking, so it's
@@ -103,22 +113,24 @@ static bool console_locked_by_current_thread(void) {
    which is like printf() but uses a va_list.
    Writes its output to both vga display and serial port. */
 int vprintf(const char* format, va_list args) {
-  int char_cnt = 0;
+  struct vprintf_aux aux;
 
+  aux.char_cnt = 0;
+  aux.len = 0;
   acquire_console();
-  __vprintf(format, args, vprintf_helper, &char_cnt);
+  __vprintf(format, args, vprintf_helper, &aux);
+  write_have_lock(aux.buf, aux.len);
   release_console();
 
-  return char_cnt;
+  return aux.char_cnt;
 }
 
 /* Writes string S to the console, followed by a new-line
    character. */
 int puts(const char* s) {
   acquire_console();
-  while (*s != '\0')
-    putchar_have_lock(*s++);
-  putchar_have_lock('\n');
+  write_have_lock(s, strlen(s));
+  write_have_lock("\n", 1);
   release_console();
 
   return 0;
@@ -127,33 +139,38 @@ int puts(const char* s) {
 /* Writes the N characters in BUFFER to the console. */
 void putbuf(const char* buffer, size_t n) {
   acquire_console();
-  while (n-- > 0)
-    putchar_have_lock(*buffer++);
+  write_have_lock(buffer, n);
   release_console();
 }
 
 /* Writes C to the vga display and serial port. */
 int putchar(int c) {
+  char byte = c;
+
   acquire_console();
-  putchar_have_lock(c);
+  write_have_lock(&byte, 1);
   release_console();
 
   return c;
 }
 
 /* Helper function for vprintf(). */
-static void vprintf_helper(char c, void* char_cnt_) {
-  int* char_cnt = char_cnt_;
-  (*char_cnt)++;
-  putchar_have_lock(c);
+static void vprintf_helper(char c, void* aux_) {
+  struct vprintf_aux* aux = aux_;
+  aux->char_cnt++;
+  aux->buf[aux->len++] = c;
+  if (aux->len >= sizeof aux->buf) {
+    write_have_lock(aux->buf, aux->len);
+    aux->len = 0;
+  }
 }
 
-/* Writes C to the vga display and serial port.
-   The caller has already acquired the console lock if
-   appropriate. */
-static void putchar_have_lock(uint8_t c) {
+/* Writes the N characters in BUFFER to the vga display and
+   serial port, each in one pass.  The caller has already
+   acquired the console lock if appropriate. */
+static void write_have_lock(const char* buffer, size_t n) {
   ASSERT(console_locked_by_current_thread());
-  write_cnt++;
-  serial_putc(c);
-  vga_putc(c);
+  write_cnt += n;
+  serial_write((const uint8_t*)buffer, n);
+  vga_write(buffer, n);
 }
@@ -6,6 +6,7 @@
    See hash.h for basic information. */
 
 #include "hash.h"
+#include <string.h>
 #include "../debug.h"
 #include "threads/malloc.h"
 
@@ -15,6 +16,7 @@ static struct list* find_bucket(struct hash*, struct hash_elem*);
 static struct hash_elem* find_elem(struct hash*, struct list*, struct hash_elem*);
 static void insert_elem(struct hash*, struct list*, struct hash_elem*);
 static void remove_elem(struct hash*, struct hash_elem*);
+static struct list* next_bucket(struct hash*, struct list*);
 static void rehash(struct hash*);
 
 /* Initializes hash table H to compute hash values using HASH and
@@ -26,6 +28,9 @@ bool hash_init(struct hash* h, hash_hash_func* hash, hash_less_func* less, void*
   h->hash = hash;
   h->less = less;
   h->aux = aux;
+  h->old_bucket_cnt = 0;
+  h->old_buckets = NULL;
+  h->moved_cnt = 0;
 
   if (h->buckets != NULL) {
     hash_clear(h, NULL);
@@ -44,11 +49,9 @@ bool hash_init(struct hash* h, hash_hash_func* hash, hash_less_func* less, void*
    hash_replace(), or hash_delete(), yields undefined behavior,
    whether done in DESTRUCTOR or elsewhere. */
 void hash_clear(struct hash* h, hash_action_func* destructor) {
-  size_t i;
-
-  for (i = 0; i < h->bucket_cnt; i++) {
-    struct list* bucket = &h->buckets[i];
+  struct list* bucket;
 
+  for (bucket = h->buckets; bucket != NULL; bucket = next_bucket(h, bucket)) {
     if (destructor != NULL)
       while (!list_empty(bucket)) {
         struct list_elem* list_elem = list_pop_front(bucket);
@@ -59,6 +62,8 @@ void hash_clear(struct hash* h, hash_action_func* destructor) {
     list_init(bucket);
   }
 
+  free(h->old_buckets);
+  h->old_buckets = NULL;
   h->elem_cnt = 0;
 }
 
@@ -76,6 +81,7 @@ void hash_destroy(struct hash* h, hash_action_func* destructor) {
   if (destructor != NULL)
     hash_clear(h, destructor);
   free(h->buckets);
+  free(h->old_buckets);
 }
 
 /* Inserts NEW into hash table H and returns a null pointer, if
@@ -138,12 +144,11 @@ struct hash_elem* hash_delete(struct hash* h, struct hash_elem* e) {
    hash_insert(), hash_replace(), or hash_delete(), yields
    undefined behavior, whether done from ACTION or elsewhere. */
 void hash_apply(struct hash* h, hash_action_func* action) {
-  size_t i;
+  struct list* bucket;
 
   ASSERT(action != NULL);
 
-  for (i = 0; i < h->bucket_cnt; i++) {
-    struct list* bucket = &h->buckets[i];
+  for (bucket = h->buckets; bucket != NULL; bucket = next_bucket(h, bucket)) {
     struct list_elem *elem, *next;
 
     for (elem = list_begin(bucket); elem != list_end(bucket); elem = next) {
@@ -192,7 +197,8 @@ struct hash_elem* hash_next(struct hash_iterator* i) {
 
   i->elem = list_elem_to_hash_elem(list_next(&i->elem->list_elem));
   while (i->elem == list_elem_to_hash_elem(list_end(i->bucket))) {
-    if (++i->bucket >= i->hash->buckets + i->hash->bucket_cnt) {
+    i->bucket = next_bucket(i->hash, i->bucket);
+    if (i->bucket == NULL) {
       i->elem = NULL;
       break;
     }
@@ -215,46 +221,119 @@ size_t hash_size(struct hash* h) { return h->elem_cnt; }
 /* Returns true if H contains no elements, false otherwise. */
 bool hash_empty(struct hash* h) { return h->elem_cnt == 0; }
 
-/* Fowler-Noll-Vo hash constants, for 32-bit word sizes. */
-#define FNV_32_PRIME 16777619u
-#define FNV_32_BASIS 2166136261u
+/* MurmurHash3 constants, for its 32-bit version. */
+#define MURMUR_C1 0xcc9e2d51u
+#define MURMUR_C2 0x1b873593u
+#define MURMUR_SEED 0x9747b28cu
+
+/* A word that may alias anything, and be unaligned. */
+typedef uint32_t __attribute__((may_alias, aligned(1))) unaligned_word;
+
+/* Returns X rotated left by R bits. */
+static inline uint32_t rotl32(uint32_t x, int r) { return (x << r) | (x >> (32 - r)); }
+
+/* Scrambles K, a word of input, for mixing into a MurmurHash3
+   hash. */
+static inline uint32_t murmur_scramble(uint32_t k) {
+  k *= MURMUR_C1;
+  k = rotl32(k, 15);
+  return k * MURMUR_C2;
+}
 
 /* Returns a hash of the SIZE bytes in BUF. */
 unsigned hash_bytes(const void* buf_, size_t size) {
-  /* Fowler-Noll-Vo 32-bit hash, for bytes. */
+  /* MurmurHash3 32-bit hash, mixing in a word at a time. */
   const unsigned char* buf = buf_;
-  unsigned hash;
+  uint32_t hash = MURMUR_SEED;
+  uint32_t k = 0;
+  size_t left;
 
   ASSERT(buf != NULL);
 
-  hash = FNV_32_BASIS;
-  while (size-- > 0)
-    hash = (hash * FNV_32_PRIME) ^ *buf++;
+  for (left = size; left >= 4; left -= 4, buf += 4) {
+    hash ^= murmur_scramble(*(const unaligned_word*)buf);
+    hash = rotl32(hash, 13) * 5 + 0xe6546b64;
+  }
+  switch (left) {
+    case 3:
+      k ^= buf[2] << 16;
+      /* Fall through. */
+    case 2:
+      k ^= buf[1] << 8;
+      /* Fall through. */
+    case 1:
+      k ^= buf[0];
+      hash ^= murmur_scramble(k);
+  }
 
-  return hash;
+  return hash_u32(hash ^ size);
 }
 
 /* Returns a hash of string S. */
-unsigned hash_string(const char* s_) {
-  const unsigned char* s = (const unsigned char*)s_;
+unsigned hash_string(const char* s) {
+  ASSERT(s != NULL);
+  return hash_bytes(s, strlen(s));
+}
+
+/* Returns a hash of integer I. */
+unsigned hash_int(int i) { return hash_u32(i); }
+
+/* Returns a hash of X, in which each bit of X affects each bit of
+   the hash about half the time: MurmurHash3's finalizer.  That
+   suits keys, like sector numbers and page addresses, that differ
+   only in a few bits. */
+unsigned hash_u32(uint32_t x) {
+  x ^= x >> 16;
+  x *= 0x85ebca6bu;
+  x ^= x >> 13;
+  x *= 0xc2b2ae35u;
+  x ^= x >> 16;
+  return x;
+}
+
+/* Fowler-Noll-Vo hash constants, for 32-bit word sizes. */
+#define FNV_32_PRIME 16777619u
+#define FNV_32_BASIS 2166136261u
+
+/* Returns the byte-at-a-time Fowler-Noll-Vo 32-bit hash of the
+   SIZE bytes in BUF, for callers that want it in particular. */
+unsigned hash_fnv(const void* buf_, size_t size) {
+  const unsigned char* buf = buf_;
   unsigned hash;
 
-  ASSERT(s != NULL);
+  ASSERT(buf != NULL);
 
   hash = FNV_32_BASIS;
-  while (*s != '\0')
-    hash = (hash * FNV_32_PRIME) ^ *s++;
+  while (size-- > 0)
+    hash = (hash * FNV_32_PRIME) ^ *buf++;
 
   return hash;
 }
 
-/* Returns a hash of integer I. */
-unsigned hash_int(int i) { return hash_bytes(&i, sizeof i); }
-
-/* Returns the bucket in H that E belongs in. */
+/* Returns the bucket in H that E belongs in: its old bucket, if
+   that has not been emptied yet, or else its bucket in the
+   current array. */
 static struct list* find_bucket(struct hash* h, struct hash_elem* e) {
-  size_t bucket_idx = h->hash(e, h->aux) & (h->bucket_cnt - 1);
-  return &h->buckets[bucket_idx];
+  unsigned hash = h->hash(e, h->aux);
+
+  if (h->old_buckets != NULL) {
+    size_t old_idx = hash & (h->old_bucket_cnt - 1);
+    if (old_idx >= h->moved_cnt)
+      return &h->old_buckets[old_idx];
+  }
+  return &h->buckets[hash & (h->bucket_cnt - 1)];
+}
+
+/* Returns the bucket of H that follows BUCKET: each of the
+   current array in turn, then each old one not yet emptied.
+   Returns a null pointer after the last. */
+static struct list* next_bucket(struct hash* h, struct list* bucket) {
+  if (bucket >= h->buckets && bucket < h->buckets + h->bucket_cnt) {
+    if (++bucket < h->buckets + h->bucket_cnt)
+      return bucket;
+    return h->old_buckets != NULL ? &h->old_buckets[h->moved_cnt] : NULL;
+  }
+  return ++bucket < h->old_buckets + h->old_bucket_cnt ? bucket : NULL;
 }
 
 /* Searches BUCKET in H for a hash element equal to E.  Returns
@@ -281,65 +360,67 @@ static inline size_t is_power_of_2(size_t x) { return x != 0 && turn_off_least_1
 #define BEST_ELEMS_PER_BUCKET 2 /* Ideal elems/bucket. */
 #define MAX_ELEMS_PER_BUCKET 4  /* Elems/bucket > 4: increase # of buckets. */
 
-/* Changes the number of buckets in hash table H to match the
-   ideal.  This function can fail because of an out-of-memory
-   condition, but that'll just make hash accesses less efficient;
-   we can still continue. */
+/* Old buckets emptied by each insertion or deletion while H is
+   being resized.  Growing at MAX_ELEMS_PER_BUCKET to about
+   BEST_ELEMS_PER_BUCKET doubles the bucket count at least, so
+   the old buckets are all emptied well before the new ones fill
+   up in turn. */
+#define MOVES_PER_OP 2
+
+/* Starts resizing hash table H to the ideal number of buckets if
+   its elements per bucket have left the range above, and then
+   carries on with resizing it, if it is being resized.  Failing
+   to allocate the new buckets just leaves the table as it is,
+   less efficient but still usable, to try again next time. */
 static void rehash(struct hash* h) {
-  size_t old_bucket_cnt, new_bucket_cnt;
-  struct list *new_buckets, *old_buckets;
   size_t i;
 
   ASSERT(h != NULL);
 
-  /* Save old bucket info for later use. */
-  old_buckets = h->buckets;
-  old_bucket_cnt = h->bucket_cnt;
-
-  /* Calculate the number of buckets to use now.
-     We want one bucket for about every BEST_ELEMS_PER_BUCKET.
-     We must have at least four buckets, and the number of
-     buckets must be a power of 2. */
-  new_bucket_cnt = h->elem_cnt / BEST_ELEMS_PER_BUCKET;
-  if (new_bucket_cnt < 4)
-    new_bucket_cnt = 4;
-  while (!is_power_of_2(new_bucket_cnt))
-    new_bucket_cnt = turn_off_least_1bit(new_bucket_cnt);
-
-  /* Don't do anything if the bucket count wouldn't change. */
-  if (new_bucket_cnt == old_bucket_cnt)
-    return;
-
-  /* Allocate new buckets and initialize them as empty. */
-  new_buckets = malloc(sizeof *new_buckets * new_bucket_cnt);
-  if (new_buckets == NULL) {
-    /* Allocation failed.  This means that use of the hash table will
-         be less efficient.  However, it is still usable, so
-         there's no reason for it to be an error. */
-    return;
+  if (h->old_buckets == NULL && (h->elem_cnt > h->bucket_cnt * MAX_ELEMS_PER_BUCKET ||
+                                 (h->elem_cnt < h->bucket_cnt * MIN_ELEMS_PER_BUCKET &&
+                                  h->bucket_cnt > 4))) {
+    struct list* new_buckets;
+    size_t new_bucket_cnt;
+
+    /* Calculate the number of buckets to use now.
+       We want one bucket for about every BEST_ELEMS_PER_BUCKET.
+       We must have at least four buckets, and the number of
+       buckets must be a power of 2. */
+    new_bucket_cnt = h->elem_cnt / BEST_ELEMS_PER_BUCKET;
+    if (new_bucket_cnt < 4)
+      new_bucket_cnt = 4;
+    while (!is_power_of_2(new_bucket_cnt))
+      new_bucket_cnt = turn_off_least_1bit(new_bucket_cnt);
+
+    new_buckets = malloc(sizeof *new_buckets * new_bucket_cnt);
+    if (new_buckets == NULL)
+      return;
+    for (i = 0; i < new_bucket_cnt; i++)
+      list_init(&new_buckets[i]);
+
+    /* The current buckets become the old ones, to be emptied. */
+    h->old_buckets = h->buckets;
+    h->old_bucket_cnt = h->bucket_cnt;
+    h->moved_cnt = 0;
+    h->buckets = new_buckets;
+    h->bucket_cnt = new_bucket_cnt;
   }
-  for (i = 0; i < new_bucket_cnt; i++)
-    list_init(&new_buckets[i]);
 
-  /* Install new bucket info. */
-  h->buckets = new_buckets;
-  h->bucket_cnt = new_bucket_cnt;
+  /* Move the elements of the next few old buckets. */
+  for (i = 0; i < MOVES_PER_OP && h->old_buckets != NULL; i++) {
+    struct list* old_bucket = &h->old_buckets[h->moved_cnt++];
 
-  /* Move each old element into the appropriate new bucket. */
-  for (i = 0; i < old_bucket_cnt; i++) {
-    struct list* old_bucket;
-    struct list_elem *elem, *next;
-
-    old_bucket = &old_buckets[i];
-    for (elem = list_begin(old_bucket); elem != list_end(old_bucket); elem = next) {
-      struct list* new_bucket = find_bucket(h, list_elem_to_hash_elem(elem));
-      next = list_next(elem);
-      list_remove(elem);
-      list_push_front(new_bucket, elem);
+    while (!list_empty(old_bucket)) {
+      struct list_elem* elem = list_pop_front(old_bucket);
+      unsigned hash = h->hash(list_elem_to_hash_elem(elem), h->aux);
+      list_push_front(&h->buckets[hash & (h->bucket_cnt - 1)], elem);
+    }
+    if (h->moved_cnt == h->old_bucket_cnt) {
+      free(h->old_buckets);
+      h->old_buckets = NULL;
     }
   }
-
-  free(old_buckets);
 }
 
 /* Inserts E into BUCKET (in hash table H). */
@@ -18,7 +18,13 @@
    conversion from a struct hash_elem back to a structure object
    that contains it.  This is the same technique used in the
    linked list implementation.  Refer to lib/kernel/list.h for a
-   detailed explanation. */
+   detailed explanation.
+
+   The table is resized incrementally.  When it grows too full
+   or too empty, a new array of buckets is allocated, and each
+   insertion or deletion thereafter moves the elements of a few
+   of the old buckets into it, until none are left.  No single
+   operation thus pays for moving every element. */
 
 #include <stdbool.h>
 #include <stddef.h>
@@ -59,6 +65,12 @@ struct hash {
   hash_hash_func* hash; /* Hash function. */
   hash_less_func* less; /* Comparison function. */
   void* aux;            /* Auxiliary data for `hash' and `less'. */
+
+  /* While resizing, the buckets being emptied into `buckets'.
+     Those below `moved_cnt' are empty. */
+  size_t old_bucket_cnt;    /* Number of old buckets, a power of 2. */
+  struct list* old_buckets; /* Array of old buckets, or null. */
+  size_t moved_cnt;         /* Old buckets emptied so far. */
 };
 
 /* A hash table iterator. */
@@ -93,5 +105,7 @@ bool hash_empty(struct hash*);
 unsigned hash_bytes(const void*, size_t);
 unsigned hash_string(const char*);
 unsigned hash_int(int);
+unsigned hash_u32(uint32_t);
+unsigned hash_fnv(const void*, size_t);
 
 #endif /* lib/kernel/hash.h */
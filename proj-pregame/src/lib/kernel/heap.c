@@ -0,0 +1,121 @@
+#include "heap.h"
+#include "../debug.h"
+
+/* Pairing heap.  See heap.h for basic information.
+
+   The elements form a tree with each element no less than its
+   children.  An element's children are a list linked through
+   their `next' and `prev' members, whose first one the parent
+   points to with `child'.  Two trees are merged by making the
+   lesser root the first child of the other, and removing a root
+   merges its children in pairs from the first, then the pairs
+   into one from the last; both passes are loops, so that a long
+   list of children does not use up the stack. */
+
+/* Merges the trees with roots A and B, either of which may be
+   null, and returns the root of the result. */
+static struct heap_elem* link(struct heap* h, struct heap_elem* a, struct heap_elem* b) {
+  struct heap_elem* tmp;
+
+  if (a == NULL)
+    return b;
+  if (b == NULL)
+    return a;
+  if (h->less(a, b, h->aux)) {
+    tmp = a;
+    a = b;
+    b = tmp;
+  }
+
+  b->next = a->child;
+  if (b->next != NULL)
+    b->next->prev = b;
+  b->prev = a;
+  a->child = b;
+  return a;
+}
+
+/* Merges the list of trees starting at FIRST into one tree and
+   returns its root. */
+static struct heap_elem* merge_pairs(struct heap* h, struct heap_elem* first) {
+  struct heap_elem* pairs = NULL; /* Merged pairs, last first. */
+  struct heap_elem* root = NULL;
+
+  while (first != NULL) {
+    struct heap_elem* a = first;
+    struct heap_elem* b = a->next;
+    first = b != NULL ? b->next : NULL;
+    a->next = a->prev = NULL;
+    if (b != NULL)
+      b->next = b->prev = NULL;
+    a = link(h, a, b);
+    a->next = pairs;
+    pairs = a;
+  }
+
+  while (pairs != NULL) {
+    struct heap_elem* next = pairs->next;
+    pairs->next = NULL;
+    root = link(h, root, pairs);
+    pairs = next;
+  }
+  return root;
+}
+
+/* Initializes H as an empty heap ordered by LESS, given
+   auxiliary data AUX. */
+void heap_init(struct heap* h, heap_less_func* less, void* aux) {
+  ASSERT(h != NULL);
+  ASSERT(less != NULL);
+
+  h->root = NULL;
+  h->less = less;
+  h->aux = aux;
+}
+
+/* Returns true if H is empty, false otherwise. */
+bool heap_empty(const struct heap* h) { return h->root == NULL; }
+
+/* Returns the greatest element in H, which must not be empty.
+   Of elements that are equal, which one is unspecified. */
+struct heap_elem* heap_top(const struct heap* h) {
+  ASSERT(!heap_empty(h));
+  return h->root;
+}
+
+/* Inserts E into H. */
+void heap_push(struct heap* h, struct heap_elem* e) {
+  ASSERT(e != NULL);
+
+  e->child = e->next = e->prev = NULL;
+  h->root = link(h, h->root, e);
+}
+
+/* Removes the greatest element from H, which must not be empty,
+   and returns it. */
+struct heap_elem* heap_pop(struct heap* h) {
+  struct heap_elem* top = heap_top(h);
+
+  h->root = merge_pairs(h, top->child);
+  return top;
+}
+
+/* Removes E, which must be in H, from H. */
+void heap_remove(struct heap* h, struct heap_elem* e) {
+  ASSERT(e != NULL);
+
+  if (e == h->root) {
+    heap_pop(h);
+    return;
+  }
+
+  /* Unlink E's tree from its siblings, then merge its children
+     back in with the rest. */
+  if (e->prev->child == e)
+    e->prev->child = e->next;
+  else
+    e->prev->next = e->next;
+  if (e->next != NULL)
+    e->next->prev = e->prev;
+  h->root = link(h, h->root, merge_pairs(h, e->child));
+}
@@ -0,0 +1,56 @@
+#ifndef __LIB_KERNEL_HEAP_H
+#define __LIB_KERNEL_HEAP_H
+
+/* Priority queue.
+
+   This is a pairing heap, which takes O(1) time to insert an
+   element and O(log n) amortized time to remove the greatest or
+   any other element.  As with lists, the heap does not use
+   dynamic allocation: each structure that can be in a heap
+   embeds a struct heap_elem member, and heap_entry converts a
+   pointer to it back to a pointer to the structure.  Refer to
+   lib/kernel/list.h for a detailed explanation.
+
+   An element's value must not change while it is in a heap.  To
+   change it, remove the element, change it, and insert it again. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Heap element. */
+struct heap_elem {
+  struct heap_elem* child; /* First child. */
+  struct heap_elem* next;  /* Next sibling. */
+  struct heap_elem* prev;  /* Previous sibling, or the parent of
+                              a first child; null for the root. */
+};
+
+/* Converts pointer to heap element HEAP_ELEM into a pointer to
+   the structure that HEAP_ELEM is embedded inside.  Supply the
+   name of the outer structure STRUCT and the member name MEMBER
+   of the heap element. */
+#define heap_entry(HEAP_ELEM, STRUCT, MEMBER)                                                      \
+  ((STRUCT*)((uint8_t*)(HEAP_ELEM) - offsetof(STRUCT, MEMBER)))
+
+/* Compares the value of two heap elements A and B, given
+   auxiliary data AUX.  Returns true if A is less than B, or
+   false if A is greater than or equal to B. */
+typedef bool heap_less_func(const struct heap_elem* a, const struct heap_elem* b, void* aux);
+
+/* Heap. */
+struct heap {
+  struct heap_elem* root; /* Greatest element, or null if empty. */
+  heap_less_func* less;   /* Comparison function. */
+  void* aux;              /* Auxiliary data for `less'. */
+};
+
+void heap_init(struct heap*, heap_less_func*, void* aux);
+bool heap_empty(const struct heap*);
+struct heap_elem* heap_top(const struct heap*);
+
+void heap_push(struct heap*, struct heap_elem*);
+struct heap_elem* heap_pop(struct heap*);
+void heap_remove(struct heap*, struct heap_elem*);
+
+#endif /* lib/kernel/heap.h */
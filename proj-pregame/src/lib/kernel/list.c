@@ -250,7 +250,8 @@ struct list_elem* list_back(struct list* list) {
 }
 
 /* Returns the number of elements in LIST.
-   Runs in O(n) in the number of elements. */
+   Runs in O(n) in the number of elements; counted_list_size()
+   runs in O(1). */
 size_t list_size(struct list* list) {
   struct list_elem* e;
   size_t cnt = 0;
@@ -439,3 +440,89 @@ struct list_elem* list_min(struct list* list, list_less_func* less, void* aux) {
   }
   return min;
 }
+
+/* Initializes CLIST as an empty counted list. */
+void counted_list_init(struct counted_list* clist) {
+  ASSERT(clist != NULL);
+  list_init(&clist->list);
+  clist->size = 0;
+}
+
+/* Inserts ELEM just before BEFORE, which must be in CLIST. */
+void counted_list_insert(struct counted_list* clist, struct list_elem* before,
+                         struct list_elem* elem) {
+  list_insert(before, elem);
+  clist->size++;
+}
+
+/* Removes elements FIRST through LAST (exclusive) from counted
+   list FROM and inserts them just before BEFORE, which must be
+   in CLIST.  Runs in O(1) when FIRST through LAST is the whole
+   of FROM, and otherwise in O(n) in the number of elements
+   moved, which have to be counted. */
+void counted_list_splice(struct counted_list* clist, struct list_elem* before,
+                         struct counted_list* from, struct list_elem* first,
+                         struct list_elem* last) {
+  size_t cnt;
+
+  if (first == list_begin(&from->list) && last == list_end(&from->list))
+    cnt = from->size;
+  else {
+    struct list_elem* e;
+
+    cnt = 0;
+    for (e = first; e != last; e = list_next(e))
+      cnt++;
+  }
+  list_splice(before, first, last);
+  from->size -= cnt;
+  clist->size += cnt;
+}
+
+/* Inserts ELEM at the beginning of CLIST. */
+void counted_list_push_front(struct counted_list* clist, struct list_elem* elem) {
+  counted_list_insert(clist, list_begin(&clist->list), elem);
+}
+
+/* Inserts ELEM at the end of CLIST. */
+void counted_list_push_back(struct counted_list* clist, struct list_elem* elem) {
+  counted_list_insert(clist, list_end(&clist->list), elem);
+}
+
+/* Inserts ELEM in the proper position in CLIST, as
+   list_insert_ordered() does. */
+void counted_list_insert_ordered(struct counted_list* clist, struct list_elem* elem,
+                                 list_less_func* less, void* aux) {
+  list_insert_ordered(&clist->list, elem, less, aux);
+  clist->size++;
+}
+
+/* Removes ELEM, which must be in CLIST, and returns the element
+   that followed it. */
+struct list_elem* counted_list_remove(struct counted_list* clist, struct list_elem* elem) {
+  ASSERT(clist->size > 0);
+  clist->size--;
+  return list_remove(elem);
+}
+
+/* Removes the front element from CLIST and returns it.
+   Undefined behavior if CLIST is empty before removal. */
+struct list_elem* counted_list_pop_front(struct counted_list* clist) {
+  struct list_elem* front = list_front(&clist->list);
+  counted_list_remove(clist, front);
+  return front;
+}
+
+/* Removes the back element from CLIST and returns it.
+   Undefined behavior if CLIST is empty before removal. */
+struct list_elem* counted_list_pop_back(struct counted_list* clist) {
+  struct list_elem* back = list_back(&clist->list);
+  counted_list_remove(clist, back);
+  return back;
+}
+
+/* Returns the number of elements in CLIST, in O(1). */
+size_t counted_list_size(struct counted_list* clist) { return clist->size; }
+
+/* Returns true if CLIST is empty, false otherwise. */
+bool counted_list_empty(struct counted_list* clist) { return clist->size == 0; }
@@ -171,4 +171,38 @@ void list_unique(struct list*, struct list* duplicates, list_less_func*, void* a
 struct list_elem* list_max(struct list*, list_less_func*, void* aux);
 struct list_elem* list_min(struct list*, list_less_func*, void* aux);
 
+/* Counted lists.
+
+   A counted list also keeps count of its elements, so that
+   counted_list_size() runs in O(1) rather than in O(n) as
+   list_size() does.  The count stays right only as long as
+   elements are added and removed through the counted_list_*()
+   functions; its LIST member may still be traversed, sorted,
+   reversed and searched with the list_*() functions, which
+   leave the number of elements as it is. */
+struct counted_list {
+  struct list list; /* The elements. */
+  size_t size;      /* Number of elements in LIST. */
+};
+
+void counted_list_init(struct counted_list*);
+
+/* Counted list insertion. */
+void counted_list_insert(struct counted_list*, struct list_elem* before, struct list_elem*);
+void counted_list_splice(struct counted_list*, struct list_elem* before, struct counted_list* from,
+                         struct list_elem* first, struct list_elem* last);
+void counted_list_push_front(struct counted_list*, struct list_elem*);
+void counted_list_push_back(struct counted_list*, struct list_elem*);
+void counted_list_insert_ordered(struct counted_list*, struct list_elem*, list_less_func*,
+                                 void* aux);
+
+/* Counted list removal. */
+struct list_elem* counted_list_remove(struct counted_list*, struct list_elem*);
+struct list_elem* counted_list_pop_front(struct counted_list*);
+struct list_elem* counted_list_pop_back(struct counted_list*);
+
+/* Counted list properties. */
+size_t counted_list_size(struct counted_list*);
+bool counted_list_empty(struct counted_list*);
+
 #endif /* lib/kernel/list.h */
@@ -0,0 +1,331 @@
+#include "rbtree.h"
+#include "../debug.h"
+
+/* Red-black tree.  See rbtree.h for basic information.
+
+   Each element is less than or equal to its right child and the
+   elements below it, and greater than its left child and the
+   elements below it.  The colors keep the tree balanced: the
+   root is black, a red element has no red child, and every path
+   from an element down to a missing child passes through the
+   same number of black elements, so that no path is more than
+   twice as long as any other.  Insertion and removal restore
+   these rules with recoloring and at most three rotations, in
+   loops rather than by recursion. */
+
+/* Returns true if N is a red element, false if it is black or
+   null. */
+static inline bool is_red(const struct rb_node* n) { return n != NULL && n->red; }
+
+/* Puts NEW in OLD's place as a child of OLD's parent, or as the
+   root of T.  Does not change NEW's parent. */
+static void replace_child(struct rb_tree* t, struct rb_node* old, struct rb_node* new) {
+  if (old->parent == NULL)
+    t->root = new;
+  else if (old == old->parent->left)
+    old->parent->left = new;
+  else
+    old->parent->right = new;
+}
+
+/* Rotates the right child of X into X's place, making X its left
+   child. */
+static void rotate_left(struct rb_tree* t, struct rb_node* x) {
+  struct rb_node* y = x->right;
+
+  x->right = y->left;
+  if (y->left != NULL)
+    y->left->parent = x;
+  y->parent = x->parent;
+  replace_child(t, x, y);
+  y->left = x;
+  x->parent = y;
+}
+
+/* Rotates the left child of X into X's place, making X its right
+   child. */
+static void rotate_right(struct rb_tree* t, struct rb_node* x) {
+  struct rb_node* y = x->left;
+
+  x->left = y->right;
+  if (y->right != NULL)
+    y->right->parent = x;
+  y->parent = x->parent;
+  replace_child(t, x, y);
+  y->right = x;
+  x->parent = y;
+}
+
+/* Returns the least element at or below N, which must not be
+   null. */
+static struct rb_node* leftmost(struct rb_node* n) {
+  while (n->left != NULL)
+    n = n->left;
+  return n;
+}
+
+/* Returns the greatest element at or below N, which must not be
+   null. */
+static struct rb_node* rightmost(struct rb_node* n) {
+  while (n->right != NULL)
+    n = n->right;
+  return n;
+}
+
+/* Initializes T as an empty tree ordered by LESS, given
+   auxiliary data AUX. */
+void rb_init(struct rb_tree* t, rb_less_func* less, void* aux) {
+  ASSERT(t != NULL);
+  ASSERT(less != NULL);
+
+  t->root = NULL;
+  t->elem_cnt = 0;
+  t->less = less;
+  t->aux = aux;
+}
+
+/* Returns true if T is empty, false otherwise. */
+bool rb_empty(const struct rb_tree* t) { return t->root == NULL; }
+
+/* Returns the number of elements in T. */
+size_t rb_size(const struct rb_tree* t) { return t->elem_cnt; }
+
+/* Inserts N into T, after any elements equal to it. */
+void rb_insert(struct rb_tree* t, struct rb_node* n) {
+  struct rb_node* parent = NULL;
+  struct rb_node** link = &t->root;
+
+  ASSERT(n != NULL);
+
+  while (*link != NULL) {
+    parent = *link;
+    link = t->less(n, parent, t->aux) ? &parent->left : &parent->right;
+  }
+  n->parent = parent;
+  n->left = n->right = NULL;
+  n->red = true;
+  *link = n;
+  t->elem_cnt++;
+
+  /* N is red, so the only rule it can break is that its parent
+     may be red too.  Push the red up the tree while N's uncle is
+     red, then rotate it away. */
+  while (is_red(n->parent)) {
+    struct rb_node* p = n->parent;
+    struct rb_node* g = p->parent; /* Not null: the root is black. */
+
+    if (p == g->left) {
+      struct rb_node* u = g->right;
+      if (is_red(u)) {
+        p->red = u->red = false;
+        g->red = true;
+        n = g;
+        continue;
+      }
+      if (n == p->right) {
+        rotate_left(t, p);
+        n = p;
+        p = n->parent;
+      }
+      p->red = false;
+      g->red = true;
+      rotate_right(t, g);
+    } else {
+      struct rb_node* u = g->left;
+      if (is_red(u)) {
+        p->red = u->red = false;
+        g->red = true;
+        n = g;
+        continue;
+      }
+      if (n == p->left) {
+        rotate_right(t, p);
+        n = p;
+        p = n->parent;
+      }
+      p->red = false;
+      g->red = true;
+      rotate_left(t, g);
+    }
+  }
+  t->root->red = false;
+}
+
+/* Removes N, which must be in T, from T. */
+void rb_remove(struct rb_tree* t, struct rb_node* n) {
+  struct rb_node* x;  /* Moves into the place of the element unlinked. */
+  struct rb_node* xp; /* X's parent, since X may be null. */
+  bool was_red;       /* Color of the element unlinked. */
+
+  ASSERT(n != NULL);
+  ASSERT(t->elem_cnt > 0);
+
+  /* Unlink N if it has a missing child, and otherwise its
+     successor, which then takes N's place and color. */
+  if (n->left == NULL || n->right == NULL) {
+    x = n->left != NULL ? n->left : n->right;
+    xp = n->parent;
+    was_red = n->red;
+    replace_child(t, n, x);
+    if (x != NULL)
+      x->parent = xp;
+  } else {
+    struct rb_node* y = leftmost(n->right);
+
+    x = y->right;
+    was_red = y->red;
+    if (y->parent == n)
+      xp = y;
+    else {
+      xp = y->parent;
+      xp->left = x;
+      if (x != NULL)
+        x->parent = xp;
+      y->right = n->right;
+      y->right->parent = y;
+    }
+    replace_child(t, n, y);
+    y->parent = n->parent;
+    y->left = n->left;
+    y->left->parent = y;
+    y->red = n->red;
+  }
+  t->elem_cnt--;
+
+  if (was_red)
+    return;
+
+  /* A black element is gone, so paths through X have one black
+     element too few.  Make X red-and-black until it can give the
+     extra black to a red element, borrowing from its sibling or
+     passing the deficit up the tree. */
+  while (x != t->root && !is_red(x)) {
+    if (x == xp->left) {
+      struct rb_node* w = xp->right; /* Not null: it has a black element to spare. */
+      if (w->red) {
+        w->red = false;
+        xp->red = true;
+        rotate_left(t, xp);
+        w = xp->right;
+      }
+      if (!is_red(w->left) && !is_red(w->right)) {
+        w->red = true;
+        x = xp;
+        xp = x->parent;
+      } else {
+        if (!is_red(w->right)) {
+          w->left->red = false;
+          w->red = true;
+          rotate_right(t, w);
+          w = xp->right;
+        }
+        w->red = xp->red;
+        xp->red = false;
+        w->right->red = false;
+        rotate_left(t, xp);
+        x = t->root;
+      }
+    } else {
+      struct rb_node* w = xp->left;
+      if (w->red) {
+        w->red = false;
+        xp->red = true;
+        rotate_right(t, xp);
+        w = xp->left;
+      }
+      if (!is_red(w->left) && !is_red(w->right)) {
+        w->red = true;
+        x = xp;
+        xp = x->parent;
+      } else {
+        if (!is_red(w->left)) {
+          w->right->red = false;
+          w->red = true;
+          rotate_left(t, w);
+          w = xp->left;
+        }
+        w->red = xp->red;
+        xp->red = false;
+        w->left->red = false;
+        rotate_right(t, xp);
+        x = t->root;
+      }
+    }
+  }
+  if (x != NULL)
+    x->red = false;
+}
+
+/* Returns the first element in T equal to KEY, or a null pointer
+   if there is none.  KEY need not be in T. */
+struct rb_node* rb_find(const struct rb_tree* t, const struct rb_node* key) {
+  struct rb_node* n = rb_lower_bound(t, key);
+  return n != NULL && !t->less(key, n, t->aux) ? n : NULL;
+}
+
+/* Returns the first element in T not less than KEY, or a null
+   pointer if there is none.  KEY need not be in T. */
+struct rb_node* rb_lower_bound(const struct rb_tree* t, const struct rb_node* key) {
+  struct rb_node* n = t->root;
+  struct rb_node* found = NULL;
+
+  while (n != NULL)
+    if (t->less(n, key, t->aux))
+      n = n->right;
+    else {
+      found = n;
+      n = n->left;
+    }
+  return found;
+}
+
+/* Returns the first element in T greater than KEY, or a null
+   pointer if there is none.  KEY need not be in T. */
+struct rb_node* rb_upper_bound(const struct rb_tree* t, const struct rb_node* key) {
+  struct rb_node* n = t->root;
+  struct rb_node* found = NULL;
+
+  while (n != NULL)
+    if (t->less(key, n, t->aux)) {
+      found = n;
+      n = n->left;
+    } else
+      n = n->right;
+  return found;
+}
+
+/* Returns the least element in T, or a null pointer if T is
+   empty. */
+struct rb_node* rb_first(const struct rb_tree* t) {
+  return t->root != NULL ? leftmost(t->root) : NULL;
+}
+
+/* Returns the greatest element in T, or a null pointer if T is
+   empty. */
+struct rb_node* rb_last(const struct rb_tree* t) {
+  return t->root != NULL ? rightmost(t->root) : NULL;
+}
+
+/* Returns the element after N in its tree, or a null pointer if
+   N is the last. */
+struct rb_node* rb_next(const struct rb_node* n) {
+  ASSERT(n != NULL);
+
+  if (n->right != NULL)
+    return leftmost(n->right);
+  while (n->parent != NULL && n == n->parent->right)
+    n = n->parent;
+  return n->parent;
+}
+
+/* Returns the element before N in its tree, or a null pointer if
+   N is the first. */
+struct rb_node* rb_prev(const struct rb_node* n) {
+  ASSERT(n != NULL);
+
+  if (n->left != NULL)
+    return rightmost(n->left);
+  while (n->parent != NULL && n == n->parent->left)
+    n = n->parent;
+  return n->parent;
+}
@@ -0,0 +1,79 @@
+#ifndef __LIB_KERNEL_RBTREE_H
+#define __LIB_KERNEL_RBTREE_H
+
+/* Ordered tree.
+
+   This is a red-black tree, which takes O(log n) time to insert
+   or remove an element or to search for one, and visits its
+   elements in order.  As with lists, the tree does not use
+   dynamic allocation: each structure that can be in a tree
+   embeds a struct rb_node member, and rb_entry converts a
+   pointer to it back to a pointer to the structure.  Refer to
+   lib/kernel/list.h for a detailed explanation.
+
+   Elements that are equal may be in a tree together; they are
+   visited in the order they were inserted.  An element's value
+   must not change while it is in a tree.  To change it, remove
+   the element, change it, and insert it again.
+
+   Iteration looks like this:
+
+      struct rb_node* n;
+
+      for (n = rb_first(&tree); n != NULL; n = rb_next(n)) {
+        struct foo* f = rb_entry(n, struct foo, node);
+        ...do something with f...
+      }
+
+   Elements may be inserted during iteration, but removing the
+   current element leaves `n' unusable; fetch rb_next(n) first. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Tree element. */
+struct rb_node {
+  struct rb_node* parent; /* Parent, or null for the root. */
+  struct rb_node* left;   /* Lesser child, or null. */
+  struct rb_node* right;  /* Greater child, or null. */
+  bool red;               /* Red, or black? */
+};
+
+/* Converts pointer to tree element RB_NODE into a pointer to the
+   structure that RB_NODE is embedded inside.  Supply the name of
+   the outer structure STRUCT and the member name MEMBER of the
+   tree element. */
+#define rb_entry(RB_NODE, STRUCT, MEMBER)                                                          \
+  ((STRUCT*)((uint8_t*)(RB_NODE) - offsetof(STRUCT, MEMBER)))
+
+/* Compares the value of two tree elements A and B, given
+   auxiliary data AUX.  Returns true if A is less than B, or
+   false if A is greater than or equal to B. */
+typedef bool rb_less_func(const struct rb_node* a, const struct rb_node* b, void* aux);
+
+/* Tree. */
+struct rb_tree {
+  struct rb_node* root; /* Root, or null if empty. */
+  size_t elem_cnt;      /* Number of elements. */
+  rb_less_func* less;   /* Comparison function. */
+  void* aux;            /* Auxiliary data for `less'. */
+};
+
+void rb_init(struct rb_tree*, rb_less_func*, void* aux);
+bool rb_empty(const struct rb_tree*);
+size_t rb_size(const struct rb_tree*);
+
+void rb_insert(struct rb_tree*, struct rb_node*);
+void rb_remove(struct rb_tree*, struct rb_node*);
+
+struct rb_node* rb_find(const struct rb_tree*, const struct rb_node*);
+struct rb_node* rb_lower_bound(const struct rb_tree*, const struct rb_node*);
+struct rb_node* rb_upper_bound(const struct rb_tree*, const struct rb_node*);
+
+struct rb_node* rb_first(const struct rb_tree*);
+struct rb_node* rb_last(const struct rb_tree*);
+struct rb_node* rb_next(const struct rb_node*);
+struct rb_node* rb_prev(const struct rb_node*);
+
+#endif /* lib/kernel/rbtree.h */
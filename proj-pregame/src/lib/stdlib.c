@@ -3,6 +3,7 @@
 #include <random.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 /* Converts a string representation of a signed decimal integer
    in S into an `int', which is returned. */
@@ -47,24 +48,38 @@ static int compare_thunk(const void* a, const void* b, void* aux) {
    using COMPARE.  When COMPARE is passed a pair of elements A
    and B, respectively, it must return a strcmp()-type result,
    i.e. less than zero if A < B, zero if A == B, greater than
-   zero if A > B.  Runs in O(n lg n) time and O(1) space in
+   zero if A > B.  Runs in O(n lg n) time and O(lg n) space in
    CNT. */
 void qsort(void* array, size_t cnt, size_t size, int (*compare)(const void*, const void*)) {
   sort(array, cnt, size, compare_thunk, &compare);
 }
 
+/* Swaps the elements of SIZE bytes at A and B, a word at a time
+   if they are made of aligned words. */
+static void swap_elems(unsigned char* a, unsigned char* b, size_t size) {
+  size_t i;
+
+  if (size % sizeof(uint32_t) == 0 && ((uintptr_t)a | (uintptr_t)b) % sizeof(uint32_t) == 0) {
+    uint32_t* wa = (uint32_t*)a;
+    uint32_t* wb = (uint32_t*)b;
+
+    for (i = 0; i < size / sizeof(uint32_t); i++) {
+      uint32_t t = wa[i];
+      wa[i] = wb[i];
+      wb[i] = t;
+    }
+  } else
+    for (i = 0; i < size; i++) {
+      unsigned char t = a[i];
+      a[i] = b[i];
+      b[i] = t;
+    }
+}
+
 /* Swaps elements with 1-based indexes A_IDX and B_IDX in ARRAY
    with elements of SIZE bytes each. */
 static void do_swap(unsigned char* array, size_t a_idx, size_t b_idx, size_t size) {
-  unsigned char* a = array + (a_idx - 1) * size;
-  unsigned char* b = array + (b_idx - 1) * size;
-  size_t i;
-
-  for (i = 0; i < size; i++) {
-    unsigned char t = a[i];
-    a[i] = b[i];
-    b[i] = t;
-  }
+  swap_elems(array + (a_idx - 1) * size, array + (b_idx - 1) * size, size);
 }
 
 /* Compares elements with 1-based indexes A_IDX and B_IDX in
@@ -103,29 +118,119 @@ static void heapify(unsigned char* array, size_t i, size_t cnt, size_t size,
   }
 }
 
+/* Sorts ARRAY, as sort() does, by heapsort. */
+static void heap_sort(unsigned char* array, size_t cnt, size_t size,
+                      int (*compare)(const void*, const void*, void* aux), void* aux) {
+  size_t i;
+
+  /* Build a heap. */
+  for (i = cnt / 2; i > 0; i--)
+    heapify(array, i, cnt, size, compare, aux);
+
+  /* Sort the heap. */
+  for (i = cnt; i > 1; i--) {
+    do_swap(array, 1, i, size);
+    heapify(array, 1, i - 1, size, compare, aux);
+  }
+}
+
+/* Sorts ARRAY, as sort() does, by insertion sort, which is the
+   fastest way for a few elements. */
+static void insertion_sort(unsigned char* array, size_t cnt, size_t size,
+                           int (*compare)(const void*, const void*, void* aux), void* aux) {
+  size_t i, j;
+
+  for (i = 1; i < cnt; i++)
+    for (j = i; j > 0 && compare(array + (j - 1) * size, array + j * size, aux) > 0; j--)
+      swap_elems(array + (j - 1) * size, array + j * size, size);
+}
+
+/* Partitions of no more than this many elements are left to
+   insertion sort. */
+#define INSERTION_MAX 16
+
+/* Sorts ARRAY, as sort() does, by quicksort, partitioning around
+   the median of its first, middle and last elements, until the
+   partitions are small enough for insertion sort.  If DEPTH
+   levels of partitioning have not made them so, the pivots are
+   being chosen badly, and heapsort takes over. */
+static void intro_sort(unsigned char* array, size_t cnt, size_t size,
+                       int (*compare)(const void*, const void*, void* aux), void* aux,
+                       int depth) {
+  while (cnt > INSERTION_MAX) {
+    unsigned char* first = array;
+    unsigned char* mid = array + cnt / 2 * size;
+    unsigned char* last = array + (cnt - 1) * size;
+    size_t i, j;
+
+    if (depth-- == 0) {
+      heap_sort(array, cnt, size, compare, aux);
+      return;
+    }
+
+    /* Order the three, then make the median the pivot, in the
+       first element.  The last, no less than it, stops the
+       upward scan below. */
+    if (compare(mid, first, aux) < 0)
+      swap_elems(mid, first, size);
+    if (compare(last, mid, aux) < 0) {
+      swap_elems(last, mid, size);
+      if (compare(mid, first, aux) < 0)
+        swap_elems(mid, first, size);
+    }
+    swap_elems(first, mid, size);
+
+    /* Partition the rest into elements no greater than the pivot
+       and elements no less, and put the pivot between them. */
+    i = 0;
+    j = cnt;
+    for (;;) {
+      do
+        i++;
+      while (compare(array + i * size, first, aux) < 0);
+      do
+        j--;
+      while (compare(array + j * size, first, aux) > 0);
+      if (i >= j)
+        break;
+      swap_elems(array + i * size, array + j * size, size);
+    }
+    swap_elems(first, array + j * size, size);
+
+    /* Recurse into the smaller side, to bound the stack, and go
+       on with the larger. */
+    if (j < cnt - j - 1) {
+      intro_sort(array, j, size, compare, aux, depth);
+      array += (j + 1) * size;
+      cnt -= j + 1;
+    } else {
+      intro_sort(array + (j + 1) * size, cnt - j - 1, size, compare, aux, depth);
+      cnt = j;
+    }
+  }
+  insertion_sort(array, cnt, size, compare, aux);
+}
+
 /* Sorts ARRAY, which contains CNT elements of SIZE bytes each,
    using COMPARE to compare elements, passing AUX as auxiliary
    data.  When COMPARE is passed a pair of elements A and B,
    respectively, it must return a strcmp()-type result, i.e. less
    than zero if A < B, zero if A == B, greater than zero if A >
-   B.  Runs in O(n lg n) time and O(1) space in CNT. */
+   B.  Runs in O(n lg n) time and O(lg n) space in CNT. */
 void sort(void* array, size_t cnt, size_t size, int (*compare)(const void*, const void*, void* aux),
           void* aux) {
-  size_t i;
+  int depth = 0;
+  size_t n;
 
   ASSERT(array != NULL || cnt == 0);
   ASSERT(compare != NULL);
   ASSERT(size > 0);
 
-  /* Build a heap. */
-  for (i = cnt / 2; i > 0; i--)
-    heapify(array, i, cnt, size, compare, aux);
-
-  /* Sort the heap. */
-  for (i = cnt; i > 1; i--) {
-    do_swap(array, 1, i, size);
-    heapify(array, 1, i - 1, size, compare, aux);
-  }
+  /* Allow twice the levels of partitioning that perfect pivots
+     would take. */
+  for (n = cnt; n > 1; n /= 2)
+    depth += 2;
+  intro_sort(array, cnt, size, compare, aux, depth);
 }
 
 /* Searches ARRAY, which contains CNT elements of SIZE bytes
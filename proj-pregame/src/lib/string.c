@@ -1,10 +1,32 @@
 #include <string.h>
 #include <debug.h>
+#include <stdint.h>
 // GCC erroneously emits a nonnull-compare error in the expansion of the ASSERT
 // macro in many places where it is used in this file, even though nothing is
 // marked as nonnull.
 #pragma GCC diagnostic ignored "-Wnonnull-compare"
 
+/* The block functions below move whole 32-bit words with the
+   string instructions, which (with the direction flag clear, as
+   the ABI and the interrupt entry code keep it) go upward, and
+   only the bytes before the first aligned word and after the last
+   one a byte at a time.  The string functions scan a word at a
+   time, which is safe past the end of a string: an aligned word
+   never crosses into another page. */
+
+/* A word that may alias anything. */
+typedef uint32_t __attribute__((may_alias)) word_t;
+
+/* Bytes below which a block is copied or set a byte at a time,
+   the string instructions not paying for their setup. */
+#define WORD_MIN 16
+
+/* Returns nonzero if any byte of W is zero. */
+#define HAS_ZERO(W) (((W) - 0x01010101u) & ~(W) & 0x80808080u)
+
+/* Returns C in each byte of a word. */
+#define REPEAT(C) ((unsigned char)(C) * 0x01010101u)
+
 /* Copies SIZE bytes from SRC to DST, which must not overlap.
    Returns DST. */
 void* memcpy(void* dst_, const void* src_, size_t size) {
@@ -14,8 +36,17 @@ void* memcpy(void* dst_, const void* src_, size_t size) {
   ASSERT(dst != NULL || size == 0);
   ASSERT(src != NULL || size == 0);
 
-  while (size-- > 0)
-    *dst++ = *src++;
+  if (size >= WORD_MIN) {
+    size_t head = -(uintptr_t)dst & 3;
+    size_t words;
+
+    size -= head;
+    asm volatile("rep movsb" : "+D"(dst), "+S"(src), "+c"(head) : : "memory");
+    words = size / 4;
+    size %= 4;
+    asm volatile("rep movsl" : "+D"(dst), "+S"(src), "+c"(words) : : "memory");
+  }
+  asm volatile("rep movsb" : "+D"(dst), "+S"(src), "+c"(size) : : "memory");
 
   return dst_;
 }
@@ -29,17 +60,33 @@ void* memmove(void* dst_, const void* src_, size_t size) {
   ASSERT(dst != NULL || size == 0);
   ASSERT(src != NULL || size == 0);
 
-  if (dst < src) {
-    while (size-- > 0)
-      *dst++ = *src++;
-  } else {
-    dst += size;
-    src += size;
-    while (size-- > 0)
+  if (dst <= src || dst >= src + size)
+    return memcpy(dst_, src_, size);
+
+  /* DST overlaps the end of SRC, so copy from the end down, with
+     the direction flag set for as long as it takes. */
+  dst += size;
+  src += size;
+  if (size >= WORD_MIN) {
+    size_t tail = (uintptr_t)dst & 3;
+    size_t words;
+
+    while (tail-- > 0) {
       *--dst = *--src;
+      size--;
+    }
+    words = size / 4;
+    size %= 4;
+    dst -= 4;
+    src -= 4;
+    asm volatile("std; rep movsl; cld" : "+D"(dst), "+S"(src), "+c"(words) : : "memory");
+    dst += 4;
+    src += 4;
   }
+  while (size-- > 0)
+    *--dst = *--src;
 
-  return dst;
+  return dst_;
 }
 
 /* Find the first differing byte in the two blocks of SIZE bytes
@@ -53,6 +100,11 @@ int memcmp(const void* a_, const void* b_, size_t size) {
   ASSERT(a != NULL || size == 0);
   ASSERT(b != NULL || size == 0);
 
+  /* Skip the words that are equal, then find the byte. */
+  for (; size >= 4 && *(const word_t*)a == *(const word_t*)b; size -= 4) {
+    a += 4;
+    b += 4;
+  }
   for (; size-- > 0; a++, b++)
     if (*a != *b)
       return *a > *b ? +1 : -1;
@@ -101,16 +153,26 @@ void* memchr(const void* block_, int ch_, size_t size) {
    STRING. */
 char* strchr(const char* string, int c_) {
   char c = c_;
+  uint32_t mask = REPEAT(c);
+  const word_t* w;
 
   ASSERT(string != NULL);
 
-  for (;;)
+  /* Up to a word boundary, then a word at a time until a word has
+     C or a null terminator in it. */
+  for (; (uintptr_t)string & 3; string++)
+    if (*string == c)
+      return (char*)string;
+    else if (*string == '\0')
+      return NULL;
+  for (w = (const word_t*)string; !HAS_ZERO(*w) && !HAS_ZERO(*w ^ mask); w++)
+    continue;
+
+  for (string = (const char*)w;; string++)
     if (*string == c)
       return (char*)string;
     else if (*string == '\0')
       return NULL;
-    else
-      string++;
 }
 
 /* Returns the length of the initial substring of STRING that
@@ -248,11 +310,21 @@ char* strtok_r(char* s, const char* delimiters, char** save_ptr) {
 /* Sets the SIZE bytes in DST to VALUE. */
 void* memset(void* dst_, int value, size_t size) {
   unsigned char* dst = dst_;
+  uint32_t word = REPEAT(value);
 
   ASSERT(dst != NULL || size == 0);
 
-  while (size-- > 0)
-    *dst++ = value;
+  if (size >= WORD_MIN) {
+    size_t head = -(uintptr_t)dst & 3;
+    size_t words;
+
+    size -= head;
+    asm volatile("rep stosb" : "+D"(dst), "+c"(head) : "a"(word) : "memory");
+    words = size / 4;
+    size %= 4;
+    asm volatile("rep stosl" : "+D"(dst), "+c"(words) : "a"(word) : "memory");
+  }
+  asm volatile("rep stosb" : "+D"(dst), "+c"(size) : "a"(word) : "memory");
 
   return dst_;
 }
@@ -260,10 +332,16 @@ void* memset(void* dst_, int value, size_t size) {
 /* Returns the length of STRING. */
 size_t strlen(const char* string) {
   const char* p;
+  const word_t* w;
 
   ASSERT(string != NULL);
 
-  for (p = string; *p != '\0'; p++)
+  for (p = string; (uintptr_t)p & 3; p++)
+    if (*p == '\0')
+      return p - string;
+  for (w = (const word_t*)p; !HAS_ZERO(*w); w++)
+    continue;
+  for (p = (const char*)w; *p != '\0'; p++)
     continue;
   return p - string;
 }
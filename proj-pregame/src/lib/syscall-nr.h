@@ -39,7 +39,20 @@ enum {
   SYS_MKDIR,   /* Create a directory. */
   SYS_READDIR, /* Reads a directory entry. */
   SYS_ISDIR,   /* Tests if a fd represents a directory. */
-  SYS_INUMBER  /* Returns the inode number for a fd. */
+  SYS_INUMBER, /* Returns the inode number for a fd. */
+
+  /* Extensions, numbered after all of the above so that theirs
+     stay put.  New calls go at the end. */
+  SYS_GETDENTS,     /* Reads many directory entries at once. */
+  SYS_SCHED_STAT,   /* Reads a scheduling statistic */
+  SYS_BLOCK_STAT,   /* Reads a block device statistic */
+  SYS_READV,        /* Read from a file into several buffers. */
+  SYS_WRITEV,       /* Write to a file from several buffers. */
+  SYS_SENDFILE,     /* Copy from a file to a file or the console. */
+  SYS_FUTEX_WAIT,   /* Sleep while a word holds a value. */
+  SYS_FUTEX_WAKE,   /* Wake threads sleeping on a word. */
+  SYS_BATCH,        /* Carry out the operations queued in a ring. */
+  SYS_PIPE          /* Create a pipe. */
 };
 
 #endif /* lib/syscall-nr.h */
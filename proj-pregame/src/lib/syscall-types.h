@@ -0,0 +1,81 @@
+#ifndef __LIB_SYSCALL_TYPES_H
+#define __LIB_SYSCALL_TYPES_H
+
+/* Constants and structures that system calls pass between user
+   programs and the kernel, apart from the call numbers in
+   syscall-nr.h. */
+
+/* Statistics read by SYS_SCHED_STAT: for the current thread, or
+   the count of waits in the run queue of a length in the Nth
+   power of two ticks, for SCHED_STAT_WAIT + N. */
+#define SCHED_WAIT_BUCKETS 16
+enum {
+  SCHED_STAT_READY_TICKS, /* Ticks spent ready but not running. */
+  SCHED_STAT_VOLUNTARY,   /* Switches away on blocking or exiting. */
+  SCHED_STAT_INVOLUNTARY, /* Switches away while still ready. */
+  SCHED_STAT_RUN_NS,      /* Nanoseconds spent running. */
+  SCHED_STAT_WAIT,        /* First of SCHED_WAIT_BUCKETS buckets. */
+};
+
+/* Statistics read by SYS_BLOCK_STAT: for the block device in a
+   role (1 for the file system, 2 for scratch, 3 for swap), or
+   the count of its requests that took under 2**N microseconds,
+   the last bucket taking the rest, for BLOCK_STAT_LATENCY + N.
+   Requests are timed from submission to completion. */
+#define BLOCK_LATENCY_BUCKETS 16
+enum {
+  BLOCK_STAT_READS,      /* Sectors read. */
+  BLOCK_STAT_WRITES,     /* Sectors written. */
+  BLOCK_STAT_REQUESTS,   /* Requests. */
+  BLOCK_STAT_SEQUENTIAL, /* Requests that began where the last ended. */
+  BLOCK_STAT_SERVICE_US, /* Microseconds spent on all requests. */
+  BLOCK_STAT_DEPTH_SUM,  /* Sum of requests outstanding as each began. */
+  BLOCK_STAT_MAX_DEPTH,  /* Most requests outstanding at once. */
+  BLOCK_STAT_LATENCY,    /* First of BLOCK_LATENCY_BUCKETS buckets. */
+};
+
+/* A buffer for SYS_READV or SYS_WRITEV, which take an array of
+   up to IOV_MAX of them. */
+#define IOV_MAX 16
+struct iovec {
+  void* iov_base;   /* First byte. */
+  unsigned iov_len; /* Number of bytes. */
+};
+
+/* A ring of operations for SYS_BATCH, in the program's memory,
+   which carries them out in order in one system call rather than
+   one each.  The program fills in the operation at TAIL and
+   advances TAIL, modulo the ring's size, for each it queues.  The
+   kernel carries out those from HEAD up to TAIL, stores each
+   one's result in it, and advances HEAD to TAIL.  The result is
+   the number of bytes read or written, 0 for a seek, or -1 if the
+   file descriptor is not open or the operation is unknown. */
+#define BATCH_RING_SIZE 64
+enum { BATCH_READ, BATCH_WRITE, BATCH_SEEK };
+struct batch_op {
+  int op;       /* BATCH_READ, BATCH_WRITE or BATCH_SEEK. */
+  int fd;       /* File descriptor. */
+  void* buf;    /* Buffer to read into or write from. */
+  unsigned len; /* Bytes to read or write, or the position to seek to. */
+  int result;   /* Result, once carried out. */
+};
+struct batch_ring {
+  unsigned head; /* Next operation for the kernel to carry out. */
+  unsigned tail; /* Where the next operation queued goes. */
+  struct batch_op ops[BATCH_RING_SIZE];
+};
+
+/* A page the kernel maps read-only at VDSO_ADDR in every process
+   and keeps up to date, so that a program can read these without
+   a system call: whenever a thread of the process is switched to
+   and on every timer tick while one runs.  A program reading
+   more than one word retries if SEQ, which the kernel increments
+   on each update, changes meanwhile. */
+#define VDSO_ADDR 0x08047000
+struct vdso {
+  unsigned seq;    /* Number of updates. */
+  int tid;         /* Thread that is running. */
+  long long ticks; /* Timer ticks since the OS booted. */
+};
+
+#endif /* lib/syscall-types.h */
@@ -3,6 +3,86 @@
 #include <syscall.h>
 #include <syscall-nr.h>
 
+/* Buffer for standard output, so that most printed lines, or
+   with STDOUT_FULL most buffers full, cost one write() rather
+   than one per call.  Guarded by stdout_lock. */
+#define STDOUT_BUF_SIZE 512
+static char stdout_buf[STDOUT_BUF_SIZE];
+static size_t stdout_len;
+static enum stdout_mode stdout_mode = STDOUT_LINE;
+static lock_t stdout_lock;
+
+/* Writes out the buffer.  stdout_lock must be held. */
+static void drain_stdout(void) {
+  if (stdout_len > 0)
+    write(STDOUT_FILENO, stdout_buf, stdout_len);
+  stdout_len = 0;
+}
+
+/* Adds the SIZE bytes at BUF to standard output, writing out
+   what its mode calls for.  stdout_lock must be held. */
+static void add_stdout(const char* buf, size_t size) {
+  const char* nl;
+
+  if (stdout_mode == STDOUT_UNBUFFERED) {
+    write(STDOUT_FILENO, buf, size);
+    return;
+  }
+
+  /* In line mode, write out through the last new-line. */
+  nl = NULL;
+  if (stdout_mode == STDOUT_LINE) {
+    size_t i;
+    for (i = size; i > 0; i--)
+      if (buf[i - 1] == '\n') {
+        nl = buf + i;
+        break;
+      }
+  }
+
+  while (size > 0) {
+    size_t n = STDOUT_BUF_SIZE - stdout_len;
+
+    /* Write straight from BUF what would fill the buffer anyway
+       and is wanted out now. */
+    if (stdout_len == 0 && (size >= STDOUT_BUF_SIZE || nl != NULL)) {
+      n = nl != NULL ? (size_t)(nl - buf) : size - size % STDOUT_BUF_SIZE;
+      write(STDOUT_FILENO, buf, n);
+    } else {
+      if (n > size)
+        n = size;
+      memcpy(stdout_buf + stdout_len, buf, n);
+      stdout_len += n;
+      if (stdout_len == STDOUT_BUF_SIZE || (nl != NULL && buf + n >= nl))
+        drain_stdout();
+    }
+    buf += n;
+    size -= n;
+    if (nl != NULL && buf >= nl)
+      nl = NULL;
+  }
+}
+
+/* Initializes standard output.  Called by _start() before
+   main(). */
+void stdout_init(void) { lock_init(&stdout_lock); }
+
+/* Sets how standard output is buffered, writing out what has
+   been buffered so far. */
+void stdout_set_mode(enum stdout_mode mode) {
+  lock_acquire(&stdout_lock);
+  drain_stdout();
+  stdout_mode = mode;
+  lock_release(&stdout_lock);
+}
+
+/* Writes out what has been buffered for standard output. */
+void stdout_flush(void) {
+  lock_acquire(&stdout_lock);
+  drain_stdout();
+  lock_release(&stdout_lock);
+}
+
 /* The standard vprintf() function,
    which is like printf() but uses a va_list. */
 int vprintf(const char* format, va_list args) { return vhprintf(STDOUT_FILENO, format, args); }
@@ -22,8 +102,10 @@ int hprintf(int handle, const char* format, ...) {
 /* Writes string S to the console, followed by a new-line
    character. */
 int puts(const char* s) {
-  write(STDOUT_FILENO, s, strlen(s));
-  putchar('\n');
+  lock_acquire(&stdout_lock);
+  add_stdout(s, strlen(s));
+  add_stdout("\n", 1);
+  lock_release(&stdout_lock);
 
   return 0;
 }
@@ -31,7 +113,10 @@ int puts(const char* s) {
 /* Writes C to the console. */
 int putchar(int c) {
   char c2 = c;
-  write(STDOUT_FILENO, &c2, 1);
+
+  lock_acquire(&stdout_lock);
+  add_stdout(&c2, 1);
+  lock_release(&stdout_lock);
   return c;
 }
 
@@ -48,14 +133,19 @@ static void flush(struct vhprintf_aux*);
 
 /* Formats the printf() format specification FORMAT with
    arguments given in ARGS and writes the output to the given
-   HANDLE. */
+   HANDLE.  Output to STDOUT_FILENO is buffered, all of it at
+   once so that it is not interleaved with other threads'. */
 int vhprintf(int handle, const char* format, va_list args) {
   struct vhprintf_aux aux;
   aux.p = aux.buf;
   aux.char_cnt = 0;
   aux.handle = handle;
+  if (handle == STDOUT_FILENO)
+    lock_acquire(&stdout_lock);
   __vprintf(format, args, add_char, &aux);
   flush(&aux);
+  if (handle == STDOUT_FILENO)
+    lock_release(&stdout_lock);
   return aux.char_cnt;
 }
 
@@ -69,9 +159,14 @@ static void add_char(char c, void* aux_) {
   aux->char_cnt++;
 }
 
-/* Flushes the buffer in AUX. */
+/* Flushes the buffer in AUX, into standard output's buffer if
+   that is where it goes. */
 static void flush(struct vhprintf_aux* aux) {
-  if (aux->p > aux->buf)
-    write(aux->handle, aux->buf, aux->p - aux->buf);
+  if (aux->p > aux->buf) {
+    if (aux->handle == STDOUT_FILENO)
+      add_stdout(aux->buf, aux->p - aux->buf);
+    else
+      write(aux->handle, aux->buf, aux->p - aux->buf);
+  }
   aux->p = aux->buf;
 }
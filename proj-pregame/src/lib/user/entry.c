@@ -1,6 +1,10 @@
+#include <stdio.h>
 #include <syscall.h>
 
 int main(int, char* []);
 void _start(int argc, char* argv[]);
 
-void _start(int argc, char* argv[]) { exit(main(argc, argv)); }
+void _start(int argc, char* argv[]) {
+  stdout_init();
+  exit(main(argc, argv));
+}
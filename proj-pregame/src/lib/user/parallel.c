@@ -0,0 +1,88 @@
+#include <parallel.h>
+#include <pthread.h>
+#include <stddef.h>
+
+/* A data-parallel loop over user threads.  The range is divided
+   into as many contiguous parts, as near the same size as can
+   be, as there are threads.  The caller works on the first part
+   itself while a new thread works on each of the others, and
+   then joins them.  A part whose thread cannot be created is
+   worked on by the caller, so the loop always completes, if with
+   less parallelism.  A reduction combines the values of the parts
+   in order, so the combining function need not commute. */
+
+/* One part of a range, and the thread that works on it. */
+struct part {
+  int start, end;      /* Indexes START through END - 1. */
+  parallel_body* body; /* For parallel_for(), or null. */
+  parallel_map* map;   /* For parallel_reduce(), or null. */
+  void* aux;           /* Passed to BODY or MAP. */
+  int result;          /* MAP's value. */
+  tid_t tid;           /* Its thread, or TID_ERROR for the caller. */
+};
+
+/* Works on the part in P_. */
+static void run_part(void* p_) {
+  struct part* p = p_;
+
+  if (p->body != NULL)
+    p->body(p->start, p->end, p->aux);
+  else
+    p->result = p->map(p->start, p->end, p->aux);
+}
+
+/* Divides START through END - 1 into up to THREAD_CNT parts and
+   works on them in PARTS, as described above.  Returns the number
+   of parts. */
+static int run_parts(struct part parts[PARALLEL_MAX_THREADS], int start, int end, int thread_cnt,
+                     parallel_body* body, parallel_map* map, void* aux) {
+  int cnt, i;
+
+  if (thread_cnt > PARALLEL_MAX_THREADS)
+    thread_cnt = PARALLEL_MAX_THREADS;
+  cnt = end - start < thread_cnt ? end - start : thread_cnt;
+  if (cnt < 1)
+    return 0;
+
+  for (i = 0; i < cnt; i++) {
+    struct part* p = &parts[i];
+
+    p->start = start + (long long)(end - start) * i / cnt;
+    p->end = start + (long long)(end - start) * (i + 1) / cnt;
+    p->body = body;
+    p->map = map;
+    p->aux = aux;
+    p->tid = i > 0 ? pthread_create(run_part, p) : TID_ERROR;
+  }
+
+  for (i = 0; i < cnt; i++)
+    if (parts[i].tid == TID_ERROR)
+      run_part(&parts[i]);
+  for (i = 1; i < cnt; i++)
+    if (parts[i].tid != TID_ERROR)
+      pthread_join(parts[i].tid);
+  return cnt;
+}
+
+/* Calls BODY on the parts of START through END - 1, in up to
+   THREAD_CNT threads at once, and returns once all are done. */
+void parallel_for(int start, int end, int thread_cnt, parallel_body* body, void* aux) {
+  struct part parts[PARALLEL_MAX_THREADS];
+
+  run_parts(parts, start, end, thread_cnt, body, NULL, aux);
+}
+
+/* Calls MAP on the parts of START through END - 1, in up to
+   THREAD_CNT threads at once, and returns the combination by
+   COMBINE of IDENTITY and each of their values, in order. */
+int parallel_reduce(int start, int end, int thread_cnt, parallel_map* map,
+                    parallel_combine* combine, int identity, void* aux) {
+  struct part parts[PARALLEL_MAX_THREADS];
+  int cnt = run_parts(parts, start, end, thread_cnt, NULL, map, aux);
+  int result = identity;
+  int i;
+
+  for (i = 0; i < cnt; i++)
+    result = combine(result, parts[i].result);
+  return result;
+}
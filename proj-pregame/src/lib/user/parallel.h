@@ -0,0 +1,23 @@
+#ifndef __LIB_USER_PARALLEL_H
+#define __LIB_USER_PARALLEL_H
+
+/* Most threads that parallel_for() and parallel_reduce() divide
+   a range among, the caller's included. */
+#define PARALLEL_MAX_THREADS 16
+
+/* Does the work for indexes START through END - 1. */
+typedef void parallel_body(int start, int end, void* aux);
+
+/* Returns a value for indexes START through END - 1, to be
+   combined with those of the other parts of the range. */
+typedef int parallel_map(int start, int end, void* aux);
+
+/* Combines A and B, the values of two parts of a range, A's
+   coming first. */
+typedef int parallel_combine(int a, int b);
+
+void parallel_for(int start, int end, int thread_cnt, parallel_body*, void* aux);
+int parallel_reduce(int start, int end, int thread_cnt, parallel_map*, parallel_combine*,
+                    int identity, void* aux);
+
+#endif /* lib/user/parallel.h */
@@ -4,4 +4,19 @@
 int hprintf(int, const char*, ...) PRINTF_FORMAT(2, 3);
 int vhprintf(int, const char*, va_list) PRINTF_FORMAT(2, 0);
 
+/* How output to STDOUT_FILENO through printf(), puts() and
+   putchar() is buffered.  Either way, it is also written out by
+   stdout_flush(), by exit(), and before reading STDIN_FILENO.
+   Output passed straight to write() is not buffered, so a
+   program that mixes the two should flush in between. */
+enum stdout_mode {
+  STDOUT_UNBUFFERED, /* Written at once. */
+  STDOUT_LINE,       /* Written at each new-line, the default. */
+  STDOUT_FULL        /* Written once the buffer is full. */
+};
+
+void stdout_init(void);
+void stdout_set_mode(enum stdout_mode);
+void stdout_flush(void);
+
 #endif /* lib/user/stdio.h */
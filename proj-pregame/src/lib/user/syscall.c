@@ -1,4 +1,6 @@
 #include <syscall.h>
+#include <stddef.h>
+#include <stdio.h>
 #include "../syscall-nr.h"
 #include <pthread.h>
 
@@ -72,6 +74,7 @@ void halt(void) {
 }
 
 void exit(int status) {
+  stdout_flush();
   syscall1(SYS_EXIT, status);
   NOT_REACHED();
 }
@@ -90,7 +93,11 @@ int open(const char* file) { return syscall1(SYS_OPEN, file); }
 
 int filesize(int fd) { return syscall1(SYS_FILESIZE, fd); }
 
-int read(int fd, void* buffer, unsigned size) { return syscall3(SYS_READ, fd, buffer, size); }
+int read(int fd, void* buffer, unsigned size) {
+  if (fd == STDIN_FILENO)
+    stdout_flush();
+  return syscall3(SYS_READ, fd, buffer, size);
+}
 
 int write(int fd, const void* buffer, unsigned size) {
   return syscall3(SYS_WRITE, fd, buffer, size);
@@ -116,6 +123,8 @@ bool isdir(int fd) { return syscall1(SYS_ISDIR, fd); }
 
 int inumber(int fd) { return syscall1(SYS_INUMBER, fd); }
 
+int getdents(int fd, char* buf, unsigned size) { return syscall3(SYS_GETDENTS, fd, buf, size); }
+
 double compute_e(int n) { return (double)syscall1f(SYS_COMPUTE_E, n); }
 
 tid_t sys_pthread_create(stub_fun sfun, pthread_fun tfun, const void* arg) {
@@ -129,32 +138,124 @@ void sys_pthread_exit() {
 
 tid_t sys_pthread_join(tid_t tid) { return syscall1(SYS_PT_JOIN, tid); }
 
-bool lock_init(lock_t* lock) { return syscall1(SYS_LOCK_INIT, lock); }
+/* Magic numbers of initialized locks and semaphores. */
+#define LOCK_MAGIC 0x4b434f4c /* "LOCK" */
+#define SEMA_MAGIC 0x414d4553 /* "SEMA" */
 
+bool lock_init(lock_t* lock) {
+  if (lock == NULL)
+    return false;
+  lock->state = 0;
+  lock->magic = LOCK_MAGIC;
+  return true;
+}
+
+/* Takes LOCK with one compare-and-swap if it is free.  Otherwise
+   marks it waited for and sleeps until it is given back, which
+   the kernel refuses, ending the process, if no other thread
+   could ever give it back. */
 void lock_acquire(lock_t* lock) {
-  bool success = syscall1(SYS_LOCK_ACQUIRE, lock);
-  if (!success)
+  int state;
+
+  if (lock->magic != LOCK_MAGIC)
     exit(1);
+  state = __sync_val_compare_and_swap(&lock->state, 0, 1);
+  if (state == 0)
+    return;
+
+  if (state != 2)
+    state = __sync_lock_test_and_set(&lock->state, 2);
+  while (state != 0) {
+    if (futex_wait(&lock->state, 2) < 0)
+      exit(1);
+    state = __sync_lock_test_and_set(&lock->state, 2);
+  }
 }
 
+/* Gives back LOCK, waking a waiter if it may have one. */
 void lock_release(lock_t* lock) {
-  bool success = syscall1(SYS_LOCK_RELEASE, lock);
-  if (!success)
+  if (lock->magic != LOCK_MAGIC || lock->state == 0)
     exit(1);
+  if (__sync_fetch_and_sub(&lock->state, 1) != 1) {
+    lock->state = 0;
+    futex_wake(&lock->state, 1);
+  }
 }
 
-bool sema_init(sema_t* sema, int val) { return syscall2(SYS_SEMA_INIT, sema, val); }
+bool sema_init(sema_t* sema, int val) {
+  if (sema == NULL || val < 0)
+    return false;
+  sema->value = val;
+  sema->waiters = 0;
+  sema->magic = SEMA_MAGIC;
+  return true;
+}
 
+/* Takes one from SEMA's value with a compare-and-swap, once it is
+   positive.  Until then, sleeps on the value while it is 0.  A
+   waiter is counted before the kernel looks at the value, and
+   sema_up() raises the value before looking at the count, so one
+   of the two always sees the other. */
 void sema_down(sema_t* sema) {
-  bool success = syscall1(SYS_SEMA_DOWN, sema);
-  if (!success)
+  if (sema->magic != SEMA_MAGIC)
     exit(1);
+  for (;;) {
+    int value = sema->value;
+    int result;
+
+    if (value > 0) {
+      if (__sync_bool_compare_and_swap(&sema->value, value, value - 1))
+        return;
+      continue;
+    }
+    __sync_fetch_and_add(&sema->waiters, 1);
+    result = futex_wait(&sema->value, 0);
+    __sync_fetch_and_sub(&sema->waiters, 1);
+    if (result < 0)
+      exit(1);
+  }
 }
 
 void sema_up(sema_t* sema) {
-  bool success = syscall1(SYS_SEMA_UP, sema);
-  if (!success)
+  if (sema->magic != SEMA_MAGIC)
     exit(1);
+  __sync_fetch_and_add(&sema->value, 1);
+  if (sema->waiters > 0)
+    futex_wake(&sema->value, 1);
+}
+
+/* The vdso page the kernel keeps up to date. */
+#define VDSO ((const volatile struct vdso*)VDSO_ADDR)
+
+tid_t get_tid(void) { return VDSO->tid; }
+
+int64_t get_ticks(void) {
+  unsigned seq;
+  int64_t ticks;
+
+  do {
+    seq = VDSO->seq;
+    ticks = VDSO->ticks;
+  } while (VDSO->seq != seq);
+  return ticks;
+}
+
+int sched_stat(int stat) { return syscall1(SYS_SCHED_STAT, stat); }
+
+int block_stat(int role, int stat) { return syscall2(SYS_BLOCK_STAT, role, stat); }
+
+int readv(int fd, const struct iovec* iov, int cnt) { return syscall3(SYS_READV, fd, iov, cnt); }
+
+int writev(int fd, const struct iovec* iov, int cnt) { return syscall3(SYS_WRITEV, fd, iov, cnt); }
+
+int sendfile(int out_fd, int in_fd, unsigned size) {
+  return syscall3(SYS_SENDFILE, out_fd, in_fd, size);
 }
 
-tid_t get_tid(void) { return syscall0(SYS_GET_TID); }
+int futex_wait(int* uaddr, int val) { return syscall2(SYS_FUTEX_WAIT, uaddr, val); }
+
+int futex_wake(int* uaddr, int cnt) { return syscall2(SYS_FUTEX_WAKE, uaddr, cnt); }
+
+int batch(struct batch_ring* ring) { return syscall1(SYS_BATCH, ring); }
+
+int pipe(int fds[2]) { return syscall1(SYS_PIPE, fds); }
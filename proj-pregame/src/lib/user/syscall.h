@@ -2,22 +2,37 @@
 #define __LIB_USER_SYSCALL_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <debug.h>
 #include <pthread.h>
+#include <syscall-types.h>
 
 /* Process identifier. */
 typedef int pid_t;
 #define PID_ERROR ((pid_t)-1)
 
-/* Synchronization Types */
-typedef char lock_t;
-typedef char sema_t;
+/* Synchronization Types.  Each is taken and given back in user
+   memory with atomic instructions, entering the kernel through a
+   futex only when a thread must sleep or another must be woken.
+   MAGIC marks one as initialized. */
+typedef struct {
+  int state; /* 0 if free, 1 if held, 2 if held and maybe waited for. */
+  unsigned magic;
+} lock_t;
+typedef struct {
+  int value;   /* Value of the semaphore. */
+  int waiters; /* Threads asleep in sema_down(), or about to be. */
+  unsigned magic;
+} sema_t;
 
 /* Map region identifier. */
 typedef int mapid_t;
 #define MAP_FAILED ((mapid_t)-1)
 
-/* Maximum characters in a filename written by readdir(). */
+/* Maximum characters in a filename written by readdir() or
+   getdents().  getdents() packs many names into its buffer, each
+   null terminated, so a buffer of READDIR_MAX_LEN + 1 bytes or
+   more always has room for the next. */
 #define READDIR_MAX_LEN 14
 
 /* Typical return values from main() and arguments to exit(). */
@@ -50,6 +65,16 @@ bool sema_init(sema_t* sema, int val);
 void sema_down(sema_t* sema);
 void sema_up(sema_t* sema);
 tid_t get_tid(void);
+int64_t get_ticks(void);
+int sched_stat(int stat);
+int block_stat(int role, int stat);
+int readv(int fd, const struct iovec* iov, int cnt);
+int writev(int fd, const struct iovec* iov, int cnt);
+int sendfile(int out_fd, int in_fd, unsigned size);
+int futex_wait(int* uaddr, int val);
+int futex_wake(int* uaddr, int cnt);
+int batch(struct batch_ring* ring);
+int pipe(int fds[2]);
 
 /* Project 3 and optionally project 4. */
 mapid_t mmap(int fd, void* addr);
@@ -61,5 +86,6 @@ bool mkdir(const char* dir);
 bool readdir(int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir(int fd);
 int inumber(int fd);
+int getdents(int fd, char* buf, unsigned size);
 
 #endif /* lib/user/syscall.h */
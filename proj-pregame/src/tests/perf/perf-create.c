@@ -0,0 +1,27 @@
+/* Measures creating a thread, running it and having it exit,
+   one after another, ITERATIONS times. */
+
+#include "tests/perf/tests.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+#define ITERATIONS 1000
+
+static thread_func quick_thread;
+
+void test_perf_create(void) {
+  struct semaphore done;
+  uint64_t start;
+  int i;
+
+  sema_init(&done, 0);
+
+  start = rdtsc();
+  for (i = 0; i < ITERATIONS; i++) {
+    thread_create("quick", thread_get_priority(), quick_thread, &done);
+    sema_down(&done);
+  }
+  perf_report("thread_create", rdtsc() - start, ITERATIONS);
+}
+
+static void quick_thread(void* done) { sema_up(done); }
@@ -0,0 +1,41 @@
+/* Measures handing a lock from one thread to another.  Two
+   threads take the lock ITERATIONS times each and yield while
+   holding it, so that the other is waiting for it when it is
+   released, and yield again after releasing it, so that the other
+   gets it before it is taken back. */
+
+#include "tests/perf/tests.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+#define ITERATIONS 5000
+
+static thread_func lock_thread;
+static struct lock lock;
+
+void test_perf_lock(void) {
+  struct semaphore done;
+  uint64_t start;
+
+  lock_init(&lock);
+  sema_init(&done, 0);
+  thread_create("locker", thread_get_priority(), lock_thread, &done);
+
+  start = rdtsc();
+  lock_thread(NULL);
+  sema_down(&done);
+  perf_report("lock handoff", rdtsc() - start, 2 * ITERATIONS);
+}
+
+static void lock_thread(void* done) {
+  int i;
+
+  for (i = 0; i < ITERATIONS; i++) {
+    lock_acquire(&lock);
+    thread_yield();
+    lock_release(&lock);
+    thread_yield();
+  }
+  if (done != NULL)
+    sema_up(done);
+}
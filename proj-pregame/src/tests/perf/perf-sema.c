@@ -0,0 +1,38 @@
+/* Measures a round trip between two threads over a pair of
+   semaphores: each sema_up() wakes the other thread and each
+   sema_down() blocks until it answers, so every round trip is
+   two wakeups and two context switches. */
+
+#include "tests/perf/tests.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+#define ITERATIONS 10000
+
+static thread_func pong_thread;
+static struct semaphore ping, pong;
+
+void test_perf_sema(void) {
+  uint64_t start;
+  int i;
+
+  sema_init(&ping, 0);
+  sema_init(&pong, 0);
+  thread_create("pong", thread_get_priority(), pong_thread, NULL);
+
+  start = rdtsc();
+  for (i = 0; i < ITERATIONS; i++) {
+    sema_up(&ping);
+    sema_down(&pong);
+  }
+  perf_report("semaphore round trip", rdtsc() - start, ITERATIONS);
+}
+
+static void pong_thread(void* aux UNUSED) {
+  int i;
+
+  for (i = 0; i < ITERATIONS; i++) {
+    sema_down(&ping);
+    sema_up(&pong);
+  }
+}
@@ -0,0 +1,40 @@
+/* Measures how long timer_sleep(1) really takes.  Each sleep
+   starts just after a tick, so it should last one tick; how far
+   the shortest and longest are apart is the wakeup jitter. */
+
+#include "tests/perf/tests.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define ITERATIONS 50
+
+void test_perf_sleep(void) {
+  uint64_t total = 0, min = UINT64_MAX, max = 0;
+  int late = 0;
+  int i;
+
+  for (i = 0; i < ITERATIONS; i++) {
+    int64_t ticks = timer_ticks();
+    uint64_t start, cycles;
+
+    /* Start on a tick boundary. */
+    while (timer_ticks() == ticks)
+      continue;
+
+    ticks = timer_ticks();
+    start = rdtsc();
+    timer_sleep(1);
+    cycles = rdtsc() - start;
+
+    if (timer_elapsed(ticks) > 1)
+      late++;
+    total += cycles;
+    if (cycles < min)
+      min = cycles;
+    if (cycles > max)
+      max = cycles;
+  }
+
+  perf_report("timer_sleep(1)", total, ITERATIONS);
+  msg("shortest %llu cycles, longest %llu cycles, %d of %d late", min, max, late, ITERATIONS);
+}
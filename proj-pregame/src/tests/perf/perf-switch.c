@@ -0,0 +1,35 @@
+/* Measures thread_yield() with two threads ready to run, which
+   is a context switch each time under the round-robin schedulers.
+   The two threads yield the CPU back and forth ITERATIONS times
+   each. */
+
+#include "tests/perf/tests.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+#define ITERATIONS 10000
+
+static thread_func yield_thread;
+
+void test_perf_switch(void) {
+  struct semaphore done;
+  uint64_t start;
+  int i;
+
+  sema_init(&done, 0);
+  thread_create("yielder", thread_get_priority(), yield_thread, &done);
+
+  start = rdtsc();
+  for (i = 0; i < ITERATIONS; i++)
+    thread_yield();
+  sema_down(&done);
+  perf_report("thread_yield", rdtsc() - start, 2 * ITERATIONS);
+}
+
+static void yield_thread(void* done) {
+  int i;
+
+  for (i = 0; i < ITERATIONS; i++)
+    thread_yield();
+  sema_up(done);
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+our ($test);
+
+my ($name) = $test =~ m%([^/]+)$%;
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+fail "missing \"($name) begin\"\n" if !grep (/^\($name\) begin$/, @output);
+fail "missing \"($name) end\"\n" if !grep (/^\($name\) end$/, @output);
+fail "no cycle counts reported\n"
+  if !grep (/^\($name\) .*: \d+ cycles each/, @output);
+pass;
@@ -0,0 +1,36 @@
+#include "tests/perf/tests.h"
+#include <test-lib.h>
+#include <debug.h>
+#include <string.h>
+
+static const struct test perf_tests[] = {
+    {"perf-switch", test_perf_switch}, {"perf-lock", test_perf_lock},
+    {"perf-sema", test_perf_sema},     {"perf-sleep", test_perf_sleep},
+    {"perf-create", test_perf_create},
+};
+
+/* Runs the benchmark named NAME.  Each is run once under every
+   scheduler, as NAME followed by "-" and the scheduler's name,
+   which the kernel has been told with -sched=. */
+void run_perf_test(const char* name) {
+  const struct test* t;
+
+  for (t = perf_tests; t < perf_tests + sizeof perf_tests / sizeof *perf_tests; t++) {
+    size_t len = strlen(t->name);
+    if (strlen(name) >= len && !memcmp(name, t->name, len) &&
+        (name[len] == '\0' || name[len] == '-')) {
+      test_name = name;
+      msg("begin");
+      t->function();
+      msg("end");
+      return;
+    }
+  }
+  PANIC("no test named \"%s\"", name);
+}
+
+/* Prints that CNT times WHAT took CYCLES in all. */
+void perf_report(const char* what, uint64_t cycles, unsigned cnt) {
+  ASSERT(cnt > 0);
+  msg("%s: %llu cycles each (%u in %llu cycles)", what, cycles / cnt, cnt, cycles);
+}
@@ -0,0 +1,24 @@
+#ifndef TESTS_PERF_TESTS_H
+#define TESTS_PERF_TESTS_H
+
+#include <stdint.h>
+#include <test-lib.h>
+
+void run_perf_test(const char*);
+
+/* Returns the processor's time-stamp counter. */
+static inline uint64_t rdtsc(void) {
+  uint64_t tsc;
+  asm volatile("rdtsc" : "=A"(tsc));
+  return tsc;
+}
+
+void perf_report(const char* what, uint64_t cycles, unsigned cnt);
+
+extern test_func test_perf_switch;
+extern test_func test_perf_lock;
+extern test_func test_perf_sema;
+extern test_func test_perf_sleep;
+extern test_func test_perf_create;
+
+#endif /* tests/perf/tests.h */
@@ -0,0 +1,23 @@
+/* Queues a write from an invalid address in batch()'s ring.
+   The process must be terminated with -1 exit code. */
+
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static struct batch_ring ring;
+
+void test_main(void) {
+  struct batch_op* op = &ring.ops[0];
+  int handle;
+
+  CHECK((handle = open("sample.txt")) > 1, "open \"sample.txt\"");
+  op->op = BATCH_WRITE;
+  op->fd = handle;
+  op->buf = (char*)0xc0100000;
+  op->len = 123;
+  ring.tail = 1;
+  batch(&ring);
+  fail("should not have survived batch()");
+}
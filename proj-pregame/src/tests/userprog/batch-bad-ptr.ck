@@ -0,0 +1,10 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(batch-bad-ptr) begin
+(batch-bad-ptr) open "sample.txt"
+batch-bad-ptr: exit(-1)
+EOF
+pass;
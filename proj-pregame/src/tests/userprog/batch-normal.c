@@ -0,0 +1,43 @@
+/* Writes a file, seeks back to its start and reads it again,
+   all queued in one ring and carried out by one batch() call. */
+
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static struct batch_ring ring;
+
+/* Queues operation OP on FD with BUF and LEN in the ring. */
+static void queue(int op, int fd, void* buf, unsigned len) {
+  struct batch_op* o = &ring.ops[ring.tail % BATCH_RING_SIZE];
+
+  o->op = op;
+  o->fd = fd;
+  o->buf = buf;
+  o->len = len;
+  ring.tail++;
+}
+
+void test_main(void) {
+  char buf[sizeof sample];
+  int handle, cnt;
+
+  CHECK(create("test.txt", sizeof sample - 1), "create \"test.txt\"");
+  CHECK((handle = open("test.txt")) > 1, "open \"test.txt\"");
+  queue(BATCH_WRITE, handle, sample, sizeof sample - 1);
+  queue(BATCH_SEEK, handle, NULL, 0);
+  queue(BATCH_READ, handle, buf, sizeof sample - 1);
+  cnt = batch(&ring);
+  if (cnt != 3)
+    fail("batch() returned %d instead of 3", cnt);
+  if (ring.head != ring.tail)
+    fail("head is %u, not tail %u", ring.head, ring.tail);
+  if (ring.ops[0].result != sizeof sample - 1)
+    fail("write returned %d instead of %zu", ring.ops[0].result, sizeof sample - 1);
+  if (ring.ops[1].result != 0)
+    fail("seek returned %d instead of 0", ring.ops[1].result);
+  if (ring.ops[2].result != sizeof sample - 1)
+    fail("read returned %d instead of %zu", ring.ops[2].result, sizeof sample - 1);
+  compare_bytes(buf, sample, sizeof sample - 1, 0, "test.txt");
+}
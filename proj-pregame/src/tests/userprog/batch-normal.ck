@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(batch-normal) begin
+(batch-normal) create "test.txt"
+(batch-normal) open "test.txt"
+(batch-normal) end
+batch-normal: exit(0)
+EOF
+pass;
@@ -0,0 +1,44 @@
+/* Writes the sample into a pipe and reads it back out, both
+   queued in one ring and carried out by one batch() call, and
+   queues a seek on the pipe, which is not a file and so fails. */
+
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static struct batch_ring ring;
+
+/* Queues operation OP on FD with BUF and LEN in the ring. */
+static void queue(int op, int fd, void* buf, unsigned len) {
+  struct batch_op* o = &ring.ops[ring.tail % BATCH_RING_SIZE];
+
+  o->op = op;
+  o->fd = fd;
+  o->buf = buf;
+  o->len = len;
+  ring.tail++;
+}
+
+void test_main(void) {
+  char buf[sizeof sample];
+  int fds[2];
+  int cnt;
+
+  CHECK(pipe(fds) == 0, "pipe");
+  queue(BATCH_WRITE, fds[1], sample, sizeof sample - 1);
+  queue(BATCH_SEEK, fds[0], NULL, 0);
+  queue(BATCH_READ, fds[0], buf, sizeof sample - 1);
+  cnt = batch(&ring);
+  if (cnt != 3)
+    fail("batch() returned %d instead of 3", cnt);
+  if (ring.ops[0].result != sizeof sample - 1)
+    fail("write returned %d instead of %zu", ring.ops[0].result, sizeof sample - 1);
+  if (ring.ops[1].result != -1)
+    fail("seek returned %d instead of -1", ring.ops[1].result);
+  if (ring.ops[2].result != sizeof sample - 1)
+    fail("read returned %d instead of %zu", ring.ops[2].result, sizeof sample - 1);
+  compare_bytes(buf, sample, sizeof sample - 1, 0, "pipe");
+  close(fds[0]);
+  close(fds[1]);
+}
@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(batch-pipe) begin
+(batch-pipe) pipe
+(batch-pipe) end
+batch-pipe: exit(0)
+EOF
+pass;
@@ -0,0 +1,14 @@
+/* Passes getdents() a buffer at an invalid address.
+   The process must be terminated with -1 exit code. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void test_main(void) {
+  int handle;
+
+  CHECK((handle = open("sample.txt")) > 1, "open \"sample.txt\"");
+  getdents(handle, (char*)0xc0100000, 123);
+  fail("should not have survived getdents()");
+}
@@ -0,0 +1,35 @@
+/* Reads the names in the root directory with getdents(), which
+   packs as many as fit into each call's buffer, until it reports
+   the end of the directory, and checks that getdents() refuses a
+   file that is not a directory. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void test_main(void) {
+  char buf[64];
+  bool seen_sample = false, seen_self = false;
+  int dir_fd, file_fd, n;
+
+  CHECK((dir_fd = open("/")) > 1, "open \"/\"");
+  msg("getdents \"/\"");
+  while ((n = getdents(dir_fd, buf, sizeof buf)) > 0) {
+    const char* name;
+
+    for (name = buf; name < buf + n; name += strlen(name) + 1) {
+      if (!strcmp(name, "sample.txt"))
+        seen_sample = true;
+      else if (!strcmp(name, "getdents-normal"))
+        seen_self = true;
+    }
+  }
+  CHECK(n == 0, "getdents \"/\" at end (must return 0, actually %d)", n);
+  if (!seen_sample || !seen_self)
+    fail("\"sample.txt\" or \"getdents-normal\" missing from \"/\"");
+
+  CHECK((file_fd = open("sample.txt")) > 1, "open \"sample.txt\"");
+  n = getdents(file_fd, buf, sizeof buf);
+  CHECK(n == -1, "getdents \"sample.txt\" (must return -1, actually %d)", n);
+}
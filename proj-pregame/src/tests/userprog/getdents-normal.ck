@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(getdents-normal) begin
+(getdents-normal) open "/"
+(getdents-normal) getdents "/"
+(getdents-normal) getdents "/" at end (must return 0, actually 0)
+(getdents-normal) open "sample.txt"
+(getdents-normal) getdents "sample.txt" (must return -1, actually -1)
+(getdents-normal) end
+getdents-normal: exit(0)
+EOF
+pass;
@@ -0,0 +1,33 @@
+/* Opens "sample.txt" more times than the descriptor table first
+   has room for, checking that each open gets the lowest free
+   descriptor, also after one is closed, and exits with them all
+   still open. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define OPEN_CNT 40
+
+void test_main(void) {
+  int fds[OPEN_CNT];
+  int i, fd;
+
+  msg("open \"sample.txt\" %d times", OPEN_CNT);
+  for (i = 0; i < OPEN_CNT; i++) {
+    fds[i] = open("sample.txt");
+    if (fds[i] < 2)
+      fail("open #%d returned %d", i, fds[i]);
+    if (i > 0 && fds[i] != fds[i - 1] + 1)
+      fail("open #%d returned %d, not %d", i, fds[i], fds[i - 1] + 1);
+  }
+
+  msg("close the tenth and reopen");
+  close(fds[9]);
+  fd = open("sample.txt");
+  if (fd != fds[9])
+    fail("reopen returned %d, not the freed %d", fd, fds[9]);
+  fd = open("sample.txt");
+  if (fd != fds[OPEN_CNT - 1] + 1)
+    fail("next open returned %d, not %d", fd, fds[OPEN_CNT - 1] + 1);
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(open-many) begin
+(open-many) open "sample.txt" 40 times
+(open-many) close the tenth and reopen
+(open-many) end
+open-many: exit(0)
+EOF
+pass;
@@ -0,0 +1,23 @@
+/* Passes data through a pipe with plain write() and read(), and
+   reads end of file from it once its write end is closed. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void test_main(void) {
+  char buf[sizeof sample];
+  int fds[2];
+
+  CHECK(pipe(fds) == 0, "pipe");
+  CHECK(write(fds[1], sample, sizeof sample - 1) == (int)sizeof sample - 1,
+        "write sample to pipe");
+  CHECK(read(fds[0], buf, sizeof buf) == (int)sizeof sample - 1, "read sample from pipe");
+  if (memcmp(buf, sample, sizeof sample - 1))
+    fail("data read from pipe differs from data written");
+  close(fds[1]);
+  CHECK(read(fds[0], buf, sizeof buf) == 0, "read end of file from pipe");
+  close(fds[0]);
+}
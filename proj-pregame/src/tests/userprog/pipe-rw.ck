@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(pipe-rw) begin
+(pipe-rw) pipe
+(pipe-rw) write sample to pipe
+(pipe-rw) read sample from pipe
+(pipe-rw) read end of file from pipe
+(pipe-rw) end
+pipe-rw: exit(0)
+EOF
+pass;
@@ -0,0 +1,17 @@
+/* Passes readv() a buffer at an invalid address.
+   The process must be terminated with -1 exit code. */
+
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void test_main(void) {
+  char head[10];
+  struct iovec iov[2] = {{head, sizeof head}, {(char*)0xc0100000, 123}};
+  int handle;
+
+  CHECK((handle = open("sample.txt")) > 1, "open \"sample.txt\"");
+  readv(handle, iov, 2);
+  fail("should not have survived readv()");
+}
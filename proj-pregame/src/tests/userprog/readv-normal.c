@@ -0,0 +1,21 @@
+/* Reads a file into two buffers with one readv() call. */
+
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void test_main(void) {
+  char head[10];
+  char tail[sizeof sample];
+  struct iovec iov[2] = {{head, sizeof head}, {tail, sizeof tail}};
+  int handle, byte_cnt;
+
+  CHECK((handle = open("sample.txt")) > 1, "open \"sample.txt\"");
+  byte_cnt = readv(handle, iov, 2);
+  if (byte_cnt != sizeof sample - 1)
+    fail("readv() returned %d instead of %zu", byte_cnt, sizeof sample - 1);
+  compare_bytes(head, sample, sizeof head, 0, "sample.txt");
+  compare_bytes(tail, sample + sizeof head, sizeof sample - 1 - sizeof head, sizeof head,
+                "sample.txt");
+}
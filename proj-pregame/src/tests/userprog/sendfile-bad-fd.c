@@ -0,0 +1,16 @@
+/* Passes sendfile() descriptors that are not open.  It takes no
+   user pointers, so it must return -1 rather than end the
+   process. */
+
+#include <limits.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void test_main(void) {
+  int in;
+
+  CHECK((in = open("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK(sendfile(1234, in, 10) == -1, "sendfile to a bad fd");
+  CHECK(sendfile(1, INT_MAX, 10) == -1, "sendfile from a bad fd");
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(sendfile-bad-fd) begin
+(sendfile-bad-fd) open "sample.txt"
+(sendfile-bad-fd) sendfile to a bad fd
+(sendfile-bad-fd) sendfile from a bad fd
+(sendfile-bad-fd) end
+sendfile-bad-fd: exit(0)
+EOF
+pass;
@@ -0,0 +1,20 @@
+/* Copies a file into another with one sendfile() call. */
+
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void test_main(void) {
+  int in, out, byte_cnt;
+
+  CHECK((in = open("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK(create("copy.txt", sizeof sample - 1), "create \"copy.txt\"");
+  CHECK((out = open("copy.txt")) > 1, "open \"copy.txt\"");
+  byte_cnt = sendfile(out, in, sizeof sample - 1);
+  if (byte_cnt != sizeof sample - 1)
+    fail("sendfile() returned %d instead of %zu", byte_cnt, sizeof sample - 1);
+  msg("close \"copy.txt\"");
+  close(out);
+  check_file("copy.txt", sample, sizeof sample - 1);
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(sendfile-normal) begin
+(sendfile-normal) open "sample.txt"
+(sendfile-normal) create "copy.txt"
+(sendfile-normal) open "copy.txt"
+(sendfile-normal) close "copy.txt"
+(sendfile-normal) open "copy.txt" for verification
+(sendfile-normal) verified contents of "copy.txt"
+(sendfile-normal) close "copy.txt"
+(sendfile-normal) end
+sendfile-normal: exit(0)
+EOF
+pass;
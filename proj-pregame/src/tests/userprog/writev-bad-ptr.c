@@ -0,0 +1,15 @@
+/* Passes writev() an array of buffers at an invalid address.
+   The process must be terminated with -1 exit code. */
+
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void test_main(void) {
+  int handle;
+
+  CHECK((handle = open("sample.txt")) > 1, "open \"sample.txt\"");
+  writev(handle, (struct iovec*)0x10123420, 2);
+  fail("should have exited with -1");
+}
@@ -0,0 +1,20 @@
+/* Writes a file from two buffers with one writev() call. */
+
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void test_main(void) {
+  struct iovec iov[2] = {{sample, 10}, {sample + 10, sizeof sample - 1 - 10}};
+  int handle, byte_cnt;
+
+  CHECK(create("test.txt", sizeof sample - 1), "create \"test.txt\"");
+  CHECK((handle = open("test.txt")) > 1, "open \"test.txt\"");
+  byte_cnt = writev(handle, iov, 2);
+  if (byte_cnt != sizeof sample - 1)
+    fail("writev() returned %d instead of %zu", byte_cnt, sizeof sample - 1);
+  msg("close \"test.txt\"");
+  close(handle);
+  check_file("test.txt", sample, sizeof sample - 1);
+}
@@ -0,0 +1,26 @@
+/* Maps a file and, without touching the mapping first, passes it
+   to write() as the buffer, so that the kernel itself has to
+   fault its page in from the file. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void test_main(void) {
+  char* actual = (char*)0x10000000;
+  int handle, copy;
+  mapid_t map;
+
+  CHECK((handle = open("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK((map = mmap(handle, actual)) != MAP_FAILED, "mmap \"sample.txt\"");
+  CHECK(create("copy.txt", strlen(sample)), "create \"copy.txt\"");
+  CHECK((copy = open("copy.txt")) > 1, "open \"copy.txt\"");
+  CHECK(write(copy, actual, strlen(sample)) == (int)strlen(sample),
+        "write \"copy.txt\" from the mapping");
+  close(copy);
+  munmap(map);
+  close(handle);
+  check_file("copy.txt", sample, strlen(sample));
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-read-sc) begin
+(mmap-read-sc) open "sample.txt"
+(mmap-read-sc) mmap "sample.txt"
+(mmap-read-sc) create "copy.txt"
+(mmap-read-sc) open "copy.txt"
+(mmap-read-sc) write "copy.txt" from the mapping
+(mmap-read-sc) open "copy.txt" for verification
+(mmap-read-sc) verified contents of "copy.txt"
+(mmap-read-sc) close "copy.txt"
+(mmap-read-sc) end
+EOF
+pass;
@@ -0,0 +1,95 @@
+#include "threads/fpu.h"
+#include <debug.h>
+#include "threads/interrupt.h"
+#include "threads/thread.h"
+
+/* Lazy FPU switching.  The FPU holds the state of one thread,
+   its owner, whatever thread is running.  Switching to any other
+   thread sets CR0.TS, so that its first FPU instruction raises
+   #NM instead.  Only then is the owner's state saved into its
+   struct thread and the new thread's state loaded, or the FPU
+   reset if the thread has never used it, and the new thread
+   becomes the owner.  Threads that never touch the FPU, which
+   are most of them, never pay for saving or restoring it. */
+
+/* CR0 bits. */
+#define CR0_MP 0x00000002 /* Monitor coprocessor: WAIT traps, too, if TS. */
+#define CR0_EM 0x00000004 /* Emulation: every FPU instruction traps. */
+#define CR0_TS 0x00000008 /* Task switched: the next FPU instruction traps. */
+
+/* Thread whose state the FPU holds, or null if none's does.
+   Changed only with interrupts off. */
+static struct thread* owner;
+
+static intr_handler_func device_not_available;
+
+static inline uint32_t read_cr0(void) {
+  uint32_t cr0;
+  asm volatile("movl %%cr0, %0" : "=r"(cr0));
+  return cr0;
+}
+
+static inline void write_cr0(uint32_t cr0) { asm volatile("movl %0, %%cr0" : : "r"(cr0)); }
+
+/* Lets FPU instructions run. */
+static inline void clts(void) { asm volatile("clts"); }
+
+/* Makes the next FPU instruction raise #NM. */
+static inline void stts(void) { write_cr0(read_cr0() | CR0_TS); }
+
+/* Turns the FPU on, owned by no thread, and registers the
+   handler that hands it from thread to thread. */
+void fpu_init(void) {
+  write_cr0((read_cr0() & ~CR0_EM) | CR0_MP | CR0_TS);
+  intr_register_int(7, 0, INTR_OFF, device_not_available, "#NM Device Not Available Exception");
+}
+
+/* Called by the scheduler, with interrupts off, just before
+   switching to NEXT.  Lets NEXT use the FPU freely if it owns
+   it, and otherwise makes its first use trap. */
+void fpu_switch(struct thread* next) {
+  ASSERT(intr_get_level() == INTR_OFF);
+
+  if (next == owner)
+    clts();
+  else
+    stts();
+}
+
+/* Forgets T's FPU state, since T is being destroyed.  Its page
+   may be reused for a new thread, which must not inherit it.
+   Interrupts must be off. */
+void fpu_forget(struct thread* t) {
+  ASSERT(intr_get_level() == INTR_OFF);
+
+  if (t == owner)
+    owner = NULL;
+}
+
+/* #NM handler, run with interrupts off: gives the FPU to the
+   running thread, in user or kernel code. */
+static void device_not_available(struct intr_frame* f UNUSED) {
+  struct thread* cur = thread_current();
+
+  clts();
+  if (owner == cur)
+    return;
+  if (owner != NULL)
+    asm volatile("fnsave %0" : "=m"(owner->fpu));
+  if (cur->fpu_used)
+    asm volatile("frstor %0" : : "m"(cur->fpu));
+  else {
+    asm volatile("fninit");
+    cur->fpu_used = true;
+  }
+  owner = cur;
+}
+
+/* Saves the running thread's FPU state in STATE and gives the
+   kernel a clean FPU to use on the thread's behalf, for example
+   in a system call, without disturbing the thread's own
+   registers.  fpu_kernel_end() puts them back. */
+void fpu_kernel_begin(struct fpu_state* state) { asm volatile("fnsave %0; fninit" : "=m"(*state)); }
+
+/* Ends FPU use begun by fpu_kernel_begin(STATE). */
+void fpu_kernel_end(struct fpu_state* state) { asm volatile("frstor %0" : : "m"(*state)); }
@@ -0,0 +1,20 @@
+#ifndef THREADS_FPU_H
+#define THREADS_FPU_H
+
+#include <stdint.h>
+
+/* The state of the x87 FPU, as saved by FSAVE. */
+struct fpu_state {
+  uint8_t bytes[108];
+};
+
+struct thread;
+
+void fpu_init(void);
+void fpu_switch(struct thread* next);
+void fpu_forget(struct thread*);
+
+void fpu_kernel_begin(struct fpu_state*);
+void fpu_kernel_end(struct fpu_state*);
+
+#endif /* threads/fpu.h */
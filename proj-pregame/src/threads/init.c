@@ -10,12 +10,15 @@
 #include <string.h>
 #include <test-lib.h>
 #include "devices/kbd.h"
+#include "devices/profile.h"
 #include "devices/input.h"
 #include "devices/serial.h"
 #include "devices/shutdown.h"
 #include "devices/timer.h"
+#include "devices/trace.h"
 #include "devices/vga.h"
 #include "devices/rtc.h"
+#include "threads/fpu.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
 #include "threads/loader.h"
@@ -26,20 +29,30 @@
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "userprog/exception.h"
+#include "userprog/futex.h"
 #include "userprog/gdt.h"
+#include "userprog/pipe.h"
 #include "userprog/syscall.h"
 #include "userprog/tss.h"
 #include "tests/userprog/kernel/tests.h"
 #endif
 #ifdef THREADS
 #include "tests/threads/tests.h"
+#include "tests/perf/tests.h"
 #endif
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/virtio-blk.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/swap.h"
+#endif
 
 /* Page directory with kernel mappings only. */
 uint32_t* init_page_dir;
@@ -65,6 +78,7 @@ static void paging_init(void);
 
 static char** read_command_line(void);
 static char** parse_options(char** argv);
+static void parse_time_slice(char* value);
 static void run_actions(char** argv);
 static void usage(void);
 
@@ -96,6 +110,8 @@ int main(void) {
   palloc_init(user_page_limit);
   malloc_init();
   paging_init();
+  profile_init();
+  trace_init();
 
   /* Segmentation. */
 #ifdef USERPROG
@@ -105,16 +121,20 @@ int main(void) {
 
   /* Initialize interrupt handlers. */
   intr_init();
+  fpu_init();
   timer_init();
   kbd_init();
   input_init();
 #ifdef USERPROG
   exception_init();
   syscall_init();
+  futex_init();
+  pipe_init();
 #endif
 
   /* Start thread scheduler and enable interrupts. */
   thread_start();
+  palloc_start();
   serial_init_queue();
   timer_calibrate();
 
@@ -126,10 +146,17 @@ int main(void) {
 #ifdef FILESYS
   /* Initialize file system. */
   ide_init();
+  virtio_blk_init();
   locate_block_devices();
   filesys_init(format_filesys);
 #endif
 
+#ifdef VM
+  /* Initialize virtual memory. */
+  frame_init();
+  swap_init();
+#endif
+
   printf("Boot complete.\n");
 
   /* Run actions specified on kernel command line. */
@@ -151,32 +178,75 @@ static void bss_init(void) {
   memset(&_start_bss, 0, &_end_bss - &_start_bss);
 }
 
+/* CPUID leaf 1 feature flags, in EDX, and the CR4 bits that turn
+   them on.  See [IA32-v2a] "CPUID--CPU Identification" and
+   [IA32-v3a] 2.5 "Control Registers". */
+#define CPUID_PSE (1 << 3)  /* 4 MB pages. */
+#define CPUID_PGE (1 << 13) /* Global pages. */
+#define CR4_PSE (1 << 4)
+#define CR4_PGE (1 << 7)
+
+/* Returns the CPU's CPUID leaf 1 feature flags from EDX. */
+static uint32_t cpu_features(void) {
+  uint32_t eax = 1, ebx, ecx, edx;
+  asm volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+  return edx;
+}
+
 /* Populates the base page directory and page table with the
    kernel virtual mapping, and then sets up the CPU to use the
    new page directory.  Points init_page_dir to the page
-   directory it creates. */
+   directory it creates.
+
+   Where the CPU has them, each whole 4 MB of RAM without kernel
+   text in it is mapped by one large page rather than a page
+   table of 4 kB pages, so that walking through lots of memory
+   takes a TLB miss every 4 MB instead of every page.  The
+   kernel's mappings are also made global, so that they stay in
+   the TLB when a process switch loads CR3. */
 static void paging_init(void) {
   uint32_t *pd, *pt;
   size_t page;
   extern char _start, _end_kernel_text;
+  uint32_t features = cpu_features();
+  bool large_pages = (features & CPUID_PSE) != 0;
+  uint32_t global = (features & CPUID_PGE) != 0 ? PTE_G : 0;
+  uint32_t cr4;
 
   pd = init_page_dir = palloc_get_page(PAL_ASSERT | PAL_ZERO);
   pt = NULL;
-  for (page = 0; page < init_ram_pages; page++) {
+  for (page = 0; page < init_ram_pages;) {
     uintptr_t paddr = page * PGSIZE;
     char* vaddr = ptov(paddr);
     size_t pde_idx = pd_no(vaddr);
     size_t pte_idx = pt_no(vaddr);
     bool in_kernel_text = &_start <= vaddr && vaddr < &_end_kernel_text;
 
+    if (large_pages && pte_idx == 0 && init_ram_pages - page >= PTSPAN / PGSIZE &&
+        (vaddr + PTSPAN <= &_start || vaddr >= &_end_kernel_text)) {
+      pd[pde_idx] = pde_create_large_kernel(vaddr, true) | global;
+      page += PTSPAN / PGSIZE;
+      continue;
+    }
+
     if (pd[pde_idx] == 0) {
       pt = palloc_get_page(PAL_ASSERT | PAL_ZERO);
       pd[pde_idx] = pde_create(pt);
     }
 
-    pt[pte_idx] = pte_create_kernel(vaddr, !in_kernel_text);
+    pt[pte_idx] = pte_create_kernel(vaddr, !in_kernel_text) | global;
+    page++;
   }
 
+  /* Large and global pages have to be turned on before CR3 points
+     to a page directory that uses them. */
+  asm volatile("movl %%cr4, %0" : "=r"(cr4));
+  if (large_pages)
+    cr4 |= CR4_PSE;
+  if (global)
+    cr4 |= CR4_PGE;
+  asm volatile("movl %0, %%cr4" : : "r"(cr4));
+
   /* Store the physical address of the page directory into CR3
      aka PDBR (page directory base register).  This activates our
      new page tables immediately.  See [IA32-v2a] "MOV--Move
@@ -240,6 +310,8 @@ static char** parse_options(char** argv) {
       filesys_bdev_name = value;
     else if (!strcmp(name, "-scratch"))
       scratch_bdev_name = value;
+    else if (!strcmp(name, "-cache"))
+      cache_sectors = atoi(value);
 #ifdef VM
     else if (!strcmp(name, "-swap"))
       swap_bdev_name = value;
@@ -247,6 +319,12 @@ static char** parse_options(char** argv) {
 #endif
     else if (!strcmp(name, "-rs"))
       random_init(atoi(value));
+    else if (!strcmp(name, "-tickless"))
+      timer_tickless = true;
+    else if (!strcmp(name, "-profile"))
+      profile_enabled = true;
+    else if (!strcmp(name, "-trace"))
+      trace_enabled = true;
     else if (!strcmp(name, "-sched")) {
       if (!strcmp(value, "fifo"))
         scheduler_flags[SCHED_FIFO] = 1;
@@ -258,10 +336,15 @@ static char** parse_options(char** argv) {
         scheduler_flags[SCHED_MLFQS] = 1;
       else
         PANIC("unknown scheduler option `%s' (use -h for help)", value);
-    }
+    } else if (!strcmp(name, "-slice"))
+      parse_time_slice(value);
 #ifdef USERPROG
     else if (!strcmp(name, "-ul"))
       user_page_limit = atoi(value);
+#endif
+#ifdef VM
+    else if (!strcmp(name, "-stack"))
+      stack_page_limit = atoi(value);
 #endif
     else
       PANIC("unknown option `%s' (use -h for help)", name);
@@ -306,6 +389,48 @@ static char** parse_options(char** argv) {
   return argv;
 }
 
+/* Parses the value of a "-slice" option: an optional scheduler
+   name and colon, then the # of timer ticks to give each thread,
+   or three #s for the lowest, middle and highest third of the
+   priorities, separated by slashes.  Without a scheduler name,
+   the slices are set for every scheduler. */
+static void parse_time_slice(char* value) {
+  static const char* policies[] = {"fifo", "prio", "fair", "mlfqs"};
+  unsigned ticks[SLICE_CLASSES];
+  int policy = -1;
+  int cnt = 0;
+  char* colon;
+  char* save_ptr;
+  char* tick;
+
+  if (value == NULL)
+    PANIC("-slice needs a value (use -h for help)");
+  colon = strchr(value, ':');
+  if (colon != NULL) {
+    *colon = '\0';
+    for (size_t i = 0; i < sizeof policies / sizeof *policies; i++)
+      if (!strcmp(value, policies[i]))
+        policy = i;
+    if (policy == -1)
+      PANIC("unknown scheduler `%s' in -slice (use -h for help)", value);
+    value = colon + 1;
+  }
+
+  for (tick = strtok_r(value, "/", &save_ptr); tick != NULL;
+       tick = strtok_r(NULL, "/", &save_ptr)) {
+    if (cnt == SLICE_CLASSES || atoi(tick) < 1)
+      PANIC("bad time slice `%s' (use -h for help)", tick);
+    ticks[cnt++] = atoi(tick);
+  }
+  if (cnt == 1)
+    thread_set_time_slice(policy, -1, ticks[0]);
+  else if (cnt == SLICE_CLASSES)
+    for (int c = 0; c < SLICE_CLASSES; c++)
+      thread_set_time_slice(policy, c, ticks[c]);
+  else
+    PANIC("-slice needs 1 or %d time slices (use -h for help)", SLICE_CLASSES);
+}
+
 /* Runs the task specified in ARGV[1]. */
 static void run_task(char** argv) {
   const char* task = argv[1];
@@ -337,6 +462,15 @@ static void run_threads_kernel_task(char** argv) {
   run_threads_test(task);
   printf("Execution of '%s' complete.\n", task);
 }
+
+/* Runs the kernel benchmark specified in ARGV[1]. */
+static void run_perf_task(char** argv) {
+  const char* task = argv[1];
+
+  printf("Executing '%s':\n", task);
+  run_perf_test(task);
+  printf("Execution of '%s' complete.\n", task);
+}
 #endif
 
 /* Executes all of the actions specified in ARGV[]
@@ -357,6 +491,7 @@ static void run_actions(char** argv) {
 #endif
 #ifdef THREADS
       {"rtkt", 2, run_threads_kernel_task},
+      {"rpkt", 2, run_perf_task},
 #endif
 #ifdef FILESYS
       {"ls", 1, fsutil_ls},
@@ -403,6 +538,7 @@ static void usage(void) {
 #endif
 #ifdef THREADS
          "  rtkt TEST          Run threads kernel test TEST.\n"
+         "  rpkt TEST          Run kernel benchmark TEST.\n"
 #endif
 #ifdef FILESYS
          "  ls                 List files in the root directory.\n"
@@ -420,20 +556,29 @@ static void usage(void) {
          "  -f                 Format file system device during startup.\n"
          "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
          "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+         "  -cache=COUNT       Cache COUNT file system sectors.\n"
 #ifdef VM
          "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif // VM
 #endif // FILESYS
          "  -rs=SEED           Set random number seed to SEED.\n"
+         "  -tickless          Stop the timer tick while the CPU is idle.\n"
+         "  -profile           Sample the CPU at each timer tick; print the profile at shutdown.\n"
+         "  -trace             Record scheduling, I/O and other events; print them at shutdown.\n"
          "  -sched-fair        Use alternate non-strict priority scheduler. Mutually exclusive "
          "with \"-sched-mlfqs\", \"-sched-prio\".\n"
          "  -sched-mlfqs       Use multi-level feedback queue scheduler. Mutually exclusive with "
          "\"-sched-fair\", \"-sched-prio\".\n"
          "  -sched-prio        Use strict-priority round-robin scheduler. Mutually exclusive with "
          "\"-sched-fair\", \"-sched-mlfqs\".\n"
+         "  -slice=[SCHED:]N   Preempt threads after N timer ticks (default 4), under SCHED only\n"
+         "                     if given.  N may be LOW/MID/HIGH, by third of the priorities.\n"
 #ifdef USERPROG
          "  -ul=COUNT          Limit user memory to COUNT pages.\n"
 #endif // USERPROG
+#ifdef VM
+         "  -stack=COUNT       Let user stacks grow to COUNT pages.\n"
+#endif // VM
   );
   shutdown_power_off();
 }
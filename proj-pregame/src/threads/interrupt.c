@@ -11,6 +11,7 @@
 #include "devices/timer.h"
 #ifdef USERPROG
 #include "userprog/gdt.h"
+#include "userprog/process.h"
 #endif
 
 /* Programmable Interrupt Controller (PIC) registers.
@@ -42,14 +43,27 @@ static unsigned int unexpected_cnt[INTR_CNT];
 
 /* External interrupts are those generated by devices outside the
    CPU, such as the timer.  External interrupts run with
-   interrupts turned off, so they never nest, nor are they ever
-   pre-empted.  Handlers for external interrupts also may not
+   interrupts turned off, so their handlers never nest, nor are
+   they ever pre-empted.  Handlers for external interrupts also may not
    sleep, although they may invoke intr_yield_on_return() to
    request that a new process be scheduled just before the
    interrupt returns. */
 static bool in_external_intr; /* Are we processing an external interrupt? */
 static bool yield_on_return;  /* Should we yield on interrupt return? */
 
+/* Deferred work.  A handler that has more to do than must be
+   done with interrupts off queues the rest with intr_defer().  As
+   the outermost external interrupt returns, after acknowledging
+   it on the PIC, the queue is run with interrupts on, so that
+   other interrupts, even the same one again, are taken in the
+   meantime.  Those that come in are handled in full except for
+   their own deferred work, which joins the queue, and any yield
+   they ask for, which waits until the queue is empty.  Deferred
+   work counts as interrupt context: it may not sleep, but it may
+   call intr_yield_on_return(). */
+static struct list deferred_list; /* Work queued by intr_defer(). */
+static bool in_deferred;          /* Are we running deferred work? */
+
 /* Programmable Interrupt Controller helpers. */
 static void pic_init(void);
 static void pic_end_of_interrupt(int irq);
@@ -85,7 +99,7 @@ enum intr_level intr_set_level(enum intr_level level) {
 /* Enables interrupts and returns the previous interrupt status. */
 enum intr_level intr_enable(void) {
   enum intr_level old_level = intr_get_level();
-  ASSERT(!intr_context());
+  ASSERT(!in_external_intr);
 
   /* Enable interrupts by setting the interrupt flag.
 
@@ -115,6 +129,7 @@ void intr_init(void) {
 
   /* Initialize interrupt controller. */
   pic_init();
+  list_init(&deferred_list);
 
   /* Initialize IDT. */
   for (i = 0; i < INTR_CNT; i++)
@@ -192,9 +207,9 @@ void intr_register_int(uint8_t vec_no, int dpl, enum intr_level level, intr_hand
   register_handler(vec_no, dpl, level, handler, name);
 }
 
-/* Returns true during processing of an external interrupt
-   and false at all other times. */
-bool intr_context(void) { return in_external_intr; }
+/* Returns true during processing of an external interrupt,
+   including its deferred work, and false at all other times. */
+bool intr_context(void) { return in_external_intr || in_deferred; }
 
 /* During processing of an external interrupt, directs the
    interrupt handler to yield to a new process just before
@@ -205,6 +220,43 @@ void intr_yield_on_return(void) {
   yield_on_return = true;
 }
 
+/* Initializes D as work that, once deferred, calls FUNC with
+   AUX. */
+void intr_deferred_init(struct intr_deferred* d, intr_deferred_func* func, void* aux) {
+  ASSERT(func != NULL);
+
+  d->func = func;
+  d->aux = aux;
+  d->pending = false;
+}
+
+/* Queues D to run once the external interrupt being handled
+   returns, unless it is queued already.  Interrupts must be
+   off. */
+void intr_defer(struct intr_deferred* d) {
+  ASSERT(intr_get_level() == INTR_OFF);
+
+  if (!d->pending) {
+    d->pending = true;
+    list_push_back(&deferred_list, &d->elem);
+  }
+}
+
+/* Runs deferred work until there is none left, each piece with
+   interrupts on.  Interrupts must be off, and are again on
+   return. */
+static void run_deferred(void) {
+  in_deferred = true;
+  while (!list_empty(&deferred_list)) {
+    struct intr_deferred* d = list_entry(list_pop_front(&deferred_list), struct intr_deferred, elem);
+    d->pending = false;
+    intr_enable();
+    d->func(d->aux);
+    intr_disable();
+  }
+  in_deferred = false;
+}
+
 /* 8259A Programmable Interrupt Controller. */
 
 /* Initializes the PICs.  Refer to [8259A] for details.
@@ -327,10 +379,15 @@ void intr_handler(struct intr_frame* frame) {
   external = frame->vec_no >= 0x20 && frame->vec_no < 0x30;
   if (external) {
     ASSERT(intr_get_level() == INTR_OFF);
-    ASSERT(!intr_context());
+    ASSERT(!in_external_intr);
 
     in_external_intr = true;
-    yield_on_return = false;
+    if (!in_deferred)
+      yield_on_return = false;
+
+    /* The CPU may have been idle for several ticks. */
+    if (frame->vec_no != 0x20)
+      timer_interrupted();
   }
 
   /* Invoke the interrupt's handler. */
@@ -352,9 +409,21 @@ void intr_handler(struct intr_frame* frame) {
     in_external_intr = false;
     pic_end_of_interrupt(frame->vec_no);
 
-    if (yield_on_return)
-      thread_yield();
+    /* An interrupt taken while deferred work runs leaves the rest
+       to the interrupt that was running it. */
+    if (!in_deferred) {
+      run_deferred();
+      if (yield_on_return)
+        thread_yield();
+    }
   }
+
+#ifdef USERPROG
+  /* A thread of a process that another of its threads is ending
+     goes no further back into it. */
+  if (is_trap_from_userspace(frame))
+    pthread_exit_if_killed();
+#endif
 }
 
 /* Handles an unexpected interrupt with interrupt frame F.  An
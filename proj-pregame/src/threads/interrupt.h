@@ -1,6 +1,7 @@
 #ifndef THREADS_INTERRUPT_H
 #define THREADS_INTERRUPT_H
 
+#include <list.h>
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -61,6 +62,19 @@ void intr_register_int(uint8_t vec, int dpl, enum intr_level, intr_handler_func*
 bool intr_context(void);
 void intr_yield_on_return(void);
 
+/* Work deferred by an external interrupt handler, to be done
+   with interrupts on once the interrupt returns. */
+typedef void intr_deferred_func(void* aux);
+struct intr_deferred {
+  struct list_elem elem;    /* In the queue, while pending. */
+  intr_deferred_func* func; /* Function to call. */
+  void* aux;                /* Its argument. */
+  bool pending;             /* Queued and not yet run? */
+};
+
+void intr_deferred_init(struct intr_deferred*, intr_deferred_func*, void* aux);
+void intr_defer(struct intr_deferred*);
+
 void intr_dump_frame(const struct intr_frame*);
 const char* intr_name(uint8_t vec);
 
@@ -5,17 +5,20 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 
 /* A simple implementation of malloc().
 
-   The size of each request, in bytes, is rounded up to a power
-   of 2 and assigned to the "descriptor" that manages blocks of
-   that size.  The descriptor keeps a list of free blocks.  If
-   the free list is nonempty, one of its blocks is used to
-   satisfy the request.
+   The size of each request, in bytes, is rounded up to a size
+   class and assigned to the "descriptor" that manages blocks of
+   that size.  The classes are 16 and 24 bytes, and then four to
+   each doubling (32, 40, 48, 56, 64, 80, ...), so that no more
+   than a fifth of a block past 32 bytes goes unused.  The
+   descriptor keeps a list of free blocks.  If the free list is
+   nonempty, one of its blocks is used to satisfy the request.
 
    Otherwise, a new page of memory, called an "arena", is
    obtained from the page allocator (if none is available,
@@ -28,18 +31,44 @@
    blocks, we remove all of the arena's blocks from the free list
    and give the arena back to the page allocator.
 
-   We can't handle blocks bigger than 2 kB using this scheme,
-   because they're too big to fit in a single page with a
-   descriptor.  We handle those by allocating contiguous pages
-   with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   In front of each descriptor's free list is a small "magazine"
+   of free blocks, one for each CPU (and so, for now, one), that
+   malloc() takes from and free() returns to with only interrupts
+   off.  The descriptor's lock is needed only to refill an empty
+   magazine, or to flush a full one, by half a magazine of blocks
+   at a time.  Blocks in a magazine count as in use in their
+   arena, which cannot be freed until they come back, but there
+   are never more than a magazine's worth of them.
+
+   A kmem_cache is a descriptor of its own, for kernel objects of
+   one size that are allocated often, whose blocks are just as
+   big as the objects.
+
+   The largest class is the largest that fits two blocks to a
+   page, since a bigger block might as well have a page to
+   itself.  We handle blocks bigger than that, 1792 bytes, by
+   allocating contiguous pages with the page allocator and
+   sticking the allocation size at the beginning of the allocated
+   block's arena header. */
+
+/* Blocks in a magazine, and moved to or from one at a time. */
+#define MAGAZINE_SIZE 16
+#define MAGAZINE_BATCH (MAGAZINE_SIZE / 2)
 
 /* Descriptor. */
 struct desc {
-  size_t block_size;       /* Size of each element in bytes. */
-  size_t blocks_per_arena; /* Number of blocks in an arena. */
-  struct list free_list;   /* List of free blocks. */
-  struct lock lock;        /* Lock. */
+  size_t block_size;                     /* Size of each element in bytes. */
+  size_t blocks_per_arena;               /* Number of blocks in an arena. */
+  struct list free_list;                 /* List of free blocks. */
+  struct lock lock;                      /* Lock. */
+  struct block* magazine[MAGAZINE_SIZE]; /* Free blocks for the CPU. */
+  size_t magazine_cnt;                   /* Number of them. */
+};
+
+/* A cache of objects of one size. */
+struct kmem_cache {
+  struct desc desc;
+  const char* name; /* For debugging. */
 };
 
 /* Magic number for detecting arena corruption. */
@@ -58,43 +87,98 @@ struct block {
 };
 
 /* Our set of descriptors. */
-static struct desc descs[10]; /* Descriptors. */
+static struct desc descs[32]; /* Descriptors. */
 static size_t desc_cnt;       /* Number of descriptors. */
 
+/* Sizes are looked up in steps of this many bytes, the least
+   step between classes. */
+#define SIZE_STEP 8
+
+/* The descriptor for each request size up to the largest block,
+   in steps of SIZE_STEP bytes. */
+static struct desc* size_descs[PGSIZE / 2 / SIZE_STEP];
+
 static struct arena* block_to_arena(struct block*);
 static struct block* arena_to_block(struct arena*, size_t idx);
+static void desc_init(struct desc*, size_t block_size);
+static void* desc_alloc(struct desc*);
+static void desc_free(struct desc*, struct block*);
+static bool magazine_refill(struct desc*);
+static void magazine_flush(struct desc*);
+static palloc_reclaim_func drain_magazines;
+
+/* Returns the step from size class BLOCK_SIZE to the next. */
+static size_t class_step(size_t block_size) {
+  size_t power = 32;
+
+  if (block_size < power)
+    return SIZE_STEP;
+  while (power * 2 <= block_size)
+    power *= 2;
+  return power / 4;
+}
 
 /* Initializes the malloc() descriptors. */
 void malloc_init(void) {
-  size_t block_size;
-
-  for (block_size = 16; block_size < PGSIZE / 2; block_size *= 2) {
-    struct desc* d = &descs[desc_cnt++];
-    ASSERT(desc_cnt <= sizeof descs / sizeof *descs);
-    d->block_size = block_size;
-    d->blocks_per_arena = (PGSIZE - sizeof(struct arena)) / block_size;
-    list_init(&d->free_list);
-    lock_init(&d->lock);
+  size_t block_size, i;
+
+  for (block_size = 16; sizeof(struct arena) + 2 * block_size <= PGSIZE;
+       block_size += class_step(block_size)) {
+    ASSERT(desc_cnt < sizeof descs / sizeof *descs);
+    desc_init(&descs[desc_cnt++], block_size);
+  }
+
+  for (i = 0; (i + 1) * SIZE_STEP <= descs[desc_cnt - 1].block_size; i++) {
+    struct desc* d = descs;
+    ASSERT(i < sizeof size_descs / sizeof *size_descs);
+    while (d->block_size < (i + 1) * SIZE_STEP)
+      d++;
+    size_descs[i] = d;
+  }
+  palloc_register_reclaim(0, drain_magazines);
+}
+
+/* Creates and returns a cache of objects of SIZE bytes, named
+   NAME for debugging purposes.  Panics if memory is not
+   available. */
+struct kmem_cache* kmem_cache_create(const char* name, size_t size) {
+  struct kmem_cache* cache = malloc(sizeof *cache);
+  size_t block_size = ROUND_UP(size, sizeof(void*));
+
+  if (cache == NULL)
+    PANIC("kmem_cache_create: out of memory for \"%s\"", name);
+  if (block_size < sizeof(struct block))
+    block_size = sizeof(struct block);
+  ASSERT(sizeof(struct arena) + block_size <= PGSIZE);
+
+  desc_init(&cache->desc, block_size);
+  cache->name = name;
+  return cache;
+}
+
+/* Obtains and returns an object from CACHE.  Returns a null
+   pointer if memory is not available. */
+void* kmem_cache_alloc(struct kmem_cache* cache) { return desc_alloc(&cache->desc); }
+
+/* Frees object P, which must have been obtained from CACHE.  It
+   may also be freed with free(). */
+void kmem_cache_free(struct kmem_cache* cache, void* p) {
+  if (p != NULL) {
+    ASSERT(block_to_arena(p)->desc == &cache->desc);
+    desc_free(&cache->desc, p);
   }
 }
 
 /* Obtains and returns a new block of at least SIZE bytes.
    Returns a null pointer if memory is not available. */
 void* malloc(size_t size) {
-  struct desc* d;
-  struct block* b;
   struct arena* a;
 
   /* A null pointer satisfies a request for 0 bytes. */
   if (size == 0)
     return NULL;
 
-  /* Find the smallest descriptor that satisfies a SIZE-byte
-     request. */
-  for (d = descs; d < descs + desc_cnt; d++)
-    if (d->block_size >= size)
-      break;
-  if (d == descs + desc_cnt) {
+  if (size > descs[desc_cnt - 1].block_size) {
     /* SIZE is too big for any descriptor.
          Allocate enough pages to hold SIZE plus an arena. */
     size_t page_cnt = DIV_ROUND_UP(size + sizeof *a, PGSIZE);
@@ -110,34 +194,25 @@ void* malloc(size_t size) {
     return a + 1;
   }
 
-  lock_acquire(&d->lock);
+  /* Take a block from the smallest descriptor that satisfies a
+     SIZE-byte request. */
+  return desc_alloc(size_descs[(size - 1) / SIZE_STEP]);
+}
 
-  /* If the free list is empty, create a new arena. */
-  if (list_empty(&d->free_list)) {
-    size_t i;
+/* Takes a block from D's magazine, refilling it if it is empty.
+   Returns a null pointer if memory is not available. */
+static void* desc_alloc(struct desc* d) {
+  struct block* b;
+  enum intr_level old_level = intr_disable();
 
-    /* Allocate a page. */
-    a = palloc_get_page(0);
-    if (a == NULL) {
-      lock_release(&d->lock);
+  while (d->magazine_cnt == 0) {
+    intr_set_level(old_level);
+    if (!magazine_refill(d))
       return NULL;
-    }
-
-    /* Initialize arena and add its blocks to the free list. */
-    a->magic = ARENA_MAGIC;
-    a->desc = d;
-    a->free_cnt = d->blocks_per_arena;
-    for (i = 0; i < d->blocks_per_arena; i++) {
-      struct block* b = arena_to_block(a, i);
-      list_push_back(&d->free_list, &b->free_elem);
-    }
+    old_level = intr_disable();
   }
-
-  /* Get a block from free list and return it. */
-  b = list_entry(list_pop_front(&d->free_list), struct block, free_elem);
-  a = block_to_arena(b);
-  a->free_cnt--;
-  lock_release(&d->lock);
+  b = d->magazine[--d->magazine_cnt];
+  intr_set_level(old_level);
   return b;
 }
 
@@ -201,36 +276,159 @@ void free(void* p) {
 
     if (d != NULL) {
       /* It's a normal block.  We handle it here. */
+      desc_free(d, b);
+    } else {
+      /* It's a big block.  Free its pages. */
+      palloc_free_multiple(a, a->free_cnt);
+      return;
+    }
+  }
+}
+
+/* Initializes D as a descriptor of blocks of BLOCK_SIZE bytes. */
+static void desc_init(struct desc* d, size_t block_size) {
+  d->block_size = block_size;
+  d->blocks_per_arena = (PGSIZE - sizeof(struct arena)) / block_size;
+  list_init(&d->free_list);
+  lock_init(&d->lock);
+  d->magazine_cnt = 0;
+}
+
+/* Puts block B, of descriptor D, in D's magazine, flushing it
+   if it is full. */
+static void desc_free(struct desc* d, struct block* b) {
+  enum intr_level old_level;
 
 #ifndef NDEBUG
-      /* Clear the block to help detect use-after-free bugs. */
-      memset(b, 0xcc, d->block_size);
+  /* Clear the block to help detect use-after-free bugs. */
+  memset(b, 0xcc, d->block_size);
 #endif
 
-      lock_acquire(&d->lock);
+  old_level = intr_disable();
+  while (d->magazine_cnt == MAGAZINE_SIZE) {
+    intr_set_level(old_level);
+    magazine_flush(d);
+    old_level = intr_disable();
+  }
+  d->magazine[d->magazine_cnt++] = b;
+  intr_set_level(old_level);
+}
 
-      /* Add block to free list. */
-      list_push_front(&d->free_list, &b->free_elem);
+/* Adds a new arena's blocks to D's free list.  Returns false if
+   memory is not available.  D's lock must be held. */
+static bool add_arena(struct desc* d) {
+  struct arena* a = palloc_get_page(0);
+  size_t i;
+
+  if (a == NULL)
+    return false;
+
+  a->magic = ARENA_MAGIC;
+  a->desc = d;
+  a->free_cnt = d->blocks_per_arena;
+  for (i = 0; i < d->blocks_per_arena; i++) {
+    struct block* b = arena_to_block(a, i);
+    list_push_back(&d->free_list, &b->free_elem);
+  }
+  return true;
+}
 
-      /* If the arena is now entirely unused, free it. */
-      if (++a->free_cnt >= d->blocks_per_arena) {
-        size_t i;
+/* Returns block B to D's free list, and its arena to the page
+   allocator if that leaves the arena entirely unused, in which
+   case it returns true.  D's lock must be held. */
+static bool release_block(struct desc* d, struct block* b) {
+  struct arena* a = block_to_arena(b);
 
-        ASSERT(a->free_cnt == d->blocks_per_arena);
-        for (i = 0; i < d->blocks_per_arena; i++) {
-          struct block* b = arena_to_block(a, i);
-          list_remove(&b->free_elem);
-        }
-        palloc_free_page(a);
-      }
+  list_push_front(&d->free_list, &b->free_elem);
+  if (++a->free_cnt >= d->blocks_per_arena) {
+    size_t i;
 
-      lock_release(&d->lock);
-    } else {
-      /* It's a big block.  Free its pages. */
-      palloc_free_multiple(a, a->free_cnt);
-      return;
+    ASSERT(a->free_cnt == d->blocks_per_arena);
+    for (i = 0; i < d->blocks_per_arena; i++) {
+      struct block* b = arena_to_block(a, i);
+      list_remove(&b->free_elem);
+    }
+    palloc_free_page(a);
+    return true;
+  }
+  return false;
+}
+
+/* Moves up to MAGAZINE_BATCH blocks from D's free list, creating
+   an arena if it is empty, to D's magazine.  Returns false if
+   there were none and memory is not available. */
+static bool magazine_refill(struct desc* d) {
+  struct block* batch[MAGAZINE_BATCH];
+  enum intr_level old_level;
+  size_t cnt = 0, i;
+
+  lock_acquire(&d->lock);
+  while (cnt < MAGAZINE_BATCH) {
+    if (list_empty(&d->free_list) && (cnt > 0 || !add_arena(d)))
+      break;
+    batch[cnt] = list_entry(list_pop_front(&d->free_list), struct block, free_elem);
+    block_to_arena(batch[cnt])->free_cnt--;
+    cnt++;
+  }
+
+  /* Blocks freed meanwhile may have left less room. */
+  old_level = intr_disable();
+  for (i = 0; i < cnt && d->magazine_cnt < MAGAZINE_SIZE; i++)
+    d->magazine[d->magazine_cnt++] = batch[i];
+  intr_set_level(old_level);
+  for (; i < cnt; i++)
+    release_block(d, batch[i]);
+  lock_release(&d->lock);
+
+  return cnt > 0;
+}
+
+/* Moves MAGAZINE_BATCH blocks, or as many as it has, from D's
+   magazine back to D's free list. */
+static void magazine_flush(struct desc* d) {
+  struct block* batch[MAGAZINE_BATCH];
+  enum intr_level old_level;
+  size_t cnt = 0, i;
+
+  old_level = intr_disable();
+  while (cnt < MAGAZINE_BATCH && d->magazine_cnt > 0)
+    batch[cnt++] = d->magazine[--d->magazine_cnt];
+  intr_set_level(old_level);
+
+  lock_acquire(&d->lock);
+  for (i = 0; i < cnt; i++)
+    release_block(d, batch[i]);
+  lock_release(&d->lock);
+}
+
+/* Empties the magazines of the malloc() descriptors, giving back
+   the arenas that only their blocks kept in use, until PAGE_CNT
+   have been.  A descriptor whose lock another thread holds, or
+   the current one, is left alone.  The magazines of kmem_caches
+   are not drained. */
+static size_t drain_magazines(size_t page_cnt) {
+  size_t freed = 0, i;
+
+  for (i = 0; i < desc_cnt && freed < page_cnt; i++) {
+    struct desc* d = &descs[i];
+    enum intr_level old_level;
+
+    if (d->magazine_cnt == 0 || lock_held_by_current_thread(&d->lock) ||
+        !lock_try_acquire(&d->lock))
+      continue;
+    for (;;) {
+      struct block* b;
+
+      old_level = intr_disable();
+      b = d->magazine_cnt > 0 ? d->magazine[--d->magazine_cnt] : NULL;
+      intr_set_level(old_level);
+      if (b == NULL)
+        break;
+      freed += release_block(d, b);
     }
+    lock_release(&d->lock);
   }
+  return freed;
 }
 
 /* Returns the arena that block B is inside. */
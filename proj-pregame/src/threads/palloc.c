@@ -2,13 +2,17 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/loader.h"
+#include "threads/spinlock.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -23,20 +27,100 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Each pool is a binary buddy allocator.  Its free pages are
+   kept as blocks of 2**ORDER pages, aligned to their size, on a
+   free list for each order; a block is split in halves to make a
+   smaller one, and a freed block is merged with its buddy, the
+   other half of the block of the next order, as long as that is
+   free too.  A request for PAGE_CNT pages takes a block of the
+   least order that holds them and gives back the pages past
+   PAGE_CNT at once, so that no more than PAGE_CNT pages are ever
+   out, and palloc_free_multiple() can be given any run of pages
+   that were allocated.  A request that no block can hold, though
+   the pages it needs are free and contiguous, falls back to a
+   search of the bitmap of free pages.
+
+   The pools are protected by spin locks rather than by struct
+   lock, because pages are freed with interrupts off, when a
+   dying thread's page is given back by thread_switch_tail().
+
+   Each pool also keeps a reserve of pages zeroed in advance by a
+   thread of the least priority, so that a request for a single
+   page with PAL_ZERO, the usual kind when creating a page table
+   or a stack, need not clear it.  The reserve is given back when
+   the pool runs out.
+
+   Caches elsewhere in the kernel that hold pages they could do
+   without register reclaim functions for the pool they take
+   them from.  When a request finds its pool out of pages, the
+   thread making it calls them, in the order they registered,
+   until the pool is back over its high watermark, and then
+   tries again; only if that fails too does it get a null
+   pointer.  A request that leaves the pool under its low
+   watermark has the zeroing thread do the same in the
+   background, so that memory is given back before it runs out
+   when the system has the time.  Reclaiming is done by one
+   thread at a time, and never from within a reclaim function,
+   nor with interrupts off. */
+
+/* Largest order of block, enough for any pool. */
+#define MAX_ORDER 20
+
+/* In ORDERS[], for a page that does not start a free block. */
+#define ORDER_NONE 0xff
+
+/* Number of zeroed pages kept in each pool's reserve. */
+#define ZERO_RESERVE 32
+
+/* A pool's low watermark is this fraction of its pages, and its
+   high watermark twice that. */
+#define LOW_WATERMARK_DIV 32
+
+/* Most reclaim functions of each pool. */
+#define RECLAIM_MAX 8
 
 /* A memory pool. */
 struct pool {
-  struct lock lock;        /* Mutual exclusion. */
-  struct bitmap* used_map; /* Bitmap of free pages. */
-  uint8_t* base;           /* Base of pool. */
+  struct spinlock lock;            /* Mutual exclusion. */
+  struct bitmap* used_map;         /* Bitmap of free pages. */
+  uint8_t* orders;                 /* Order of the free block each page starts. */
+  struct list free[MAX_ORDER + 1]; /* Free blocks of each order. */
+  uint8_t* base;                   /* Base of pool. */
+  void* zeroed[ZERO_RESERVE];      /* Pages zeroed in advance. */
+  size_t zeroed_cnt;               /* Number of them. */
+  size_t free_cnt;                 /* Pages free in USED_MAP. */
+  size_t low, high;                /* Watermarks of free_cnt + zeroed_cnt. */
+  bool low_signaled;               /* Zeroing thread woken to reclaim? */
+
+  /* Registered reclaim functions.  Set up before they are
+     called, and never removed. */
+  palloc_reclaim_func* reclaim[RECLAIM_MAX];
+  size_t reclaim_cnt;
 };
 
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
+/* Upped to have the zeroing thread refill the reserves, or
+   reclaim pages. */
+static struct semaphore zero_wanted;
+static bool zeroing_started;
+
+/* Held by the thread calling reclaim functions. */
+static struct lock reclaim_lock;
+
 static void init_pool(struct pool*, void* base, size_t page_cnt, const char* name);
+static struct pool* pool_of(enum palloc_flags);
 static bool page_from_pool(const struct pool*, void* page);
+static size_t pool_alloc(struct pool*, size_t page_cnt);
+static void pool_free(struct pool*, size_t page_idx, size_t page_cnt);
+static void* take_zeroed(struct pool*);
+static void drain_zeroed(struct pool*);
+static bool reclaim(struct pool*, size_t page_cnt);
+static void check_low(struct pool*);
+static thread_func zero_thread NO_RETURN;
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -54,6 +138,15 @@ void palloc_init(size_t user_page_limit) {
   /* Give half of memory to kernel, half to user. */
   init_pool(&kernel_pool, free_start, kernel_pages, "kernel pool");
   init_pool(&user_pool, free_start + kernel_pages * PGSIZE, user_pages, "user pool");
+  lock_init(&reclaim_lock);
+}
+
+/* Starts the thread that zeroes pages in advance.  Must be
+   called after thread_start(). */
+void palloc_start(void) {
+  sema_init(&zero_wanted, 0);
+  zeroing_started = true;
+  thread_create("zeroer", PRI_MIN, zero_thread, NULL);
 }
 
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
@@ -63,16 +156,41 @@ void palloc_init(size_t user_page_limit) {
    available, returns a null pointer, unless PAL_ASSERT is set in
    FLAGS, in which case the kernel panics. */
 void* palloc_get_multiple(enum palloc_flags flags, size_t page_cnt) {
-  struct pool* pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  struct pool* pool = pool_of(flags);
   void* pages;
   size_t page_idx;
+  enum intr_level old_level;
 
   if (page_cnt == 0)
     return NULL;
 
-  lock_acquire(&pool->lock);
-  page_idx = bitmap_scan_and_flip(pool->used_map, 0, page_cnt, false);
-  lock_release(&pool->lock);
+  if (page_cnt == 1 && flags & PAL_ZERO) {
+    pages = take_zeroed(pool);
+    if (pages != NULL) {
+      check_low(pool);
+      return pages;
+    }
+  }
+
+  for (;;) {
+    old_level = spin_lock(&pool->lock);
+    page_idx = pool_alloc(pool, page_cnt);
+    if (page_idx == BITMAP_ERROR && pool->zeroed_cnt > 0) {
+      drain_zeroed(pool);
+      page_idx = pool_alloc(pool, page_cnt);
+    }
+    if (page_idx != BITMAP_ERROR) {
+      bitmap_set_multiple(pool->used_map, page_idx, page_cnt, true);
+      pool->free_cnt -= page_cnt;
+    }
+    spin_unlock(&pool->lock, old_level);
+
+    /* Out of pages, try again with what can be reclaimed. */
+    if (page_idx != BITMAP_ERROR || !reclaim(pool, page_cnt))
+      break;
+  }
+  if (page_idx != BITMAP_ERROR)
+    check_low(pool);
 
   if (page_idx != BITMAP_ERROR)
     pages = pool->base + PGSIZE * page_idx;
@@ -103,6 +221,7 @@ void* palloc_get_page(enum palloc_flags flags) { return palloc_get_multiple(flag
 void palloc_free_multiple(void* pages, size_t page_cnt) {
   struct pool* pool;
   size_t page_idx;
+  enum intr_level old_level;
 
   ASSERT(pg_ofs(pages) == 0);
   if (pages == NULL || page_cnt == 0)
@@ -121,30 +240,275 @@ void palloc_free_multiple(void* pages, size_t page_cnt) {
   memset(pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
+  old_level = spin_lock(&pool->lock);
   ASSERT(bitmap_all(pool->used_map, page_idx, page_cnt));
   bitmap_set_multiple(pool->used_map, page_idx, page_cnt, false);
+  pool_free(pool, page_idx, page_cnt);
+  pool->free_cnt += page_cnt;
+  spin_unlock(&pool->lock, old_level);
 }
 
 /* Frees the page at PAGE. */
 void palloc_free_page(void* page) { palloc_free_multiple(page, 1); }
 
+/* Returns the pool chosen as by PAL_USER in FLAGS. */
+static struct pool* pool_of(enum palloc_flags flags) {
+  return flags & PAL_USER ? &user_pool : &kernel_pool;
+}
+
+/* Returns the number of pages free in the pool chosen as by
+   PAL_USER in FLAGS, counting those zeroed in advance. */
+size_t palloc_free_cnt(enum palloc_flags flags) {
+  struct pool* pool = pool_of(flags);
+  enum intr_level old_level = spin_lock(&pool->lock);
+  size_t free_cnt = pool->free_cnt + pool->zeroed_cnt;
+  spin_unlock(&pool->lock, old_level);
+  return free_cnt;
+}
+
+/* Has RECLAIM called when the pool chosen as by PAL_USER in
+   FLAGS runs low.  Must be called while the kernel starts,
+   before any thread could be reclaiming. */
+void palloc_register_reclaim(enum palloc_flags flags, palloc_reclaim_func* reclaim) {
+  struct pool* pool = pool_of(flags);
+  ASSERT(pool->reclaim_cnt < RECLAIM_MAX);
+  pool->reclaim[pool->reclaim_cnt++] = reclaim;
+}
+
+/* Calls POOL's reclaim functions until it has its high
+   watermark of pages free, and PAGE_CNT more, or they have all
+   been called.  Returns true if they gave back any pages.
+   Returns false at once if the current thread may not sleep or
+   is reclaiming already, and otherwise waits for any other
+   thread reclaiming to finish first. */
+static bool reclaim(struct pool* pool, size_t page_cnt) {
+  size_t target = pool->high + page_cnt, freed = 0, i;
+  enum intr_level old_level;
+
+  if (pool->reclaim_cnt == 0 || intr_context() || intr_get_level() == INTR_OFF ||
+      lock_held_by_current_thread(&reclaim_lock))
+    return false;
+
+  lock_acquire(&reclaim_lock);
+  for (i = 0; i < pool->reclaim_cnt; i++) {
+    size_t free_cnt;
+
+    old_level = spin_lock(&pool->lock);
+    free_cnt = pool->free_cnt + pool->zeroed_cnt;
+    spin_unlock(&pool->lock, old_level);
+    if (free_cnt >= target)
+      break;
+    freed += pool->reclaim[i](target - free_cnt);
+  }
+  pool->low_signaled = false;
+  lock_release(&reclaim_lock);
+  return freed > 0;
+}
+
+/* Has the zeroing thread reclaim pages if POOL has fallen under
+   its low watermark. */
+static void check_low(struct pool* pool) {
+  enum intr_level old_level = spin_lock(&pool->lock);
+  bool wake = (pool->free_cnt + pool->zeroed_cnt < pool->low && !pool->low_signaled &&
+               pool->reclaim_cnt > 0);
+  if (wake)
+    pool->low_signaled = true;
+  spin_unlock(&pool->lock, old_level);
+
+  if (wake && zeroing_started)
+    sema_up(&zero_wanted);
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void init_pool(struct pool* p, void* base, size_t page_cnt, const char* name) {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP(bitmap_buf_size(page_cnt), PGSIZE);
+  /* We'll put the pool's used_map and orders at its base.
+     Calculate the space needed for them and subtract it from
+     the pool's size. */
+  size_t bm_size = ROUND_UP(bitmap_buf_size(page_cnt), sizeof(uint32_t));
+  size_t bm_pages = DIV_ROUND_UP(bm_size + page_cnt, PGSIZE);
+  size_t order;
   if (bm_pages > page_cnt)
     PANIC("Not enough memory in %s for bitmap.", name);
   page_cnt -= bm_pages;
+  ASSERT(page_cnt < (size_t)1 << (MAX_ORDER + 1));
 
   printf("%zu pages available in %s.\n", page_cnt, name);
 
-  /* Initialize the pool. */
-  lock_init(&p->lock);
-  p->used_map = bitmap_create_in_buf(page_cnt, base, bm_pages * PGSIZE);
+  /* Initialize the pool, with all of its pages free. */
+  spinlock_init(&p->lock);
+  p->used_map = bitmap_create_in_buf(page_cnt, base, bm_size);
+  p->orders = (uint8_t*)base + bm_size;
+  memset(p->orders, ORDER_NONE, page_cnt);
+  for (order = 0; order <= MAX_ORDER; order++)
+    list_init(&p->free[order]);
   p->base = base + bm_pages * PGSIZE;
+  p->zeroed_cnt = 0;
+  p->free_cnt = page_cnt;
+  p->low = page_cnt / LOW_WATERMARK_DIV;
+  p->high = 2 * p->low;
+  p->low_signaled = false;
+  pool_free(p, 0, page_cnt);
+}
+
+/* The list element at the start of free page PAGE_IDX. */
+static struct list_elem* block_elem(const struct pool* pool, size_t page_idx) {
+  return (struct list_elem*)(pool->base + PGSIZE * page_idx);
+}
+
+static size_t block_idx(const struct pool* pool, struct list_elem* elem) {
+  return pg_no(elem) - pg_no(pool->base);
+}
+
+/* Frees the block of 2**ORDER pages at PAGE_IDX, merging it
+   with its buddy for as long as that is free. */
+static void free_block(struct pool* pool, size_t page_idx, size_t order) {
+  size_t page_cnt = bitmap_size(pool->used_map);
+
+  for (; order < MAX_ORDER; order++) {
+    size_t buddy = page_idx ^ ((size_t)1 << order);
+    if (buddy >= page_cnt || pool->orders[buddy] != order)
+      break;
+    list_remove(block_elem(pool, buddy));
+    pool->orders[buddy] = ORDER_NONE;
+    page_idx &= ~((size_t)1 << order);
+  }
+  pool->orders[page_idx] = order;
+  list_push_front(&pool->free[order], block_elem(pool, page_idx));
+}
+
+/* Frees the PAGE_CNT pages at PAGE_IDX, as the largest aligned
+   blocks they can be split into. */
+static void pool_free(struct pool* pool, size_t page_idx, size_t page_cnt) {
+  while (page_cnt > 0) {
+    size_t order = 0;
+    while (order < MAX_ORDER && page_idx % ((size_t)2 << order) == 0 &&
+           (size_t)2 << order <= page_cnt)
+      order++;
+    free_block(pool, page_idx, order);
+    page_idx += (size_t)1 << order;
+    page_cnt -= (size_t)1 << order;
+  }
+}
+
+/* Takes the PAGE_CNT free pages at PAGE_IDX out of the free
+   blocks they are in, and frees the rest of those blocks again. */
+static void carve(struct pool* pool, size_t page_idx, size_t page_cnt) {
+  size_t end = page_idx + page_cnt;
+  size_t page = page_idx;
+
+  while (page < end) {
+    size_t order = 0, head, head_end;
+
+    /* Find the free block that PAGE is in. */
+    while (pool->orders[head = page & ~(((size_t)1 << order) - 1)] != order) {
+      order++;
+      ASSERT(order <= MAX_ORDER);
+    }
+    list_remove(block_elem(pool, head));
+    pool->orders[head] = ORDER_NONE;
+
+    head_end = head + ((size_t)1 << order);
+    if (head < page_idx)
+      pool_free(pool, head, page_idx - head);
+    if (head_end > end)
+      pool_free(pool, end, head_end - end);
+    page = head_end;
+  }
+}
+
+/* Takes PAGE_CNT free pages from POOL and returns the index of
+   the first, or BITMAP_ERROR if it has no free run so long. */
+static size_t pool_alloc(struct pool* pool, size_t page_cnt) {
+  size_t want = 0, order, page_idx;
+
+  for (; (size_t)1 << want < page_cnt && want <= MAX_ORDER; want++)
+    continue;
+  for (order = want; order <= MAX_ORDER && list_empty(&pool->free[order]); order++)
+    continue;
+  if (order > MAX_ORDER) {
+    page_idx = bitmap_scan(pool->used_map, 0, page_cnt, false);
+    if (page_idx != BITMAP_ERROR)
+      carve(pool, page_idx, page_cnt);
+    return page_idx;
+  }
+
+  page_idx = block_idx(pool, list_pop_front(&pool->free[order]));
+  pool->orders[page_idx] = ORDER_NONE;
+
+  /* Split the block down to the order wanted, and give back what
+     is left past PAGE_CNT. */
+  while (order > want) {
+    order--;
+    free_block(pool, page_idx + ((size_t)1 << order), order);
+  }
+  pool_free(pool, page_idx + page_cnt, ((size_t)1 << want) - page_cnt);
+  return page_idx;
+}
+
+/* Takes a page from POOL's reserve of zeroed pages, and has the
+   reserve refilled if it is running low.  Returns a null pointer
+   if the reserve is empty. */
+static void* take_zeroed(struct pool* pool) {
+  enum intr_level old_level = spin_lock(&pool->lock);
+  void* page = pool->zeroed_cnt > 0 ? pool->zeroed[--pool->zeroed_cnt] : NULL;
+  bool low = pool->zeroed_cnt == ZERO_RESERVE / 2;
+  spin_unlock(&pool->lock, old_level);
+
+  if (low && zeroing_started)
+    sema_up(&zero_wanted);
+  return page;
+}
+
+/* Frees the pages in POOL's reserve of zeroed pages.  POOL's
+   lock must be held. */
+static void drain_zeroed(struct pool* pool) {
+  while (pool->zeroed_cnt > 0) {
+    size_t page_idx = pg_no(pool->zeroed[--pool->zeroed_cnt]) - pg_no(pool->base);
+    bitmap_reset(pool->used_map, page_idx);
+    pool_free(pool, page_idx, 1);
+    pool->free_cnt++;
+  }
+}
+
+/* Fills POOL's reserve of zeroed pages, as far as it has free
+   pages.  Only the zeroing thread adds to the reserve, so it
+   cannot fill up while a page is being cleared. */
+static void fill_zeroed(struct pool* pool) {
+  for (;;) {
+    enum intr_level old_level = spin_lock(&pool->lock);
+    size_t page_idx = pool->zeroed_cnt < ZERO_RESERVE ? pool_alloc(pool, 1) : BITMAP_ERROR;
+    void* page;
+    if (page_idx != BITMAP_ERROR) {
+      bitmap_mark(pool->used_map, page_idx);
+      pool->free_cnt--;
+    }
+    spin_unlock(&pool->lock, old_level);
+    if (page_idx == BITMAP_ERROR)
+      return;
+
+    page = pool->base + PGSIZE * page_idx;
+    memset(page, 0, PGSIZE);
+
+    old_level = spin_lock(&pool->lock);
+    ASSERT(pool->zeroed_cnt < ZERO_RESERVE);
+    pool->zeroed[pool->zeroed_cnt++] = page;
+    spin_unlock(&pool->lock, old_level);
+  }
+}
+
+/* Keeps the reserves of zeroed pages filled, and reclaims pages
+   for a pool that has run low. */
+static void zero_thread(void* aux UNUSED) {
+  for (;;) {
+    if (kernel_pool.low_signaled)
+      reclaim(&kernel_pool, 0);
+    if (user_pool.low_signaled)
+      reclaim(&user_pool, 0);
+    fill_zeroed(&kernel_pool);
+    fill_zeroed(&user_pool);
+    sema_down(&zero_wanted);
+  }
 }
 
 /* Returns true if PAGE was allocated from POOL,
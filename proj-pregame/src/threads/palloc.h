@@ -1,6 +1,7 @@
 #ifndef THREADS_PALLOC_H
 #define THREADS_PALLOC_H
 
+#include <stdbool.h>
 #include <stddef.h>
 
 /* How to allocate pages. */
@@ -11,9 +12,19 @@ enum palloc_flags {
 };
 
 void palloc_init(size_t user_page_limit);
+void palloc_start(void);
 void* palloc_get_page(enum palloc_flags);
 void* palloc_get_multiple(enum palloc_flags, size_t page_cnt);
 void palloc_free_page(void*);
 void palloc_free_multiple(void*, size_t page_cnt);
+size_t palloc_free_cnt(enum palloc_flags);
+
+/* Gives back up to PAGE_CNT pages that a cache can do without,
+   and returns the number given back.  Called by a thread that
+   may sleep, with interrupts on and no pool's lock held, but
+   possibly holding other locks: it must not wait for any lock
+   it cannot be sure of getting. */
+typedef size_t palloc_reclaim_func(size_t page_cnt);
+void palloc_register_reclaim(enum palloc_flags, palloc_reclaim_func*);
 
 #endif /* threads/palloc.h */
@@ -47,7 +47,8 @@ static inline uintptr_t pd_no(const void* va) { return (uintptr_t)va >> PDSHIFT;
    |         Physical Address           |         Flags          |
    +------------------------------------+------------------------+
 
-   In a PDE, the physical address points to a page table.
+   In a PDE, the physical address points to a page table, or, if
+   PTE_PS is set, to a 4 MB page that the PDE maps by itself.
    In a PTE, the physical address points to a data or code page.
    The important flags are listed below.
    When a PDE or PTE is not "present", the other flags are
@@ -62,6 +63,8 @@ static inline uintptr_t pd_no(const void* va) { return (uintptr_t)va >> PDSHIFT;
 #define PTE_U 0x4            /* 1=user/kernel, 0=kernel only. */
 #define PTE_A 0x20           /* 1=accessed, 0=not acccessed. */
 #define PTE_D 0x40           /* 1=dirty, 0=not dirty (PTEs only). */
+#define PTE_PS 0x80          /* 1=4 MB page, 0=page table (PDEs only). */
+#define PTE_G 0x100          /* 1=global, kept in the TLB across CR3 loads. */
 
 /* Returns a PDE that points to page table PT. */
 static inline uint32_t pde_create(uint32_t* pt) {
@@ -69,10 +72,20 @@ static inline uint32_t pde_create(uint32_t* pt) {
   return vtop(pt) | PTE_U | PTE_P | PTE_W;
 }
 
+/* Returns a PDE that maps the 4 MB of memory starting at PAGE as
+   one large page, usable only by ring 0 code.  PAGE must be 4 MB
+   aligned.  If WRITABLE is true the memory is writable as well
+   as readable. */
+static inline uint32_t pde_create_large_kernel(void* page, bool writable) {
+  ASSERT(((uintptr_t)page & (PTSPAN - 1)) == 0);
+  return vtop(page) | PTE_PS | PTE_P | (writable ? PTE_W : 0);
+}
+
 /* Returns a pointer to the page table that page directory entry
    PDE, which must "present", points to. */
 static inline uint32_t* pde_get_pt(uint32_t pde) {
   ASSERT(pde & PTE_P);
+  ASSERT(!(pde & PTE_PS));
   return ptov(pde & PTE_ADDR);
 }
 
@@ -0,0 +1,46 @@
+#ifndef THREADS_SPINLOCK_H
+#define THREADS_SPINLOCK_H
+
+#include <debug.h>
+#include "threads/interrupt.h"
+
+/* Spin lock, for data that interrupt handlers share with threads
+   and that is now protected by turning interrupts off alone.
+
+   spin_lock() turns interrupts off, as before, and then takes the
+   lock with an atomic exchange, spinning while another CPU holds
+   it.  With a single CPU the lock is never found held, because
+   its holder runs with interrupts off until it lets go; the lock
+   only names what it protects, so that the code is ready for a
+   second CPU, where turning interrupts off is no longer enough.
+
+   A spin lock must not be held across a sleep or a thread
+   switch. */
+struct spinlock {
+  volatile int locked; /* 1 if held, 0 otherwise. */
+};
+
+/* Initializer for a spin lock declared statically. */
+#define SPINLOCK_INITIALIZER                                                                       \
+  { 0 }
+
+static inline void spinlock_init(struct spinlock* lock) { lock->locked = 0; }
+
+/* Turns interrupts off, acquires LOCK, and returns the previous
+   interrupt level, to be passed to spin_unlock(). */
+static inline enum intr_level spin_lock(struct spinlock* lock) {
+  enum intr_level old_level = intr_disable();
+  while (__sync_lock_test_and_set(&lock->locked, 1))
+    while (lock->locked)
+      asm volatile("pause");
+  return old_level;
+}
+
+/* Releases LOCK and restores interrupts to OLD_LEVEL. */
+static inline void spin_unlock(struct spinlock* lock, enum intr_level old_level) {
+  ASSERT(lock->locked);
+  __sync_lock_release(&lock->locked);
+  intr_set_level(old_level);
+}
+
+#endif /* threads/spinlock.h */
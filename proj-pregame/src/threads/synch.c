@@ -29,9 +29,33 @@
 #include "threads/synch.h"
 #include <stdio.h>
 #include <string.h>
+#include "devices/trace.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 
+/* Source of the waiters' sequence numbers, which break ties in
+   priority first come, first served. */
+static unsigned next_wait_seq;
+
+/* Returns true if a waiter with PRIORITY_A that came at SEQ_A
+   should wake after one with PRIORITY_B that came at SEQ_B: it
+   has a lower priority under priority scheduling, or the same
+   and came later.  The sequence numbers are compared modulo
+   wraparound. */
+static bool wakes_later(int priority_a, unsigned seq_a, int priority_b, unsigned seq_b) {
+  if (priority_a != priority_b && thread_priority_scheduling())
+    return priority_a < priority_b;
+  return (int)(seq_a - seq_b) > 0;
+}
+
+/* Orders the threads in a semaphore's waiters. */
+static bool sema_waiter_less(const struct heap_elem* a_, const struct heap_elem* b_,
+                             void* aux UNUSED) {
+  const struct thread* a = heap_entry(a_, struct thread, waitelem);
+  const struct thread* b = heap_entry(b_, struct thread, waitelem);
+  return wakes_later(a->wait_priority, a->wait_seq, b->wait_priority, b->wait_seq);
+}
+
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
    manipulating it:
@@ -45,7 +69,7 @@ void sema_init(struct semaphore* sema, unsigned value) {
   ASSERT(sema != NULL);
 
   sema->value = value;
-  list_init(&sema->waiters);
+  heap_init(&sema->waiters, sema_waiter_less, NULL);
 }
 
 /* Down or "P" operation on a semaphore.  Waits for SEMA's value
@@ -62,8 +86,12 @@ void sema_down(struct semaphore* sema) {
   ASSERT(!intr_context());
 
   old_level = intr_disable();
+  TRACE(TRACE_SEMA_DOWN, sema, sema->value);
   while (sema->value == 0) {
-    list_push_back(&sema->waiters, &thread_current()->elem);
+    struct thread* cur = thread_current();
+    cur->wait_priority = cur->priority;
+    cur->wait_seq = next_wait_seq++;
+    heap_push(&sema->waiters, &cur->waitelem);
     thread_block();
   }
   sema->value--;
@@ -102,10 +130,16 @@ void sema_up(struct semaphore* sema) {
   ASSERT(sema != NULL);
 
   old_level = intr_disable();
-  if (!list_empty(&sema->waiters))
-    thread_unblock(list_entry(list_pop_front(&sema->waiters), struct thread, elem));
+  TRACE(TRACE_SEMA_UP, sema, sema->value);
+  if (!heap_empty(&sema->waiters))
+    thread_unblock(heap_entry(heap_pop(&sema->waiters), struct thread, waitelem));
   sema->value++;
   intr_set_level(old_level);
+
+  /* The thread woken may outrank the one running.  In an
+     interrupt handler, thread_unblock() has seen to that. */
+  if (!intr_context())
+    thread_preempt();
 }
 
 static void sema_test_helper(void* sema_);
@@ -158,9 +192,85 @@ void lock_init(struct lock* lock) {
   ASSERT(lock != NULL);
 
   lock->holder = NULL;
+  lock->priority = PRI_MIN;
   sema_init(&lock->semaphore, 1);
 }
 
+/* How many holders a donation is passed along to, through a
+   holder waiting for a lock with a holder of its own and so on.
+   Bounds the time spent with interrupts off if locks are ever
+   taken in a cycle. */
+#define DONATION_DEPTH 16
+
+/* Donates the running thread's priority, which is about to wait
+   for LOCK, to LOCK's holder, and on along the chain of locks the
+   holders wait for while any runs at a lower priority.  Interrupts
+   must be off.
+
+   A holder that is itself waiting moves up in the waiters of the
+   lock it waits for, which are kept in order of the priority
+   each had when it started to wait. */
+static void donate_priority(struct lock* lock) {
+  int priority = thread_current()->priority;
+  int depth;
+
+  for (depth = 0; lock != NULL && lock->holder != NULL && depth < DONATION_DEPTH; depth++) {
+    if (lock->priority < priority)
+      lock->priority = priority;
+    if (lock->holder->priority >= priority)
+      break;
+    struct thread* holder = lock->holder;
+    thread_update_priority(holder, priority);
+    lock = holder->waiting_lock;
+    if (lock != NULL && holder->status == THREAD_BLOCKED) {
+      struct heap* waiters = &lock->semaphore.waiters;
+      heap_remove(waiters, &holder->waitelem);
+      holder->wait_priority = priority;
+      heap_push(waiters, &holder->waitelem);
+    }
+  }
+}
+
+/* Returns the highest priority among the threads waiting for
+   LOCK, or PRI_MIN if there are none.  Interrupts must be off. */
+static int waiters_priority(struct lock* lock) {
+  struct heap* waiters = &lock->semaphore.waiters;
+  if (heap_empty(waiters))
+    return PRI_MIN;
+  return heap_entry(heap_top(waiters), struct thread, waitelem)->wait_priority;
+}
+
+/* Takes LOCK for the running thread if it is free, without
+   turning interrupts off: one locked compare-and-swap claims the
+   semaphore, and the rest touches only the running thread's own
+   list.  Returns false, having done nothing, if LOCK is taken or
+   this is an interrupt handler, which takes the slow path.
+
+   A thread that started waiting between the claim and the holder
+   being set found no holder to donate to, so the waiters are
+   checked once the holder is set, and any donation made then. */
+static bool lock_acquire_fast(struct lock* lock) {
+  struct thread* cur;
+
+  if (intr_context() || !__sync_bool_compare_and_swap(&lock->semaphore.value, 1, 0))
+    return false;
+
+  cur = thread_current();
+  lock->priority = PRI_MIN;
+  list_push_back(&cur->held_locks, &lock->elem);
+  lock->holder = cur;
+  barrier();
+
+  if (!heap_empty(&lock->semaphore.waiters) && active_sched_policy == SCHED_PRIO) {
+    enum intr_level old_level = intr_disable();
+    lock->priority = waiters_priority(lock);
+    if (lock->priority > cur->priority)
+      thread_update_priority(cur, lock->priority);
+    intr_set_level(old_level);
+  }
+  return true;
+}
+
 /* Acquires LOCK, sleeping until it becomes available if
    necessary.  The lock must not already be held by the current
    thread.
@@ -170,12 +280,38 @@ void lock_init(struct lock* lock) {
    interrupts disabled, but interrupts will be turned back on if
    we need to sleep. */
 void lock_acquire(struct lock* lock) {
+  struct thread* cur = thread_current();
+  enum intr_level old_level;
+
   ASSERT(lock != NULL);
   ASSERT(!intr_context());
   ASSERT(!lock_held_by_current_thread(lock));
 
+  if (lock_acquire_fast(lock))
+    return;
+
+  /* Under strict priority, a holder preempted by middling threads
+     runs at the priority of the highest thread waiting on it. */
+  old_level = intr_disable();
+  if (lock->holder != NULL && active_sched_policy == SCHED_PRIO) {
+    cur->waiting_lock = lock;
+    donate_priority(lock);
+  }
+  intr_set_level(old_level);
+
   sema_down(&lock->semaphore);
-  lock->holder = thread_current();
+
+  /* The threads still waiting donate to the new holder. */
+  old_level = intr_disable();
+  cur->waiting_lock = NULL;
+  lock->holder = cur;
+  list_push_back(&cur->held_locks, &lock->elem);
+  if (active_sched_policy == SCHED_PRIO) {
+    lock->priority = waiters_priority(lock);
+    if (lock->priority > cur->priority)
+      thread_update_priority(cur, lock->priority);
+  }
+  intr_set_level(old_level);
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -190,9 +326,17 @@ bool lock_try_acquire(struct lock* lock) {
   ASSERT(lock != NULL);
   ASSERT(!lock_held_by_current_thread(lock));
 
+  if (lock_acquire_fast(lock))
+    return true;
+
   success = sema_try_down(&lock->semaphore);
-  if (success)
+  if (success) {
+    enum intr_level old_level = intr_disable();
     lock->holder = thread_current();
+    lock->priority = PRI_MIN;
+    list_push_back(&lock->holder->held_locks, &lock->elem);
+    intr_set_level(old_level);
+  }
   return success;
 }
 
@@ -202,10 +346,32 @@ bool lock_try_acquire(struct lock* lock) {
    make sense to try to release a lock within an interrupt
    handler. */
 void lock_release(struct lock* lock) {
+  struct thread* cur = thread_current();
+  enum intr_level old_level;
+  struct list_elem* e;
+  int priority;
+
   ASSERT(lock != NULL);
   ASSERT(lock_held_by_current_thread(lock));
 
+  /* What was donated through LOCK goes with it: the holder falls
+     back to the highest of its own priority and what the locks it
+     still holds bring, which each lock keeps so that none of
+     their waiters need to be looked at. */
+  old_level = intr_disable();
+  list_remove(&lock->elem);
   lock->holder = NULL;
+  if (active_sched_policy == SCHED_PRIO) {
+    priority = cur->base_priority;
+    for (e = list_begin(&cur->held_locks); e != list_end(&cur->held_locks); e = list_next(e)) {
+      struct lock* held = list_entry(e, struct lock, elem);
+      if (held->priority > priority)
+        priority = held->priority;
+    }
+    thread_update_priority(cur, priority);
+  }
+  intr_set_level(old_level);
+
   sema_up(&lock->semaphore);
 }
 
@@ -223,25 +389,45 @@ void rw_lock_init(struct rw_lock* rw_lock) {
   lock_init(&rw_lock->lock);
   cond_init(&rw_lock->read);
   cond_init(&rw_lock->write);
-  rw_lock->AR = rw_lock->WR = rw_lock->AW = rw_lock->WW = 0;
+  rw_lock->readers = 0;
+  rw_lock->WR = rw_lock->AW = rw_lock->WW = 0;
 }
 
-/* Acquire a writer-centric readers-writers lock */
+/* Acquire a writer-centric readers-writers lock.
+
+   Readers count themselves in with a compare-and-swap on the
+   readers word while RW_WRITERS is clear, without the guard lock,
+   so that they do not serialize on it.  Writers set RW_WRITERS
+   under the guard lock before waiting, which sends any reader
+   after them to the slow path to wait behind them.  Waiters of
+   either kind are woken in priority order by cond_signal(). */
 void rw_lock_acquire(struct rw_lock* rw_lock, bool reader) {
+  if (reader) {
+    // Reader fast path: no writer active or waiting
+    unsigned readers = rw_lock->readers;
+    while (!(readers & RW_WRITERS)) {
+      unsigned seen = __sync_val_compare_and_swap(&rw_lock->readers, readers, readers + 1);
+      if (seen == readers)
+        return;
+      readers = seen;
+    }
+  }
+
   // Must hold the guard lock the entire time
   lock_acquire(&rw_lock->lock);
 
   if (reader) {
     // Reader code: Block while there are waiting or active writers
-    while ((rw_lock->AW + rw_lock->WW) > 0) {
+    while (rw_lock->readers & RW_WRITERS) {
       rw_lock->WR++;
       cond_wait(&rw_lock->read, &rw_lock->lock);
       rw_lock->WR--;
     }
-    rw_lock->AR++;
+    __sync_fetch_and_add(&rw_lock->readers, 1);
   } else {
-    // Writer code: Block while there are any active readers/writers in the system
-    while ((rw_lock->AR + rw_lock->AW) > 0) {
+    // Writer code: Keep new readers out, then block while there are any active readers/writers
+    __sync_fetch_and_or(&rw_lock->readers, RW_WRITERS);
+    while ((rw_lock->readers & ~RW_WRITERS) > 0 || rw_lock->AW > 0) {
       rw_lock->WW++;
       cond_wait(&rw_lock->write, &rw_lock->lock);
       rw_lock->WW--;
@@ -255,20 +441,27 @@ void rw_lock_acquire(struct rw_lock* rw_lock, bool reader) {
 
 /* Release a writer-centric readers-writers lock */
 void rw_lock_release(struct rw_lock* rw_lock, bool reader) {
-  // Must hold the guard lock the entire time
-  lock_acquire(&rw_lock->lock);
-
   if (reader) {
-    // Reader code: Wake any waiting writers if we are the last reader
-    rw_lock->AR--;
-    if (rw_lock->AR == 0 && rw_lock->WW > 0)
-      cond_signal(&rw_lock->write, &rw_lock->lock);
-  } else {
-    // Writer code: First try to wake a waiting writer, otherwise all waiting readers
-    rw_lock->AW--;
+    // Reader code: Only the last reader with a writer waiting takes the guard lock, to wake it
+    if (__sync_sub_and_fetch(&rw_lock->readers, 1) != RW_WRITERS)
+      return;
+    lock_acquire(&rw_lock->lock);
     if (rw_lock->WW > 0)
       cond_signal(&rw_lock->write, &rw_lock->lock);
-    else if (rw_lock->WR > 0)
+    lock_release(&rw_lock->lock);
+    return;
+  }
+
+  // Must hold the guard lock the entire time
+  lock_acquire(&rw_lock->lock);
+
+  // Writer code: First try to wake a waiting writer, otherwise let readers in and wake them all
+  rw_lock->AW--;
+  if (rw_lock->WW > 0)
+    cond_signal(&rw_lock->write, &rw_lock->lock);
+  else {
+    __sync_fetch_and_and(&rw_lock->readers, ~RW_WRITERS);
+    if (rw_lock->WR > 0)
       cond_broadcast(&rw_lock->read, &rw_lock->lock);
   }
 
@@ -278,17 +471,27 @@ void rw_lock_release(struct rw_lock* rw_lock, bool reader) {
 
 /* One semaphore in a list. */
 struct semaphore_elem {
-  struct list_elem elem;      /* List element. */
+  struct heap_elem elem;      /* Heap element. */
   struct semaphore semaphore; /* This semaphore. */
+  int priority;               /* Priority of the thread waiting on it. */
+  unsigned seq;               /* When it started waiting. */
 };
 
+/* Orders the semaphore_elems in a condition's waiters. */
+static bool cond_waiter_less(const struct heap_elem* a_, const struct heap_elem* b_,
+                             void* aux UNUSED) {
+  const struct semaphore_elem* a = heap_entry(a_, struct semaphore_elem, elem);
+  const struct semaphore_elem* b = heap_entry(b_, struct semaphore_elem, elem);
+  return wakes_later(a->priority, a->seq, b->priority, b->seq);
+}
+
 /* Initializes condition variable COND.  A condition variable
    allows one piece of code to signal a condition and cooperating
    code to receive the signal and act upon it. */
 void cond_init(struct condition* cond) {
   ASSERT(cond != NULL);
 
-  list_init(&cond->waiters);
+  heap_init(&cond->waiters, cond_waiter_less, NULL);
 }
 
 /* Atomically releases LOCK and waits for COND to be signaled by
@@ -320,7 +523,9 @@ void cond_wait(struct condition* cond, struct lock* lock) {
   ASSERT(lock_held_by_current_thread(lock));
 
   sema_init(&waiter.semaphore, 0);
-  list_push_back(&cond->waiters, &waiter.elem);
+  waiter.priority = thread_current()->priority;
+  waiter.seq = __sync_fetch_and_add(&next_wait_seq, 1);
+  heap_push(&cond->waiters, &waiter.elem);
   lock_release(lock);
   sema_down(&waiter.semaphore);
   lock_acquire(lock);
@@ -339,8 +544,8 @@ void cond_signal(struct condition* cond, struct lock* lock UNUSED) {
   ASSERT(!intr_context());
   ASSERT(lock_held_by_current_thread(lock));
 
-  if (!list_empty(&cond->waiters))
-    sema_up(&list_entry(list_pop_front(&cond->waiters), struct semaphore_elem, elem)->semaphore);
+  if (!heap_empty(&cond->waiters))
+    sema_up(&heap_entry(heap_pop(&cond->waiters), struct semaphore_elem, elem)->semaphore);
 }
 
 /* Wakes up all threads, if any, waiting on COND (protected by
@@ -353,6 +558,6 @@ void cond_broadcast(struct condition* cond, struct lock* lock) {
   ASSERT(cond != NULL);
   ASSERT(lock != NULL);
 
-  while (!list_empty(&cond->waiters))
+  while (!heap_empty(&cond->waiters))
     cond_signal(cond, lock);
 }
@@ -1,13 +1,14 @@
 #ifndef THREADS_SYNCH_H
 #define THREADS_SYNCH_H
 
+#include <heap.h>
 #include <list.h>
 #include <stdbool.h>
 
 /* A counting semaphore. */
 struct semaphore {
   unsigned value;      /* Current value. */
-  struct list waiters; /* List of waiting threads. */
+  struct heap waiters; /* Waiting threads, the next to wake on top. */
 };
 
 void sema_init(struct semaphore*, unsigned value);
@@ -20,6 +21,8 @@ void sema_self_test(void);
 struct lock {
   struct thread* holder;      /* Thread holding lock (for debugging). */
   struct semaphore semaphore; /* Binary semaphore controlling access. */
+  struct list_elem elem;      /* In the holder's held_locks. */
+  int priority;               /* Highest priority donated by waiters. */
 };
 
 void lock_init(struct lock*);
@@ -30,7 +33,7 @@ bool lock_held_by_current_thread(const struct lock*);
 
 /* Condition variable. */
 struct condition {
-  struct list waiters; /* List of waiting threads. */
+  struct heap waiters; /* Waiting threads, the next to wake on top. */
 };
 
 void cond_init(struct condition*);
@@ -42,10 +45,15 @@ void cond_broadcast(struct condition*, struct lock*);
 #define RW_READER 1
 #define RW_WRITER 0
 
+/* The active readers, which count up from bit 0 of rw_lock's
+   readers, and a flag set while a writer is active or waiting. */
+#define RW_WRITERS 0x80000000u
+
 struct rw_lock {
   struct lock lock;
   struct condition read, write;
-  int AR, WR, AW, WW;
+  unsigned readers; /* Active readers, plus RW_WRITERS. */
+  int WR, AW, WW;
 };
 
 void rw_lock_init(struct rw_lock*);
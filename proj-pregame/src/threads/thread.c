@@ -4,13 +4,17 @@
 #include <random.h>
 #include <stdio.h>
 #include <string.h>
+#include <syscall-types.h>
 #include "threads/flags.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
 #include "threads/palloc.h"
+#include "threads/spinlock.h"
 #include "threads/switch.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
+#include "devices/timer.h"
+#include "devices/trace.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #endif
@@ -24,16 +28,70 @@
    that are ready to run but not actually running. */
 static struct list fifo_ready_list;
 
+/* The ready threads under the strict-priority scheduler: a FIFO
+   queue for each priority, and a bitmap of the queues that are
+   not empty, so that the highest priority with a ready thread is
+   found with one bit scan however many threads are ready. */
+#define PRIO_MASK_WORDS ((PRI_MAX + 1 + 31) / 32)
+static struct list prio_ready_lists[PRI_MAX + 1];
+static uint32_t prio_ready_mask[PRIO_MASK_WORDS];
+static int prio_ready_cnt; /* Threads in all the queues. */
+
+/* The MLFQS keeps its ready threads in the same queues.  Once a
+   second, when load_avg is updated, recent_cpu decays for every
+   thread; that is applied right away only to the threads that are
+   running or ready, whose priorities it changes.  A blocked thread
+   catches up when it is next made ready, with the factor each
+   second decayed by, kept for the last DECAY_HISTORY seconds and
+   the oldest of them taken for any before. */
+#define DECAY_HISTORY 64
+static fixed_point_t load_avg;
+static int64_t mlfqs_seconds; /* Seconds since the MLFQS started. */
+static fixed_point_t decay_history[DECAY_HISTORY];
+
+/* The fair scheduler does stride scheduling at two levels: among
+   the groups with a thread ready, and among the ready threads of
+   the group picked.  Each level runs the node of least pass, from
+   a heap of them, and charges it for every tick it runs a stride
+   inversely proportional to its share.  The running thread and its
+   group are out of the heaps, so their passes can grow in place. */
+#define FAIR_STRIDE1 (1 << 16)               /* Stride of a single ticket. */
+#define FAIR_GROUP_STRIDE (FAIR_STRIDE1 / 64) /* Every group's stride. */
+static struct fair_group kernel_group;       /* The kernel threads. */
+static struct fair_node* fair_groups;        /* Heap of groups ready to run. */
+static struct fair_group* fair_running;      /* Group of the running thread. */
+static unsigned fair_running_ticks;          /* Ticks it has run since chosen. */
+static uint64_t fair_pass;                   /* Pass of the group chosen last. */
+
+/* Returns the struct that fair_node NODE is member MEMBER of. */
+#define fair_entry(NODE, STRUCT, MEMBER)                                                           \
+  ((STRUCT*)((uint8_t*)(NODE) - offsetof(STRUCT, MEMBER)))
+
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
 static struct list all_list;
 
+/* All threads but those that have exited, keyed by tid, for
+   thread_find().  Set up by thread_start(), once malloc() works. */
+static struct hash tid_table;
+static struct lock tid_table_lock;
+static bool tid_table_ready;
+
 /* Idle thread. */
 static struct thread* idle_thread;
 
 /* Initial thread, the thread running init.c:main(). */
 static struct thread* initial_thread;
 
+/* Pages of threads that have died, kept to be the pages of new
+   ones without a trip through palloc.  A thread's page needs no
+   zeroing: init_thread() clears the struct thread at its start,
+   and the stack above it is written before it is read. */
+#define THREAD_PAGE_CACHE_SIZE 8
+static void* thread_page_cache[THREAD_PAGE_CACHE_SIZE];
+static size_t thread_page_cache_cnt;
+static struct spinlock thread_page_cache_lock = SPINLOCK_INITIALIZER;
+
 /* Lock used by allocate_tid(). */
 static struct lock tid_lock;
 
@@ -48,17 +106,38 @@ struct kernel_thread_frame {
 static long long idle_ticks;   /* # of timer ticks spent idle. */
 static long long kernel_ticks; /* # of timer ticks in kernel threads. */
 static long long user_ticks;   /* # of timer ticks in user programs. */
+static long long voluntary_switches;   /* # of switches on blocking or exiting. */
+static long long involuntary_switches; /* # of switches away from ready threads. */
+
+/* # of waits in the run queue by length: 0 ticks in the first
+   bucket, then [2**(N-1), 2**N) ticks in bucket N, and the last
+   taking any longer. */
+static long long wait_histogram[SCHED_WAIT_BUCKETS];
 
 /* Scheduling. */
 #define TIME_SLICE 4          /* # of timer ticks to give each thread. */
 static unsigned thread_ticks; /* # of timer ticks since last yield. */
 
+/* # of timer ticks to give a thread, by scheduling policy and
+   class of its priority, if not TIME_SLICE.  Set by the kernel
+   command-line option "-slice", so that a workload can trade the
+   cost of switching for responsiveness: longer slices for the
+   low, CPU-bound priorities of the MLFQS, say, and shorter ones
+   for its high, interactive ones. */
+static unsigned time_slices[8][SLICE_CLASSES];
+
 static void init_thread(struct thread*, const char* name, int priority);
 static bool is_thread(struct thread*) UNUSED;
 static void* alloc_frame(struct thread*, size_t size);
 static void schedule(void);
 static void thread_enqueue(struct thread* t);
+static int64_t run_ns(struct thread*);
 static tid_t allocate_tid(void);
+static struct thread* alloc_thread_page(void);
+static palloc_reclaim_func drain_thread_pages;
+static hash_hash_func tid_hash;
+static hash_less_func tid_less;
+static void tid_table_insert(struct thread*);
 void thread_switch_tail(struct thread* prev);
 
 static void kernel_thread(thread_func*, void* aux);
@@ -71,6 +150,15 @@ static struct thread* thread_schedule_prio(void);
 static struct thread* thread_schedule_fair(void);
 static struct thread* thread_schedule_mlfqs(void);
 static struct thread* thread_schedule_reserved(void);
+static int prio_highest_ready(void);
+static void prio_push(struct thread*);
+static void prio_remove(struct thread*);
+static int mlfqs_priority(struct thread*);
+static void mlfqs_catch_up(struct thread*);
+static void mlfqs_tick(struct thread*);
+static void fair_enqueue(struct thread*);
+static void fair_put_back(void);
+static unsigned time_slice(struct thread*);
 
 /* Determines which scheduler the kernel should use.
    Controlled by the kernel command-line options
@@ -107,12 +195,17 @@ void thread_init(void) {
   ASSERT(intr_get_level() == INTR_OFF);
 
   lock_init(&tid_lock);
+  lock_init(&tid_table_lock);
   list_init(&fifo_ready_list);
+  for (int i = PRI_MIN; i <= PRI_MAX; i++)
+    list_init(&prio_ready_lists[i]);
   list_init(&all_list);
 
   /* Set up a thread structure for the running thread. */
   initial_thread = running_thread();
   init_thread(initial_thread, "main", PRI_DEFAULT);
+  if (active_sched_policy == SCHED_MLFQS)
+    initial_thread->priority = mlfqs_priority(initial_thread);
   initial_thread->status = THREAD_RUNNING;
   initial_thread->tid = allocate_tid();
 }
@@ -120,8 +213,17 @@ void thread_init(void) {
 /* Starts preemptive thread scheduling by enabling interrupts.
    Also creates the idle thread. */
 void thread_start(void) {
-  /* Create the idle thread. */
   struct semaphore idle_started;
+
+  palloc_register_reclaim(0, drain_thread_pages);
+
+  /* Index the threads by tid. */
+  if (!hash_init(&tid_table, tid_hash, tid_less, NULL))
+    PANIC("out of memory for the thread table");
+  tid_table_ready = true;
+  tid_table_insert(initial_thread);
+
+  /* Create the idle thread. */
   sema_init(&idle_started, 0);
   thread_create("idle", PRI_MIN, idle, &idle_started);
 
@@ -146,16 +248,114 @@ void thread_tick(void) {
 #endif
   else
     kernel_ticks++;
+#ifdef USERPROG
+  process_update_vdso();
+#endif
+
+  if (active_sched_policy == SCHED_MLFQS)
+    mlfqs_tick(t);
+  else if (active_sched_policy == SCHED_FAIR && t != idle_thread) {
+    t->fair.pass += FAIR_STRIDE1 / (t->priority + 1);
+    fair_running_ticks++;
+  }
 
   /* Enforce preemption. */
-  if (++thread_ticks >= TIME_SLICE)
+  if (++thread_ticks >= time_slice(t))
     intr_yield_on_return();
 }
 
+/* Gives threads TICKS timer ticks at a time under POLICY, or
+   under every policy if POLICY is -1, at the priorities of
+   SLICE_CLASS, or at every priority if SLICE_CLASS is -1.  Must
+   be called before the scheduler starts. */
+void thread_set_time_slice(int policy, int slice_class, unsigned ticks) {
+  ASSERT(policy >= -1 && policy < 8);
+  ASSERT(slice_class >= -1 && slice_class < SLICE_CLASSES);
+  ASSERT(ticks > 0);
+
+  for (int p = 0; p < 8; p++)
+    for (int c = 0; c < SLICE_CLASSES; c++)
+      if ((policy == -1 || p == policy) && (slice_class == -1 || c == slice_class))
+        time_slices[p][c] = ticks;
+}
+
+/* Returns the # of timer ticks T may run before it is preempted,
+   which depends on its priority as it is now, so that a thread
+   the MLFQS demotes mid-slice gets the longer slice at once. */
+static unsigned time_slice(struct thread* t) {
+  unsigned ticks =
+      time_slices[active_sched_policy][t->priority * SLICE_CLASSES / (PRI_MAX + 1)];
+  return ticks != 0 ? ticks : TIME_SLICE;
+}
+
 /* Prints thread statistics. */
 void thread_print_stats(void) {
+  struct list_elem* e;
+
   printf("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n", idle_ticks, kernel_ticks,
          user_ticks);
+  printf("Thread: %lld voluntary switches, %lld involuntary switches\n", voluntary_switches,
+         involuntary_switches);
+
+  printf("Thread: run queue waits, in ticks:");
+  for (int i = 0; i < SCHED_WAIT_BUCKETS; i++)
+    if (wait_histogram[i] != 0) {
+      if (i == 0)
+        printf(" 0: %lld", wait_histogram[i]);
+      else if (i == SCHED_WAIT_BUCKETS - 1)
+        printf(" %d+: %lld", 1 << (i - 1), wait_histogram[i]);
+      else
+        printf(" %d-%d: %lld", 1 << (i - 1), (1 << i) - 1, wait_histogram[i]);
+    }
+  printf("\n");
+
+  for (e = list_begin(&all_list); e != list_end(&all_list); e = list_next(e)) {
+    struct thread* t = list_entry(e, struct thread, allelem);
+    printf("Thread %s (%d): %lld us running, %lld ticks ready, %u voluntary, %u involuntary "
+           "switches\n",
+           t->name, t->tid, run_ns(t) / 1000, t->ready_ticks, t->voluntary_switches,
+           t->involuntary_switches);
+  }
+}
+
+/* Returns statistic STAT, one of the SCHED_STAT_* values in
+   <syscall-nr.h>, or -1 if there is no such statistic. */
+long long thread_sched_stat(int stat) {
+  struct thread* cur = thread_current();
+
+  if (stat == SCHED_STAT_READY_TICKS)
+    return cur->ready_ticks;
+  else if (stat == SCHED_STAT_RUN_NS)
+    return run_ns(cur);
+  else if (stat == SCHED_STAT_VOLUNTARY)
+    return cur->voluntary_switches;
+  else if (stat == SCHED_STAT_INVOLUNTARY)
+    return cur->involuntary_switches;
+  else if (stat >= SCHED_STAT_WAIT && stat < SCHED_STAT_WAIT + SCHED_WAIT_BUCKETS)
+    return wait_histogram[stat - SCHED_STAT_WAIT];
+  else
+    return -1;
+}
+
+/* Returns the nanoseconds T has spent running, up to now if it
+   is running. */
+static int64_t run_ns(struct thread* t) {
+  enum intr_level old_level = intr_disable();
+  int64_t ns = t->run_ns;
+  if (t->status == THREAD_RUNNING)
+    ns += timer_ns() - t->running_since;
+  intr_set_level(old_level);
+  return ns;
+}
+
+/* Returns the bucket of wait_histogram for a wait of TICKS. */
+static int wait_bucket(int64_t ticks) {
+  int bucket = 0;
+  while (ticks > 0 && bucket < SCHED_WAIT_BUCKETS - 1) {
+    ticks >>= 1;
+    bucket++;
+  }
+  return bucket;
 }
 
 /* Creates a new kernel thread named NAME with the given initial
@@ -183,13 +383,22 @@ tid_t thread_create(const char* name, int priority, thread_func* function, void*
   ASSERT(function != NULL);
 
   /* Allocate thread. */
-  t = palloc_get_page(PAL_ZERO);
+  t = alloc_thread_page();
   if (t == NULL)
     return TID_ERROR;
 
   /* Initialize thread. */
   init_thread(t, name, priority);
   tid = t->tid = allocate_tid();
+  tid_table_insert(t);
+
+  /* Under the MLFQS, a thread starts out as nice as its parent,
+     with as much recent_cpu, and PRIORITY goes unused. */
+  if (active_sched_policy == SCHED_MLFQS && function != idle) {
+    t->nice = thread_current()->nice;
+    t->recent_cpu = thread_current()->recent_cpu;
+    t->priority = t->base_priority = mlfqs_priority(t);
+  }
 
   /* Stack frame for kernel_thread(). */
   kf = alloc_frame(t, sizeof *kf);
@@ -208,6 +417,7 @@ tid_t thread_create(const char* name, int priority, thread_func* function, void*
 
   /* Add to run queue. */
   thread_unblock(t);
+  thread_preempt();
 
   return tid;
 }
@@ -222,6 +432,7 @@ void thread_block(void) {
   ASSERT(!intr_context());
   ASSERT(intr_get_level() == INTR_OFF);
 
+  TRACE(TRACE_BLOCK, 0, 0);
   thread_current()->status = THREAD_BLOCKED;
   schedule();
 }
@@ -234,12 +445,55 @@ static void thread_enqueue(struct thread* t) {
   ASSERT(intr_get_level() == INTR_OFF);
   ASSERT(is_thread(t));
 
+  t->ready_since = timer_ticks();
   if (active_sched_policy == SCHED_FIFO)
     list_push_back(&fifo_ready_list, &t->elem);
-  else
+  else if (active_sched_policy == SCHED_PRIO)
+    prio_push(t);
+  else if (active_sched_policy == SCHED_FAIR)
+    fair_enqueue(t);
+  else if (active_sched_policy == SCHED_MLFQS) {
+    /* A thread that was blocked over a second has fallen behind. */
+    if (t->recent_cpu_seconds != mlfqs_seconds) {
+      mlfqs_catch_up(t);
+      t->priority = mlfqs_priority(t);
+    }
+    prio_push(t);
+  } else
     PANIC("Unimplemented scheduling policy value: %d", active_sched_policy);
 }
 
+/* Returns true if the active scheduling policy always runs the
+   ready thread with the highest priority, so that the threads
+   waiting for something should be woken in priority order too. */
+bool thread_priority_scheduling(void) {
+  return active_sched_policy == SCHED_PRIO || active_sched_policy == SCHED_MLFQS;
+}
+
+/* Yields the CPU if a ready thread has a higher priority than
+   the running thread under the active scheduling policy, right
+   away or, within an interrupt handler, as it returns.  Called
+   wherever a thread may have become ready or the running
+   thread's priority may have dropped. */
+void thread_preempt(void) {
+  enum intr_level old_level;
+  bool outranked;
+
+  if (!thread_priority_scheduling())
+    return;
+
+  old_level = intr_disable();
+  outranked = prio_highest_ready() > running_thread()->priority;
+  intr_set_level(old_level);
+
+  if (!outranked)
+    return;
+  if (intr_context())
+    intr_yield_on_return();
+  else
+    thread_yield();
+}
+
 /* Transitions a blocked thread T to the ready-to-run state.
    This is an error if T is not blocked.  (Use thread_yield() to
    make the running thread ready.)
@@ -247,16 +501,25 @@ static void thread_enqueue(struct thread* t) {
    This function does not preempt the running thread.  This can
    be important: if the caller had disabled interrupts itself,
    it may expect that it can atomically unblock a thread and
-   update other data. */
+   update other data.  Within an interrupt handler, though, it
+   does arrange to switch as the handler returns if T should run
+   before the thread interrupted, or that thread is the idle
+   thread, so that a thread woken by a device runs right away
+   rather than at the next tick. */
 void thread_unblock(struct thread* t) {
+  struct thread* cur = running_thread();
   enum intr_level old_level;
 
   ASSERT(is_thread(t));
 
   old_level = intr_disable();
   ASSERT(t->status == THREAD_BLOCKED);
+  TRACE(TRACE_UNBLOCK, t->tid, 0);
   thread_enqueue(t);
   t->status = THREAD_READY;
+  if (intr_context() &&
+      (cur == idle_thread || (thread_priority_scheduling() && t->priority > cur->priority)))
+    intr_yield_on_return();
   intr_set_level(old_level);
 }
 
@@ -283,11 +546,50 @@ struct thread* thread_current(void) {
 /* Returns the running thread's tid. */
 tid_t thread_tid(void) { return thread_current()->tid; }
 
+/* Returns the thread with TID, or a null pointer if there is
+   none or it has exited.  The thread may exit as soon as this
+   returns unless something else keeps it from doing so, so the
+   caller must see to that before using it. */
+struct thread* thread_find(tid_t tid) {
+  struct thread key;
+  struct hash_elem* e;
+
+  ASSERT(!intr_context());
+
+  key.tid = tid;
+  lock_acquire(&tid_table_lock);
+  e = hash_find(&tid_table, &key.tidelem);
+  lock_release(&tid_table_lock);
+
+  return e != NULL ? hash_entry(e, struct thread, tidelem) : NULL;
+}
+
+static unsigned tid_hash(const struct hash_elem* e, void* aux UNUSED) {
+  return hash_int(hash_entry(e, struct thread, tidelem)->tid);
+}
+
+static bool tid_less(const struct hash_elem* a, const struct hash_elem* b, void* aux UNUSED) {
+  return hash_entry(a, struct thread, tidelem)->tid < hash_entry(b, struct thread, tidelem)->tid;
+}
+
+/* Adds T to the threads by tid, if they are set up yet. */
+static void tid_table_insert(struct thread* t) {
+  if (!tid_table_ready)
+    return;
+  lock_acquire(&tid_table_lock);
+  hash_insert(&tid_table, &t->tidelem);
+  lock_release(&tid_table_lock);
+}
+
 /* Deschedules the current thread and destroys it.  Never
    returns to the caller. */
 void thread_exit(void) {
   ASSERT(!intr_context());
 
+  lock_acquire(&tid_table_lock);
+  hash_delete(&tid_table, &thread_current()->tidelem);
+  lock_release(&tid_table_lock);
+
   /* Remove thread from all threads list, set our status to dying,
      and schedule another process.  That process will destroy us
      when it calls thread_switch_tail(). */
@@ -327,32 +629,102 @@ void thread_foreach(thread_action_func* func, void* aux) {
   }
 }
 
-/* Sets the current thread's priority to NEW_PRIORITY. */
-void thread_set_priority(int new_priority) { thread_current()->priority = new_priority; }
+/* Sets the current thread's priority to NEW_PRIORITY, yielding if
+   it is no longer the highest.  A priority donated to it that is
+   higher still holds until the lock it came through is released.
+   The MLFQS sets priorities itself, so there this does nothing. */
+void thread_set_priority(int new_priority) {
+  struct thread* cur = thread_current();
+  enum intr_level old_level;
+  struct list_elem* e;
+  int priority = new_priority;
+
+  if (active_sched_policy == SCHED_MLFQS)
+    return;
+
+  old_level = intr_disable();
+  cur->base_priority = new_priority;
+  for (e = list_begin(&cur->held_locks); e != list_end(&cur->held_locks); e = list_next(e)) {
+    struct lock* lock = list_entry(e, struct lock, elem);
+    if (lock->priority > priority)
+      priority = lock->priority;
+  }
+  thread_update_priority(cur, priority);
+  intr_set_level(old_level);
+
+  thread_preempt();
+}
+
+/* Sets the priority T runs at, base or donated, to PRIORITY,
+   moving it to the queue for PRIORITY if it is ready.
+   Interrupts must be off. */
+void thread_update_priority(struct thread* t, int priority) {
+  ASSERT(intr_get_level() == INTR_OFF);
+  ASSERT(PRI_MIN <= priority && priority <= PRI_MAX);
+
+  if (t->status == THREAD_READY && thread_priority_scheduling() && t->priority != priority) {
+    prio_remove(t);
+    t->priority = priority;
+    prio_push(t);
+  } else
+    t->priority = priority;
+}
+
+/* Initializes GROUP as a fair scheduling group with no threads. */
+void thread_group_init(struct fair_group* group) {
+  group->node.pass = 0;
+  group->threads = NULL;
+  group->pass = 0;
+}
+
+/* Moves the running thread to GROUP, or back to the group of
+   kernel threads if GROUP is null, for its share of the CPU under
+   the fair scheduler.  The ticks it has run for its old group are
+   charged to that group first. */
+void thread_set_group(struct fair_group* group) {
+  enum intr_level old_level = intr_disable();
+  fair_put_back();
+  thread_current()->group = group != NULL ? group : &kernel_group;
+  intr_set_level(old_level);
+}
 
 /* Returns the current thread's priority. */
 int thread_get_priority(void) { return thread_current()->priority; }
 
-/* Sets the current thread's nice value to NICE. */
-void thread_set_nice(int nice UNUSED) { /* Not yet implemented. */
+/* Sets the current thread's nice value to NICE, yielding if its
+   priority under the MLFQS is no longer the highest. */
+void thread_set_nice(int nice) {
+  struct thread* cur = thread_current();
+  enum intr_level old_level;
+
+  ASSERT(NICE_MIN <= nice && nice <= NICE_MAX);
+
+  old_level = intr_disable();
+  cur->nice = nice;
+  if (active_sched_policy == SCHED_MLFQS)
+    thread_update_priority(cur, mlfqs_priority(cur));
+  intr_set_level(old_level);
+
+  thread_preempt();
 }
 
 /* Returns the current thread's nice value. */
-int thread_get_nice(void) {
-  /* Not yet implemented. */
-  return 0;
-}
+int thread_get_nice(void) { return thread_current()->nice; }
 
 /* Returns 100 times the system load average. */
 int thread_get_load_avg(void) {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable();
+  int load = fix_round(fix_scale(load_avg, 100));
+  intr_set_level(old_level);
+  return load;
 }
 
 /* Returns 100 times the current thread's recent_cpu value. */
 int thread_get_recent_cpu(void) {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable();
+  int recent_cpu = fix_round(fix_scale(thread_current()->recent_cpu, 100));
+  intr_set_level(old_level);
+  return recent_cpu;
 }
 
 /* Idle thread.  Executes when no other thread is ready to run.
@@ -386,6 +758,7 @@ static void idle(void* idle_started_ UNUSED) {
 
          See [IA32-v2a] "HLT", [IA32-v2b] "STI", and [IA32-v3a]
          7.11.1 "HLT Instruction". */
+    timer_idle();
     asm volatile("sti; hlt" : : : "memory");
   }
 }
@@ -427,8 +800,14 @@ static void init_thread(struct thread* t, const char* name, int priority) {
   t->status = THREAD_BLOCKED;
   strlcpy(t->name, name, sizeof t->name);
   t->stack = (uint8_t*)t + PGSIZE;
-  t->priority = priority;
+  t->priority = t->base_priority = priority;
+  t->nice = NICE_DEFAULT;
+  t->recent_cpu = fix_int(0);
+  t->recent_cpu_seconds = mlfqs_seconds;
+  t->group = &kernel_group;
+  list_init(&t->held_locks);
   t->pcb = NULL;
+  t->user = NULL;
   t->magic = THREAD_MAGIC;
 
   old_level = intr_disable();
@@ -455,21 +834,219 @@ static struct thread* thread_schedule_fifo(void) {
     return idle_thread;
 }
 
-/* Strict priority scheduler */
+/* Returns the highest priority of a ready thread under the
+   strict-priority scheduler, or -1 if none is ready.  Interrupts
+   must be off. */
+static int prio_highest_ready(void) {
+  for (int i = PRIO_MASK_WORDS - 1; i >= 0; i--)
+    if (prio_ready_mask[i] != 0)
+      return i * 32 + 31 - __builtin_clz(prio_ready_mask[i]);
+  return -1;
+}
+
+/* Adds ready thread T to the back of the queue for its priority. */
+static void prio_push(struct thread* t) {
+  list_push_back(&prio_ready_lists[t->priority], &t->elem);
+  prio_ready_mask[t->priority / 32] |= 1u << (t->priority % 32);
+  prio_ready_cnt++;
+}
+
+/* Takes ready thread T out of the queue for its priority. */
+static void prio_remove(struct thread* t) {
+  list_remove(&t->elem);
+  if (list_empty(&prio_ready_lists[t->priority]))
+    prio_ready_mask[t->priority / 32] &= ~(1u << (t->priority % 32));
+  prio_ready_cnt--;
+}
+
+/* Strict priority scheduler: the first thread of the highest
+   priority ready, so that threads of one priority take turns. */
 static struct thread* thread_schedule_prio(void) {
-  PANIC("Unimplemented scheduler policy: \"-sched=prio\"");
+  int priority = prio_highest_ready();
+  struct thread* t;
+
+  if (priority < 0)
+    return idle_thread;
+
+  t = list_entry(list_front(&prio_ready_lists[priority]), struct thread, elem);
+  prio_remove(t);
+  return t;
 }
 
-/* Fair priority scheduler */
+/* Merges the heaps A and B and returns the merged heap.  A skew
+   heap: amortized O(log n), needing no memory but the nodes and,
+   walking the right spines in a loop, no stack. */
+static struct fair_node* fair_merge(struct fair_node* a, struct fair_node* b) {
+  struct fair_node* root = NULL;
+  struct fair_node** link = &root;
+
+  while (a != NULL && b != NULL) {
+    struct fair_node* right;
+    if (b->pass < a->pass) {
+      struct fair_node* tmp = a;
+      a = b;
+      b = tmp;
+    }
+    /* A's right merges with B as its new left. */
+    *link = a;
+    right = a->right;
+    a->right = a->left;
+    link = &a->left;
+    a = right;
+  }
+  *link = a != NULL ? a : b;
+  return root;
+}
+
+static void fair_push(struct fair_node** heap, struct fair_node* node) {
+  node->left = node->right = NULL;
+  *heap = fair_merge(*heap, node);
+}
+
+static struct fair_node* fair_pop(struct fair_node** heap) {
+  struct fair_node* min = *heap;
+  *heap = fair_merge(min->left, min->right);
+  return min;
+}
+
+/* Adds ready thread T to its group's heap, and the group to the
+   heap of groups if it had no thread ready before and is not the
+   one running.  A thread or group that has waited comes back at
+   the pass of those chosen last, so that it cannot pile up credit
+   while blocked and then shut out the rest. */
+static void fair_enqueue(struct thread* t) {
+  struct fair_group* group = t->group;
+  bool was_empty = group->threads == NULL;
+
+  if (t->fair.pass < group->pass)
+    t->fair.pass = group->pass;
+  fair_push(&group->threads, &t->fair);
+
+  if (was_empty && group != fair_running) {
+    if (group->node.pass < fair_pass)
+      group->node.pass = fair_pass;
+    fair_push(&fair_groups, &group->node);
+  }
+}
+
+/* Charges the group of the running thread for the ticks run, and
+   returns it to the heap of groups if it has a thread ready. */
+static void fair_put_back(void) {
+  struct fair_group* group = fair_running;
+
+  if (group == NULL)
+    return;
+  group->node.pass += (uint64_t)fair_running_ticks * FAIR_GROUP_STRIDE;
+  if (group->threads != NULL)
+    fair_push(&fair_groups, &group->node);
+  fair_running = NULL;
+}
+
+/* Fair scheduler: stride scheduling, with a thread's tickets one
+   more than its priority, among the threads of a group, and equal
+   shares among the groups. */
 static struct thread* thread_schedule_fair(void) {
-  PANIC("Unimplemented scheduler policy: \"-sched=fair\"");
+  struct fair_group* group;
+  struct thread* t;
+
+  fair_put_back();
+  if (fair_groups == NULL)
+    return idle_thread;
+
+  group = fair_entry(fair_pop(&fair_groups), struct fair_group, node);
+  t = fair_entry(fair_pop(&group->threads), struct thread, fair);
+  fair_pass = group->node.pass;
+  group->pass = t->fair.pass;
+  fair_running = group;
+  fair_running_ticks = 0;
+  return t;
+}
+
+/* Returns T's priority under the MLFQS, from its recent_cpu and
+   nice values. */
+static int mlfqs_priority(struct thread* t) {
+  int priority = PRI_MAX - fix_trunc(fix_unscale(t->recent_cpu, 4)) - t->nice * 2;
+  if (priority < PRI_MIN)
+    return PRI_MIN;
+  if (priority > PRI_MAX)
+    return PRI_MAX;
+  return priority;
+}
+
+/* Decays T's recent_cpu for each second since it was last
+   decayed.  Interrupts must be off. */
+static void mlfqs_catch_up(struct thread* t) {
+  int64_t oldest = mlfqs_seconds > DECAY_HISTORY ? mlfqs_seconds - DECAY_HISTORY : 0;
+  fixed_point_t nice = fix_int(t->nice);
+
+  /* Before the history, stopping early on reaching a fixed point,
+     which long enough a sleep always does. */
+  while (t->recent_cpu_seconds < oldest) {
+    fixed_point_t old = t->recent_cpu;
+    t->recent_cpu = fix_add(fix_mul(decay_history[oldest % DECAY_HISTORY], old), nice);
+    t->recent_cpu_seconds = t->recent_cpu.f == old.f ? oldest : t->recent_cpu_seconds + 1;
+  }
+  for (; t->recent_cpu_seconds < mlfqs_seconds; t->recent_cpu_seconds++) {
+    fixed_point_t decay = decay_history[t->recent_cpu_seconds % DECAY_HISTORY];
+    t->recent_cpu = fix_add(fix_mul(decay, t->recent_cpu), nice);
+  }
+}
+
+/* Updates load_avg and decays recent_cpu for the running thread
+   CUR and the ready threads, placing each of the latter in the
+   queue for its new priority.  The queues are emptied into one
+   list highest priority first and refilled from it, so that the
+   order of the threads among those of a priority holds. */
+static void mlfqs_second(struct thread* cur) {
+  int ready = prio_ready_cnt + (cur != idle_thread ? 1 : 0);
+  fixed_point_t twice_load;
+  struct list threads;
+
+  load_avg = fix_add(fix_mul(fix_frac(59, 60), load_avg), fix_scale(fix_frac(1, 60), ready));
+  twice_load = fix_scale(load_avg, 2);
+  decay_history[mlfqs_seconds % DECAY_HISTORY] =
+      fix_div(twice_load, fix_add(twice_load, fix_int(1)));
+  mlfqs_seconds++;
+
+  if (cur != idle_thread) {
+    mlfqs_catch_up(cur);
+    cur->priority = mlfqs_priority(cur);
+  }
+
+  list_init(&threads);
+  for (int i = PRI_MAX; i >= PRI_MIN; i--)
+    list_splice(list_end(&threads), list_begin(&prio_ready_lists[i]),
+                list_end(&prio_ready_lists[i]));
+  memset(prio_ready_mask, 0, sizeof prio_ready_mask);
+  prio_ready_cnt = 0;
+  while (!list_empty(&threads)) {
+    struct thread* t = list_entry(list_pop_front(&threads), struct thread, elem);
+    mlfqs_catch_up(t);
+    t->priority = mlfqs_priority(t);
+    prio_push(t);
+  }
 }
 
-/* Multi-level feedback queue scheduler */
-static struct thread* thread_schedule_mlfqs(void) {
-  PANIC("Unimplemented scheduler policy: \"-sched=mlfqs\"");
+/* Charges the tick to the running thread CUR under the MLFQS.
+   Its priority is recomputed every TIME_SLICE ticks, and only its
+   own, since between seconds no other thread's recent_cpu moves.
+   The caller preempts CUR if it is outranked as a result. */
+static void mlfqs_tick(struct thread* cur) {
+  int64_t ticks = timer_ticks();
+
+  if (cur != idle_thread)
+    cur->recent_cpu = fix_add(cur->recent_cpu, fix_int(1));
+
+  if (ticks % TIMER_FREQ == 0)
+    mlfqs_second(cur);
+  else if (ticks % TIME_SLICE == 0 && cur != idle_thread)
+    cur->priority = mlfqs_priority(cur);
 }
 
+/* Multi-level feedback queue scheduler: the strict-priority
+   scheduler, over priorities the MLFQS sets. */
+static struct thread* thread_schedule_mlfqs(void) { return thread_schedule_prio(); }
+
 /* Not an actual scheduling policy — placeholder for empty
  * slots in the scheduler jump table. */
 static struct thread* thread_schedule_reserved(void) {
@@ -523,8 +1100,18 @@ void thread_switch_tail(struct thread* prev) {
      initial_thread because its memory was not obtained via
      palloc().) */
   if (prev != NULL && prev->status == THREAD_DYING && prev != initial_thread) {
+    enum intr_level old_level;
+    bool cached;
+
     ASSERT(prev != cur);
-    palloc_free_page(prev);
+    fpu_forget(prev);
+    old_level = spin_lock(&thread_page_cache_lock);
+    cached = thread_page_cache_cnt < THREAD_PAGE_CACHE_SIZE;
+    if (cached)
+      thread_page_cache[thread_page_cache_cnt++] = prev;
+    spin_unlock(&thread_page_cache_lock, old_level);
+    if (!cached)
+      palloc_free_page(prev);
   }
 }
 
@@ -544,11 +1131,63 @@ static void schedule(void) {
   ASSERT(cur->status != THREAD_RUNNING);
   ASSERT(is_thread(next));
 
-  if (cur != next)
+  /* The idle thread comes out of no queue, but when first run. */
+  if (next->status == THREAD_READY) {
+    int64_t wait = timer_ticks() - next->ready_since;
+    next->ready_ticks += wait;
+    wait_histogram[wait_bucket(wait)]++;
+  }
+
+  /* As in Unix, a switch is involuntary if the thread switched
+     from could have gone on running, whether it was preempted or
+     yielded. */
+  if (cur != next) {
+    int64_t now = timer_ns();
+    cur->run_ns += now - cur->running_since;
+    next->running_since = now;
+
+    if (cur->status == THREAD_READY) {
+      cur->involuntary_switches++;
+      involuntary_switches++;
+    } else {
+      cur->voluntary_switches++;
+      voluntary_switches++;
+    }
+    TRACE(TRACE_SCHEDULE, next->tid, cur->status);
+    fpu_switch(next);
     prev = switch_threads(cur, next);
+  }
   thread_switch_tail(prev);
 }
 
+/* Returns a page for a new thread, from those of threads that
+   have died if there are any, or a null pointer if memory is
+   exhausted. */
+static struct thread* alloc_thread_page(void) {
+  enum intr_level old_level = spin_lock(&thread_page_cache_lock);
+  void* page = thread_page_cache_cnt > 0 ? thread_page_cache[--thread_page_cache_cnt] : NULL;
+  spin_unlock(&thread_page_cache_lock, old_level);
+
+  return page != NULL ? page : palloc_get_page(0);
+}
+
+/* Gives the pages of dead threads kept for new ones back to the
+   kernel pool, up to PAGE_CNT of them. */
+static size_t drain_thread_pages(size_t page_cnt) {
+  size_t freed = 0;
+
+  while (freed < page_cnt) {
+    enum intr_level old_level = spin_lock(&thread_page_cache_lock);
+    void* page = thread_page_cache_cnt > 0 ? thread_page_cache[--thread_page_cache_cnt] : NULL;
+    spin_unlock(&thread_page_cache_lock, old_level);
+    if (page == NULL)
+      break;
+    palloc_free_page(page);
+    freed++;
+  }
+  return freed;
+}
+
 /* Returns a tid to use for a new thread. */
 static tid_t allocate_tid(void) {
   static tid_t next_tid = 1;
@@ -2,10 +2,16 @@
 #define THREADS_THREAD_H
 
 #include <debug.h>
+#include <hash.h>
 #include <list.h>
+#include <rbtree.h>
 #include <stdint.h>
+#include "threads/fpu.h"
 #include "threads/synch.h"
 #include "threads/fixed-point.h"
+#ifdef USERPROG
+#include "userprog/pagedir.h"
+#endif
 
 /* States in a thread's life cycle. */
 enum thread_status {
@@ -25,6 +31,27 @@ typedef int tid_t;
 #define PRI_DEFAULT 31 /* Default priority. */
 #define PRI_MAX 63     /* Highest priority. */
 
+/* Thread niceness, under the MLFQS. */
+#define NICE_MIN -20   /* Nicest to other threads. */
+#define NICE_DEFAULT 0 /* Default niceness. */
+#define NICE_MAX 20    /* Least nice. */
+
+/* A node of one of the fair scheduler's heaps, keyed by pass. */
+struct fair_node {
+  uint64_t pass;           /* Virtual time the node has run for. */
+  struct fair_node* left;  /* Children in the heap. */
+  struct fair_node* right;
+};
+
+/* Threads that the fair scheduler gives a share of the CPU to
+   together, which they divide among themselves by priority: the
+   threads of a user process, or the kernel's own threads. */
+struct fair_group {
+  struct fair_node node;     /* In the heap of groups. */
+  struct fair_node* threads; /* Heap of its ready threads. */
+  uint64_t pass;             /* Pass of its thread chosen last. */
+};
+
 /* A kernel thread or user process.
 
    Each thread structure is stored in its own 4 kB page.  The
@@ -76,26 +103,73 @@ typedef int tid_t;
    set to THREAD_MAGIC.  Stack overflow will normally change this
    value, triggering the assertion. */
 /* The `elem' member has a dual purpose.  It can be an element in
-   the run queue (thread.c), or it can be an element in a
-   semaphore wait list (synch.c).  It can be used these two ways
-   only because they are mutually exclusive: only a thread in the
-   ready state is on the run queue, whereas only a thread in the
-   blocked state is on a semaphore wait list. */
+   the run queue (thread.c), or it can be an element in the sleep
+   list (timer.c).  It can be used these ways only because they
+   are mutually exclusive: only a thread in the ready state is on
+   the run queue, whereas only a thread in the blocked state is on
+   the sleep list.  A blocked thread waiting on a semaphore is in
+   its waiters through `waitelem' instead (synch.c). */
 struct thread {
   /* Owned by thread.c. */
   tid_t tid;                 /* Thread identifier. */
   enum thread_status status; /* Thread state. */
   char name[16];             /* Name (for debugging purposes). */
   uint8_t* stack;            /* Saved stack pointer. */
-  int priority;              /* Priority. */
+  int priority;              /* Priority, with any donated to it. */
   struct list_elem allelem;  /* List element for all threads list. */
+  struct hash_elem tidelem;  /* Hash element for the threads by tid. */
+
+  /* Owned by thread.c, for the MLFQS. */
+  int nice;                   /* Niceness, from NICE_MIN to NICE_MAX. */
+  fixed_point_t recent_cpu;   /* Decaying average of ticks run. */
+  int64_t recent_cpu_seconds; /* Seconds of decay applied to recent_cpu. */
+
+  /* Owned by thread.c, for statistics. */
+  int64_t ready_since;           /* Tick it last became ready at. */
+  int64_t ready_ticks;           /* Ticks spent ready but not running. */
+  int64_t running_since;         /* timer_ns() when it last began to run. */
+  int64_t run_ns;                /* Nanoseconds spent running before that. */
+  unsigned voluntary_switches;   /* Switches away on blocking or exiting. */
+  unsigned involuntary_switches; /* Switches away while still ready. */
+
+  /* Owned by thread.c, for the fair scheduler. */
+  struct fair_node fair;    /* In its group's heap of threads. */
+  struct fair_group* group; /* The group it shares the CPU with. */
 
   /* Shared between thread.c and synch.c. */
+  int base_priority;          /* Priority set by the thread itself. */
+  struct list held_locks;     /* Locks held, to recompute donations. */
+  struct lock* waiting_lock;  /* Lock being waited for, or NULL. */
+  struct heap_elem waitelem;  /* In a semaphore's waiters. */
+  int wait_priority;          /* Priority it waits there with. */
+  unsigned wait_seq;          /* When it started waiting there. */
+
+  /* Shared between thread.c, synch.c and timer.c. */
   struct list_elem elem; /* List element. */
 
+  /* Owned by fpu.c. */
+  bool fpu_used;        /* Has it used the FPU yet? */
+  struct fpu_state fpu; /* Its FPU state, while the FPU holds another's. */
+
+  /* Owned by timer.c. */
+  int64_t wakeup_tick;      /* Tick to wake up at, while in timer_sleep(). */
+  struct rb_node sleepelem; /* In the sleepers, while in timer_sleep(). */
+
 #ifdef USERPROG
   /* Owned by process.c. */
-  struct process* pcb; /* Process control block if this thread is a userprog */
+  struct process* pcb;      /* Process control block if this thread is a userprog */
+  struct user_thread* user; /* Its record in the process's threads. */
+
+  /* Owned by userprog/pagedir.c. */
+  struct pagedir_cache pd_cache; /* PTEs it looked up last. */
+
+  /* Owned by userprog/syscall.c. */
+  void* user_esp; /* User stack pointer at its last system call. */
+#endif
+
+#ifdef FILESYS
+  /* Owned by filesys/journal.c. */
+  int journal_depth; /* Journal operations begun and not yet ended. */
 #endif
 
   /* Owned by thread.c. */
@@ -118,11 +192,18 @@ enum sched_policy {
  * Is equal to SCHED_FIFO by default. */
 extern enum sched_policy active_sched_policy;
 
+/* Classes of priority that may be given time slices of their
+   own: the lowest, middle and highest third of PRI_MIN...PRI_MAX. */
+#define SLICE_CLASSES 3
+
+void thread_set_time_slice(int policy, int slice_class, unsigned ticks);
+
 void thread_init(void);
 void thread_start(void);
 
 void thread_tick(void);
 void thread_print_stats(void);
+long long thread_sched_stat(int stat);
 
 typedef void thread_func(void* aux);
 tid_t thread_create(const char* name, int priority, thread_func*, void*);
@@ -132,6 +213,7 @@ void thread_unblock(struct thread*);
 
 struct thread* thread_current(void);
 tid_t thread_tid(void);
+struct thread* thread_find(tid_t);
 const char* thread_name(void);
 
 void thread_exit(void) NO_RETURN;
@@ -143,6 +225,12 @@ void thread_foreach(thread_action_func*, void*);
 
 int thread_get_priority(void);
 void thread_set_priority(int);
+bool thread_priority_scheduling(void);
+void thread_update_priority(struct thread*, int priority);
+void thread_preempt(void);
+
+void thread_group_init(struct fair_group*);
+void thread_set_group(struct fair_group*);
 
 int thread_get_nice(void);
 void thread_set_nice(int);
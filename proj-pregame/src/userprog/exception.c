@@ -1,10 +1,15 @@
 #include "userprog/exception.h"
 #include <inttypes.h>
 #include <stdio.h>
+#include "devices/trace.h"
 #include "userprog/gdt.h"
 #include "userprog/process.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
@@ -43,7 +48,6 @@ void exception_init(void) {
   intr_register_int(0, 0, INTR_ON, kill, "#DE Divide Error");
   intr_register_int(1, 0, INTR_ON, kill, "#DB Debug Exception");
   intr_register_int(6, 0, INTR_ON, kill, "#UD Invalid Opcode Exception");
-  intr_register_int(7, 0, INTR_ON, kill, "#NM Device Not Available Exception");
   intr_register_int(11, 0, INTR_ON, kill, "#NP Segment Not Present");
   intr_register_int(12, 0, INTR_ON, kill, "#SS Stack Fault Exception");
   intr_register_int(13, 0, INTR_ON, kill, "#GP General Protection Exception");
@@ -122,6 +126,7 @@ static void page_fault(struct intr_frame* f) {
      [IA32-v3a] 5.15 "Interrupt 14--Page Fault Exception
      (#PF)". */
   asm("movl %%cr2, %0" : "=r"(fault_addr));
+  TRACE(TRACE_PAGE_FAULT, fault_addr, f->error_code);
 
   /* Turn interrupts back on (they were only off so that we could
      be assured of reading CR2 before it changed). */
@@ -135,6 +140,29 @@ static void page_fault(struct intr_frame* f) {
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
+#ifdef VM
+  /* Bring in the page, if it is one of the process's.  The user
+     stack pointer is in F only if the fault came from user mode;
+     from the kernel, in a system call, it is the one saved on
+     entry. */
+  if (not_present &&
+      page_fault_in(fault_addr, user ? f->esp : thread_current()->user_esp, write))
+    return;
+
+  /* Copy a page that shares its frame on the first write to it. */
+  if (!not_present && write && page_fault_write(fault_addr))
+    return;
+#endif
+
+  /* A fault in the kernel on a user address is a system call's
+     get_user() or put_user() trying one: resume it at the address
+     it left in eax, with eax set to -1 to say the access failed. */
+  if (!user && is_user_vaddr(fault_addr)) {
+    f->eip = (void (*)(void))f->eax;
+    f->eax = 0xffffffff;
+    return;
+  }
+
   /* To implement virtual memory, delete the rest of the function
      body, and replace it with code that brings in the page to
      which fault_addr refers. */
@@ -0,0 +1,134 @@
+#include "userprog/futex.h"
+#include <debug.h>
+#include <list.h>
+#include <stdint.h>
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "userprog/process.h"
+
+/* Futexes ("fast user-space mutexes").  The locks and semaphores
+   of the user library live in user memory and are taken and given
+   back there with atomic instructions.  A thread enters the kernel
+   only to sleep until a word of its process's memory has changed,
+   with futex_wait(), or to wake threads that sleep on one, with
+   futex_wake(), so that a lock no other thread wants costs no
+   system call at all.
+
+   futex_wait() reads the word and goes to sleep under FUTEX_LOCK,
+   which futex_wake() also takes, so that a wake that follows a
+   change to the word cannot come between the two and be missed.
+
+   A wait that would leave every thread of the process asleep on a
+   futex, as a thread that acquires a lock it already holds would,
+   can never end, and fails instead.  So does a wait in a process
+   that is exiting, whose threads must all get back to the point
+   where they end. */
+
+/* A thread sleeping on a futex. */
+struct futex_waiter {
+  struct list_elem elem;  /* In a bucket. */
+  struct process* pcb;    /* Process whose memory UADDR is in. */
+  const int* uaddr;       /* Word waited on. */
+  struct semaphore woken; /* Upped by futex_wake(). */
+};
+
+/* Sleeping threads, hashed by process and address into buckets,
+   guarded by FUTEX_LOCK. */
+#define FUTEX_BUCKETS 64
+static struct list buckets[FUTEX_BUCKETS];
+static struct lock futex_lock;
+
+/* Initializes the futex module. */
+void futex_init(void) {
+  size_t i;
+
+  lock_init(&futex_lock);
+  for (i = 0; i < FUTEX_BUCKETS; i++)
+    list_init(&buckets[i]);
+}
+
+/* Returns the bucket for UADDR in the memory of PCB. */
+static struct list* bucket(struct process* pcb, const int* uaddr) {
+  uintptr_t key = (uintptr_t)uaddr ^ (uintptr_t)pcb;
+  return &buckets[(key >> 2) * 2654435761u % FUTEX_BUCKETS];
+}
+
+/* If the word at user address UADDR, which the caller has checked,
+   holds VAL, sleeps until futex_wake() is called on it.  Returns 0
+   once woken or at once if the word holds something else, which
+   the caller should then look at again, or -1 if every other
+   thread of the process already sleeps on a futex, which would
+   leave none to wake this one. */
+int futex_wait(const int* uaddr, int val) {
+  struct process* pcb = thread_current()->pcb;
+  struct futex_waiter w;
+
+  lock_acquire(&futex_lock);
+  if (*uaddr != val || pcb->exiting) {
+    lock_release(&futex_lock);
+    return 0;
+  }
+  if (pcb->futex_waiters + 1 >= pcb->thread_cnt) {
+    lock_release(&futex_lock);
+    return -1;
+  }
+  w.pcb = pcb;
+  w.uaddr = uaddr;
+  sema_init(&w.woken, 0);
+  list_push_back(bucket(pcb, uaddr), &w.elem);
+  pcb->futex_waiters++;
+  lock_release(&futex_lock);
+
+  sema_down(&w.woken);
+  return 0;
+}
+
+/* Wakes up to CNT threads of the current process that sleep on
+   the word at user address UADDR, the longest sleeping first.
+   Returns the number woken. */
+int futex_wake(const int* uaddr, int cnt) {
+  struct process* pcb = thread_current()->pcb;
+  struct list* b = bucket(pcb, uaddr);
+  struct list_elem* e;
+  int woken = 0;
+
+  lock_acquire(&futex_lock);
+  for (e = list_begin(b); e != list_end(b) && woken < cnt;) {
+    struct futex_waiter* w = list_entry(e, struct futex_waiter, elem);
+
+    e = list_next(e);
+    if (w->pcb == pcb && w->uaddr == uaddr) {
+      list_remove(&w->elem);
+      pcb->futex_waiters--;
+      sema_up(&w->woken);
+      woken++;
+    }
+  }
+  lock_release(&futex_lock);
+  return woken;
+}
+
+/* Wakes every thread of PCB that sleeps on a futex, once
+   PCB->exiting has been set, after which none goes to sleep. */
+void futex_wake_all(struct process* pcb) {
+  size_t i;
+
+  ASSERT(pcb->exiting);
+
+  lock_acquire(&futex_lock);
+  for (i = 0; i < FUTEX_BUCKETS; i++) {
+    struct list_elem* e;
+
+    for (e = list_begin(&buckets[i]); e != list_end(&buckets[i]);) {
+      struct futex_waiter* w = list_entry(e, struct futex_waiter, elem);
+
+      e = list_next(e);
+      if (w->pcb == pcb) {
+        list_remove(&w->elem);
+        pcb->futex_waiters--;
+        sema_up(&w->woken);
+      }
+    }
+  }
+  lock_release(&futex_lock);
+}
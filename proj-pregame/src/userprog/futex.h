@@ -0,0 +1,11 @@
+#ifndef USERPROG_FUTEX_H
+#define USERPROG_FUTEX_H
+
+struct process;
+
+void futex_init(void);
+int futex_wait(const int* uaddr, int val);
+int futex_wake(const int* uaddr, int cnt);
+void futex_wake_all(struct process*);
+
+#endif /* userprog/futex.h */
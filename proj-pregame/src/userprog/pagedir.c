@@ -3,10 +3,26 @@
 #include <stddef.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
+#include "threads/thread.h"
 
-static void invalidate_pagedir(uint32_t*);
+/* Finding a page's PTE walks the page directory, and the
+   allocator, the system calls and eviction look the same few
+   pages up over and over.  So each thread keeps the PTEs it
+   found last in its pd_cache, a direct-mapped software TLB.
+   Unlike the hardware's, it holds addresses of PTEs rather than
+   translations, which stay put while the page directory does:
+   a page table, once created, is freed only with its page
+   directory.  Mapping, unmapping or changing a page therefore
+   leaves the caches correct; only pagedir_destroy() empties
+   them, by bumping PAGEDIR_EPOCH, since a new page directory
+   may be given the page the destroyed one was in.  Each cache
+   is touched only by its own thread, so none needs a lock. */
+static unsigned pagedir_epoch;
+
+static void invalidate_page(uint32_t*, const void*);
 
 /* Creates a new page directory that has mappings for kernel
    virtual addresses, but none for user virtual addresses.
@@ -39,6 +55,26 @@ void pagedir_destroy(uint32_t* pd) {
       palloc_free_page(pt);
     }
   palloc_free_page(pd);
+  pagedir_epoch++;
+}
+
+/* Returns the current thread's slot in its cache of PTEs for
+   VADDR in PD, emptying the cache first if a page directory has
+   been destroyed since it was filled, or a null pointer in an
+   interrupt handler, which must not disturb the cache of the
+   thread it interrupted. */
+static struct pagedir_cache* cache_slot(uint32_t* pd, const void* vaddr, size_t* slot) {
+  struct pagedir_cache* cache;
+
+  if (intr_context())
+    return NULL;
+  cache = &thread_current()->pd_cache;
+  if (cache->epoch != pagedir_epoch) {
+    memset(cache->slots, 0, sizeof cache->slots);
+    cache->epoch = pagedir_epoch;
+  }
+  *slot = (pg_no(vaddr) ^ vtop(pd) >> PGBITS) % PAGEDIR_CACHE_SIZE;
+  return cache;
 }
 
 /* Returns the address of the page table entry for virtual
@@ -49,12 +85,20 @@ void pagedir_destroy(uint32_t* pd) {
    pointer is returned. */
 static uint32_t* lookup_page(uint32_t* pd, const void* vaddr, bool create) {
   uint32_t *pt, *pde;
+  const void* upage = pg_round_down(vaddr);
+  struct pagedir_cache* cache;
+  size_t slot;
 
   ASSERT(pd != NULL);
 
   /* Shouldn't create new kernel virtual mappings. */
   ASSERT(!create || is_user_vaddr(vaddr));
 
+  /* Look in the cache first. */
+  cache = cache_slot(pd, vaddr, &slot);
+  if (cache != NULL && cache->slots[slot].pd == pd && cache->slots[slot].upage == upage)
+    return cache->slots[slot].pte;
+
   /* Check for a page table for VADDR.
      If one is missing, create one if requested. */
   pde = pd + pd_no(vaddr);
@@ -69,8 +113,13 @@ static uint32_t* lookup_page(uint32_t* pd, const void* vaddr, bool create) {
       return NULL;
   }
 
-  /* Return the page table entry. */
+  /* Return the page table entry, remembering it. */
   pt = pde_get_pt(*pde);
+  if (cache != NULL) {
+    cache->slots[slot].pd = pd;
+    cache->slots[slot].upage = upage;
+    cache->slots[slot].pte = &pt[pt_no(vaddr)];
+  }
   return &pt[pt_no(vaddr)];
 }
 
@@ -132,7 +181,7 @@ void pagedir_clear_page(uint32_t* pd, void* upage) {
   pte = lookup_page(pd, upage, false);
   if (pte != NULL && (*pte & PTE_P) != 0) {
     *pte &= ~PTE_P;
-    invalidate_pagedir(pd);
+    invalidate_page(pd, upage);
   }
 }
 
@@ -154,7 +203,7 @@ void pagedir_set_dirty(uint32_t* pd, const void* vpage, bool dirty) {
       *pte |= PTE_D;
     else {
       *pte &= ~(uint32_t)PTE_D;
-      invalidate_pagedir(pd);
+      invalidate_page(pd, vpage);
     }
   }
 }
@@ -177,11 +226,25 @@ void pagedir_set_accessed(uint32_t* pd, const void* vpage, bool accessed) {
       *pte |= PTE_A;
     else {
       *pte &= ~(uint32_t)PTE_A;
-      invalidate_pagedir(pd);
+      invalidate_page(pd, vpage);
     }
   }
 }
 
+/* Makes the PTE for virtual page VPAGE in PD writable if
+   WRITABLE is true and read-only otherwise.  Does nothing if
+   VPAGE is not mapped. */
+void pagedir_set_writable(uint32_t* pd, const void* vpage, bool writable) {
+  uint32_t* pte = lookup_page(pd, vpage, false);
+  if (pte != NULL && (*pte & PTE_P) != 0) {
+    if (writable)
+      *pte |= PTE_W;
+    else
+      *pte &= ~(uint32_t)PTE_W;
+    invalidate_page(pd, vpage);
+  }
+}
+
 /* Loads page directory PD into the CPU's page directory base
    register. */
 void pagedir_activate(uint32_t* pd) {
@@ -209,16 +272,20 @@ uint32_t* active_pd(void) {
 
 /* Seom page table changes can cause the CPU's translation
    lookaside buffer (TLB) to become out-of-sync with the page
-   table.  When this happens, we have to "invalidate" the TLB by
-   re-activating it.
+   table.  When this happens, we have to "invalidate" the stale
+   entry.
 
-   This function invalidates the TLB if PD is the active page
-   directory.  (If PD is not active then its entries are not in
-   the TLB, so there is no need to invalidate anything.) */
-static void invalidate_pagedir(uint32_t* pd) {
+   This function invalidates the TLB entry for VPAGE if PD is the
+   active page directory.  (If PD is not active then its entries
+   are not in the TLB, so there is no need to invalidate
+   anything.)  Changing one PTE never needs more than that, so
+   the rest of the TLB, and the kernel's mappings in particular,
+   survive. */
+static void invalidate_page(uint32_t* pd, const void* vpage) {
   if (active_pd() == pd) {
-    /* Re-activating PD clears the TLB.  See [IA32-v3a] 3.12
-         "Translation Lookaside Buffers (TLBs)". */
-    pagedir_activate(pd);
+    /* INVLPG drops just the entry for VPAGE.  See [IA32-v2a]
+       "INVLPG--Invalidate TLB Entry" and [IA32-v3a] 3.12
+       "Translation Lookaside Buffers (TLBs)". */
+    asm volatile("invlpg (%0)" : : "r"(vpage) : "memory");
   }
 }
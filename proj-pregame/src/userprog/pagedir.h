@@ -4,6 +4,23 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+/* Number of page table entries each thread keeps the addresses
+   of, to look them up again without walking the page directory. */
+#define PAGEDIR_CACHE_SIZE 16
+
+/* A thread's cache of page table entries: the PTE for user
+   virtual page UPAGE in page directory PD, in the slot the pair
+   hashes to, for the last lookups of PAGEDIR_CACHE_SIZE pairs
+   or so.  Owned by userprog/pagedir.c. */
+struct pagedir_cache {
+  unsigned epoch; /* Page directories destroyed when it was filled. */
+  struct {
+    uint32_t* pd;      /* Page directory, or a null pointer if empty. */
+    const void* upage; /* Page looked up. */
+    uint32_t* pte;     /* Its page table entry. */
+  } slots[PAGEDIR_CACHE_SIZE];
+};
+
 uint32_t* pagedir_create(void);
 void pagedir_destroy(uint32_t* pd);
 bool pagedir_set_page(uint32_t* pd, void* upage, void* kpage, bool rw);
@@ -13,6 +30,7 @@ bool pagedir_is_dirty(uint32_t* pd, const void* upage);
 void pagedir_set_dirty(uint32_t* pd, const void* upage, bool dirty);
 bool pagedir_is_accessed(uint32_t* pd, const void* upage);
 void pagedir_set_accessed(uint32_t* pd, const void* upage, bool accessed);
+void pagedir_set_writable(uint32_t* pd, const void* upage, bool writable);
 void pagedir_activate(uint32_t* pd);
 uint32_t* active_pd(void);
 
@@ -0,0 +1,173 @@
+#include "userprog/pipe.h"
+#include <debug.h>
+#include <list.h>
+#include <stdint.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/process.h"
+
+/* Pipes.  A pipe is a ring buffer in the kernel with a read end
+   and a write end, each held by a file descriptor, so that one
+   thread can stream bytes to another through memory.
+
+   A read waits until there are bytes to read and returns what
+   there is, up to the size asked for, or 0 once the write end is
+   closed and the buffer is empty.  A write waits for room until
+   it has written all of its bytes, and stops short once the read
+   end is closed.  Neither waits in a process that is exiting,
+   whose threads must all get back to the point where they end:
+   pipe_wake_all() wakes those already waiting, and the check
+   under PIPE_LOCK keeps the rest from starting. */
+
+#define PIPE_SIZE PGSIZE
+
+/* A pipe, guarded by PIPE_LOCK. */
+struct pipe {
+  struct list_elem elem;     /* In PIPES. */
+  uint8_t* buffer;           /* PIPE_SIZE bytes. */
+  size_t head;               /* Bytes ever read. */
+  size_t tail;               /* Bytes ever written. */
+  bool reader_open;          /* Is the read end open? */
+  bool writer_open;          /* Is the write end open? */
+  struct condition readable; /* Signaled on a write or on closing the write end. */
+  struct condition writable; /* Signaled on a read or on closing the read end. */
+};
+
+/* Every pipe, guarded by PIPE_LOCK. */
+static struct list pipes;
+static struct lock pipe_lock;
+
+/* Initializes the pipe module. */
+void pipe_init(void) {
+  lock_init(&pipe_lock);
+  list_init(&pipes);
+}
+
+/* Returns a new pipe with both ends open, or a null pointer if
+   memory runs out. */
+struct pipe* pipe_create(void) {
+  struct pipe* p = malloc(sizeof *p);
+
+  if (p == NULL)
+    return NULL;
+  p->buffer = palloc_get_page(0);
+  if (p->buffer == NULL) {
+    free(p);
+    return NULL;
+  }
+  p->head = p->tail = 0;
+  p->reader_open = p->writer_open = true;
+  cond_init(&p->readable);
+  cond_init(&p->writable);
+
+  lock_acquire(&pipe_lock);
+  list_push_back(&pipes, &p->elem);
+  lock_release(&pipe_lock);
+  return p;
+}
+
+/* Returns true if the current thread's process is exiting. */
+static bool exiting(void) {
+  struct process* pcb = thread_current()->pcb;
+  return pcb != NULL && pcb->exiting;
+}
+
+/* Reads up to SIZE bytes from P into BUFFER, which the caller has
+   checked, waiting for at least one unless SIZE is 0.  Returns
+   the number read, 0 at the end of the pipe. */
+int pipe_read(struct pipe* p, void* buffer_, size_t size) {
+  uint8_t* buffer = buffer_;
+  size_t n, i;
+
+  lock_acquire(&pipe_lock);
+  while (p->head == p->tail && p->writer_open && !exiting())
+    cond_wait(&p->readable, &pipe_lock);
+
+  n = p->tail - p->head < size ? p->tail - p->head : size;
+  for (i = 0; i < n;) {
+    size_t ofs = (p->head + i) % PIPE_SIZE;
+    size_t chunk = n - i < PIPE_SIZE - ofs ? n - i : PIPE_SIZE - ofs;
+    memcpy(buffer + i, p->buffer + ofs, chunk);
+    i += chunk;
+  }
+  p->head += n;
+  if (n > 0)
+    cond_broadcast(&p->writable, &pipe_lock);
+  lock_release(&pipe_lock);
+  return n;
+}
+
+/* Writes SIZE bytes from BUFFER, which the caller has checked, to
+   P, waiting for room as needed.  Returns the number written,
+   short if the read end is closed meanwhile, or -1 if it was
+   closed already. */
+int pipe_write(struct pipe* p, const void* buffer_, size_t size) {
+  const uint8_t* buffer = buffer_;
+  size_t written = 0;
+
+  lock_acquire(&pipe_lock);
+  while (written < size && p->reader_open && !exiting()) {
+    size_t ofs = p->tail % PIPE_SIZE;
+    size_t room = PIPE_SIZE - (p->tail - p->head);
+    size_t chunk;
+
+    if (room == 0) {
+      cond_wait(&p->writable, &pipe_lock);
+      continue;
+    }
+    chunk = size - written < room ? size - written : room;
+    if (chunk > PIPE_SIZE - ofs)
+      chunk = PIPE_SIZE - ofs;
+    memcpy(p->buffer + ofs, buffer + written, chunk);
+    p->tail += chunk;
+    written += chunk;
+    cond_broadcast(&p->readable, &pipe_lock);
+  }
+  lock_release(&pipe_lock);
+  return written > 0 || size == 0 || p->reader_open ? (int)written : -1;
+}
+
+/* Closes P's write end if WRITER is true, and its read end
+   otherwise, freeing P once both are closed. */
+void pipe_close(struct pipe* p, bool writer) {
+  bool done;
+
+  lock_acquire(&pipe_lock);
+  if (writer) {
+    ASSERT(p->writer_open);
+    p->writer_open = false;
+    cond_broadcast(&p->readable, &pipe_lock);
+  } else {
+    ASSERT(p->reader_open);
+    p->reader_open = false;
+    cond_broadcast(&p->writable, &pipe_lock);
+  }
+  done = !p->reader_open && !p->writer_open;
+  if (done)
+    list_remove(&p->elem);
+  lock_release(&pipe_lock);
+
+  if (done) {
+    palloc_free_page(p->buffer);
+    free(p);
+  }
+}
+
+/* Wakes every thread waiting on a pipe, so that those of a
+   process that is exiting see that it is.  The others go back to
+   waiting. */
+void pipe_wake_all(void) {
+  struct list_elem* e;
+
+  lock_acquire(&pipe_lock);
+  for (e = list_begin(&pipes); e != list_end(&pipes); e = list_next(e)) {
+    struct pipe* p = list_entry(e, struct pipe, elem);
+    cond_broadcast(&p->readable, &pipe_lock);
+    cond_broadcast(&p->writable, &pipe_lock);
+  }
+  lock_release(&pipe_lock);
+}
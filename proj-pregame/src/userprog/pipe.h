@@ -0,0 +1,16 @@
+#ifndef USERPROG_PIPE_H
+#define USERPROG_PIPE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct pipe;
+
+void pipe_init(void);
+struct pipe* pipe_create(void);
+int pipe_read(struct pipe*, void* buffer, size_t size);
+int pipe_write(struct pipe*, const void* buffer, size_t size);
+void pipe_close(struct pipe*, bool writer);
+void pipe_wake_all(void);
+
+#endif /* userprog/pipe.h */
@@ -1,12 +1,15 @@
 #include "userprog/process.h"
 
 #include <debug.h>
+#include <bitmap.h>
 #include <inttypes.h>
 #include <round.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <syscall-types.h>
 
+#include "devices/timer.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
@@ -18,15 +21,67 @@
 #include "threads/synch.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#include "userprog/futex.h"
 #include "userprog/gdt.h"
 #include "userprog/pagedir.h"
+#include "userprog/pipe.h"
 #include "userprog/tss.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
+
+/* The stacks of threads but the main one are in slots of
+   THREAD_STACK_PAGES pages, one for each of up to MAX_THREADS
+   threads, below the most the main thread's stack may take.  The
+   lowest page of each slot, and the page above the first, are
+   never mapped, so that a stack that overflows faults.
+
+   A slot's pages are mapped for the first thread to use it and
+   stay mapped when it exits, for the next thread created, so
+   that creating a thread takes no page allocation, mapping or
+   zeroing once as many have run at once before.  The free slot
+   nearest PHYS_BASE is used first.  With VM, a slot's pages are
+   added as zero pages, and only those touched take a frame. */
+#ifdef VM
+#define THREAD_STACK_PAGES 8
+#else
+#define THREAD_STACK_PAGES 1
+#endif
+#define SLOT_PAGES (THREAD_STACK_PAGES + 1)
+
+/* What start_pthread() needs, from pthread_execute(). */
+struct pthread_start {
+  struct process* pcb;      /* Process to run in. */
+  stub_fun sf;              /* Function to start at. */
+  pthread_fun tf;           /* First argument to SF. */
+  void* arg;                /* Second argument to SF. */
+  struct semaphore started; /* Upped once started, or not. */
+  bool success;             /* Did it start? */
+};
+
+/* What start_process() needs, from process_execute(), which
+   waits for the load to finish. */
+struct process_start {
+  uint8_t* page;       /* Command line, as build_args() wants it. */
+  struct child* child; /* Shared with the parent. */
+};
 
-static struct semaphore temporary;
 static thread_func start_process NO_RETURN;
 static thread_func start_pthread NO_RETURN;
-static bool load(const char* file_name, void (**eip)(void), void** esp);
-bool setup_thread(void (**eip)(void), void** esp);
+static size_t build_args(uint8_t* page, char** name);
+static bool load(const char* file_name, uint8_t* stack_page, size_t stack_size,
+                 void (**eip)(void), void** esp);
+static bool fd_is_free(const struct fd_entry*);
+static void close_fds(struct process*);
+static bool add_user_thread(struct thread*, size_t slot);
+static bool end_threads(void);
+static void free_threads(struct process*);
+static void release_child(struct child*);
+static void free_children(struct process*);
+static hash_hash_func child_hash;
+static hash_less_func child_less;
+static void leave(void) NO_RETURN;
+bool setup_thread(void (**eip)(void), void** esp, struct pthread_start*);
 
 /* Initializes user programs in the system by ensuring the main
    thread has a minimal PCB so that it can execute and wait for
@@ -46,39 +101,93 @@ void userprog_init(void) {
 
   /* Kill the kernel if we did not succeed */
   ASSERT(success);
+  lock_init(&t->pcb->fd_lock);
+  t->pcb->fd_free = FD_FIRST;
+  lock_init(&t->pcb->child_lock);
+  if (!hash_init(&t->pcb->children, child_hash, child_less, NULL))
+    PANIC("no memory for the children of the main thread");
 }
 
 /* Starts a new thread running a user program loaded from
-   FILENAME.  The new thread may be scheduled (and may even exit)
-   before process_execute() returns.  Returns the new process's
-   process id, or TID_ERROR if the thread cannot be created. */
+   FILENAME, as a child of the current process, and waits for it
+   to load.  The new process may even exit before
+   process_execute() returns.  Returns the new process's process
+   id, or TID_ERROR if it cannot be created or loaded. */
 pid_t process_execute(const char* file_name) {
-  char* fn_copy;
+  struct process* pcb = thread_current()->pcb;
+  struct process_start start;
+  uint8_t* page;
+  struct child* c;
+  char name[sizeof thread_current()->name];
+  size_t len;
   tid_t tid;
 
-  sema_init(&temporary, 0);
-  /* Make a copy of FILE_NAME.
+  /* Make a copy of FILE_NAME, a command line, at the end of a
+     page, its length in the first word, for build_args().
      Otherwise there's a race between the caller and load(). */
-  fn_copy = palloc_get_page(0);
-  if (fn_copy == NULL) return TID_ERROR;
-  strlcpy(fn_copy, file_name, PGSIZE);
+  len = strnlen(file_name, PGSIZE) + 1;
+  if (len > PGSIZE - sizeof len) return TID_ERROR;
+  page = palloc_get_page(PAL_USER);
+  if (page == NULL) return TID_ERROR;
+  memcpy(page + PGSIZE - len, file_name, len);
+  memcpy(page, &len, sizeof len);
+
+  c = malloc(sizeof *c);
+  if (c == NULL) {
+    palloc_free_page(page);
+    return TID_ERROR;
+  }
+  c->loaded = false;
+  c->exit_code = -1;
+  sema_init(&c->load_done, 0);
+  sema_init(&c->exited, 0);
+  c->ref_cnt = 2;
+
+  /* Create a new thread to execute FILE_NAME, named for the
+     program alone. */
+  file_name += strspn(file_name, " ");
+  strlcpy(name, file_name, sizeof name);
+  name[strcspn(name, " ")] = '\0';
+  start.page = page;
+  start.child = c;
+  tid = thread_create(name, PRI_DEFAULT, start_process, &start);
+  if (tid == TID_ERROR) {
+    palloc_free_page(page);
+    free(c);
+    return TID_ERROR;
+  }
 
-  /* Create a new thread to execute FILE_NAME. */
-  tid = thread_create(file_name, PRI_DEFAULT, start_process, fn_copy);
-  if (tid == TID_ERROR) palloc_free_page(fn_copy);
+  /* The child now owns PAGE, and lets go of C if it fails. */
+  sema_down(&c->load_done);
+  if (!c->loaded) {
+    release_child(c);
+    return TID_ERROR;
+  }
+  c->pid = tid;
+  lock_acquire(&pcb->child_lock);
+  hash_insert(&pcb->children, &c->elem);
+  lock_release(&pcb->child_lock);
   return tid;
 }
 
 /* A thread function that loads a user process and starts it
    running. */
-static void start_process(void* file_name_) {
-  char* file_name = (char*)file_name_;
+static void start_process(void* start_) {
+  struct process_start* start = start_;
+  uint8_t* page = start->page;
+  struct child* c = start->child;
   struct thread* t = thread_current();
   struct intr_frame if_;
+  size_t stack_size;
+  char* file_name;
   bool success, pcb_success;
 
   /* Allocate process control block */
   struct process* new_pcb = malloc(sizeof(struct process));
+  if (new_pcb != NULL && !hash_init(&new_pcb->children, child_hash, child_less, NULL)) {
+    free(new_pcb);
+    new_pcb = NULL;
+  }
   success = pcb_success = new_pcb != NULL;
 
   /* Initialize process control block */
@@ -86,11 +195,30 @@ static void start_process(void* file_name_) {
     // Ensure that timer_interrupt() -> schedule() -> process_activate()
     // does not try to activate our uninitialized pagedir
     new_pcb->pagedir = NULL;
+    new_pcb->vdso = NULL;
     t->pcb = new_pcb;
 
     // Continue initializing the PCB as normal
     t->pcb->main_thread = t;
     strlcpy(t->pcb->process_name, t->name, sizeof t->name);
+    t->pcb->child = c;
+    t->pcb->exit_code = -1;
+    lock_init(&t->pcb->child_lock);
+    lock_init(&t->pcb->fd_lock);
+    t->pcb->fds = NULL;
+    t->pcb->fd_cnt = 0;
+    t->pcb->fd_free = FD_FIRST;
+    lock_init(&t->pcb->thread_lock);
+    cond_init(&t->pcb->thread_exited);
+    list_init(&t->pcb->threads);
+    t->pcb->thread_cnt = 1;
+    t->pcb->stacks = bitmap_create(MAX_THREADS);
+    t->pcb->stacks_mapped = 0;
+    t->pcb->exiting = false;
+    t->pcb->futex_waiters = 0;
+    thread_group_init(&t->pcb->group);
+    thread_set_group(&t->pcb->group);
+    success = t->pcb->stacks != NULL && add_user_thread(t, SIZE_MAX);
   }
 
   /* Initialize interrupt frame and load executable. */
@@ -99,7 +227,8 @@ static void start_process(void* file_name_) {
     if_.gs = if_.fs = if_.es = if_.ds = if_.ss = SEL_UDSEG;
     if_.cs = SEL_UCSEG;
     if_.eflags = FLAG_IF | FLAG_MBS;
-    success = load(file_name, &if_.eip, &if_.esp);
+    stack_size = build_args(page, &file_name);
+    success = stack_size > 0 && load(file_name, page, stack_size, &if_.eip, &if_.esp);
   }
 
   /* Handle failure with succesful PCB malloc. Must free the PCB */
@@ -108,14 +237,30 @@ static void start_process(void* file_name_) {
     // If this happens, then an unfortuantely timed timer interrupt
     // can try to activate the pagedir, but it is now freed memory
     struct process* pcb_to_free = t->pcb;
+#ifdef VM
+    page_table_destroy();
+    file_close(pcb_to_free->executable);
+#endif
+    thread_set_group(NULL);
     t->pcb = NULL;
+    t->user = NULL;
+    free_threads(pcb_to_free);
+    free_children(pcb_to_free);
     free(pcb_to_free);
   }
 
-  /* Clean up. Exit on failure or jump to userspace */
-  palloc_free_page(file_name);
+  /* Clean up. Exit on failure or jump to userspace.  Without VM,
+     PAGE is the stack once the load has succeeded. */
+#ifndef VM
+  if (!success)
+#endif
+    palloc_free_page(page);
+
+  /* Tell the parent how the load went. */
+  c->loaded = success;
+  sema_up(&c->load_done);
   if (!success) {
-    sema_up(&temporary);
+    release_child(c);
     thread_exit();
   }
 
@@ -134,13 +279,26 @@ static void start_process(void* file_name_) {
    exception), returns -1.  If child_pid is invalid or if it was not a
    child of the calling process, or if process_wait() has already
    been successfully called for the given PID, returns -1
-   immediately, without waiting.
-
-   This function will be implemented in problem 2-2.  For now, it
-   does nothing. */
-int process_wait(pid_t child_pid UNUSED) {
-  sema_down(&temporary);
-  return 0;
+   immediately, without waiting. */
+int process_wait(pid_t child_pid) {
+  struct process* pcb = thread_current()->pcb;
+  struct child key;
+  struct hash_elem* e;
+  struct child* c;
+  int exit_code;
+
+  key.pid = child_pid;
+  lock_acquire(&pcb->child_lock);
+  e = hash_delete(&pcb->children, &key.elem);
+  lock_release(&pcb->child_lock);
+  if (e == NULL)
+    return -1;
+
+  c = hash_entry(e, struct child, elem);
+  sema_down(&c->exited);
+  exit_code = c->exit_code;
+  release_child(c);
+  return exit_code;
 }
 
 /* Free the current process's resources. */
@@ -154,6 +312,21 @@ void process_exit(void) {
     NOT_REACHED();
   }
 
+  /* Bring down the other threads first, unless one of them is
+     already ending the process, in which case this one just
+     ends. */
+  if (!end_threads())
+    leave();
+
+#ifdef VM
+  /* Free the pages of the process before the page directory that
+     maps them. */
+  page_table_destroy();
+  file_close(cur->pcb->executable);
+#endif
+
+  close_fds(cur->pcb);
+
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
   pd = cur->pcb->pagedir;
@@ -166,6 +339,7 @@ void process_exit(void) {
          directory, or our active page directory will be one
          that's been freed (and cleared). */
     cur->pcb->pagedir = NULL;
+    cur->pcb->vdso = NULL;
     pagedir_activate(NULL);
     pagedir_destroy(pd);
   }
@@ -175,13 +349,136 @@ void process_exit(void) {
      If this happens, then an unfortuantely timed timer interrupt
      can try to activate the pagedir, but it is now freed memory */
   struct process* pcb_to_free = cur->pcb;
+  struct child* c = pcb_to_free->child;
+  thread_set_group(NULL);
   cur->pcb = NULL;
+  cur->user = NULL;
+  c->exit_code = pcb_to_free->exit_code;
+  free_threads(pcb_to_free);
+  free_children(pcb_to_free);
   free(pcb_to_free);
 
-  sema_up(&temporary);
+  sema_up(&c->exited);
+  release_child(c);
   thread_exit();
 }
 
+/* Gives ENTRY the lowest free file descriptor of the current
+   process and returns it, or -1 if memory runs out.  The table
+   of descriptors doubles in size when it is full, so that a
+   descriptor is always an index into it. */
+static int fd_open(struct fd_entry entry) {
+  struct process* pcb = thread_current()->pcb;
+  int fd;
+
+  lock_acquire(&pcb->fd_lock);
+  for (fd = pcb->fd_free; fd < pcb->fd_cnt && !fd_is_free(&pcb->fds[fd]); fd++)
+    continue;
+  if (fd >= pcb->fd_cnt) {
+    int cnt = pcb->fd_cnt > 0 ? pcb->fd_cnt * 2 : 16;
+    struct fd_entry* fds = realloc(pcb->fds, cnt * sizeof *fds);
+    if (fds == NULL) {
+      lock_release(&pcb->fd_lock);
+      return -1;
+    }
+    memset(fds + pcb->fd_cnt, 0, (cnt - pcb->fd_cnt) * sizeof *fds);
+    pcb->fds = fds;
+    pcb->fd_cnt = cnt;
+  }
+  pcb->fds[fd] = entry;
+  pcb->fd_free = fd + 1;
+  lock_release(&pcb->fd_lock);
+  return fd;
+}
+
+/* Returns true if ENTRY is open as neither a file nor a pipe. */
+static bool fd_is_free(const struct fd_entry* entry) {
+  return entry->file == NULL && entry->pipe == NULL;
+}
+
+/* Gives FILE the lowest free file descriptor of the current
+   process and returns it, or -1 if memory runs out. */
+int process_fd_open(struct file* file) {
+  struct fd_entry entry = {file, NULL, false};
+
+  ASSERT(file != NULL);
+  return fd_open(entry);
+}
+
+/* Gives the write end of PIPE if WRITER is true, or else its read
+   end, the lowest free file descriptor of the current process and
+   returns it, or -1 if memory runs out. */
+int process_fd_open_pipe(struct pipe* pipe, bool writer) {
+  struct fd_entry entry = {NULL, pipe, writer};
+
+  ASSERT(pipe != NULL);
+  return fd_open(entry);
+}
+
+/* Returns what descriptor FD of the current process is open as,
+   all null if it is not open. */
+static struct fd_entry fd_get(int fd) {
+  struct process* pcb = thread_current()->pcb;
+  struct fd_entry entry = {NULL, NULL, false};
+
+  lock_acquire(&pcb->fd_lock);
+  if (fd >= FD_FIRST && fd < pcb->fd_cnt)
+    entry = pcb->fds[fd];
+  lock_release(&pcb->fd_lock);
+  return entry;
+}
+
+/* Returns the file open as descriptor FD in the current process,
+   or a null pointer if there is none. */
+struct file* process_fd_get(int fd) { return fd_get(fd).file; }
+
+/* Returns the pipe whose write end, if WRITER is true, or else
+   whose read end is open as descriptor FD in the current process,
+   or a null pointer if there is none. */
+struct pipe* process_fd_get_pipe(int fd, bool writer) {
+  struct fd_entry entry = fd_get(fd);
+  return entry.writer == writer ? entry.pipe : NULL;
+}
+
+/* Closes ENTRY's file or its end of a pipe. */
+static void fd_close(struct fd_entry* entry) {
+  if (entry->file != NULL)
+    file_close(entry->file);
+  else if (entry->pipe != NULL)
+    pipe_close(entry->pipe, entry->writer);
+}
+
+/* Closes descriptor FD of the current process and frees it.
+   Returns false if it was not open. */
+bool process_fd_close(int fd) {
+  struct process* pcb = thread_current()->pcb;
+  struct fd_entry entry = {NULL, NULL, false};
+
+  lock_acquire(&pcb->fd_lock);
+  if (fd >= FD_FIRST && fd < pcb->fd_cnt) {
+    entry = pcb->fds[fd];
+    memset(&pcb->fds[fd], 0, sizeof pcb->fds[fd]);
+    if (!fd_is_free(&entry) && fd < pcb->fd_free)
+      pcb->fd_free = fd;
+  }
+  lock_release(&pcb->fd_lock);
+
+  fd_close(&entry);
+  return !fd_is_free(&entry);
+}
+
+/* Closes every file and pipe end PCB has open and frees its table
+   of descriptors. */
+static void close_fds(struct process* pcb) {
+  int fd;
+
+  for (fd = FD_FIRST; fd < pcb->fd_cnt; fd++)
+    fd_close(&pcb->fds[fd]);
+  free(pcb->fds);
+  pcb->fds = NULL;
+  pcb->fd_cnt = 0;
+}
+
 /* Sets up the CPU for running user code in the current
    thread. This function is called on every context switch. */
 void process_activate(void) {
@@ -196,6 +493,23 @@ void process_activate(void) {
   /* Set thread's kernel stack for use in processing interrupts.
      This does nothing if this is not a user process. */
   tss_update();
+
+  process_update_vdso();
+}
+
+/* Brings the current process's vdso page up to date, if it has
+   one.  Called with interrupts off, on every context switch and
+   timer tick, so the page changes only between a program's
+   instructions. */
+void process_update_vdso(void) {
+  struct thread* t = thread_current();
+  struct vdso* v;
+
+  if (t->pcb == NULL || (v = t->pcb->vdso) == NULL)
+    return;
+  v->tid = t->tid;
+  v->ticks = timer_ticks();
+  v->seq++;
 }
 
 /* We load ELF binaries.  The following definitions are taken
@@ -259,17 +573,25 @@ struct Elf32_Phdr {
 #define PF_W 2 /* Writable. */
 #define PF_R 4 /* Readable. */
 
-static bool setup_stack(void** esp);
+/* With VM, pages on each side of the entry point's page that are
+   read in before the process starts, along with that page. */
+#define ENTRY_PREFETCH_PAGES 1
+
+static bool setup_vdso(void);
+static bool setup_stack(void** esp, uint8_t* page, size_t size);
 static bool validate_segment(const struct Elf32_Phdr*, struct file*);
 static bool load_segment(struct file* file, off_t ofs, uint8_t* upage,
                          uint32_t read_bytes, uint32_t zero_bytes,
                          bool writable);
 
-/* Loads an ELF executable from FILE_NAME into the current thread.
+/* Loads an ELF executable from FILE_NAME into the current thread,
+   with the top STACK_SIZE bytes of STACK_PAGE, as build_args() left
+   them, at the top of its stack.
    Stores the executable's entry point into *EIP
    and its initial stack pointer into *ESP.
    Returns true if successful, false otherwise. */
-bool load(const char* file_name, void (**eip)(void), void** esp) {
+bool load(const char* file_name, uint8_t* stack_page, size_t stack_size, void (**eip)(void),
+          void** esp) {
   struct thread* t = thread_current();
   struct Elf32_Ehdr ehdr;
   struct file* file = NULL;
@@ -278,9 +600,14 @@ bool load(const char* file_name, void (**eip)(void), void** esp) {
   int i;
 
   /* Allocate and activate page directory. */
+#ifdef VM
+  t->pcb->executable = NULL;
+  if (!page_table_init()) goto done;
+#endif
   t->pcb->pagedir = pagedir_create();
   if (t->pcb->pagedir == NULL) goto done;
   process_activate();
+  if (!setup_vdso()) goto done;
 
   /* Open executable file. */
   file = filesys_open(file_name);
@@ -288,6 +615,10 @@ bool load(const char* file_name, void (**eip)(void), void** esp) {
     printf("load: %s: open failed\n", file_name);
     goto done;
   }
+#ifdef VM
+  /* Keep it open: the pages of its segments are read on demand. */
+  t->pcb->executable = file;
+#endif
 
   /* Read and verify executable header. */
   if (file_read(file, &ehdr, sizeof ehdr) != sizeof ehdr ||
@@ -349,16 +680,26 @@ bool load(const char* file_name, void (**eip)(void), void** esp) {
   }
 
   /* Set up stack. */
-  if (!setup_stack(esp)) goto done;
+  if (!setup_stack(esp, stack_page, stack_size)) goto done;
 
   /* Start address. */
   *eip = (void (*)(void))ehdr.e_entry;
 
+#ifdef VM
+  /* The segments are read as they are touched, but the code the
+     process starts in is certain to be, so read it now rather than
+     fault on it at once.  The stack page is in already. */
+  for (i = -ENTRY_PREFETCH_PAGES; i <= ENTRY_PREFETCH_PAGES; i++)
+    page_fault_in((uint8_t*)pg_round_down((void*)ehdr.e_entry) + i * PGSIZE, NULL, false);
+#endif
+
   success = true;
 
 done:
   /* We arrive here whether the load is successful or not. */
+#ifndef VM
   file_close(file);
+#endif
   return success;
 }
 
@@ -422,6 +763,22 @@ static bool load_segment(struct file* file, off_t ofs, uint8_t* upage,
   ASSERT(pg_ofs(upage) == 0);
   ASSERT(ofs % PGSIZE == 0);
 
+#ifdef VM
+  /* Only record the pages.  They are read from FILE, which is the
+     process's executable, when they are first touched. */
+  ASSERT(file == thread_current()->pcb->executable);
+  while (read_bytes > 0 || zero_bytes > 0) {
+    size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
+
+    if (!page_add_file(upage, ofs, page_read_bytes, writable)) return false;
+    read_bytes -= page_read_bytes;
+    zero_bytes -= PGSIZE - page_read_bytes;
+    ofs += PGSIZE;
+    upage += PGSIZE;
+  }
+  return true;
+#endif
+
   file_seek(file, ofs);
   while (read_bytes > 0 || zero_bytes > 0) {
     /* Calculate how to fill this page.
@@ -455,21 +812,104 @@ static bool load_segment(struct file* file, off_t ofs, uint8_t* upage,
   return true;
 }
 
-/* Create a minimal stack by mapping a zeroed page at the top of
-   user virtual memory. */
-static bool setup_stack(void** esp) {
-  uint8_t* kpage;
-  bool success = false;
+/* Maps a zeroed page read-only at VDSO_ADDR as the current
+   process's vdso page, and fills it in.  The page directory frees
+   it with the rest. */
+static bool setup_vdso(void) {
+  struct process* pcb = thread_current()->pcb;
+  uint8_t* kpage = palloc_get_page(PAL_USER | PAL_ZERO);
+  enum intr_level old_level;
+
+  if (kpage == NULL) return false;
+  if (!install_page((void*)VDSO_ADDR, kpage, false)) {
+    palloc_free_page(kpage);
+    return false;
+  }
+  old_level = intr_disable();
+  pcb->vdso = (struct vdso*)kpage;
+  process_update_vdso();
+  intr_set_level(old_level);
+  return true;
+}
 
-  kpage = palloc_get_page(PAL_USER | PAL_ZERO);
-  if (kpage != NULL) {
-    success = install_page(((uint8_t*)PHYS_BASE) - PGSIZE, kpage, true);
-    if (success)
-      *esp = ((uint8_t*)PHYS_BASE) - (0x14);
-    else
-      palloc_free_page(kpage);
+/* Create a minimal stack by mapping PAGE, a page of the user
+   pool whose top SIZE bytes build_args() filled in, at the top of
+   user virtual memory, and point *ESP at the bottom of them.  The
+   page then belongs to the process. */
+static bool setup_stack(void** esp, uint8_t* page, size_t size) {
+  uint8_t* stack = (uint8_t*)PHYS_BASE - size;
+
+#ifdef VM
+  /* The page is zeroed when it is first touched, as it is here,
+     and PAGE stays the caller's. */
+  if (!page_add_zero(((uint8_t*)PHYS_BASE) - PGSIZE, true)) return false;
+  memcpy(stack, page + PGSIZE - size, size);
+  *esp = stack;
+  return true;
+#endif
+
+  if (!install_page(((uint8_t*)PHYS_BASE) - PGSIZE, page, true)) return false;
+  *esp = stack;
+  return true;
+}
+
+/* Makes the command line that process_execute() left at the end of
+   PAGE into the arguments of main(), where they lie, in one pass
+   from its end: each space becomes a null terminator, and a
+   pointer to each word is pushed below them, last word first,
+   after argv[argc].  Below the array go argv, argc and a null
+   return address, with argc 16-byte aligned, as the ABI wants the
+   stack at a call.  Any padding that takes goes above argv, so
+   the array needs no moving once argc is known.  Pointers are to
+   where PAGE will be mapped, just below PHYS_BASE.
+
+   Returns the number of bytes used at the top of PAGE, storing a
+   pointer to the program name in *NAME, or 0 if the command line
+   names no program or its words leave no room for the rest. */
+static size_t build_args(uint8_t* page, char** name) {
+  uint8_t* top = page + PGSIZE;
+  size_t len;
+  char* cmd;
+  char* end;
+  uint32_t* sp;
+  size_t argv, ofs;
+  int argc = 0;
+
+  memcpy(&len, page, sizeof len);
+  cmd = (char*)top - len;
+  end = cmd + len - 1;
+
+  /* PHYS_BASE - (TOP - K) is where kernel address K will be. */
+  sp = (uint32_t*)ROUND_DOWN((uintptr_t)cmd, sizeof *sp);
+  *--sp = 0;
+  while (end > cmd) {
+    char* start = end;
+
+    if (end[-1] == ' ') {
+      *--end = '\0';
+      continue;
+    }
+    while (start > cmd && start[-1] != ' ')
+      start--;
+    if ((uint8_t*)sp - page < 32)
+      return 0;
+    *--sp = (uintptr_t)PHYS_BASE - (top - (uint8_t*)start);
+    *name = start;
+    argc++;
+    end = start;
   }
-  return success;
+  if (argc == 0)
+    return 0;
+
+  /* ARGV is how far below PHYS_BASE the array starts, OFS how
+     far below it argv goes, less one word. */
+  argv = top - (uint8_t*)sp;
+  ofs = ROUND_UP(argv + 2 * sizeof *sp, 16) - 2 * sizeof *sp;
+  sp = (uint32_t*)(top - ofs);
+  *--sp = (uintptr_t)PHYS_BASE - argv;
+  *--sp = argc;
+  *--sp = 0;
+  return top - (uint8_t*)sp;
 }
 
 /* Adds a mapping from user virtual address UPAGE to kernel
@@ -498,66 +938,362 @@ bool is_main_thread(struct thread* t, struct process* p) {
 /* Gets the PID of a process */
 pid_t get_pid(struct process* p) { return (pid_t)p->main_thread->tid; }
 
-/* Creates a new stack for the thread and sets up its arguments.
-   Stores the thread's entry point into *EIP and its initial stack
-   pointer into *ESP. Handles all cleanup if unsuccessful. Returns
-   true if successful, false otherwise.
+/* Returns the address just above stack slot SLOT. */
+static uint8_t* stack_top(size_t slot) {
+  return (uint8_t*)PHYS_BASE - (MAX_STACK_PAGES + 1) * PGSIZE - slot * SLOT_PAGES * PGSIZE;
+}
+
+/* Unmaps the page at UPAGE, one of a stack slot's. */
+static void unmap_stack_page(uint8_t* upage) {
+#ifdef VM
+  page_remove(upage);
+#else
+  uint32_t* pd = thread_current()->pcb->pagedir;
+  void* kpage = pagedir_get_page(pd, upage);
+
+  pagedir_clear_page(pd, upage);
+  palloc_free_page(kpage);
+#endif
+}
+
+/* Maps the page at UPAGE, one of a stack slot's, zeroed. */
+static bool map_stack_page(uint8_t* upage) {
+#ifdef VM
+  return page_add_zero(upage, true);
+#else
+  void* kpage = palloc_get_page(PAL_USER | PAL_ZERO);
+
+  if (kpage == NULL)
+    return false;
+  if (!install_page(upage, kpage, true)) {
+    palloc_free_page(kpage);
+    return false;
+  }
+  return true;
+#endif
+}
+
+/* Maps the pages of stack slot SLOT in the current process.
+   Returns false, having mapped none, if memory runs out. */
+static bool map_stack(size_t slot) {
+  uint8_t* top = stack_top(slot);
+  size_t i;
+
+  for (i = 1; i <= THREAD_STACK_PAGES; i++)
+    if (!map_stack_page(top - i * PGSIZE)) {
+      while (--i > 0)
+        unmap_stack_page(top - i * PGSIZE);
+      return false;
+    }
+  return true;
+}
+
+/* Records T, a new thread of its process with the stack in SLOT,
+   in the process's threads.  Returns false if memory runs out.
+   The process's thread_lock must be held, unless T is its first
+   thread. */
+static bool add_user_thread(struct thread* t, size_t slot) {
+  struct user_thread* u = malloc(sizeof *u);
+
+  if (u == NULL)
+    return false;
+  u->tid = t->tid;
+  u->thread = t;
+  u->slot = slot;
+  u->joining = false;
+  sema_init(&u->exited, 0);
+  list_push_back(&t->pcb->threads, &u->elem);
+  t->user = u;
+  return true;
+}
+
+/* Returns the record of the thread of PCB with TID, or a null
+   pointer if there is none.  PCB's thread_lock must be held. */
+static struct user_thread* find_user_thread(struct process* pcb, tid_t tid) {
+  struct list_elem* e;
+
+  for (e = list_begin(&pcb->threads); e != list_end(&pcb->threads); e = list_next(e)) {
+    struct user_thread* u = list_entry(e, struct user_thread, elem);
+    if (u->tid == tid)
+      return u;
+  }
+  return NULL;
+}
+
+/* Frees the records of PCB's threads and its stack slots, once
+   the last of its threads has exited. */
+static void free_threads(struct process* pcb) {
+  while (!list_empty(&pcb->threads))
+    free(list_entry(list_pop_front(&pcb->threads), struct user_thread, elem));
+  if (pcb->stacks != NULL)
+    bitmap_destroy(pcb->stacks);
+}
+
+/* Lets go of C, freeing it if its parent or child already has. */
+static void release_child(struct child* c) {
+  if (__sync_sub_and_fetch(&c->ref_cnt, 1) == 0)
+    free(c);
+}
+
+/* Lets go of the struct child in hash element E. */
+static void release_child_elem(struct hash_elem* e, void* aux UNUSED) {
+  release_child(hash_entry(e, struct child, elem));
+}
+
+/* Lets go of the children of PCB that it did not wait for, which
+   then run on without a parent. */
+static void free_children(struct process* pcb) {
+  hash_destroy(&pcb->children, release_child_elem);
+}
+
+/* Returns a hash of the pid of the child in E. */
+static unsigned child_hash(const struct hash_elem* e, void* aux UNUSED) {
+  return hash_int(hash_entry(e, struct child, elem)->pid);
+}
+
+/* Returns true if the child in A has a lower pid than the one in
+   B. */
+static bool child_less(const struct hash_elem* a, const struct hash_elem* b, void* aux UNUSED) {
+  return hash_entry(a, struct child, elem)->pid < hash_entry(b, struct child, elem)->pid;
+}
 
-   This function will be implemented in Project 2: Multithreading. For
-   now, it does nothing. You may find it necessary to change the
-   function signature. */
-bool setup_thread(void (**eip)(void) UNUSED, void** esp UNUSED) {
-  return false;
+/* Gives the current thread, new in its process, a stack slot,
+   and sets up the stack there to call START's stub function with
+   its thread function and argument, as if from a null return
+   address, the arguments 16-byte aligned as the ABI wants.
+   Stores the thread's entry point into *EIP and its initial stack
+   pointer into *ESP.  Returns true if successful, false otherwise,
+   having undone what it did. */
+bool setup_thread(void (**eip)(void), void** esp, struct pthread_start* start) {
+  struct thread* t = thread_current();
+  struct process* pcb = t->pcb;
+  uint32_t* sp;
+  size_t slot;
+
+  lock_acquire(&pcb->thread_lock);
+  slot = pcb->exiting ? BITMAP_ERROR : bitmap_scan_and_flip(pcb->stacks, 0, 1, false);
+  if (slot == BITMAP_ERROR) {
+    lock_release(&pcb->thread_lock);
+    return false;
+  }
+  /* Slots are taken lowest first, so this one is mapped or is the
+     first that is not. */
+  if (slot == pcb->stacks_mapped && map_stack(slot))
+    pcb->stacks_mapped++;
+  if (slot == pcb->stacks_mapped || !add_user_thread(t, slot)) {
+    bitmap_reset(pcb->stacks, slot);
+    lock_release(&pcb->thread_lock);
+    return false;
+  }
+  pcb->thread_cnt++;
+  lock_release(&pcb->thread_lock);
+
+  sp = (uint32_t*)(stack_top(slot) - 16);
+  *--sp = (uintptr_t)start->arg;
+  *--sp = (uintptr_t)start->tf;
+  *--sp = 0;
+  *eip = (void (*)(void))start->sf;
+  *esp = sp;
+  return true;
 }
 
 /* Starts a new thread with a new user stack running SF, which takes
    TF and ARG as arguments on its user stack. This new thread may be
    scheduled (and may even exit) before pthread_execute () returns.
    Returns the new thread's TID or TID_ERROR if the thread cannot
-   be created properly.
+   be created properly. */
+tid_t pthread_execute(stub_fun sf, pthread_fun tf, void* arg) {
+  struct pthread_start start;
+  tid_t tid;
 
-   This function will be implemented in Project 2: Multithreading and
-   should be similar to process_execute (). For now, it does nothing.
-   */
-tid_t pthread_execute(stub_fun sf UNUSED, pthread_fun tf UNUSED,
-                      void* arg UNUSED) {
-  return -1;
+  start.pcb = thread_current()->pcb;
+  start.sf = sf;
+  start.tf = tf;
+  start.arg = arg;
+  sema_init(&start.started, 0);
+
+  tid = thread_create(start.pcb->process_name, PRI_DEFAULT, start_pthread, &start);
+  if (tid == TID_ERROR)
+    return TID_ERROR;
+  sema_down(&start.started);
+  return start.success ? tid : TID_ERROR;
 }
 
 /* A thread function that creates a new user thread and starts it
    running. Responsible for adding itself to the list of threads in
-   the PCB.
+   the PCB, and to the process's scheduling group with
+   thread_set_group(), so that under the fair scheduler all the
+   threads of a process share one process's worth of the CPU. */
+static void start_pthread(void* start_) {
+  struct pthread_start* start = start_;
+  struct thread* t = thread_current();
+  struct intr_frame if_;
+  bool success;
+
+  t->pcb = start->pcb;
+  process_activate();
+  thread_set_group(&t->pcb->group);
+
+  memset(&if_, 0, sizeof if_);
+  if_.gs = if_.fs = if_.es = if_.ds = if_.ss = SEL_UDSEG;
+  if_.cs = SEL_UCSEG;
+  if_.eflags = FLAG_IF | FLAG_MBS;
+  success = start->success = setup_thread(&if_.eip, &if_.esp, start);
+
+  /* START is gone once its creator wakes. */
+  sema_up(&start->started);
+  if (!success) {
+    thread_set_group(NULL);
+    t->pcb = NULL;
+    thread_exit();
+  }
 
-   This function will be implemented in Project 2: Multithreading and
-   should be similar to start_process (). For now, it does nothing. */
-static void start_pthread(void* exec_ UNUSED) {}
+  asm volatile("movl %0, %%esp; jmp intr_exit" : : "g"(&if_) : "memory");
+  NOT_REACHED();
+}
 
 /* Waits for thread with TID to die, if that thread was spawned
    in the same process and has not been waited on yet. Returns TID on
    success and returns TID_ERROR on failure immediately, without
-   waiting.
+   waiting.  A thread may join the main thread, which is woken
+   when the main thread calls pthread_exit(). */
+tid_t pthread_join(tid_t tid) {
+  struct thread* t = thread_current();
+  struct process* pcb = t->pcb;
+  struct user_thread* u;
+
+  lock_acquire(&pcb->thread_lock);
+  u = find_user_thread(pcb, tid);
+  if (u == NULL || u->joining || u == t->user) {
+    lock_release(&pcb->thread_lock);
+    return TID_ERROR;
+  }
+  u->joining = true;
+  lock_release(&pcb->thread_lock);
+
+  sema_down(&u->exited);
+
+  /* The main thread's record lasts as long as the process. */
+  lock_acquire(&pcb->thread_lock);
+  if (u->thread == NULL) {
+    list_remove(&u->elem);
+    free(u);
+  }
+  lock_release(&pcb->thread_lock);
+  return tid;
+}
+
+/* Ends the current thread, other than the one ending its process,
+   and wakes the thread that joins it.  Its stack slot becomes free
+   but stays mapped, for the next thread created to use. */
+static void leave(void) {
+  struct thread* t = thread_current();
+  struct process* pcb = t->pcb;
+  struct user_thread* u = t->user;
+
+  /* Leave PCB alone once the count drops, for it may be freed. */
+  thread_set_group(NULL);
+  t->pcb = NULL;
+  t->user = NULL;
+  process_activate();
+
+  lock_acquire(&pcb->thread_lock);
+  if (u->slot != SIZE_MAX)
+    bitmap_reset(pcb->stacks, u->slot);
+  u->thread = NULL;
+  sema_up(&u->exited);
+  pcb->thread_cnt--;
+  cond_broadcast(&pcb->thread_exited, &pcb->thread_lock);
+  lock_release(&pcb->thread_lock);
+
+  thread_exit();
+}
 
-   This function will be implemented in Project 2: Multithreading. For
-   now, it does nothing. */
-tid_t pthread_join(tid_t tid UNUSED) { return -1; }
+/* Makes the current thread the one that ends its process and
+   waits for the others to end, which each does on its way back
+   to user mode.  Threads asleep on a futex or a pipe, or joining
+   this one, are woken for the purpose.  Returns false, at once,
+   if another thread is already ending the process. */
+static bool end_threads(void) {
+  struct thread* t = thread_current();
+  struct process* pcb = t->pcb;
+
+  lock_acquire(&pcb->thread_lock);
+  if (pcb->exiting) {
+    lock_release(&pcb->thread_lock);
+    return false;
+  }
+  pcb->exiting = true;
+  lock_release(&pcb->thread_lock);
+
+  futex_wake_all(pcb);
+  pipe_wake_all();
+
+  lock_acquire(&pcb->thread_lock);
+  sema_up(&t->user->exited);
+  while (pcb->thread_cnt > 1)
+    cond_wait(&pcb->thread_exited, &pcb->thread_lock);
+  lock_release(&pcb->thread_lock);
+  return true;
+}
 
 /* Free the current thread's resources. Most resources will
-   be freed on thread_exit(), so all we have to do is deallocate the
-   thread's userspace stack. Wake any waiters on this thread.
+   be freed on thread_exit(), so all we have to do is give back
+   the thread's userspace stack, for reuse. Wake any waiters on
+   this thread.
 
    The main thread should not use this function. See
-   pthread_exit_main() below.
-
-   This function will be implemented in Project 2: Multithreading. For
-   now, it does nothing. */
-void pthread_exit(void) {}
+   pthread_exit_main() below. */
+void pthread_exit(void) { leave(); }
 
 /* Only to be used when the main thread explicitly calls pthread_exit.
-   The main thread should wait on all threads in the process to
-   terminate properly, before exiting itself. When it exits itself, it
-   must terminate the process in addition to all necessary duties in
-   pthread_exit.
-
-   This function will be implemented in Project 2: Multithreading. For
-   now, it does nothing. */
-void pthread_exit_main(void) {}
+   The main thread wakes any thread that joins it, then joins each
+   thread that no other thread joins and waits for the rest to
+   end.  It then returns, for its caller to end the process with
+   exit code 0.  If another thread ends the process meanwhile, the
+   main thread just ends. */
+void pthread_exit_main(void) {
+  struct thread* t = thread_current();
+  struct process* pcb = t->pcb;
+  bool killed;
+
+  lock_acquire(&pcb->thread_lock);
+  sema_up(&t->user->exited);
+  for (;;) {
+    struct user_thread* u = NULL;
+    struct list_elem* e;
+
+    for (e = list_begin(&pcb->threads); e != list_end(&pcb->threads); e = list_next(e)) {
+      u = list_entry(e, struct user_thread, elem);
+      if (!u->joining && u != t->user)
+        break;
+    }
+    if (e == list_end(&pcb->threads) || pcb->exiting)
+      break;
+
+    u->joining = true;
+    lock_release(&pcb->thread_lock);
+    sema_down(&u->exited);
+    lock_acquire(&pcb->thread_lock);
+    if (u->thread == NULL) {
+      list_remove(&u->elem);
+      free(u);
+    }
+  }
+  while (pcb->thread_cnt > 1 && !pcb->exiting)
+    cond_wait(&pcb->thread_exited, &pcb->thread_lock);
+  killed = pcb->exiting;
+  lock_release(&pcb->thread_lock);
+
+  if (killed)
+    leave();
+}
+
+/* Ends the current thread if another thread of its process is
+   ending the process.  Called on every return to user mode. */
+void pthread_exit_if_killed(void) {
+  struct thread* t = thread_current();
+
+  if (t->pcb != NULL && t->pcb->exiting)
+    leave();
+}
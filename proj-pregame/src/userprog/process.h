@@ -2,7 +2,10 @@
 #define USERPROG_PROCESS_H
 
 #include "threads/thread.h"
+#include <hash.h>
+#include <list.h>
 #include <stdint.h>
+#include "threads/synch.h"
 
 // At most 8MB can be allocated to the stack
 // These defines will be used in Project 2: Multithreading
@@ -13,6 +16,46 @@
    the TID of the main thread of the process */
 typedef tid_t pid_t;
 
+/* File descriptors 0 and 1 are the console's, so the first file
+   opened gets FD_FIRST. */
+#define FD_FIRST 2
+
+struct bitmap;
+struct file;
+struct pipe;
+
+/* What a file descriptor is open as: a file or one end of a pipe,
+   or neither if it is free. */
+struct fd_entry {
+  struct file* file; /* The file, or null. */
+  struct pipe* pipe; /* The pipe, or null. */
+  bool writer;       /* Is it the pipe's write end? */
+};
+
+/* A thread of a user process, from its creation until it has
+   exited and been joined. */
+struct user_thread {
+  struct list_elem elem;   /* In its process's threads. */
+  tid_t tid;               /* Its tid. */
+  struct thread* thread;   /* The thread, or null once it has exited. */
+  size_t slot;             /* Its stack's slot, or SIZE_MAX for the main thread. */
+  bool joining;            /* Does a thread join it, or has one? */
+  struct semaphore exited; /* Upped when it exits. */
+};
+
+/* What a process and one of its children share, so that it can
+   learn whether the child loaded and how it exited.  Freed by
+   whichever of the two lets go of it last. */
+struct child {
+  struct hash_elem elem;      /* In the parent's children. */
+  pid_t pid;                  /* The child's pid. */
+  bool loaded;                /* Did it load, once LOAD_DONE is upped? */
+  int exit_code;              /* Its exit code, once EXITED is upped. */
+  struct semaphore load_done; /* Upped when its load succeeds or fails. */
+  struct semaphore exited;    /* Upped when it exits. */
+  int ref_cnt;                /* Holders: the parent, the child, or both. */
+};
+
 /* Thread functions (Project 2: Multithreading) */
 typedef void (*pthread_fun)(void*);
 typedef void (*stub_fun)(pthread_fun, void*);
@@ -27,6 +70,42 @@ struct process {
   uint32_t* pagedir;          /* Page directory. */
   char process_name[16];      /* Name of the main thread */
   struct thread* main_thread; /* Pointer to main thread */
+  struct vdso* vdso;          /* Kernel address of its vdso page. */
+  struct child* child;        /* Shared with its parent. */
+  int exit_code;              /* Exit code, -1 unless it calls exit. */
+
+  /* Owned by process.c, guarded by child_lock. */
+  struct lock child_lock;
+  struct hash children; /* Its struct childs not yet waited for, by pid. */
+
+  /* Owned by process.c, guarded by fd_lock. */
+  struct lock fd_lock;
+  struct fd_entry* fds; /* What each descriptor is open as. */
+  int fd_cnt;           /* Number of slots in FDS. */
+  int fd_free;          /* No slot below this is free. */
+
+  /* Owned by process.c, guarded by thread_lock. */
+  struct lock thread_lock;
+  struct condition thread_exited; /* Signaled when a thread exits. */
+  struct list threads;            /* Its struct user_threads. */
+  int thread_cnt;                 /* Threads running the process. */
+  struct bitmap* stacks;          /* Stack slots in use. */
+  size_t stacks_mapped;           /* Slots mapped, from the first. */
+  bool exiting;                   /* Is a thread ending the process? */
+
+  /* Owned by userprog/futex.c, guarded by its lock. */
+  int futex_waiters; /* Threads asleep on a futex. */
+
+  /* Owned by thread.c. */
+  struct fair_group group; /* Threads of the process. */
+
+#ifdef VM
+  /* Owned by vm/page.c. */
+  struct hash pages;       /* Supplemental page table. */
+  struct file* executable; /* Backs the pages of its segments. */
+  struct list mappings;    /* Mapped files, by struct mapping's elem. */
+  int next_mapid;          /* Id of the next mapping. */
+#endif
 };
 
 void userprog_init(void);
@@ -35,13 +114,21 @@ pid_t process_execute(const char* file_name);
 int process_wait(pid_t);
 void process_exit(void);
 void process_activate(void);
+void process_update_vdso(void);
+
+int process_fd_open(struct file*);
+int process_fd_open_pipe(struct pipe*, bool writer);
+struct file* process_fd_get(int fd);
+struct pipe* process_fd_get_pipe(int fd, bool writer);
+bool process_fd_close(int fd);
 
 bool is_main_thread(struct thread*, struct process*);
 pid_t get_pid(struct process*);
 
 tid_t pthread_execute(stub_fun, pthread_fun, void*);
 tid_t pthread_join(tid_t);
-void pthread_exit(void);
+void pthread_exit(void) NO_RETURN;
 void pthread_exit_main(void);
+void pthread_exit_if_killed(void);
 
 #endif /* userprog/process.h */
@@ -1,16 +1,159 @@
 #include "userprog/syscall.h"
+#include <float.h>
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
+#include <syscall-types.h>
+#include "devices/block.h"
+#include "devices/shutdown.h"
+#include "devices/input.h"
+#include "devices/trace.h"
+#include "filesys/directory.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "filesys/inode.h"
+#include "threads/fpu.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/futex.h"
+#include "userprog/pipe.h"
 #include "userprog/process.h"
+#ifdef VM
+#include "vm/mmap.h"
+#endif
 
 static void syscall_handler(struct intr_frame*);
 
+/* A system call: the function that carries it out, given the
+   arguments above the number on the user stack, and how many of
+   them it takes.  Its return value goes to the user in eax. */
+typedef uint32_t syscall_func(uint32_t* args);
+struct syscall {
+  syscall_func* func;
+  int arg_cnt;
+};
+
+static syscall_func sys_halt, sys_read, sys_write, sys_practice;
+static syscall_func sys_filesize, sys_seek, sys_tell;
+static syscall_func sys_exit, sys_exec, sys_wait, sys_create, sys_remove, sys_open, sys_close;
+static syscall_func sys_pipe, sys_sched_stat, sys_block_stat, sys_readv, sys_writev, sys_sendfile;
+static syscall_func sys_futex_wait, sys_futex_wake;
+static syscall_func sys_pt_create, sys_pt_exit, sys_pt_join, sys_get_tid, sys_batch;
+#ifdef VM
+static syscall_func sys_mmap, sys_munmap;
+#endif
+static syscall_func sys_compute_e, sys_isdir, sys_inumber, sys_getdents;
+
+/* System calls, by number.  Those not listed have no function,
+   and return -1. */
+static const struct syscall syscalls[] = {
+    [SYS_HALT] = {sys_halt, 0},
+    [SYS_EXIT] = {sys_exit, 1},
+    [SYS_EXEC] = {sys_exec, 1},
+    [SYS_WAIT] = {sys_wait, 1},
+    [SYS_CREATE] = {sys_create, 2},
+    [SYS_REMOVE] = {sys_remove, 1},
+    [SYS_OPEN] = {sys_open, 1},
+    [SYS_FILESIZE] = {sys_filesize, 1},
+    [SYS_READ] = {sys_read, 3},
+    [SYS_WRITE] = {sys_write, 3},
+    [SYS_SEEK] = {sys_seek, 2},
+    [SYS_TELL] = {sys_tell, 1},
+    [SYS_CLOSE] = {sys_close, 1},
+    [SYS_PRACTICE] = {sys_practice, 1},
+    [SYS_COMPUTE_E] = {sys_compute_e, 1},
+    [SYS_PT_CREATE] = {sys_pt_create, 3},
+    [SYS_PT_EXIT] = {sys_pt_exit, 0},
+    [SYS_PT_JOIN] = {sys_pt_join, 1},
+    [SYS_GET_TID] = {sys_get_tid, 0},
+#ifdef VM
+    [SYS_MMAP] = {sys_mmap, 2},
+    [SYS_MUNMAP] = {sys_munmap, 1},
+#endif
+    [SYS_ISDIR] = {sys_isdir, 1},
+    [SYS_INUMBER] = {sys_inumber, 1},
+    [SYS_SCHED_STAT] = {sys_sched_stat, 1},
+    [SYS_BLOCK_STAT] = {sys_block_stat, 2},
+    [SYS_READV] = {sys_readv, 3},
+    [SYS_WRITEV] = {sys_writev, 3},
+    [SYS_SENDFILE] = {sys_sendfile, 3},
+    [SYS_FUTEX_WAIT] = {sys_futex_wait, 2},
+    [SYS_FUTEX_WAKE] = {sys_futex_wake, 2},
+    [SYS_BATCH] = {sys_batch, 1},
+    [SYS_PIPE] = {sys_pipe, 1},
+    [SYS_GETDENTS] = {sys_getdents, 3},
+};
+
+#define SYSCALL_CNT (sizeof syscalls / sizeof *syscalls)
+
 void syscall_init(void) { intr_register_int(0x30, 3, INTR_ON, syscall_handler, "syscall"); }
 
-static void syscall_handler(struct intr_frame* f UNUSED) {
+/* Reads a byte at user virtual address UADDR, which must be below
+   PHYS_BASE.  Returns the byte value if successful, -1 if a
+   segfault occurred, which page_fault() arranges by resuming at
+   the address left in eax with eax set to -1. */
+static int get_user(const uint8_t* uaddr) {
+  int result;
+  asm volatile("movl $1f, %0; movzbl %1, %0; 1:" : "=&a"(result) : "m"(*uaddr));
+  return result;
+}
+
+/* Writes BYTE to user address UDST, which must be below
+   PHYS_BASE.  Returns true if successful, false if a segfault
+   occurred. */
+static bool put_user(uint8_t* udst, uint8_t byte) {
+  int error_code;
+  asm volatile("movl $1f, %0; movb %b2, %1; 1:" : "=&a"(error_code), "=m"(*udst) : "q"(byte));
+  return error_code != -1;
+}
+
+/* Returns true if the SIZE bytes from user address UADDR may be
+   read, and also written if WRITE is true.  A page is mapped or
+   not as a whole, so a byte of each page is enough to try. */
+static bool check_user(const void* uaddr, size_t size, bool write) {
+  const uint8_t* p = uaddr;
+  const uint8_t* end = p + size;
+
+  if (size == 0)
+    return true;
+  if (end < p || end > (const uint8_t*)PHYS_BASE)
+    return false;
+  for (; p < end; p = (const uint8_t*)pg_round_down(p) + PGSIZE) {
+    int byte = get_user(p);
+    if (byte == -1 || (write && !put_user((uint8_t*)p, byte)))
+      return false;
+  }
+  return true;
+}
+
+/* Returns true if the null-terminated string at user address
+   USTR may be read. */
+static bool check_string(const char* ustr) {
+  const uint8_t* p = (const uint8_t*)ustr;
+  int byte;
+
+  do {
+    if (p >= (const uint8_t*)PHYS_BASE || (byte = get_user(p++)) == -1)
+      return false;
+  } while (byte != '\0');
+  return true;
+}
+
+/* Terminates the current process with exit code STATUS. */
+static void exit_process(int status) {
+  struct process* pcb = thread_current()->pcb;
+
+  printf("%s: exit(%d)\n", pcb->process_name, status);
+  pcb->exit_code = status;
+  process_exit();
+  NOT_REACHED();
+}
+
+static void syscall_handler(struct intr_frame* f) {
   uint32_t* args = ((uint32_t*)f->esp);
+  const struct syscall* sc;
 
   /*
    * The following print statement, if uncommented, will print out the syscall
@@ -21,9 +164,440 @@ static void syscall_handler(struct intr_frame* f UNUSED) {
 
   /* printf("System call number: %d\n", args[0]); */
 
-  if (args[0] == SYS_EXIT) {
-    f->eax = args[1];
-    printf("%s: exit(%d)\n", thread_current()->pcb->process_name, args[1]);
-    process_exit();
+  /* A fault in the kernel on a page of stack not yet touched
+     needs the user's stack pointer to tell that it is one. */
+  thread_current()->user_esp = f->esp;
+  if (!check_user(args, sizeof *args, false))
+    exit_process(-1);
+  TRACE(TRACE_SYSCALL, args[0], 0);
+  if (args[0] >= SYSCALL_CNT || syscalls[args[0]].func == NULL) {
+    f->eax = -1;
+    return;
+  }
+
+  sc = &syscalls[args[0]];
+  if (!check_user(args + 1, sc->arg_cnt * sizeof *args, false))
+    exit_process(-1);
+  f->eax = sc->func(args + 1);
+}
+
+static uint32_t sys_halt(uint32_t* args UNUSED) { shutdown_power_off(); }
+
+static uint32_t sys_exit(uint32_t* args) {
+  exit_process(args[0]);
+  NOT_REACHED();
+}
+
+static uint32_t sys_exec(uint32_t* args) {
+  const char* cmd_line = (const char*)args[0];
+
+  if (!check_string(cmd_line))
+    exit_process(-1);
+  return process_execute(cmd_line);
+}
+
+static uint32_t sys_wait(uint32_t* args) { return process_wait(args[0]); }
+
+static uint32_t sys_create(uint32_t* args) {
+  const char* name = (const char*)args[0];
+
+  if (!check_string(name))
+    exit_process(-1);
+  return filesys_create(name, args[1]);
+}
+
+static uint32_t sys_remove(uint32_t* args) {
+  const char* name = (const char*)args[0];
+
+  if (!check_string(name))
+    exit_process(-1);
+  return filesys_remove(name);
+}
+
+/* Opens the file named ARGS[0] as the lowest free descriptor.
+   Returns the descriptor, or -1 if there is no such file or
+   memory runs out. */
+static uint32_t sys_open(uint32_t* args) {
+  const char* name = (const char*)args[0];
+  struct file* file;
+  int fd;
+
+  if (!check_string(name))
+    exit_process(-1);
+  file = filesys_open(name);
+  if (file == NULL)
+    return -1;
+  fd = process_fd_open(file);
+  if (fd < 0)
+    file_close(file);
+  return fd;
+}
+
+static uint32_t sys_close(uint32_t* args) {
+  process_fd_close(args[0]);
+  return 0;
+}
+
+/* Creates a pipe and stores the descriptors of its read and write
+   ends in the two ints at user address ARGS[0].  Returns 0, or -1
+   if memory runs out. */
+static uint32_t sys_pipe(uint32_t* args) {
+  int* ufds = (int*)args[0];
+  struct pipe* pipe;
+  int fds[2];
+
+  if (!check_user(ufds, sizeof fds, true))
+    exit_process(-1);
+  pipe = pipe_create();
+  if (pipe == NULL)
+    return -1;
+  fds[0] = process_fd_open_pipe(pipe, false);
+  if (fds[0] < 0) {
+    pipe_close(pipe, false);
+    pipe_close(pipe, true);
+    return -1;
+  }
+  fds[1] = process_fd_open_pipe(pipe, true);
+  if (fds[1] < 0) {
+    process_fd_close(fds[0]);
+    pipe_close(pipe, true);
+    return -1;
+  }
+  memcpy(ufds, fds, sizeof fds);
+  return 0;
+}
+
+/* Returns its argument plus one, to exercise the system call
+   path itself. */
+static uint32_t sys_practice(uint32_t* args) { return args[0] + 1; }
+
+static uint32_t sys_pt_create(uint32_t* args) {
+  return pthread_execute((stub_fun)args[0], (pthread_fun)args[1], (void*)args[2]);
+}
+
+/* The main thread's pthread_exit() ends the process with exit
+   code 0, once every other thread has ended. */
+static uint32_t sys_pt_exit(uint32_t* args UNUSED) {
+  struct thread* t = thread_current();
+
+  if (!is_main_thread(t, t->pcb)) {
+    pthread_exit();
+    NOT_REACHED();
+  }
+  pthread_exit_main();
+  exit_process(0);
+  NOT_REACHED();
+}
+
+static uint32_t sys_pt_join(uint32_t* args) { return pthread_join(args[0]); }
+
+static uint32_t sys_get_tid(uint32_t* args UNUSED) { return thread_current()->tid; }
+
+/* Computes e in the kernel, on an FPU of its own, so that the
+   caller's FPU registers are as it left them. */
+static uint32_t sys_compute_e(uint32_t* args) {
+  struct fpu_state fpu;
+  int e;
+
+  fpu_kernel_begin(&fpu);
+  e = sys_sum_to_e(args[0]);
+  fpu_kernel_end(&fpu);
+  return e;
+}
+
+static uint32_t sys_sched_stat(uint32_t* args) { return thread_sched_stat(args[0]); }
+
+static uint32_t sys_block_stat(uint32_t* args) { return block_stat(args[0], args[1]); }
+
+/* Copies the CNT buffers that user address UIOV describes into
+   IOV, checking that each may be read, and also written if WRITE
+   is true.  Returns the total number of bytes they hold, ending
+   the process if any of it is bad. */
+static size_t get_iov(struct iovec iov[IOV_MAX], const struct iovec* uiov, int cnt, bool write) {
+  size_t total = 0;
+  int i;
+
+  if (cnt < 0 || cnt > IOV_MAX || !check_user(uiov, cnt * sizeof *uiov, false))
+    exit_process(-1);
+  memcpy(iov, uiov, cnt * sizeof *uiov);
+  for (i = 0; i < cnt; i++) {
+    if (!check_user(iov[i].iov_base, iov[i].iov_len, write))
+      exit_process(-1);
+    total += iov[i].iov_len;
+  }
+  return total;
+}
+
+/* Reads up to SIZE bytes from FD into BUF, which has been
+   checked, waiting for each byte if FD is the keyboard, or for
+   any if FD is a pipe.  Returns the number read, short at the end
+   of a file, or -1 if FD is not open for reading. */
+static int read_fd(int fd, uint8_t* buf, size_t size) {
+  struct file* file;
+  struct pipe* pipe;
+  size_t n;
+
+  if (fd == STDIN_FILENO) {
+    for (n = 0; n < size; n++)
+      buf[n] = input_getc();
+    return n;
+  }
+  file = process_fd_get(fd);
+  if (file != NULL)
+    return file_read(file, buf, size);
+  pipe = process_fd_get_pipe(fd, false);
+  return pipe != NULL ? pipe_read(pipe, buf, size) : -1;
+}
+
+/* Writes SIZE bytes from BUF, which has been checked, to FD.
+   Returns the number written, short if a file cannot grow or a
+   pipe's read end is closed, or -1 if FD is not open for
+   writing, as a directory is not. */
+static int write_fd(int fd, const void* buf, size_t size) {
+  struct file* file;
+  struct pipe* pipe;
+
+  if (fd == STDOUT_FILENO) {
+    putbuf(buf, size);
+    return size;
+  }
+  file = process_fd_get(fd);
+  if (file != NULL)
+    return !inode_is_dir(file_get_inode(file)) ? file_write(file, buf, size) : -1;
+  pipe = process_fd_get_pipe(fd, true);
+  return pipe != NULL ? pipe_write(pipe, buf, size) : -1;
+}
+
+static uint32_t sys_read(uint32_t* args) {
+  if (!check_user((void*)args[1], args[2], true))
+    exit_process(-1);
+  return read_fd(args[0], (uint8_t*)args[1], args[2]);
+}
+
+static uint32_t sys_write(uint32_t* args) {
+  if (!check_user((void*)args[1], args[2], false))
+    exit_process(-1);
+  return write_fd(args[0], (const void*)args[1], args[2]);
+}
+
+/* Returns the size of the file open as ARGS[0], or -1 if no file
+   is. */
+static uint32_t sys_filesize(uint32_t* args) {
+  struct file* file = process_fd_get(args[0]);
+  return file != NULL ? file_length(file) : -1;
+}
+
+static uint32_t sys_seek(uint32_t* args) {
+  struct file* file = process_fd_get(args[0]);
+
+  if (file != NULL)
+    file_seek(file, args[1]);
+  return 0;
+}
+
+/* Returns the position in the file open as ARGS[0], or -1 if no
+   file is. */
+static uint32_t sys_tell(uint32_t* args) {
+  struct file* file = process_fd_get(args[0]);
+  return file != NULL ? file_tell(file) : -1;
+}
+
+/* Reads into each of the buffers in turn, stopping short at the
+   end of the file.  Reading the keyboard, it waits for each byte. */
+static uint32_t sys_readv(uint32_t* args) {
+  struct iovec iov[IOV_MAX];
+  int fd = args[0];
+  int cnt = args[2];
+  size_t total = 0;
+  int i;
+
+  get_iov(iov, (const struct iovec*)args[1], cnt, true);
+  for (i = 0; i < cnt; i++) {
+    int n = read_fd(fd, iov[i].iov_base, iov[i].iov_len);
+    if (n < 0)
+      return -1;
+    total += n;
+    if ((size_t)n < iov[i].iov_len)
+      break;
+  }
+  return total;
+}
+
+/* Writes each of the buffers in turn, stopping short if the file
+   cannot grow. */
+static uint32_t sys_writev(uint32_t* args) {
+  struct iovec iov[IOV_MAX];
+  int fd = args[0];
+  int cnt = args[2];
+  size_t total = 0;
+  int i;
+
+  get_iov(iov, (const struct iovec*)args[1], cnt, false);
+  for (i = 0; i < cnt; i++) {
+    int n = write_fd(fd, iov[i].iov_base, iov[i].iov_len);
+    if (n < 0)
+      return -1;
+    total += n;
+    if ((size_t)n < iov[i].iov_len)
+      break;
+  }
+  return total;
+}
+
+/* Copies up to SIZE bytes from the file open as IN_FD, from its
+   current position, to the file open as OUT_FD or to the console.
+   The data passes from the buffer cache to the buffer cache, or
+   to the console, through a kernel page, never crossing into user
+   memory.  Returns the number of bytes copied. */
+static uint32_t sys_sendfile(uint32_t* args) {
+  int out_fd = args[0];
+  struct file* in = process_fd_get(args[1]);
+  struct file* out = NULL;
+  unsigned size = args[2];
+  unsigned total = 0;
+  uint8_t* page;
+
+  if (in == NULL || (out_fd != STDOUT_FILENO && (out = process_fd_get(out_fd)) == NULL))
+    return -1;
+  if (out != NULL && inode_is_dir(file_get_inode(out)))
+    return -1;
+  page = palloc_get_page(0);
+  if (page == NULL)
+    return -1;
+
+  while (total < size) {
+    off_t n = file_read(in, page, size - total < PGSIZE ? size - total : PGSIZE);
+    off_t written = n;
+
+    if (n == 0)
+      break;
+    if (out == NULL)
+      putbuf((const char*)page, n);
+    else
+      written = file_write(out, page, n);
+    total += written;
+    if (written < n) {
+      file_seek(in, file_tell(in) - (n - written));
+      break;
+    }
+  }
+
+  palloc_free_page(page);
+  return total;
+}
+
+#ifdef VM
+/* Maps the file open as ARGS[0] at user address ARGS[1].  Returns
+   the mapping's id, or MAP_FAILED if ARGS[0] is not open as a
+   file or mmap_map() refuses. */
+static uint32_t sys_mmap(uint32_t* args) {
+  struct file* file = process_fd_get(args[0]);
+
+  if (file == NULL || inode_is_dir(file_get_inode(file)))
+    return MAP_FAILED;
+  return mmap_map(file, (void*)args[1]);
+}
+
+static uint32_t sys_munmap(uint32_t* args) {
+  mmap_unmap(args[0]);
+  return 0;
+}
+#endif
+
+/* Returns true if ARGS[0] is open as a directory. */
+static uint32_t sys_isdir(uint32_t* args) {
+  struct file* file = process_fd_get(args[0]);
+  return file != NULL && inode_is_dir(file_get_inode(file));
+}
+
+/* Returns the inode number of what ARGS[0] is open as, or -1 if
+   it is not open as a file or directory. */
+static uint32_t sys_inumber(uint32_t* args) {
+  struct file* file = process_fd_get(args[0]);
+  return file != NULL ? inode_get_inumber(file_get_inode(file)) : (block_sector_t)-1;
+}
+
+/* Packs the names of as many of the entries of the directory open
+   as FD as fit, from its current position, into the user buffer,
+   each null terminated, reading a sector's worth of entries at a
+   time.  Returns the number of bytes stored, 0 at the end of the
+   directory, or -1 if FD is not open as a directory. */
+static uint32_t sys_getdents(uint32_t* args) {
+  struct file* file = process_fd_get(args[0]);
+  char* buf = (char*)args[1];
+  size_t size = args[2];
+  size_t n;
+  off_t pos;
+
+  if (!check_user(buf, size, true))
+    exit_process(-1);
+  if (file == NULL || !inode_is_dir(file_get_inode(file)))
+    return -1;
+
+  pos = file_tell(file);
+  n = dir_getdents(file_get_inode(file), &pos, buf, size);
+  file_seek(file, pos);
+  return n;
+}
+
+/* Returns the futex word at user address ARG, ending the process
+   if it is not an aligned word that may be read. */
+static const int* get_futex(uint32_t arg) {
+  const int* uaddr = (const int*)arg;
+
+  if (arg % sizeof *uaddr != 0 || !check_user(uaddr, sizeof *uaddr, false))
+    exit_process(-1);
+  return uaddr;
+}
+
+static uint32_t sys_futex_wait(uint32_t* args) { return futex_wait(get_futex(args[0]), args[1]); }
+
+static uint32_t sys_futex_wake(uint32_t* args) { return futex_wake(get_futex(args[0]), args[1]); }
+
+/* Carries out the operations queued in the ring at user address
+   ARGS[0], from its head up to its tail, storing the result of each
+   in it and advancing the head past it.  Returns the number done. */
+static uint32_t sys_batch(uint32_t* args) {
+  struct batch_ring* ring = (struct batch_ring*)args[0];
+  unsigned head, tail;
+  int cnt = 0;
+
+  if (!check_user(ring, sizeof *ring, true))
+    exit_process(-1);
+  head = ring->head;
+  tail = ring->tail;
+  if (tail - head > BATCH_RING_SIZE)
+    exit_process(-1);
+
+  for (; head != tail; head++) {
+    struct batch_op* user_op = &ring->ops[head % BATCH_RING_SIZE];
+    struct batch_op op = *user_op;
+    struct file* file;
+
+    switch (op.op) {
+      case BATCH_READ:
+        if (!check_user(op.buf, op.len, true))
+          exit_process(-1);
+        op.result = read_fd(op.fd, op.buf, op.len);
+        break;
+      case BATCH_WRITE:
+        if (!check_user(op.buf, op.len, false))
+          exit_process(-1);
+        op.result = write_fd(op.fd, op.buf, op.len);
+        break;
+      case BATCH_SEEK:
+        file = process_fd_get(op.fd);
+        if (file != NULL)
+          file_seek(file, op.len);
+        op.result = file != NULL ? 0 : -1;
+        break;
+      default:
+        op.result = -1;
+        break;
+    }
+    user_op->result = op.result;
+    cnt++;
   }
+  ring->head = head;
+  return cnt;
 }
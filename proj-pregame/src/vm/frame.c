@@ -0,0 +1,442 @@
+#include "vm/frame.h"
+#include <debug.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "filesys/inode.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/page.h"
+#include "vm/swap.h"
+
+/* The frame table: every frame of the user pool that holds a
+   page, in the order the clock hand passes them.
+
+   When the pool runs out, a frame is evicted by the clock (or
+   second-chance) algorithm.  The hand sweeps the table, clearing
+   the accessed bit of each frame's page as it goes, and stops at
+   the first frame whose page was not accessed since the hand
+   last passed it.  That page is unmapped first, so that its
+   process faults on it rather than changing it, and then written
+   to swap if it cannot be read back as it is: if it was written
+   to, or holds no file data.  A page that would have to be
+   written finds no slot with the swap device full or absent, and
+   the hand moves on.  A page of a mapped file is written back to
+   the file instead, if it was written to.
+
+   A page that must be written takes with it the next few that
+   must be, as write_cluster() explains, so that eviction goes to
+   the disk once for a cluster of frames rather than once for
+   each.
+
+   A frame that holds a page of an executable just as it is in
+   the file is shared: every process running the file maps it,
+   read-only even where the page is writable, and it is found
+   through the shared frames by where in the file it came from.
+   The first write to such a page faults, and frame_unshare()
+   gives the writer a copy of its own, so processes share all
+   that they do not write.  A shared frame is never dirty, so it
+   is evicted by unmapping it from all of them.
+
+   A shared frame that the last process running the file lets go
+   of stays in the frame table, holding no page, as a cache of the
+   file for the next process to run it, such as another child
+   exec'd from the same binary.  The hand takes such a frame the
+   first time it passes, since nothing can have accessed it.  It
+   is found only at the inode version it was read at, so that it
+   is never used once the file has been written, or once the
+   inode has been closed and another opened at its address. */
+static struct list frames;
+static struct list_elem* hand; /* Next frame to look at. */
+static struct hash shared;    /* Shared frames, by inode and offset. */
+static struct kmem_cache* frame_cache;
+
+/* Most pages written to swap in one go. */
+#define CLUSTER_PAGES 8
+
+struct lock vm_lock;
+void* zero_kpage;
+
+static hash_hash_func shared_hash;
+static hash_less_func shared_less;
+static palloc_reclaim_func evict_frames;
+
+/* Initializes the frame table. */
+void frame_init(void) {
+  list_init(&frames);
+  hand = list_end(&frames);
+  if (!hash_init(&shared, shared_hash, shared_less, NULL))
+    PANIC("frame_init: out of memory");
+  frame_cache = kmem_cache_create("frame", sizeof(struct frame));
+  lock_init(&vm_lock);
+  zero_kpage = palloc_get_page(PAL_ASSERT | PAL_ZERO);
+  palloc_register_reclaim(PAL_USER, evict_frames);
+}
+
+/* Returns the page held by F, which is not shared. */
+static struct page* private_page(struct frame* f) {
+  ASSERT(f->inode == NULL);
+  return list_entry(list_front(&f->pages), struct page, frame_elem);
+}
+
+/* Returns the frame table element after E, wrapping around. */
+static struct list_elem* clock_next(struct list_elem* e) {
+  e = list_next(e);
+  return e != list_end(&frames) ? e : list_begin(&frames);
+}
+
+/* Takes frame F out of the frame table, moving the hand past it
+   if it is there. */
+static void detach(struct frame* f) {
+  struct list_elem* next = clock_next(&f->elem);
+
+  list_remove(&f->elem);
+  if (hand == &f->elem)
+    hand = next != &f->elem ? next : list_end(&frames);
+}
+
+/* Returns true if any page held by F was accessed since the hand
+   last passed it.  If CLEAR is true, clears the accessed bits for
+   next time. */
+static bool accessed(struct frame* f, bool clear) {
+  bool any = false;
+  struct list_elem* e;
+
+  for (e = list_begin(&f->pages); e != list_end(&f->pages); e = list_next(e)) {
+    struct page* page = list_entry(e, struct page, frame_elem);
+    if (pagedir_is_accessed(page->pagedir, page->upage)) {
+      if (clear)
+        pagedir_set_accessed(page->pagedir, page->upage, false);
+      any = true;
+    }
+  }
+  return any;
+}
+
+/* Returns true if F holds a page that would have to be written
+   to swap, according to its PTE. */
+static bool must_save(struct frame* f) {
+  struct page* page;
+
+  if (f->inode != NULL)
+    return false;
+  page = private_page(f);
+  if (page->kind == PAGE_MMAP)
+    return false;
+  return pagedir_is_dirty(page->pagedir, page->upage) || page->kind == PAGE_SWAP;
+}
+
+/* Takes frame F out of the frame table and unmaps its pages, so
+   that their processes fault on them rather than changing them.
+   Returns true if the page must be written to swap before F can
+   be reused: if it was written to, or holds no file data.  A page
+   of a mapped file is written back to the file here instead. */
+static bool take(struct frame* f) {
+  struct list_elem* e;
+
+  detach(f);
+  if (f->inode != NULL)
+    hash_delete(&shared, &f->share_elem);
+  for (e = list_begin(&f->pages); e != list_end(&f->pages); e = list_next(e)) {
+    struct page* page = list_entry(e, struct page, frame_elem);
+    pagedir_clear_page(page->pagedir, page->upage);
+    if (page->kind == PAGE_MMAP)
+      page_write_back(page, f->kpage);
+  }
+  return must_save(f);
+}
+
+/* Marks the pages of frame F, which take() unmapped, as being out
+   of memory.  F is left holding none. */
+static void drop(struct frame* f) {
+  while (!list_empty(&f->pages)) {
+    struct page* page = list_entry(list_pop_front(&f->pages), struct page, frame_elem);
+    page->frame = NULL;
+  }
+  f->inode = NULL;
+}
+
+/* Maps the page of frame F back as take() found it, but
+   accessed, so that the hand passes it over next time round,
+   and puts F back in the frame table. */
+static void put_back(struct frame* f) {
+  struct page* page = private_page(f);
+
+  pagedir_set_page(page->pagedir, page->upage, f->kpage, page->writable);
+  pagedir_set_dirty(page->pagedir, page->upage, true);
+  pagedir_set_accessed(page->pagedir, page->upage, true);
+  list_push_back(&frames, &f->elem);
+}
+
+/* Records that the page of frame F is in swap SLOT. */
+static void swapped(struct frame* f, size_t slot) {
+  struct page* page = private_page(f);
+
+  page->kind = PAGE_SWAP;
+  page->swap_slot = slot;
+  drop(f);
+}
+
+/* Frees frame F, which is in no table. */
+static void release(struct frame* f) {
+  palloc_free_page(f->kpage);
+  kmem_cache_free(frame_cache, f);
+}
+
+/* Writes the page of VICTIM, which take() said must be saved, to
+   swap, along with those of up to CLUSTER_PAGES - 1 more frames
+   that the hand would take after it and that must be saved too.
+   They go to adjacent slots in one sweep, so the next several
+   evictions find a free frame without touching the disk.
+   Returns the first frame whose page was written, now free for
+   reuse, having freed the rest, or a null pointer if none could
+   be written for want of swap space. */
+static struct frame* write_cluster(struct frame* victim) {
+  struct frame* cluster[CLUSTER_PAGES];
+  void* kpages[CLUSTER_PAGES];
+  struct frame* first = NULL;
+  size_t cnt = 1;
+  size_t looked, slot, i;
+
+  /* Pick the frames ahead of the hand whose pages it would neither
+     spare as accessed nor drop as clean.  A dirty bit, once set,
+     stays set, so take() cannot find such a page clean. */
+  cluster[0] = victim;
+  for (looked = 0; cnt < CLUSTER_PAGES && looked < 2 * CLUSTER_PAGES && !list_empty(&frames);
+       looked++) {
+    struct frame* f;
+
+    if (hand == list_end(&frames))
+      hand = list_begin(&frames);
+    f = list_entry(hand, struct frame, elem);
+    if (must_save(f) && !accessed(f, false)) {
+      take(f);
+      cluster[cnt++] = f;
+    } else
+      hand = clock_next(hand);
+  }
+  for (i = 0; i < cnt; i++)
+    kpages[i] = cluster[i]->kpage;
+
+  /* Without a run of free slots that long, write them one by one
+     wherever they fit, and put back what does not. */
+  slot = swap_out(kpages, cnt);
+  for (i = 0; i < cnt; i++) {
+    size_t s = slot != SWAP_ERROR ? slot + i : swap_out(&kpages[i], 1);
+
+    if (s == SWAP_ERROR)
+      put_back(cluster[i]);
+    else {
+      swapped(cluster[i], s);
+      if (first == NULL)
+        first = cluster[i];
+      else
+        release(cluster[i]);
+    }
+  }
+  return first;
+}
+
+/* Takes a frame from the frame table by the clock algorithm and
+   returns it, no longer in the table and holding no page, or
+   returns a null pointer if no page can be evicted. */
+static struct frame* clock_evict(void) {
+  size_t looked;
+
+  /* Twice around clears every accessed bit, so a third pass
+     fails only if no page can be written out at all. */
+  for (looked = 0; looked < 3 * list_size(&frames); looked++) {
+    struct frame* f;
+
+    if (list_empty(&frames))
+      break;
+    if (hand == list_end(&frames))
+      hand = list_begin(&frames);
+    f = list_entry(hand, struct frame, elem);
+
+    if (accessed(f, true))
+      hand = clock_next(hand);
+    else if (!take(f)) {
+      drop(f);
+      return f;
+    } else {
+      f = write_cluster(f);
+      if (f != NULL)
+        return f;
+    }
+  }
+  return NULL;
+}
+
+/* Returns a new frame from the user pool, outside the frame
+   table, or a null pointer if the pool is out of frames. */
+static struct frame* new_frame(void) {
+  void* kpage = palloc_get_page(PAL_USER);
+  struct frame* f;
+
+  if (kpage == NULL)
+    return NULL;
+  f = kmem_cache_alloc(frame_cache);
+  if (f == NULL) {
+    palloc_free_page(kpage);
+    return NULL;
+  }
+  f->kpage = kpage;
+  return f;
+}
+
+/* Enters frame F in the frame table, holding just PAGE. */
+static struct frame* install(struct frame* f, struct page* page) {
+  list_init(&f->pages);
+  list_push_back(&f->pages, &page->frame_elem);
+  f->inode = NULL;
+  list_push_back(&frames, &f->elem);
+  return f;
+}
+
+/* Returns a frame for PAGE, evicting another page if the user
+   pool is out of frames, or a null pointer if none can be had.
+   vm_lock must be held. */
+struct frame* frame_alloc(struct page* page) {
+  struct frame* f;
+
+  ASSERT(lock_held_by_current_thread(&vm_lock));
+
+  f = new_frame();
+  if (f == NULL)
+    f = clock_evict();
+  return f != NULL ? install(f, page) : NULL;
+}
+
+/* Evicts up to PAGE_CNT frames and gives them back to the user
+   pool, when it runs low.  Does nothing if vm_lock is held, by
+   the current thread, which evicts for itself as it needs to, or
+   by another. */
+static size_t evict_frames(size_t page_cnt) {
+  size_t freed = 0;
+
+  if (lock_held_by_current_thread(&vm_lock) || !lock_try_acquire(&vm_lock))
+    return 0;
+  while (freed < page_cnt) {
+    struct frame* f = clock_evict();
+    if (f == NULL)
+      break;
+    release(f);
+    freed++;
+  }
+  lock_release(&vm_lock);
+  return freed;
+}
+
+/* Returns a frame for PAGE if the user pool has one free, or a
+   null pointer without evicting anything if it does not.
+   vm_lock must be held. */
+struct frame* frame_try_alloc(struct page* page) {
+  struct frame* f;
+
+  ASSERT(lock_held_by_current_thread(&vm_lock));
+
+  f = new_frame();
+  return f != NULL ? install(f, page) : NULL;
+}
+
+/* Makes frame F, which holds one page and has just been filled
+   from INODE at offset OFS, available to frame_find_shared().
+   Its pages must be mapped read-only from now on.  vm_lock must
+   be held. */
+void frame_share(struct frame* f, struct inode* inode, off_t ofs) {
+  ASSERT(lock_held_by_current_thread(&vm_lock));
+  ASSERT(f->inode == NULL);
+
+  f->inode = inode;
+  f->version = inode_version(inode);
+  f->ofs = ofs;
+  if (hash_insert(&shared, &f->share_elem) != NULL)
+    f->inode = NULL;
+}
+
+/* Returns the shared frame that holds the page of INODE at offset
+   OFS, having added PAGE to the pages that it holds, or a null
+   pointer if there is none.  vm_lock must be held. */
+struct frame* frame_find_shared(struct page* page, struct inode* inode, off_t ofs) {
+  struct frame key;
+  struct hash_elem* e;
+  struct frame* f;
+
+  ASSERT(lock_held_by_current_thread(&vm_lock));
+
+  key.inode = inode;
+  key.version = inode_version(inode);
+  key.ofs = ofs;
+  e = hash_find(&shared, &key.share_elem);
+  if (e == NULL)
+    return NULL;
+  f = hash_entry(e, struct frame, share_elem);
+  list_push_back(&f->pages, &page->frame_elem);
+  return f;
+}
+
+/* Gives PAGE, which is held by a shared frame, a frame of its own
+   with the same contents, and returns it, or a null pointer if
+   none can be had.  PAGE is left unmapped, and the caller must
+   map it writable.  If PAGE is the only page the frame holds, it
+   keeps the frame instead, which stops being shared, and stays
+   mapped read-only.  vm_lock must be held. */
+struct frame* frame_unshare(struct page* page) {
+  struct frame* old = page->frame;
+  struct frame* f;
+
+  ASSERT(lock_held_by_current_thread(&vm_lock));
+  ASSERT(old->inode != NULL);
+
+  if (list_size(&old->pages) == 1) {
+    hash_delete(&shared, &old->share_elem);
+    old->inode = NULL;
+    return old;
+  }
+
+  /* Keep the hand off the frame being copied while another is
+     found for the copy. */
+  detach(old);
+  pagedir_clear_page(page->pagedir, page->upage);
+  list_remove(&page->frame_elem);
+  f = frame_alloc(page);
+  if (f != NULL)
+    memcpy(f->kpage, old->kpage, PGSIZE);
+  else
+    page->frame = NULL;
+  list_push_back(&frames, &old->elem);
+  return f;
+}
+
+/* Drops PAGE's hold on frame F, freeing F if no other page holds
+   it, unless F is shared and so stays cached for the next process
+   to run the file.  PAGE must already be unmapped.  vm_lock must
+   be held. */
+void frame_free(struct frame* f, struct page* page) {
+  ASSERT(lock_held_by_current_thread(&vm_lock));
+
+  list_remove(&page->frame_elem);
+  page->frame = NULL;
+  if (!list_empty(&f->pages) || f->inode != NULL)
+    return;
+
+  detach(f);
+  release(f);
+}
+
+/* Returns a hash value for the shared frame at E. */
+static unsigned shared_hash(const struct hash_elem* e, void* aux UNUSED) {
+  const struct frame* f = hash_entry(e, struct frame, share_elem);
+  return hash_u32((uintptr_t)f->inode) ^ hash_int(f->version) ^ hash_int(f->ofs);
+}
+
+/* Returns true if the shared frame at A precedes the one at B. */
+static bool shared_less(const struct hash_elem* a_, const struct hash_elem* b_,
+                        void* aux UNUSED) {
+  const struct frame* a = hash_entry(a_, struct frame, share_elem);
+  const struct frame* b = hash_entry(b_, struct frame, share_elem);
+  if (a->inode != b->inode)
+    return a->inode < b->inode;
+  return a->version != b->version ? a->version < b->version : a->ofs < b->ofs;
+}
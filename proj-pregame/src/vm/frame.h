@@ -0,0 +1,44 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+
+#include <hash.h>
+#include <list.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
+#include "threads/synch.h"
+
+struct inode;
+struct page;
+
+/* A frame of the user pool that holds a page of some process, or
+   the same page of every process running an executable. */
+struct frame {
+  struct list_elem elem;       /* In the frame table. */
+  struct hash_elem share_elem; /* In the shared frames, if shared. */
+  void* kpage;                 /* Kernel virtual address of the frame. */
+  struct list pages;           /* Pages it holds, by their frame_elem. */
+
+  /* For a shared frame, where its contents came from; INODE is a
+     null pointer for a frame that is not shared. */
+  struct inode* inode;
+  unsigned version; /* INODE's version when they were read. */
+  off_t ofs;
+};
+
+/* Serializes all paging: faults, eviction and tearing down
+   address spaces. */
+extern struct lock vm_lock;
+
+/* A frame of zeros, mapped read-only by pages of zeros that have
+   not been written yet.  It is in no table and never freed. */
+extern void* zero_kpage;
+
+void frame_init(void);
+struct frame* frame_alloc(struct page*);
+struct frame* frame_try_alloc(struct page*);
+void frame_share(struct frame*, struct inode*, off_t);
+struct frame* frame_find_shared(struct page*, struct inode*, off_t);
+struct frame* frame_unshare(struct page*);
+void frame_free(struct frame*, struct page*);
+
+#endif /* vm/frame.h */
@@ -0,0 +1,103 @@
+#include "vm/mmap.h"
+#include <debug.h>
+#include <round.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/process.h"
+#include "vm/page.h"
+
+/* Memory-mapped files.  A mapping is a run of PAGE_MMAP pages in
+   the supplemental page table, read from the file on demand like
+   the pages of the executable.  A page that is written to goes
+   back to the file rather than to swap, when it is evicted or
+   unmapped, and a page that is not is simply dropped. */
+
+/* Maps FILE into the current process's address space, starting
+   at ADDR, and returns the mapping's id.  Returns MAP_FAILED if
+   ADDR is null or not page-aligned, if the file is empty, if any
+   page of it would overlap a page already in use, or if memory
+   is not available.  The mapping uses its own reopening of FILE,
+   so closing FILE leaves it in place. */
+mapid_t mmap_map(struct file* file, void* addr) {
+  struct process* pcb = thread_current()->pcb;
+  struct mapping* m;
+  off_t length;
+  size_t i;
+
+  length = file_length(file);
+  if (addr == NULL || pg_ofs(addr) != 0 || length == 0)
+    return MAP_FAILED;
+  if (!is_user_vaddr(addr) || (uintptr_t)PHYS_BASE - (uintptr_t)addr < (uintptr_t)length)
+    return MAP_FAILED;
+
+  m = malloc(sizeof *m);
+  if (m == NULL)
+    return MAP_FAILED;
+  m->file = file_reopen(file);
+  if (m->file == NULL) {
+    free(m);
+    return MAP_FAILED;
+  }
+  m->base = addr;
+  m->page_cnt = DIV_ROUND_UP(length, PGSIZE);
+
+  for (i = 0; i < m->page_cnt; i++) {
+    off_t ofs = i * PGSIZE;
+    size_t read_bytes = length - ofs < PGSIZE ? length - ofs : PGSIZE;
+
+    if (!page_add_mmap((uint8_t*)addr + ofs, m->file, ofs, read_bytes)) {
+      while (i-- > 0)
+        page_remove((uint8_t*)addr + i * PGSIZE);
+      file_close(m->file);
+      free(m);
+      return MAP_FAILED;
+    }
+  }
+
+  m->id = pcb->next_mapid++;
+  list_push_back(&pcb->mappings, &m->elem);
+  return m->id;
+}
+
+/* Removes mapping M, writing back the pages that were written
+   to, and frees it. */
+static void unmap(struct mapping* m) {
+  size_t i;
+
+  for (i = 0; i < m->page_cnt; i++)
+    page_remove((uint8_t*)m->base + i * PGSIZE);
+  list_remove(&m->elem);
+  file_close(m->file);
+  free(m);
+}
+
+/* Removes the current process's mapping MAPID, writing back the
+   pages that were written to.  Does nothing if there is no such
+   mapping. */
+void mmap_unmap(mapid_t mapid) {
+  struct list* mappings = &thread_current()->pcb->mappings;
+  struct list_elem* e;
+
+  for (e = list_begin(mappings); e != list_end(mappings); e = list_next(e)) {
+    struct mapping* m = list_entry(e, struct mapping, elem);
+    if (m->id == mapid) {
+      unmap(m);
+      return;
+    }
+  }
+}
+
+/* Removes all of the current process's mappings.  Called by
+   page_table_destroy(), after it has written back and freed the
+   pages, so only the files and the mappings are left to free. */
+void mmap_destroy(void) {
+  struct list* mappings = &thread_current()->pcb->mappings;
+
+  while (!list_empty(mappings)) {
+    struct mapping* m = list_entry(list_pop_front(mappings), struct mapping, elem);
+    file_close(m->file);
+    free(m);
+  }
+}
@@ -0,0 +1,25 @@
+#ifndef VM_MMAP_H
+#define VM_MMAP_H
+
+#include <list.h>
+
+struct file;
+
+/* Identifies a mapping of a file into a process's memory. */
+typedef int mapid_t;
+#define MAP_FAILED ((mapid_t)-1)
+
+/* A file mapped into the current process's address space. */
+struct mapping {
+  struct list_elem elem; /* In struct process's mappings. */
+  mapid_t id;
+  struct file* file; /* Reopened, so it outlives the caller's. */
+  void* base;        /* First page. */
+  size_t page_cnt;
+};
+
+mapid_t mmap_map(struct file*, void* addr);
+void mmap_unmap(mapid_t);
+void mmap_destroy(void);
+
+#endif /* vm/mmap.h */
@@ -0,0 +1,397 @@
+#include "vm/page.h"
+#include <debug.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "userprog/process.h"
+#include "vm/frame.h"
+#include "vm/mmap.h"
+#include "vm/swap.h"
+
+/* Supplemental page tables.  Each process's records every page
+   of its address space, whether or not it is in memory, and
+   where to find its contents when it is not.  Nothing is read or
+   zeroed until the process first touches a page: the fault lands
+   in page_fault_in(), which finds a frame for the page, fills it
+   and maps it.  A page of zeros that is first read rather than
+   written maps the zero frame read-only instead, and takes a
+   frame of its own only when it is written, so untouched BSS,
+   heap and stack read before being written cost neither a frame
+   nor the zeroing of one.
+
+   The tables are protected by vm_lock, like the frame table,
+   since eviction changes the pages of other processes. */
+
+/* How far below the stack pointer an access may fault and still
+   be taken for the stack growing.  PUSHA writes 32 bytes below
+   the stack pointer before it moves it. */
+#define STACK_SLACK 32
+
+/* -stack: Most pages the user stack may grow to. */
+size_t stack_page_limit = MAX_STACK_PAGES;
+
+/* Most pages read in after one faulted in from swap. */
+#define PREFETCH_PAGES 4
+
+static hash_hash_func page_hash;
+static hash_less_func page_less;
+
+/* Creates the current process's supplemental page table.
+   Returns false if memory is not available. */
+bool page_table_init(void) {
+  struct process* pcb = thread_current()->pcb;
+
+  list_init(&pcb->mappings);
+  pcb->next_mapid = 0;
+  return hash_init(&pcb->pages, page_hash, page_less, NULL);
+}
+
+/* Writes PAGE, a page of a mapped file, from the frame at KPAGE
+   back to the file, if it was written to since it was read.  The
+   page must be unmapped already, so that it cannot change after
+   it was written.  vm_lock must be held. */
+void page_write_back(struct page* page, void* kpage) {
+  ASSERT(page->kind == PAGE_MMAP);
+
+  if (pagedir_is_dirty(page->pagedir, page->upage))
+    file_write_at(page->file, kpage, page->read_bytes, page->ofs);
+}
+
+/* Returns true if PAGE maps the zero frame, read-only, as a page
+   of zeros not yet written does.  vm_lock must be held. */
+static bool maps_zero(struct page* page) {
+  return page->frame == NULL && pagedir_get_page(page->pagedir, page->upage) == zero_kpage;
+}
+
+/* Frees the page at E and its swap slot, and lets go of its
+   frame, having written it back first if it is a page of a
+   mapped file. */
+static void page_destroy(struct hash_elem* e, void* aux UNUSED) {
+  struct page* page = hash_entry(e, struct page, elem);
+
+  if (page->frame != NULL) {
+    pagedir_clear_page(page->pagedir, page->upage);
+    if (page->kind == PAGE_MMAP)
+      page_write_back(page, page->frame->kpage);
+    frame_free(page->frame, page);
+  } else if (maps_zero(page))
+    pagedir_clear_page(page->pagedir, page->upage);
+  else if (page->kind == PAGE_SWAP)
+    swap_free(page->swap_slot);
+  free(page);
+}
+
+/* Frees the current process's supplemental page table, with all
+   of its frames and swap slots, and its file mappings.  Must be
+   called before the process's page directory is destroyed. */
+void page_table_destroy(void) {
+  struct hash* pages = &thread_current()->pcb->pages;
+
+  /* Nothing to do if page_table_init() failed. */
+  if (pages->buckets == NULL)
+    return;
+
+  lock_acquire(&vm_lock);
+  hash_destroy(pages, page_destroy);
+  lock_release(&vm_lock);
+  mmap_destroy();
+}
+
+/* Adds a page at UPAGE to the current process's supplemental
+   page table.  vm_lock must be held.  Returns the page, or a
+   null pointer if memory is not available or UPAGE is taken. */
+static struct page* page_add(void* upage, bool writable, enum page_kind kind) {
+  struct page* page;
+
+  ASSERT(lock_held_by_current_thread(&vm_lock));
+  ASSERT(pg_ofs(upage) == 0);
+
+  page = malloc(sizeof *page);
+  if (page == NULL)
+    return NULL;
+  page->upage = upage;
+  page->pagedir = thread_current()->pcb->pagedir;
+  page->writable = writable;
+  page->kind = kind;
+  page->frame = NULL;
+  if (hash_insert(&thread_current()->pcb->pages, &page->elem) != NULL) {
+    free(page);
+    return NULL;
+  }
+  return page;
+}
+
+/* Adds a page at UPAGE whose first READ_BYTES bytes are to be
+   read from the current process's executable at offset OFS,
+   and the rest zeroed.  Returns false if memory is not available
+   or UPAGE is taken. */
+bool page_add_file(void* upage, off_t ofs, size_t read_bytes, bool writable) {
+  struct page* page;
+
+  ASSERT(read_bytes <= PGSIZE);
+
+  lock_acquire(&vm_lock);
+  page = page_add(upage, writable, read_bytes > 0 ? PAGE_FILE : PAGE_ZERO);
+  if (page != NULL) {
+    page->ofs = ofs;
+    page->read_bytes = read_bytes;
+  }
+  lock_release(&vm_lock);
+  return page != NULL;
+}
+
+/* Adds a page at UPAGE of the mapped FILE, whose first
+   READ_BYTES bytes are to be read from FILE at offset OFS, and
+   the rest zeroed.  Returns false if memory is not available or
+   UPAGE is taken. */
+bool page_add_mmap(void* upage, struct file* file, off_t ofs, size_t read_bytes) {
+  struct page* page;
+
+  ASSERT(read_bytes <= PGSIZE);
+
+  lock_acquire(&vm_lock);
+  page = page_add(upage, true, PAGE_MMAP);
+  if (page != NULL) {
+    page->file = file;
+    page->ofs = ofs;
+    page->read_bytes = read_bytes;
+  }
+  lock_release(&vm_lock);
+  return page != NULL;
+}
+
+/* Removes the page at UPAGE from the current process's
+   supplemental page table, as page_destroy() frees it. */
+void page_remove(void* upage) {
+  struct page key;
+  struct hash_elem* e;
+
+  lock_acquire(&vm_lock);
+  key.upage = upage;
+  e = hash_delete(&thread_current()->pcb->pages, &key.elem);
+  if (e != NULL)
+    page_destroy(e, NULL);
+  lock_release(&vm_lock);
+}
+
+/* Adds a page of zeros at UPAGE.  Returns false if memory is not
+   available or UPAGE is taken. */
+bool page_add_zero(void* upage, bool writable) {
+  struct page* page;
+
+  lock_acquire(&vm_lock);
+  page = page_add(upage, writable, PAGE_ZERO);
+  lock_release(&vm_lock);
+  return page != NULL;
+}
+
+/* Reads in the swapped-out pages that follow PAGE, which is
+   being read from swap slot SLOT, for as long as each is in the
+   slot after the last and a frame is free for it.  Pages evicted
+   together went to adjacent slots, in address order if they were
+   adjacent, so these are likely to be wanted soon and cost little
+   more than PAGE to read.  They are mapped unaccessed, so the
+   clock takes them back first if they are not. */
+static void prefetch(struct page* page, size_t slot) {
+  struct hash* pages = &thread_current()->pcb->pages;
+  size_t i;
+
+  for (i = 1; i <= PREFETCH_PAGES; i++) {
+    struct page key;
+    struct hash_elem* e;
+    struct page* next;
+    struct frame* f;
+
+    key.upage = (uint8_t*)page->upage + i * PGSIZE;
+    if (!is_user_vaddr(key.upage))
+      break;
+    e = hash_find(pages, &key.elem);
+    if (e == NULL)
+      break;
+    next = hash_entry(e, struct page, elem);
+    if (next->frame != NULL || next->kind != PAGE_SWAP || next->swap_slot != slot + i)
+      break;
+    f = frame_try_alloc(next);
+    if (f == NULL)
+      break;
+
+    swap_read(next->swap_slot, f->kpage);
+    if (!pagedir_set_page(next->pagedir, next->upage, f->kpage, next->writable)) {
+      frame_free(f, next);
+      break;
+    }
+    swap_free(next->swap_slot);
+    next->frame = f;
+  }
+}
+
+/* Brings PAGE into a frame and maps it, for writing if WRITE is
+   true.  A page of the executable goes in the frame that other
+   processes running it share, if there is one, and becomes
+   shared itself otherwise.  A page of zeros maps the zero frame
+   unless it is being written.  vm_lock must be held. */
+static bool page_load(struct page* page, bool write) {
+  struct file* executable = thread_current()->pcb->executable;
+  struct inode* inode = NULL;
+  struct frame* f = NULL;
+
+  if (page->kind == PAGE_ZERO && !write)
+    return maps_zero(page) || pagedir_set_page(page->pagedir, page->upage, zero_kpage, false);
+  if (maps_zero(page))
+    pagedir_clear_page(page->pagedir, page->upage);
+
+  if (page->kind == PAGE_FILE) {
+    inode = file_get_inode(executable);
+    f = frame_find_shared(page, inode, page->ofs);
+  }
+  if (f == NULL) {
+    f = frame_alloc(page);
+    if (f == NULL)
+      return false;
+
+    switch (page->kind) {
+      case PAGE_FILE:
+        if (file_read_at(executable, f->kpage, page->read_bytes, page->ofs) !=
+            (off_t)page->read_bytes) {
+          frame_free(f, page);
+          return false;
+        }
+        memset((uint8_t*)f->kpage + page->read_bytes, 0, PGSIZE - page->read_bytes);
+        frame_share(f, inode, page->ofs);
+        break;
+      case PAGE_ZERO:
+        memset(f->kpage, 0, PGSIZE);
+        break;
+      case PAGE_MMAP:
+        if (file_read_at(page->file, f->kpage, page->read_bytes, page->ofs) !=
+            (off_t)page->read_bytes) {
+          frame_free(f, page);
+          return false;
+        }
+        memset((uint8_t*)f->kpage + page->read_bytes, 0, PGSIZE - page->read_bytes);
+        break;
+      case PAGE_SWAP:
+        swap_read(page->swap_slot, f->kpage);
+        break;
+    }
+  }
+
+  /* A shared frame is mapped read-only, so that a write faults
+     and page_fault_write() copies it. */
+  if (!pagedir_set_page(page->pagedir, page->upage, f->kpage,
+                        page->writable && f->inode == NULL)) {
+    frame_free(f, page);
+    return false;
+  }
+  page->frame = f;
+  if (page->kind == PAGE_SWAP) {
+    swap_free(page->swap_slot);
+    prefetch(page, page->swap_slot);
+  }
+  return true;
+}
+
+/* Returns true if a fault at FAULT_ADDR, with the user stack
+   pointer at ESP, is the stack growing.  setup_stack() records
+   only the top page, and every other page of stack is added this
+   way, so a stack costs a frame for each page that has been
+   touched, up to stack_page_limit pages. */
+static bool is_stack_growth(const void* fault_addr, const void* esp) {
+  return esp != NULL && (const uint8_t*)fault_addr >= (const uint8_t*)esp - STACK_SLACK &&
+         (uintptr_t)PHYS_BASE - (uintptr_t)fault_addr <= stack_page_limit * PGSIZE;
+}
+
+/* Handles a fault on the not-present page at FAULT_ADDR, which
+   was being written if WRITE is true, by loading it into memory,
+   or by adding a page of stack if the fault is just below ESP,
+   the user stack pointer, which is a null pointer if it is not
+   known.  Returns false if FAULT_ADDR is not in the current
+   process's address space or the page cannot be loaded. */
+bool page_fault_in(void* fault_addr, void* esp, bool write) {
+  struct process* pcb = thread_current()->pcb;
+  struct page key;
+  struct hash_elem* e;
+  struct page* page;
+  bool success = true;
+
+  if (pcb == NULL || !is_user_vaddr(fault_addr))
+    return false;
+
+  lock_acquire(&vm_lock);
+  key.upage = pg_round_down(fault_addr);
+  e = hash_find(&pcb->pages, &key.elem);
+  if (e != NULL)
+    page = hash_entry(e, struct page, elem);
+  else if (is_stack_growth(fault_addr, esp))
+    page = page_add(key.upage, true, PAGE_ZERO);
+  else
+    page = NULL;
+
+  /* Another thread of the process may have brought it in. */
+  if (page == NULL || (page->frame == NULL && !page_load(page, write)))
+    success = false;
+  lock_release(&vm_lock);
+
+  return success;
+}
+
+/* Handles a write fault on the present, read-only page at
+   FAULT_ADDR.  If the page is writable but shares its frame, or
+   maps the zero frame, gives it a frame of its own and maps that
+   writable.  Returns false if the page may not be written or no
+   frame can be had. */
+bool page_fault_write(void* fault_addr) {
+  struct process* pcb = thread_current()->pcb;
+  struct page key;
+  struct hash_elem* e;
+  struct page* page;
+  struct frame* old;
+  struct frame* f;
+  bool success = false;
+
+  if (pcb == NULL || !is_user_vaddr(fault_addr))
+    return false;
+
+  lock_acquire(&vm_lock);
+  key.upage = pg_round_down(fault_addr);
+  e = hash_find(&pcb->pages, &key.elem);
+  page = e != NULL ? hash_entry(e, struct page, elem) : NULL;
+  if (page != NULL && page->writable) {
+    /* Unless another thread of the process got here first, or
+       the page was evicted meanwhile, in which case the write is
+       simply tried again. */
+    if (maps_zero(page))
+      success = page_load(page, true);
+    else if (page->frame == NULL || page->frame->inode == NULL)
+      success = true;
+    else {
+      old = page->frame;
+      f = frame_unshare(page);
+      if (f == old) {
+        pagedir_set_writable(page->pagedir, page->upage, true);
+        success = true;
+      } else if (f != NULL && pagedir_set_page(page->pagedir, page->upage, f->kpage, true)) {
+        page->frame = f;
+        success = true;
+      } else if (f != NULL)
+        frame_free(f, page);
+    }
+  }
+  lock_release(&vm_lock);
+
+  return success;
+}
+
+/* Returns a hash value for the page at E. */
+static unsigned page_hash(const struct hash_elem* e, void* aux UNUSED) {
+  const struct page* page = hash_entry(e, struct page, elem);
+  return hash_u32((uintptr_t)page->upage);
+}
+
+/* Returns true if the page at A precedes the one at B. */
+static bool page_less(const struct hash_elem* a, const struct hash_elem* b, void* aux UNUSED) {
+  return hash_entry(a, struct page, elem)->upage < hash_entry(b, struct page, elem)->upage;
+}
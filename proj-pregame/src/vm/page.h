@@ -0,0 +1,54 @@
+#ifndef VM_PAGE_H
+#define VM_PAGE_H
+
+#include <hash.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
+
+struct file;
+struct frame;
+
+/* Where a page's contents are while it is not in memory. */
+enum page_kind {
+  PAGE_FILE, /* In the executable, followed by zeros. */
+  PAGE_ZERO, /* All zeros. */
+  PAGE_SWAP, /* In a swap slot. */
+  PAGE_MMAP  /* In a mapped file, and written back there. */
+};
+
+/* A page of a process's address space, in its supplemental page
+   table. */
+struct page {
+  struct hash_elem elem;       /* In struct process's pages. */
+  void* upage;                 /* User virtual address. */
+  uint32_t* pagedir;           /* Page directory it is mapped in. */
+  bool writable;               /* May the process write to it? */
+  enum page_kind kind;         /* Where its contents are when not in a frame. */
+  struct frame* frame;         /* Frame holding it, or a null pointer. */
+  struct list_elem frame_elem; /* In the frame's pages. */
+
+  /* For PAGE_FILE and PAGE_MMAP. */
+  struct file* file; /* The mapped file, for PAGE_MMAP. */
+  off_t ofs;         /* Offset in the executable or the file. */
+  size_t read_bytes; /* Bytes to read; the rest are zeroed. */
+
+  /* For PAGE_SWAP. */
+  size_t swap_slot; /* Slot holding it. */
+};
+
+extern size_t stack_page_limit;
+
+bool page_table_init(void);
+void page_table_destroy(void);
+bool page_add_file(void* upage, off_t ofs, size_t read_bytes, bool writable);
+bool page_add_zero(void* upage, bool writable);
+bool page_add_mmap(void* upage, struct file*, off_t ofs, size_t read_bytes);
+void page_remove(void* upage);
+void page_write_back(struct page*, void* kpage);
+bool page_fault_in(void* fault_addr, void* esp, bool write);
+bool page_fault_write(void* fault_addr);
+
+#endif /* vm/page.h */
@@ -0,0 +1,69 @@
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <stdio.h>
+#include "devices/block.h"
+#include "threads/vaddr.h"
+#include "vm/frame.h"
+
+/* Swap space.  The swap device is divided into page-sized
+   slots, and a bitmap records which are in use.  All of it is
+   protected by vm_lock.  With no swap device there are no slots,
+   and only pages that can be read back from their file can be
+   evicted.
+
+   Pages evicted together are written to a run of adjacent slots,
+   so that writing them out, and reading them back in if they are
+   faulted in together as well, is one sweep of the disk. */
+
+/* Sectors in a slot. */
+#define SLOT_SECTORS (PGSIZE / BLOCK_SECTOR_SIZE)
+
+static struct block* swap_device;
+static struct bitmap* used_slots; /* Slots in use. */
+
+/* Sets up swap space on the swap device, if there is one. */
+void swap_init(void) {
+  swap_device = block_get_role(BLOCK_SWAP);
+  if (swap_device == NULL)
+    return;
+
+  used_slots = bitmap_create(block_size(swap_device) / SLOT_SECTORS);
+  if (used_slots == NULL)
+    PANIC("swap_init: out of memory");
+  printf("swap: %zu slots on %s.\n", bitmap_size(used_slots), block_name(swap_device));
+}
+
+/* Writes the CNT pages at KPAGES to a run of CNT free slots, in
+   order, and returns the first slot, or SWAP_ERROR if there is
+   no such run. */
+size_t swap_out(void* const kpages[], size_t cnt) {
+  size_t slot, i;
+
+  ASSERT(lock_held_by_current_thread(&vm_lock));
+
+  if (used_slots == NULL)
+    return SWAP_ERROR;
+  slot = bitmap_scan_and_flip(used_slots, 0, cnt, false);
+  if (slot == BITMAP_ERROR)
+    return SWAP_ERROR;
+
+  for (i = 0; i < cnt; i++)
+    block_write_multiple(swap_device, (slot + i) * SLOT_SECTORS, SLOT_SECTORS, kpages[i]);
+  return slot;
+}
+
+/* Reads SLOT into the page at KPAGE.  The slot stays in use. */
+void swap_read(size_t slot, void* kpage) {
+  ASSERT(lock_held_by_current_thread(&vm_lock));
+  ASSERT(bitmap_test(used_slots, slot));
+
+  block_read_multiple(swap_device, slot * SLOT_SECTORS, SLOT_SECTORS, kpage);
+}
+
+/* Frees SLOT. */
+void swap_free(size_t slot) {
+  ASSERT(lock_held_by_current_thread(&vm_lock));
+  ASSERT(bitmap_test(used_slots, slot));
+  bitmap_reset(used_slots, slot);
+}
@@ -0,0 +1,15 @@
+#ifndef VM_SWAP_H
+#define VM_SWAP_H
+
+#include <stddef.h>
+#include <bitmap.h>
+
+/* Returned by swap_out() when no slot is free. */
+#define SWAP_ERROR BITMAP_ERROR
+
+void swap_init(void);
+size_t swap_out(void* const kpages[], size_t cnt);
+void swap_read(size_t slot, void* kpage);
+void swap_free(size_t slot);
+
+#endif /* vm/swap.h */